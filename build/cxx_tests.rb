@@ -37,17 +37,28 @@ TEST_CXX_OBJECTS = {
     "test/cxx/Core/ApplicationPool/ProcessTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/Core/ApplicationPool/PoolTest.o" =>
     "test/cxx/Core/ApplicationPool/PoolTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/Core/ApplicationPool/CapacitySharesTest.o" =>
+    "test/cxx/Core/ApplicationPool/CapacitySharesTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/Core/SpawningKit/DirectSpawnerTest.o" =>
     "test/cxx/Core/SpawningKit/DirectSpawnerTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/Core/SpawningKit/SmartSpawnerTest.o" =>
     "test/cxx/Core/SpawningKit/SmartSpawnerTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/Core/SpawningKit/ShellEnvvarsCacheTest.o" =>
+    "test/cxx/Core/SpawningKit/ShellEnvvarsCacheTest.cpp",
 
   "#{TEST_OUTPUT_DIR}cxx/Core/UnionStationTest.o" =>
     "test/cxx/Core/UnionStationTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/Core/ResponseCacheTest.o" =>
     "test/cxx/Core/ResponseCacheTest.cpp",
-  # "#{TEST_OUTPUT_DIR}cxx/Core/RequestHandlerTest.o" =>
-  #   "test/cxx/Core/RequestHandlerTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/Core/MultipartOffloaderTest.o" =>
+    "test/cxx/Core/MultipartOffloaderTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/Core/StaticFileCacheTest.o" =>
+    "test/cxx/Core/StaticFileCacheTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/Core/RequestHandlerTest.o" =>
+    "test/cxx/Core/RequestHandlerTest.cpp",
+
+  "#{TEST_OUTPUT_DIR}cxx/UstRouter/RemoteSenderTest.o" =>
+    "test/cxx/UstRouter/RemoteSenderTest.cpp",
 
   "#{TEST_OUTPUT_DIR}cxx/ServerKit/ChannelTest.o" =>
     "test/cxx/ServerKit/ChannelTest.cpp",
@@ -59,6 +70,12 @@ TEST_CXX_OBJECTS = {
     "test/cxx/ServerKit/ServerTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/ServerKit/HttpServerTest.o" =>
     "test/cxx/ServerKit/HttpServerTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/ServerKit/Http2HpackTest.o" =>
+    "test/cxx/ServerKit/Http2HpackTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/ServerKit/TimerWheelTest.o" =>
+    "test/cxx/ServerKit/TimerWheelTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/ServerKit/MultipartParserTest.o" =>
+    "test/cxx/ServerKit/MultipartParserTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/ServerKit/CookieUtilsTest.o" =>
     "test/cxx/ServerKit/CookieUtilsTest.cpp",
 
@@ -96,12 +113,22 @@ TEST_CXX_OBJECTS = {
     "test/cxx/StringMapTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/ProcessMetricsCollectorTest.o" =>
     "test/cxx/ProcessMetricsCollectorTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/SystemMetricsCollectorTest.o" =>
+    "test/cxx/SystemMetricsCollectorTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/DateParsingTest.o" =>
     "test/cxx/DateParsingTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/UtilsTest.o" =>
     "test/cxx/UtilsTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/Utils/StrIntUtilsTest.o" =>
     "test/cxx/Utils/StrIntUtilsTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/Utils/LatencyHistogramTest.o" =>
+    "test/cxx/Utils/LatencyHistogramTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/Utils/MetricsTest.o" =>
+    "test/cxx/Utils/MetricsTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/Utils/CpuAffinityTest.o" =>
+    "test/cxx/Utils/CpuAffinityTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/Utils/TracePointProfilerTest.o" =>
+    "test/cxx/Utils/TracePointProfilerTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/IOUtilsTest.o" =>
     "test/cxx/IOUtilsTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/TemplateTest.o" =>
@@ -207,6 +234,74 @@ task 'test:cxx' => dependencies do
   end
 end
 
+
+### C++ benchmarks ###
+
+TEST_CXX_BENCHMARKS = {
+  "#{TEST_OUTPUT_DIR}cxx/Benchmarks/MicroBenchmark" =>
+    "test/cxx/Benchmarks/MicroBenchmark.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/Benchmarks/ProcessMetricsCollectorBenchmark" =>
+    "test/cxx/Benchmarks/ProcessMetricsCollectorBenchmark.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/Benchmarks/SystemMetricsCollectorBenchmark" =>
+    "test/cxx/Benchmarks/SystemMetricsCollectorBenchmark.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/Benchmarks/UstRouterProtocolBenchmark" =>
+    "test/cxx/Benchmarks/UstRouterProtocolBenchmark.cpp"
+}
+
+# Built like the benchmarks, but not run by test:cxx:benchmark because the
+# load test needs a PassengerAgent and takes minutes.
+TEST_CXX_LOAD_TEST = {
+  "#{TEST_OUTPUT_DIR}cxx/Benchmarks/CoreLoadTest" =>
+    "test/cxx/Benchmarks/CoreLoadTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/Benchmarks/CoreLoadTestStubApp" =>
+    "test/cxx/Benchmarks/CoreLoadTestStubApp.cpp"
+}
+
+TEST_CXX_BENCHMARKS.merge(TEST_CXX_LOAD_TEST).each_pair do |target, source|
+  object = "#{target}.o"
+  define_cxx_object_compilation_task(
+    object,
+    source,
+    :include_paths => ["src/agent", *CXX_SUPPORTLIB_INCLUDE_PATHS],
+    :flags => [LIBEV_CFLAGS, LIBUV_CFLAGS, PlatformInfo.curl_flags, TEST_COMMON_CFLAGS,
+      OPTIMIZE ? "-O" : nil].compact
+  )
+
+  dependencies = [
+    object,
+    LIBEV_TARGET,
+    LIBUV_TARGET,
+    TEST_BOOST_OXT_LIBRARY,
+    TEST_COMMON_LIBRARY.link_objects
+  ].flatten.compact
+  file(target => dependencies) do
+    create_cxx_executable(target, object, :flags => test_cxx_ldflags)
+  end
+end
+
+desc "Run benchmarks for the C++ components"
+task 'test:cxx:benchmark' => TEST_CXX_BENCHMARKS.keys do
+  TEST_CXX_BENCHMARKS.each_key do |target|
+    sh "cd test && #{File.expand_path(target)}"
+  end
+end
+
+desc "Run the C++ micro-benchmarks (options: FILTER, JSON, COMPARE, MAX_REGRESSION)"
+task 'test:cxx:microbenchmark' => "#{TEST_OUTPUT_DIR}cxx/Benchmarks/MicroBenchmark" do
+  require 'shellwords'
+  args = []
+  args << "--filter #{Shellwords.escape(ENV['FILTER'])}" if ENV['FILTER']
+  args << "--json #{Shellwords.escape(File.expand_path(ENV['JSON']))}" if ENV['JSON']
+  args << "--compare #{Shellwords.escape(File.expand_path(ENV['COMPARE']))}" if ENV['COMPARE']
+  args << "--max-regression #{ENV['MAX_REGRESSION'].to_f}" if ENV['MAX_REGRESSION']
+  sh "cd test && #{File.expand_path(TEST_OUTPUT_DIR)}/cxx/Benchmarks/MicroBenchmark #{args.join(' ')}"
+end
+
+desc "Run the end-to-end load test of the Core (options: ARGS)"
+task 'test:cxx:load_test' => [AGENT_TARGET, *TEST_CXX_LOAD_TEST.keys] do
+  sh "cd test && #{File.expand_path(TEST_OUTPUT_DIR)}/cxx/Benchmarks/CoreLoadTest #{ENV['ARGS']}"
+end
+
 file('test/cxx/TestSupport.h.gch' => generate_compilation_task_dependencies('test/cxx/TestSupport.h')) do
   compile_cxx(
     'test/cxx/TestSupport.h',
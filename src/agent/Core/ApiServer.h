@@ -46,6 +46,9 @@
 #include <Logging.h>
 #include <Constants.h>
 #include <Utils/StrIntUtils.h>
+#include <Utils/TracePointProfiler.h>
+#include <Utils/Metrics.h>
+#include <Utils/CpuAffinity.h>
 #include <Utils/BufferedIO.h>
 #include <Utils/MessageIO.h>
 
@@ -98,6 +101,8 @@ private:
 			processServerStatus(client, req);
 		} else if (regex_match(path, serverConnectionPath)) {
 			processServerConnectionOperation(client, req);
+		} else if (path == P_STATIC_STRING("/metrics")) {
+			processMetrics(client, req);
 		} else if (path == P_STATIC_STRING("/pool.xml")) {
 			processPoolStatusXml(client, req);
 		} else if (path == P_STATIC_STRING("/pool.txt")) {
@@ -108,6 +113,8 @@ private:
 			processPoolDetachProcess(client, req);
 		} else if (path == P_STATIC_STRING("/backtraces.txt")) {
 			apiServerProcessBacktraces(this, client, req);
+		} else if (path == P_STATIC_STRING("/profile.txt")) {
+			processProfile(client, req);
 		} else if (path == P_STATIC_STRING("/ping.json")) {
 			apiServerProcessPing(this, client, req);
 		} else if (path == P_STATIC_STRING("/version.json")) {
@@ -168,8 +175,36 @@ private:
 		}
 	}
 
-	static void inspectRequestHandlerState(RequestHandler *rh, Json::Value *json) {
+	static void inspectRequestHandlerState(RequestHandler *rh,
+		const CpuTopology *cpuTopology, Json::Value *json)
+	{
 		*json = rh->inspectStateAsJson();
+		(*json)["placement"] = inspectThreadPlacement(cpuTopology);
+	}
+
+	/**
+	 * Describes which CPUs and NUMA node the calling thread runs on.
+	 */
+	static Json::Value inspectThreadPlacement(const CpuTopology *cpuTopology) {
+		Json::Value doc(Json::objectValue);
+		#ifdef SUPPORTS_PER_THREAD_CPU_AFFINITY
+			CpuList cpus;
+			int cpu;
+
+			if (getCurrentThreadCpuAffinity(cpus)) {
+				doc["cpu_affinity"] = formatCpuList(cpus);
+				if (cpuTopology != NULL) {
+					doc["numa_node"] = cpuTopology->getNode(cpus);
+				}
+			}
+			if ((cpu = sched_getcpu()) != -1) {
+				doc["current_cpu"] = cpu;
+				if (cpuTopology != NULL) {
+					doc["current_numa_node"] = cpuTopology->getNode(cpu);
+				}
+			}
+		#endif
+		return doc;
 	}
 
 	void processServerStatus(Client *client, Request *req) {
@@ -179,12 +214,15 @@ private:
 
 			Json::Value doc;
 			doc["threads"] = (Json::UInt) requestHandlers.size();
+			if (cpuTopology != NULL) {
+				doc["numa_nodes"] = cpuTopology->nodeCount;
+			}
 			for (unsigned int i = 0; i < requestHandlers.size(); i++) {
 				Json::Value json;
 				string key = "thread" + toString(i + 1);
 
 				requestHandlers[i]->getContext()->libev->runSync(boost::bind(
-					inspectRequestHandlerState, requestHandlers[i], &json));
+					inspectRequestHandlerState, requestHandlers[i], cpuTopology, &json));
 				doc[key] = json;
 			}
 
@@ -198,6 +236,73 @@ private:
 		}
 	}
 
+	/**
+	 * Serves metrics in the OpenMetrics format, for Prometheus. Unlike
+	 * /server.json and /pool.xml, this neither runs anything on the
+	 * RequestHandler event loops nor locks the pool, so frequent scraping
+	 * does not affect request handling.
+	 */
+	void processMetrics(Client *client, Request *req) {
+		if (authorizeStateInspectionOperation(this, client, req)) {
+			OpenMetricsWriter writer;
+			HeaderTable headers;
+			headers.insert(req->pool, "Content-Type", OpenMetricsWriter::CONTENT_TYPE());
+
+			RequestHandler::writeMetrics(writer, requestHandlers);
+			appPool->writeMetrics(writer);
+			writeSimpleResponse(client, 200, &headers,
+				psg_pstrdup(req->pool, writer.finish()));
+			if (!req->ended()) {
+				endRequest(&client, &req);
+			}
+		} else {
+			apiServerRespondWith401(this, client, req);
+		}
+	}
+
+	/**
+	 * GET returns the trace point profiler report. POST returns the report
+	 * and then resets the profiler, which allows profiling a specific period
+	 * of time. Because resetting changes state, it requires admin
+	 * authorization.
+	 */
+	void processProfile(Client *client, Request *req) {
+		bool reset;
+
+		if (req->method == HTTP_GET || req->method == HTTP_HEAD) {
+			reset = false;
+			if (!authorizeStateInspectionOperation(this, client, req)) {
+				apiServerRespondWith401(this, client, req);
+				return;
+			}
+		} else if (req->method == HTTP_POST) {
+			reset = true;
+			if (!authorizeAdminOperation(this, client, req)) {
+				apiServerRespondWith401(this, client, req);
+				return;
+			}
+		} else {
+			apiServerRespondWith405(this, client, req);
+			return;
+		}
+
+		HeaderTable headers;
+		headers.insert(req->pool, "Content-Type", "text/plain");
+		if (profiler == NULL) {
+			writeSimpleResponse(client, 404, &headers,
+				"The trace point profiler is disabled. Enable it with --profiler-interval\n");
+		} else {
+			writeSimpleResponse(client, 200, &headers,
+				psg_pstrdup(req->pool, profiler->report()));
+			if (reset) {
+				profiler->reset();
+			}
+		}
+		if (!req->ended()) {
+			endRequest(&client, &req);
+		}
+	}
+
 	void processPoolStatusXml(Client *client, Request *req) {
 		Authorization auth(authorize(this, client, req));
 		if (auth.canReadPool) {
@@ -587,13 +692,17 @@ public:
 	string instanceDir;
 	string fdPassingPassword;
 	EventFd *exitEvent;
+	TracePointProfiler *profiler;
+	const CpuTopology *cpuTopology;
 	vector<Authorization> authorizations;
 
 	ApiServer(ServerKit::Context *context)
 		: ParentClass(context),
 		  serverConnectionPath("^/server/(.+)\\.json$"),
 		  apiAccountDatabase(NULL),
-		  exitEvent(NULL)
+		  exitEvent(NULL),
+		  profiler(NULL),
+		  cpuTopology(NULL)
 		{ }
 
 	virtual StaticString getServerName() const {
@@ -0,0 +1,242 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2014-2015 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_APPLICATION_POOL2_CAPACITY_SHARES_H_
+#define _PASSENGER_APPLICATION_POOL2_CAPACITY_SHARES_H_
+
+#include <string>
+#include <vector>
+#include <StaticString.h>
+#include <DataStructures/StringKeyTable.h>
+
+namespace Passenger {
+namespace ApplicationPool2 {
+
+using namespace std;
+
+
+class Group;
+
+/** See CapacityShares. */
+const double CAPACITY_HYSTERESIS = 0.5;
+const double CAPACITY_EPSILON = 0.0001;
+/**
+ * If computing shares for a Group whose processes are all busy didn't give
+ * it a process, then Pool doesn't compute them again for that reason until
+ * this many microseconds have passed. See Pool::freeCapacityForBusyGroup().
+ */
+const unsigned long long CAPACITY_REBALANCE_RETRY_INTERVAL = 100000;
+
+/**
+ * Divides the capacity of a full pool among Groups according to weighted
+ * max-min fair share, and decides whether a process should move from one
+ * Group to another.
+ *
+ * Every Group has a demand: the number of processes that it could keep busy
+ * right now, i.e. its busy processes plus its queued requests, bounded by its
+ * `maxProcesses`. Capacity is divided in two rounds:
+ *
+ *  1. Every Group is guaranteed min(`minProcesses`, demand) processes.
+ *  2. The remaining capacity is divided in proportion to the Groups'
+ *     `capacityWeight`, with no Group receiving more than its demand.
+ *     Capacity that a Group doesn't need is redistributed among the others.
+ *
+ * If the guarantees alone exceed the capacity then they're scaled down by
+ * weight as well. Shares are fractional: with a pool of 3 processes and
+ * three Groups that each want 2, every Group's share is 1.
+ *
+ * A Group's deficit is its share minus the capacity it's using. Processes
+ * only move from a Group to another when:
+ *
+ *  - the recipient has no processes at all and the donor is over its share,
+ *    so that a Group is never starved; or
+ *  - the recipient's deficit exceeds the donor's deficit by more than
+ *    1 + `CAPACITY_HYSTERESIS`, and the donor keeps at least one process
+ *    unless it has no demand at all. Moving a process narrows the gap by 2,
+ *    so a move is never immediately followed by a move back.
+ *
+ * This class doesn't lock anything and doesn't know about Pool. Pool fills
+ * it in, see Pool::collectCapacityDemand().
+ */
+class CapacityShares {
+public:
+	struct Entry {
+		/** NULL for applications that don't have a Group yet. */
+		const Group *group;
+		string name;
+		unsigned int weight;
+		unsigned int guaranteed;
+		unsigned int demand;
+		/** Capacity that the Group is using, including processes being spawned. */
+		unsigned int current;
+		double share;
+
+		double deficit() const {
+			return share - current;
+		}
+
+		bool overShare() const {
+			return current > share + CAPACITY_EPSILON;
+		}
+	};
+
+	vector<Entry> entries;
+
+private:
+	/** Maps names to indices in `entries`. */
+	StringKeyTable<unsigned int> index;
+
+	/**
+	 * Weighted water-filling: raises the allocation of every entry in
+	 * proportion to its weight until it reaches its limit, or until
+	 * `amount` has been handed out. Returns what's left of `amount`.
+	 */
+	double fill(const vector<double> &limits, double amount) {
+		while (amount > CAPACITY_EPSILON) {
+			double totalWeight = 0;
+			double step = -1;
+			vector<Entry>::const_iterator it, end = entries.end();
+			unsigned int i;
+
+			for (it = entries.begin(), i = 0; it != end; it++, i++) {
+				if (it->share + CAPACITY_EPSILON < limits[i]) {
+					double room = (limits[i] - it->share) / it->weight;
+					totalWeight += it->weight;
+					if (step < 0 || room < step) {
+						step = room;
+					}
+				}
+			}
+			if (totalWeight == 0) {
+				break;
+			}
+			if (step * totalWeight > amount) {
+				step = amount / totalWeight;
+			}
+
+			vector<Entry>::iterator mit, mend = entries.end();
+			for (mit = entries.begin(), i = 0; mit != mend; mit++, i++) {
+				if (mit->share + CAPACITY_EPSILON < limits[i]) {
+					mit->share = std::min(mit->share + step * mit->weight, limits[i]);
+				}
+			}
+			amount -= step * totalWeight;
+		}
+		return amount;
+	}
+
+public:
+	/**
+	 * Adds a Group, or returns the existing entry with the same name. Weights
+	 * lower than 1 are treated as 1. The returned reference is invalidated
+	 * by the next call.
+	 */
+	Entry &add(const Group *group, const StaticString &name, unsigned int weight,
+		unsigned int guaranteed)
+	{
+		HashedStaticString hname(name);
+		Entry *entry = find(hname);
+		if (entry == NULL) {
+			index.insert(hname, entries.size());
+			entries.push_back(Entry());
+			entry = &entries.back();
+			entry->group = group;
+			entry->name = name.toString();
+			entry->weight = std::max(weight, 1u);
+			entry->guaranteed = guaranteed;
+			entry->demand = 0;
+			entry->current = 0;
+			entry->share = 0;
+		}
+		return *entry;
+	}
+
+	Entry *find(const HashedStaticString &name) {
+		unsigned int *i;
+		if (index.lookup(name, &i)) {
+			return &entries[*i];
+		} else {
+			return NULL;
+		}
+	}
+
+	const Entry *find(const HashedStaticString &name) const {
+		const unsigned int *i;
+		if (index.lookup(name, &i)) {
+			return &entries[*i];
+		} else {
+			return NULL;
+		}
+	}
+
+	const Entry *find(const Group *group) const {
+		vector<Entry>::const_iterator it, end = entries.end();
+		for (it = entries.begin(); it != end; it++) {
+			if (it->group == group) {
+				return &(*it);
+			}
+		}
+		return NULL;
+	}
+
+	/** Divides `capacity` processes among the entries. */
+	void compute(unsigned int capacity) {
+		vector<double> limits;
+		vector<Entry>::iterator it, end = entries.end();
+
+		limits.reserve(entries.size());
+		for (it = entries.begin(); it != end; it++) {
+			it->share = 0;
+			limits.push_back(std::min(it->guaranteed, it->demand));
+		}
+		double remaining = fill(limits, capacity);
+
+		limits.clear();
+		for (it = entries.begin(); it != end; it++) {
+			limits.push_back(it->demand);
+		}
+		fill(limits, remaining);
+	}
+
+	/**
+	 * Whether `recipient`, which wants another process, may take one that
+	 * `donor` isn't using.
+	 */
+	static bool shouldMove(const Entry &donor, const Entry &recipient) {
+		if (&donor == &recipient || recipient.demand <= recipient.current) {
+			return false;
+		} else if (recipient.current == 0) {
+			return donor.overShare();
+		} else {
+			return (donor.current > 1 || donor.demand == 0)
+				&& recipient.deficit() - donor.deficit() > 1 + CAPACITY_HYSTERESIS;
+		}
+	}
+};
+
+} // namespace ApplicationPool2
+} // namespace Passenger
+
+#endif /* _PASSENGER_APPLICATION_POOL2_CAPACITY_SHARES_H_ */
@@ -186,10 +186,18 @@ struct GetCallback {
 struct GetWaiter {
 	Options options;
 	GetCallback callback;
-
-	GetWaiter(const Options &o, const GetCallback &cb)
+	/** When this waiter was put in the queue, in microseconds. */
+	unsigned long long enqueuedAt;
+	/** When this waiter should be removed from the queue, in microseconds.
+	 * 0 means never. */
+	unsigned long long deadline;
+
+	GetWaiter(const Options &o, const GetCallback &cb,
+		unsigned long long _enqueuedAt = 0, unsigned long long _deadline = 0)
 		: options(o),
-		  callback(cb)
+		  callback(cb),
+		  enqueuedAt(_enqueuedAt),
+		  deadline(_deadline)
 	{
 		options.persist(o);
 	}
@@ -36,6 +36,7 @@
 #include <boost/shared_ptr.hpp>
 #include <boost/make_shared.hpp>
 #include <boost/container/vector.hpp>
+#include <boost/unordered_map.hpp>
 #include <boost/atomic.hpp>
 #include <oxt/macros.hpp>
 #include <oxt/thread.hpp>
@@ -48,6 +49,8 @@
 #include <MemoryKit/palloc.h>
 #include <Hooks.h>
 #include <Utils.h>
+#include <Utils/FileWatcher.h>
+#include <Utils/LatencyHistogram.h>
 #include <Core/ApplicationPool/Common.h>
 #include <Core/ApplicationPool/Context.h>
 #include <Core/ApplicationPool/BasicGroupInfo.h>
@@ -77,6 +80,7 @@ public:
 	struct GetAction {
 		GetCallback callback;
 		SessionPtr session;
+		ExceptionPtr exception;
 	};
 
 	struct DisableWaiter {
@@ -167,12 +171,22 @@ public:
 	 * spawn new process. If spawning was already in progress when the restart was initiated,
 	 * then the spawning will abort as soon as possible.
 	 *
-	 * When rolling restarting is in progress, this flag is false.
+	 * When rolling restarting is in progress, this flag is only set while the new spawner
+	 * is being created. The old processes keep serving requests in the mean time.
 	 *
 	 * Invariant:
 	 *    if m_restarting: processesBeingSpawned == 0
 	 */
 	bool m_restarting: 1;
+	/** Whether a rolling restart is in progress. The processes that existed when it
+	 * began are marked `oldGeneration`. The spawn loop replaces them one by one with
+	 * processes from the new spawner, and detaches an old process every time a new
+	 * one has been attached. See `restart()`.
+	 *
+	 * Invariant:
+	 *    if m_rollingRestarting and !m_restarting: rollingRestartOldSpawner != NULL
+	 */
+	bool m_rollingRestarting: 1;
 	bool alwaysRestartFileExists: 1;
 
 	/** Contains the spawn loop thread and the restarter thread. */
@@ -182,6 +196,25 @@ public:
 	string alwaysRestartFile;
 	ProcessPtr nullProcess;
 
+	/**
+	 * If the Pool has a restart file watcher, then this is our registration
+	 * with it, and needsRestart() only looks at the two flags below instead of
+	 * stat()ing restart.txt and always_restart.txt. 0 if restart files are
+	 * checked by polling.
+	 */
+	FileWatcher::WatchId restartFileWatchId;
+	/** Set by the file watcher thread when restart.txt has been created or touched. */
+	boost::atomic<bool> restartFileChanged;
+	/**
+	 * The mtime (in microseconds) of restart.txt when it last set
+	 * `restartFileChanged`, or when watching began. A single touch produces
+	 * several file watcher events, and only the first one that carries a newer
+	 * mtime may cause a restart. Only used by the file watcher thread.
+	 */
+	boost::atomic<unsigned long long> restartFileTriggerMtime;
+	/** Maintained by the file watcher thread. */
+	boost::atomic<bool> alwaysRestartFilePresent;
+
 	/** This timer scans `detachedProcesses` periodically to see
 	 * whether any of the Processes can be shut down.
 	 */
@@ -196,6 +229,11 @@ public:
 	static ApiKey generateApiKey(const Pool *pool);
 	static string generateUuid(const Pool *pool);
 
+	void watchRestartFiles();
+	static unsigned long long getRestartFileMtime(const string &filename);
+	static void onRestartFileChanged(boost::weak_ptr<Group> weakSelf, const string &dir,
+		const string &name, bool exists);
+
 	bool shutdownCanFinish() const;
 	void finishShutdown(boost::container::vector<Callback> &postLockActions);
 
@@ -214,16 +252,31 @@ public:
 		unsigned int restartsInitiated);
 	void spawnThreadRealMain(const SpawningKit::SpawnerPtr &spawner, const Options &options,
 		unsigned int restartsInitiated);
+	void warmUpProcess(const ProcessPtr &process, const Options &options);
+	void sendWarmupRequest(const ProcessPtr &process, const Options &options,
+		const StaticString &path);
 	void finalizeRestart(GroupPtr self, Options oldOptions, Options newOptions,
 		RestartMethod method, SpawningKit::FactoryPtr spawningKitFactory,
 		unsigned int restartsInitiated, boost::container::vector<Callback> postLockActions);
+	void markProcessesAsOldGeneration(ProcessList &processes);
+	unsigned int countOldGenerationProcesses() const;
+	Process *findOldGenerationProcessToDetach() const;
+	void makeRoomForRollingRestart(boost::container::vector<Callback> &postLockActions);
+	void continueRollingRestart(boost::container::vector<Callback> &postLockActions);
+	bool replaceOldGenerationProcess(boost::container::vector<Callback> &postLockActions);
+	void finishRollingRestart(boost::container::vector<Callback> &postLockActions);
+	void abortRollingRestart(const ExceptionPtr &exception,
+		boost::container::vector<Callback> &postLockActions);
+	void clearRollingRestart(boost::container::vector<Callback> &postLockActions);
 
 	/****** Process list management ******/
 
 	Process *findProcessWithStickySessionId(unsigned int id) const;
-	Process *findProcessWithStickySessionIdOrLowestBusyness(unsigned int id) const;
+	Process *findEnabledProcessWithStickySessionHash(unsigned int id) const;
 	Process *findProcessWithLowestBusyness(const ProcessList &processes) const;
 	Process *findEnabledProcessWithLowestBusyness() const;
+	Process *findEnabledProcessWithLowestWarmupBusyness(unsigned long long now) const;
+	Process *findEnabledProcessPreferringNewGeneration() const;
 
 	void addProcessToList(const ProcessPtr &process, ProcessList &destination);
 	void removeProcessFromList(const ProcessPtr &process, ProcessList &source);
@@ -232,6 +285,11 @@ public:
 	void clearDisableWaitlist(DisableResult result,
 		boost::container::vector<Callback> &postLockActions);
 	void enableAllDisablingProcesses(boost::container::vector<Callback> &postLockActions);
+	bool needsStandbyProcess() const;
+	bool standbyProcessesMissing() const;
+	bool shouldPromoteStandbyProcess() const;
+	bool promoteStandbyProcess(boost::container::vector<Callback> &postLockActions);
+	void detachStandbyProcesses(boost::container::vector<Callback> &postLockActions);
 
 	void startCheckingDetachedProcesses(bool immediately);
 	void detachedProcessesCheckerMain(GroupPtr self);
@@ -261,9 +319,10 @@ public:
 	void setupAttachOrDetachHook(const ProcessPtr process, HookScriptOptions &options) const;
 
 	unsigned int generateStickySessionId();
+	unsigned int findFreeProcessSlot() const;
 	ProcessPtr createProcessObject(const Json::Value &json);
 	bool poolAtFullCapacity() const;
-	ProcessPtr poolForceFreeCapacity(const Group *exclude, boost::container::vector<Callback> &postLockActions);
+	ProcessPtr poolForceFreeCapacity(const Group *recipient, boost::container::vector<Callback> &postLockActions);
 	void wakeUpGarbageCollector();
 	bool anotherGroupIsWaitingForCapacity() const;
 	Group *findOtherGroupWaitingForCapacity() const;
@@ -274,6 +333,30 @@ public:
 	bool testOverflowRequestQueue() const;
 	void callAbortLongRunningConnectionsCallback(const ProcessPtr &process);
 
+	/****** Request queue management ******/
+
+	bool requestQueueIsStanding(unsigned long long now) const;
+	bool shouldServeGetWaitlistInLifoOrder(unsigned long long now) const;
+	ExceptionPtr checkGetWaiterExpired(const GetWaiter &waiter,
+		unsigned long long now, bool standing);
+	void recordGetWaiterAssigned(const GetWaiter &waiter, unsigned long long now);
+	void shedExpiredGetWaiters(unsigned long long now,
+		boost::container::vector<Callback> &postLockActions);
+	unsigned long long getNextGetWaiterExpiryTime() const;
+	void scheduleGetWaiterExpiry(unsigned long long expiryTime);
+
+	/****** Process recycling ******/
+
+	bool processExceedsMemoryLimit(const Process *process) const;
+	void updateMemoryLimitBackoff(unsigned long long now, bool baselineExceeded,
+		bool baselineWithinLimit, size_t baselineMemory);
+	unsigned int countProcessesExceedingMemoryLimit() const;
+	Process *findProcessExceedingMemoryLimitToDetach() const;
+	void detachProcessExceedingMemoryLimit(const ProcessPtr &process,
+		boost::container::vector<Callback> &postLockActions);
+	void checkMemoryLimits(boost::container::vector<Callback> &postLockActions);
+	bool replaceProcessExceedingMemoryLimit(boost::container::vector<Callback> &postLockActions);
+
 	/****** Correctness verification ******/
 
 	bool selfCheckingEnabled() const;
@@ -359,6 +442,23 @@ public:
 	 */
 	ProcessList detachedProcesses;
 
+	/**
+	 * Fully initialized processes that are kept in reserve, up to
+	 * `options.standbyProcesses`. They don't handle requests, and are not
+	 * counted by `getProcessCount()`, but they do count towards
+	 * `capacityUsed()`. get() promotes one of them to `enabledProcesses` as
+	 * soon as more capacity is needed, and the spawn loop refills them.
+	 *
+	 * Invariant:
+	 *    standbyProcesses.size() == standbyCount
+	 *    for all process in standbyProcesses:
+	 *       process.enabled == Process::STANDBY
+	 *       process.isAlive()
+	 *       process.sessions == 0
+	 */
+	int standbyCount;
+	ProcessList standbyProcesses;
+
 	/**
 	 * A cache of the processes' busyness. It's in a compact structure
 	 * so that `findProcessWithLowestBusyness()` can work very quickly
@@ -366,6 +466,24 @@ public:
 	 */
 	boost::container::vector<int> enabledProcessBusynessLevels;
 
+	/**
+	 * Maps sticky session IDs to the processes in `enabledProcesses`,
+	 * `disablingProcesses`, `disabledProcesses` and `standbyProcesses`, so
+	 * that routing a sticky session doesn't have to scan all processes.
+	 * Maintained by `addProcessToList()` and `removeProcessFromList()`.
+	 * Detached processes are not in here, so their IDs may be reused.
+	 */
+	boost::unordered_map<unsigned int, Process *> stickySessionIndex;
+
+	/**
+	 * The time (in microseconds) at which the youngest enabled process
+	 * finishes warming up (see `options.warmupTime`), or 0 if no process is
+	 * warming up. As long as this is non-zero, route() takes the processes'
+	 * ages into account instead of using `enabledProcessBusynessLevels`.
+	 * Reset by the garbage collector.
+	 */
+	unsigned long long warmupEndTime;
+
 	/**
 	 * get() requests for this group that cannot be immediately satisfied are
 	 * put on this wait list, which must be processed as soon as the necessary
@@ -398,6 +516,29 @@ public:
 	 *       !enabledProcesses.empty() || m_spawning || restarting() || poolAtFullCapacity()
 	 */
 	deque<GetWaiter> getWaitlist;
+	/**
+	 * The time (in microseconds) at which getWaitlist last transitioned from
+	 * empty to non-empty. Used for detecting standing queues, see
+	 * Group/QueueManagement.cpp.
+	 */
+	unsigned long long getWaitlistLastEmptyTime;
+	/** How long requests spent in getWaitlist before they were assigned a session. */
+	LatencyHistogram getWaitlistWaitTimes;
+	/** The number of requests that were removed from getWaitlist because their deadline passed. */
+	unsigned long long getWaitersTimedOut;
+	/** The number of requests that were shed from getWaitlist because it was a standing queue. */
+	unsigned long long getWaitersShed;
+	/** The number of processes that were detached because they reached `options.maxRequests`. */
+	unsigned long long processesRecycledForMaxRequests;
+	/** The number of processes that were detached because they exceeded `options.memoryLimit`. */
+	unsigned long long processesRecycledForMemoryLimit;
+	/**
+	 * How many times in a row freshly spawned processes were found to exceed
+	 * `options.memoryLimit`, and until when (in microseconds) processes must
+	 * not be recycled for exceeding it. See Group::updateMemoryLimitBackoff().
+	 */
+	unsigned int memoryLimitBackoffLevel;
+	unsigned long long memoryLimitBackoffEndTime;
 	/**
 	 * Disable() commands that couldn't finish immediately will put their callbacks
 	 * in this queue. Note that there may be multiple DisableWaiters pointing to the
@@ -414,6 +555,22 @@ public:
 	 */
 	SpawningKit::SpawnerPtr spawner;
 
+	/**
+	 * The spawner and options that were in use before the current rolling restart
+	 * began, so that the restart can be rolled back if the new generation of
+	 * processes fails to spawn. Only set while `m_rollingRestarting`.
+	 */
+	SpawningKit::SpawnerPtr rollingRestartOldSpawner;
+	Options rollingRestartOldOptions;
+	/** The number of old generation processes when the current rolling restart began. */
+	unsigned int rollingRestartTotal;
+	/**
+	 * The number of old generation processes that were detached ahead of their
+	 * replacements, because there was no room to spawn the replacements first.
+	 * The next this many new processes don't cause old processes to be detached.
+	 */
+	unsigned int rollingRestartVacancies;
+
 
 	/****** Initialization and shutdown ******/
 
@@ -446,6 +603,7 @@ public:
 
 	void restart(const Options &options, RestartMethod method = RM_DEFAULT);
 	bool restarting() const;
+	bool rollingRestarting() const;
 	bool needsRestart(const Options &options);
 
 	SpawnResult spawn();
@@ -485,6 +643,7 @@ public:
 
 	/****** Miscellaneous ******/
 
+	void reportResponseTimeout(const ProcessPtr &process, unsigned int detachThreshold);
 	void cleanupSpawner(boost::container::vector<Callback> &postLockActions);
 	bool authorizeByUid(uid_t uid) const;
 	bool authorizeByApiKey(const ApiKey &key) const;
@@ -57,6 +57,66 @@ Group::generateUuid(const Pool *pool) {
 	return pool->getRandomGenerator()->generateAsciiString(20);
 }
 
+void
+Group::watchRestartFiles() {
+	vector<string> names;
+	string dir = extractDirName(restartFile);
+
+	names.push_back(extractBaseName(restartFile));
+	names.push_back(extractBaseName(alwaysRestartFile));
+	// An existing restart.txt only restarts the group once it's touched.
+	restartFileTriggerMtime.store(getRestartFileMtime(restartFile),
+		boost::memory_order_relaxed);
+	restartFileWatchId = pool->restartFileWatcher->watch(dir, names,
+		boost::bind(onRestartFileChanged, boost::weak_ptr<Group>(shared_from_this()),
+			_1, _2, _3));
+	alwaysRestartFilePresent.store(
+		pool->restartFileWatcher->exists(restartFileWatchId, names[1]),
+		boost::memory_order_relaxed);
+}
+
+/** Returns the mtime of the given file in microseconds, or 0 if it doesn't exist. */
+unsigned long long
+Group::getRestartFileMtime(const string &filename) {
+	struct stat buf;
+
+	if (syscalls::stat(filename.c_str(), &buf) == -1) {
+		return 0;
+	}
+	#if defined(__APPLE__)
+		return buf.st_mtimespec.tv_sec * 1000000ull + buf.st_mtimespec.tv_nsec / 1000;
+	#elif defined(__linux__)
+		return buf.st_mtim.tv_sec * 1000000ull + buf.st_mtim.tv_nsec / 1000;
+	#else
+		return buf.st_mtime * 1000000ull;
+	#endif
+}
+
+/** Called from the file watcher thread, outside the pool lock. */
+void
+Group::onRestartFileChanged(boost::weak_ptr<Group> weakSelf, const string &dir,
+	const string &name, bool exists)
+{
+	GroupPtr self = weakSelf.lock();
+	if (self == NULL) {
+		return;
+	}
+
+	if (name == extractBaseName(self->alwaysRestartFile)) {
+		self->alwaysRestartFilePresent.store(exists, boost::memory_order_release);
+	} else if (exists) {
+		// Deleting restart.txt does not trigger a restart. Neither do the
+		// other events of a touch that has already been seen.
+		unsigned long long mtime = getRestartFileMtime(self->restartFile);
+		if (mtime > self->restartFileTriggerMtime.load(boost::memory_order_relaxed)) {
+			P_DEBUG("Restart file " << dir << "/" << name << " changed; group "
+				<< self->info.name << " will be restarted on its next request");
+			self->restartFileTriggerMtime.store(mtime, boost::memory_order_relaxed);
+			self->restartFileChanged.store(true, boost::memory_order_release);
+		}
+	}
+}
+
 bool
 Group::shutdownCanFinish() const {
 	LifeStatus lifeStatus = (LifeStatus) this->lifeStatus.load(boost::memory_order_seq_cst);
@@ -64,6 +124,7 @@ Group::shutdownCanFinish() const {
 		&& enabledCount == 0
 		&& disablingCount == 0
  		&& disabledCount == 0
+		&& standbyCount == 0
  		&& detachedProcesses.empty();
 }
 
@@ -108,16 +169,32 @@ Group::Group(Pool *_pool, const Options &_options)
 	enabledCount   = 0;
 	disablingCount = 0;
 	disabledCount  = 0;
+	standbyCount   = 0;
 	nEnabledProcessesTotallyBusy = 0;
 	spawner        = getContext()->getSpawningKitFactory()->create(options);
 	restartsInitiated = 0;
 	processesBeingSpawned = 0;
 	m_spawning     = false;
 	m_restarting   = false;
+	m_rollingRestarting = false;
+	rollingRestartTotal = 0;
+	rollingRestartVacancies = 0;
+	getWaitlistLastEmptyTime = 0;
+	getWaitersTimedOut = 0;
+	getWaitersShed = 0;
+	processesRecycledForMaxRequests = 0;
+	processesRecycledForMemoryLimit = 0;
+	memoryLimitBackoffLevel = 0;
+	memoryLimitBackoffEndTime = 0;
+	warmupEndTime = 0;
 	lifeStatus.store(ALIVE, boost::memory_order_relaxed);
 	lastRestartFileMtime = 0;
 	lastRestartFileCheckTime = 0;
 	alwaysRestartFileExists = false;
+	restartFileWatchId = 0;
+	restartFileChanged.store(false, boost::memory_order_relaxed);
+	restartFileTriggerMtime.store(0, boost::memory_order_relaxed);
+	alwaysRestartFilePresent.store(false, boost::memory_order_relaxed);
 	if (options.restartDir.empty()) {
 		restartFile = options.appRoot + "/tmp/restart.txt";
 		alwaysRestartFile = options.appRoot + "/tmp/always_restart.txt";
@@ -155,6 +232,10 @@ Group::initialize() {
 
 	nullProcess = createProcessObject(json);
 	nullProcess->shutdownNotRequired();
+
+	if (pool->restartFileWatcher != NULL) {
+		watchRestartFiles();
+	}
 	return true;
 }
 
@@ -176,11 +257,16 @@ Group::shutdown(const Callback &callback,
 
 	P_DEBUG("Begin shutting down group " << info.name);
 	shutdownCallback = callback;
+	if (restartFileWatchId != 0) {
+		pool->restartFileWatcher->unwatch(restartFileWatchId);
+		restartFileWatchId = 0;
+	}
 	detachAll(postLockActions);
 	startCheckingDetachedProcesses(true);
 	interruptableThreads.interrupt_all();
 	postLockActions.push_back(boost::bind(doCleanupSpawner, spawner));
 	spawner.reset();
+	clearRollingRestart(postLockActions);
 	selfPointer = shared_from_this();
 	assert(disableWaitlist.empty());
 	lifeStatus.store(SHUTTING_DOWN, boost::memory_order_seq_cst);
@@ -88,6 +88,14 @@ Group::mergeOptions(const Options &other) {
 	options.minProcesses     = other.minProcesses;
 	options.statThrottleRate = other.statThrottleRate;
 	options.maxPreloaderIdleTime = other.maxPreloaderIdleTime;
+	options.requestQueueTarget   = other.requestQueueTarget;
+	options.requestQueueInterval = other.requestQueueInterval;
+	options.requestQueueAdaptiveLifo = other.requestQueueAdaptiveLifo;
+	options.warmupTime = other.warmupTime;
+	options.standbyProcesses = other.standbyProcesses;
+	options.memoryLimit = other.memoryLimit;
+	options.capacityWeight = other.capacityWeight;
+	options.stickySessionsFallback = other.stickySessionsFallback;
 }
 
 /* Given a hook name like "queue_full_error", we return HookScriptOptions filled in with this name and a spec
@@ -143,6 +151,28 @@ Group::generateStickySessionId() {
 	return 0;
 }
 
+/**
+ * Returns the lowest process slot that isn't used by any attached process.
+ */
+unsigned int
+Group::findFreeProcessSlot() const {
+	const ProcessList *lists[] = {
+		&enabledProcesses, &disablingProcesses, &disabledProcesses, &standbyProcesses
+	};
+	vector<bool> used(enabledProcesses.size() + disablingProcesses.size()
+		+ disabledProcesses.size() + standbyProcesses.size() + 1, false);
+
+	for (unsigned int i = 0; i < sizeof(lists) / sizeof(lists[0]); i++) {
+		foreach (const ProcessPtr &process, *lists[i]) {
+			if (process->slot < used.size()) {
+				used[process->slot] = true;
+			}
+		}
+	}
+	// There are more slots than processes, so at least one is free.
+	return std::find(used.begin(), used.end(), false) - used.begin();
+}
+
 ProcessPtr
 Group::createProcessObject(const Json::Value &json) {
 	struct Guard {
@@ -180,10 +210,10 @@ Group::poolAtFullCapacity() const {
 }
 
 ProcessPtr
-Group::poolForceFreeCapacity(const Group *exclude,
+Group::poolForceFreeCapacity(const Group *recipient,
 	boost::container::vector<Callback> &postLockActions)
 {
-	return getPool()->forceFreeCapacity(exclude, postLockActions);
+	return getPool()->forceFreeCapacity(recipient, postLockActions);
 }
 
 void
@@ -218,13 +248,44 @@ bool
 Group::pushGetWaiter(const Options &newOptions, const GetCallback &callback,
 	boost::container::vector<Callback> &postLockActions)
 {
+	unsigned long long now = SystemTime::getUsec();
+
+	if (newOptions.maxRequestQueueSize != 0
+	 && getWaitlist.size() >= newOptions.maxRequestQueueSize)
+	{
+		// Make room by removing waiters that have already expired.
+		shedExpiredGetWaiters(now, postLockActions);
+	}
+
 	if (OXT_LIKELY(!testOverflowRequestQueue()
 		&& (newOptions.maxRequestQueueSize == 0
 		    || getWaitlist.size() < newOptions.maxRequestQueueSize)))
 	{
+		unsigned long long deadline = 0;
+		unsigned long long expiryTime;
+
+		if (newOptions.maxRequestQueueTime != 0) {
+			deadline = now + newOptions.maxRequestQueueTime * 1000ull;
+		}
+		expiryTime = deadline;
+		if (getWaitlist.empty()) {
+			getWaitlistLastEmptyTime = now;
+			if (options.requestQueueTarget != 0) {
+				unsigned long long shedTime = now + 1000ull * std::max(
+					options.requestQueueInterval,
+					options.requestQueueTarget) + 1;
+				if (expiryTime == 0 || shedTime < expiryTime) {
+					expiryTime = shedTime;
+				}
+			}
+		}
+
 		getWaitlist.push_back(GetWaiter(
 			newOptions.copyAndPersist().detachFromUnionStationTransaction(),
-			callback));
+			callback, now, deadline));
+		if (expiryTime != 0) {
+			scheduleGetWaiterExpiry(expiryTime);
+		}
 		return true;
 	} else {
 		postLockActions.push_back(boost::bind(GetCallback::call,
@@ -250,19 +311,34 @@ Group::assignSessionsToGetWaitersQuickly(Lock &lock) {
 	}
 
 	SmallVector<GetAction, 8> actions;
+	unsigned long long now = SystemTime::getUsec();
+	bool standing = requestQueueIsStanding(now);
+	bool lifo = shouldServeGetWaitlistInLifoOrder(now);
 	unsigned int i = 0;
 	bool done = false;
 
 	actions.reserve(getWaitlist.size());
 
 	while (!done && i < getWaitlist.size()) {
-		const GetWaiter &waiter = getWaitlist[i];
+		unsigned int index = lifo ? getWaitlist.size() - 1 - i : i;
+		const GetWaiter &waiter = getWaitlist[index];
+		ExceptionPtr e = checkGetWaiterExpired(waiter, now, standing);
+		if (OXT_UNLIKELY(e != NULL)) {
+			GetAction action;
+			action.callback  = waiter.callback;
+			action.exception = e;
+			getWaitlist.erase(getWaitlist.begin() + index);
+			actions.push_back(action);
+			continue;
+		}
+
 		RouteResult result = route(waiter.options);
 		if (result.process != NULL) {
 			GetAction action;
 			action.callback = waiter.callback;
 			action.session  = newSession(result.process);
-			getWaitlist.erase(getWaitlist.begin() + i);
+			recordGetWaiterAssigned(waiter, now);
+			getWaitlist.erase(getWaitlist.begin() + index);
 			actions.push_back(action);
 		} else {
 			done = result.finished;
@@ -276,17 +352,36 @@ Group::assignSessionsToGetWaitersQuickly(Lock &lock) {
 	lock.unlock();
 	SmallVector<GetAction, 50>::const_iterator it, end = actions.end();
 	for (it = actions.begin(); it != end; it++) {
-		it->callback(it->session, ExceptionPtr());
+		it->callback(it->session, it->exception);
 	}
 }
 
 void
 Group::assignSessionsToGetWaiters(boost::container::vector<Callback> &postLockActions) {
+	if (getWaitlist.empty()) {
+		return;
+	}
+
+	unsigned long long now = SystemTime::getUsec();
+	bool standing = requestQueueIsStanding(now);
+	bool lifo = shouldServeGetWaitlistInLifoOrder(now);
 	unsigned int i = 0;
 	bool done = false;
 
 	while (!done && i < getWaitlist.size()) {
-		const GetWaiter &waiter = getWaitlist[i];
+		unsigned int index = lifo ? getWaitlist.size() - 1 - i : i;
+		const GetWaiter &waiter = getWaitlist[index];
+		ExceptionPtr e = checkGetWaiterExpired(waiter, now, standing);
+		if (OXT_UNLIKELY(e != NULL)) {
+			postLockActions.push_back(boost::bind(
+				GetCallback::call,
+				waiter.callback,
+				SessionPtr(),
+				e));
+			getWaitlist.erase(getWaitlist.begin() + index);
+			continue;
+		}
+
 		RouteResult result = route(waiter.options);
 		if (result.process != NULL) {
 			postLockActions.push_back(boost::bind(
@@ -294,7 +389,8 @@ Group::assignSessionsToGetWaiters(boost::container::vector<Callback> &postLockAc
 				waiter.callback,
 				newSession(result.process),
 				ExceptionPtr()));
-			getWaitlist.erase(getWaitlist.begin() + i);
+			recordGetWaiterAssigned(waiter, now);
+			getWaitlist.erase(getWaitlist.begin() + index);
 		} else {
 			done = result.finished;
 			if (!result.finished) {
@@ -45,6 +45,32 @@ using namespace boost;
  ****************************/
 
 
+// Thread-safe, but only call outside the pool lock!
+void
+Group::reportResponseTimeout(const ProcessPtr &process, unsigned int detachThreshold) {
+	// Standard resource management boilerplate stuff...
+	Pool *pool = getPool();
+	boost::container::vector<Callback> actions;
+	boost::unique_lock<boost::mutex> lock(pool->syncher);
+	if (!isAlive() || !process->isAlive()) {
+		return;
+	}
+
+	process->responseTimeouts++;
+	process->consecutiveResponseTimeouts++;
+	if (detachThreshold > 0
+	 && process->consecutiveResponseTimeouts >= detachThreshold
+	 && process->enabled != Process::DETACHED)
+	{
+		P_WARN("Process " << process->inspect() << " did not respond in time "
+			<< process->consecutiveResponseTimeouts << " times in a row; detaching it");
+		pool->detachProcessUnlocked(process, actions);
+		pool->fullVerifyInvariants();
+		lock.unlock();
+		runAllActions(actions);
+	}
+}
+
 void
 Group::cleanupSpawner(boost::container::vector<Callback> &postLockActions) {
 	assert(isAlive());
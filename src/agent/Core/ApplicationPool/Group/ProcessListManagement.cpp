@@ -45,40 +45,53 @@ using namespace boost;
  ****************************/
 
 
+/**
+ * Returns the process with the given sticky session ID, no matter whether
+ * it's enabled, disabling, disabled or standby. Returns NULL if there is
+ * no such process, or if it has been detached.
+ */
 Process *
 Group::findProcessWithStickySessionId(unsigned int id) const {
-	ProcessList::const_iterator it, end = enabledProcesses.end();
-	for (it = enabledProcesses.begin(); it != end; it++) {
-		Process *process = it->get();
-		if (process->getStickySessionId() == id) {
-			return process;
-		}
+	boost::unordered_map<unsigned int, Process *>::const_iterator it =
+		stickySessionIndex.find(id);
+	if (it != stickySessionIndex.end()) {
+		return it->second;
+	} else {
+		return NULL;
 	}
-	return NULL;
 }
 
+/**
+ * Picks the enabled process that a sticky session is routed to when the
+ * process it belongs to cannot take it (see `options.stickySessionsFallback`).
+ * Uses rendezvous hashing: every process is weighted by a hash of its own
+ * sticky session ID and the requested one. All requests for the same session
+ * therefore go to the same process, and adding or removing a process only
+ * moves the sessions that hash to it. Processes that are totally busy are
+ * skipped. Returns NULL if all enabled processes are totally busy.
+ */
 Process *
-Group::findProcessWithStickySessionIdOrLowestBusyness(unsigned int id) const {
-	int leastBusyProcessIndex = -1;
-	int lowestBusyness = 0;
-	unsigned int i, size = enabledProcessBusynessLevels.size();
-	const int *enabledProcessBusynessLevels = &this->enabledProcessBusynessLevels[0];
+Group::findEnabledProcessWithStickySessionHash(unsigned int id) const {
+	Process *result = NULL;
+	boost::uint32_t highestWeight = 0;
+	ProcessList::const_iterator it, end = enabledProcesses.end();
 
-	for (i = 0; i < size; i++) {
-		Process *process = enabledProcesses[i].get();
-		if (process->getStickySessionId() == id) {
-			return process;
-		} else if (leastBusyProcessIndex == -1 || enabledProcessBusynessLevels[i] < lowestBusyness) {
-			leastBusyProcessIndex = i;
-			lowestBusyness = enabledProcessBusynessLevels[i];
+	for (it = enabledProcesses.begin(); it != end; it++) {
+		Process *process = it->get();
+		if (!process->canBeRoutedTo()) {
+			continue;
 		}
-	}
 
-	if (leastBusyProcessIndex == -1) {
-		return NULL;
-	} else {
-		return enabledProcesses[leastBusyProcessIndex].get();
+		boost::uint32_t key[2] = { id, process->getStickySessionId() };
+		Hasher hasher;
+		hasher.update((const char *) key, sizeof(key));
+		boost::uint32_t weight = hasher.finalize();
+		if (result == NULL || weight > highestWeight) {
+			result = process;
+			highestWeight = weight;
+		}
 	}
+	return result;
 }
 
 Process *
@@ -126,8 +139,82 @@ Group::findEnabledProcessWithLowestBusyness() const {
 }
 
 /**
- * Adds a process to the given list (enabledProcess, disablingProcesses, disabledProcesses)
- * and sets the process->enabled flag accordingly.
+ * Like findEnabledProcessWithLowestBusyness(), but gives processes that
+ * are still warming up a smaller share of the traffic. Routable processes
+ * are always preferred over totally busy ones, no matter how young.
+ */
+Process *
+Group::findEnabledProcessWithLowestWarmupBusyness(unsigned long long now) const {
+	unsigned long long warmupTime = options.warmupTime * 1000000ull;
+	Process *leastBusyProcess = NULL;
+	double lowestBusyness = 0;
+	bool routable = false;
+	ProcessList::const_iterator it;
+	ProcessList::const_iterator end = enabledProcesses.end();
+
+	for (it = enabledProcesses.begin(); it != end; it++) {
+		Process *process = (*it).get();
+		double busyness = process->getWarmupBusyness(now, warmupTime);
+		bool canBeRoutedTo = process->canBeRoutedTo();
+		if (leastBusyProcess == NULL
+		 || (canBeRoutedTo && !routable)
+		 || (canBeRoutedTo == routable && busyness < lowestBusyness))
+		{
+			leastBusyProcess = process;
+			lowestBusyness = busyness;
+			routable = canBeRoutedTo;
+		}
+	}
+	return leastBusyProcess;
+}
+
+/**
+ * Used by route() during a rolling restart. Prefers routable new generation
+ * processes, so that new requests go to the new version of the application
+ * as soon as its processes are ready, and the old generation processes only
+ * finish what they're doing. Old generation processes are routed to while
+ * all new generation processes are totally busy. Within a generation, the
+ * process with the lowest busyness is chosen, taking warmup into account.
+ */
+Process *
+Group::findEnabledProcessPreferringNewGeneration() const {
+	unsigned long long now = 0;
+	unsigned long long warmupTime = options.warmupTime * 1000000ull;
+	Process *leastBusyProcess = NULL;
+	double lowestBusyness = 0;
+	int bestRank = -1;
+	ProcessList::const_iterator it;
+	ProcessList::const_iterator end = enabledProcesses.end();
+
+	if (warmupEndTime != 0) {
+		now = SystemTime::getUsec();
+		if (now >= warmupEndTime) {
+			now = 0;
+		}
+	}
+
+	for (it = enabledProcesses.begin(); it != end; it++) {
+		Process *process = (*it).get();
+		// 2: routable new generation, 1: routable old generation, 0: totally busy.
+		int rank = process->canBeRoutedTo() ? (process->oldGeneration ? 1 : 2) : 0;
+		double busyness = (now != 0)
+			? process->getWarmupBusyness(now, warmupTime)
+			: process->busyness();
+		if (leastBusyProcess == NULL
+		 || rank > bestRank
+		 || (rank == bestRank && busyness < lowestBusyness))
+		{
+			leastBusyProcess = process;
+			lowestBusyness = busyness;
+			bestRank = rank;
+		}
+	}
+	return leastBusyProcess;
+}
+
+/**
+ * Adds a process to the given list (enabledProcess, disablingProcesses, disabledProcesses,
+ * standbyProcesses) and sets the process->enabled flag accordingly.
  * The process must currently not be in any list. This function does not fix
  * getWaitlist invariants or other stuff.
  */
@@ -135,6 +222,9 @@ void
 Group::addProcessToList(const ProcessPtr &process, ProcessList &destination) {
 	destination.push_back(process);
 	process->setIndex(destination.size() - 1);
+	if (&destination != &detachedProcesses && process->getStickySessionId() != 0) {
+		stickySessionIndex[process->getStickySessionId()] = process.get();
+	}
 	if (&destination == &enabledProcesses) {
 		process->enabled = Process::ENABLED;
 		enabledCount++;
@@ -149,6 +239,10 @@ Group::addProcessToList(const ProcessPtr &process, ProcessList &destination) {
 		assert(process->sessions == 0);
 		process->enabled = Process::DISABLED;
 		disabledCount++;
+	} else if (&destination == &standbyProcesses) {
+		assert(process->sessions == 0);
+		process->enabled = Process::STANDBY;
+		standbyCount++;
 	} else if (&destination == &detachedProcesses) {
 		assert(process->isAlive());
 		process->enabled = Process::DETACHED;
@@ -159,7 +253,8 @@ Group::addProcessToList(const ProcessPtr &process, ProcessList &destination) {
 }
 
 /**
- * Removes a process to the given list (enabledProcess, disablingProcesses, disabledProcesses).
+ * Removes a process to the given list (enabledProcess, disablingProcesses, disabledProcesses,
+ * standbyProcesses).
  * This function does not fix getWaitlist invariants or other stuff.
  */
 void
@@ -168,6 +263,13 @@ Group::removeProcessFromList(const ProcessPtr &process, ProcessList &source) {
 
 	source.erase(source.begin() + process->getIndex());
 	process->setIndex(-1);
+	if (&source != &detachedProcesses) {
+		boost::unordered_map<unsigned int, Process *>::iterator it =
+			stickySessionIndex.find(process->getStickySessionId());
+		if (it != stickySessionIndex.end() && it->second == process.get()) {
+			stickySessionIndex.erase(it);
+		}
+	}
 
 	switch (process->enabled) {
 	case Process::ENABLED:
@@ -185,6 +287,10 @@ Group::removeProcessFromList(const ProcessPtr &process, ProcessList &source) {
 		assert(&source == &disabledProcesses);
 		disabledCount--;
 		break;
+	case Process::STANDBY:
+		assert(&source == &standbyProcesses);
+		standbyCount--;
+		break;
 	case Process::DETACHED:
 		assert(&source == &detachedProcesses);
 		break;
@@ -263,6 +369,73 @@ Group::enableAllDisablingProcesses(boost::container::vector<Callback> &postLockA
 	clearDisableWaitlist(DR_ERROR, postLockActions);
 }
 
+/**
+ * Whether a process that is about to be attached should become a standby
+ * process, i.e. whether there are fewer than `options.standbyProcesses` of
+ * them while the enabled processes can handle the current load by themselves.
+ * Processes that exceed the memory limit are replaced first.
+ */
+bool
+Group::needsStandbyProcess() const {
+	return standbyCount < (int) options.standbyProcesses
+		&& enabledCount > 0
+		&& !m_rollingRestarting
+		&& getWaitlist.empty()
+		&& disableWaitlist.empty()
+		&& countProcessesExceedingMemoryLimit() == 0
+		&& !allEnabledProcessesAreTotallyBusy()
+		&& getProcessCount() >= options.minProcesses;
+}
+
+/** Whether the spawn loop should spawn more processes to refill the standby processes. */
+bool
+Group::standbyProcessesMissing() const {
+	return standbyCount < (int) options.standbyProcesses
+		&& enabledCount > 0
+		&& !m_rollingRestarting;
+}
+
+/** Whether get() should promote a standby process before routing a request. */
+bool
+Group::shouldPromoteStandbyProcess() const {
+	return standbyCount > 0
+		&& (enabledCount == 0
+			|| allEnabledProcessesAreTotallyBusy()
+			|| !getWaitlist.empty());
+}
+
+/**
+ * Moves the oldest standby process to `enabledProcesses`, so that it can
+ * handle requests right away, and assigns sessions to get waiters.
+ * Returns false if there are no standby processes.
+ */
+bool
+Group::promoteStandbyProcess(boost::container::vector<Callback> &postLockActions) {
+	if (standbyProcesses.empty()) {
+		return false;
+	}
+
+	ProcessPtr process = standbyProcesses.front();
+	P_DEBUG("Promoting standby process " << process->inspect());
+	removeProcessFromList(process, standbyProcesses);
+	// Otherwise the garbage collector may consider the process to
+	// have been idle ever since it was spawned.
+	process->lastUsed = SystemTime::getUsec();
+	addProcessToList(process, enabledProcesses);
+	if (!getWaitlist.empty()) {
+		assignSessionsToGetWaiters(postLockActions);
+	}
+	return true;
+}
+
+void
+Group::detachStandbyProcesses(boost::container::vector<Callback> &postLockActions) {
+	while (!standbyProcesses.empty()) {
+		ProcessPtr process = standbyProcesses.back();
+		detach(process, postLockActions);
+	}
+}
+
 /**
  * The `immediately` parameter only has effect if the detached processes checker
  * thread is active. It means that, if the thread is currently sleeping, it should
@@ -411,8 +584,18 @@ Group::attach(const ProcessPtr &process,
 	}
 
 	process->initializeStickySessionId(generateStickySessionId());
-	P_DEBUG("Attaching process " << process->inspect());
-	addProcessToList(process, enabledProcesses);
+	process->slot = findFreeProcessSlot();
+	if (needsStandbyProcess()) {
+		P_DEBUG("Attaching process " << process->inspect() << " as standby process");
+		addProcessToList(process, standbyProcesses);
+	} else {
+		P_DEBUG("Attaching process " << process->inspect());
+		addProcessToList(process, enabledProcesses);
+		if (options.warmupTime > 0) {
+			warmupEndTime = std::max(warmupEndTime,
+				process->getSpawnEndTime() + options.warmupTime * 1000000ull);
+		}
+	}
 
 	/* Now that there are enough resources, relevant processes in
 	 * 'disableWaitlist' can be disabled.
@@ -479,6 +662,8 @@ Group::detach(const ProcessPtr &process, boost::container::vector<Callback> &pos
 			removeProcessFromList(process, disablingProcesses);
 			removeFromDisableWaitlist(process, DR_NOOP, postLockActions);
 		}
+	} else if (process->enabled == Process::STANDBY) {
+		removeProcessFromList(process, standbyProcesses);
 	} else {
 		assert(process->enabled == Process::DISABLED);
 		assert(!disabledProcesses.empty());
@@ -509,14 +694,20 @@ Group::detachAll(boost::container::vector<Callback> &postLockActions) {
 	foreach (ProcessPtr process, disabledProcesses) {
 		addProcessToList(process, detachedProcesses);
 	}
+	foreach (ProcessPtr process, standbyProcesses) {
+		addProcessToList(process, detachedProcesses);
+	}
 
 	enabledProcesses.clear();
 	disablingProcesses.clear();
 	disabledProcesses.clear();
+	standbyProcesses.clear();
 	enabledProcessBusynessLevels.clear();
+	stickySessionIndex.clear();
 	enabledCount = 0;
 	disablingCount = 0;
 	disabledCount = 0;
+	standbyCount = 0;
 	nEnabledProcessesTotallyBusy = 0;
 	clearDisableWaitlist(DR_NOOP, postLockActions);
 	startCheckingDetachedProcesses(false);
@@ -541,6 +732,10 @@ Group::enable(const ProcessPtr &process, boost::container::vector<Callback> &pos
 		P_DEBUG("Enabling DISABLED process " << process->inspect());
 		removeProcessFromList(process, disabledProcesses);
 		addProcessToList(process, enabledProcesses);
+	} else if (process->enabled == Process::STANDBY) {
+		P_DEBUG("Enabling STANDBY process " << process->inspect());
+		removeProcessFromList(process, standbyProcesses);
+		addProcessToList(process, enabledProcesses);
 	} else {
 		P_DEBUG("Enabling ENABLED process " << process->inspect());
 	}
@@ -594,6 +789,10 @@ Group::disable(const ProcessPtr &process, const DisableCallback &callback) {
 		P_DEBUG("Disabling DISABLING process " << process->inspect() <<
 			info.name << "; command queued, deferring disable command completion");
 		return DR_DEFERRED;
+	} else if (process->enabled == Process::STANDBY) {
+		P_DEBUG("Disabling STANDBY process " << process->inspect() <<
+			info.name << "; standby processes don't handle requests anyway");
+		return DR_NOOP;
 	} else {
 		assert(disabledCount > 0);
 		P_DEBUG("Disabling DISABLED process " << process->inspect() <<
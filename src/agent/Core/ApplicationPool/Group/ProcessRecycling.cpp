@@ -0,0 +1,282 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2015 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#include <Core/ApplicationPool/Group.h>
+
+/*************************************************************************
+ *
+ * Process recycling functions for ApplicationPool2::Group
+ *
+ * Processes are recycled, i.e. replaced by fresh ones, when they have
+ * processed `options.maxRequests` requests (see Group::onSessionClose())
+ * or when they use more private memory than `options.memoryLimit`. The
+ * latter is checked by the pool's analytics collector, every time it has
+ * updated the processes' metrics.
+ *
+ * A process that exceeds the memory limit is marked, but keeps serving
+ * requests until it can be replaced without losing capacity:
+ *
+ *  - If there is a standby process, it is promoted in its place.
+ *  - Otherwise, if the group may spawn, a new process is spawned first.
+ *    The spawn loop detaches a marked process every time it has attached
+ *    a new one, see replaceProcessExceedingMemoryLimit().
+ *  - Otherwise, the marked process is only detached if that leaves at
+ *    least `options.minProcesses` (and at least 1) processes. Else it is
+ *    retried the next time the limits are checked.
+ *
+ * Detached processes finish their current requests before they're shut down.
+ *
+ * If the memory limit is lower than what the app uses right after spawning,
+ * then every replacement exceeds it too. To avoid replacing processes over
+ * and over, the group backs off when freshly spawned processes repeatedly
+ * exceed the limit: no processes are recycled for exceeding it for a while,
+ * and that period doubles every time it happens again. See
+ * updateMemoryLimitBackoff().
+ *
+ *************************************************************************/
+
+namespace Passenger {
+namespace ApplicationPool2 {
+
+using namespace std;
+using namespace boost;
+
+/** Processes younger than this are considered freshly spawned. */
+static const unsigned long long MEMORY_LIMIT_BASELINE_AGE = 30 * 1000000ull;
+static const unsigned long long MEMORY_LIMIT_MIN_BACKOFF = 60 * 1000000ull;
+static const unsigned long long MEMORY_LIMIT_MAX_BACKOFF = 60 * 60 * 1000000ull;
+
+
+/****************************
+ *
+ * Private methods
+ *
+ ****************************/
+
+
+bool
+Group::processExceedsMemoryLimit(const Process *process) const {
+	return options.memoryLimit > 0
+		&& process->metrics.isValid()
+		&& process->metrics.realMemory() > (size_t) options.memoryLimit * 1024;
+}
+
+/**
+ * Called by checkMemoryLimits() with what it has learned about the memory
+ * usage of freshly spawned processes. If they exceeded the memory limit
+ * twice in a row, then the limit is probably below the app's baseline
+ * memory usage, so we stop recycling processes for exceeding it for a
+ * while. A freshly spawned process that is within the limit resets this.
+ */
+void
+Group::updateMemoryLimitBackoff(unsigned long long now, bool baselineExceeded,
+	bool baselineWithinLimit, size_t baselineMemory)
+{
+	if (baselineWithinLimit) {
+		memoryLimitBackoffLevel = 0;
+		memoryLimitBackoffEndTime = 0;
+	} else if (baselineExceeded && now >= memoryLimitBackoffEndTime) {
+		memoryLimitBackoffLevel++;
+		if (memoryLimitBackoffLevel >= 2) {
+			unsigned long long duration = std::min(MEMORY_LIMIT_MAX_BACKOFF,
+				MEMORY_LIMIT_MIN_BACKOFF << std::min(memoryLimitBackoffLevel - 2, 6u));
+			memoryLimitBackoffEndTime = now + duration;
+			P_WARN("Processes of group " << info.name << " use " <<
+				(baselineMemory / 1024) << " MB of memory right after spawning, " <<
+				"which exceeds the memory limit of " << options.memoryLimit <<
+				" MB. The memory limit is probably too low. Processes won't be " <<
+				"replaced for exceeding it during the next " <<
+				(duration / 1000000) << " seconds");
+		}
+	}
+}
+
+unsigned int
+Group::countProcessesExceedingMemoryLimit() const {
+	const ProcessList *lists[] = { &enabledProcesses, &disablingProcesses, &disabledProcesses };
+	unsigned int result = 0;
+
+	for (unsigned int i = 0; i < sizeof(lists) / sizeof(ProcessList *); i++) {
+		ProcessList::const_iterator it, end = lists[i]->end();
+		for (it = lists[i]->begin(); it != end; it++) {
+			if ((*it)->memoryLimitExceeded) {
+				result++;
+			}
+		}
+	}
+	return result;
+}
+
+/**
+ * Returns the marked process that is the cheapest to get rid of: a disabled
+ * or disabling one if possible, otherwise the enabled one with the lowest
+ * busyness. Returns NULL if no process exceeds the memory limit.
+ */
+Process *
+Group::findProcessExceedingMemoryLimitToDetach() const {
+	const ProcessList *lists[] = { &disabledProcesses, &disablingProcesses, &enabledProcesses };
+
+	for (unsigned int i = 0; i < sizeof(lists) / sizeof(ProcessList *); i++) {
+		int lowestBusyness = -1;
+		Process *leastBusyProcess = NULL;
+		ProcessList::const_iterator it, end = lists[i]->end();
+
+		for (it = lists[i]->begin(); it != end; it++) {
+			Process *process = (*it).get();
+			if (process->memoryLimitExceeded
+			 && (lowestBusyness == -1 || lowestBusyness > process->busyness()))
+			{
+				lowestBusyness = process->busyness();
+				leastBusyProcess = process;
+			}
+		}
+		if (leastBusyProcess != NULL) {
+			return leastBusyProcess;
+		}
+	}
+	return NULL;
+}
+
+void
+Group::detachProcessExceedingMemoryLimit(const ProcessPtr &process,
+	boost::container::vector<Callback> &postLockActions)
+{
+	P_DEBUG("Detaching process " << process->inspect() <<
+		" because it exceeds the memory limit");
+	processesRecycledForMemoryLimit++;
+	detach(process, postLockActions);
+}
+
+/**
+ * Marks the processes that exceed `options.memoryLimit`, and replaces as many
+ * of them as possible. Called by the analytics collector after it has updated
+ * the processes' metrics.
+ */
+void
+Group::checkMemoryLimits(boost::container::vector<Callback> &postLockActions) {
+	if (options.memoryLimit == 0 || !isAlive() || restarting() || m_rollingRestarting) {
+		return;
+	}
+
+	unsigned long long now = SystemTime::getUsec();
+	bool backingOff = now < memoryLimitBackoffEndTime;
+	bool baselineExceeded = false;
+	bool baselineWithinLimit = false;
+	size_t baselineMemory = 0;
+
+	// Standby processes don't serve requests, so they can be detached
+	// right away. The spawn loop refills them.
+	vector<ProcessPtr> standbyProcessesToDetach;
+	const ProcessList *lists[] = { &standbyProcesses, &enabledProcesses,
+		&disablingProcesses, &disabledProcesses };
+	for (unsigned int i = 0; i < sizeof(lists) / sizeof(ProcessList *); i++) {
+		ProcessList::const_iterator it, end = lists[i]->end();
+		for (it = lists[i]->begin(); it != end; it++) {
+			Process *process = it->get();
+			bool fresh = process->getSpawnEndTime() + MEMORY_LIMIT_BASELINE_AGE > now;
+
+			if (process->memoryLimitExceeded || !process->metrics.isValid()) {
+				continue;
+			} else if (!processExceedsMemoryLimit(process)) {
+				baselineWithinLimit = baselineWithinLimit || fresh;
+				continue;
+			}
+
+			if (fresh) {
+				baselineExceeded = true;
+				baselineMemory = std::max(baselineMemory, process->metrics.realMemory());
+			}
+			if (backingOff) {
+				continue;
+			}
+			if (lists[i] == &standbyProcesses) {
+				standbyProcessesToDetach.push_back(*it);
+			} else {
+				P_WARN("Process " << process->inspect() << " uses " <<
+					(process->metrics.realMemory() / 1024) << " MB of memory, " <<
+					"which exceeds the limit of " << options.memoryLimit <<
+					" MB. It will be replaced");
+				process->memoryLimitExceeded = true;
+			}
+		}
+	}
+
+	updateMemoryLimitBackoff(now, baselineExceeded, baselineWithinLimit,
+		baselineMemory);
+
+	foreach (const ProcessPtr &process, standbyProcessesToDetach) {
+		detachProcessExceedingMemoryLimit(process, postLockActions);
+	}
+
+	unsigned int pending = countProcessesExceedingMemoryLimit();
+	while (pending > 0 && promoteStandbyProcess(postLockActions)) {
+		detachProcessExceedingMemoryLimit(
+			ProcessPtr(findProcessExceedingMemoryLimitToDetach()),
+			postLockActions);
+		pending--;
+	}
+
+	if (pending == 0) {
+		if (shouldSpawn()) {
+			spawn();
+		}
+	} else if (allowSpawn()) {
+		spawn();
+	} else {
+		unsigned int minProcesses = std::max(1u, options.minProcesses);
+		bool detached = false;
+		while (pending > 0 && getProcessCount() > minProcesses) {
+			detachProcessExceedingMemoryLimit(
+				ProcessPtr(findProcessExceedingMemoryLimitToDetach()),
+				postLockActions);
+			pending--;
+			detached = true;
+		}
+		if (detached) {
+			pool->possiblySpawnMoreProcessesForExistingGroups();
+		}
+	}
+}
+
+/**
+ * Called by the spawn loop after a new process has been attached. Detaches
+ * a process that exceeds the memory limit, now that its replacement is ready.
+ *
+ * Returns whether the spawn loop should continue with the next replacement.
+ */
+bool
+Group::replaceProcessExceedingMemoryLimit(boost::container::vector<Callback> &postLockActions) {
+	Process *process = findProcessExceedingMemoryLimitToDetach();
+	if (process == NULL) {
+		return false;
+	}
+
+	detachProcessExceedingMemoryLimit(ProcessPtr(process), postLockActions);
+	return countProcessesExceedingMemoryLimit() > 0;
+}
+
+
+} // namespace ApplicationPool2
+} // namespace Passenger
@@ -0,0 +1,183 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2015 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#include <Core/ApplicationPool/Group.h>
+
+/*************************************************************************
+ *
+ * Request queue management functions for ApplicationPool2::Group
+ *
+ * Requests that cannot be routed to a process immediately are put in
+ * getWaitlist. A queue that is fed faster than it is drained keeps growing
+ * until it overflows at maxRequestQueueSize, and by then every request in
+ * it has waited so long that its client has probably given up already. The
+ * functions in this file bound the time that requests spend in the queue:
+ *
+ *  - A waiter may have a deadline, derived from options.maxRequestQueueTime.
+ *    Once it passes, the waiter is removed from the queue and fails with a
+ *    RequestQueueTimeoutException, which results in a fast 503.
+ *  - Standing queue detection, modeled after CoDel: a short burst drains
+ *    quickly, but if the queue has not been empty for
+ *    options.requestQueueInterval msec then it is a standing queue, meaning
+ *    that the group is persistently overloaded. Waiters in a standing queue
+ *    that have waited longer than options.requestQueueTarget msec are shed.
+ *  - Adaptive LIFO: if options.requestQueueAdaptiveLifo is set, a standing
+ *    queue is served newest first, so that the requests that do get served
+ *    are the ones whose clients are most likely still waiting.
+ *
+ * Expired waiters are removed while assigning sessions to waiters, when a
+ * new waiter would otherwise overflow the queue, and by the garbage
+ * collector, which is scheduled to run when the next waiter expires.
+ *
+ *************************************************************************/
+
+namespace Passenger {
+namespace ApplicationPool2 {
+
+using namespace std;
+using namespace boost;
+
+
+/****************************
+ *
+ * Private methods
+ *
+ ****************************/
+
+
+bool
+Group::requestQueueIsStanding(unsigned long long now) const {
+	return options.requestQueueTarget != 0
+		&& !getWaitlist.empty()
+		&& now > getWaitlistLastEmptyTime
+		&& now - getWaitlistLastEmptyTime > options.requestQueueInterval * 1000ull;
+}
+
+bool
+Group::shouldServeGetWaitlistInLifoOrder(unsigned long long now) const {
+	return options.requestQueueAdaptiveLifo && requestQueueIsStanding(now);
+}
+
+/**
+ * Checks whether the given waiter must be removed from the queue. If so,
+ * it is counted in the statistics, and the exception that the waiter must
+ * be failed with is returned. Otherwise, returns a null pointer.
+ */
+ExceptionPtr
+Group::checkGetWaiterExpired(const GetWaiter &waiter, unsigned long long now,
+	bool standing)
+{
+	unsigned long long waitTime = (now > waiter.enqueuedAt)
+		? now - waiter.enqueuedAt
+		: 0;
+
+	if (waiter.deadline != 0 && now >= waiter.deadline) {
+		getWaitersTimedOut++;
+		return boost::make_shared<RequestQueueTimeoutException>(waitTime, false);
+	} else if (standing && waitTime > options.requestQueueTarget * 1000ull) {
+		getWaitersShed++;
+		return boost::make_shared<RequestQueueTimeoutException>(waitTime, true);
+	} else {
+		return ExceptionPtr();
+	}
+}
+
+void
+Group::recordGetWaiterAssigned(const GetWaiter &waiter, unsigned long long now) {
+	getWaitlistWaitTimes.add((now > waiter.enqueuedAt)
+		? now - waiter.enqueuedAt
+		: 0);
+}
+
+void
+Group::shedExpiredGetWaiters(unsigned long long now,
+	boost::container::vector<Callback> &postLockActions)
+{
+	bool standing = requestQueueIsStanding(now);
+	deque<GetWaiter>::iterator it = getWaitlist.begin();
+
+	while (it != getWaitlist.end()) {
+		ExceptionPtr e = checkGetWaiterExpired(*it, now, standing);
+		if (e != NULL) {
+			P_DEBUG("Removing request from queue of group " << getName() <<
+				": " << e->what());
+			postLockActions.push_back(boost::bind(GetCallback::call,
+				it->callback, SessionPtr(), e));
+			it = getWaitlist.erase(it);
+		} else {
+			it++;
+		}
+	}
+}
+
+/**
+ * Returns the earliest time at which a waiter in the queue expires, or 0 if
+ * no waiter ever expires. Waiters that have already expired must have been
+ * removed with shedExpiredGetWaiters() before calling this.
+ */
+unsigned long long
+Group::getNextGetWaiterExpiryTime() const {
+	unsigned long long result = 0;
+	deque<GetWaiter>::const_iterator it, end = getWaitlist.end();
+
+	for (it = getWaitlist.begin(); it != end; it++) {
+		if (it->deadline != 0 && (result == 0 || it->deadline < result)) {
+			result = it->deadline;
+		}
+	}
+
+	if (options.requestQueueTarget != 0 && !getWaitlist.empty()) {
+		// The oldest waiter is the first one to be shed, which happens
+		// once the queue is standing and the waiter has exceeded the target.
+		unsigned long long shedTime = std::max(
+			getWaitlistLastEmptyTime + options.requestQueueInterval * 1000ull,
+			getWaitlist.front().enqueuedAt + options.requestQueueTarget * 1000ull) + 1;
+		if (result == 0 || shedTime < result) {
+			result = shedTime;
+		}
+	}
+
+	return result;
+}
+
+/**
+ * Makes sure that the garbage collector runs no later than `expiryTime`,
+ * so that waiters are shed even if no process becomes available to
+ * drain the queue.
+ */
+void
+Group::scheduleGetWaiterExpiry(unsigned long long expiryTime) {
+	Pool *pool = getPool();
+	if (pool->nextGarbageCollectionTime == 0
+	 || expiryTime < pool->nextGarbageCollectionTime)
+	{
+		pool->nextGarbageCollectionTime = expiryTime;
+		wakeUpGarbageCollector();
+	}
+}
+
+
+} // namespace ApplicationPool2
+} // namespace Passenger
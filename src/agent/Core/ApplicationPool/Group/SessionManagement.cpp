@@ -53,28 +53,64 @@ using namespace boost;
  * If there are no enabled process, then waiting for one to spawn is too
  * expensive. The next best thing is to route to disabling processes
  * until more processes have been spawned.
+ *
+ * While processes are warming up (see `options.warmupTime`), their
+ * busyness is scaled by their age so that they receive a ramped share
+ * of the traffic.
+ *
+ * During a rolling restart, new generation processes are preferred over
+ * old generation ones as soon as they're ready.
+ *
+ * A request with a sticky session ID waits for the process that owns the
+ * session if it's totally busy, unless `options.stickySessionsFallback`
+ * is set.
  */
 Group::RouteResult
 Group::route(const Options &options) const {
 	if (OXT_LIKELY(enabledCount > 0)) {
 		if (options.stickySessionId == 0) {
-			Process *process = findEnabledProcessWithLowestBusyness();
+			Process *process;
+			if (OXT_UNLIKELY(m_rollingRestarting)) {
+				process = findEnabledProcessPreferringNewGeneration();
+			} else if (OXT_UNLIKELY(warmupEndTime != 0)) {
+				unsigned long long now = SystemTime::getUsec();
+				if (now < warmupEndTime) {
+					process = findEnabledProcessWithLowestWarmupBusyness(now);
+				} else {
+					process = findEnabledProcessWithLowestBusyness();
+				}
+			} else {
+				process = findEnabledProcessWithLowestBusyness();
+			}
 			if (process->canBeRoutedTo()) {
 				return RouteResult(process);
 			} else {
 				return RouteResult(NULL, true);
 			}
 		} else {
-			Process *process = findProcessWithStickySessionIdOrLowestBusyness(
-				options.stickySessionId);
-			if (process != NULL) {
-				if (process->canBeRoutedTo()) {
+			Process *process = findProcessWithStickySessionId(options.stickySessionId);
+			if (process != NULL && process->enabled != Process::ENABLED) {
+				process = NULL;
+			}
+			if (process != NULL && process->canBeRoutedTo()) {
+				return RouteResult(process);
+			} else if (options.stickySessionsFallback) {
+				process = findEnabledProcessWithStickySessionHash(options.stickySessionId);
+				if (process != NULL) {
 					return RouteResult(process);
 				} else {
-					return RouteResult(NULL, false);
+					return RouteResult(NULL, true);
 				}
+			} else if (process != NULL) {
+				// Other requests may still be routable to other processes.
+				return RouteResult(NULL, false);
 			} else {
-				return RouteResult(NULL, true);
+				process = findEnabledProcessWithLowestBusyness();
+				if (process->canBeRoutedTo()) {
+					return RouteResult(process);
+				} else {
+					return RouteResult(NULL, true);
+				}
 			}
 		}
 	} else {
@@ -180,11 +216,8 @@ Group::onSessionClose(Process *process, Session *session) {
 		)) || (
 			detachingBecauseCapacityNeeded = (
 				process->sessions == 0
-				&& getWaitlist.empty()
-				&& (
-					!pool->getWaitlist.empty()
-					|| anotherGroupIsWaitingForCapacity()
-				)
+				&& (getWaitlist.empty() || enabledCount > 1)
+				&& pool->shouldGiveUpProcessForCapacity(process)
 			)
 		);
 	bool shouldDisable =
@@ -200,9 +233,9 @@ Group::onSessionClose(Process *process, Session *session) {
 			if (detachingBecauseCapacityNeeded) {
 				/* Someone might be trying to get() a session for a different
 				 * group that couldn't be spawned because of lack of pool capacity.
-				 * If this group isn't under sufficiently load (as apparent by the
-				 * checked conditions) then now's a good time to detach
-				 * this process or group in order to free capacity.
+				 * If this group is using more than its fair share compared to
+				 * that group then now's a good time to detach this process in
+				 * order to free capacity.
 				 */
 				P_DEBUG("Process " << process->inspect() << " is no longer totally "
 					"busy; detaching it in order to make room in the pool");
@@ -213,6 +246,7 @@ Group::onSessionClose(Process *process, Session *session) {
 				P_DEBUG("Process " << process->inspect() <<
 					" has reached its maximum number of requests (" <<
 					options.maxRequests << "); detaching it");
+				processesRecycledForMaxRequests++;
 			}
 			pool->detachProcessUnlocked(process->shared_from_this(), actions);
 		} else {
@@ -265,9 +299,14 @@ Group::get(const Options &newOptions, const GetCallback &callback,
 			mergeOptions(newOptions);
 		}
 		if (OXT_UNLIKELY(!newOptions.noop && shouldSpawnForGetAction())) {
+			// Promoting a standby process provides capacity right away,
+			// while spawn() refills the standby processes in the background.
+			if (shouldPromoteStandbyProcess()) {
+				promoteStandbyProcess(postLockActions);
+			}
 			// If we're trying to spawn the first process for this group, and
 			// spawning failed because the pool is at full capacity, then we
-			// try to kill some random idle process in the pool and try again.
+			// try to kill an idle process of another group and try again.
 			if (spawn() == SR_ERR_POOL_AT_FULL_CAPACITY && enabledCount == 0) {
 				P_INFO("Unable to spawn the the sole process for group " << info.name <<
 					" because the max pool size has been reached. Trying " <<
@@ -281,6 +320,21 @@ Group::get(const Options &newOptions, const GetCallback &callback,
 						"for shutdown. Will try again later.");
 				}
 			}
+		} else if (OXT_UNLIKELY(!newOptions.noop
+			&& enabledCount > 0
+			&& !spawning()
+			&& allEnabledProcessesAreTotallyBusy()
+			&& !processUpperLimitsReached()
+			&& poolAtFullCapacity()))
+		{
+			// All our processes are busy and the pool is full. If another
+			// group is using more than its fair share then we take an idle
+			// process from it. See CapacityShares.
+			if (pool->freeCapacityForBusyGroup(this, postLockActions) != NULL) {
+				SpawnResult result = spawn();
+				assert(result == SR_OK);
+				(void) result;
+			}
 		}
 	}
 
@@ -24,6 +24,7 @@
  *  THE SOFTWARE.
  */
 #include <Core/ApplicationPool/Group.h>
+#include <MessageReadersWriters.h>
 
 /*************************************************************************
  *
@@ -91,6 +92,7 @@ Group::spawnThreadRealMain(const SpawningKit::SpawnerPtr &spawner,
 
 		ProcessPtr process;
 		ExceptionPtr exception;
+		unsigned long long spawnStartTime = SystemTime::getUsec();
 		try {
 			UPDATE_TRACE_POINT();
 			this_thread::restore_interruption ri(di);
@@ -101,8 +103,14 @@ Group::spawnThreadRealMain(const SpawningKit::SpawnerPtr &spawner,
 				throw e;
 			} else {
 				process = createProcessObject(spawner->spawn(options));
+				if (!options.warmupUrls.empty()) {
+					warmUpProcess(process, options);
+				}
 			}
 		} catch (const thread_interrupted &) {
+			if (process != NULL) {
+				Process::forceTriggerShutdownAndCleanup(process);
+			}
 			break;
 		} catch (const tracable_exception &e) {
 			exception = copyException(e);
@@ -147,12 +155,29 @@ Group::spawnThreadRealMain(const SpawningKit::SpawnerPtr &spawner,
 		processesBeingSpawned--;
 		assert(processesBeingSpawned == 0);
 
+		if (process != NULL) {
+			unsigned long long now = SystemTime::getUsec();
+			pool->metrics.processesSpawned.inc();
+			pool->metrics.spawnTimes.add((now > spawnStartTime) ? now - spawnStartTime : 0);
+		} else {
+			pool->metrics.spawnFailures.inc();
+		}
+
 		UPDATE_TRACE_POINT();
 		boost::container::vector<Callback> actions;
+		bool rollingRestartContinues = false;
+		bool memoryLimitReplacementContinues = false;
+		bool rolledBack = false;
 		if (process != NULL) {
 			AttachResult result = attach(process, actions);
 			if (result == AR_OK) {
 				guard.clear();
+				if (m_rollingRestarting) {
+					rollingRestartContinues = replaceOldGenerationProcess(actions);
+				} else {
+					memoryLimitReplacementContinues =
+						replaceProcessExceedingMemoryLimit(actions);
+				}
 				if (getWaitlist.empty()) {
 					pool->assignSessionsToGetWaiters(actions);
 				} else {
@@ -167,6 +192,21 @@ Group::spawnThreadRealMain(const SpawningKit::SpawnerPtr &spawner,
 					pool->possiblySpawnMoreProcessesForExistingGroups();
 				}
 			}
+		} else if (m_rollingRestarting) {
+			// The old generation processes that are left keep serving
+			// requests, so only fail the get waiters if there are none.
+			abortRollingRestart(exception, actions);
+			rolledBack = true;
+			if (enabledCount == 0) {
+				enableAllDisablingProcesses(actions);
+			}
+			if (enabledCount > 0) {
+				assignSessionsToGetWaiters(actions);
+			} else {
+				Pool::assignExceptionToGetWaiters(getWaitlist, exception, actions);
+			}
+			pool->assignSessionsToGetWaiters(actions);
+			done = true;
 		} else {
 			// TODO: sure this is the best thing? if there are
 			// processes currently alive we should just use them.
@@ -179,12 +219,21 @@ Group::spawnThreadRealMain(const SpawningKit::SpawnerPtr &spawner,
 		}
 
 		done = done
-			|| (processLowerLimitsSatisfied() && getWaitlist.empty())
+			|| (!rollingRestartContinues
+				&& !memoryLimitReplacementContinues
+				&& processLowerLimitsSatisfied()
+				&& getWaitlist.empty()
+				&& !standbyProcessesMissing())
 			|| processUpperLimitsReached()
 			|| pool->atFullCapacityUnlocked();
 		m_spawning = !done;
 		if (done) {
 			P_DEBUG("Spawn loop done");
+			if (rolledBack && shouldSpawn()) {
+				// Replace the processes that were detached during the
+				// rolling restart, using the restored spawner.
+				spawn();
+			}
 		} else {
 			processesBeingSpawned++;
 			P_DEBUG("Continue spawning");
@@ -203,6 +252,152 @@ Group::spawnThreadRealMain(const SpawningKit::SpawnerPtr &spawner,
 	}
 }
 
+/**
+ * Requests each of `options.warmupUrls` from a newly spawned process that
+ * hasn't been attached yet, so that it doesn't have to warm up its caches
+ * while serving real traffic. Failures are logged but otherwise ignored:
+ * a process that can't be warmed up is still better than no process.
+ *
+ * Called from the spawn thread, without holding the pool lock. May throw
+ * thread_interrupted.
+ */
+void
+Group::warmUpProcess(const ProcessPtr &process, const Options &options) {
+	TRACE_POINT();
+	vector<string> paths;
+	vector<string>::const_iterator it;
+
+	split(options.warmupUrls, ',', paths);
+	for (it = paths.begin(); it != paths.end(); it++) {
+		string path = strip(*it);
+		if (path.empty()) {
+			continue;
+		}
+		if (!startsWith(path, "/")) {
+			path.insert(0, 1, '/');
+		}
+
+		try {
+			sendWarmupRequest(process, options, path);
+		} catch (const SystemException &e) {
+			P_WARN("Cannot warm up process " << process->inspect() <<
+				" with " << path << ": " << e.what());
+		} catch (const TimeoutException &e) {
+			P_WARN("Cannot warm up process " << process->inspect() <<
+				" with " << path << ": " << e.what());
+		}
+	}
+}
+
+void
+Group::sendWarmupRequest(const ProcessPtr &process, const Options &options,
+	const StaticString &path)
+{
+	TRACE_POINT();
+	Socket *socket = process->findSessionSocketWithLowestBusyness();
+	unsigned long long timeout = options.startTimeout * 1000ull;
+	string baseURI, uri, pathInfo, queryString;
+	string::size_type pos;
+
+	if (options.baseURI != "/") {
+		baseURI = options.baseURI;
+	}
+	uri = baseURI + path;
+	pos = path.find('?');
+	if (pos == string::npos) {
+		pathInfo = path;
+	} else {
+		pathInfo = path.substr(0, pos);
+		queryString = path.substr(pos + 1);
+	}
+
+	// The connection is marked as fail so that it's closed after this
+	// request, because we read the response until EOF.
+	Connection connection = socket->checkoutConnection();
+	connection.fail = true;
+	ScopeGuard guard(boost::bind(&Socket::checkinConnection, socket, connection));
+
+	P_DEBUG("Warming up process " << process->inspect() << " with " << uri);
+	if (socket->protocol == "session") {
+		// This is copied from RequestHandler when it is sending data using the
+		// "session" protocol.
+		char sizeField[sizeof(boost::uint32_t)];
+		SmallVector<StaticString, 30> data;
+
+		data.push_back(StaticString(sizeField, sizeof(boost::uint32_t)));
+		data.push_back(P_STATIC_STRING_WITH_NULL("REQUEST_URI"));
+		data.push_back(StaticString(uri.c_str(), uri.size() + 1));
+		data.push_back(P_STATIC_STRING_WITH_NULL("PATH_INFO"));
+		data.push_back(StaticString(pathInfo.c_str(), pathInfo.size() + 1));
+		data.push_back(P_STATIC_STRING_WITH_NULL("SCRIPT_NAME"));
+		data.push_back(StaticString(baseURI.c_str(), baseURI.size() + 1));
+		data.push_back(P_STATIC_STRING_WITH_NULL("QUERY_STRING"));
+		data.push_back(StaticString(queryString.c_str(), queryString.size() + 1));
+		data.push_back(P_STATIC_STRING_WITH_NULL("REQUEST_METHOD"));
+		data.push_back(P_STATIC_STRING_WITH_NULL("GET"));
+		data.push_back(P_STATIC_STRING_WITH_NULL("SERVER_NAME"));
+		data.push_back(P_STATIC_STRING_WITH_NULL("localhost"));
+		data.push_back(P_STATIC_STRING_WITH_NULL("SERVER_PORT"));
+		data.push_back(P_STATIC_STRING_WITH_NULL("80"));
+		data.push_back(P_STATIC_STRING_WITH_NULL("SERVER_PROTOCOL"));
+		data.push_back(P_STATIC_STRING_WITH_NULL("HTTP/1.1"));
+		data.push_back(P_STATIC_STRING_WITH_NULL("REMOTE_ADDR"));
+		data.push_back(P_STATIC_STRING_WITH_NULL("127.0.0.1"));
+		data.push_back(P_STATIC_STRING_WITH_NULL("HTTP_HOST"));
+		data.push_back(P_STATIC_STRING_WITH_NULL("localhost"));
+		data.push_back(P_STATIC_STRING_WITH_NULL("HTTP_USER_AGENT"));
+		data.push_back(P_STATIC_STRING_WITH_NULL(SHORT_PROGRAM_NAME " warm-up"));
+		data.push_back(P_STATIC_STRING_WITH_NULL("PASSENGER_CONNECT_PASSWORD"));
+		data.push_back(getApiKey().toStaticString());
+		data.push_back(StaticString("", 1));
+
+		boost::uint32_t dataSize = 0;
+		for (unsigned int i = 1; i < data.size(); i++) {
+			dataSize += (boost::uint32_t) data[i].size();
+		}
+		Uint32Message::generate(sizeField, dataSize);
+
+		gatheredWrite(connection.fd, &data[0], data.size(), &timeout);
+	} else {
+		string request = "GET " + uri + " HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"User-Agent: " SHORT_PROGRAM_NAME " warm-up\r\n"
+			"Connection: close\r\n\r\n";
+		writeExact(connection.fd, request, &timeout);
+	}
+
+	// We only care about the status line; the rest is discarded.
+	UPDATE_TRACE_POINT();
+	char buf[1024 * 8];
+	string statusLine;
+	bool statusLineComplete = false;
+	while (true) {
+		if (!waitUntilReadable(connection.fd, &timeout)) {
+			throw TimeoutException("Timeout while waiting for the response");
+		}
+		ssize_t ret = syscalls::read(connection.fd, buf, sizeof(buf));
+		if (ret == -1) {
+			int e = errno;
+			throw SystemException("Cannot read the response", e);
+		} else if (ret == 0) {
+			break;
+		}
+		if (!statusLineComplete) {
+			statusLine.append(buf, ret);
+			pos = statusLine.find("\r\n");
+			if (pos != string::npos) {
+				statusLine.resize(pos);
+				statusLineComplete = true;
+			} else if (statusLine.size() > 1024) {
+				statusLineComplete = true;
+			}
+		}
+	}
+
+	P_INFO("Warmed up process " << process->inspect() << " with " << uri <<
+		": " << statusLine);
+}
+
 // The 'self' parameter is for keeping the current Group object alive while this thread is running.
 void
 Group::finalizeRestart(GroupPtr self,
@@ -264,7 +459,17 @@ Group::finalizeRestart(GroupPtr self,
 	spawner    = newSpawner;
 
 	m_restarting = false;
-	if (shouldSpawn()) {
+	if (m_rollingRestarting) {
+		// The old spawner is kept around until the rolling restart
+		// is done, so that it can be rolled back.
+		rollingRestartOldSpawner = oldSpawner;
+		oldSpawner.reset();
+		resetOptions(oldOptions, &rollingRestartOldOptions);
+		P_INFO("Rolling restart of group " << getName() << " begins: replacing " <<
+			rollingRestartTotal << " " <<
+			Pool::maybePluralize(rollingRestartTotal, "process", "processes"));
+		continueRollingRestart(postLockActions);
+	} else if (shouldSpawn()) {
 		spawn();
 	} else if (isWaitingForCapacity()) {
 		P_INFO("Group " << getName() << " is waiting for capacity to become available. "
@@ -287,6 +492,191 @@ Group::finalizeRestart(GroupPtr self,
 	}
 }
 
+void
+Group::markProcessesAsOldGeneration(ProcessList &processes) {
+	ProcessList::iterator it, end = processes.end();
+	for (it = processes.begin(); it != end; it++) {
+		(*it)->oldGeneration = true;
+		rollingRestartTotal++;
+	}
+}
+
+unsigned int
+Group::countOldGenerationProcesses() const {
+	const ProcessList *lists[] = { &enabledProcesses, &disablingProcesses, &disabledProcesses };
+	unsigned int result = 0;
+
+	for (unsigned int i = 0; i < sizeof(lists) / sizeof(ProcessList *); i++) {
+		ProcessList::const_iterator it, end = lists[i]->end();
+		for (it = lists[i]->begin(); it != end; it++) {
+			if ((*it)->oldGeneration) {
+				result++;
+			}
+		}
+	}
+	return result;
+}
+
+/**
+ * Returns the old generation process that is the cheapest to get rid of:
+ * a disabled or disabling one if possible, otherwise the enabled one with
+ * the lowest busyness. Returns NULL if there are no old generation processes.
+ */
+Process *
+Group::findOldGenerationProcessToDetach() const {
+	const ProcessList *lists[] = { &disabledProcesses, &disablingProcesses, &enabledProcesses };
+
+	for (unsigned int i = 0; i < sizeof(lists) / sizeof(ProcessList *); i++) {
+		int lowestBusyness = -1;
+		Process *leastBusyProcess = NULL;
+		ProcessList::const_iterator it, end = lists[i]->end();
+
+		for (it = lists[i]->begin(); it != end; it++) {
+			Process *process = (*it).get();
+			if (process->oldGeneration
+			 && (lowestBusyness == -1 || lowestBusyness > process->busyness()))
+			{
+				lowestBusyness = process->busyness();
+				leastBusyProcess = process;
+			}
+		}
+		if (leastBusyProcess != NULL) {
+			return leastBusyProcess;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * If the group or the pool is full, detaches up to `options.rollingRestartBatchSize`
+ * old generation processes so that their replacements can be spawned. Detached
+ * processes finish their current requests before they're shut down.
+ */
+void
+Group::makeRoomForRollingRestart(boost::container::vector<Callback> &postLockActions) {
+	if (allowSpawn()) {
+		return;
+	}
+
+	unsigned int batchSize = std::max(1u, options.rollingRestartBatchSize);
+	for (unsigned int i = 0; i < batchSize; i++) {
+		Process *process = findOldGenerationProcessToDetach();
+		if (process == NULL) {
+			break;
+		}
+		P_DEBUG("Detaching old generation process " << process->inspect() <<
+			" to make room for its replacement");
+		detach(ProcessPtr(process), postLockActions);
+		rollingRestartVacancies++;
+	}
+}
+
+/**
+ * Spawns the next new generation process, or finishes the rolling restart
+ * if there are no old generation processes left.
+ */
+void
+Group::continueRollingRestart(boost::container::vector<Callback> &postLockActions) {
+	assert(m_rollingRestarting);
+	if (countOldGenerationProcesses() == 0) {
+		finishRollingRestart(postLockActions);
+	} else if (!m_spawning) {
+		makeRoomForRollingRestart(postLockActions);
+		spawn();
+	}
+}
+
+/**
+ * Called by the spawn loop after a new generation process has been attached.
+ * Detaches the old generation process that it replaces, unless one was already
+ * detached ahead of time to make room for it.
+ *
+ * Returns whether the spawn loop should continue with the next replacement.
+ */
+bool
+Group::replaceOldGenerationProcess(boost::container::vector<Callback> &postLockActions) {
+	assert(m_rollingRestarting);
+	if (rollingRestartVacancies > 0) {
+		rollingRestartVacancies--;
+	} else {
+		Process *process = findOldGenerationProcessToDetach();
+		if (process != NULL) {
+			P_DEBUG("Detaching old generation process " << process->inspect() <<
+				" because its replacement is ready");
+			detach(ProcessPtr(process), postLockActions);
+		}
+	}
+
+	if (countOldGenerationProcesses() == 0) {
+		finishRollingRestart(postLockActions);
+		return false;
+	} else {
+		makeRoomForRollingRestart(postLockActions);
+		return true;
+	}
+}
+
+void
+Group::finishRollingRestart(boost::container::vector<Callback> &postLockActions) {
+	P_INFO("Rolling restart of group " << getName() << " done: replaced " <<
+		rollingRestartTotal << " " <<
+		Pool::maybePluralize(rollingRestartTotal, "process", "processes"));
+	clearRollingRestart(postLockActions);
+}
+
+/**
+ * Rolls back a rolling restart because a new generation process failed to
+ * spawn: the new generation processes are detached, the old generation
+ * processes that are left become regular processes again, and the old
+ * spawner is restored. The caller is responsible for the getWaitlist and
+ * for spawning processes to replace the detached ones.
+ */
+void
+Group::abortRollingRestart(const ExceptionPtr &exception,
+	boost::container::vector<Callback> &postLockActions)
+{
+	ProcessList *lists[] = { &enabledProcesses, &disablingProcesses, &disabledProcesses };
+	boost::container::vector<ProcessPtr> newProcesses;
+	boost::container::vector<ProcessPtr>::iterator p_it;
+
+	assert(m_rollingRestarting);
+	assert(rollingRestartOldSpawner != NULL);
+	P_WARN("A new process for group " << getName() << " could not be spawned "
+		"during a rolling restart, so rolling back to the previous version: " <<
+		exception->what());
+
+	for (unsigned int i = 0; i < sizeof(lists) / sizeof(ProcessList *); i++) {
+		ProcessList::iterator it, end = lists[i]->end();
+		for (it = lists[i]->begin(); it != end; it++) {
+			if ((*it)->oldGeneration) {
+				(*it)->oldGeneration = false;
+			} else {
+				newProcesses.push_back(*it);
+			}
+		}
+	}
+	for (p_it = newProcesses.begin(); p_it != newProcesses.end(); p_it++) {
+		detach(*p_it, postLockActions);
+	}
+
+	resetOptions(rollingRestartOldOptions);
+	postLockActions.push_back(boost::bind(doCleanupSpawner, spawner));
+	spawner = rollingRestartOldSpawner;
+	rollingRestartOldSpawner.reset();
+	clearRollingRestart(postLockActions);
+}
+
+void
+Group::clearRollingRestart(boost::container::vector<Callback> &postLockActions) {
+	if (rollingRestartOldSpawner != NULL) {
+		postLockActions.push_back(boost::bind(doCleanupSpawner, rollingRestartOldSpawner));
+		rollingRestartOldSpawner.reset();
+	}
+	m_rollingRestarting = false;
+	rollingRestartTotal = 0;
+	rollingRestartVacancies = 0;
+}
+
 
 /****************************
  *
@@ -295,6 +685,19 @@ Group::finalizeRestart(GroupPtr self,
  ****************************/
 
 
+/**
+ * Restarts this group. A blocking restart detaches all processes right away,
+ * and spawns new processes after the new spawner has been created.
+ *
+ * A rolling restart (`method == RM_ROLLING`, or `options.rollingRestart` by
+ * default) preserves the capacity of the group instead: the existing processes
+ * keep serving requests while new processes are spawned one by one, and every
+ * time a new process has been attached, an old one is detached. If the group
+ * or the pool is full, up to `options.rollingRestartBatchSize` old processes
+ * are detached ahead of their replacements. If a new process fails to spawn,
+ * the restart is rolled back to the old spawner. A rolling restart is not
+ * possible if there are no enabled processes.
+ */
 void
 Group::restart(const Options &options, RestartMethod method) {
 	boost::container::vector<Callback> actions;
@@ -310,7 +713,20 @@ Group::restart(const Options &options, RestartMethod method) {
 	m_spawning   = false;
 	m_restarting = true;
 	uuid         = generateUuid(pool);
-	detachAll(actions);
+	clearRollingRestart(actions);
+	if (enabledCount > 0
+	 && (method == RM_ROLLING || (method == RM_DEFAULT && options.rollingRestart)))
+	{
+		m_rollingRestarting = true;
+		// Standby processes don't handle requests, so there's no point in
+		// keeping them around until they're replaced.
+		detachStandbyProcesses(actions);
+		markProcessesAsOldGeneration(enabledProcesses);
+		markProcessesAsOldGeneration(disablingProcesses);
+		markProcessesAsOldGeneration(disabledProcesses);
+	} else {
+		detachAll(actions);
+	}
 	getPool()->interruptableThreads.create_thread(
 		boost::bind(&Group::finalizeRestart, this, shared_from_this(),
 			this->options.copyAndPersist().clearPerRequestFields(),
@@ -327,10 +743,20 @@ Group::restarting() const {
 	return m_restarting;
 }
 
+bool
+Group::rollingRestarting() const {
+	return m_rollingRestarting;
+}
+
 bool
 Group::needsRestart(const Options &options) {
 	if (m_restarting) {
 		return false;
+	} else if (restartFileWatchId != 0) {
+		// The file watcher tells us about changes asynchronously,
+		// so no filesystem calls are necessary here.
+		return restartFileChanged.exchange(false, boost::memory_order_acq_rel)
+			|| alwaysRestartFilePresent.load(boost::memory_order_acquire);
 	} else {
 		time_t now;
 		struct stat buf;
@@ -452,6 +878,8 @@ Group::shouldSpawn() const {
 			!processLowerLimitsSatisfied()
 			|| allEnabledProcessesAreTotallyBusy()
 			|| !getWaitlist.empty()
+			|| (m_rollingRestarting && !m_restarting)
+			|| standbyProcessesMissing()
 		);
 }
 
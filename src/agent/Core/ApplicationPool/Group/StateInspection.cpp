@@ -45,6 +45,7 @@ using namespace boost;
  ****************************/
 
 
+/** The number of processes that handle requests. Standby processes are not included. */
 unsigned int
 Group::getProcessCount() const {
 	return enabledCount + disablingCount + disabledCount;
@@ -57,7 +58,7 @@ Group::getProcessCount() const {
  */
 bool
 Group::processLowerLimitsSatisfied() const {
-	return capacityUsed() >= options.minProcesses;
+	return capacityUsed() - standbyCount >= options.minProcesses;
 }
 
 /**
@@ -86,7 +87,8 @@ Group::allEnabledProcessesAreTotallyBusy() const {
  */
 unsigned int
 Group::capacityUsed() const {
-	return enabledCount + disablingCount + disabledCount + processesBeingSpawned;
+	return enabledCount + disablingCount + disabledCount + standbyCount
+		+ processesBeingSpawned;
 }
 
 /**
@@ -128,8 +130,18 @@ Group::inspectXml(std::ostream &stream, bool includeSecrets) const {
 	stream << "<enabled_process_count>" << enabledCount << "</enabled_process_count>";
 	stream << "<disabling_process_count>" << disablingCount << "</disabling_process_count>";
 	stream << "<disabled_process_count>" << disabledCount << "</disabled_process_count>";
+	stream << "<standby_process_count>" << standbyCount << "</standby_process_count>";
 	stream << "<capacity_used>" << capacityUsed() << "</capacity_used>";
 	stream << "<get_wait_list_size>" << getWaitlist.size() << "</get_wait_list_size>";
+	stream << "<get_wait_list_wait_time>";
+	getWaitlistWaitTimes.toXml(stream);
+	stream << "</get_wait_list_wait_time>";
+	stream << "<get_waiters_timed_out>" << getWaitersTimedOut << "</get_waiters_timed_out>";
+	stream << "<get_waiters_shed>" << getWaitersShed << "</get_waiters_shed>";
+	stream << "<processes_recycled_for_max_requests>" << processesRecycledForMaxRequests <<
+		"</processes_recycled_for_max_requests>";
+	stream << "<processes_recycled_for_memory_limit>" << processesRecycledForMemoryLimit <<
+		"</processes_recycled_for_memory_limit>";
 	stream << "<disable_wait_list_size>" << disableWaitlist.size() << "</disable_wait_list_size>";
 	stream << "<processes_being_spawned>" << processesBeingSpawned << "</processes_being_spawned>";
 	if (m_spawning) {
@@ -138,6 +150,14 @@ Group::inspectXml(std::ostream &stream, bool includeSecrets) const {
 	if (restarting()) {
 		stream << "<restarting/>";
 	}
+	if (m_rollingRestarting) {
+		unsigned int oldProcesses = countOldGenerationProcesses();
+		stream << "<rolling_restart>";
+		stream << "<total>" << rollingRestartTotal << "</total>";
+		stream << "<old_generation_process_count>" << oldProcesses << "</old_generation_process_count>";
+		stream << "<replaced>" << (rollingRestartTotal - std::min(oldProcesses, rollingRestartTotal)) << "</replaced>";
+		stream << "</rolling_restart>";
+	}
 	if (includeSecrets) {
 		stream << "<secret>" << escapeForXml(getApiKey().toStaticString()) << "</secret>";
 		stream << "<api_key>" << escapeForXml(getApiKey().toStaticString()) << "</api_key>";
@@ -184,6 +204,11 @@ Group::inspectXml(std::ostream &stream, bool includeSecrets) const {
 		(*it)->inspectXml(stream, includeSecrets);
 		stream << "</process>";
 	}
+	for (it = standbyProcesses.begin(); it != standbyProcesses.end(); it++) {
+		stream << "<process>";
+		(*it)->inspectXml(stream, includeSecrets);
+		stream << "</process>";
+	}
 	for (it = detachedProcesses.begin(); it != detachedProcesses.end(); it++) {
 		stream << "<process>";
 		(*it)->inspectXml(stream, includeSecrets);
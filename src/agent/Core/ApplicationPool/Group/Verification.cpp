@@ -80,12 +80,14 @@ Group::verifyInvariants() const {
 	// Verify processesBeingSpawned, m_spawning and m_restarting.
 	assert(!( processesBeingSpawned > 0 ) || ( m_spawning ));
 	assert(!( m_restarting ) || ( processesBeingSpawned == 0 ));
+	assert(!( m_rollingRestarting && !m_restarting ) || ( rollingRestartOldSpawner != NULL ));
 
 	// Verify lifeStatus.
 	if (lifeStatus != ALIVE) {
 		assert(enabledCount == 0);
 		assert(disablingCount == 0);
 		assert(disabledCount == 0);
+		assert(standbyCount == 0);
 		assert(nEnabledProcessesTotallyBusy == 0);
 	}
 
@@ -93,6 +95,7 @@ Group::verifyInvariants() const {
 	assert((int) enabledProcesses.size() == enabledCount);
 	assert((int) disablingProcesses.size() == disablingCount);
 	assert((int) disabledProcesses.size() == disabledCount);
+	assert((int) standbyProcesses.size() == standbyCount);
 	assert(nEnabledProcessesTotallyBusy <= enabledCount);
 	#endif
 }
@@ -113,6 +116,8 @@ Group::verifyExpensiveInvariants() const {
 		const ProcessPtr &process = *it;
 		assert(process->enabled == Process::ENABLED);
 		assert(process->isAlive());
+		assert(process->getStickySessionId() == 0
+			|| findProcessWithStickySessionId(process->getStickySessionId()) == process.get());
 		assert(process->oobwStatus == Process::OOBW_NOT_ACTIVE
 			|| process->oobwStatus == Process::OOBW_REQUESTED);
 	}
@@ -135,6 +140,14 @@ Group::verifyExpensiveInvariants() const {
 			|| process->oobwStatus == Process::OOBW_IN_PROGRESS);
 	}
 
+	end = standbyProcesses.end();
+	for (it = standbyProcesses.begin(); it != end; it++) {
+		const ProcessPtr &process = *it;
+		assert(process->enabled == Process::STANDBY);
+		assert(process->isAlive());
+		assert(process->sessions == 0);
+	}
+
 	foreach (const ProcessPtr &process, detachedProcesses) {
 		assert(process->enabled == Process::DETACHED);
 	}
@@ -43,15 +43,18 @@
 #include <Utils/ScopeGuard.h>
 #include <Utils/MessageIO.h>
 #include <Utils/JsonUtils.h>
+#include <Utils/Hasher.h>
 #include <Core/ApplicationPool/Pool.h>
 #include <Core/ApplicationPool/Group.h>
 #include <Core/ApplicationPool/ErrorRenderer.h>
 #include <Core/ApplicationPool/Pool/InitializationAndShutdown.cpp>
 #include <Core/ApplicationPool/Pool/AnalyticsCollection.cpp>
+#include <Core/ApplicationPool/Pool/Metrics.cpp>
 #include <Core/ApplicationPool/Pool/GarbageCollection.cpp>
 #include <Core/ApplicationPool/Pool/GeneralUtils.cpp>
 #include <Core/ApplicationPool/Pool/GroupUtils.cpp>
 #include <Core/ApplicationPool/Pool/ProcessUtils.cpp>
+#include <Core/ApplicationPool/Pool/CapacityScheduling.cpp>
 #include <Core/ApplicationPool/Pool/StateInspection.cpp>
 #include <Core/ApplicationPool/Pool/Miscellaneous.cpp>
 #include <Core/ApplicationPool/Group/InitializationAndShutdown.cpp>
@@ -62,6 +65,8 @@
 #include <Core/ApplicationPool/Group/OutOfBandWork.cpp>
 #include <Core/ApplicationPool/Group/Miscellaneous.cpp>
 #include <Core/ApplicationPool/Group/InternalUtils.cpp>
+#include <Core/ApplicationPool/Group/QueueManagement.cpp>
+#include <Core/ApplicationPool/Group/ProcessRecycling.cpp>
 #include <Core/ApplicationPool/Group/StateInspection.cpp>
 #include <Core/ApplicationPool/Group/Verification.cpp>
 
@@ -93,6 +98,7 @@ copyException(const tracable_exception &e) {
 	TRY_COPY_EXCEPTION(ConfigurationException);
 
 	TRY_COPY_EXCEPTION(RequestQueueFullException);
+	TRY_COPY_EXCEPTION(RequestQueueTimeoutException);
 	TRY_COPY_EXCEPTION(GetAbortedException);
 	TRY_COPY_EXCEPTION(SpawnException);
 
@@ -136,6 +142,7 @@ rethrowException(const ExceptionPtr &e) {
 
 	TRY_RETHROW_EXCEPTION(SpawnException);
 	TRY_RETHROW_EXCEPTION(RequestQueueFullException);
+	TRY_RETHROW_EXCEPTION(RequestQueueTimeoutException);
 	TRY_RETHROW_EXCEPTION(GetAbortedException);
 
 	TRY_RETHROW_EXCEPTION(InvalidModeStringException);
@@ -331,6 +338,13 @@ Session::requestOOBW() {
 	process->getGroup()->requestOOBW(process);
 }
 
+void
+Session::reportResponseTimeout(unsigned int detachThreshold) {
+	ProcessPtr process = getProcess()->shared_from_this();
+	responseTimedOut = true;
+	process->getGroup()->reportResponseTimeout(process, detachThreshold);
+}
+
 
 } // namespace ApplicationPool2
 } // namespace Passenger
@@ -117,6 +117,7 @@ private:
 		result.push_back(&options.hostName);
 		result.push_back(&options.uri);
 		result.push_back(&options.unionStationKey);
+		result.push_back(&options.warmupUrls);
 
 		return result;
 	}
@@ -335,6 +336,16 @@ public:
 	 */
 	unsigned int maxProcesses;
 
+	/**
+	 * The weight of this group when the pool's capacity is divided among
+	 * groups that all want more processes than the pool can hold. A group
+	 * with weight 2 is entitled to twice as many processes as a group with
+	 * weight 1. `minProcesses` processes are guaranteed to a group before the
+	 * rest of the capacity is divided, as long as it has that much demand.
+	 * See CapacityShares.
+	 */
+	unsigned int capacityWeight;
+
 	/** The number of seconds that preloader processes may stay alive idling. */
 	long maxPreloaderIdleTime;
 
@@ -350,6 +361,83 @@ public:
 	 */
 	unsigned int maxRequestQueueSize;
 
+	/**
+	 * The maximum number of milliseconds that a request may spend in the
+	 * Group.getWaitlist queue. Requests that have waited longer are removed from
+	 * the queue and fail with a RequestQueueTimeoutException. A value of 0 means
+	 * unlimited.
+	 *
+	 * Unlike most per-group options, this one is evaluated for every request
+	 * that is put in the queue, so that it may be lowered on a per-request basis.
+	 */
+	unsigned int maxRequestQueueTime;
+
+	/**
+	 * CoDel-style queue management. When the Group.getWaitlist queue has not been
+	 * empty for at least `requestQueueInterval` milliseconds, the queue is
+	 * considered to be a standing queue, and requests that have waited longer
+	 * than `requestQueueTarget` milliseconds are shed with a
+	 * RequestQueueTimeoutException. A `requestQueueTarget` of 0 disables this.
+	 */
+	unsigned int requestQueueTarget;
+	unsigned int requestQueueInterval;
+
+	/**
+	 * Whether to serve the Group.getWaitlist queue in LIFO order while it is a
+	 * standing queue (see `requestQueueTarget`). The newest requests are then the
+	 * ones most likely to be served before their clients give up, while the oldest
+	 * ones are shed. Has no effect if `requestQueueTarget` is 0.
+	 */
+	bool requestQueueAdaptiveLifo;
+
+	/**
+	 * Slow start. During the first `warmupTime` seconds after a process has
+	 * been spawned, it receives a share of the traffic that ramps up linearly
+	 * with its age, so that its caches can warm up before it's loaded as much
+	 * as the other processes. A value of 0 disables this.
+	 */
+	unsigned int warmupTime;
+
+	/**
+	 * A comma-separated list of paths (relative to the base URI) that are
+	 * requested from every newly spawned process before it's attached to the
+	 * Group, i.e. before it receives any real traffic.
+	 */
+	StaticString warmupUrls;
+
+	/**
+	 * Whether restarts should be rolling by default, i.e. whether old
+	 * processes should keep serving requests while they're replaced one by
+	 * one, instead of all of them being shut down before new processes are
+	 * spawned. See Group::restart().
+	 */
+	bool rollingRestart;
+
+	/**
+	 * During a rolling restart, the maximum number of old processes that are
+	 * detached ahead of their replacements when the group or the pool is
+	 * full, i.e. by how many processes the capacity of the group may drop
+	 * during the restart.
+	 */
+	unsigned int rollingRestartBatchSize;
+
+	/**
+	 * The number of spawned processes to keep in reserve, on top of the
+	 * processes that handle requests. Standby processes aren't routed to, but
+	 * as soon as all other processes are totally busy, one of them is
+	 * promoted instantly and a replacement is spawned in the background.
+	 * Standby processes count towards `maxProcesses` and the pool's capacity.
+	 */
+	unsigned int standbyProcesses;
+
+	/**
+	 * The maximum amount of private memory, in megabytes, that a process may
+	 * use, as measured by the pool's analytics collector. A process that
+	 * exceeds it is replaced: a new process is spawned first, after which the
+	 * old one is detached and finishes its current requests. 0 means no limit.
+	 */
+	unsigned int memoryLimit;
+
 	/**
 	 * The Union Station key to use in case analytics logging is enabled.
 	 * It is used by Pool::collectAnalytics() and other administrative
@@ -395,6 +483,16 @@ public:
 	 */
 	unsigned int stickySessionId;
 
+	/**
+	 * What to do with a sticky session whose process is totally busy, or no
+	 * longer exists. By default the request waits for that process, or goes to
+	 * the least busy process if it's gone. When this is set, the request is
+	 * routed to another process by consistent hashing on the sticky session ID
+	 * instead, so that concurrent requests for the same session still end up
+	 * in the same process. The response then sticks the session to that process.
+	 */
+	bool stickySessionsFallback;
+
 	/**
 	 * A throttling rate for file stats. When set to a non-zero value N,
 	 * restart.txt and other files which are usually stat()ted on every
@@ -469,11 +567,22 @@ public:
 
 		  minProcesses(1),
 		  maxProcesses(0),
+		  capacityWeight(1),
 		  maxPreloaderIdleTime(-1),
 		  maxOutOfBandWorkInstances(1),
 		  maxRequestQueueSize(100),
+		  maxRequestQueueTime(0),
+		  requestQueueTarget(0),
+		  requestQueueInterval(100),
+		  requestQueueAdaptiveLifo(false),
+		  warmupTime(0),
+		  rollingRestart(false),
+		  rollingRestartBatchSize(1),
+		  standbyProcesses(0),
+		  memoryLimit(0),
 
 		  stickySessionId(0),
+		  stickySessionsFallback(false),
 		  statThrottleRate(DEFAULT_STAT_THROTTLE_RATE),
 		  maxRequests(0),
 		  currentTime(0),
@@ -607,8 +716,20 @@ public:
 		if (fields & PER_GROUP_POOL_OPTIONS) {
 			appendKeyValue3(vec, "min_processes",       minProcesses);
 			appendKeyValue3(vec, "max_processes",       maxProcesses);
+			appendKeyValue3(vec, "capacity_weight",     capacityWeight);
 			appendKeyValue2(vec, "max_preloader_idle_time", maxPreloaderIdleTime);
 			appendKeyValue3(vec, "max_out_of_band_work_instances", maxOutOfBandWorkInstances);
+			appendKeyValue3(vec, "max_request_queue_time", maxRequestQueueTime);
+			appendKeyValue3(vec, "request_queue_target", requestQueueTarget);
+			appendKeyValue3(vec, "request_queue_interval", requestQueueInterval);
+			appendKeyValue4(vec, "request_queue_adaptive_lifo", requestQueueAdaptiveLifo);
+			appendKeyValue3(vec, "warmup_time",         warmupTime);
+			appendKeyValue (vec, "warmup_urls",         warmupUrls);
+			appendKeyValue4(vec, "rolling_restart",     rollingRestart);
+			appendKeyValue3(vec, "rolling_restart_batch_size", rollingRestartBatchSize);
+			appendKeyValue3(vec, "standby_processes",   standbyProcesses);
+			appendKeyValue3(vec, "memory_limit",        memoryLimit);
+			appendKeyValue4(vec, "sticky_sessions_fallback", stickySessionsFallback);
 		}
 		if ((fields & SPAWN_OPTIONS) || (fields & PER_GROUP_POOL_OPTIONS)) {
 			appendKeyValue (vec, "union_station_key",   unionStationKey);
@@ -28,6 +28,7 @@
 
 #include <string>
 #include <vector>
+#include <deque>
 #include <algorithm>
 #include <utility>
 #include <sstream>
@@ -38,6 +39,7 @@
 #include <boost/make_shared.hpp>
 #include <boost/function.hpp>
 #include <boost/foreach.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/pool/object_pool.hpp>
 // We use boost::container::vector instead of std::vector, because the
 // former does not allocate memory in its default constructor. This is
@@ -56,12 +58,15 @@
 #include <Utils/SystemTime.h>
 #include <Utils/MessagePassing.h>
 #include <Utils/VariantMap.h>
+#include <Utils/FileWatcher.h>
 #include <Utils/ProcessMetricsCollector.h>
 #include <Utils/SystemMetricsCollector.h>
+#include <Utils/Metrics.h>
 #include <Core/ApplicationPool/Common.h>
 #include <Core/ApplicationPool/Context.h>
 #include <Core/ApplicationPool/Process.h>
 #include <Core/ApplicationPool/Group.h>
+#include <Core/ApplicationPool/CapacityShares.h>
 #include <Core/ApplicationPool/Session.h>
 #include <Core/ApplicationPool/Options.h>
 #include <Core/SpawningKit/Factory.h>
@@ -226,6 +231,14 @@ public:
 
 	const VariantMap *agentsOptions;
 
+	/**
+	 * Notifies Groups about changes to their restart.txt and always_restart.txt.
+	 * NULL if restart file watching is disabled, in which case Groups poll
+	 * these files themselves in Group::needsRestart().
+	 * Set during initialization only.
+	 */
+	boost::scoped_ptr<FileWatcher> restartFileWatcher;
+
 // Actually private, but marked public so that unit tests can access the fields.
 public:
 	/****** Debugging support *******/
@@ -273,6 +286,9 @@ public:
 		string data;
 	};
 
+	/** Only accessed by the analytics collector thread. Kept around
+	 * so that it can reuse its /proc file descriptors and buffers. */
+	ProcessMetricsCollector processMetricsCollector;
 	SystemMetricsCollector systemMetricsCollector;
 	SystemMetrics systemMetrics;
 
@@ -289,6 +305,117 @@ public:
 	void realCollectAnalytics();
 
 
+	/****** Metrics ******/
+
+	/**
+	 * Statistics for the ApiServer's /metrics endpoint. They are updated
+	 * while holding `syncher`, but are read without it. See MetricCounter.
+	 */
+	struct Metrics {
+		MetricCounter processesSpawned;
+		MetricCounter spawnFailures;
+		/** How long spawning (including warming up) successful processes took. */
+		MetricHistogram spawnTimes;
+	};
+
+	/**
+	 * A copy of the group and process state that is reported by /metrics.
+	 * It is periodically published by the analytics collector, so that
+	 * reading it doesn't require locking `syncher`.
+	 */
+	struct MetricsSnapshot {
+		struct ProcessInfo {
+			unsigned int slot;
+			pid_t pid;
+			Process::EnabledStatus enabled;
+			int sessions;
+			int concurrency;
+			unsigned int processed;
+			/** In KB; 0 if unknown. */
+			size_t realMemory;
+		};
+
+		struct GroupInfo {
+			string name;
+			unsigned int getWaitlistSize;
+			LatencyHistogram getWaitlistWaitTimes;
+			unsigned long long getWaitersTimedOut;
+			unsigned long long getWaitersShed;
+			unsigned long long processesRecycledForMaxRequests;
+			unsigned long long processesRecycledForMemoryLimit;
+			vector<ProcessInfo> processes;
+		};
+
+		/** When this snapshot was taken, in microseconds. */
+		unsigned long long time;
+		unsigned int max;
+		unsigned int capacityUsed;
+		unsigned int getWaitlistSize;
+		vector<GroupInfo> groups;
+	};
+
+	typedef boost::shared_ptr<const MetricsSnapshot> MetricsSnapshotPtr;
+
+	Metrics metrics;
+	/**
+	 * The latest published MetricsSnapshot, or NULL if none has been published
+	 * yet. Only access with `boost::atomic_load()` and `boost::atomic_store()`.
+	 */
+	MetricsSnapshotPtr metricsSnapshot;
+
+	static void snapshotProcessList(const ProcessList &processes,
+		vector<MetricsSnapshot::ProcessInfo> &result);
+	void publishMetricsSnapshot();
+	static string processMetricsLabels(const MetricsSnapshot::GroupInfo &group,
+		const MetricsSnapshot::ProcessInfo &process);
+
+
+	/****** Capacity scheduling ******/
+
+	/**
+	 * A process that was given up by one Group so that another Group could
+	 * use the capacity. Kept for state inspection.
+	 */
+	struct CapacityDecision {
+		/** In microseconds. */
+		unsigned long long time;
+		pid_t pid;
+		string donor;
+		string recipient;
+		unsigned int donorCurrent;
+		double donorShare;
+		unsigned int recipientCurrent;
+		double recipientShare;
+	};
+
+	static const unsigned int MAX_CAPACITY_DECISIONS = 20;
+
+	/** The `MAX_CAPACITY_DECISIONS` most recent CapacityDecisions, oldest first. */
+	deque<CapacityDecision> capacityDecisions;
+	/**
+	 * In an overloaded pool, every get() and every session close may want to
+	 * move a process between Groups, and computing the shares looks at every
+	 * Group, process and queued request. After a computation that didn't move
+	 * a process, these hold the time (in microseconds) before which
+	 * freeCapacityForBusyGroup() and shouldGiveUpProcessForCapacity()
+	 * respectively don't compute the shares again.
+	 */
+	unsigned long long nextBusyGroupRebalanceTime;
+	unsigned long long nextGiveUpProcessCheckTime;
+
+	void collectCapacityDemand(CapacityShares &shares) const;
+	ProcessPtr findIdleProcessToGiveUp(const Group *group) const;
+	ProcessPtr freeCapacityFor(CapacityShares &shares, const StaticString &recipient,
+		boost::container::vector<Callback> &postLockActions);
+	void recordCapacityDecision(const CapacityShares::Entry &donor,
+		const CapacityShares::Entry &recipient, pid_t pid);
+	bool shouldGiveUpProcessForCapacity(const Process *process);
+	ProcessPtr freeCapacityForBusyGroup(const Group *recipient,
+		boost::container::vector<Callback> &postLockActions);
+	static void sortByCapacityDeficit(const CapacityShares &shares,
+		vector< pair<double, Group *> > &groups);
+
+
 	/****** Garbage collection ******/
 
 	struct GarbageCollectorState {
@@ -298,15 +425,23 @@ public:
 	};
 
 	boost::condition_variable garbageCollectionCond;
+	/**
+	 * The time (in microseconds) at which the garbage collector will run next.
+	 * Groups lower this, and wake up the garbage collector, if they need it to
+	 * run earlier in order to shed expired requests from their getWaitlist.
+	 */
+	unsigned long long nextGarbageCollectionTime;
 
 	void initializeGarbageCollection();
 	static void garbageCollect(PoolPtr self);
-	void maybeUpdateNextGcRuntime(GarbageCollectorState &state, unsigned long candidate);
+	void maybeUpdateNextGcRuntime(GarbageCollectorState &state, unsigned long long candidate);
 	void checkWhetherProcessCanBeGarbageCollected(GarbageCollectorState &state,
 		const GroupPtr &group, const ProcessPtr &process, ProcessList &output);
 	void garbageCollectProcessesInGroup(GarbageCollectorState &state,
 		const GroupPtr &group);
 	void maybeCleanPreloader(GarbageCollectorState &state, const GroupPtr &group);
+	void maybeShedExpiredGetWaiters(GarbageCollectorState &state, const GroupPtr &group);
+	void maybeEndWarmup(GarbageCollectorState &state, const GroupPtr &group);
 	unsigned long long realGarbageCollect();
 	void wakeupGarbageCollector();
 
@@ -367,9 +502,10 @@ public:
 		}
 	};
 
-	ProcessPtr findOldestIdleProcess(const Group *exclude = NULL) const;
 	ProcessPtr findBestProcessToTrash() const;
-	ProcessPtr forceFreeCapacity(const Group *exclude,
+	ProcessPtr forceFreeCapacity(const Group *recipient,
+		boost::container::vector<Callback> &postLockActions);
+	ProcessPtr forceFreeCapacity(const Options &newGroupOptions,
 		boost::container::vector<Callback> &postLockActions);
 	bool detachProcessUnlocked(const ProcessPtr &process,
 		boost::container::vector<Callback> &postLockActions);
@@ -384,6 +520,8 @@ public:
 	bool atFullCapacityUnlocked() const;
 	void inspectProcessList(const InspectOptions &options, stringstream &result,
 		const Group *group, const ProcessList &processes) const;
+	void inspectCapacityDecisions(stringstream &result) const;
+	void inspectRequestQueue(stringstream &result, const Group *group) const;
 
 public:
 	typedef void (*AbortLongRunningConnectionsCallback)(const ProcessPtr &process);
@@ -397,6 +535,7 @@ public:
 	~Pool();
 	void initialize();
 	void initDebugging();
+	void initRestartFileWatching(unsigned int pollInterval);
 	void prepareForShutdown();
 	void destroy();
 
@@ -444,6 +583,7 @@ public:
 		bool lock = true) const;
 	string toXml(const ToXmlOptions &options = ToXmlOptions::makeAuthorized(),
 		bool lock = true) const;
+	void writeMetrics(OpenMetricsWriter &writer) const;
 
 
 	/****** Miscellaneous ******/
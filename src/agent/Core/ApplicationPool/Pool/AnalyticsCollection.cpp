@@ -175,6 +175,7 @@ Pool::realCollectAnalytics() {
 			collectPids(group->enabledProcesses, pids);
 			collectPids(group->disablingProcesses, pids);
 			collectPids(group->disabledProcesses, pids);
+			collectPids(group->standbyProcesses, pids);
 			g_it.next();
 		}
 	}
@@ -182,20 +183,33 @@ Pool::realCollectAnalytics() {
 	// Collect process metrics and system and store them in the
 	// data structures. Later, we log them to Union Station.
 	ProcessMetricMap processMetrics;
+	bool collected = false;
 	try {
 		UPDATE_TRACE_POINT();
 		P_DEBUG("Collecting process metrics");
-		processMetrics = ProcessMetricsCollector().collect(pids);
+		processMetrics = processMetricsCollector.collect(pids);
+		collected = true;
 	} catch (const ParseException &) {
 		P_WARN("Unable to collect process metrics: cannot parse 'ps' output.");
-		return;
+	} catch (const RuntimeException &e) {
+		P_WARN("Unable to collect process metrics: " << e.what());
 	}
-	try {
+	if (collected) {
+		try {
+			UPDATE_TRACE_POINT();
+			P_DEBUG("Collecting system metrics");
+			systemMetricsCollector.collect(systemMetrics);
+		} catch (const RuntimeException &e) {
+			P_WARN("Unable to collect system metrics: " << e.what());
+			collected = false;
+		}
+	}
+	if (!collected) {
+		// Still update /metrics, with the process metrics of the
+		// previous cycle.
 		UPDATE_TRACE_POINT();
-		P_DEBUG("Collecting system metrics");
-		systemMetricsCollector.collect(systemMetrics);
-	} catch (const RuntimeException &e) {
-		P_WARN("Unable to collect system metrics: " << e.what());
+		LockGuard l(syncher);
+		publishMetricsSnapshot();
 		return;
 	}
 
@@ -213,6 +227,7 @@ Pool::realCollectAnalytics() {
 			updateProcessMetrics(group->enabledProcesses, processMetrics, processesToDetach);
 			updateProcessMetrics(group->disablingProcesses, processMetrics, processesToDetach);
 			updateProcessMetrics(group->disabledProcesses, processMetrics, processesToDetach);
+			updateProcessMetrics(group->standbyProcesses, processMetrics, processesToDetach);
 			prepareUnionStationProcessStateLogs(logEntries, group);
 			prepareUnionStationSystemMetricsLogs(logEntries, group);
 			g_it.next();
@@ -225,6 +240,19 @@ Pool::realCollectAnalytics() {
 		UPDATE_TRACE_POINT();
 		processesToDetach.clear();
 
+		UPDATE_TRACE_POINT();
+		GroupMap::ConstIterator g_it2(groups);
+		while (*g_it2 != NULL) {
+			const GroupPtr &group = g_it2.getValue();
+			group->checkMemoryLimits(actions);
+			g_it2.next();
+		}
+
+		// Done after updating the process metrics, so that /metrics
+		// reports the memory usage that was just collected.
+		UPDATE_TRACE_POINT();
+		publishMetricsSnapshot();
+
 		l.unlock();
 		UPDATE_TRACE_POINT();
 		if (!logEntries.empty()) {
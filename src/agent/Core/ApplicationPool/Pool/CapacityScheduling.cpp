@@ -0,0 +1,330 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2011-2015 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#include <Core/ApplicationPool/Pool.h>
+
+/*************************************************************************
+ *
+ * Capacity scheduling functions for ApplicationPool2::Pool
+ *
+ *************************************************************************/
+
+namespace Passenger {
+namespace ApplicationPool2 {
+
+using namespace std;
+using namespace boost;
+
+
+/****************************
+ *
+ * Private methods
+ *
+ ****************************/
+
+
+struct CapacityDeficitComparator {
+	bool operator()(const pair<double, Group *> &a, const pair<double, Group *> &b) const {
+		return a.first > b.first;
+	}
+};
+
+/**
+ * Adds every Group, and every application in the top-level `getWaitlist`,
+ * to `shares` along with its demand and the capacity that it's using.
+ * See CapacityShares.
+ */
+void
+Pool::collectCapacityDemand(CapacityShares &shares) const {
+	GroupMap::ConstIterator g_it(groups);
+	while (*g_it != NULL) {
+		const GroupPtr &group = g_it.getValue();
+		const Options &options = group->options;
+		CapacityShares::Entry &entry = shares.add(group.get(), group->getName(),
+			options.capacityWeight, options.minProcesses);
+		unsigned int busy = 0;
+		ProcessList::const_iterator p_it;
+
+		for (p_it = group->enabledProcesses.begin(); p_it != group->enabledProcesses.end(); p_it++) {
+			if ((*p_it)->sessions > 0) {
+				busy++;
+			}
+		}
+		for (p_it = group->disablingProcesses.begin(); p_it != group->disablingProcesses.end(); p_it++) {
+			if ((*p_it)->sessions > 0) {
+				busy++;
+			}
+		}
+		entry.demand = busy + group->getWaitlist.size();
+		if (options.maxProcesses > 0) {
+			entry.demand = std::min(entry.demand, options.maxProcesses);
+		}
+		entry.current = group->capacityUsed();
+		g_it.next();
+	}
+
+	vector<GetWaiter>::const_iterator w_it, w_end = getWaitlist.end();
+	for (w_it = getWaitlist.begin(); w_it != w_end; w_it++) {
+		const Options &options = w_it->options;
+		CapacityShares::Entry &entry = shares.add(NULL, options.getAppGroupName(),
+			options.capacityWeight, options.minProcesses);
+		if (options.maxProcesses == 0 || entry.demand < options.maxProcesses) {
+			entry.demand++;
+		}
+	}
+}
+
+/**
+ * Returns the process that the given Group can give up most cheaply: a
+ * standby process, or otherwise its least recently used idle process.
+ * Returns NULL if the Group has requests in its queue, or if all its
+ * processes are busy.
+ */
+ProcessPtr
+Pool::findIdleProcessToGiveUp(const Group *group) const {
+	if (!group->getWaitlist.empty()) {
+		return ProcessPtr();
+	} else if (!group->standbyProcesses.empty()) {
+		return group->standbyProcesses.back();
+	}
+
+	ProcessPtr result;
+	ProcessList::const_iterator p_it, p_end = group->enabledProcesses.end();
+	for (p_it = group->enabledProcesses.begin(); p_it != p_end; p_it++) {
+		const ProcessPtr &process = *p_it;
+		if (process->busyness() == 0
+		 && (result == NULL || process->lastUsed < result->lastUsed))
+		{
+			result = process;
+		}
+	}
+	return result;
+}
+
+/**
+ * Detaches an idle process from the Group that is furthest over its fair
+ * share, provided that CapacityShares::shouldMove() allows `recipient` to
+ * take it. `shares` must have been computed, and the recipient's demand must
+ * include the process that it wants.
+ *
+ * Calls Group::detach() so be sure to fix up the invariants afterwards.
+ * See the comments for Group::detach() and the code for detachProcessUnlocked().
+ */
+ProcessPtr
+Pool::freeCapacityFor(CapacityShares &shares, const StaticString &recipient,
+	boost::container::vector<Callback> &postLockActions)
+{
+	const CapacityShares::Entry *recipientEntry = shares.find(recipient);
+	const CapacityShares::Entry *donorEntry = NULL;
+	ProcessPtr process;
+	vector<CapacityShares::Entry>::const_iterator it, end = shares.entries.end();
+
+	assert(recipientEntry != NULL);
+	for (it = shares.entries.begin(); it != end; it++) {
+		if (it->group == NULL
+		 || !CapacityShares::shouldMove(*it, *recipientEntry))
+		{
+			continue;
+		}
+		ProcessPtr candidate = findIdleProcessToGiveUp(it->group);
+		if (candidate == NULL) {
+			continue;
+		}
+
+		// Prefer the Group that is furthest over its share,
+		// and then the least recently used process.
+		if (donorEntry != NULL) {
+			double excess = it->current - it->share;
+			double bestExcess = donorEntry->current - donorEntry->share;
+			if (excess < bestExcess - CAPACITY_EPSILON
+			 || (excess < bestExcess + CAPACITY_EPSILON
+			  && candidate->lastUsed >= process->lastUsed))
+			{
+				continue;
+			}
+		}
+		donorEntry = &(*it);
+		process = candidate;
+	}
+
+	if (process != NULL) {
+		P_DEBUG("Forcefully detaching process " << process->inspect() <<
+			" in order to free capacity in the pool for " << recipient);
+		recordCapacityDecision(*donorEntry, *recipientEntry, process->getPid());
+		process->getGroup()->detach(process, postLockActions);
+	}
+	return process;
+}
+
+void
+Pool::recordCapacityDecision(const CapacityShares::Entry &donor,
+	const CapacityShares::Entry &recipient, pid_t pid)
+{
+	CapacityDecision decision;
+	decision.time = SystemTime::getUsec();
+	decision.pid = pid;
+	decision.donor = donor.name;
+	decision.recipient = recipient.name;
+	decision.donorCurrent = donor.current;
+	decision.donorShare = donor.share;
+	decision.recipientCurrent = recipient.current;
+	decision.recipientShare = recipient.share;
+	capacityDecisions.push_back(decision);
+	if (capacityDecisions.size() > MAX_CAPACITY_DECISIONS) {
+		capacityDecisions.pop_front();
+	}
+}
+
+/**
+ * Called when a session of `process` has been closed and the process is idle.
+ * Returns whether the process should be detached so that another Group, or
+ * an application in the top-level `getWaitlist`, can use its capacity. If so,
+ * the decision is recorded.
+ */
+bool
+Pool::shouldGiveUpProcessForCapacity(const Process *process) {
+	const Group *donor = process->getGroup();
+	bool othersWaiting = !getWaitlist.empty();
+
+	// Only Groups with queued requests want more processes,
+	// so there's no need to compute shares in the common case.
+	GroupMap::ConstIterator g_it(groups);
+	while (!othersWaiting && *g_it != NULL) {
+		const GroupPtr &group = g_it.getValue();
+		othersWaiting = group.get() != donor && !group->getWaitlist.empty();
+		g_it.next();
+	}
+	if (!othersWaiting) {
+		return false;
+	}
+
+	unsigned long long now = SystemTime::getUsec();
+	if (now < nextGiveUpProcessCheckTime) {
+		return false;
+	}
+
+	CapacityShares shares;
+	collectCapacityDemand(shares);
+	shares.compute(max);
+
+	const CapacityShares::Entry *donorEntry = shares.find(donor);
+	const CapacityShares::Entry *recipientEntry = NULL;
+	vector<CapacityShares::Entry>::const_iterator it, end = shares.entries.end();
+	for (it = shares.entries.begin(); it != end; it++) {
+		if (CapacityShares::shouldMove(*donorEntry, *it)
+		 && (recipientEntry == NULL || it->deficit() > recipientEntry->deficit()))
+		{
+			recipientEntry = &(*it);
+		}
+	}
+
+	if (recipientEntry != NULL) {
+		recordCapacityDecision(*donorEntry, *recipientEntry, process->getPid());
+		return true;
+	} else {
+		nextGiveUpProcessCheckTime = now + CAPACITY_REBALANCE_RETRY_INTERVAL;
+		return false;
+	}
+}
+
+/**
+ * Called by Group::get() when the pool is full and all of `recipient`'s
+ * processes are busy. Like forceFreeCapacity(const Group *), but if that
+ * didn't free capacity, then further calls return NULL without computing
+ * the shares until CAPACITY_REBALANCE_RETRY_INTERVAL has passed. Processes
+ * that become idle in the meantime can still be given up when their session
+ * is closed, because shouldGiveUpProcessForCapacity() is throttled separately.
+ */
+ProcessPtr
+Pool::freeCapacityForBusyGroup(const Group *recipient,
+	boost::container::vector<Callback> &postLockActions)
+{
+	unsigned long long now = SystemTime::getUsec();
+	if (now < nextBusyGroupRebalanceTime) {
+		return ProcessPtr();
+	}
+
+	ProcessPtr process = forceFreeCapacity(recipient, postLockActions);
+	if (process == NULL) {
+		nextBusyGroupRebalanceTime = now + CAPACITY_REBALANCE_RETRY_INTERVAL;
+	}
+	return process;
+}
+
+void
+Pool::sortByCapacityDeficit(const CapacityShares &shares,
+	vector< pair<double, Group *> > &groups)
+{
+	vector< pair<double, Group *> >::iterator it, end = groups.end();
+	for (it = groups.begin(); it != end; it++) {
+		const CapacityShares::Entry *entry = shares.find(it->second->getName());
+		it->first = entry->deficit();
+	}
+	std::stable_sort(groups.begin(), groups.end(), CapacityDeficitComparator());
+}
+
+/**
+ * Frees capacity for `recipient`, which wants one more process, by detaching
+ * an idle process from another Group according to fair share. See
+ * CapacityShares for the rules.
+ *
+ * Calls Group::detach() so be sure to fix up the invariants afterwards.
+ * See the comments for Group::detach() and the code for detachProcessUnlocked().
+ */
+ProcessPtr
+Pool::forceFreeCapacity(const Group *recipient,
+	boost::container::vector<Callback> &postLockActions)
+{
+	CapacityShares shares;
+	collectCapacityDemand(shares);
+	CapacityShares::Entry *entry = shares.find(recipient->getName());
+	entry->demand = std::max(entry->demand, entry->current + 1);
+	if (recipient->options.maxProcesses > 0) {
+		entry->demand = std::min(entry->demand, recipient->options.maxProcesses);
+	}
+	shares.compute(max);
+	return freeCapacityFor(shares, recipient->getName(), postLockActions);
+}
+
+/**
+ * Like forceFreeCapacity(const Group *), but for an application that doesn't
+ * have a Group yet, and for which `get()` was called with `newGroupOptions`.
+ */
+ProcessPtr
+Pool::forceFreeCapacity(const Options &newGroupOptions,
+	boost::container::vector<Callback> &postLockActions)
+{
+	CapacityShares shares;
+	collectCapacityDemand(shares);
+	StaticString name = newGroupOptions.getAppGroupName();
+	shares.add(NULL, name, newGroupOptions.capacityWeight,
+		newGroupOptions.minProcesses).demand++;
+	shares.compute(max);
+	return freeCapacityFor(shares, name, postLockActions);
+}
+
+
+} // namespace ApplicationPool2
+} // namespace Passenger
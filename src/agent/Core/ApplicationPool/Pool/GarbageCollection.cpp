@@ -61,8 +61,20 @@ Pool::garbageCollect(PoolPtr self) {
 			unsigned long long sleepTime = self->realGarbageCollect();
 			UPDATE_TRACE_POINT();
 			ScopedLock lock(self->syncher);
-			self->garbageCollectionCond.timed_wait(lock,
-				posix_time::microseconds(sleepTime));
+			// A Group may have moved nextGarbageCollectionTime forward, and
+			// tried to wake us up, before we started waiting.
+			unsigned long long now = SystemTime::getUsec();
+			if (self->nextGarbageCollectionTime < now + sleepTime) {
+				if (self->nextGarbageCollectionTime > now) {
+					sleepTime = self->nextGarbageCollectionTime - now;
+				} else {
+					sleepTime = 0;
+				}
+			}
+			if (sleepTime > 0) {
+				self->garbageCollectionCond.timed_wait(lock,
+					posix_time::microseconds(sleepTime));
+			}
 		} catch (const thread_interrupted &) {
 			break;
 		} catch (const tracable_exception &e) {
@@ -72,7 +84,7 @@ Pool::garbageCollect(PoolPtr self) {
 }
 
 void
-Pool::maybeUpdateNextGcRuntime(GarbageCollectorState &state, unsigned long candidate) {
+Pool::maybeUpdateNextGcRuntime(GarbageCollectorState &state, unsigned long long candidate) {
 	if (state.nextGcRunTime == 0 || candidate < state.nextGcRunTime) {
 		state.nextGcRunTime = candidate;
 	}
@@ -121,6 +133,12 @@ Pool::garbageCollectProcessesInGroup(GarbageCollectorState &state,
 		group->detach(process, state.actions);
 		p_it++;
 	}
+
+	// A group that has been scaled down to nothing doesn't need
+	// any standby processes either.
+	if (group->getProcessCount() == 0) {
+		group->detachStandbyProcesses(state.actions);
+	}
 }
 
 void
@@ -138,6 +156,29 @@ Pool::maybeCleanPreloader(GarbageCollectorState &state, const GroupPtr &group) {
 	}
 }
 
+void
+Pool::maybeShedExpiredGetWaiters(GarbageCollectorState &state, const GroupPtr &group) {
+	if (!group->getWaitlist.empty()) {
+		group->shedExpiredGetWaiters(state.now, state.actions);
+		unsigned long long expiryTime = group->getNextGetWaiterExpiryTime();
+		if (expiryTime != 0) {
+			maybeUpdateNextGcRuntime(state, expiryTime);
+		}
+	}
+}
+
+void
+Pool::maybeEndWarmup(GarbageCollectorState &state, const GroupPtr &group) {
+	if (group->warmupEndTime != 0) {
+		if (state.now >= group->warmupEndTime) {
+			P_DEBUG("All processes have warmed up: group=" << group->getName());
+			group->warmupEndTime = 0;
+		} else {
+			maybeUpdateNextGcRuntime(state, group->warmupEndTime);
+		}
+	}
+}
+
 unsigned long long
 Pool::realGarbageCollect() {
 	TRACE_POINT();
@@ -164,11 +205,16 @@ Pool::realGarbageCollect() {
 		// ...cleanup the spawner if it's been idle for more than preloaderIdleTime.
 		maybeCleanPreloader(state, group);
 
+		// ...shed requests that have waited in the queue for too long.
+		maybeShedExpiredGetWaiters(state, group);
+
+		// ...switch back to fast routing once all processes have warmed up.
+		maybeEndWarmup(state, group);
+
 		g_it.next();
 	}
 
 	verifyInvariants();
-	lock.unlock();
 
 	// Schedule next garbage collection run.
 	unsigned long long sleepTime;
@@ -181,6 +227,9 @@ Pool::realGarbageCollect() {
 	} else {
 		sleepTime = state.nextGcRunTime - state.now;
 	}
+	nextGarbageCollectionTime = state.now + sleepTime;
+	lock.unlock();
+
 	P_DEBUG("Garbage collection done; next garbage collect in " <<
 		std::fixed << std::setprecision(3) << (sleepTime / 1000000.0) << " sec");
 
@@ -56,6 +56,9 @@ Pool::Pool(const SpawningKit::FactoryPtr &spawningKitFactory,
 	lifeStatus   = ALIVE;
 	max          = 6;
 	maxIdleTime  = 60 * 1000000;
+	nextGarbageCollectionTime = 0;
+	nextBusyGroupRebalanceTime = 0;
+	nextGiveUpProcessCheckTime = 0;
 	selfchecking = true;
 	palloc       = psg_create_pool(PSG_DEFAULT_POOL_SIZE);
 
@@ -87,6 +90,27 @@ Pool::initDebugging() {
 	debugSupport = boost::make_shared<DebugSupport>();
 }
 
+/**
+ * Enables asynchronous detection of restart.txt and always_restart.txt changes,
+ * using inotify where possible. Groups created after this call no longer
+ * stat() their restart files during get(). Directories that cannot be watched
+ * with inotify are polled once per `pollInterval` seconds.
+ *
+ * Must be called right after initialize(), before any Groups are created.
+ */
+void
+Pool::initRestartFileWatching(unsigned int pollInterval) {
+	LockGuard l(syncher);
+	assert(groups.empty());
+	restartFileWatcher.reset(new FileWatcher(pollInterval));
+	restartFileWatcher->start();
+	if (restartFileWatcher->usingInotify()) {
+		P_DEBUG("Watching restart files using inotify");
+	} else {
+		P_DEBUG("Watching restart files by polling every " << pollInterval << " sec");
+	}
+}
+
 /**
  * Should be called right after the agent has received
  * the message to exit gracefully. This will tell processes to
@@ -133,6 +157,9 @@ Pool::destroy() {
 	P_DEBUG("Shutting down ApplicationPool background threads...");
 	interruptableThreads.interrupt_and_join_all();
 	nonInterruptableThreads.join_all();
+	if (restartFileWatcher != NULL) {
+		restartFileWatcher->stop();
+	}
 	lock.lock();
 
 	lifeStatus = SHUT_DOWN;
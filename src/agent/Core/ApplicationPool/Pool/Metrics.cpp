@@ -0,0 +1,278 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2011-2015 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#include <Core/ApplicationPool/Pool.h>
+
+/*************************************************************************
+ *
+ * Metrics functions for ApplicationPool2::Pool
+ *
+ *************************************************************************/
+
+namespace Passenger {
+namespace ApplicationPool2 {
+
+using namespace std;
+using namespace boost;
+
+
+/****************************
+ *
+ * Private methods
+ *
+ ****************************/
+
+
+void
+Pool::snapshotProcessList(const ProcessList &processes,
+	vector<MetricsSnapshot::ProcessInfo> &result)
+{
+	foreach (const ProcessPtr &process, processes) {
+		result.push_back(MetricsSnapshot::ProcessInfo());
+		MetricsSnapshot::ProcessInfo &info = result.back();
+		info.slot = process->slot;
+		info.pid = process->getPid();
+		info.enabled = process->enabled;
+		info.sessions = process->sessions;
+		info.concurrency = process->getConcurrency();
+		info.processed = process->processed;
+		info.realMemory = process->metrics.isValid()
+			? process->metrics.realMemory()
+			: 0;
+	}
+}
+
+/**
+ * Copies the state that /metrics reports into a new MetricsSnapshot and
+ * publishes it. Must be called while holding `syncher`.
+ */
+void
+Pool::publishMetricsSnapshot() {
+	boost::shared_ptr<MetricsSnapshot> snapshot = boost::make_shared<MetricsSnapshot>();
+	GroupMap::ConstIterator g_it(groups);
+
+	snapshot->time = SystemTime::getUsec();
+	snapshot->max = max;
+	snapshot->capacityUsed = capacityUsedUnlocked();
+	snapshot->getWaitlistSize = getWaitlist.size();
+	snapshot->groups.reserve(groups.size());
+
+	while (*g_it != NULL) {
+		const GroupPtr &group = g_it.getValue();
+
+		snapshot->groups.push_back(MetricsSnapshot::GroupInfo());
+		MetricsSnapshot::GroupInfo &info = snapshot->groups.back();
+		info.name = group->getName();
+		info.getWaitlistSize = group->getWaitlist.size();
+		info.getWaitlistWaitTimes = group->getWaitlistWaitTimes;
+		info.getWaitersTimedOut = group->getWaitersTimedOut;
+		info.getWaitersShed = group->getWaitersShed;
+		info.processesRecycledForMaxRequests = group->processesRecycledForMaxRequests;
+		info.processesRecycledForMemoryLimit = group->processesRecycledForMemoryLimit;
+		snapshotProcessList(group->enabledProcesses, info.processes);
+		snapshotProcessList(group->disablingProcesses, info.processes);
+		snapshotProcessList(group->disabledProcesses, info.processes);
+		snapshotProcessList(group->standbyProcesses, info.processes);
+
+		g_it.next();
+	}
+
+	boost::atomic_store(&metricsSnapshot, MetricsSnapshotPtr(snapshot));
+}
+
+/**
+ * Processes are labeled by their slot instead of their PID. Recycled
+ * processes get new PIDs, so PID labels would make the number of series
+ * grow without bound.
+ */
+string
+Pool::processMetricsLabels(const MetricsSnapshot::GroupInfo &group,
+	const MetricsSnapshot::ProcessInfo &process)
+{
+	return OpenMetricsWriter::label("group", group.name)
+		+ ",slot=\"" + toString(process.slot) + "\"";
+}
+
+
+/****************************
+ *
+ * Public methods
+ *
+ ****************************/
+
+
+/**
+ * Writes the pool's metrics. Does not lock `syncher`, so this never delays
+ * request routing. Group and process metrics are taken from the latest
+ * snapshot published by the analytics collector, and are thus a few seconds
+ * old at most.
+ */
+void
+Pool::writeMetrics(OpenMetricsWriter &writer) const {
+	MetricsSnapshotPtr snapshot = boost::atomic_load(&metricsSnapshot);
+	LatencyHistogram spawnTimes;
+	vector<MetricsSnapshot::GroupInfo>::const_iterator g_it, g_end;
+	vector<MetricsSnapshot::ProcessInfo>::const_iterator p_it, p_end;
+
+	metrics.spawnTimes.collect(spawnTimes);
+	writer.declare("passenger_processes_spawned", "counter",
+		"Application processes that were successfully spawned.");
+	writer.sample("passenger_processes_spawned_total", "",
+		metrics.processesSpawned.get());
+	writer.declare("passenger_spawn_failures", "counter",
+		"Application process spawn attempts that failed.");
+	writer.sample("passenger_spawn_failures_total", "",
+		metrics.spawnFailures.get());
+	writer.declare("passenger_spawn_duration_seconds", "histogram",
+		"Time it took to spawn and warm up application processes.");
+	writer.histogram("passenger_spawn_duration_seconds", "", spawnTimes);
+
+	if (snapshot == NULL) {
+		return;
+	}
+
+	g_end = snapshot->groups.end();
+
+	writer.declare("passenger_pool_snapshot_timestamp_seconds", "gauge",
+		"When the pool state that the passenger_pool_* and passenger_group_* "
+		"metrics describe was taken.");
+	writer.sample("passenger_pool_snapshot_timestamp_seconds", "",
+		snapshot->time / 1000000);
+	writer.declare("passenger_pool_max_processes", "gauge",
+		"The maximum number of application processes.");
+	writer.sample("passenger_pool_max_processes", "", snapshot->max);
+	writer.declare("passenger_pool_capacity_used", "gauge",
+		"The number of process slots in use.");
+	writer.sample("passenger_pool_capacity_used", "", snapshot->capacityUsed);
+	writer.declare("passenger_pool_queued_requests", "gauge",
+		"Requests waiting for pool capacity to become available.");
+	writer.sample("passenger_pool_queued_requests", "", snapshot->getWaitlistSize);
+
+	writer.declare("passenger_group_queued_requests", "gauge",
+		"Requests waiting for a process of the group.");
+	for (g_it = snapshot->groups.begin(); g_it != g_end; g_it++) {
+		writer.sample("passenger_group_queued_requests",
+			OpenMetricsWriter::label("group", g_it->name),
+			g_it->getWaitlistSize);
+	}
+	writer.declare("passenger_group_queue_wait_seconds", "histogram",
+		"How long requests waited for a process of the group.");
+	for (g_it = snapshot->groups.begin(); g_it != g_end; g_it++) {
+		writer.histogram("passenger_group_queue_wait_seconds",
+			OpenMetricsWriter::label("group", g_it->name),
+			g_it->getWaitlistWaitTimes);
+	}
+	writer.declare("passenger_group_queue_timeouts", "counter",
+		"Queued requests that were dropped because their deadline passed.");
+	for (g_it = snapshot->groups.begin(); g_it != g_end; g_it++) {
+		writer.sample("passenger_group_queue_timeouts_total",
+			OpenMetricsWriter::label("group", g_it->name),
+			g_it->getWaitersTimedOut);
+	}
+	writer.declare("passenger_group_queue_shed", "counter",
+		"Queued requests that were shed because the queue was standing.");
+	for (g_it = snapshot->groups.begin(); g_it != g_end; g_it++) {
+		writer.sample("passenger_group_queue_shed_total",
+			OpenMetricsWriter::label("group", g_it->name),
+			g_it->getWaitersShed);
+	}
+	writer.declare("passenger_group_processes_recycled", "counter",
+		"Processes that were replaced because of --max-requests or --memory-limit.");
+	for (g_it = snapshot->groups.begin(); g_it != g_end; g_it++) {
+		string groupLabel = OpenMetricsWriter::label("group", g_it->name);
+		writer.sample("passenger_group_processes_recycled_total",
+			groupLabel + ",reason=\"max_requests\"",
+			g_it->processesRecycledForMaxRequests);
+		writer.sample("passenger_group_processes_recycled_total",
+			groupLabel + ",reason=\"memory_limit\"",
+			g_it->processesRecycledForMemoryLimit);
+	}
+
+	writer.declare("passenger_process_pid", "gauge",
+		"The PID of the process that currently occupies the slot.");
+	for (g_it = snapshot->groups.begin(); g_it != g_end; g_it++) {
+		p_end = g_it->processes.end();
+		for (p_it = g_it->processes.begin(); p_it != p_end; p_it++) {
+			writer.sample("passenger_process_pid",
+				processMetricsLabels(*g_it, *p_it),
+				p_it->pid);
+		}
+	}
+	writer.declare("passenger_process_sessions", "gauge",
+		"Requests that the process is currently handling.");
+	for (g_it = snapshot->groups.begin(); g_it != g_end; g_it++) {
+		p_end = g_it->processes.end();
+		for (p_it = g_it->processes.begin(); p_it != p_end; p_it++) {
+			writer.sample("passenger_process_sessions",
+				processMetricsLabels(*g_it, *p_it),
+				p_it->sessions);
+		}
+	}
+	writer.declare("passenger_process_concurrency", "gauge",
+		"The maximum number of concurrent requests of the process; 0 if unlimited.");
+	for (g_it = snapshot->groups.begin(); g_it != g_end; g_it++) {
+		p_end = g_it->processes.end();
+		for (p_it = g_it->processes.begin(); p_it != p_end; p_it++) {
+			writer.sample("passenger_process_concurrency",
+				processMetricsLabels(*g_it, *p_it),
+				p_it->concurrency);
+		}
+	}
+	writer.declare("passenger_process_enabled", "gauge",
+		"1 if the process receives new requests, 0 if it is disabled, "
+		"shutting down or kept on standby.");
+	for (g_it = snapshot->groups.begin(); g_it != g_end; g_it++) {
+		p_end = g_it->processes.end();
+		for (p_it = g_it->processes.begin(); p_it != p_end; p_it++) {
+			writer.sample("passenger_process_enabled",
+				processMetricsLabels(*g_it, *p_it),
+				(int) (p_it->enabled == Process::ENABLED));
+		}
+	}
+	writer.declare("passenger_process_requests", "counter",
+		"Requests that the process has handled.");
+	for (g_it = snapshot->groups.begin(); g_it != g_end; g_it++) {
+		p_end = g_it->processes.end();
+		for (p_it = g_it->processes.begin(); p_it != p_end; p_it++) {
+			writer.sample("passenger_process_requests_total",
+				processMetricsLabels(*g_it, *p_it),
+				p_it->processed);
+		}
+	}
+	writer.declare("passenger_process_memory_bytes", "gauge",
+		"Private memory usage of the process (private dirty plus swap).");
+	for (g_it = snapshot->groups.begin(); g_it != g_end; g_it++) {
+		p_end = g_it->processes.end();
+		for (p_it = g_it->processes.begin(); p_it != p_end; p_it++) {
+			writer.sample("passenger_process_memory_bytes",
+				processMetricsLabels(*g_it, *p_it),
+				(unsigned long long) p_it->realMemory * 1024);
+		}
+	}
+}
+
+
+} // namespace ApplicationPool2
+} // namespace Passenger
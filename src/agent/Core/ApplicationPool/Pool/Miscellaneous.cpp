@@ -77,7 +77,7 @@ Pool::asyncGet(const Options &options, const GetCallback &callback, bool lockNow
 		 * as least as possible, but let's try to handle it as well
 		 * as we can.
 		 */
-		ProcessPtr freedProcess = forceFreeCapacity(NULL, actions);
+		ProcessPtr freedProcess = forceFreeCapacity(options, actions);
 		if (freedProcess == NULL) {
 			/* No process is eligible for killing. This could happen if, for example,
 			 * all (super)groups are currently initializing/restarting/spawning/etc.
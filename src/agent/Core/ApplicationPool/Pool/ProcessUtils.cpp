@@ -45,34 +45,6 @@ using namespace boost;
  ****************************/
 
 
-ProcessPtr
-Pool::findOldestIdleProcess(const Group *exclude) const {
-	ProcessPtr oldestIdleProcess;
-
-	GroupMap::ConstIterator g_it(groups);
-	while (*g_it != NULL) {
-		const GroupPtr &group = g_it.getValue();
-		if (group.get() == exclude) {
-			g_it.next();
-			continue;
-		}
-		const ProcessList &processes = group->enabledProcesses;
-		ProcessList::const_iterator p_it, p_end = processes.end();
-		for (p_it = processes.begin(); p_it != p_end; p_it++) {
-			const ProcessPtr process = *p_it;
-			if (process->busyness() == 0
-			     && (oldestIdleProcess == NULL
-			         || process->lastUsed < oldestIdleProcess->lastUsed)
-			) {
-				oldestIdleProcess = process;
-			}
-		}
-		g_it.next();
-	}
-
-	return oldestIdleProcess;
-}
-
 ProcessPtr
 Pool::findBestProcessToTrash() const {
 	ProcessPtr oldestProcess;
@@ -95,28 +67,6 @@ Pool::findBestProcessToTrash() const {
 	return oldestProcess;
 }
 
-/**
- * Calls Group::detach() so be sure to fix up the invariants afterwards.
- * See the comments for Group::detach() and the code for detachProcessUnlocked().
- */
-ProcessPtr
-Pool::forceFreeCapacity(const Group *exclude,
-	boost::container::vector<Callback> &postLockActions)
-{
-	ProcessPtr process = findOldestIdleProcess(exclude);
-	if (process != NULL) {
-		P_DEBUG("Forcefully detaching process " << process->inspect() <<
-			" in order to free capacity in the pool");
-
-		Group *group = process->getGroup();
-		assert(group != NULL);
-		assert(group->getWaitlist.empty());
-
-		group->detach(process, postLockActions);
-	}
-	return process;
-}
-
 bool
 Pool::detachProcessUnlocked(const ProcessPtr &process,
 	boost::container::vector<Callback> &postLockActions)
@@ -153,34 +103,47 @@ Pool::syncDisableProcessCallback(const ProcessPtr &process, DisableResult result
 void
 Pool::possiblySpawnMoreProcessesForExistingGroups() {
 	/* Looks for Groups that are waiting for capacity to become available,
-	 * and spawn processes in those groups.
+	 * and Groups that haven't maximized their allowed capacity yet, and
+	 * spawn processes in those groups. Waiting Groups go first. If capacity
+	 * is scarce then within each of these two kinds, the Groups that are
+	 * furthest below their fair share go first.
 	 */
+	vector< pair<double, Group *> > waiting, wanting;
 	GroupMap::ConstIterator g_it(groups);
 	while (*g_it != NULL) {
 		const GroupPtr &group = g_it.getValue();
 		if (group->isWaitingForCapacity()) {
-			P_DEBUG("Group " << group->getName() << " is waiting for capacity");
-			group->spawn();
-			if (atFullCapacityUnlocked()) {
-				return;
-			}
+			waiting.push_back(make_pair(0.0, group.get()));
+		} else if (group->shouldSpawn()) {
+			wanting.push_back(make_pair(0.0, group.get()));
 		}
 		g_it.next();
 	}
-	/* Now look for Groups that haven't maximized their allowed capacity
-	 * yet, and spawn processes in those groups.
-	 */
-	g_it = GroupMap::ConstIterator(groups);
-	while (*g_it != NULL) {
-		const GroupPtr &group = g_it.getValue();
-		if (group->shouldSpawn()) {
-			P_DEBUG("Group " << group->getName() << " requests more processes to be spawned");
-			group->spawn();
+
+	if (waiting.size() + wanting.size() > 1) {
+		CapacityShares shares;
+		collectCapacityDemand(shares);
+		shares.compute(max);
+		sortByCapacityDeficit(shares, waiting);
+		sortByCapacityDeficit(shares, wanting);
+	}
+
+	vector< pair<double, Group *> >::const_iterator it;
+	for (it = waiting.begin(); it != waiting.end(); it++) {
+		P_DEBUG("Group " << it->second->getName() << " is waiting for capacity");
+		it->second->spawn();
+		if (atFullCapacityUnlocked()) {
+			return;
+		}
+	}
+	for (it = wanting.begin(); it != wanting.end(); it++) {
+		if (it->second->shouldSpawn()) {
+			P_DEBUG("Group " << it->second->getName() << " requests more processes to be spawned");
+			it->second->spawn();
 			if (atFullCapacityUnlocked()) {
 				return;
 			}
 		}
-		g_it.next();
 	}
 }
 
@@ -210,6 +173,9 @@ Pool::getProcesses(bool lock) const {
 		for (p_it = group->disabledProcesses.begin(); p_it != group->disabledProcesses.end(); p_it++) {
 			result.push_back(*p_it);
 		}
+		for (p_it = group->standbyProcesses.begin(); p_it != group->standbyProcesses.end(); p_it++) {
+			result.push_back(*p_it);
+		}
 
 		g_it.next();
 	}
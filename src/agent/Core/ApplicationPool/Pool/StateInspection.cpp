@@ -103,9 +103,14 @@ Pool::inspectProcessList(const InspectOptions &options, stringstream &result,
 			result << "    Disabling..." << endl;
 		} else if (process->enabled == Process::DISABLED) {
 			result << "    DISABLED" << endl;
+		} else if (process->enabled == Process::STANDBY) {
+			result << "    Standby" << endl;
 		} else if (process->enabled == Process::DETACHED) {
 			result << "    Shutting down..." << endl;
 		}
+		if (process->memoryLimitExceeded && process->enabled != Process::DETACHED) {
+			result << "    Memory limit exceeded; waiting to be replaced..." << endl;
+		}
 
 		const Socket *socket;
 		if (options.verbose && (socket = process->getSockets().findSocketWithName("http")) != NULL) {
@@ -115,6 +120,47 @@ Pool::inspectProcessList(const InspectOptions &options, stringstream &result,
 	}
 }
 
+void
+Pool::inspectCapacityDecisions(stringstream &result) const {
+	deque<CapacityDecision>::const_iterator it, end = capacityDecisions.end();
+	for (it = capacityDecisions.begin(); it != end; it++) {
+		char buf[64];
+		snprintf(buf, sizeof(buf), "%u %s, share %.1f",
+			it->donorCurrent,
+			maybePluralize(it->donorCurrent, "process", "processes"),
+			it->donorShare);
+		result << "  " << distanceOfTimeInWords(it->time / 1000000) << " ago: PID " <<
+			it->pid << " of " << it->donor << " (" << buf << ") given up for ";
+		snprintf(buf, sizeof(buf), "%u %s, share %.1f",
+			it->recipientCurrent,
+			maybePluralize(it->recipientCurrent, "process", "processes"),
+			it->recipientShare);
+		result << it->recipient << " (" << buf << ")" << endl;
+	}
+}
+
+void
+Pool::inspectRequestQueue(stringstream &result, const Group *group) const {
+	const LatencyHistogram &waitTimes = group->getWaitlistWaitTimes;
+
+	result << "  Requests in queue: " << group->getWaitlist.size() << endl;
+	if (waitTimes.getCount() > 0 || group->getWaitersTimedOut > 0
+	 || group->getWaitersShed > 0)
+	{
+		char buf[192];
+		snprintf(buf, sizeof(buf),
+			"  Queue wait time: p50 %.1fms, p99 %.1fms, max %.1fms (%llu queued); "
+			"timed out: %llu, shed: %llu",
+			waitTimes.getPercentile(50) / 1000.0,
+			waitTimes.getPercentile(99) / 1000.0,
+			waitTimes.getMax() / 1000.0,
+			waitTimes.getCount(),
+			group->getWaitersTimedOut,
+			group->getWaitersShed);
+		result << buf << endl;
+	}
+}
+
 
 /****************************
  *
@@ -147,9 +193,17 @@ Pool::inspect(const InspectOptions &options, bool lock) const {
 			result << "  " << i << ": " << waiter.options.getAppGroupName() << endl;
 			i++;
 		}
+		if (!capacityDecisions.empty()) {
+			result << "Processes given up for other groups (most recent last):" << endl;
+			inspectCapacityDecisions(result);
+		}
 	}
 	result << endl;
 
+	CapacityShares shares;
+	collectCapacityDemand(shares);
+	shares.compute(max);
+
 	result << headerColor << "----------- Application groups -----------" << resetColor << endl;
 	GroupMap::ConstIterator g_it(groups);
 	while (*g_it != NULL) {
@@ -167,6 +221,12 @@ Pool::inspect(const InspectOptions &options, bool lock) const {
 		result << "  App root: " << group->options.appRoot << endl;
 		if (group->restarting()) {
 			result << "  (restarting...)" << endl;
+		} else if (group->rollingRestarting()) {
+			unsigned int oldProcesses = group->countOldGenerationProcesses();
+			unsigned int total = group->rollingRestartTotal;
+			result << "  (rolling restart: " << (total - std::min(oldProcesses, total)) <<
+				" of " << total << " " << maybePluralize(total, "process", "processes") <<
+				" replaced...)" << endl;
 		}
 		if (group->spawning()) {
 			if (group->processesBeingSpawned == 0) {
@@ -177,10 +237,23 @@ Pool::inspect(const InspectOptions &options, bool lock) const {
 					"...)" << endl;
 			}
 		}
-		result << "  Requests in queue: " << group->getWaitlist.size() << endl;
+		inspectRequestQueue(result, group.get());
+		const CapacityShares::Entry *entry = shares.find(group.get());
+		char buf[128];
+		snprintf(buf, sizeof(buf), "  Capacity share: %.1f (weight %u, demand %u)",
+			entry->share, entry->weight, entry->demand);
+		result << buf << endl;
+		if (group->processesRecycledForMaxRequests > 0
+		 || group->processesRecycledForMemoryLimit > 0)
+		{
+			result << "  Processes recycled: " << group->processesRecycledForMaxRequests <<
+				" for max requests, " << group->processesRecycledForMemoryLimit <<
+				" for memory limit" << endl;
+		}
 		inspectProcessList(options, result, group.get(), group->enabledProcesses);
 		inspectProcessList(options, result, group.get(), group->disablingProcesses);
 		inspectProcessList(options, result, group.get(), group->disabledProcesses);
+		inspectProcessList(options, result, group.get(), group->standbyProcesses);
 		inspectProcessList(options, result, group.get(), group->detachedProcesses);
 		result << endl;
 
@@ -223,8 +296,28 @@ Pool::toXml(const ToXmlOptions &options, bool lock) const {
 			result << "</item>";
 		}
 		result << "</get_wait_list>";
+
+		deque<CapacityDecision>::const_iterator d_it, d_end = capacityDecisions.end();
+		result << "<capacity_decisions>";
+		for (d_it = capacityDecisions.begin(); d_it != d_end; d_it++) {
+			result << "<decision>";
+			result << "<time>" << d_it->time << "</time>";
+			result << "<pid>" << d_it->pid << "</pid>";
+			result << "<donor>" << escapeForXml(d_it->donor) << "</donor>";
+			result << "<donor_capacity_used>" << d_it->donorCurrent << "</donor_capacity_used>";
+			result << "<donor_share>" << d_it->donorShare << "</donor_share>";
+			result << "<recipient>" << escapeForXml(d_it->recipient) << "</recipient>";
+			result << "<recipient_capacity_used>" << d_it->recipientCurrent << "</recipient_capacity_used>";
+			result << "<recipient_share>" << d_it->recipientShare << "</recipient_share>";
+			result << "</decision>";
+		}
+		result << "</capacity_decisions>";
 	}
 
+	CapacityShares shares;
+	collectCapacityDemand(shares);
+	shares.compute(max);
+
 	result << "<supergroups>";
 	while (*g_it != NULL) {
 		const GroupPtr &group = g_it.getValue();
@@ -240,6 +333,10 @@ Pool::toXml(const ToXmlOptions &options, bool lock) const {
 		result << "<state>READY</state>";
 		result << "<get_wait_list_size>0</get_wait_list_size>";
 		result << "<capacity_used>" << group->capacityUsed() << "</capacity_used>";
+		const CapacityShares::Entry *entry = shares.find(group.get());
+		result << "<capacity_weight>" << entry->weight << "</capacity_weight>";
+		result << "<capacity_demand>" << entry->demand << "</capacity_demand>";
+		result << "<capacity_share>" << entry->share << "</capacity_share>";
 		if (options.secrets) {
 			result << "<secret>" << escapeForXml(group->getApiKey().toStaticString()) << "</secret>";
 		}
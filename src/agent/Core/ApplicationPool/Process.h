@@ -144,6 +144,13 @@ private:
 	 */
 	StaticString codeRevision;
 
+	/**
+	 * The user and group that the process runs as, or -1 if unknown,
+	 * e.g. for dummy processes.
+	 */
+	uid_t uid;
+	gid_t gid;
+
 	/**
 	 * Time at which the Spawner that created this process was created.
 	 * Microseconds resolution.
@@ -368,6 +375,17 @@ public:
 	int sessions;
 	/** Number of sessions opened so far. */
 	unsigned int processed;
+	/** Number of sessions in which the process did not respond in time.
+	 * See Session::reportResponseTimeout(). */
+	unsigned int responseTimeouts;
+	/** Like `responseTimeouts`, but reset whenever a session without a
+	 * response timeout is closed. A non-zero value means that the process
+	 * is suspected of being stuck. */
+	unsigned int consecutiveResponseTimeouts;
+	/** Identifies this process within its Group while it's attached. Slots
+	 * of detached processes are reused, so the number of distinct slots is
+	 * bounded by the number of processes. See Group::findFreeProcessSlot(). */
+	unsigned int slot;
 	/** Do not access directly, always use `isAlive()`/`isDead()`/`getLifeStatus()` or
 	 * through `lifetimeSyncher`. */
 	enum LifeStatus {
@@ -397,6 +415,12 @@ public:
 		 * the Out-of-Band-Work trigger.
 		 */
 		DISABLED,
+		/**
+		 * Process is fully initialized, but is kept in reserve instead of
+		 * handling requests, so that the Group can scale up without waiting
+		 * for a spawn. See `Options::standbyProcesses`.
+		 */
+		STANDBY,
 		/**
 		 * Process has been detached. It will be removed from the Group
 		 * as soon we have detected that the OS process has exited. Detached
@@ -419,6 +443,12 @@ public:
 	/** Caches whether or not the OS process still exists. */
 	mutable bool m_osProcessExists: 1;
 	bool longRunningConnectionsAborted: 1;
+	/** Whether this process was spawned before the rolling restart that is
+	 * in progress, and is still waiting to be replaced. See Group::restart(). */
+	bool oldGeneration: 1;
+	/** Whether this process uses more memory than `options.memoryLimit`, and
+	 * is waiting to be replaced. See Group::checkMemoryLimits(). */
+	bool memoryLimitExceeded: 1;
 	/** Time at which shutdown began. */
 	time_t shutdownStartTime;
 	/** Collected by Pool::collectAnalytics(). */
@@ -428,6 +458,8 @@ public:
 	Process(const BasicGroupInfo *groupInfo, const Json::Value &json)
 		: info(this, groupInfo, json),
 		  sessionSocketCount(0),
+		  uid((uid_t) getJsonIntField(json, "uid", -1)),
+		  gid((gid_t) getJsonIntField(json, "gid", -1)),
 		  spawnerCreationTime(getJsonUint64Field(json, "spawner_creation_time")),
 		  spawnStartTime(getJsonUint64Field(json, "spawn_start_time")),
 		  spawnEndTime(SystemTime::getUsec()),
@@ -438,11 +470,16 @@ public:
 		  lastUsed(spawnEndTime),
 		  sessions(0),
 		  processed(0),
+		  responseTimeouts(0),
+		  consecutiveResponseTimeouts(0),
+		  slot(0),
 		  lifeStatus(ALIVE),
 		  enabled(ENABLED),
 		  oobwStatus(OOBW_NOT_ACTIVE),
 		  m_osProcessExists(true),
 		  longRunningConnectionsAborted(false),
+		  oldGeneration(false),
+		  memoryLimitExceeded(false),
 		  shutdownStartTime(0)
 	{
 		initializeSocketsAndStringFields(json);
@@ -617,10 +654,22 @@ public:
 		return info.stickySessionId;
 	}
 
+	uid_t getUid() const {
+		return uid;
+	}
+
+	gid_t getGid() const {
+		return gid;
+	}
+
 	unsigned long long getSpawnerCreationTime() const {
 		return spawnerCreationTime;
 	}
 
+	unsigned long long getSpawnEndTime() const {
+		return spawnEndTime;
+	}
+
 	bool isDummy() const {
 		return dummy;
 	}
@@ -711,6 +760,14 @@ public:
 		}
 	}
 
+	/**
+	 * The maximum number of concurrent sessions this process can handle,
+	 * or 0 if unlimited.
+	 */
+	int getConcurrency() const {
+		return concurrency;
+	}
+
 	/**
 	 * Whether we've reached the maximum number of concurrent sessions for this
 	 * process.
@@ -728,6 +785,38 @@ public:
 		return !isTotallyBusy();
 	}
 
+	/**
+	 * The share of traffic that this process should receive relative to a
+	 * process that has warmed up, in [0.1..1]. It ramps up linearly during
+	 * the first `warmupTime` microseconds after spawning.
+	 */
+	double getWarmupWeight(unsigned long long now, unsigned long long warmupTime) const {
+		if (warmupTime == 0 || now >= spawnEndTime + warmupTime) {
+			return 1;
+		} else if (now <= spawnEndTime) {
+			return 0.1;
+		} else {
+			return std::max(0.1, (now - spawnEndTime) / (double) warmupTime);
+		}
+	}
+
+	/**
+	 * busyness(), scaled by the warmup weight as in weighted least-connections
+	 * routing: a process with weight W looks as busy as a warmed up process
+	 * would with 1/W times as many sessions, counting the session that is
+	 * about to be routed. For a warmed up process this equals busyness().
+	 */
+	double getWarmupBusyness(unsigned long long now, unsigned long long warmupTime) const {
+		double weight = getWarmupWeight(now, warmupTime);
+		double unit;
+		if (concurrency == 0) {
+			unit = 1;
+		} else {
+			unit = INT_MAX / (double) concurrency;
+		}
+		return (busyness() + unit) / weight - unit;
+	}
+
 	/**
 	 * Create a new communication session with this process. This will connect to one
 	 * of the session sockets or reuse an existing connection. See Session for
@@ -795,9 +884,20 @@ public:
 		socket->sessions--;
 		this->sessions--;
 		processed++;
+		if (!session->hasResponseTimedOut()) {
+			consecutiveResponseTimeouts = 0;
+		}
 		assert(!isTotallyBusy());
 	}
 
+	/**
+	 * Whether the last session(s) on this process timed out waiting
+	 * for a response, which suggests that the process is stuck.
+	 */
+	bool isSuspicious() const {
+		return consecutiveResponseTimeouts > 0;
+	}
+
 	/**
 	 * Returns the uptime of this process so far, as a string.
 	 */
@@ -821,6 +921,10 @@ public:
 		stream << "<sessions>" << sessions << "</sessions>";
 		stream << "<busyness>" << busyness() << "</busyness>";
 		stream << "<processed>" << processed << "</processed>";
+		stream << "<response_timeouts>" << responseTimeouts << "</response_timeouts>";
+		if (isSuspicious()) {
+			stream << "<suspicious>true</suspicious>";
+		}
 		stream << "<spawner_creation_time>" << spawnerCreationTime << "</spawner_creation_time>";
 		stream << "<spawn_start_time>" << spawnStartTime << "</spawn_start_time>";
 		stream << "<spawn_end_time>" << spawnEndTime << "</spawn_end_time>";
@@ -853,12 +957,21 @@ public:
 		case DISABLED:
 			stream << "<enabled>DISABLED</enabled>";
 			break;
+		case STANDBY:
+			stream << "<enabled>STANDBY</enabled>";
+			break;
 		case DETACHED:
 			stream << "<enabled>DETACHED</enabled>";
 			break;
 		default:
 			P_BUG("Unknown 'enabled' state " << (int) enabled);
 		}
+		if (oldGeneration) {
+			stream << "<old_generation/>";
+		}
+		if (memoryLimitExceeded) {
+			stream << "<memory_limit_exceeded/>";
+		}
 		if (metrics.isValid()) {
 			stream << "<has_metrics>true</has_metrics>";
 			stream << "<cpu>" << (int) metrics.cpu << "</cpu>";
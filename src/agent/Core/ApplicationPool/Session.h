@@ -87,6 +87,7 @@ private:
 	Connection connection;
 	mutable boost::atomic<int> refcount;
 	bool closed;
+	bool responseTimedOut;
 
 	void deinitiate(bool success, bool wantKeepAlive) {
 		connection.fail = !success;
@@ -124,6 +125,7 @@ public:
 		  socket(_socket),
 		  refcount(1),
 		  closed(false),
+		  responseTimedOut(false),
 		  onInitiateFailure(NULL),
 		  onClose(NULL)
 		{ }
@@ -226,6 +228,18 @@ public:
 
 	void requestOOBW();
 
+	/**
+	 * Tells the pool that the process did not respond to this session in
+	 * time. The process keeps track of its consecutive response timeouts,
+	 * and is detached once it reaches `detachThreshold` of them (0 means
+	 * never). Must be called before closing the session.
+	 */
+	void reportResponseTimeout(unsigned int detachThreshold);
+
+	bool hasResponseTimedOut() const {
+		return responseTimedOut;
+	}
+
 
 	void ref() const {
 		refcount.fetch_add(1, boost::memory_order_relaxed);
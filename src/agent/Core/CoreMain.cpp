@@ -27,11 +27,6 @@
 #ifndef _GNU_SOURCE
 	#define _GNU_SOURCE
 #endif
-#ifdef __linux__
-	#define SUPPORTS_PER_THREAD_CPU_AFFINITY
-	#include <sched.h>
-	#include <pthread.h>
-#endif
 #ifdef USE_SELINUX
 	#include <selinux/selinux.h>
 #endif
@@ -40,6 +35,7 @@
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/un.h>
+#include <sys/resource.h>
 #include <cstring>
 #include <cassert>
 #include <cerrno>
@@ -83,6 +79,8 @@
 #include <Utils/IOUtils.h>
 #include <Utils/MessageIO.h>
 #include <Utils/VariantMap.h>
+#include <Utils/TracePointProfiler.h>
+#include <Utils/CpuAffinity.h>
 #include <Core/OptionParser.h>
 #include <Core/RequestHandler.h>
 #include <Core/ApiServer.h>
@@ -103,6 +101,8 @@ namespace Core {
 		BackgroundEventLoop *bgloop;
 		ServerKit::Context *serverKitContext;
 		RequestHandler *requestHandler;
+		/** The CPUs that this thread is bound to. Empty if not bound. */
+		CpuList cpus;
 
 		ThreadWorkingObjects()
 			: bgloop(NULL),
@@ -138,6 +138,7 @@ namespace Core {
 
 		ServerKit::AcceptLoadBalancer<RequestHandler> loadBalancer;
 		vector<ThreadWorkingObjects> threadWorkingObjects;
+		CpuTopology cpuTopology;
 		struct ev_signal sigintWatcher;
 		struct ev_signal sigtermWatcher;
 		struct ev_signal sigquitWatcher;
@@ -149,6 +150,7 @@ namespace Core {
 		unsigned int terminationCount;
 		boost::atomic<unsigned int> shutdownCounter;
 		oxt::thread *prestarterThread;
+		TracePointProfiler *profiler;
 
 		WorkingObjects()
 			: exitEvent(__FILE__, __LINE__, "WorkingObjects: exitEvent"),
@@ -164,6 +166,7 @@ namespace Core {
 
 		~WorkingObjects() {
 			delete prestarterThread;
+			delete profiler;
 
 			vector<ThreadWorkingObjects>::iterator it, end = threadWorkingObjects.end();
 			for (it = threadWorkingObjects.begin(); it != end; it++) {
@@ -203,6 +206,7 @@ initializePrivilegedWorkingObjects() {
 	WorkingObjects *wo = workingObjects = new WorkingObjects();
 
 	wo->prestarterThread = NULL;
+	wo->profiler = NULL;
 
 	wo->password = options.get("core_password", false);
 	if (wo->password == "-") {
@@ -517,6 +521,75 @@ spawningKitErrorHandler(const SpawningKit::ConfigPtr &config, SpawnException &e,
 	ApplicationPool2::processAndLogNewSpawnException(e, options, config);
 }
 
+/**
+ * Decides which CPUs the core threads are bound to. Returns an empty list
+ * unless --cpu-affine or --cpu-affinity is given.
+ */
+static vector<CpuList>
+planCoreThreadCpuAffinity(unsigned int nthreads) {
+	VariantMap &options = *agentsOptions;
+	WorkingObjects *wo = workingObjects;
+	string spec = options.get("core_cpu_affinity", false);
+	vector<CpuList> result;
+
+	if (!options.getBool("core_cpu_affine") && spec.empty()) {
+		return result;
+	}
+
+	#ifdef SUPPORTS_PER_THREAD_CPU_AFFINITY
+		CpuList allowed;
+		if (!getCurrentThreadCpuAffinity(allowed)) {
+			int e = errno;
+			P_WARN("Cannot query the CPU affinity of the core: " <<
+				strerror(e) << " (errno=" << e << "). Core threads are not bound to CPUs");
+			return result;
+		}
+
+		result = planThreadCpuAffinity(nthreads, wo->cpuTopology, allowed, spec);
+		for (unsigned int i = 0; i < result.size(); i++) {
+			P_DEBUG("Core thread " << (i + 1) << " will be bound to CPU(s) " <<
+				formatCpuList(result[i]) << " (NUMA node " <<
+				wo->cpuTopology.getNode(result[i]) << ")");
+		}
+	#else
+		P_WARN("Binding core threads to CPUs is not supported on this platform");
+	#endif
+	return result;
+}
+
+/**
+ * Every HTTP/2 stream uses a socket pair and usually a connection to an
+ * application process. Limits the streams of each core thread so that
+ * they can use at most half of the file descriptors, leaving the rest to
+ * HTTP/1 clients and the application pool. Returns 0 for no limit.
+ */
+static unsigned int
+calculateHttp2MaxTotalStreams(unsigned int nthreads) {
+	struct rlimit rl;
+
+	if (getrlimit(RLIMIT_NOFILE, &rl) == -1 || rl.rlim_cur == RLIM_INFINITY) {
+		return 0;
+	}
+	return std::max<rlim_t>(1, rl.rlim_cur / 2 / 3 / nthreads);
+}
+
+/**
+ * Every static file cache entry keeps up to three files open (the file and
+ * its .gz and .br variants), and every core thread has its own cache.
+ * Limits the cache size so that all caches together use at most a quarter
+ * of the file descriptors. Returns `configured` if that is already low enough.
+ */
+static unsigned int
+calculateStaticFileCacheSize(unsigned int nthreads, unsigned int configured) {
+	struct rlimit rl;
+
+	if (getrlimit(RLIMIT_NOFILE, &rl) == -1 || rl.rlim_cur == RLIM_INFINITY) {
+		return configured;
+	}
+	return std::min<rlim_t>(configured,
+		std::max<rlim_t>(1, rl.rlim_cur / 4 / StaticFileCache::ENCODING_COUNT / nthreads));
+}
+
 static void
 initializeNonPrivilegedWorkingObjects() {
 	TRACE_POINT();
@@ -565,6 +638,8 @@ initializeNonPrivilegedWorkingObjects() {
 		wo->spawningKitConfig->instanceDir = absolutizePath(
 			wo->spawningKitConfig->instanceDir);
 	}
+	wo->spawningKitConfig->shellEnvvarsCache = boost::make_shared<SpawningKit::ShellEnvvarsCache>(
+		options.getInt("shell_envvars_cache_ttl"));
 	wo->spawningKitConfig->finalize();
 
 	UPDATE_TRACE_POINT();
@@ -575,15 +650,52 @@ initializeNonPrivilegedWorkingObjects() {
 	wo->appPool->setMaxIdleTime(options.getInt("pool_idle_time") * 1000000ULL);
 	wo->appPool->enableSelfChecking(options.getBool("selfchecks"));
 	wo->appPool->abortLongRunningConnectionsCallback = abortLongRunningConnections;
+	if (options.getBool("restart_file_watching")) {
+		wo->appPool->initRestartFileWatching(options.getInt("stat_throttle_rate"));
+	}
 
 	UPDATE_TRACE_POINT();
 	unsigned int nthreads = options.getInt("core_threads");
 	BackgroundEventLoop *firstLoop = NULL; // Avoid compiler warning
+	wo->cpuTopology.load();
+	vector<CpuList> threadCpus = planCoreThreadCpuAffinity(nthreads);
+	unsigned int http2MaxTotalStreams = calculateHttp2MaxTotalStreams(nthreads);
+	if (options.getBool("http2")) {
+		P_DEBUG("Each core thread serves at most " << http2MaxTotalStreams <<
+			" concurrent HTTP/2 streams (0 = unlimited)");
+	}
+	if (options.getBool("serve_static_files")) {
+		unsigned int staticFileCacheSize = calculateStaticFileCacheSize(nthreads,
+			options.getUint("static_file_cache_size"));
+		if (staticFileCacheSize < options.getUint("static_file_cache_size")) {
+			P_WARN("Lowering the static file cache size from " <<
+				options.getUint("static_file_cache_size") << " to " <<
+				staticFileCacheSize << " files per core thread, because the file "
+				"descriptor limit is too low for more. Raise the limit with "
+				"`ulimit -n` to cache more files");
+			options.setInt("static_file_cache_size", staticFileCacheSize);
+		}
+	}
 	wo->threadWorkingObjects.reserve(nthreads);
 	for (unsigned int i = 0; i < nthreads; i++) {
 		UPDATE_TRACE_POINT();
 		ThreadWorkingObjects two;
 
+		if (!threadCpus.empty()) {
+			two.cpus = threadCpus[i];
+		}
+		// Allocates this thread's data structures, such as the mbuf pool,
+		// on the NUMA node that it will run on.
+		ScopedCpuAffinity affinity(two.cpus);
+		if (affinity.getErrorCode() != 0) {
+			int e = affinity.getErrorCode();
+			P_WARN("Cannot set CPU affinity on core thread " << (i + 1) << ": " <<
+				strerror(e) << " (errno=" << e << ")");
+			// The thread runs wherever the kernel puts it, so the load
+			// balancer must not route clients to it by NUMA node.
+			two.cpus.clear();
+		}
+
 		if (i == 0) {
 			two.bgloop = firstLoop = new BackgroundEventLoop(true, true);
 		} else {
@@ -603,6 +715,10 @@ initializeNonPrivilegedWorkingObjects() {
 		two.requestHandler = new RequestHandler(two.serverKitContext, agentsOptions, i + 1);
 		two.requestHandler->minSpareClients = 128;
 		two.requestHandler->clientFreelistLimit = 1024;
+		two.requestHandler->http2Enabled = options.getBool("http2");
+		two.requestHandler->http2MaxConcurrentStreams =
+			options.getUint("http2_max_concurrent_streams");
+		two.requestHandler->http2MaxTotalStreams = http2MaxTotalStreams;
 		two.requestHandler->resourceLocator = &wo->resourceLocator;
 		two.requestHandler->appPool = wo->appPool;
 		two.requestHandler->unionStationCore = wo->unionStationCore;
@@ -621,6 +737,12 @@ initializeNonPrivilegedWorkingObjects() {
 	ev_signal_init(&wo->sigtermWatcher, onTerminationSignal, SIGTERM);
 	ev_signal_start(firstLoop->libev_loop, &wo->sigtermWatcher);
 
+	UPDATE_TRACE_POINT();
+	if (options.getInt("profiler_interval") > 0) {
+		wo->profiler = new TracePointProfiler(options.getInt("profiler_interval"));
+		wo->profiler->start();
+	}
+
 	UPDATE_TRACE_POINT();
 	if (!apiAddresses.empty()) {
 		UPDATE_TRACE_POINT();
@@ -647,6 +769,8 @@ initializeNonPrivilegedWorkingObjects() {
 		awo->apiServer->instanceDir = options.get("instance_dir", false);
 		awo->apiServer->fdPassingPassword = options.get("watchdog_fd_passing_password", false);
 		awo->apiServer->exitEvent = &wo->exitEvent;
+		awo->apiServer->profiler = wo->profiler;
+		awo->apiServer->cpuTopology = &wo->cpuTopology;
 		awo->apiServer->shutdownFinishCallback = apiServerShutdownFinished;
 
 		wo->shutdownCounter.fetch_add(1, boost::memory_order_relaxed);
@@ -670,6 +794,7 @@ initializeNonPrivilegedWorkingObjects() {
 	}
 	for (unsigned int i = 0; i < nthreads; i++) {
 		ThreadWorkingObjects *two = &wo->threadWorkingObjects[i];
+		ScopedCpuAffinity affinity(two->cpus);
 		two->requestHandler->createSpareClients();
 	}
 	if (nthreads > 1) {
@@ -678,6 +803,14 @@ initializeNonPrivilegedWorkingObjects() {
 			ThreadWorkingObjects *two = &wo->threadWorkingObjects[i];
 			wo->loadBalancer.servers.push_back(two->requestHandler);
 		}
+		if (!threadCpus.empty()) {
+			wo->loadBalancer.cpuNumaNodes = wo->cpuTopology.cpuNodes;
+			for (unsigned int i = 0; i < nthreads; i++) {
+				// -1 (no node) for threads that could not be bound.
+				wo->loadBalancer.serverNumaNodes.push_back(wo->cpuTopology.getNode(
+					wo->threadWorkingObjects[i].cpus));
+			}
+		}
 	}
 	for (unsigned int i = 0; i < apiAddresses.size(); i++) {
 		wo->apiWorkingObjects.apiServer->listen(wo->apiServerFds[i]);
@@ -742,33 +875,14 @@ static void
 mainLoop() {
 	TRACE_POINT();
 	WorkingObjects *wo = workingObjects;
-	#ifdef SUPPORTS_PER_THREAD_CPU_AFFINITY
-		unsigned int maxCpus = boost::thread::hardware_concurrency();
-		bool cpuAffine = agentsOptions->getBool("core_cpu_affine")
-			&& maxCpus <= CPU_SETSIZE;
-	#endif
 
 	installDiagnosticsDumper(dumpDiagnosticsOnCrash, NULL);
 	for (unsigned int i = 0; i < wo->threadWorkingObjects.size(); i++) {
 		ThreadWorkingObjects *two = &wo->threadWorkingObjects[i];
+		// The event loop thread and its libuv poller thread inherit
+		// the CPU affinity of the thread that starts them.
+		ScopedCpuAffinity affinity(two->cpus);
 		two->bgloop->start("Main event loop: thread " + toString(i + 1), 0);
-		#ifdef SUPPORTS_PER_THREAD_CPU_AFFINITY
-			if (cpuAffine) {
-				cpu_set_t cpus;
-				int result;
-
-				CPU_ZERO(&cpus);
-				CPU_SET(i % maxCpus, &cpus);
-				P_DEBUG("Setting CPU affinity of core thread " << (i + 1)
-					<< " to CPU " << (i % maxCpus + 1));
-				result = pthread_setaffinity_np(two->bgloop->getNativeHandle(),
-					maxCpus, &cpus);
-				if (result != 0) {
-					P_WARN("Cannot set CPU affinity on core thread " << (i + 1)
-						<< ": " << strerror(result) << " (errno=" << result << ")");
-				}
-			}
-		#endif
 	}
 	if (wo->apiWorkingObjects.apiServer != NULL) {
 		wo->apiWorkingObjects.bgloop->start("API event loop", 0);
@@ -928,6 +1042,11 @@ cleanup() {
 		delete wo->prestarterThread;
 		wo->prestarterThread = NULL;
 	}
+	if (wo->profiler != NULL) {
+		wo->profiler->stop();
+		delete wo->profiler;
+		wo->profiler = NULL;
+	}
 	for (unsigned int i = 0; i < SERVER_KIT_MAX_SERVER_ENDPOINTS; i++) {
 		if (wo->serverFds[i] != -1) {
 			close(wo->serverFds[i]);
@@ -1058,21 +1177,41 @@ setAgentsOptionsDefaults() {
 	options.setDefaultInt("pool_idle_time", DEFAULT_POOL_IDLE_TIME);
 	options.setDefaultInt("min_instances", 1);
 	options.setDefaultInt("max_preloader_idle_time", DEFAULT_MAX_PRELOADER_IDLE_TIME);
+	options.setDefaultInt("shell_envvars_cache_ttl", 0);
 	options.setDefaultInt("stat_throttle_rate", DEFAULT_STAT_THROTTLE_RATE);
+	options.setDefaultBool("restart_file_watching", true);
+	options.setDefaultInt("app_response_header_timeout", 0);
+	options.setDefaultInt("app_response_body_timeout", 0);
+	options.setDefaultInt("app_response_timeout_detach_threshold", 0);
+	options.setDefaultInt("max_request_queue_time", 0);
+	options.setDefaultInt("request_queue_target", 0);
+	options.setDefaultInt("request_queue_interval", 100);
+	options.setDefaultBool("request_queue_adaptive_lifo", false);
+	options.setDefaultInt("warmup_time", 0);
+	options.setDefaultInt("standby_processes", 0);
+	options.setDefaultInt("memory_limit", 0);
 	options.setDefault("server_software", SERVER_TOKEN_NAME "/" PASSENGER_VERSION);
 	options.setDefaultBool("show_version_in_header", true);
 	options.setDefaultBool("sticky_sessions", false);
+	options.setDefaultBool("sticky_sessions_fallback", false);
 	options.setDefault("sticky_sessions_cookie_name", DEFAULT_STICKY_SESSIONS_COOKIE_NAME);
 	options.setDefaultBool("turbocaching", true);
+	options.setDefaultBool("http2", false);
+	options.setDefaultUint("http2_max_concurrent_streams", 100);
+	options.setDefaultBool("offload_multipart_uploads", false);
+	options.setDefaultBool("serve_static_files", false);
+	options.setDefaultUint("static_file_cache_size", 1024);
 	options.setDefault("data_buffer_dir", getSystemTempDir());
 	options.setDefaultUint("file_buffer_threshold", DEFAULT_FILE_BUFFERED_CHANNEL_THRESHOLD);
 	options.setDefaultInt("response_buffer_high_watermark", DEFAULT_RESPONSE_BUFFER_HIGH_WATERMARK);
 	options.setDefaultBool("selfchecks", false);
+	options.setDefaultInt("profiler_interval", 0);
 	options.setDefaultBool("core_graceful_exit", true);
 	options.setDefaultInt("core_threads", boost::thread::hardware_concurrency());
 	options.setDefaultBool("core_cpu_affine", false);
 	options.setDefault("friendly_error_pages", "auto");
 	options.setDefaultBool("rolling_restarts", false);
+	options.setDefaultInt("rolling_restart_batch_size", 1);
 	options.setDefaultBool("resist_deployment_errors", false);
 
 	string firstAddress = options.getStrSet("core_addresses")[0];
@@ -1178,6 +1317,17 @@ sanityCheckOptions() {
 		fprintf(stderr, "ERROR: you may only specify for --threads a number greater than or equal to 1.\n");
 		ok = false;
 	}
+	CpuList allowedCpus;
+	#ifdef SUPPORTS_PER_THREAD_CPU_AFFINITY
+		getCurrentThreadCpuAffinity(allowedCpus);
+	#endif
+	try {
+		planThreadCpuAffinity(1, CpuTopology(), allowedCpus,
+			options.get("core_cpu_affinity", false));
+	} catch (const ArgumentException &e) {
+		fprintf(stderr, "ERROR: invalid value for --cpu-affinity: %s.\n", e.what());
+		ok = false;
+	}
 	if (options.getInt("max_pool_size") < 1) {
 		fprintf(stderr, "ERROR: you may only specify for --max-pool-size a number greater than or equal to 1.\n");
 		ok = false;
@@ -118,7 +118,13 @@ coreUsage() {
 	printf("                            (passed to Meteor using --settings)\n");
 	printf("      --debugger            Enable Ruby debugger support (Enterprise only)\n");
 	printf("\n");
-	printf("      --rolling-restarts    Enable rolling restarts (Enterprise only)\n");
+	printf("      --rolling-restarts    Replace application processes one by one when\n");
+	printf("                            restarting, so that the old processes keep\n");
+	printf("                            serving requests in the mean time\n");
+	printf("      --rolling-restart-batch-size N\n");
+	printf("                            Maximum number of old processes to shut down\n");
+	printf("                            ahead of their replacements when the pool is\n");
+	printf("                            full during a rolling restart. Default: 1\n");
 	printf("      --resist-deployment-errors\n");
 	printf("                            Enable deployment error resistance (Enterprise only)\n");
 	printf("\n");
@@ -132,6 +138,11 @@ coreUsage() {
 	printf("                            Maximum time that preloader processes may be\n");
 	printf("                            be idle. A value of 0 means that preloader\n");
 	printf("                            processes never timeout. Default: %d\n", DEFAULT_MAX_PRELOADER_IDLE_TIME);
+	printf("      --shell-envvars-cache-ttl SECS\n");
+	printf("                            Number of seconds that the environment set up by\n");
+	printf("                            a user's login shell is reused for new processes.\n");
+	printf("                            Ulimits and the umask set by the shell are not\n");
+	printf("                            reused. Default: 0 (disabled)\n");
 	printf("      --min-instances N     Minimum number of application processes. Default: 1\n");
 	printf("\n");
 	printf("Request handling options (optional):\n");
@@ -141,10 +152,65 @@ coreUsage() {
 	printf("      --sticky-sessions-cookie-name NAME\n");
 	printf("                            Cookie name to use for sticky sessions.\n");
 	printf("                            Default: " DEFAULT_STICKY_SESSIONS_COOKIE_NAME "\n");
+	printf("      --sticky-sessions-fallback\n");
+	printf("                            Route sticky sessions whose process is totally\n");
+	printf("                            busy to another process by consistent hashing,\n");
+	printf("                            instead of queueing them\n");
 	printf("      --vary-turbocache-by-cookie NAME\n");
 	printf("                            Vary the turbocache by the cookie of the given name\n");
 	printf("      --disable-turbocaching\n");
 	printf("                            Disable turbocaching\n");
+	printf("      --http2               Accept cleartext HTTP/2 connections (prior\n");
+	printf("                            knowledge and h2c upgrade)\n");
+	printf("      --http2-max-concurrent-streams N\n");
+	printf("                            Maximum number of concurrent HTTP/2 streams per\n");
+	printf("                            connection. The total number of streams is also\n");
+	printf("                            limited by the file descriptor limit. Default: 100\n");
+	printf("      --offload-multipart-uploads\n");
+	printf("                            Write file uploads in multipart/form-data request\n");
+	printf("                            bodies to temporary files and pass their paths to\n");
+	printf("                            the application\n");
+	printf("      --serve-static-files  Serve files in the application's public directory\n");
+	printf("                            directly, without forwarding the requests to the\n");
+	printf("                            application\n");
+	printf("      --static-file-cache-size N\n");
+	printf("                            Maximum number of files per thread whose file\n");
+	printf("                            descriptors and metadata are cached when serving\n");
+	printf("                            static files. Default: 1024\n");
+	printf("      --app-response-header-timeout MSEC\n");
+	printf("                            Respond with 504 if the application does not\n");
+	printf("                            send a response header within this time.\n");
+	printf("                            Default: 0 (unlimited)\n");
+	printf("      --app-response-body-timeout MSEC\n");
+	printf("                            Abort the request if the application does not\n");
+	printf("                            send response body data within this time.\n");
+	printf("                            Default: 0 (unlimited)\n");
+	printf("      --app-response-timeout-detach-threshold N\n");
+	printf("                            Detach a process that times out this many times\n");
+	printf("                            in a row. Default: 0 (never)\n");
+	printf("      --max-request-queue-time SECS\n");
+	printf("                            Maximum time that a request may wait in the\n");
+	printf("                            request queue. Default: 0 (unlimited)\n");
+	printf("      --request-queue-target MSEC\n");
+	printf("                            Shed requests that waited longer than this in a\n");
+	printf("                            queue that has not been empty during the last\n");
+	printf("                            --request-queue-interval. Default: 0 (disabled)\n");
+	printf("      --request-queue-interval MSEC\n");
+	printf("                            How long the request queue must be non-empty\n");
+	printf("                            before it is considered overloaded. Default: 100\n");
+	printf("      --request-queue-adaptive-lifo\n");
+	printf("                            Serve newest requests first while the request\n");
+	printf("                            queue is overloaded\n");
+	printf("      --warmup-time SECS    Ramp up the share of traffic that newly spawned\n");
+	printf("                            processes receive over this many seconds.\n");
+	printf("                            Default: 0 (disabled)\n");
+	printf("      --warmup-urls PATHS   Comma-separated list of paths to request from\n");
+	printf("                            newly spawned processes before routing traffic\n");
+	printf("                            to them\n");
+	printf("      --standby-processes N Number of spawned processes to keep in reserve\n");
+	printf("                            for instant scale-up. Default: 0\n");
+	printf("      --memory-limit MB     Replace processes whose private memory usage\n");
+	printf("                            exceeds this many megabytes. Default: 0 (no limit)\n");
 	printf("\n");
 	printf("Other options (optional):\n");
 	printf("      --log-file PATH       Log to the given file.\n");
@@ -153,6 +219,9 @@ coreUsage() {
 	printf("      --stat-throttle-rate SECONDS\n");
 	printf("                            Throttle filesystem restart.txt checks to at most\n");
 	printf("                            once per given seconds. Default: %d\n", DEFAULT_STAT_THROTTLE_RATE);
+	printf("      --no-restart-file-watching\n");
+	printf("                            Check restart.txt during requests instead of\n");
+	printf("                            watching it in the background with inotify\n");
 	printf("      --no-show-version-in-header\n");
 	printf("                            Do not show " PROGRAM_NAME " version number in\n");
 	printf("                            HTTP headers.\n");
@@ -167,10 +236,17 @@ coreUsage() {
 	printf("      --disable-selfchecks  Disable various self-checks. This improves\n");
 	printf("                            performance, but might delay finding bugs in\n");
 	printf("                            " PROGRAM_NAME "\n");
+	printf("      --profiler-interval MSEC\n");
+	printf("                            Enable the trace point profiler, sampling the\n");
+	printf("                            threads every MSEC milliseconds (see\n");
+	printf("                            /profile.txt in the API). Default: 0 (disabled)\n");
 	printf("      --threads NUMBER      Number of threads to use for request handling.\n");
 	printf("                            Default: number of CPU cores (%d)\n",
 		boost::thread::hardware_concurrency());
-	printf("      --cpu-affine          Enable per-thread CPU affinity (Linux only)\n");
+	printf("      --cpu-affine          Bind every thread to a CPU, spread evenly over\n");
+	printf("                            NUMA nodes (Linux only)\n");
+	printf("      --cpu-affinity CPUS   Bind threads to the given colon-separated CPU\n");
+	printf("                            lists, in turn. Example: 0-7:8-15 (Linux only)\n");
 	printf("  -h, --help                Show this help\n");
 	printf("\n");
 	printf("API account privilege levels (ordered from most to least privileges):\n");
@@ -256,6 +332,9 @@ parseCoreOption(int argc, const char *argv[], int &i, VariantMap &options) {
 	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--max-preloader-idle-time")) {
 		options.setInt("max_preloader_idle_time", atoi(argv[i + 1]));
 		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--shell-envvars-cache-ttl")) {
+		options.setInt("shell_envvars_cache_ttl", atoi(argv[i + 1]));
+		i += 2;
 	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--min-instances")) {
 		options.setInt("min_instances", atoi(argv[i + 1]));
 		i += 2;
@@ -295,6 +374,9 @@ parseCoreOption(int argc, const char *argv[], int &i, VariantMap &options) {
 	} else if (p.isFlag(argv[i], '\0', "--sticky-sessions")) {
 		options.setBool("sticky_sessions", true);
 		i++;
+	} else if (p.isFlag(argv[i], '\0', "--sticky-sessions-fallback")) {
+		options.setBool("sticky_sessions_fallback", true);
+		i++;
 	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--sticky-sessions-cookie-name")) {
 		options.set("sticky_sessions_cookie_name", argv[i + 1]);
 		i += 2;
@@ -304,6 +386,54 @@ parseCoreOption(int argc, const char *argv[], int &i, VariantMap &options) {
 	} else if (p.isFlag(argv[i], '\0', "--disable-turbocaching")) {
 		options.setBool("turbocaching", false);
 		i++;
+	} else if (p.isFlag(argv[i], '\0', "--http2")) {
+		options.setBool("http2", true);
+		i++;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--http2-max-concurrent-streams")) {
+		options.setInt("http2_max_concurrent_streams", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isFlag(argv[i], '\0', "--offload-multipart-uploads")) {
+		options.setBool("offload_multipart_uploads", true);
+		i++;
+	} else if (p.isFlag(argv[i], '\0', "--serve-static-files")) {
+		options.setBool("serve_static_files", true);
+		i++;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--static-file-cache-size")) {
+		options.setInt("static_file_cache_size", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--app-response-header-timeout")) {
+		options.setInt("app_response_header_timeout", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--app-response-body-timeout")) {
+		options.setInt("app_response_body_timeout", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--app-response-timeout-detach-threshold")) {
+		options.setInt("app_response_timeout_detach_threshold", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--max-request-queue-time")) {
+		options.setInt("max_request_queue_time", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--request-queue-target")) {
+		options.setInt("request_queue_target", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--request-queue-interval")) {
+		options.setInt("request_queue_interval", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isFlag(argv[i], '\0', "--request-queue-adaptive-lifo")) {
+		options.setBool("request_queue_adaptive_lifo", true);
+		i++;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--warmup-time")) {
+		options.setInt("warmup_time", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--warmup-urls")) {
+		options.set("warmup_urls", argv[i + 1]);
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--standby-processes")) {
+		options.setInt("standby_processes", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--memory-limit")) {
+		options.setInt("memory_limit", atoi(argv[i + 1]));
+		i += 2;
 	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--ruby")) {
 		options.set("default_ruby", argv[i + 1]);
 		i += 2;
@@ -322,6 +452,9 @@ parseCoreOption(int argc, const char *argv[], int &i, VariantMap &options) {
 	} else if (p.isFlag(argv[i], '\0', "--rolling-restarts")) {
 		options.setBool("rolling_restarts", true);
 		i++;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--rolling-restart-batch-size")) {
+		options.setInt("rolling_restart_batch_size", atoi(argv[i + 1]));
+		i += 2;
 	} else if (p.isFlag(argv[i], '\0', "--resist-deployment-errors")) {
 		options.setBool("resist_deployment_errors", true);
 		i++;
@@ -343,6 +476,9 @@ parseCoreOption(int argc, const char *argv[], int &i, VariantMap &options) {
 	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--stat-throttle-rate")) {
 		options.setInt("stat_throttle_rate", atoi(argv[i + 1]));
 		i += 2;
+	} else if (p.isFlag(argv[i], '\0', "--no-restart-file-watching")) {
+		options.setBool("restart_file_watching", false);
+		i++;
 	} else if (p.isFlag(argv[i], '\0', "--no-show-version-in-header")) {
 		options.setBool("show_version_in_header", false);
 		i++;
@@ -358,12 +494,18 @@ parseCoreOption(int argc, const char *argv[], int &i, VariantMap &options) {
 	} else if (p.isFlag(argv[i], '\0', "--disable-selfchecks")) {
 		options.setBool("selfchecks", false);
 		i++;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--profiler-interval")) {
+		options.setInt("profiler_interval", atoi(argv[i + 1]));
+		i += 2;
 	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--threads")) {
 		options.setInt("core_threads", atoi(argv[i + 1]));
 		i += 2;
 	} else if (p.isFlag(argv[i], '\0', "--cpu-affine")) {
 		options.setBool("core_cpu_affine", true);
 		i++;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--cpu-affinity")) {
+		options.set("core_cpu_affinity", argv[i + 1]);
+		i += 2;
 	} else if (!startsWith(argv[i], "-")) {
 		if (!options.has("app_root")) {
 			options.set("app_root", argv[i]);
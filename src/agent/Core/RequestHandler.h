@@ -31,6 +31,7 @@
 
 #include <boost/shared_ptr.hpp>
 #include <boost/make_shared.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/cstdint.hpp>
 #include <oxt/macros.hpp>
 #include <ev++.h>
@@ -43,6 +44,9 @@
 
 #include <sys/types.h>
 #include <sys/uio.h>
+#ifdef __linux__
+	#include <sys/sendfile.h>
+#endif
 #include <utility>
 #include <typeinfo>
 #include <cstdio>
@@ -68,10 +72,12 @@
 #include <Utils/HttpConstants.h>
 #include <Utils/VariantMap.h>
 #include <Utils/Timer.h>
+#include <Utils/Metrics.h>
 #include <Core/ApplicationPool/ErrorRenderer.h>
 #include <Core/RequestHandler/Client.h>
 #include <Core/RequestHandler/AppResponse.h>
 #include <Core/RequestHandler/TurboCaching.h>
+#include <Core/RequestHandler/StaticFileCache.h>
 #include <Core/UnionStation/Core.h>
 
 namespace Passenger {
@@ -108,14 +114,24 @@ private:
 	typedef ServerKit::FileBufferedFdSinkChannel FileBufferedFdSinkChannel;
 
 	static const unsigned int MAX_SESSION_CHECKOUT_TRY = 10;
+	/** The maximum number of static file bytes to send before giving other clients a turn. */
+	static const unsigned int STATIC_FILE_SEND_BURST = 512 * 1024;
 
 	unsigned int statThrottleRate;
 	unsigned int responseBufferHighWatermark;
+	// In milliseconds; 0 means no timeout. See ForwardResponse.cpp.
+	unsigned int appResponseHeaderTimeout;
+	unsigned int appResponseBodyTimeout;
+	// Detach a process after this many consecutive response timeouts; 0 means never.
+	unsigned int appResponseTimeoutDetachThreshold;
+	unsigned long totalAppResponseHeaderTimeouts;
+	unsigned long totalAppResponseBodyTimeouts;
 	BenchmarkMode benchmarkMode: 3;
 	bool singleAppMode: 1;
 	bool showVersionInHeader: 1;
 	bool stickySessions: 1;
 	bool gracefulExit: 1;
+	bool offloadMultipartUploads: 1;
 
 	const VariantMap *agentsOptions;
 	psg_pool_t *stringPool;
@@ -152,6 +168,10 @@ private:
 	HashedStaticString HTTP_CONNECTION;
 	HashedStaticString HTTP_STATUS;
 	HashedStaticString HTTP_TRANSFER_ENCODING;
+	HashedStaticString HTTP_X_REQUEST_QUEUE_TIMEOUT;
+	HashedStaticString HTTP_ACCEPT_ENCODING;
+	HashedStaticString HTTP_IF_NONE_MATCH;
+	HashedStaticString HTTP_IF_MODIFIED_SINCE;
 
 	unsigned int threadNumber;
 	StaticString serverLogName;
@@ -160,6 +180,8 @@ private:
 	friend class ResponseCache<Request>;
 	struct ev_check checkWatcher;
 	TurboCaching<Request> turboCaching;
+	/** NULL unless static file serving is enabled. */
+	boost::scoped_ptr<StaticFileCache> staticFileCache;
 
 	#ifdef DEBUG_RH_EVENT_LOOP_BLOCKING
 		struct ev_prepare prepareWatcher;
@@ -167,14 +189,36 @@ private:
 	#endif
 
 public:
+	/**
+	 * Statistics for the ApiServer's /metrics endpoint. They are only
+	 * updated by this RequestHandler's event loop thread, so every thread
+	 * has its own set and updating them requires no synchronization. See
+	 * MetricCounter. The ApiServer sums them over all threads with
+	 * `writeMetrics()`.
+	 */
+	struct Metrics {
+		MetricCounter requests;
+		MetricCounter requestBodyBytes;
+		MetricCounter appResponseBodyBytes;
+		/** Indexed by the first digit of the status code, minus 1. */
+		MetricCounter appResponses[5];
+		MetricCounter turbocacheFetches;
+		MetricCounter turbocacheHits;
+		MetricCounter staticFileResponses;
+		/** From the beginning of a request until it has been fully handled. */
+		MetricHistogram requestTimes;
+	};
+
 	ResourceLocator *resourceLocator;
 	PoolPtr appPool;
 	UnionStation::CorePtr unionStationCore;
+	Metrics metrics;
 
 protected:
 	#include <Core/RequestHandler/Utils.cpp>
 	#include <Core/RequestHandler/Hooks.cpp>
 	#include <Core/RequestHandler/InitRequest.cpp>
+	#include <Core/RequestHandler/StaticFiles.cpp>
 	#include <Core/RequestHandler/BufferBody.cpp>
 	#include <Core/RequestHandler/CheckoutSession.cpp>
 	#include <Core/RequestHandler/SendRequest.cpp>
@@ -187,11 +231,21 @@ public:
 
 		  statThrottleRate(_agentsOptions->getInt("stat_throttle_rate")),
 		  responseBufferHighWatermark(_agentsOptions->getInt("response_buffer_high_watermark")),
+		  appResponseHeaderTimeout(_agentsOptions->getInt("app_response_header_timeout",
+			  false, 0)),
+		  appResponseBodyTimeout(_agentsOptions->getInt("app_response_body_timeout",
+			  false, 0)),
+		  appResponseTimeoutDetachThreshold(_agentsOptions->getInt(
+			  "app_response_timeout_detach_threshold", false, 0)),
+		  totalAppResponseHeaderTimeouts(0),
+		  totalAppResponseBodyTimeouts(0),
 		  benchmarkMode(parseBenchmarkMode(_agentsOptions->get("benchmark_mode", false))),
 		  singleAppMode(false),
 		  showVersionInHeader(_agentsOptions->getBool("show_version_in_header")),
 		  stickySessions(_agentsOptions->getBool("sticky_sessions")),
 		  gracefulExit(_agentsOptions->getBool("core_graceful_exit")),
+		  offloadMultipartUploads(_agentsOptions->getBool("offload_multipart_uploads",
+			  false, false)),
 
 		  agentsOptions(_agentsOptions),
 		  stringPool(psg_create_pool(1024 * 4)),
@@ -217,6 +271,10 @@ public:
 		  HTTP_CONNECTION("connection"),
 		  HTTP_STATUS("status"),
 		  HTTP_TRANSFER_ENCODING("transfer-encoding"),
+		  HTTP_X_REQUEST_QUEUE_TIMEOUT("x-request-queue-timeout"),
+		  HTTP_ACCEPT_ENCODING("accept-encoding"),
+		  HTTP_IF_NONE_MATCH("if-none-match"),
+		  HTTP_IF_MODIFIED_SINCE("if-modified-since"),
 
 		  threadNumber(_threadNumber),
 		  turboCaching(getTurboCachingInitialState(_agentsOptions))
@@ -247,6 +305,11 @@ public:
 
 		generateServerLogName(_threadNumber);
 
+		if (agentsOptions->getBool("serve_static_files", false, false)) {
+			unsigned int cacheSize = agentsOptions->getInt("static_file_cache_size", false, 1024);
+			staticFileCache.reset(new StaticFileCache(cacheSize, statThrottleRate, cacheSize));
+		}
+
 		if (!agentsOptions->getBool("multi_app")) {
 			boost::shared_ptr<Options> options = boost::make_shared<Options>();
 
@@ -279,6 +342,9 @@ public:
 	}
 
 	~RequestHandler() {
+		// Unwatches the cached files, so this must happen while
+		// the pool's FileWatcher still exists.
+		staticFileCache.reset();
 		psg_destroy_pool(stringPool);
 	}
 
@@ -309,6 +375,9 @@ public:
 		if (unionStationCore == NULL) {
 			unionStationCore = appPool->getUnionStationCore();
 		}
+		if (staticFileCache != NULL) {
+			staticFileCache->setWatcher(appPool->restartFileWatcher.get());
+		}
 	}
 
 	void disconnectLongRunningConnections(const StaticString &gupid) {
@@ -358,12 +427,76 @@ public:
 		}
 	}
 
+	/**
+	 * Writes the sum of the metrics of the given RequestHandlers. Safe to
+	 * call from any thread.
+	 */
+	static void writeMetrics(OpenMetricsWriter &writer,
+		const vector<RequestHandler *> &requestHandlers)
+	{
+		boost::uint64_t requests = 0, requestBodyBytes = 0, appResponseBodyBytes = 0;
+		boost::uint64_t appResponses[5] = { 0, 0, 0, 0, 0 };
+		boost::uint64_t turbocacheFetches = 0, turbocacheHits = 0;
+		boost::uint64_t staticFileResponses = 0;
+		LatencyHistogram requestTimes;
+		vector<RequestHandler *>::const_iterator it, end = requestHandlers.end();
+		unsigned int i;
+
+		for (it = requestHandlers.begin(); it != end; it++) {
+			const Metrics &metrics = (*it)->metrics;
+			requests += metrics.requests.get();
+			requestBodyBytes += metrics.requestBodyBytes.get();
+			appResponseBodyBytes += metrics.appResponseBodyBytes.get();
+			for (i = 0; i < 5; i++) {
+				appResponses[i] += metrics.appResponses[i].get();
+			}
+			turbocacheFetches += metrics.turbocacheFetches.get();
+			turbocacheHits += metrics.turbocacheHits.get();
+			staticFileResponses += metrics.staticFileResponses.get();
+			metrics.requestTimes.collect(requestTimes);
+		}
+
+		writer.declare("passenger_requests", "counter",
+			"Requests received from clients.");
+		writer.sample("passenger_requests_total", "", requests);
+		writer.declare("passenger_request_duration_seconds", "histogram",
+			"Time from receiving a request until it has been fully handled.");
+		writer.histogram("passenger_request_duration_seconds", "", requestTimes);
+		writer.declare("passenger_request_body_bytes", "counter",
+			"Request body bytes received from clients.");
+		writer.sample("passenger_request_body_bytes_total", "", requestBodyBytes);
+		writer.declare("passenger_app_responses", "counter",
+			"Responses received from applications, by status code class.");
+		for (i = 0; i < 5; i++) {
+			char statusClass[] = { char('1' + i), 'x', 'x', '\0' };
+			writer.sample("passenger_app_responses_total",
+				OpenMetricsWriter::label("code", statusClass), appResponses[i]);
+		}
+		writer.declare("passenger_app_response_body_bytes", "counter",
+			"Response body bytes received from applications.");
+		writer.sample("passenger_app_response_body_bytes_total", "", appResponseBodyBytes);
+		writer.declare("passenger_turbocache_fetches", "counter",
+			"Turbocache lookups.");
+		writer.sample("passenger_turbocache_fetches_total", "", turbocacheFetches);
+		writer.declare("passenger_turbocache_hits", "counter",
+			"Requests that were answered from the turbocache.");
+		writer.sample("passenger_turbocache_hits_total", "", turbocacheHits);
+		writer.declare("passenger_static_file_responses", "counter",
+			"Requests that were answered with a file from an application's public directory.");
+		writer.sample("passenger_static_file_responses_total", "", staticFileResponses);
+	}
+
 	virtual Json::Value getConfigAsJson() const {
 		Json::Value doc = ParentClass::getConfigAsJson();
 		doc["single_app_mode"] = singleAppMode;
 		doc["stat_throttle_rate"] = statThrottleRate;
 		doc["show_version_in_header"] = showVersionInHeader;
 		doc["data_buffer_dir"] = getContext()->defaultFileBufferedChannelConfig.bufferDir;
+		doc["offload_multipart_uploads"] = offloadMultipartUploads;
+		doc["serve_static_files"] = staticFileCache != NULL;
+		doc["app_response_header_timeout"] = appResponseHeaderTimeout;
+		doc["app_response_body_timeout"] = appResponseBodyTimeout;
+		doc["app_response_timeout_detach_threshold"] = appResponseTimeoutDetachThreshold;
 		return doc;
 	}
 
@@ -376,10 +509,27 @@ public:
 			getContext()->defaultFileBufferedChannelConfig.bufferDir =
 				doc["data_buffer_dir"].asString();
 		}
+		if (doc.isMember("offload_multipart_uploads")) {
+			offloadMultipartUploads = doc["offload_multipart_uploads"].asBool();
+		}
+		if (doc.isMember("app_response_header_timeout")) {
+			appResponseHeaderTimeout = doc["app_response_header_timeout"].asUInt();
+		}
+		if (doc.isMember("app_response_body_timeout")) {
+			appResponseBodyTimeout = doc["app_response_body_timeout"].asUInt();
+		}
+		if (doc.isMember("app_response_timeout_detach_threshold")) {
+			appResponseTimeoutDetachThreshold =
+				doc["app_response_timeout_detach_threshold"].asUInt();
+		}
 	}
 
 	virtual Json::Value inspectStateAsJson() const {
 		Json::Value doc = ParentClass::inspectStateAsJson();
+		Json::Value timeouts;
+		timeouts["header"] = (Json::UInt64) totalAppResponseHeaderTimeouts;
+		timeouts["body"] = (Json::UInt64) totalAppResponseBodyTimeouts;
+		doc["app_response_timeouts"] = timeouts;
 		if (turboCaching.isEnabled()) {
 			Json::Value subdoc;
 			subdoc["fetches"] = turboCaching.responseCache.getFetches();
@@ -390,6 +540,9 @@ public:
 			subdoc["store_success_ratio"] = turboCaching.responseCache.getStoreSuccessRatio();
 			doc["turbocaching"] = subdoc;
 		}
+		if (staticFileCache != NULL) {
+			doc["static_file_cache"] = staticFileCache->inspectStateAsJson();
+		}
 		return doc;
 	}
 
@@ -422,6 +575,9 @@ public:
 		if (req->requestBodyBuffering) {
 			doc["body_bytes_buffered"] = byteSizeToJson(req->bodyBytesBuffered);
 		}
+		if (req->multipartOffloader != NULL) {
+			doc["multipart_offloading"] = req->multipartOffloader->inspectStateAsJson();
+		}
 
 		if (req->session != NULL) {
 			Json::Value &sessionDoc = doc["session"] = Json::Value(Json::objectValue);
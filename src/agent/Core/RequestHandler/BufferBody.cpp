@@ -38,6 +38,32 @@ beginBufferingBody(Client *client, Request *req) {
 	req->beginStopwatchLog(&req->stopwatchLogs.bufferingRequestBody, "buffering request body");
 }
 
+void
+initializeMultipartOffloading(Client *client, Request *req) {
+	const LString *contentType = req->headers.lookup(HTTP_CONTENT_TYPE);
+	string boundary;
+
+	if (contentType == NULL) {
+		return;
+	}
+	contentType = psg_lstr_make_contiguous(contentType, req->pool);
+	if (!ServerKit::MultipartParser::parseBoundary(
+		StaticString(contentType->start->data, contentType->size), boundary))
+	{
+		return;
+	}
+
+	SKC_TRACE(client, 2, "Offloading file uploads in multipart request body");
+	MultipartOffloader *offloader = new MultipartOffloader(getContext(), boundary,
+		getContext()->defaultFileBufferedChannelConfig.bufferDir,
+		appPool->getRandomGenerator().get());
+	offloader->outputCallback = onMultipartOffloaderOutput;
+	offloader->consumedCallback = onMultipartOffloaderConsumed;
+	offloader->userData = req;
+	req->multipartOffloader = offloader;
+	req->requestBodyBuffering = true;
+}
+
 Channel::Result
 whenBufferingBody_onRequestBody(Client *client, Request *req,
 	const MemoryKit::mbuf &buffer, int errcode)
@@ -46,6 +72,9 @@ whenBufferingBody_onRequestBody(Client *client, Request *req,
 
 	if (buffer.size() > 0) {
 		// Data
+		if (req->multipartOffloader != NULL) {
+			return offloadMultipartBody(client, req, buffer);
+		}
 		req->bodyBytesBuffered += buffer.size();
 		SKC_TRACE(client, 3, "Buffering " << buffer.size() <<
 			" bytes of client request body: \"" <<
@@ -56,36 +85,16 @@ whenBufferingBody_onRequestBody(Client *client, Request *req,
 	} else if (errcode == 0 || errcode == ECONNRESET) {
 		// EOF
 		SKC_TRACE(client, 2, "End of request body encountered");
-		req->bodyBuffer.feed(MemoryKit::mbuf());
-		if (req->bodyType == Request::RBT_CHUNKED) {
-			// The data that we've stored in the body buffer is dechunked, so when forwarding
-			// the buffered body to the app we must advertise it as being a fixed-length,
-			// non-chunked body.
-			const unsigned int UINT64_STRSIZE = sizeof("18446744073709551615");
-			SKC_TRACE(client, 2, "Adjusting forwarding headers as fixed-length, non-chunked");
-			ServerKit::Header *header = (ServerKit::Header *)
-				psg_palloc(req->pool, sizeof(ServerKit::Header));
-			char *contentLength = (char *) psg_pnalloc(req->pool, UINT64_STRSIZE);
-			unsigned int size = integerToOtherBase<boost::uint64_t, 10>(
-				req->bodyBytesBuffered, contentLength, UINT64_STRSIZE);
-
-			psg_lstr_init(&header->key);
-			psg_lstr_append(&header->key, req->pool, "content-length",
-				sizeof("content-length") - 1);
-			psg_lstr_init(&header->origKey);
-			psg_lstr_append(&header->origKey, req->pool, "Content-Length",
-				sizeof("Content-Length") - 1);
-			psg_lstr_init(&header->val);
-			psg_lstr_append(&header->val, req->pool, contentLength, size);
-
-			header->hash = HashedStaticString("content-length",
-				sizeof("content-length") - 1).hash();
-
-			req->headers.erase(HTTP_TRANSFER_ENCODING);
-			req->headers.insert(&header, req->pool);
+		if (req->multipartOffloader != NULL) {
+			int result = req->multipartOffloader->finish();
+			if (result == -1) {
+				// Continues in onMultipartOffloaderConsumed().
+				return Channel::Result(-1, false);
+			}
+			finishOffloadingMultipartBody(client, req);
+		} else {
+			finishBufferingBody(client, req);
 		}
-		req->endStopwatchLog(&req->stopwatchLogs.bufferingRequestBody);
-		checkoutSession(client, req);
 		return Channel::Result(0, true);
 	} else {
 		const unsigned int BUFSIZE = 1024;
@@ -97,3 +106,122 @@ whenBufferingBody_onRequestBody(Client *client, Request *req,
 		return Channel::Result(0, true);
 	}
 }
+
+void
+finishBufferingBody(Client *client, Request *req) {
+	req->bodyBuffer.feed(MemoryKit::mbuf());
+	if (req->bodyType == Request::RBT_CHUNKED || req->multipartOffloader != NULL) {
+		// The data that we've stored in the body buffer is dechunked or rewritten,
+		// so when forwarding the buffered body to the app we must advertise it as
+		// being a fixed-length, non-chunked body of the buffered size.
+		const unsigned int UINT64_STRSIZE = sizeof("18446744073709551615");
+		SKC_TRACE(client, 2, "Adjusting forwarding headers as fixed-length, non-chunked");
+		ServerKit::Header *header = (ServerKit::Header *)
+			psg_palloc(req->pool, sizeof(ServerKit::Header));
+		char *contentLength = (char *) psg_pnalloc(req->pool, UINT64_STRSIZE);
+		unsigned int size = integerToOtherBase<boost::uint64_t, 10>(
+			req->bodyBytesBuffered, contentLength, UINT64_STRSIZE);
+
+		psg_lstr_init(&header->key);
+		psg_lstr_append(&header->key, req->pool, "content-length",
+			sizeof("content-length") - 1);
+		psg_lstr_init(&header->origKey);
+		psg_lstr_append(&header->origKey, req->pool, "Content-Length",
+			sizeof("Content-Length") - 1);
+		psg_lstr_init(&header->val);
+		psg_lstr_append(&header->val, req->pool, contentLength, size);
+
+		header->hash = HashedStaticString("content-length",
+			sizeof("content-length") - 1).hash();
+
+		req->headers.erase(HTTP_TRANSFER_ENCODING);
+		req->headers.erase(HTTP_CONTENT_LENGTH);
+		req->headers.insert(&header, req->pool);
+	}
+	req->endStopwatchLog(&req->stopwatchLogs.bufferingRequestBody);
+	checkoutSession(client, req);
+}
+
+
+/***** Multipart upload offloading *****/
+
+Channel::Result
+offloadMultipartBody(Client *client, Request *req, const MemoryKit::mbuf &buffer) {
+	SKC_TRACE(client, 3, "Offloading " << buffer.size() <<
+		" bytes of multipart request body");
+	int result = req->multipartOffloader->feed(buffer);
+	if (req->multipartOffloader->hasError()) {
+		endOffloadingWithError(client, req);
+		return Channel::Result(0, true);
+	} else {
+		// Continues in onMultipartOffloaderConsumed() if result is -1.
+		return Channel::Result(result, false);
+	}
+}
+
+void
+finishOffloadingMultipartBody(Client *client, Request *req) {
+	MultipartOffloader *offloader = req->multipartOffloader;
+
+	if (offloader->hasError() || offloader->isIncomplete()) {
+		endOffloadingWithError(client, req);
+	} else {
+		SKC_TRACE(client, 2, "Offloaded " << offloader->getFiles().size() <<
+			" file(s); rewritten request body is " << offloader->getOutputSize() <<
+			" bytes");
+		finishBufferingBody(client, req);
+	}
+}
+
+void
+endOffloadingWithError(Client *client, Request *req) {
+	MultipartOffloader *offloader = req->multipartOffloader;
+
+	if (offloader->getIoErrcode() != 0) {
+		int errcode = offloader->getIoErrcode();
+		const unsigned int BUFSIZE = 1024;
+		char *message = (char *) psg_pnalloc(req->pool, BUFSIZE);
+		int size = snprintf(message, BUFSIZE,
+			"error writing uploaded file to disk: %s (errno=%d)",
+			strerror(errcode), errcode);
+		disconnectWithError(&client, StaticString(message, size));
+	} else {
+		const char *error = offloader->getParseError();
+		if (error == NULL) {
+			error = "body ended prematurely";
+		}
+		SKC_WARN(client, "Malformed multipart request body: " << error);
+		endAsBadRequest(&client, &req, "Malformed multipart request body");
+	}
+}
+
+static void
+onMultipartOffloaderOutput(MultipartOffloader *offloader, const MemoryKit::mbuf &buffer) {
+	Request *req = static_cast<Request *>(offloader->userData);
+	req->bodyBytesBuffered += buffer.size();
+	req->bodyBuffer.feed(buffer);
+}
+
+static void
+onMultipartOffloaderConsumed(MultipartOffloader *offloader, unsigned int size) {
+	Request *req = static_cast<Request *>(offloader->userData);
+	Client *client = static_cast<Client *>(req->client);
+	RequestHandler *self = static_cast<RequestHandler *>(
+		RequestHandler::getServerFromClient(client));
+	SKC_LOG_EVENT_FROM_STATIC(self, RequestHandler, client, "onMultipartOffloaderConsumed");
+
+	if (size > 0) {
+		if (offloader->hasError()) {
+			req->bodyChannel.consumed(0, true);
+			self->endOffloadingWithError(client, req);
+		} else {
+			req->bodyChannel.consumed(size, false);
+		}
+	} else {
+		// The end of the body has been reached.
+		req->bodyChannel.consumed(0, true);
+		if (!req->ended()) {
+			self->finishOffloadingMultipartBody(client, req);
+		}
+	}
+}
@@ -153,6 +153,20 @@ void
 initiateSession(Client *client, Request *req) {
 	TRACE_POINT();
 	req->sessionCheckoutTry++;
+	if (req->multipartOffloader != NULL) {
+		// The upload files are only readable by us, so the application
+		// cannot do anything with the request unless we hand them over.
+		const Process *process = req->session->getProcess();
+		if (!req->multipartOffloader->changeOwner(process->getUid(), process->getGid())) {
+			endRequestWithSimpleResponse(&client, &req,
+				"<h1>Internal Server Error</h1>"
+				"<p>The uploaded files could not be handed over to the application.</p>",
+				500);
+			return;
+		}
+	}
+
+	UPDATE_TRACE_POINT();
 	try {
 		req->session->initiate(false);
 	} catch (const SystemException &e2) {
@@ -213,6 +227,14 @@ reportSessionCheckoutError(Client *client, Request *req, const ExceptionPtr &e)
 			return;
 		}
 	}
+	{
+		boost::shared_ptr<RequestQueueTimeoutException> e2 =
+			dynamic_pointer_cast<RequestQueueTimeoutException>(e);
+		if (e2 != NULL) {
+			writeRequestQueueFullExceptionErrorResponse(client, req, e2);
+			return;
+		}
+	}
 	{
 		boost::shared_ptr<SpawnException> e2 = dynamic_pointer_cast<SpawnException>(e);
 		if (e2 != NULL) {
@@ -224,7 +246,7 @@ reportSessionCheckoutError(Client *client, Request *req, const ExceptionPtr &e)
 }
 
 void
-writeRequestQueueFullExceptionErrorResponse(Client *client, Request *req, const boost::shared_ptr<RequestQueueFullException> &e) {
+writeRequestQueueFullExceptionErrorResponse(Client *client, Request *req, const boost::shared_ptr<GetAbortedException> &e) {
 	TRACE_POINT();
 	const LString *value = req->secureHeaders.lookup("!~PASSENGER_REQUEST_QUEUE_OVERFLOW_STATUS_CODE");
 	int requestQueueOverflowStatusCode = 503;
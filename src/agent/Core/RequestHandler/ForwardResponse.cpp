@@ -44,6 +44,10 @@ onAppSourceData(Client *client, Request *req, const MemoryKit::mbuf &buffer, int
 	SKC_LOG_EVENT(RequestHandler, client, "onAppSourceData");
 	AppResponse *resp = &req->appResponse;
 
+	if (resp->begun() && req->appResponseTimer.isArmed()) {
+		armAppResponseTimer(client, req, appResponseBodyTimeout);
+	}
+
 	switch (resp->httpState) {
 	case AppResponse::PARSING_HEADERS:
 		if (buffer.size() > 0) {
@@ -349,6 +353,12 @@ onAppResponseBegin(Client *client, Request *req) {
 
 	prepareAppResponseCaching(client, req);
 
+	if (resp->hasBody() && !resp->upgraded()) {
+		armAppResponseTimer(client, req, appResponseBodyTimeout);
+	} else {
+		cancelAppResponseTimer(req);
+	}
+
 	if (OXT_UNLIKELY(oobw)) {
 		SKC_TRACE(client, 2, "Response with OOBW detected");
 		if (req->session != NULL) {
@@ -994,6 +1004,9 @@ outputBuffersFlushed(Client *client, Request *req) {
 		SKC_TRACE(client, 2, "Buffered response data has been written to disk. Resuming application socket");
 		client->output.setBuffersFlushedCallback(NULL);
 		req->appSource.start();
+		if (req->appResponseTimer.isArmed()) {
+			armAppResponseTimer(client, req, appResponseBodyTimeout);
+		}
 	}
 }
 
@@ -1018,7 +1031,58 @@ outputDataFlushed(Client *client, Request *req) {
 		SKC_TRACE(client, 2, "The client is ready to receive more data. Resuming application socket");
 		client->output.setDataFlushedCallback(getClientOutputDataFlushedCallback());
 		req->appSource.start();
+		if (req->appResponseTimer.isArmed()) {
+			armAppResponseTimer(client, req, appResponseBodyTimeout);
+		}
+	}
+}
+
+void
+armAppResponseTimer(Client *client, Request *req, unsigned int timeout) {
+	if (timeout == 0) {
+		cancelAppResponseTimer(req);
+	} else {
+		getContext()->timerWheel.arm(&req->appResponseTimer, timeout);
+	}
+}
+
+void
+cancelAppResponseTimer(Request *req) {
+	if (req->appResponseTimer.isArmed()) {
+		getContext()->timerWheel.cancel(&req->appResponseTimer);
+	}
+}
+
+static void
+_onAppResponseTimerExpired(ServerKit::TimerWheelEntry *entry) {
+	Request *req = static_cast<Request *>(static_cast<
+		ServerKit::BaseHttpRequest *>(entry->userData));
+	Client *client = static_cast<Client *>(req->client);
+	RequestHandler *self = static_cast<RequestHandler *>(getServerFromClient(client));
+	self->onAppResponseTimerExpired(client, req);
+}
+
+void
+onAppResponseTimerExpired(Client *client, Request *req) {
+	TRACE_POINT();
+	AppResponse *resp = &req->appResponse;
+
+	assert(!req->ended());
+	if (!resp->begun()) {
+		SKC_WARN(client, "Application did not send a response header within " <<
+			appResponseHeaderTimeout << " msec");
+		totalAppResponseHeaderTimeouts++;
+	} else if (!req->appSource.isStarted()) {
+		// We're throttling the application because the client
+		// is slow, which is not the application's fault.
+		armAppResponseTimer(client, req, appResponseBodyTimeout);
+		return;
+	} else {
+		SKC_WARN(client, "Application did not send response body data within " <<
+			appResponseBodyTimeout << " msec");
+		totalAppResponseBodyTimeouts++;
 	}
+	endRequestWithAppResponseTimeout(&client, &req);
 }
 
 void
@@ -66,6 +66,12 @@ onRequestObjectCreated(Client *client, Request *req) {
 	req->bodyBuffer.setContext(getContext());
 	req->bodyBuffer.setHooks(&req->hooks);
 	req->bodyBuffer.setDataCallback(onBodyBufferData);
+
+	req->appResponseTimer.callback = _onAppResponseTimerExpired;
+	req->appResponseTimer.userData = static_cast<ServerKit::BaseHttpRequest *>(req);
+
+	ev_io_init(&req->staticFileWatcher, _onStaticFileWritable, -1, EV_WRITE);
+	req->staticFileWatcher.data = static_cast<ServerKit::BaseHttpRequest *>(req);
 }
 
 virtual void deinitializeClient(Client *client) {
@@ -93,6 +99,9 @@ virtual void reinitializeRequest(Client *client, Request *req) {
 	req->hasPragmaHeader = false;
 	req->host = NULL;
 	req->bodyBytesBuffered = 0;
+	req->multipartOffloader = NULL;
+	req->staticFileEncoding = StaticFileCache::IDENTITY;
+	req->staticFileOffset = 0;
 	req->cacheKey = HashedStaticString();
 	req->cacheControl = NULL;
 	req->varyCookie = NULL;
@@ -108,8 +117,17 @@ virtual void reinitializeRequest(Client *client, Request *req) {
 }
 
 virtual void deinitializeRequest(Client *client, Request *req) {
+	cancelAppResponseTimer(req);
 	req->session.reset();
 
+	if (req->startedAt != 0) {
+		ev_tstamp duration = ev_now(getLoop()) - req->startedAt;
+		metrics.requestTimes.add((duration > 0)
+			? (unsigned long long) (duration * 1000000)
+			: 0);
+		metrics.requestBodyBytes.inc(req->bodyAlreadyRead);
+	}
+
 	req->endStopwatchLog(&req->stopwatchLogs.requestProxying, false);
 	req->endStopwatchLog(&req->stopwatchLogs.getFromPool, false);
 	req->endStopwatchLog(&req->stopwatchLogs.bufferingRequestBody, false);
@@ -121,6 +139,13 @@ virtual void deinitializeRequest(Client *client, Request *req) {
 	req->appSink.deinitialize();
 	req->appSource.deinitialize();
 	req->bodyBuffer.deinitialize();
+	if (req->multipartOffloader != NULL) {
+		req->multipartOffloader->destroy();
+		req->multipartOffloader = NULL;
+	}
+	if (req->staticFile != NULL) {
+		deinitializeStaticFileResponse(client, req);
+	}
 
 	/***************/
 	/***************/
@@ -164,6 +189,11 @@ void deinitializeAppResponse(Client *client, Request *req) {
 
 	req->appResponseInitialized = false;
 
+	metrics.appResponseBodyBytes.inc(resp->bodyAlreadyRead);
+	if (resp->statusCode >= 100 && resp->statusCode < 600) {
+		metrics.appResponses[resp->statusCode / 100 - 1].inc();
+	}
+
 	if (resp->httpState == AppResponse::PARSING_HEADERS
 	 && resp->parserState.headerParser != NULL)
 	{
@@ -216,6 +246,17 @@ shouldDisconnectClientOnShutdown(Client *client) {
 	return ParentClass::shouldDisconnectClientOnShutdown(client) || !gracefulExit;
 }
 
+virtual void
+onResponseTimeout(Client *client, Request *req) {
+	if (req->session != NULL && req->state >= Request::SENDING_HEADER_TO_APP) {
+		// The request was handed to the application, so treat this
+		// like an application response timeout.
+		endRequestWithAppResponseTimeout(&client, &req);
+	} else {
+		ParentClass::onResponseTimeout(client, req);
+	}
+}
+
 private:
 
 static Channel::Result
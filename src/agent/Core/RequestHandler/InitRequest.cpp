@@ -37,6 +37,7 @@ struct RequestAnalysis {
 virtual void
 onRequestBegin(Client *client, Request *req) {
 	ParentClass::onRequestBegin(client, req);
+	metrics.requests.inc();
 
 	RH_BENCHMARK_POINT(client, req, BM_AFTER_ACCEPT);
 
@@ -69,6 +70,9 @@ onRequestBegin(Client *client, Request *req) {
 		if (req->ended()) {
 			return;
 		}
+		if (staticFileCache != NULL && serveStaticFile(client, req)) {
+			return;
+		}
 		initializeUnionStation(client, req, analysis);
 		if (req->ended()) {
 			return;
@@ -76,6 +80,10 @@ onRequestBegin(Client *client, Request *req) {
 		setStickySessionId(client, req);
 	}
 
+	if (offloadMultipartUploads && req->hasBody()) {
+		// Turns on request body buffering for multipart/form-data bodies.
+		initializeMultipartOffloading(client, req);
+	}
 	if (!req->hasBody() || !req->requestBodyBuffering) {
 		req->requestBodyBuffering = false;
 		checkoutSession(client, req);
@@ -150,7 +158,9 @@ respondFromTurboCache(Client *client, Request *req) {
 	if (turboCaching.responseCache.requestAllowsFetching(req)) {
 		ResponseCache<Request>::Entry entry(turboCaching.responseCache.fetch(req,
 			ev_now(getLoop())));
+		metrics.turbocacheFetches.inc();
 		if (entry.valid()) {
+			metrics.turbocacheHits.inc();
 			SKC_TRACE(client, 2, "Turbocaching: cache hit (key \"" <<
 				cEscapeString(req->cacheKey) << "\")");
 			turboCaching.writeResponse(this, client, req, entry);
@@ -203,6 +213,27 @@ initializePoolOptions(Client *client, Request *req, RequestAnalysis &analysis) {
 	if (!req->ended()) {
 		fillPoolOption(req, req->options.environmentVariables, PASSENGER_ENV_VARS);
 		fillPoolOption(req, req->options.maxRequests, PASSENGER_MAX_REQUESTS);
+		applyRequestQueueTimeoutHeader(req);
+	}
+}
+
+/**
+ * Allows the client, or a load balancer in front of us, to lower the maximum
+ * time that this request may spend in the request queue through the
+ * X-Request-Queue-Timeout header (in milliseconds). The header can only lower
+ * the configured limit, not raise it.
+ */
+void
+applyRequestQueueTimeoutHeader(Request *req) {
+	const LString *value = req->headers.lookup(HTTP_X_REQUEST_QUEUE_TIMEOUT);
+	if (value != NULL && value->size > 0) {
+		value = psg_lstr_make_contiguous(value, req->pool);
+		unsigned int timeout = stringToUint(StaticString(value->start->data, value->size));
+		if (timeout > 0 && (req->options.maxRequestQueueTime == 0
+			|| timeout < req->options.maxRequestQueueTime))
+		{
+			req->options.maxRequestQueueTime = timeout;
+		}
 	}
 }
 
@@ -237,6 +268,20 @@ fillPoolOptionsFromAgentsOptions(Options &options) {
 	options.spawnMethod = agentsOptions->get("spawn_method");
 	options.loadShellEnvvars = agentsOptions->getBool("load_shell_envvars");
 	options.statThrottleRate = statThrottleRate;
+	options.maxRequestQueueTime = agentsOptions->getInt("max_request_queue_time") * 1000;
+	options.requestQueueTarget = agentsOptions->getInt("request_queue_target");
+	options.requestQueueInterval = agentsOptions->getInt("request_queue_interval");
+	options.requestQueueAdaptiveLifo = agentsOptions->getBool("request_queue_adaptive_lifo");
+	options.warmupTime = agentsOptions->getInt("warmup_time");
+	options.standbyProcesses = agentsOptions->getInt("standby_processes");
+	options.memoryLimit = agentsOptions->getInt("memory_limit");
+	if (agentsOptions->has("warmup_urls")) {
+		options.warmupUrls = agentsOptions->get("warmup_urls");
+	}
+	options.stickySessionsFallback = agentsOptions->getBool("sticky_sessions_fallback");
+	options.rollingRestart = agentsOptions->getBool("rolling_restarts");
+	options.rollingRestartBatchSize = std::max(1,
+		agentsOptions->getInt("rolling_restart_batch_size"));
 
 	/******************************/
 }
@@ -370,11 +415,13 @@ createNewPoolOptions(Client *client, Request *req, const HashedStaticString &app
 	fillPoolOption(req, options.group, "!~PASSENGER_GROUP");
 	fillPoolOption(req, options.minProcesses, "!~PASSENGER_MIN_PROCESSES");
 	fillPoolOption(req, options.maxProcesses, "!~PASSENGER_MAX_PROCESSES");
+	fillPoolOption(req, options.capacityWeight, "!~PASSENGER_CAPACITY_WEIGHT");
 	fillPoolOption(req, options.spawnMethod, "!~PASSENGER_SPAWN_METHOD");
 	fillPoolOption(req, options.startCommand, "!~PASSENGER_START_COMMAND");
 	fillPoolOptionSecToMsec(req, options.startTimeout, "!~PASSENGER_START_TIMEOUT");
 	fillPoolOption(req, options.maxPreloaderIdleTime, "!~PASSENGER_MAX_PRELOADER_IDLE_TIME");
 	fillPoolOption(req, options.maxRequestQueueSize, "!~PASSENGER_MAX_REQUEST_QUEUE_SIZE");
+	fillPoolOptionSecToMsec(req, options.maxRequestQueueTime, "!~PASSENGER_MAX_REQUEST_QUEUE_TIME");
 	fillPoolOption(req, options.restartDir, "!~PASSENGER_RESTART_DIR");
 	fillPoolOption(req, options.startupFile, "!~PASSENGER_STARTUP_FILE");
 	fillPoolOption(req, options.loadShellEnvvars, "!~PASSENGER_LOAD_SHELL_ENVVARS");
@@ -0,0 +1,703 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2015 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_MULTIPART_OFFLOADER_H_
+#define _PASSENGER_MULTIPART_OFFLOADER_H_
+
+#include <boost/cstdint.hpp>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <deque>
+#include <uv.h>
+#include <jsoncpp/json.h>
+#include <Logging.h>
+#include <StaticString.h>
+#include <RandomGenerator.h>
+#include <MemoryKit/mbuf.h>
+#include <ServerKit/Context.h>
+#include <ServerKit/MultipartParser.h>
+#include <Utils/StrIntUtils.h>
+#include <Utils/JsonUtils.h>
+
+namespace Passenger {
+
+using namespace std;
+
+
+/**
+ * Rewrites a multipart/form-data request body while it is being received:
+ * the contents of file parts are written to temporary files, and every file
+ * part is replaced by four small fields that describe the file. For a part
+ * named `avatar` these are:
+ *
+ *  - `avatar[filename]` -- the file name supplied by the client.
+ *  - `avatar[content_type]` -- the part's Content-Type, if any.
+ *  - `avatar[path]` -- the path of the temporary file.
+ *  - `avatar[size]` -- the file size in bytes.
+ *
+ * All other parts are passed through unchanged, except for parts that the
+ * application would read as one of these fields (taking Rack's lenient
+ * parsing of brackets into account): those are dropped, so that a client cannot
+ * forge the description of an offloaded file (e.g. by sending a plain
+ * `avatar[path]` field) and trick the application into reading or moving
+ * arbitrary files. The rewritten body is passed
+ * to `outputCallback`, so that the application only has to parse a small
+ * body instead of the whole upload. The temporary files are deleted when the
+ * offloader is destroyed, so the application must move or copy them before
+ * it finishes its response. They have unpredictable names and are only
+ * readable by their owner; call `changeOwner()` to hand them over to the
+ * user that the application runs as.
+ *
+ * File I/O is performed asynchronously through libuv, one operation at a
+ * time. Like a Channel data callback, `feed()` returns -1 if the buffer
+ * cannot be considered consumed until the file I/O that it caused has
+ * finished; `consumedCallback` is called at that point.
+ */
+class MultipartOffloader {
+public:
+	typedef void (*OutputCallback)(MultipartOffloader *offloader, const MemoryKit::mbuf &buffer);
+	typedef void (*ConsumedCallback)(MultipartOffloader *offloader, unsigned int size);
+
+	struct File {
+		string fieldName;
+		string filename;
+		string contentType;
+		string path;
+		boost::uint64_t size;
+		int fd;
+
+		File()
+			: size(0),
+			  fd(-1)
+			{ }
+	};
+
+private:
+	struct Operation {
+		enum Type {
+			OPEN,
+			WRITE,
+			CLOSE
+		};
+
+		Type type;
+		unsigned int fileIndex;
+		MemoryKit::mbuf buffer;
+		boost::uint64_t offset;
+
+		Operation(Type _type, unsigned int _fileIndex)
+			: type(_type),
+			  fileIndex(_fileIndex),
+			  offset(0)
+			{ }
+	};
+
+	ServerKit::Context *ctx;
+	ServerKit::MultipartParser parser;
+	string boundary;
+	string dir;
+	RandomGenerator *randomGenerator;
+	vector<File> files;
+	deque<Operation> operations;
+	string pendingOutput;
+	const MemoryKit::mbuf *currentInput;
+	boost::uint64_t outputSize;
+	boost::uint64_t bytesOffloaded;
+	uv_fs_t fsReq;
+	uv_buf_t uvBuffer;
+	unsigned int pendingInputSize;
+	int ioErrcode;
+
+	bool inFilePart: 1;
+	bool inStrippedPart: 1;
+	bool closingDelimiterWritten: 1;
+	bool ioInProgress: 1;
+	bool waitingForIo: 1;
+	bool destroyRequested: 1;
+
+
+	/***** Output *****/
+
+	/**
+	 * Returns an mbuf containing the given data. Data inside the buffer that
+	 * is currently being fed is referenced, anything else is copied.
+	 */
+	MemoryKit::mbuf makeBuffer(const char *data, size_t size) {
+		if (currentInput != NULL
+		 && data >= currentInput->start
+		 && data + size <= currentInput->end)
+		{
+			return MemoryKit::mbuf(*currentInput, data - currentInput->start, size);
+		} else {
+			MemoryKit::mbuf buffer(MemoryKit::mbuf_get(&ctx->mbuf_pool));
+			assert(size <= buffer.size());
+			memcpy(buffer.start, data, size);
+			return MemoryKit::mbuf(buffer, 0, size);
+		}
+	}
+
+	void flushPendingOutput() {
+		const char *data = pendingOutput.data();
+		size_t size = pendingOutput.size();
+		unsigned int blockSize = MemoryKit::mbuf_pool_data_size(&ctx->mbuf_pool);
+
+		while (size > 0) {
+			size_t n = std::min<size_t>(size, blockSize);
+			output(makeBuffer(data, n));
+			data += n;
+			size -= n;
+		}
+		pendingOutput.clear();
+	}
+
+	void output(const MemoryKit::mbuf &buffer) {
+		outputSize += buffer.size();
+		if (outputCallback != NULL) {
+			outputCallback(this, buffer);
+		}
+	}
+
+	static void appendQuoted(string &output, const StaticString &value) {
+		output.append(1, '"');
+		for (string::size_type i = 0; i < value.size(); i++) {
+			if (value[i] == '"' || value[i] == '\\') {
+				output.append(1, '\\');
+			}
+			output.append(1, value[i]);
+		}
+		output.append(1, '"');
+	}
+
+	void appendDelimiter() {
+		pendingOutput.append("--");
+		pendingOutput.append(boundary);
+		pendingOutput.append("\r\n");
+	}
+
+	void appendField(const File &file, const StaticString &suffix, const StaticString &value) {
+		appendDelimiter();
+		pendingOutput.append("Content-Disposition: form-data; name=");
+		appendQuoted(pendingOutput, file.fieldName + suffix);
+		pendingOutput.append("\r\n\r\n");
+		pendingOutput.append(value.data(), value.size());
+		pendingOutput.append("\r\n");
+	}
+
+	/**
+	 * Whether the application would read the given field name as a key that
+	 * `onPartEnd()` uses to describe an offloaded file, e.g. `avatar[path]`.
+	 *
+	 * The name is split into keys the way Rack's `normalize_params` does,
+	 * because Rack is lenient about brackets: `avatar[path`, `avatar[path]]`
+	 * and `avatar]path` all end up in `params["avatar"]["path"]`.
+	 */
+	static bool isGeneratedFieldName(const StaticString &name) {
+		static const StaticString reservedKeys[] = {
+			P_STATIC_STRING("filename"),
+			P_STATIC_STRING("content_type"),
+			P_STATIC_STRING("path"),
+			P_STATIC_STRING("size")
+		};
+		const char *pos = name.data();
+		const char *end = name.data() + name.size();
+		StaticString key;
+		unsigned int depth = 0;
+
+		while (true) {
+			const char *nameStart = pos;
+
+			// Equivalent to Rack's /\A[\[\]]*([^\[\]]+)\]*/
+			while (pos < end && (*pos == '[' || *pos == ']')) {
+				pos++;
+			}
+			const char *keyStart = pos;
+			while (pos < end && *pos != '[' && *pos != ']') {
+				pos++;
+			}
+			if (pos == keyStart) {
+				return false;
+			}
+			key = StaticString(keyStart, pos - keyStart);
+			depth++;
+			while (pos < end && *pos == ']') {
+				pos++;
+			}
+
+			StaticString after(pos, end - pos);
+			if (after.empty()) {
+				break;
+			} else if (after == P_STATIC_STRING("[")) {
+				// Rack stores the value under the entire remaining name.
+				key = StaticString(nameStart, end - nameStart);
+				break;
+			} else if (after == P_STATIC_STRING("[]")) {
+				// The value becomes an array element.
+				return false;
+			} else if (after.size() > 2 && after[0] == '[' && after[1] == ']') {
+				// The value becomes part of a hash inside an array.
+				pos += 2;
+			}
+		}
+
+		if (depth < 2) {
+			return false;
+		}
+		for (unsigned int i = 0; i < sizeof(reservedKeys) / sizeof(StaticString); i++) {
+			if (key == reservedKeys[i]) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/**
+	 * Whether a part has more than one Content-Disposition header, or more
+	 * than one `name` or `filename` parameter in it. We and the application
+	 * could disagree about which of them counts.
+	 */
+	static bool isAmbiguousDisposition(const StaticString &headers, const StaticString &disposition) {
+		return ServerKit::MultipartParser::countHeaders(headers,
+				P_STATIC_STRING("content-disposition")) > 1
+			|| ServerKit::MultipartParser::countHeaderParameters(disposition,
+				P_STATIC_STRING("name")) > 1
+			|| ServerKit::MultipartParser::countHeaderParameters(disposition,
+				P_STATIC_STRING("filename")) > 1;
+	}
+
+	/***** Parser callbacks *****/
+
+	static void onPartBegin(ServerKit::MultipartParser *parser, const StaticString &headers) {
+		MultipartOffloader *self = static_cast<MultipartOffloader *>(parser->userData);
+		StaticString disposition = ServerKit::MultipartParser::getHeader(headers,
+			P_STATIC_STRING("content-disposition"));
+		File file;
+		string name;
+
+		self->inFilePart = false;
+		self->inStrippedPart = false;
+		if (isAmbiguousDisposition(headers, disposition)) {
+			// Rack uses the last `name` where we would use the first one,
+			// which would let the part slip past the checks below.
+			P_WARN("[MultipartOffloader " << (void *) self << "] Dropping part with "
+				"an ambiguous Content-Disposition header: \""
+				<< cEscapeString(disposition) << "\"");
+			self->inStrippedPart = true;
+		} else if (ServerKit::MultipartParser::getHeaderParameter(disposition,
+				P_STATIC_STRING("filename"), file.filename)
+		 && !file.filename.empty()
+		 && ServerKit::MultipartParser::getHeaderParameter(disposition,
+				P_STATIC_STRING("name"), file.fieldName))
+		{
+			StaticString contentType = ServerKit::MultipartParser::getHeader(headers,
+				P_STATIC_STRING("content-type"));
+			file.contentType.assign(contentType.data(), contentType.size());
+			file.path = self->createTempFilePath();
+			P_TRACE(3, "[MultipartOffloader " << (void *) self << "] Offloading \""
+				<< file.filename << "\" to " << file.path);
+			self->files.push_back(file);
+			self->inFilePart = true;
+			self->queue(Operation(Operation::OPEN, self->files.size() - 1));
+		} else if (ServerKit::MultipartParser::getHeaderParameter(disposition,
+				P_STATIC_STRING("name"), name)
+		 && isGeneratedFieldName(name))
+		{
+			P_DEBUG("[MultipartOffloader " << (void *) self << "] Dropping client-supplied field \""
+				<< cEscapeString(name) << "\" because its name is reserved for offloaded files");
+			self->inStrippedPart = true;
+		} else {
+			self->appendDelimiter();
+			if (!headers.empty()) {
+				self->pendingOutput.append(headers.data(), headers.size());
+				self->pendingOutput.append("\r\n");
+			}
+			self->pendingOutput.append("\r\n");
+		}
+	}
+
+	static void onPartData(ServerKit::MultipartParser *parser, const char *data, size_t size) {
+		MultipartOffloader *self = static_cast<MultipartOffloader *>(parser->userData);
+
+		if (self->inFilePart) {
+			File &file = self->files.back();
+			Operation op(Operation::WRITE, self->files.size() - 1);
+			op.buffer = self->makeBuffer(data, size);
+			op.offset = file.size;
+			file.size += size;
+			self->bytesOffloaded += size;
+			self->queue(op);
+		} else if (!self->inStrippedPart) {
+			self->flushPendingOutput();
+			self->output(self->makeBuffer(data, size));
+		}
+	}
+
+	static void onPartEnd(ServerKit::MultipartParser *parser) {
+		MultipartOffloader *self = static_cast<MultipartOffloader *>(parser->userData);
+
+		if (self->inFilePart) {
+			const File &file = self->files.back();
+			self->queue(Operation(Operation::CLOSE, self->files.size() - 1));
+			self->appendField(file, P_STATIC_STRING("[filename]"), file.filename);
+			self->appendField(file, P_STATIC_STRING("[content_type]"), file.contentType);
+			self->appendField(file, P_STATIC_STRING("[path]"), file.path);
+			self->appendField(file, P_STATIC_STRING("[size]"), toString(file.size));
+			self->inFilePart = false;
+		} else if (self->inStrippedPart) {
+			self->inStrippedPart = false;
+		} else {
+			self->pendingOutput.append("\r\n");
+		}
+	}
+
+
+	/***** File I/O *****/
+
+	string createTempFilePath() const {
+		string path = dir;
+		path.append("/passenger-upload.");
+		path.append(randomGenerator->generateAsciiString(24));
+		return path;
+	}
+
+	void queue(const Operation &op) {
+		if (ioErrcode == 0) {
+			operations.push_back(op);
+		}
+	}
+
+	void startNextOperation() {
+		assert(!ioInProgress);
+		if (operations.empty() || ioErrcode != 0) {
+			return;
+		}
+
+		Operation &op = operations.front();
+		File &file = files[op.fileIndex];
+		int result;
+
+		fsReq.data = this;
+		switch (op.type) {
+		case Operation::OPEN:
+			result = uv_fs_open(ctx->libuv, &fsReq, file.path.c_str(),
+				O_WRONLY | O_CREAT | O_EXCL,
+				0600, onOperationDone);
+			break;
+		case Operation::WRITE:
+			uvBuffer.base = op.buffer.start;
+			uvBuffer.len = op.buffer.size();
+			result = uv_fs_write(ctx->libuv, &fsReq, file.fd, &uvBuffer, 1,
+				op.offset, onOperationDone);
+			break;
+		case Operation::CLOSE:
+			result = uv_fs_close(ctx->libuv, &fsReq, file.fd, onOperationDone);
+			break;
+		default:
+			P_BUG("Unknown operation type " << (int) op.type);
+			return;
+		}
+
+		if (result == 0) {
+			ioInProgress = true;
+		} else {
+			setIoError(-result);
+		}
+	}
+
+	static void onOperationDone(uv_fs_t *req) {
+		MultipartOffloader *self = static_cast<MultipartOffloader *>(req->data);
+		ssize_t result = req->result;
+
+		uv_fs_req_cleanup(req);
+		self->ioInProgress = false;
+		if (self->destroyRequested) {
+			if (self->operations.front().type == Operation::OPEN && result >= 0) {
+				self->files[self->operations.front().fileIndex].fd = result;
+			}
+			self->cleanup();
+			return;
+		}
+		self->operationDone(result);
+	}
+
+	void operationDone(ssize_t result) {
+		Operation &op = operations.front();
+		File &file = files[op.fileIndex];
+
+		if (result < 0) {
+			if (op.type == Operation::OPEN && result == UV_EEXIST) {
+				// Try again with a different name.
+				file.path = createTempFilePath();
+			} else {
+				if (op.type == Operation::CLOSE) {
+					file.fd = -1;
+				}
+				setIoError(-result);
+				return;
+			}
+		} else {
+			switch (op.type) {
+			case Operation::OPEN:
+				file.fd = result;
+				P_LOG_FILE_DESCRIPTOR_OPEN4(file.fd, __FILE__, __LINE__,
+					"MultipartOffloader upload file");
+				operations.pop_front();
+				break;
+			case Operation::WRITE:
+				op.buffer = MemoryKit::mbuf(op.buffer, result);
+				op.offset += result;
+				if (op.buffer.empty()) {
+					operations.pop_front();
+				}
+				break;
+			case Operation::CLOSE:
+				P_LOG_FILE_DESCRIPTOR_CLOSE(file.fd);
+				file.fd = -1;
+				operations.pop_front();
+				break;
+			}
+		}
+
+		startNextOperation();
+		if (!ioInProgress) {
+			ioFinished();
+		}
+	}
+
+	void setIoError(int errcode) {
+		P_DEBUG("[MultipartOffloader " << (void *) this << "] Cannot offload upload: "
+			<< strerror(errcode) << " (errno=" << errcode << ")");
+		ioErrcode = errcode;
+		operations.clear();
+		ioFinished();
+	}
+
+	void ioFinished() {
+		if (waitingForIo && operations.empty()) {
+			waitingForIo = false;
+			if (consumedCallback != NULL) {
+				consumedCallback(this, pendingInputSize);
+			}
+		}
+	}
+
+	int afterFeeding(unsigned int size) {
+		if (!ioInProgress) {
+			startNextOperation();
+		}
+		if (operations.empty()) {
+			return size;
+		} else {
+			waitingForIo = true;
+			pendingInputSize = size;
+			return -1;
+		}
+	}
+
+	static void fileDeleted(uv_fs_t *req) {
+		uv_fs_req_cleanup(req);
+		free(req);
+	}
+
+	/**
+	 * Closes and deletes the files in the background. Must only be called
+	 * when no I/O operation is in progress.
+	 */
+	void cleanup() {
+		for (unsigned int i = 0; i < files.size(); i++) {
+			File &file = files[i];
+
+			if (file.fd != -1) {
+				P_LOG_FILE_DESCRIPTOR_CLOSE(file.fd);
+				::close(file.fd);
+				file.fd = -1;
+			}
+
+			uv_fs_t *req = (uv_fs_t *) malloc(sizeof(uv_fs_t));
+			if (req == NULL) {
+				P_ERROR("Cannot delete " << file.path <<
+					": cannot allocate memory for necessary temporary data structure");
+				continue;
+			}
+			int result = uv_fs_unlink(ctx->libuv, req, file.path.c_str(), fileDeleted);
+			if (result != 0) {
+				P_ERROR("Cannot delete " << file.path << ": cannot initiate I/O operation: "
+					<< uv_strerror(result) << " (errno=" << -result << ")");
+				free(req);
+			}
+		}
+		delete this;
+	}
+
+	~MultipartOffloader() { }
+
+public:
+	OutputCallback outputCallback;
+	ConsumedCallback consumedCallback;
+	void *userData;
+
+	MultipartOffloader(ServerKit::Context *context, const StaticString &_boundary,
+		const StaticString &_dir, RandomGenerator *_randomGenerator)
+		: ctx(context),
+		  parser(_boundary),
+		  boundary(_boundary.data(), _boundary.size()),
+		  dir(_dir.data(), _dir.size()),
+		  randomGenerator(_randomGenerator),
+		  currentInput(NULL),
+		  outputSize(0),
+		  bytesOffloaded(0),
+		  pendingInputSize(0),
+		  ioErrcode(0),
+		  inFilePart(false),
+		  inStrippedPart(false),
+		  closingDelimiterWritten(false),
+		  ioInProgress(false),
+		  waitingForIo(false),
+		  destroyRequested(false),
+		  outputCallback(NULL),
+		  consumedCallback(NULL),
+		  userData(NULL)
+	{
+		parser.onPartBegin = onPartBegin;
+		parser.onPartData = onPartData;
+		parser.onPartEnd = onPartEnd;
+		parser.userData = this;
+	}
+
+	/**
+	 * Deletes the offloader and the files that it created. If an I/O
+	 * operation is in progress, this happens when it has finished.
+	 * No callbacks are called anymore after this.
+	 */
+	void destroy() {
+		destroyRequested = true;
+		if (!ioInProgress) {
+			cleanup();
+		}
+	}
+
+	/**
+	 * Parses the given part of the body. Returns `buffer.size()` if it has
+	 * been fully processed, or -1 if `consumedCallback` will be called once
+	 * the file I/O for it has finished. Check `hasError()` afterwards.
+	 */
+	int feed(const MemoryKit::mbuf &buffer) {
+		assert(!waitingForIo);
+		currentInput = &buffer;
+		parser.feed(buffer.start, buffer.size());
+		currentInput = NULL;
+
+		if (parser.isDone() && !closingDelimiterWritten) {
+			closingDelimiterWritten = true;
+			pendingOutput.append("--");
+			pendingOutput.append(boundary);
+			pendingOutput.append("--\r\n");
+		}
+		flushPendingOutput();
+		return afterFeeding(buffer.size());
+	}
+
+	/**
+	 * Must be called at the end of the body. Returns 0 if all files have
+	 * been written, or -1 if `consumedCallback` will be called (with size 0)
+	 * when that has happened. Check `hasError()` afterwards; it is an error
+	 * if the closing delimiter hasn't been seen.
+	 */
+	int finish() {
+		assert(!waitingForIo);
+		return afterFeeding(0);
+	}
+
+	/**
+	 * Hands the files over to the given user and group, so that an
+	 * application that runs as another user can read them. Only has an
+	 * effect if we're running as root. Must be called after `finish()` has
+	 * completed. Returns false if a file could not be handed over.
+	 */
+	bool changeOwner(uid_t uid, gid_t gid) {
+		if (geteuid() != 0 || uid == (uid_t) -1 || uid == 0) {
+			return true;
+		}
+		for (unsigned int i = 0; i < files.size(); i++) {
+			if (::chown(files[i].path.c_str(), uid, gid) == -1) {
+				int e = errno;
+				P_WARN("Cannot change the owner of " << files[i].path << " to UID "
+					<< uid << ": " << strerror(e) << " (errno=" << e << ")");
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool hasError() const {
+		return parser.hasError() || ioErrcode != 0;
+	}
+
+	/** Whether the body ended before the closing delimiter. */
+	bool isIncomplete() const {
+		return !parser.isDone();
+	}
+
+	/** Returns the parse error, or NULL. */
+	const char *getParseError() const {
+		return parser.getErrorMessage();
+	}
+
+	/** Returns the errno of the file I/O error that occurred, or 0. */
+	int getIoErrcode() const {
+		return ioErrcode;
+	}
+
+	/** The size of the rewritten body produced so far. */
+	boost::uint64_t getOutputSize() const {
+		return outputSize;
+	}
+
+	const vector<File> &getFiles() const {
+		return files;
+	}
+
+	Json::Value inspectStateAsJson() const {
+		Json::Value doc;
+		doc["files"] = (Json::UInt) files.size();
+		doc["bytes_offloaded"] = byteSizeToJson(bytesOffloaded);
+		doc["output_size"] = byteSizeToJson(outputSize);
+		doc["pending_io_operations"] = (Json::UInt) operations.size();
+		if (ioErrcode != 0) {
+			doc["io_error"] = strerror(ioErrcode);
+		}
+		return doc;
+	}
+};
+
+
+} // namespace Passenger
+
+#endif /* _PASSENGER_MULTIPART_OFFLOADER_H_ */
@@ -33,12 +33,15 @@
 #include <ServerKit/HttpRequest.h>
 #include <ServerKit/FdSinkChannel.h>
 #include <ServerKit/FdSourceChannel.h>
+#include <ServerKit/TimerWheel.h>
 #include <Logging.h>
 #include <Core/ApplicationPool/Pool.h>
 #include <Core/UnionStation/Core.h>
 #include <Core/UnionStation/Transaction.h>
 #include <Core/UnionStation/StopwatchLog.h>
 #include <Core/RequestHandler/AppResponse.h>
+#include <Core/RequestHandler/MultipartOffloader.h>
+#include <Core/RequestHandler/StaticFileCache.h>
 
 namespace Passenger {
 
@@ -80,9 +83,23 @@ public:
 	ServerKit::FdSinkChannel appSink;
 	ServerKit::FdSourceChannel appSource;
 	AppResponse appResponse;
+	// Guards the time until the app sends the response header, and
+	// after that the time between two pieces of response body data.
+	ServerKit::TimerWheelEntry appResponseTimer;
 
 	ServerKit::FileBufferedChannel bodyBuffer;
 	boost::uint64_t bodyBytesBuffered; // After dechunking
+	// Non-NULL if file uploads in a multipart body are written to disk
+	// while buffering. See BufferBody.cpp.
+	MultipartOffloader *multipartOffloader;
+
+	// Non-NULL while a file from the application's public directory is
+	// being sent. See StaticFiles.cpp.
+	StaticFileCache::EntryPtr staticFile;
+	StaticFileCache::Encoding staticFileEncoding;
+	off_t staticFileOffset;
+	// Waits until the client socket is writable while sending staticFile.
+	struct ev_io staticFileWatcher;
 
 	struct {
 		UnionStation::StopwatchLog *requestProcessing;
@@ -104,7 +121,8 @@ public:
 
 
 	Request()
-		: BaseHttpRequest()
+		: BaseHttpRequest(),
+		  multipartOffloader(NULL)
 	{
 		memset(&stopwatchLogs, 0, sizeof(stopwatchLogs));
 	}
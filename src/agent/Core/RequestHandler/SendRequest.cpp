@@ -34,6 +34,7 @@ sendHeaderToApp(Client *client, Request *req) {
 	SKC_TRACE(client, 2, "Sending headers to application with " <<
 		req->session->getProtocol() << " protocol");
 	req->state = Request::SENDING_HEADER_TO_APP;
+	armAppResponseTimer(client, req, appResponseHeaderTimeout);
 
 	/**
 	 * HTTP does not formally support half-closing, and Node.js treats a
@@ -880,6 +881,11 @@ whenSendingRequest_onRequestBody(Client *client, Request *req,
 				cEscapeString(StaticString(buffer.start, buffer.size())) <<
 				"\"");
 		}
+		if (!req->appResponse.begun() && req->appResponseTimer.isArmed()) {
+			// The app can't be expected to respond while the
+			// client is still sending the body.
+			armAppResponseTimer(client, req, appResponseHeaderTimeout);
+		}
 		req->appSink.feed(buffer);
 		if (!req->appSink.acceptingInput()) {
 			if (req->appSink.mayAcceptInputLater()) {
@@ -0,0 +1,764 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2015 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_STATIC_FILE_CACHE_H_
+#define _PASSENGER_STATIC_FILE_CACHE_H_
+
+#include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <oxt/system_calls.hpp>
+#include <ev++.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cctype>
+#include <cerrno>
+#include <cassert>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <list>
+#include <jsoncpp/json.h>
+#include <StaticString.h>
+#include <Utils.h>
+#include <Utils/FileWatcher.h>
+
+namespace Passenger {
+
+using namespace std;
+
+
+/**
+ * Caches open file descriptors and metadata of the files in applications'
+ * `public` directories, so that the RequestHandler can serve them without
+ * involving application processes (see StaticFiles.cpp). A lookup of a
+ * cached file performs no system calls.
+ *
+ * Every entry caches a file descriptor for the file itself and for its
+ * precompressed `.gz` and `.br` siblings, if they exist and are not older
+ * than the file. Entries are invalidated as soon as the FileWatcher notices
+ * that one of these files changed. Independently of that, every entry is
+ * checked with stat() once it is `revalidateInterval` seconds old; this also
+ * catches changes that the FileWatcher cannot see, such as a deployment that
+ * swaps the application directory symlink. Entries for files that don't exist
+ * are cached too, but only rely on the latter mechanism.
+ *
+ * The least recently used entries are evicted when there are more than
+ * `maxEntries` entries. Entries for files that don't exist have their own
+ * LRU list and limit (`maxNegativeEntries`): every request for a dynamic URL
+ * adds two of them (for `path` and `path.html`), and they must not push the
+ * actual files out of the cache. Entries are reference counted, so an
+ * evicted entry's file descriptors stay open for as long as a request is
+ * still sending it.
+ *
+ * This class is not thread-safe: every RequestHandler has its own instance.
+ */
+class StaticFileCache: public boost::noncopyable {
+public:
+	enum Encoding {
+		IDENTITY,
+		GZIP,
+		BROTLI,
+
+		ENCODING_COUNT
+	};
+
+	struct Variant {
+		/** -1 if this variant does not exist. */
+		int fd;
+		off_t size;
+		/** Including the quotes. */
+		string etag;
+
+		Variant()
+			: fd(-1),
+			  size(0)
+			{ }
+	};
+
+	struct Entry: public boost::noncopyable {
+		string filename;
+		bool exists;
+		dev_t dev;
+		ino_t ino;
+		time_t mtime;
+		Variant variants[ENCODING_COUNT];
+		string lastModified;
+		StaticString contentType;
+		ev_tstamp validatedAt;
+		/** Set by the FileWatcher thread. */
+		boost::shared_ptr< boost::atomic<bool> > stale;
+		/** 0 if the files are not being watched. */
+		FileWatcher::WatchId watchId;
+
+		Entry()
+			: exists(false),
+			  dev(0),
+			  ino(0),
+			  mtime(0),
+			  validatedAt(0),
+			  stale(boost::make_shared< boost::atomic<bool> >(false)),
+			  watchId(0)
+			{ }
+
+		~Entry() {
+			for (unsigned int i = 0; i < ENCODING_COUNT; i++) {
+				if (variants[i].fd != -1) {
+					boost::this_thread::disable_syscall_interruption dsi;
+					oxt::syscalls::close(variants[i].fd);
+				}
+			}
+		}
+
+		bool hasPrecompressedVariants() const {
+			return variants[GZIP].fd != -1 || variants[BROTLI].fd != -1;
+		}
+
+		/**
+		 * Returns the smallest variant that the client accepts according
+		 * to its Accept-Encoding header.
+		 */
+		Encoding selectEncoding(const StaticString &acceptEncoding) const {
+			if (variants[BROTLI].fd != -1
+			 && acceptsEncoding(acceptEncoding, P_STATIC_STRING("br")))
+			{
+				return BROTLI;
+			} else if (variants[GZIP].fd != -1
+			 && acceptsEncoding(acceptEncoding, P_STATIC_STRING("gzip")))
+			{
+				return GZIP;
+			} else {
+				return IDENTITY;
+			}
+		}
+	};
+
+	typedef boost::shared_ptr<Entry> EntryPtr;
+
+private:
+	typedef list<EntryPtr> EntryList;
+	typedef boost::unordered_map<string, EntryList::iterator> EntryMap;
+
+	/** Most recently used first. Entries for files that don't exist are in `negativeLru`. */
+	EntryList lru, negativeLru;
+	EntryMap entries;
+	unsigned int maxEntries, maxNegativeEntries;
+	unsigned int negativeEntryCount;
+	unsigned int revalidateInterval;
+	FileWatcher *watcher;
+	unsigned long long lookups, hits;
+	// Reused between lookups to avoid memory allocations.
+	string path, filename;
+
+	static void onFileChanged(boost::shared_ptr< boost::atomic<bool> > stale,
+		const string &dir, const string &name, bool exists)
+	{
+		stale->store(true, boost::memory_order_relaxed);
+	}
+
+	static bool equalsIgnoreCase(const char *data, size_t size, const StaticString &str) {
+		if (size != str.size()) {
+			return false;
+		}
+		for (size_t i = 0; i < size; i++) {
+			if (tolower((unsigned char) data[i]) != str[i]) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	static bool isWhitespace(char ch) {
+		return ch == ' ' || ch == '\t';
+	}
+
+	static int parseHexDigit(char ch) {
+		if (ch >= '0' && ch <= '9') {
+			return ch - '0';
+		} else if (ch >= 'a' && ch <= 'f') {
+			return ch - 'a' + 10;
+		} else if (ch >= 'A' && ch <= 'F') {
+			return ch - 'A' + 10;
+		} else {
+			return -1;
+		}
+	}
+
+	static void closeFd(int fd) {
+		boost::this_thread::disable_syscall_interruption dsi;
+		oxt::syscalls::close(fd);
+	}
+
+	/**
+	 * Opens the component `name` of the directory `dirfd` without following
+	 * symlinks, unless the symlink has the same owner as the file or
+	 * directory that it points to.
+	 */
+	static int openComponent(int dirfd, const string &name, int flags, struct stat &buf) {
+		int fd;
+
+		do {
+			fd = ::openat(dirfd, name.c_str(), flags | O_NOFOLLOW);
+		} while (fd == -1 && errno == EINTR);
+		// FreeBSD returns EMLINK instead of ELOOP for symlinks, and
+		// O_DIRECTORY makes Linux return ENOTDIR.
+		if (fd == -1 && (errno == ELOOP || errno == EMLINK || errno == ENOTDIR)) {
+			struct stat linkBuf;
+
+			if (fstatat(dirfd, name.c_str(), &linkBuf, AT_SYMLINK_NOFOLLOW) == -1
+			 || !S_ISLNK(linkBuf.st_mode))
+			{
+				return -1;
+			}
+			do {
+				fd = ::openat(dirfd, name.c_str(), flags);
+			} while (fd == -1 && errno == EINTR);
+			if (fd == -1) {
+				return -1;
+			}
+			if (fstat(fd, &buf) == -1 || buf.st_uid != linkBuf.st_uid) {
+				closeFd(fd);
+				return -1;
+			}
+			return fd;
+		} else if (fd == -1 || fstat(fd, &buf) == -1) {
+			if (fd != -1) {
+				closeFd(fd);
+			}
+			return -1;
+		} else {
+			return fd;
+		}
+	}
+
+	/**
+	 * Opens `filename`, of which the first `publicDirSize` characters are
+	 * the public directory, and checks that it is a regular file.
+	 *
+	 * The RequestHandler usually runs as root, while the public directory is
+	 * writable by the application's user. So like Nginx's
+	 * `disable_symlinks if_not_owner`, we walk the path one component at a
+	 * time, and only follow a symlink below the public directory if it is
+	 * owned by the owner of its target. Otherwise a symlink to e.g.
+	 * /etc/shadow would let anybody read it.
+	 */
+	static int openRegularFile(const string &filename, string::size_type publicDirSize,
+		struct stat &buf)
+	{
+		int dirFlags = O_RDONLY | O_NOCTTY | O_DIRECTORY;
+		int fileFlags = O_RDONLY | O_NOCTTY;
+		#ifdef O_CLOEXEC
+			dirFlags |= O_CLOEXEC;
+			fileFlags |= O_CLOEXEC;
+		#endif
+		string component;
+		string::size_type pos = publicDirSize;
+		int dirfd, fd = -1;
+
+		dirfd = oxt::syscalls::open((publicDirSize == 0)
+			? "/" : filename.substr(0, publicDirSize).c_str(),
+			dirFlags);
+		if (dirfd == -1) {
+			return -1;
+		}
+		while (pos < filename.size()) {
+			string::size_type end = filename.find('/', pos);
+			if (end == string::npos) {
+				end = filename.size();
+			}
+			if (end == pos) {
+				pos++;
+				continue;
+			}
+
+			component.assign(filename, pos, end - pos);
+			pos = end;
+			if (filename.find_first_not_of('/', pos) == string::npos) {
+				fd = openComponent(dirfd, component, fileFlags, buf);
+				break;
+			} else {
+				fd = openComponent(dirfd, component, dirFlags, buf);
+				closeFd(dirfd);
+				if (fd == -1) {
+					return -1;
+				}
+				dirfd = fd;
+				fd = -1;
+			}
+		}
+		closeFd(dirfd);
+
+		if (fd == -1) {
+			return -1;
+		}
+		if (!S_ISREG(buf.st_mode)) {
+			closeFd(fd);
+			return -1;
+		}
+		#ifndef O_CLOEXEC
+			fcntl(fd, F_SETFD, FD_CLOEXEC);
+		#endif
+		return fd;
+	}
+
+	static void setVariant(Variant &variant, int fd, const struct stat &buf,
+		const char *suffix)
+	{
+		char etag[64];
+
+		snprintf(etag, sizeof(etag), "\"%lx-%llx%s\"",
+			(unsigned long) buf.st_mtime,
+			(unsigned long long) buf.st_size,
+			suffix);
+		variant.fd = fd;
+		variant.size = buf.st_size;
+		variant.etag = etag;
+	}
+
+	void loadPrecompressedVariant(Entry &entry, string::size_type publicDirSize,
+		Encoding encoding, const char *extension)
+	{
+		struct stat buf;
+		string variantFilename = entry.filename + extension;
+		int fd = openRegularFile(variantFilename, publicDirSize, buf);
+
+		if (fd == -1) {
+			return;
+		} else if (buf.st_mtime < entry.mtime) {
+			// Left behind by an older version of the file.
+			closeFd(fd);
+		} else {
+			setVariant(entry.variants[encoding], fd, buf,
+				(encoding == GZIP) ? "-gz" : "-br");
+		}
+	}
+
+	EntryPtr load(const string &filename, string::size_type publicDirSize, ev_tstamp now) {
+		EntryPtr entry = boost::make_shared<Entry>();
+		struct stat buf;
+		int fd;
+
+		entry->filename = filename;
+		entry->validatedAt = now;
+		fd = openRegularFile(filename, publicDirSize, buf);
+		if (fd == -1) {
+			return entry;
+		}
+
+		entry->exists = true;
+		entry->dev = buf.st_dev;
+		entry->ino = buf.st_ino;
+		entry->mtime = buf.st_mtime;
+		setVariant(entry->variants[IDENTITY], fd, buf, "");
+		loadPrecompressedVariant(*entry, publicDirSize, GZIP, ".gz");
+		loadPrecompressedVariant(*entry, publicDirSize, BROTLI, ".br");
+		entry->lastModified = formatHttpDate(buf.st_mtime);
+		entry->contentType = getContentType(filename);
+
+		if (watcher != NULL) {
+			vector<string> names;
+			string baseName = extractBaseName(filename);
+			names.push_back(baseName);
+			names.push_back(baseName + ".gz");
+			names.push_back(baseName + ".br");
+			entry->watchId = watcher->watch(extractDirName(filename), names,
+				boost::bind(onFileChanged, entry->stale, _1, _2, _3));
+		}
+		return entry;
+	}
+
+	/** Checks whether the file is still the one that `entry` describes. */
+	static bool revalidate(const Entry &entry) {
+		struct stat buf;
+
+		if (oxt::syscalls::stat(entry.filename.c_str(), &buf) == -1) {
+			return !entry.exists && (errno == ENOENT || errno == ENOTDIR);
+		} else if (!entry.exists) {
+			return !S_ISREG(buf.st_mode);
+		} else {
+			return S_ISREG(buf.st_mode)
+				&& buf.st_dev == entry.dev
+				&& buf.st_ino == entry.ino
+				&& buf.st_mtime == entry.mtime
+				&& buf.st_size == entry.variants[IDENTITY].size;
+		}
+	}
+
+	EntryList &getLru(const Entry &entry) {
+		return entry.exists ? lru : negativeLru;
+	}
+
+	void remove(EntryMap::iterator it) {
+		EntryPtr entry = *it->second;
+		if (entry->watchId != 0) {
+			watcher->unwatch(entry->watchId);
+		}
+		if (!entry->exists) {
+			negativeEntryCount--;
+		}
+		getLru(*entry).erase(it->second);
+		entries.erase(it);
+	}
+
+	EntryPtr lookupFile(const string &filename, string::size_type publicDirSize,
+		ev_tstamp now)
+	{
+		EntryMap::iterator it = entries.find(filename);
+
+		lookups++;
+		if (it != entries.end()) {
+			EntryPtr entry = *it->second;
+			if (!entry->stale->load(boost::memory_order_relaxed)) {
+				EntryList &list = getLru(*entry);
+				if (now - entry->validatedAt < revalidateInterval) {
+					hits++;
+					list.splice(list.begin(), list, it->second);
+					return entry;
+				} else if (revalidate(*entry)) {
+					entry->validatedAt = now;
+					list.splice(list.begin(), list, it->second);
+					return entry;
+				}
+			}
+			remove(it);
+		}
+
+		EntryPtr entry = load(filename, publicDirSize, now);
+		EntryList &list = getLru(*entry);
+		list.push_front(entry);
+		entries.insert(make_pair(filename, list.begin()));
+		if (entry->exists) {
+			while (entries.size() - negativeEntryCount > maxEntries) {
+				remove(entries.find(lru.back()->filename));
+			}
+		} else {
+			negativeEntryCount++;
+			while (negativeEntryCount > maxNegativeEntries) {
+				remove(entries.find(negativeLru.back()->filename));
+			}
+		}
+		return entry;
+	}
+
+public:
+	StaticFileCache(unsigned int _maxEntries = 1024, unsigned int _revalidateInterval = 10,
+		unsigned int _maxNegativeEntries = 1024)
+		: maxEntries(_maxEntries == 0 ? 1 : _maxEntries),
+		  maxNegativeEntries(_maxNegativeEntries == 0 ? 1 : _maxNegativeEntries),
+		  negativeEntryCount(0),
+		  revalidateInterval(_revalidateInterval),
+		  watcher(NULL),
+		  lookups(0),
+		  hits(0)
+		{ }
+
+	~StaticFileCache() {
+		clear();
+	}
+
+	/**
+	 * Sets the FileWatcher that is used for invalidating entries. It must
+	 * outlive this StaticFileCache. Must be called before the first lookup.
+	 */
+	void setWatcher(FileWatcher *_watcher) {
+		assert(entries.empty());
+		watcher = _watcher;
+	}
+
+	/**
+	 * Looks up the file that the given URI path (without query string) maps
+	 * to in `publicDir`. Like Passenger's Nginx module, a path that doesn't
+	 * match a file is also tried with ".html" appended, and a path that ends
+	 * with a slash is mapped to "index.html". Returns NULL if there is no such
+	 * file, or if the path is not safe to map to the filesystem.
+	 */
+	EntryPtr lookup(const StaticString &publicDir, const StaticString &uriPath,
+		ev_tstamp now)
+	{
+		if (!decodeUriPath(uriPath, path)) {
+			return EntryPtr();
+		}
+
+		filename.assign(publicDir.data(), publicDir.size());
+		filename.append(path);
+		if (path[path.size() - 1] == '/') {
+			filename.append("index.html");
+		} else {
+			EntryPtr entry = lookupFile(filename, publicDir.size(), now);
+			if (entry->exists) {
+				return entry;
+			}
+			filename.append(".html");
+		}
+
+		EntryPtr entry = lookupFile(filename, publicDir.size(), now);
+		if (entry->exists) {
+			return entry;
+		} else {
+			return EntryPtr();
+		}
+	}
+
+	void clear() {
+		while (!entries.empty()) {
+			remove(entries.begin());
+		}
+	}
+
+	/** Including the entries for files that don't exist. */
+	unsigned int size() const {
+		return entries.size();
+	}
+
+	Json::Value inspectStateAsJson() const {
+		Json::Value doc;
+		doc["entries"] = (Json::UInt) entries.size();
+		doc["max_entries"] = maxEntries;
+		doc["negative_entries"] = negativeEntryCount;
+		doc["max_negative_entries"] = maxNegativeEntries;
+		doc["lookups"] = (Json::UInt64) lookups;
+		doc["hits"] = (Json::UInt64) hits;
+		return doc;
+	}
+
+
+	/**
+	 * Percent-decodes a URI path into `result`. Returns false if the path
+	 * does not begin with a slash, or if it contains NUL bytes or "." or
+	 * ".." segments, so that the result can be safely appended to a
+	 * directory name.
+	 */
+	static bool decodeUriPath(const StaticString &uriPath, string &result) {
+		const char *pos = uriPath.data();
+		const char *end = uriPath.data() + uriPath.size();
+
+		result.clear();
+		if (pos == end || *pos != '/') {
+			return false;
+		}
+		while (pos < end) {
+			char ch = *pos;
+			if (ch == '%') {
+				int high, low;
+				if (end - pos < 3
+				 || (high = parseHexDigit(pos[1])) == -1
+				 || (low = parseHexDigit(pos[2])) == -1)
+				{
+					return false;
+				}
+				ch = (char) (high * 16 + low);
+				pos += 3;
+			} else {
+				pos++;
+			}
+			if (ch == '\0') {
+				return false;
+			}
+			result.append(1, ch);
+		}
+
+		// Check for "." and ".." segments after decoding, because
+		// "%2e%2e" is just as dangerous as "..".
+		string::size_type segmentStart = 1;
+		while (segmentStart <= result.size()) {
+			string::size_type segmentEnd = result.find('/', segmentStart);
+			if (segmentEnd == string::npos) {
+				segmentEnd = result.size();
+			}
+			StaticString segment(result.data() + segmentStart, segmentEnd - segmentStart);
+			if (segment == "." || segment == "..") {
+				return false;
+			}
+			segmentStart = segmentEnd + 1;
+		}
+		return true;
+	}
+
+	/**
+	 * Returns whether an Accept-Encoding header value allows the given
+	 * content coding, which must be in lowercase.
+	 */
+	static bool acceptsEncoding(const StaticString &acceptEncoding, const StaticString &coding) {
+		const char *pos = acceptEncoding.data();
+		const char *end = acceptEncoding.data() + acceptEncoding.size();
+		bool wildcard = false;
+
+		while (pos < end) {
+			while (pos < end && (isWhitespace(*pos) || *pos == ',')) {
+				pos++;
+			}
+			const char *name = pos;
+			while (pos < end && !isWhitespace(*pos) && *pos != ',' && *pos != ';') {
+				pos++;
+			}
+			size_t nameSize = pos - name;
+
+			// Parse the parameters. Only "q" is meaningful.
+			bool refused = false;
+			while (pos < end && *pos != ',') {
+				if (*pos == ';') {
+					pos++;
+					while (pos < end && isWhitespace(*pos)) {
+						pos++;
+					}
+					if (end - pos >= 2 && (pos[0] == 'q' || pos[0] == 'Q') && pos[1] == '=') {
+						// A quality value of 0 (or 0.0, 0.00 etc) refuses the coding.
+						pos += 2;
+						refused = pos < end && *pos == '0';
+						if (refused) {
+							pos++;
+							if (pos < end && *pos == '.') {
+								pos++;
+							}
+							while (pos < end && *pos == '0') {
+								pos++;
+							}
+							refused = pos == end || *pos == ',' || *pos == ';'
+								|| isWhitespace(*pos);
+						}
+					}
+				} else {
+					pos++;
+				}
+			}
+
+			if (equalsIgnoreCase(name, nameSize, coding)) {
+				return !refused;
+			} else if (nameSize == 1 && *name == '*') {
+				wildcard = !refused;
+			}
+		}
+		return wildcard;
+	}
+
+	/**
+	 * Returns whether an If-None-Match header value matches the given
+	 * entity tag, using the weak comparison function of RFC 7232.
+	 */
+	static bool etagMatches(const StaticString &ifNoneMatch, const StaticString &etag) {
+		const char *pos = ifNoneMatch.data();
+		const char *end = ifNoneMatch.data() + ifNoneMatch.size();
+
+		while (pos < end) {
+			while (pos < end && (isWhitespace(*pos) || *pos == ',')) {
+				pos++;
+			}
+			if (pos < end && *pos == '*') {
+				return true;
+			}
+			if (end - pos >= 2 && pos[0] == 'W' && pos[1] == '/') {
+				pos += 2;
+			}
+			const char *tag = pos;
+			if (pos < end && *pos == '"') {
+				pos++;
+				while (pos < end && *pos != '"') {
+					pos++;
+				}
+				if (pos < end) {
+					pos++;
+				}
+			} else {
+				while (pos < end && *pos != ',') {
+					pos++;
+				}
+			}
+			if (StaticString(tag, pos - tag) == etag) {
+				return true;
+			}
+			while (pos < end && *pos != ',') {
+				pos++;
+			}
+		}
+		return false;
+	}
+
+	static string formatHttpDate(time_t time) {
+		char buf[64];
+		struct tm tm;
+
+		gmtime_r(&time, &tm);
+		return string(buf, strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm));
+	}
+
+	/** Determines the Content-Type from the file name extension. */
+	static StaticString getContentType(const StaticString &filename) {
+		static const char * const types[] = {
+			"html",  "text/html; charset=utf-8",
+			"htm",   "text/html; charset=utf-8",
+			"css",   "text/css; charset=utf-8",
+			"js",    "application/javascript; charset=utf-8",
+			"json",  "application/json",
+			"map",   "application/json",
+			"xml",   "application/xml",
+			"txt",   "text/plain; charset=utf-8",
+			"csv",   "text/csv; charset=utf-8",
+			"svg",   "image/svg+xml",
+			"png",   "image/png",
+			"jpg",   "image/jpeg",
+			"jpeg",  "image/jpeg",
+			"gif",   "image/gif",
+			"ico",   "image/x-icon",
+			"webp",  "image/webp",
+			"woff",  "font/woff",
+			"woff2", "font/woff2",
+			"ttf",   "font/ttf",
+			"otf",   "font/otf",
+			"eot",   "application/vnd.ms-fontobject",
+			"pdf",   "application/pdf",
+			"zip",   "application/zip",
+			"wasm",  "application/wasm",
+			"mp3",   "audio/mpeg",
+			"mp4",   "video/mp4",
+			"webm",  "video/webm",
+			NULL
+		};
+		const char *end = filename.data() + filename.size();
+		const char *extension = end;
+
+		while (extension > filename.data() && extension[-1] != '.' && extension[-1] != '/') {
+			extension--;
+		}
+		if (extension > filename.data() && extension[-1] == '.') {
+			for (unsigned int i = 0; types[i] != NULL; i += 2) {
+				if (equalsIgnoreCase(extension, end - extension, types[i])) {
+					return types[i + 1];
+				}
+			}
+		}
+		return P_STATIC_STRING("application/octet-stream");
+	}
+};
+
+
+} // namespace Passenger
+
+#endif /* _PASSENGER_STATIC_FILE_CACHE_H_ */
@@ -0,0 +1,288 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2011-2015 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+
+// This file is included inside the RequestHandler class.
+
+private:
+
+/**
+ * Serves GET and HEAD requests for files in the application's public
+ * directory directly from the StaticFileCache, so that asset requests
+ * never occupy an application process. Returns whether the request
+ * has been handled.
+ */
+bool
+serveStaticFile(Client *client, Request *req) {
+	TRACE_POINT();
+
+	if ((req->method != HTTP_GET && req->method != HTTP_HEAD)
+	 || req->hasBody()
+	 || req->upgraded()
+	 || req->options.appRoot.empty())
+	{
+		return false;
+	}
+
+	const LString *path = psg_lstr_make_contiguous(&req->path, req->pool);
+	StaticString uriPath(path->start->data, path->size);
+	if (req->queryStringIndex >= 0) {
+		uriPath = uriPath.substr(0, req->queryStringIndex);
+	}
+	if (!req->options.baseURI.empty() && req->options.baseURI != P_STATIC_STRING("/")) {
+		if (!startsWith(uriPath, req->options.baseURI)) {
+			return false;
+		}
+		uriPath = uriPath.substr(req->options.baseURI.size());
+		if (uriPath.empty()) {
+			uriPath = P_STATIC_STRING("/");
+		}
+	}
+
+	unsigned int publicDirSize = req->options.appRoot.size() + sizeof("/public") - 1;
+	char *publicDir = (char *) psg_pnalloc(req->pool, publicDirSize);
+	char *pos = appendData(publicDir, publicDir + publicDirSize, req->options.appRoot);
+	appendData(pos, publicDir + publicDirSize, P_STATIC_STRING("/public"));
+
+	StaticFileCache::EntryPtr entry = staticFileCache->lookup(
+		StaticString(publicDir, publicDirSize), uriPath, ev_now(getLoop()));
+	if (entry == NULL) {
+		return false;
+	}
+
+	SKC_TRACE(client, 2, "Serving static file " << entry->filename);
+	metrics.staticFileResponses.inc();
+	req->staticFile = entry;
+	if (entry->hasPrecompressedVariants()) {
+		const LString *acceptEncoding = req->headers.lookup(HTTP_ACCEPT_ENCODING);
+		if (acceptEncoding != NULL) {
+			acceptEncoding = psg_lstr_make_contiguous(acceptEncoding, req->pool);
+			req->staticFileEncoding = entry->selectEncoding(StaticString(
+				acceptEncoding->start->data, acceptEncoding->size));
+		}
+	}
+
+	bool notModified = staticFileNotModified(req);
+	bool sendBody = !notModified && req->method == HTTP_GET
+		&& entry->variants[req->staticFileEncoding].size > 0;
+	StaticString header = constructStaticFileResponseHeader(req, notModified);
+
+	if (sendBody) {
+		// The body is sent once the header has been flushed. If that
+		// happens right away, then the whole response may have been
+		// sent by the time writeResponse() returns.
+		client->output.setDataFlushedCallback(_staticFileHeaderFlushed);
+		writeResponse(client, header);
+	} else {
+		writeResponse(client, header);
+		if (!req->ended()) {
+			endRequest(&client, &req);
+		}
+	}
+	return true;
+}
+
+bool
+staticFileNotModified(Request *req) {
+	const StaticFileCache::Entry &entry = *req->staticFile;
+	const LString *value;
+
+	// If-None-Match takes precedence over If-Modified-Since.
+	value = req->headers.lookup(HTTP_IF_NONE_MATCH);
+	if (value != NULL) {
+		value = psg_lstr_make_contiguous(value, req->pool);
+		return StaticFileCache::etagMatches(
+			StaticString(value->start->data, value->size),
+			entry.variants[req->staticFileEncoding].etag);
+	}
+
+	value = req->headers.lookup(HTTP_IF_MODIFIED_SINCE);
+	if (value != NULL) {
+		struct tm tm;
+		int zone;
+
+		value = psg_lstr_make_contiguous(value, req->pool);
+		if (parseImfFixdate(value->start->data, value->start->data + value->size, tm, zone)) {
+			return entry.mtime <= parsedDateToTimestamp(tm, zone);
+		}
+	}
+
+	return false;
+}
+
+StaticString
+constructStaticFileResponseHeader(Request *req, bool notModified) {
+	const StaticFileCache::Entry &entry = *req->staticFile;
+	const StaticFileCache::Variant &variant = entry.variants[req->staticFileEncoding];
+	unsigned int capacity = 512 + entry.contentType.size() + variant.etag.size()
+		+ entry.lastModified.size();
+	char *header = (char *) psg_pnalloc(req->pool, capacity);
+	char *pos = header;
+	const char *end = header + capacity;
+
+	if (notModified) {
+		pos += snprintf(pos, end - pos, "HTTP/%d.%d 304 Not Modified\r\n",
+			(int) req->httpMajor, (int) req->httpMinor);
+	} else {
+		pos += snprintf(pos, end - pos, "HTTP/%d.%d 200 OK\r\n"
+			"Content-Length: %llu\r\n",
+			(int) req->httpMajor, (int) req->httpMinor,
+			(unsigned long long) variant.size);
+		pos = appendData(pos, end, "Content-Type: ");
+		pos = appendData(pos, end, entry.contentType);
+		pos = appendData(pos, end, "\r\n");
+		if (req->staticFileEncoding == StaticFileCache::GZIP) {
+			pos = appendData(pos, end, "Content-Encoding: gzip\r\n");
+		} else if (req->staticFileEncoding == StaticFileCache::BROTLI) {
+			pos = appendData(pos, end, "Content-Encoding: br\r\n");
+		}
+	}
+	if (entry.hasPrecompressedVariants()) {
+		pos = appendData(pos, end, "Vary: Accept-Encoding\r\n");
+	}
+
+	pos = appendData(pos, end, "Last-Modified: ");
+	pos = appendData(pos, end, entry.lastModified);
+	pos = appendData(pos, end, "\r\nETag: ");
+	pos = appendData(pos, end, variant.etag);
+	pos = appendData(pos, end, "\r\n");
+	pos += constructDateHeaderBuffersForResponse(pos, end - pos);
+	pos = appendData(pos, end, "\r\n");
+
+	if (canKeepAlive(req)) {
+		pos = appendData(pos, end, "Connection: keep-alive\r\n");
+	} else {
+		req->wantKeepAlive = false;
+		pos = appendData(pos, end, "Connection: close\r\n");
+	}
+
+	#ifdef PASSENGER_IS_ENTERPRISE
+		pos = appendData(pos, end, "X-Powered-By: " PROGRAM_NAME " Enterprise\r\n\r\n");
+	#else
+		pos = appendData(pos, end, "X-Powered-By: " PROGRAM_NAME "\r\n\r\n");
+	#endif
+
+	return StaticString(header, pos - header);
+}
+
+static void
+_staticFileHeaderFlushed(FileBufferedChannel *_channel) {
+	FileBufferedFdSinkChannel *channel = reinterpret_cast<FileBufferedFdSinkChannel *>(_channel);
+	Client *client = static_cast<Client *>(static_cast<
+		ServerKit::BaseClient *>(channel->getHooks()->userData));
+	Request *req = static_cast<Request *>(client->currentRequest);
+	RequestHandler *self = static_cast<RequestHandler *>(getServerFromClient(client));
+
+	client->output.setDataFlushedCallback(getClientOutputDataFlushedCallback());
+	getClientOutputDataFlushedCallback()(_channel);
+	if (client->connected() && req != NULL && !req->ended()) {
+		self->sendStaticFileBody(client, req);
+	}
+}
+
+static void
+_onStaticFileWritable(EV_P_ struct ev_io *io, int revents) {
+	Request *req = static_cast<Request *>(static_cast<
+		ServerKit::BaseHttpRequest *>(io->data));
+	Client *client = static_cast<Client *>(req->client);
+	RequestHandler *self = static_cast<RequestHandler *>(getServerFromClient(client));
+
+	ev_io_stop(self->getLoop(), io);
+	self->sendStaticFileBody(client, req);
+}
+
+/**
+ * Writes the file straight to the client socket, bypassing the output
+ * channel, which has nothing buffered at this point. On Linux, sendfile()
+ * avoids copying the file through userspace. When the socket is not
+ * writable, or after STATIC_FILE_SEND_BURST bytes so that other clients
+ * get their turn, this waits for the socket to become writable.
+ */
+void
+sendStaticFileBody(Client *client, Request *req) {
+	TRACE_POINT();
+	const StaticFileCache::Variant &variant = req->staticFile->variants[req->staticFileEncoding];
+	int fd = client->getFd();
+	off_t sent = 0;
+	ssize_t ret;
+
+	while (req->staticFileOffset < variant.size && sent < (off_t) STATIC_FILE_SEND_BURST) {
+		size_t size = (size_t) std::min<off_t>(variant.size - req->staticFileOffset,
+			STATIC_FILE_SEND_BURST - sent);
+
+		#ifdef __linux__
+			off_t offset = req->staticFileOffset;
+			do {
+				ret = sendfile(fd, variant.fd, &offset, size);
+			} while (ret == -1 && errno == EINTR);
+		#else
+			MemoryKit::mbuf buffer(MemoryKit::mbuf_get(&getContext()->mbuf_pool));
+			size = std::min<size_t>(size, buffer.size());
+			do {
+				ret = pread(variant.fd, buffer.start, size, req->staticFileOffset);
+			} while (ret == -1 && errno == EINTR);
+			if (ret > 0) {
+				do {
+					ret = write(fd, buffer.start, ret);
+				} while (ret == -1 && errno == EINTR);
+			}
+		#endif
+
+		if (ret > 0) {
+			req->staticFileOffset += ret;
+			sent += ret;
+		} else if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			break;
+		} else if (ret == 0) {
+			// The file has been truncated after we opened it, so we
+			// cannot send the promised Content-Length anymore.
+			disconnectWithError(&client, "static file " + req->staticFile->filename +
+				" has been truncated while sending it");
+			return;
+		} else {
+			disconnectWithClientSocketWriteError(&client, errno);
+			return;
+		}
+	}
+
+	if (req->staticFileOffset < variant.size) {
+		ev_io_set(&req->staticFileWatcher, fd, EV_WRITE);
+		ev_io_start(getLoop(), &req->staticFileWatcher);
+	} else {
+		SKC_TRACE(client, 2, "Static file sent");
+		endRequest(&client, &req);
+	}
+}
+
+void
+deinitializeStaticFileResponse(Client *client, Request *req) {
+	if (ev_is_active(&req->staticFileWatcher)) {
+		ev_io_stop(getLoop(), &req->staticFileWatcher);
+	}
+	if (client->output.getDataFlushedCallback() == _staticFileHeaderFlushed) {
+		client->output.setDataFlushedCallback(getClientOutputDataFlushedCallback());
+	}
+	req->staticFile.reset();
+}
@@ -112,6 +112,25 @@ endRequestWithAppSocketReadError(Client **client, Request **req, int e) {
 	}
 }
 
+/**
+ * Reports the timeout to the pool (which may detach the process), then
+ * responds with 504 if possible. The session is not reused: it's
+ * closed as failed when the request is deinitialized.
+ */
+void
+endRequestWithAppResponseTimeout(Client **client, Request **req) {
+	if ((*req)->session != NULL && !(*req)->session->isClosed()) {
+		(*req)->session->reportResponseTimeout(appResponseTimeoutDetachThreshold);
+	}
+	if (!(*req)->responseBegun) {
+		SKC_WARN(*client, "Sending 504 response: application did not respond in time");
+		endRequestWithSimpleResponse(client, req,
+			"<h2>Gateway Timeout</h2>The application did not respond in time.", 504);
+	} else {
+		disconnectWithError(client, "application did not send response data in time");
+	}
+}
+
 /**
  * `data` must outlive the request.
  */
@@ -36,6 +36,7 @@
 #include <Exceptions.h>
 #include <Utils/VariantMap.h>
 #include <Core/UnionStation/Core.h>
+#include <Core/SpawningKit/ShellEnvvarsCache.h>
 
 namespace Passenger {
 namespace ApplicationPool2 {
@@ -68,12 +69,16 @@ struct Config {
 	// Used by SmartSpawner and DirectSpawner.
 	RandomGeneratorPtr randomGenerator;
 	string instanceDir;
+	ShellEnvvarsCachePtr shellEnvvarsCache;
 
 	// Used by DummySpawner and SpawnerFactory.
 	unsigned int concurrency;
 	unsigned int spawnerCreationSleepTime;
 	unsigned int spawnTime;
 
+	// Used by DummySpawner. The socket that dummy processes claim to listen on.
+	string dummySocketAddress;
+
 	// Used by PipeWatcher.
 	OutputHandler outputHandler;
 
@@ -87,6 +92,7 @@ struct Config {
 		  concurrency(1),
 		  spawnerCreationSleepTime(0),
 		  spawnTime(0),
+		  dummySocketAddress("tcp://127.0.0.1:1234"),
 		  data(NULL)
 		{ }
 
@@ -98,6 +104,9 @@ struct Config {
 		if (randomGenerator == NULL) {
 			randomGenerator = boost::make_shared<RandomGenerator>();
 		}
+		if (shellEnvvarsCache == NULL) {
+			shellEnvvarsCache = boost::make_shared<ShellEnvvarsCache>(0);
+		}
 	}
 };
 
@@ -121,7 +121,7 @@ private:
 			throw RuntimeException("No startCommand given");
 		}
 
-		if (shouldLoadShellEnvvars(options, preparation)) {
+		if (preparation.shellEnvvarsSource == SES_LOGIN_SHELL) {
 			command.push_back(preparation.userSwitching.shell);
 			command.push_back(preparation.userSwitching.shell);
 			command.push_back("-lc");
@@ -133,7 +133,7 @@ private:
 		command.push_back(agentFilename);
 		command.push_back("spawn-preparer");
 		command.push_back(preparation.appRoot);
-		command.push_back(serializeEnvvarsFromPoolOptions(options));
+		command.push_back(serializeEnvvarsFromPoolOptions(options, preparation));
 		command.push_back(startCommandArgs[0]);
 		// Note: do not try to set a process title here.
 		// https://code.google.com/p/phusion-passenger/issues/detail?id=855
@@ -165,11 +165,15 @@ public:
 		Pipe errorPipe = createPipe(__FILE__, __LINE__);
 		DebugDirPtr debugDir = boost::make_shared<DebugDir>(preparation.userSwitching.uid,
 			preparation.userSwitching.gid);
+		unsigned long long forkTime = SystemTime::getUsec();
 		pid_t pid;
 
 		pid = syscalls::fork();
 		if (pid == 0) {
 			setenv("PASSENGER_DEBUG_DIR", debugDir->getPath().c_str(), 1);
+			if (preparation.captureShellEnvvars) {
+				setenv("PASSENGER_CAPTURE_SHELL_ENVVARS", "1", 1);
+			}
 			purgeStdio(stdout);
 			purgeStdio(stderr);
 			resetSignalHandlersAndMask();
@@ -241,8 +245,8 @@ public:
 			}
 			detachProcess(result["pid"].asInt());
 			guard.clear();
-			P_DEBUG("Process spawning done: appRoot=" << options.appRoot <<
-				", pid=" << result["pid"].asInt());
+			cacheShellEnvvars(preparation, debugDir);
+			logSpawnTimes("Process", options, preparation, result["pid"].asInt(), forkTime);
 			return result;
 		}
 	}
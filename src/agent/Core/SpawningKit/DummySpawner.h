@@ -62,7 +62,7 @@ public:
 		Json::Value socket;
 
 		socket["name"] = "main";
-		socket["address"] = "tcp://127.0.0.1:1234";
+		socket["address"] = config->dummySocketAddress;
 		socket["protocol"] = "session";
 		socket["concurrency"] = config->concurrency;
 
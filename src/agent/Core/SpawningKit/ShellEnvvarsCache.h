@@ -0,0 +1,360 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2011-2015 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_SPAWNING_KIT_SHELL_ENVVARS_CACHE_H_
+#define _PASSENGER_SPAWNING_KIT_SHELL_ENVVARS_CACHE_H_
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <cstring>
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <map>
+#include <oxt/system_calls.hpp>
+#include <StaticString.h>
+#include <Utils/SystemTime.h>
+#include <Utils/StrIntUtils.h>
+#include <Core/SpawningKit/UserSwitchingRules.h>
+
+namespace Passenger {
+namespace SpawningKit {
+
+using namespace std;
+
+
+/**
+ * Caches the environment that the user's login shell sets up, so that
+ * spawning a process doesn't have to run the login shell every time.
+ * Shell initialization files that set up Ruby or Node version managers
+ * can easily take hundreds of milliseconds.
+ *
+ * An environment is captured by spawn-preparer, right after the login shell
+ * executed it (see Spawner::prepareShellEnvvars()). Entries are keyed by
+ * user, shell, chroot and application root, because shell initialization
+ * files may behave differently in different directories. An entry is
+ * discarded after `ttl` seconds, or when any of the shell's initialization
+ * files, or any file in /etc/profile.d, is created, removed or modified.
+ *
+ * Only environment variables are cached. Other effects of the shell
+ * initialization files, such as ulimits and the umask, don't apply to
+ * processes that are spawned with a cached environment. That's why the
+ * Core only enables this cache when `--shell-envvars-cache-ttl` is given.
+ *
+ * This class is thread-safe.
+ */
+class ShellEnvvarsCache {
+private:
+	struct FileStamp {
+		string path;
+		bool exists;
+		time_t mtime;
+		off_t size;
+
+		FileStamp(const string &_path)
+			: path(_path)
+		{
+			struct stat buf;
+			int ret;
+
+			do {
+				ret = stat(path.c_str(), &buf);
+			} while (ret == -1 && errno == EINTR);
+			exists = ret == 0;
+			if (exists) {
+				mtime = buf.st_mtime;
+				size = buf.st_size;
+			} else {
+				mtime = 0;
+				size = 0;
+			}
+		}
+
+		bool operator==(const FileStamp &other) const {
+			return exists == other.exists
+				&& mtime == other.mtime
+				&& size == other.size;
+		}
+	};
+
+	struct Entry {
+		string envvars;
+		vector<FileStamp> files;
+		unsigned long long createdAt;
+	};
+
+	mutable boost::mutex syncher;
+	map<string, Entry> entries;
+	unsigned int ttl;
+
+	static string createKey(const UserSwitchingInfo &user, const string &chrootDir,
+		const string &appRoot)
+	{
+		string key;
+		key.append(user.username);
+		key.append(1, '\0');
+		key.append(user.shell);
+		key.append(1, '\0');
+		key.append(chrootDir);
+		key.append(1, '\0');
+		key.append(appRoot);
+		return key;
+	}
+
+	/**
+	 * Adds the entries of the given directory to `paths`, so that in-place
+	 * modifications of the files in it are noticed as well. Modifying a
+	 * file doesn't change the mtime of its directory.
+	 */
+	static void addDirectoryEntries(const string &dir, vector<string> &paths) {
+		DIR *d = opendir(dir.c_str());
+		struct dirent *ent;
+
+		if (d == NULL) {
+			return;
+		}
+		while ((ent = readdir(d)) != NULL) {
+			if (ent->d_name[0] != '.') {
+				paths.push_back(dir + "/" + ent->d_name);
+			}
+		}
+		closedir(d);
+	}
+
+	static bool stillValid(const vector<FileStamp> &files) {
+		vector<FileStamp>::const_iterator it, end = files.end();
+		for (it = files.begin(); it != end; it++) {
+			if (!(FileStamp(it->path) == *it)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+public:
+	/**
+	 * @param ttl How long entries are kept, in seconds. 0 disables caching.
+	 */
+	ShellEnvvarsCache(unsigned int _ttl = 600)
+		: ttl(_ttl)
+		{ }
+
+	bool isEnabled() const {
+		return ttl > 0;
+	}
+
+	/**
+	 * Returns the initialization files that the given user's login shell
+	 * may read, relative to `chrootDir`.
+	 */
+	static vector<string> getShellInitFiles(const UserSwitchingInfo &user,
+		const string &chrootDir)
+	{
+		static const char * const bashFiles[] = {
+			"/etc/profile", "/etc/profile.d", "/etc/environment",
+			"/etc/bash.bashrc", "/etc/bashrc",
+			"~/.bash_profile", "~/.bash_login", "~/.profile", "~/.bashrc",
+			NULL
+		};
+		static const char * const zshFiles[] = {
+			"/etc/profile", "/etc/profile.d", "/etc/environment",
+			"/etc/zshenv", "/etc/zsh/zshenv", "/etc/zprofile", "/etc/zsh/zprofile",
+			"/etc/zshrc", "/etc/zsh/zshrc", "/etc/zlogin", "/etc/zsh/zlogin",
+			"~/.zshenv", "~/.zprofile", "~/.zshrc", "~/.zlogin",
+			NULL
+		};
+		static const char * const kshFiles[] = {
+			"/etc/profile", "/etc/profile.d", "/etc/environment",
+			"/etc/ksh.kshrc", "~/.profile", "~/.kshrc",
+			NULL
+		};
+		string shellName = extractBaseName(user.shell);
+		const char * const *files;
+		vector<string> result;
+		string prefix;
+
+		if (shellName == "zsh") {
+			files = zshFiles;
+		} else if (shellName == "ksh") {
+			files = kshFiles;
+		} else {
+			files = bashFiles;
+		}
+		if (chrootDir != "/") {
+			prefix = chrootDir;
+		}
+
+		for (; *files != NULL; files++) {
+			if ((*files)[0] == '~') {
+				result.push_back(prefix + user.home + (*files + 1));
+			} else {
+				result.push_back(prefix + *files);
+			}
+		}
+		return result;
+	}
+
+	/**
+	 * Removes the variables from a captured environment that are specific
+	 * to a single invocation of the shell or of spawn-preparer.
+	 *
+	 * @param environment Null-terminated key-value pairs, as written by spawn-preparer.
+	 * @return Null-terminated key-value pairs.
+	 */
+	static string filterEnvvars(const StaticString &environment) {
+		const char *key = environment.data();
+		const char *end = environment.data() + environment.size();
+		string result;
+
+		while (key < end) {
+			const char *keyEnd = (const char *) memchr(key, '\0', end - key);
+			if (keyEnd == NULL || keyEnd + 1 >= end) {
+				break;
+			}
+			const char *value = keyEnd + 1;
+			const char *valueEnd = (const char *) memchr(value, '\0', end - value);
+			if (valueEnd == NULL) {
+				break;
+			}
+
+			StaticString name(key, keyEnd - key);
+			if (name != "_"
+			 && name != "PWD"
+			 && name != "OLDPWD"
+			 && name != "SHLVL"
+			 && name != "PASSENGER_DEBUG_DIR"
+			 && name != "PASSENGER_CAPTURE_SHELL_ENVVARS")
+			{
+				result.append(key, valueEnd + 1 - key);
+			}
+			key = valueEnd + 1;
+		}
+		return result;
+	}
+
+	/**
+	 * Looks up the cached environment of the given user's login shell.
+	 * Returns whether it was found, in which case `envvars` is set to
+	 * the environment as null-terminated key-value pairs.
+	 */
+	bool lookup(const UserSwitchingInfo &user, const string &chrootDir,
+		const string &appRoot, string &envvars)
+	{
+		string key = createKey(user, chrootDir, appRoot);
+		Entry entry;
+
+		if (!isEnabled()) {
+			return false;
+		}
+
+		{
+			boost::lock_guard<boost::mutex> l(syncher);
+			map<string, Entry>::iterator it = entries.find(key);
+			if (it == entries.end()) {
+				return false;
+			} else if (SystemTime::getUsec() >= it->second.createdAt + ttl * 1000000ull) {
+				entries.erase(it);
+				return false;
+			}
+			entry = it->second;
+		}
+
+		// Checking the files is done without holding the lock.
+		if (stillValid(entry.files)) {
+			envvars = entry.envvars;
+			return true;
+		} else {
+			boost::lock_guard<boost::mutex> l(syncher);
+			map<string, Entry>::iterator it = entries.find(key);
+			if (it != entries.end() && it->second.createdAt == entry.createdAt) {
+				entries.erase(it);
+			}
+			return false;
+		}
+	}
+
+	/**
+	 * Stores an environment that was captured by spawn-preparer.
+	 *
+	 * @param environment Null-terminated key-value pairs, as written by spawn-preparer.
+	 * @param capturedSince When the spawn that captured the environment began,
+	 *                      in microseconds. If the shell's initialization files
+	 *                      were modified after that, then it is unknown whether
+	 *                      the environment reflects that change, so it isn't stored.
+	 * @return Whether the environment was stored.
+	 */
+	bool store(const UserSwitchingInfo &user, const string &chrootDir,
+		const string &appRoot, const StaticString &environment,
+		unsigned long long capturedSince)
+	{
+		vector<string> paths = getShellInitFiles(user, chrootDir);
+		vector<string>::const_iterator it, end;
+		Entry entry;
+
+		if (!isEnabled()) {
+			return false;
+		}
+
+		for (it = paths.begin(), end = paths.end(); it != end; it++) {
+			if (extractBaseName(*it) == "profile.d") {
+				vector<string> dirEntries;
+				addDirectoryEntries(*it, dirEntries);
+				paths.insert(paths.end(), dirEntries.begin(), dirEntries.end());
+				break;
+			}
+		}
+
+		for (it = paths.begin(), end = paths.end(); it != end; it++) {
+			entry.files.push_back(FileStamp(*it));
+			if (entry.files.back().exists
+			 && (unsigned long long) entry.files.back().mtime >= capturedSince / 1000000)
+			{
+				return false;
+			}
+		}
+		entry.envvars = filterEnvvars(environment);
+		entry.createdAt = SystemTime::getUsec();
+
+		boost::lock_guard<boost::mutex> l(syncher);
+		entries[createKey(user, chrootDir, appRoot)] = entry;
+		return true;
+	}
+
+	void clear() {
+		boost::lock_guard<boost::mutex> l(syncher);
+		entries.clear();
+	}
+};
+
+typedef boost::shared_ptr<ShellEnvvarsCache> ShellEnvvarsCachePtr;
+
+
+} // namespace SpawningKit
+} // namespace Passenger
+
+#endif /* _PASSENGER_SPAWNING_KIT_SHELL_ENVVARS_CACHE_H_ */
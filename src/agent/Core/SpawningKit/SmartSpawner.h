@@ -99,7 +99,7 @@ private:
 		string agentFilename = config->resourceLocator->findSupportBinary(AGENT_EXE);
 		vector<string> command;
 
-		if (shouldLoadShellEnvvars(options, preparation)) {
+		if (preparation.shellEnvvarsSource == SES_LOGIN_SHELL) {
 			command.push_back(preparation.userSwitching.shell);
 			command.push_back(preparation.userSwitching.shell);
 			command.push_back("-lc");
@@ -111,7 +111,7 @@ private:
 		command.push_back(agentFilename);
 		command.push_back("spawn-preparer");
 		command.push_back(preparation.appRoot);
-		command.push_back(serializeEnvvarsFromPoolOptions(options));
+		command.push_back(serializeEnvvarsFromPoolOptions(options, preparation));
 		command.push_back(preloaderCommand[0]);
 		// Note: do not try to set a process title here.
 		// https://code.google.com/p/phusion-passenger/issues/detail?id=855
@@ -212,11 +212,15 @@ private:
 		Pipe errorPipe = createPipe(__FILE__, __LINE__);
 		DebugDirPtr debugDir = boost::make_shared<DebugDir>(preparation.userSwitching.uid,
 			preparation.userSwitching.gid);
+		unsigned long long forkTime = SystemTime::getUsec();
 		pid_t pid;
 
 		pid = syscalls::fork();
 		if (pid == 0) {
 			setenv("PASSENGER_DEBUG_DIR", debugDir->getPath().c_str(), 1);
+			if (preparation.captureShellEnvvars) {
+				setenv("PASSENGER_CAPTURE_SHELL_ENVVARS", "1", 1);
+			}
 			purgeStdio(stdout);
 			purgeStdio(stderr);
 			resetSignalHandlersAndMask();
@@ -303,6 +307,8 @@ private:
 			watcher->start();
 
 			preloaderAnnotations = debugDir->readAll();
+			cacheShellEnvvars(preparation, debugDir);
+			logSpawnTimes("Preloader", options, preparation, pid, forkTime);
 			P_INFO("Preloader for " << options.appRoot <<
 				" started on PID " << pid <<
 				", listening on " << socketAddress);
@@ -89,6 +89,7 @@
 #include <Utils/IOUtils.h>
 #include <Utils/StrIntUtils.h>
 #include <Utils/ProcessMetricsCollector.h>
+#include <Utils/SystemTime.h>
 #include <Core/SpawningKit/Config.h>
 #include <Core/SpawningKit/Options.h>
 #include <Core/SpawningKit/Result.h>
@@ -173,6 +174,15 @@ protected:
 
 	typedef boost::shared_ptr<DebugDir> DebugDirPtr;
 
+	enum ShellEnvvarsSource {
+		/** The login shell's environment is not loaded. */
+		SES_NONE,
+		/** The process is started through the login shell. */
+		SES_LOGIN_SHELL,
+		/** The login shell's environment is taken from the ShellEnvvarsCache. */
+		SES_CACHE
+	};
+
 	/**
 	 * Contains information that will be used after fork()ing but before exec()ing,
 	 * such as the intended app root, the UID it should switch to, the
@@ -209,8 +219,20 @@ protected:
 
 		UserSwitchingInfo userSwitching;
 
+		// Login shell environment
+
+		ShellEnvvarsSource shellEnvvarsSource;
+		/** Whether spawn-preparer should save the environment that the login shell
+		 * set up, so that it can be cached. */
+		bool captureShellEnvvars;
+		/** If shellEnvvarsSource == SES_CACHE: the cached environment, as
+		 * null-terminated key-value pairs. */
+		string cachedShellEnvvars;
+
 		// Other information
 		string codeRevision;
+		/** When preparation began, in microseconds. */
+		unsigned long long startTime;
 	};
 
 	/**
@@ -428,6 +450,8 @@ private:
 		result["gupid"] = details.gupid;
 		result["sockets"] = sockets;
 		result["code_revision"] = details.preparation->codeRevision;
+		result["uid"] = (Json::Int) details.preparation->userSwitching.uid;
+		result["gid"] = (Json::Int) details.preparation->userSwitching.gid;
 		result["spawner_creation_time"] = (Json::UInt64) creationTime;
 		result["spawn_start_time"] = (Json::UInt64) details.spawnStartTime;
 		result.adminSocket = details.adminSocket;
@@ -715,9 +739,11 @@ protected:
 	SpawnPreparationInfo prepareSpawn(const Options &options) {
 		TRACE_POINT();
 		SpawnPreparationInfo info;
+		info.startTime = SystemTime::getUsec();
 		prepareChroot(info, options);
 		info.userSwitching = prepareUserSwitching(options);
 		prepareSwitchingWorkingDirectory(info, options);
+		prepareShellEnvvars(info, options);
 		inferApplicationInfo(info);
 		return info;
 	}
@@ -772,6 +798,85 @@ protected:
 		assert(info.appRootPathsInsideChroot.back() == info.appRootInsideChroot);
 	}
 
+	/**
+	 * Decides whether the process is started through the user's login shell,
+	 * or whether the environment that the login shell sets up can be taken
+	 * from the ShellEnvvarsCache. In the former case, spawn-preparer is asked
+	 * to save the environment so that `cacheShellEnvvars()` can cache it.
+	 */
+	void prepareShellEnvvars(SpawnPreparationInfo &info, const Options &options) const {
+		const ShellEnvvarsCachePtr &cache = config->shellEnvvarsCache;
+
+		info.captureShellEnvvars = false;
+		if (!shouldLoadShellEnvvars(options, info)) {
+			info.shellEnvvarsSource = SES_NONE;
+		} else if (cache != NULL && cache->lookup(info.userSwitching, info.chrootDir,
+			info.appRoot, info.cachedShellEnvvars))
+		{
+			info.shellEnvvarsSource = SES_CACHE;
+		} else {
+			info.shellEnvvarsSource = SES_LOGIN_SHELL;
+			info.captureShellEnvvars = cache != NULL && cache->isEnabled();
+		}
+	}
+
+	/**
+	 * To be called after the process has successfully started. Caches the
+	 * environment that spawn-preparer saved, if it was asked to.
+	 */
+	void cacheShellEnvvars(const SpawnPreparationInfo &info, const DebugDirPtr &debugDir) {
+		if (!info.captureShellEnvvars) {
+			return;
+		}
+
+		string path = debugDir->getPath() + "/.shell_envvars";
+		string environment;
+		try {
+			environment = Passenger::readAll(path);
+		} catch (const SystemException &e) {
+			P_WARN("Cannot read the login shell environment saved by spawn-preparer (" <<
+				path << "): " << e.what());
+			return;
+		}
+
+		if (config->shellEnvvarsCache->store(info.userSwitching, info.chrootDir,
+			info.appRoot, environment, info.startTime))
+		{
+			P_DEBUG("Cached the environment of the login shell (" <<
+				info.userSwitching.shell << ") of user " << info.userSwitching.username <<
+				" for " << info.appRoot);
+		}
+	}
+
+	/**
+	 * Logs how long the phases of spawning took, so that the effect of
+	 * ShellEnvvarsCache can be measured.
+	 */
+	static void logSpawnTimes(const char *what, const Options &options,
+		const SpawnPreparationInfo &info, pid_t pid, unsigned long long forkTime)
+	{
+		unsigned long long now = SystemTime::getUsec();
+		const char *shellEnvvarsSource;
+
+		switch (info.shellEnvvarsSource) {
+		case SES_LOGIN_SHELL:
+			shellEnvvarsSource = "loaded by login shell";
+			break;
+		case SES_CACHE:
+			shellEnvvarsSource = "cached";
+			break;
+		default:
+			shellEnvvarsSource = "not loaded";
+			break;
+		}
+
+		P_DEBUG(what << " spawning done: appRoot=" << options.appRoot <<
+			", pid=" << pid <<
+			", preparation=" << (forkTime - info.startTime) / 1000 << "ms" <<
+			", startup=" << (now - forkTime) / 1000 << "ms" <<
+			", shell environment " << shellEnvvarsSource);
+	}
+
 	void inferApplicationInfo(SpawnPreparationInfo &info) const {
 		info.codeRevision = readFromRevisionFile(info);
 		if (info.codeRevision.empty()) {
@@ -824,10 +929,22 @@ protected:
 		}
 	}
 
-	string serializeEnvvarsFromPoolOptions(const Options &options) const {
+	/**
+	 * Serializes the environment variables that spawn-preparer sets.
+	 * If the login shell's environment was taken from the ShellEnvvarsCache,
+	 * then it is included too, with lower precedence than the variables
+	 * from the options.
+	 */
+	string serializeEnvvarsFromPoolOptions(const Options &options,
+		const SpawnPreparationInfo &preparation) const
+	{
 		vector< pair<StaticString, StaticString> >::const_iterator it, end;
 		string result;
 
+		if (preparation.shellEnvvarsSource == SES_CACHE) {
+			result.append(preparation.cachedShellEnvvars);
+		}
+
 		appendNullTerminatedKeyValue(result, "IN_PASSENGER", "1");
 		appendNullTerminatedKeyValue(result, "PYTHONUNBUFFERED", "1");
 		appendNullTerminatedKeyValue(result, "NODE_PATH", config->resourceLocator->getNodeLibDir());
@@ -39,6 +39,7 @@
 
 #include <Logging.h>
 #include <Exceptions.h>
+#include <UstRouterBinaryProtocol.h>
 #include <Utils/IOUtils.h>
 #include <Utils/MessageIO.h>
 
@@ -92,8 +93,19 @@ struct Connection: public boost::noncopyable {
 	mutable boost::mutex syncher;
 	int fd;
 
-	Connection(int _fd)
-		: fd(_fd)
+	/**
+	 * Whether the UstRouter accepted binary framing during 'init'.
+	 * See UstRouterBinaryProtocol.h.
+	 */
+	bool binaryProtocol;
+	/** IDs of the strings that have been defined on this connection. */
+	UstRouterBinaryProtocol::StringTable strings;
+	/** Scratch buffer for building frames, reused to avoid allocations. */
+	string frameBuffer;
+
+	Connection(int _fd, bool _binaryProtocol = false)
+		: fd(_fd),
+		  binaryProtocol(_binaryProtocol)
 		{ }
 
 	~Connection() {
@@ -40,6 +40,7 @@
 #include <Logging.h>
 #include <Exceptions.h>
 #include <StaticString.h>
+#include <UstRouterBinaryProtocol.h>
 #include <Utils.h>
 #include <Utils/MessageIO.h>
 #include <Utils/SystemTime.h>
@@ -79,6 +80,8 @@ private:
 	 * will fail. Calculated from reconnectTimeout.
 	 */
 	unsigned long long nextReconnectTime;
+	/** Whether to negotiate binary framing with the UstRouter. */
+	bool binaryProtocol;
 
 	static string determineNodeName(const string &givenNodeName) {
 		if (givenNodeName.empty()) {
@@ -103,9 +106,37 @@ private:
 		nullTransaction   = boost::make_shared<Transaction>();
 		reconnectTimeout  = 1000000;
 		nextReconnectTime = 0;
+		binaryProtocol    = true;
 	}
 
 	ConnectionPtr createNewConnection() {
+		boost::unique_lock<boost::mutex> l(syncher);
+		bool binary = binaryProtocol;
+		l.unlock();
+
+		if (binary) {
+			ConnectionPtr connection = createNewConnection(true);
+			if (connection != NULL) {
+				return connection;
+			}
+
+			// The UstRouter is too old to know about binary framing.
+			// It closes the connection after rejecting 'init', so
+			// reconnect and don't ask again.
+			P_DEBUG("The UstRouter at " << serverAddress << " does not support "
+				"binary framing; falling back to the text protocol");
+			l.lock();
+			binaryProtocol = false;
+			l.unlock();
+		}
+		return createNewConnection(false);
+	}
+
+	/**
+	 * Connects, authenticates and initializes the session. Returns NULL if
+	 * <tt>binary</tt> is true and the UstRouter rejected the 'init' command.
+	 */
+	ConnectionPtr createNewConnection(bool binary) {
 		TRACE_POINT();
 		int fd;
 		vector<string> args;
@@ -154,13 +185,19 @@ private:
 
 		// Initialize session.
 		UPDATE_TRACE_POINT();
-		writeArrayMessage(fd, &timeout, "init", nodeName.c_str(), NULL);
+		if (binary) {
+			writeArrayMessage(fd, &timeout, "init", nodeName.c_str(), "binary", NULL);
+		} else {
+			writeArrayMessage(fd, &timeout, "init", nodeName.c_str(), NULL);
+		}
 		if (!readArrayMessage(fd, args, &timeout)) {
 			throw SystemException("Cannot connect to the UstRouter", ECONNREFUSED);
 		} else if (args.size() < 2 || args[0] != "status") {
 			throw IOException("The UstRouter returned an invalid reply for the 'init' command");
 		} else if (args[1] == "ok") {
-			// Do nothing
+			binary = args.size() >= 3 && args[2] == "binary";
+		} else if (args[1] == "error" && binary) {
+			return ConnectionPtr();
 		} else if (args[1] == "error") {
 			if (args.size() >= 3) {
 				throw IOException("The UstRouter denied client initialization: " + args[2]);
@@ -171,11 +208,54 @@ private:
 			throw IOException("The UstRouter returned an invalid reply for the 'init' command");
 		}
 
-		ConnectionPtr connection = boost::make_shared<Connection>(fd);
+		ConnectionPtr connection = boost::make_shared<Connection>(fd, binary);
 		guard.clear();
 		return connection;
 	}
 
+	/**
+	 * Writes an array message, or the given frames if <tt>argsSend</tt> is NULL.
+	 */
+	static void writeRequest(const ConnectionPtr &connection, const StaticString argsSend[],
+		unsigned int nrArgsSend, const StaticString &frames, unsigned long long *timeout)
+	{
+		if (argsSend != NULL) {
+			writeArrayMessage(connection->fd, argsSend, nrArgsSend, timeout);
+		} else {
+			writeExact(connection->fd, frames, timeout);
+		}
+	}
+
+	/**
+	 * Appends an OPEN_TRANSACTION frame, and DEFINE_STRING frames for any of
+	 * its strings that are new to this connection, to the connection's frame
+	 * buffer. The connection must be checked out by the caller.
+	 */
+	static void buildOpenTransactionFrames(Connection &connection, const StaticString &txnId,
+		const StaticString &groupName, const StaticString &category,
+		const StaticString &unionStationKey, const StaticString &filters,
+		unsigned long long timestamp, bool ack)
+	{
+		using namespace UstRouterBinaryProtocol;
+		string &buffer = connection.frameBuffer;
+
+		buffer.clear();
+		boost::uint16_t groupId = connection.strings.lookup(groupName, buffer);
+		boost::uint16_t categoryId = connection.strings.lookup(category, buffer);
+		boost::uint16_t keyId = connection.strings.lookup(unionStationKey, buffer);
+		boost::uint16_t filtersId = connection.strings.lookup(filters, buffer);
+
+		FrameBuilder frame(buffer, OPEN_TRANSACTION);
+		frame.appendUint8(CRASH_PROTECT | (ack ? ACK : 0));
+		frame.appendUint64(timestamp);
+		frame.appendUint16(groupId);
+		frame.appendUint16(categoryId);
+		frame.appendUint16(keyId);
+		frame.appendUint16(filtersId);
+		frame.appendSizedString(txnId);
+		frame.finish();
+	}
+
 public:
 	Core() {
 		initialize();
@@ -280,6 +360,17 @@ public:
 
 	bool sendRequest(const ConnectionPtr &connection, StaticString argsSend[],
 			unsigned int nrArgsSend)
+	{
+		return sendRequest(connection, argsSend, nrArgsSend, StaticString());
+	}
+
+	/** Sends already built binary frames. */
+	bool sendFrames(const ConnectionPtr &connection, const StaticString &frames) {
+		return sendRequest(connection, NULL, 0, frames);
+	}
+
+	bool sendRequest(const ConnectionPtr &connection, const StaticString argsSend[],
+		unsigned int nrArgsSend, const StaticString &frames)
 	{
 		ConnectionLock cl(connection);
 		ConnectionGuard guard(connection.get());
@@ -287,7 +378,7 @@ public:
 		try {
 			unsigned long long timeout = 15000000;
 
-			writeArrayMessage(connection->fd, argsSend, nrArgsSend, &timeout);
+			writeRequest(connection, argsSend, nrArgsSend, frames, &timeout);
 
 			guard.clear();
 			return true;
@@ -303,6 +394,24 @@ public:
 	bool sendRequestGetResponse(const ConnectionPtr &connection,
 		StaticString argsSend[], unsigned int nrArgsSend,
 		vector<string> &argsReply, unsigned int expectedExtraReplyArgs = 0)
+	{
+		return sendRequestGetResponse(connection, argsSend, nrArgsSend,
+			StaticString(), argsReply, expectedExtraReplyArgs);
+	}
+
+	/** Sends already built binary frames and reads the reply. */
+	bool sendFramesGetResponse(const ConnectionPtr &connection,
+		const StaticString &frames, vector<string> &argsReply,
+		unsigned int expectedExtraReplyArgs = 0)
+	{
+		return sendRequestGetResponse(connection, NULL, 0, frames,
+			argsReply, expectedExtraReplyArgs);
+	}
+
+	bool sendRequestGetResponse(const ConnectionPtr &connection,
+		const StaticString argsSend[], unsigned int nrArgsSend,
+		const StaticString &frames, vector<string> &argsReply,
+		unsigned int expectedExtraReplyArgs)
 	{
 		ConnectionLock cl(connection);
 		ConnectionGuard guard(connection.get());
@@ -310,7 +419,7 @@ public:
 		try {
 			unsigned long long timeout = 15000000;
 
-			writeArrayMessage(connection->fd, argsSend, nrArgsSend, &timeout);
+			writeRequest(connection, argsSend, nrArgsSend, frames, &timeout);
 
 			if (!readArrayMessage(connection->fd, argsReply, &timeout)) {
 				boost::lock_guard<boost::mutex> l(syncher);
@@ -423,7 +532,16 @@ public:
 
 		// The router will generate a txnId for us and pass it in the response.
 		vector<string> argsReply;
-		if (sendRequestGetResponse(connection, params, nparams, argsReply, 1)) {
+		bool sent;
+		if (connection->binaryProtocol) {
+			buildOpenTransactionFrames(*connection, StaticString(), groupName,
+				category, unionStationKey, filters, timestamp, true);
+			sent = sendFramesGetResponse(connection, connection->frameBuffer,
+				argsReply, 1);
+		} else {
+			sent = sendRequestGetResponse(connection, params, nparams, argsReply, 1);
+		}
+		if (sent) {
 			string txnId = argsReply[2];
 			ConnectionGuard guard(connection.get());
 			TransactionPtr transaction = boost::make_shared<Transaction>(
@@ -454,8 +572,9 @@ public:
 		}
 
 		// Prepare parameters.
+		unsigned long long timestamp = SystemTime::getUsec();
 		char timestampStr[2 * sizeof(unsigned long long) + 1];
-		integerToHexatri<unsigned long long>(SystemTime::getUsec(), timestampStr);
+		integerToHexatri<unsigned long long>(timestamp, timestampStr);
 
 		StaticString params[] = {
 			StaticString("openTransaction", sizeof("openTransaction") - 1),
@@ -479,7 +598,15 @@ public:
 		}
 
 		// We didn't ask for a response (ack), so just send here.
-		if (sendRequest(connection, params, nparams)) {
+		bool sent;
+		if (connection->binaryProtocol) {
+			buildOpenTransactionFrames(*connection, txnId, groupName,
+				category, unionStationKey, StaticString(), timestamp, false);
+			sent = sendFrames(connection, connection->frameBuffer);
+		} else {
+			sent = sendRequest(connection, params, nparams);
+		}
+		if (sent) {
 			ConnectionGuard guard(connection.get());
 			TransactionPtr transaction = boost::make_shared<Transaction>(
 				shared_from_this(),
@@ -503,6 +630,15 @@ public:
 		reconnectTimeout = usec;
 	}
 
+	/**
+	 * Sets whether new connections negotiate binary framing with the
+	 * UstRouter. Enabled by default. Existing connections are not affected.
+	 */
+	void setBinaryProtocol(bool enabled) {
+		boost::lock_guard<boost::mutex> l(syncher);
+		binaryProtocol = enabled;
+	}
+
 	bool isNull() const {
 		return serverAddress.empty();
 	}
@@ -39,6 +39,7 @@
 #include <Logging.h>
 #include <Exceptions.h>
 #include <StaticString.h>
+#include <UstRouterBinaryProtocol.h>
 #include <Utils/IOUtils.h>
 #include <Utils/SystemTime.h>
 #include <Utils/StrIntUtils.h>
@@ -106,6 +107,22 @@ private:
 		return buffer;
 	}
 
+	/**
+	 * Builds a LOG or CLOSE_TRANSACTION frame in the connection's frame buffer.
+	 * The caller must hold the connection lock.
+	 */
+	void buildFrame(UstRouterBinaryProtocol::FrameType type, unsigned long long timestamp,
+		size_t trailingSize = 0)
+	{
+		string &buffer = connection->frameBuffer;
+		buffer.clear();
+		UstRouterBinaryProtocol::FrameBuilder frame(buffer, type);
+		frame.appendUint8(0);
+		frame.appendUint64(timestamp);
+		frame.appendSizedString(txnId);
+		frame.finish(trailingSize);
+	}
+
 	template<typename ExceptionType>
 	void handleException(const ExceptionType &e) {
 		switch (exceptionHandlingMode) {
@@ -158,19 +175,24 @@ public:
 			return;
 		}
 
-		char timestamp[2 * sizeof(unsigned long long) + 1];
-		integerToHexatri<unsigned long long>(SystemTime::getUsec(),
-			timestamp);
+		unsigned long long now = SystemTime::getUsec();
 
 		UPDATE_TRACE_POINT();
 		ConnectionGuard guard(connection.get());
 		try {
 			unsigned long long timeout = IO_TIMEOUT;
-			writeArrayMessage(connection->fd, &timeout,
-				"closeTransaction",
-				txnId.c_str(),
-				timestamp,
-				NULL);
+			if (connection->binaryProtocol) {
+				buildFrame(UstRouterBinaryProtocol::CLOSE_TRANSACTION, now);
+				writeExact(connection->fd, connection->frameBuffer, &timeout);
+			} else {
+				char timestamp[2 * sizeof(unsigned long long) + 1];
+				integerToHexatri<unsigned long long>(now, timestamp);
+				writeArrayMessage(connection->fd, &timeout,
+					"closeTransaction",
+					txnId.c_str(),
+					timestamp,
+					NULL);
+			}
 
 			if (shouldFlushToDiskAfterClose) {
 				UPDATE_TRACE_POINT();
@@ -202,20 +224,29 @@ public:
 			return;
 		}
 
-		char timestamp[2 * sizeof(unsigned long long) + 1];
-		integerToHexatri<unsigned long long>(SystemTime::getUsec(), timestamp);
+		unsigned long long now = SystemTime::getUsec();
 
 		UPDATE_TRACE_POINT();
 		ConnectionGuard guard(connection.get());
 		try {
 			unsigned long long timeout = IO_TIMEOUT;
-			P_TRACE(3, "[Union Station log] " << txnId << " " << timestamp << " " << text);
-			writeArrayMessage(connection->fd, &timeout,
-				"log",
-				txnId.c_str(),
-				timestamp,
-				NULL);
-			writeScalarMessage(connection->fd, text, &timeout);
+			P_TRACE(3, "[Union Station log] " << txnId << " " << now << " " << text);
+			if (connection->binaryProtocol) {
+				// The text is written right after the frame header
+				// instead of being copied into the frame buffer.
+				buildFrame(UstRouterBinaryProtocol::LOG, now, text.size());
+				StaticString data[2] = { connection->frameBuffer, text };
+				gatheredWrite(connection->fd, data, 2, &timeout);
+			} else {
+				char timestamp[2 * sizeof(unsigned long long) + 1];
+				integerToHexatri<unsigned long long>(now, timestamp);
+				writeArrayMessage(connection->fd, &timeout,
+					"log",
+					txnId.c_str(),
+					timestamp,
+					NULL);
+				writeScalarMessage(connection->fd, text, &timeout);
+			}
 			guard.clear();
 		} catch (const std::exception &e) {
 			UPDATE_TRACE_POINT();
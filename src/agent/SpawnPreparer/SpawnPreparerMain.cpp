@@ -27,6 +27,8 @@
 /*
  * Sets given environment variables, dumps the entire environment to
  * a given file (for diagnostics purposes), then execs the given command.
+ * If asked to, it also saves the environment that the login shell set up,
+ * so that SpawningKit can cache it for subsequent spawns.
  *
  * This is a separate executable because it does quite
  * some non-async-signal-safe stuff that we can't do after
@@ -96,6 +98,41 @@ setGivenEnvVars(const char *envvarsData) {
 	}
 }
 
+/**
+ * Saves the environment, as set up by the login shell that we were executed
+ * through, to $PASSENGER_DEBUG_DIR/.shell_envvars as null-terminated
+ * key-value pairs. The file name starts with a dot so that it is not
+ * included in error pages.
+ */
+static void
+captureShellEnvvars() {
+	const char *c_dir;
+	if (getenv("PASSENGER_CAPTURE_SHELL_ENVVARS") == NULL) {
+		return;
+	}
+	unsetenv("PASSENGER_CAPTURE_SHELL_ENVVARS");
+	if ((c_dir = getenv("PASSENGER_DEBUG_DIR")) == NULL) {
+		return;
+	}
+
+	string dir = c_dir;
+	FILE *f = fopen((dir + "/.shell_envvars").c_str(), "w");
+	if (f != NULL) {
+		int i = 0;
+		while (environ[i] != NULL) {
+			const char *separator = strchr(environ[i], '=');
+			if (separator != NULL) {
+				fwrite(environ[i], 1, separator - environ[i], f);
+				putc('\0', f);
+				fputs(separator + 1, f);
+				putc('\0', f);
+			}
+			i++;
+		}
+		fclose(f);
+	}
+}
+
 static void
 dumpInformation() {
 	const char *c_dir;
@@ -189,6 +226,7 @@ spawnPreparerMain(int argc, char *argv[]) {
 	const char *executable = argv[ARG_OFFSET + 3];
 	char **execArgs = &argv[ARG_OFFSET + 4];
 
+	captureShellEnvvars();
 	changeWorkingDir(workingDir);
 	setGivenEnvVars(envvars);
 	dumpInformation();
@@ -73,6 +73,7 @@ usage() {
 	printf("        --no-general       Do not display general metrics\n");
 	printf("        --no-cpu           Do not display CPU metrics\n");
 	printf("        --no-memory        Do not display memory metrics\n");
+	printf("        --no-pressure      Do not display pressure stall metrics\n");
 	printf("        --force-colors     Display colors even if stdout is not a TTY\n");
 	printf("    -w  --watch INTERVAL   Reprint metrics every INTERVAL seconds\n");
 	printf("        --stdin            Reprint metrics every time a newline is received on\n");
@@ -105,6 +106,10 @@ parseOptions(int argc, char *argv[]) {
 			options.xmlOptions.memory = false;
 			options.descOptions.memory = false;
 			i++;
+		} else if (isFlag(argv[i], '\0', "--no-pressure")) {
+			options.xmlOptions.pressure = false;
+			options.descOptions.pressure = false;
+			i++;
 		} else if (isFlag(argv[i], '\0', "--force-colors")) {
 			options.descOptions.colors = true;
 			i++;
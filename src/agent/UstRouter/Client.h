@@ -28,6 +28,8 @@
 
 #include <set>
 #include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
 #include <UstRouter/Transaction.h>
 #include <ServerKit/Server.h>
 #include <MessageReadersWriters.h>
@@ -45,7 +47,8 @@ public:
 		READING_AUTH_USERNAME,
 		READING_AUTH_PASSWORD,
 		READING_MESSAGE,
-		READING_MESSAGE_BODY
+		READING_MESSAGE_BODY,
+		READING_FRAME
 	};
 
 	enum Type {
@@ -60,6 +63,18 @@ public:
 	Type type;
 	string nodeName;
 
+	/**
+	 * Whether this client negotiated binary framing during 'init'.
+	 * See UstRouterBinaryProtocol.h.
+	 */
+	bool binaryProtocol;
+	/** Whether arrayReader has been fed part of a message. */
+	bool readingArrayMessage;
+	/** Type of the frame that is currently being read. */
+	boost::uint8_t frameType;
+	/** Strings defined through DEFINE_STRING frames, indexed by ID. */
+	vector<string> strings;
+
 	/**
 	 * Set of transaction IDs opened by this client.
 	 * @invariant This is a subset of the transaction IDs in the 'transactions' member.
@@ -86,6 +101,8 @@ public:
 			return "READING_MESSAGE";
 		case READING_MESSAGE_BODY:
 			return "READING_MESSAGE_BODY";
+		case READING_FRAME:
+			return "READING_FRAME";
 		default:
 			return "UNKNOWN";
 		}
@@ -39,11 +39,13 @@
 #include <StaticString.h>
 #include <Constants.h>
 #include <Logging.h>
+#include <RandomGenerator.h>
 #include <UstRouter/Transaction.h>
 #include <UstRouter/Client.h>
 #include <UstRouter/FileSink.h>
 #include <UstRouter/RemoteSink.h>
 #include <UnionStationFilterSupport.h>
+#include <UstRouterBinaryProtocol.h>
 #include <MessageReadersWriters.h>
 #include <Utils.h>
 #include <Utils/StrIntUtils.h>
@@ -191,7 +193,18 @@ private:
 	Channel::Result onMessageDataReceived(Client *client, const MemoryKit::mbuf &buffer,
 		int errcode)
 	{
+		if (client->binaryProtocol
+		 && !client->readingArrayMessage
+		 && UstRouterBinaryProtocol::isFrameType(buffer.start[0]))
+		{
+			// Control continues in onFrameDataReceived().
+			client->frameType = buffer.start[0];
+			client->state = Client::READING_FRAME;
+			return Channel::Result(1, false);
+		}
+
 		size_t consumed = client->arrayReader.feed(buffer.start, buffer.size());
+		client->readingArrayMessage = !client->arrayReader.done();
 
 		if (client->arrayReader.hasError()) {
 			disconnectWithError(&client,
@@ -270,7 +283,6 @@ private:
 		StaticString txnId, timestamp;
 		bool ack;
 		TransactionPtr transaction;
-		set<string>::iterator s_it;
 
 		if (OXT_UNLIKELY(!expectingMinArgumentsCount(client, args, 3)
 		              || !expectingLoggerType(client)))
@@ -282,28 +294,8 @@ private:
 		timestamp = args[2];
 		ack       = getBool(args, 3, false);
 
-		transaction = transactions.get(txnId);
+		transaction = findTransactionForLogging(client, txnId, ack);
 		if (OXT_UNLIKELY(transaction == NULL)) {
-			SKC_ERROR(client, "Cannot log data: transaction does not exist");
-			if (ack) {
-				sendErrorToClient(client, "Cannot log data: transaction does not exist");
-				if (client->connected()) {
-					disconnect(&client);
-				}
-			}
-			goto done;
-		}
-
-		s_it = client->openTransactions.find(transaction->txnId);
-		if (OXT_UNLIKELY(s_it == client->openTransactions.end())) {
-			SKC_ERROR(client, "Cannot log data: transaction not opened in this connection");
-			if (ack) {
-				sendErrorToClient(client,
-					"Cannot log data: transaction not opened in this connection");
-				if (client->connected()) {
-					disconnect(&client);
-				}
-			}
 			goto done;
 		}
 
@@ -360,6 +352,43 @@ private:
 		}
 	}
 
+	/**
+	 * Looks up a transaction that the client wants to log data to. Returns NULL,
+	 * and reports the error to the client if it asked for an ack, if the
+	 * transaction does not exist or is not opened in this connection.
+	 */
+	TransactionPtr findTransactionForLogging(Client *client, const StaticString &txnId,
+		bool ack)
+	{
+		TransactionPtr transaction = transactions.get(txnId);
+		if (OXT_UNLIKELY(transaction == NULL)) {
+			SKC_ERROR(client, "Cannot log data: transaction does not exist");
+			if (ack) {
+				sendErrorToClient(client, "Cannot log data: transaction does not exist");
+				if (client->connected()) {
+					disconnect(&client);
+				}
+			}
+			return TransactionPtr();
+		}
+
+		if (OXT_UNLIKELY(client->openTransactions.find(transaction->txnId)
+			== client->openTransactions.end()))
+		{
+			SKC_ERROR(client, "Cannot log data: transaction not opened in this connection");
+			if (ack) {
+				sendErrorToClient(client,
+					"Cannot log data: transaction not opened in this connection");
+				if (client->connected()) {
+					disconnect(&client);
+				}
+			}
+			return TransactionPtr();
+		}
+
+		return transaction;
+	}
+
 	void processOpenTransactionMessage(Client *client, const vector<StaticString> &args) {
 		if (OXT_UNLIKELY(!expectingMinArgumentsCount(client, args, 7)
 		              || !expectingLoggerType(client)))
@@ -367,16 +396,24 @@ private:
 			return;
 		}
 
-		StaticString txnId     = args[1];
-		StaticString groupName = args[2];
-		StaticString nodeName  = args[3];
-		StaticString category  = args[4];
-		StaticString timestamp = args[5];
-		StaticString unionStationKey = args[6];
-		bool         crashProtect    = getBool(args, 7, true);
-		bool         ack             = getBool(args, 8, false);
-		StaticString filters         = getStaticString(args, 9);
+		openTransaction(client,
+			args[1],                        // txnId
+			args[2],                        // groupName
+			args[3],                        // nodeName
+			args[4],                        // category
+			args[5],                        // timestamp
+			args[6],                        // unionStationKey
+			getBool(args, 7, true),         // crashProtect
+			getBool(args, 8, false),        // ack
+			getStaticString(args, 9));      // filters
+	}
 
+	void openTransaction(Client *client, StaticString txnId,
+		const StaticString &groupName, StaticString nodeName,
+		const StaticString &category, const StaticString &timestamp,
+		const StaticString &unionStationKey, bool crashProtect, bool ack,
+		const StaticString &filters)
+	{
 		TransactionPtr transaction;
 		char autogeneratedTxnIdBuf[TXN_ID_MAX_SIZE];
 		char *autogeneratedTxnIdBufEnd;
@@ -533,20 +570,23 @@ private:
 	}
 
 	void processCloseTransactionMessage(Client *client, const vector<StaticString> &args) {
-		StaticString txnId, timestamp;
-		bool ack;
-		set<string>::const_iterator s_it;
-		TransactionPtr transaction;
-
 		if (OXT_UNLIKELY(!expectingMinArgumentsCount(client, args, 3)
 		              || !expectingLoggerType(client)))
 		{
-			goto done;
+			return;
 		}
 
-		txnId     = args[1];
-		timestamp = args[2];
-		ack       = getBool(args, 3, false);
+		closeTransaction(client,
+			args[1],                        // txnId
+			args[2],                        // timestamp
+			getBool(args, 3, false));       // ack
+	}
+
+	void closeTransaction(Client *client, const StaticString &txnId,
+		const StaticString &timestamp, bool ack)
+	{
+		set<string>::const_iterator s_it;
+		TransactionPtr transaction;
 
 		transaction = transactions.get(txnId);
 		if (OXT_UNLIKELY(transaction == NULL)) {
@@ -604,13 +644,23 @@ private:
 			}
 			goto done;
 		}
-		if (OXT_UNLIKELY(!expectingArgumentsCount(client, args, 2))) {
+		if (OXT_UNLIKELY(!expectingMinArgumentsCount(client, args, 2))) {
 			goto done;
 		}
 
 		client->nodeName = args[1];
 		client->type = Client::LOGGER;
-		sendOkToClient(client);
+		if (getStaticString(args, 2) == P_STATIC_STRING("binary")) {
+			StaticString reply[] = {
+				P_STATIC_STRING("status"),
+				P_STATIC_STRING("ok"),
+				P_STATIC_STRING("binary")
+			};
+			client->binaryProtocol = true;
+			writeArrayMessage(client, reply, 3);
+		} else {
+			sendOkToClient(client);
+		}
 
 		done:
 		if (client != NULL && client->connected()) {
@@ -667,6 +717,180 @@ private:
 	}
 
 
+	/****** Binary frame handling ******/
+
+	Channel::Result onFrameDataReceived(Client *client, const MemoryKit::mbuf &buffer,
+		int errcode)
+	{
+		size_t consumed = client->scalarReader.feed(buffer.start, buffer.size());
+
+		if (client->scalarReader.hasError()) {
+			disconnectWithError(&client,
+				string("Error processing frame: ")
+				+ client->scalarReader.errorString());
+			return Channel::Result(consumed, true);
+		}
+
+		if (client->scalarReader.done()) {
+			client->state = Client::READING_MESSAGE;
+			processFrame(client, client->scalarReader.value());
+			client->scalarReader.reset();
+		}
+		return Channel::Result(consumed, false);
+	}
+
+	void processFrame(Client *client, const StaticString &payload) {
+		using namespace UstRouterBinaryProtocol;
+		FrameParser parser(payload);
+		bool ok;
+
+		try {
+			switch (client->frameType) {
+			case DEFINE_STRING:
+				ok = processDefineStringFrame(client, parser);
+				break;
+			case OPEN_TRANSACTION:
+				ok = processOpenTransactionFrame(client, parser);
+				break;
+			case LOG:
+				ok = processLogFrame(client, parser);
+				break;
+			case CLOSE_TRANSACTION:
+				ok = processCloseTransactionFrame(client, parser);
+				break;
+			default:
+				disconnectWithError(&client, "Error processing frame: unknown frame type "
+					+ toString((int) client->frameType));
+				return;
+			}
+		} catch (const oxt::tracable_exception &e) {
+			SKC_ERROR(client, "Exception: " << e.what() << "\n" << e.backtrace());
+			if (client->connected()) {
+				disconnect(&client);
+			}
+			return;
+		}
+
+		if (!ok && client->connected()) {
+			disconnectWithError(&client, "Error processing frame: invalid payload");
+		}
+	}
+
+	bool processDefineStringFrame(Client *client,
+		UstRouterBinaryProtocol::FrameParser &parser)
+	{
+		boost::uint16_t id;
+
+		if (!parser.readUint16(id) || id >= UstRouterBinaryProtocol::MAX_STRINGS) {
+			return false;
+		}
+		if (id >= client->strings.size()) {
+			client->strings.resize(id + 1);
+		}
+		client->strings[id] = parser.rest();
+		return true;
+	}
+
+	bool processOpenTransactionFrame(Client *client,
+		UstRouterBinaryProtocol::FrameParser &parser)
+	{
+		using namespace UstRouterBinaryProtocol;
+		boost::uint8_t flags;
+		boost::uint64_t timestamp;
+		boost::uint16_t groupId, categoryId, keyId, filtersId;
+		StaticString txnId, groupName, category, unionStationKey, filters;
+		char timestampStr[2 * sizeof(unsigned long long) + 1];
+
+		if (!parser.readUint8(flags)
+		 || !parser.readUint64(timestamp)
+		 || !parser.readUint16(groupId)
+		 || !parser.readUint16(categoryId)
+		 || !parser.readUint16(keyId)
+		 || !parser.readUint16(filtersId)
+		 || !parser.readSizedString(txnId)
+		 || !lookupString(client, groupId, groupName)
+		 || !lookupString(client, categoryId, category)
+		 || !lookupString(client, keyId, unionStationKey)
+		 || !lookupString(client, filtersId, filters))
+		{
+			return false;
+		}
+
+		openTransaction(client, txnId, groupName, StaticString(), category,
+			StaticString(timestampStr, integerToHexatri<unsigned long long>(
+				timestamp, timestampStr)),
+			unionStationKey,
+			flags & CRASH_PROTECT,
+			flags & ACK,
+			filters);
+		return true;
+	}
+
+	bool processLogFrame(Client *client, UstRouterBinaryProtocol::FrameParser &parser) {
+		boost::uint8_t flags;
+		boost::uint64_t timestamp;
+		StaticString txnId;
+		char timestampStr[2 * sizeof(unsigned long long) + 1];
+
+		if (!parser.readUint8(flags)
+		 || !parser.readUint64(timestamp)
+		 || !parser.readSizedString(txnId))
+		{
+			return false;
+		}
+
+		bool ack = flags & UstRouterBinaryProtocol::ACK;
+		TransactionPtr transaction = findTransactionForLogging(client, txnId, ack);
+		if (OXT_UNLIKELY(transaction == NULL)) {
+			return true;
+		}
+
+		writeLogEntry(client, transaction,
+			StaticString(timestampStr, integerToHexatri<unsigned long long>(
+				timestamp, timestampStr)),
+			parser.rest(),
+			ack);
+		if (ack && client->connected()) {
+			sendOkToClient(client);
+		}
+		return true;
+	}
+
+	bool processCloseTransactionFrame(Client *client,
+		UstRouterBinaryProtocol::FrameParser &parser)
+	{
+		boost::uint8_t flags;
+		boost::uint64_t timestamp;
+		StaticString txnId;
+		char timestampStr[2 * sizeof(unsigned long long) + 1];
+
+		if (!parser.readUint8(flags)
+		 || !parser.readUint64(timestamp)
+		 || !parser.readSizedString(txnId))
+		{
+			return false;
+		}
+
+		closeTransaction(client, txnId,
+			StaticString(timestampStr, integerToHexatri<unsigned long long>(
+				timestamp, timestampStr)),
+			flags & UstRouterBinaryProtocol::ACK);
+		return true;
+	}
+
+	bool lookupString(Client *client, boost::uint16_t id, StaticString &result) {
+		if (id == UstRouterBinaryProtocol::NO_STRING) {
+			result = StaticString();
+			return true;
+		} else if (id < client->strings.size()) {
+			result = client->strings[id];
+			return true;
+		} else {
+			return false;
+		}
+	}
+
+
 	/****** Periodic tasks ******/
 
 	/**
@@ -1039,12 +1263,15 @@ protected:
 		client->scalarReader.setMaxSize(1024 * 1024);
 		client->state = Client::READING_AUTH_USERNAME;
 		client->type = Client::UNINITIALIZED;
+		client->binaryProtocol = false;
+		client->readingArrayMessage = false;
 	}
 
 	virtual void deinitializeClient(Client *client) {
 		client->arrayReader.reset();
 		client->scalarReader.reset();
 		client->nodeName.clear();
+		client->strings.clear();
 
 		set<string>::const_iterator s_it;
 		set<string>::const_iterator s_end = client->openTransactions.end();
@@ -1097,6 +1324,8 @@ protected:
 			return onMessageDataReceived(client, buffer, errcode);
 		case Client::READING_MESSAGE_BODY:
 			return onMessageBodyDataReceived(client, buffer, errcode);
+		case Client::READING_FRAME:
+			return onFrameDataReceived(client, buffer, errcode);
 		default:
 			P_BUG("Unknown state " << client->state);
 			return Channel::Result(0, false); // Never reached
@@ -1109,6 +1338,24 @@ protected:
 		ParentClass::onShutdown(forceDisconnect);
 	}
 
+	static RemoteSenderOptions createRemoteSenderOptions(const VariantMap &options) {
+		RemoteSenderOptions result;
+		result.gatewayAddress = options.get("union_station_gateway_address", false,
+			DEFAULT_UNION_STATION_GATEWAY_ADDRESS);
+		result.gatewayPort = options.getInt("union_station_gateway_port", false,
+			DEFAULT_UNION_STATION_GATEWAY_PORT);
+		result.certificate = options.get("union_station_gateway_cert", false, "");
+		result.proxyAddress = options.get("union_station_proxy_address", false);
+		result.maxConnections = options.getUint("union_station_max_connections", false,
+			result.maxConnections);
+		result.maxBatchSize = options.getUint("union_station_batch_size", false,
+			result.maxBatchSize);
+		result.maxBatchDelay = options.getUint("union_station_batch_delay", false,
+			result.maxBatchDelay);
+		result.spillDir = options.get("union_station_spill_dir", false, "");
+		return result;
+	}
+
 public:
 	Controller(ServerKit::Context *context, const VariantMap &options = VariantMap())
 		: ServerKit::BaseServer<Controller, Client>(context),
@@ -1116,11 +1363,7 @@ public:
 		  password(options.get("ust_router_password", false, "")),
 		  dumpDir(options.get("ust_router_dump_dir", false, "/tmp")),
 		  devMode(options.getBool("ust_router_dev_mode", false, false)),
-		  remoteSender(
-		      options.get("union_station_gateway_address", false, DEFAULT_UNION_STATION_GATEWAY_ADDRESS),
-		      options.getInt("union_station_gateway_port", false, DEFAULT_UNION_STATION_GATEWAY_PORT),
-		      options.get("union_station_gateway_cert", false, ""),
-		      options.get("union_station_proxy_address", false)),
+		  remoteSender(createRemoteSenderOptions(options)),
 		  gcTimer(getLoop()),
 		  flushTimer(getLoop())
 	{
@@ -1164,6 +1407,7 @@ public:
 		doc["state"] = client->getStateName();
 		doc["type"] = client->getTypeName();
 		doc["node_name"] = client->nodeName;
+		doc["binary_protocol"] = client->binaryProtocol;
 		doc["open_transactions_count"] = Json::UInt(client->openTransactions.size());
 
 		Json::Value openTransactions(Json::arrayValue);
@@ -69,6 +69,15 @@ ustRouterUsage() {
 	printf("      --dev-mode              Enable development mode: dump data to a directory\n");
 	printf("                              instead of sending them to the Union Station gateway\n");
 	printf("      --dump-dir  PATH        Directory to dump to\n");
+	printf("      --gateway-connections NUMBER\n");
+	printf("                              Maximum number of concurrent uploads to the Union\n");
+	printf("                              Station gateway. Default: 4\n");
+	printf("      --batch-size BYTES      Upload packets together until their uncompressed\n");
+	printf("                              size reaches this many bytes. Default: 1048576\n");
+	printf("      --batch-delay MSEC      Upload packets at the latest this many milliseconds\n");
+	printf("                              after the first one was queued. Default: 1000\n");
+	printf("      --spill-dir PATH        Store data on disk while the Union Station gateway\n");
+	printf("                              is unreachable, and send it when it's back\n");
 	printf("\n");
 	printf("Other options (optional):\n");
 	printf("      --user USERNAME         Lower privilege to the given user. Only has\n");
@@ -146,6 +155,18 @@ parseUstRouterOption(int argc, const char *argv[], int &i, VariantMap &options)
 	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--dump-dir")) {
 		options.set("ust_router_dump_dir", argv[i + 1]);
 		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--gateway-connections")) {
+		options.setInt("union_station_max_connections", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--batch-size")) {
+		options.setInt("union_station_batch_size", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--batch-delay")) {
+		options.setInt("union_station_batch_delay", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--spill-dir")) {
+		options.set("union_station_spill_dir", argv[i + 1]);
+		i += 2;
 	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--user")) {
 		options.set("analytics_log_user", argv[i + 1]);
 		i += 2;
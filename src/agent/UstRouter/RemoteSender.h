@@ -27,29 +27,49 @@
 #define _PASSENGER_REMOTE_SENDER_H_
 
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <cstdio>
+#include <climits>
 #include <ctime>
 #include <cassert>
 #include <curl/curl.h>
 #include <zlib.h>
 
 #include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
 #include <boost/bind.hpp>
 #include <boost/foreach.hpp>
+#include <boost/thread.hpp>
 #include <oxt/thread.hpp>
 #include <string>
 #include <list>
+#include <deque>
+#include <map>
+#include <vector>
+#include <algorithm>
 #include <jsoncpp/json.h>
 #include <modp_b64.h>
 
 #include <Logging.h>
+#include <Constants.h>
+#include <Exceptions.h>
 #include <StaticString.h>
 #include <Utils.h>
-#include <Utils/BlockingQueue.h>
+#include <Utils/IOUtils.h>
+#include <Utils/StrIntUtils.h>
 #include <Utils/SystemTime.h>
 #include <Utils/ScopeGuard.h>
 #include <Utils/JsonUtils.h>
+#include <Utils/SpeedMeter.h>
 #include <Utils/Curl.h>
 
+#if LIBCURL_VERSION_NUM >= 0x074400
+	// curl_multi_poll() and curl_multi_wakeup() exist since libcurl 7.68.
+	#define PASSENGER_HAS_CURL_MULTI_WAKEUP
+#endif
+
 namespace Passenger {
 
 using namespace std;
@@ -57,19 +77,144 @@ using namespace boost;
 using namespace oxt;
 
 
+struct RemoteSenderOptions {
+	string gatewayAddress;
+	unsigned short gatewayPort;
+	/** The certificate to verify the gateway with. Empty to disable verification. */
+	string certificate;
+	string proxyAddress;
+	/** Whether to talk to the gateway over HTTPS. Only tests turn this off. */
+	bool useHttps;
+	/** The maximum number of uploads to have in flight at the same time. */
+	unsigned int maxConnections;
+	/**
+	 * Packets with the same key, node name and category are coalesced into
+	 * a single upload until their uncompressed size reaches `maxBatchSize`
+	 * bytes, or until the oldest packet has waited for `maxBatchDelay` msec.
+	 */
+	unsigned int maxBatchSize;
+	unsigned int maxBatchDelay;
+	/** The maximum number of uncompressed bytes waiting to be sent. New
+	 * packets are dropped if this limit has been reached.
+	 */
+	size_t maxQueueMemory;
+	/** If not empty, batches that cannot be delivered because no gateway
+	 * servers are up are stored in this directory, and sent later.
+	 */
+	string spillDir;
+	size_t maxSpillSize;
+	/**
+	 * A batch that gateway servers fail to process is retried on another
+	 * server, up to this many servers in total. After that it is dropped
+	 * without marking those servers down, because the batch itself is
+	 * probably at fault.
+	 */
+	unsigned int maxBatchAttempts;
+
+	RemoteSenderOptions()
+		: gatewayAddress(DEFAULT_UNION_STATION_GATEWAY_ADDRESS),
+		  gatewayPort(DEFAULT_UNION_STATION_GATEWAY_PORT),
+		  useHttps(true),
+		  maxConnections(4),
+		  maxBatchSize(1024 * 1024),
+		  maxBatchDelay(1000),
+		  maxQueueMemory(64 * 1024 * 1024),
+		  maxSpillSize(1024 * 1024 * 1024),
+		  maxBatchAttempts(3)
+		{ }
+};
+
+/**
+ * Sends Union Station packets to the gateway servers in a background thread.
+ *
+ * Packets for the same key, node name and category are coalesced into
+ * batches, which are compressed and uploaded over up to
+ * `maxConnections` concurrent keep-alive connections using the curl
+ * multi interface. Batches are round-robin load balanced over all gateway
+ * servers that are up. If no servers are up, batches are spilled to disk
+ * (if a spill directory is configured) and uploaded once a server comes
+ * back.
+ *
+ * A server that fails to process a batch is not marked down right away,
+ * because the batch may be at fault instead. The batch is retried on
+ * other servers first: if another server accepts it, the servers that
+ * failed it are marked down; if it fails on `maxBatchAttempts` servers,
+ * it is dropped.
+ */
 class RemoteSender {
 private:
 	struct Item {
-		bool exit;
-		bool compressed;
 		string unionStationKey;
 		string nodeName;
 		string category;
 		string data;
+	};
+
+	/** Uncompressed data that is being coalesced into a batch. */
+	struct BatchBuilder {
+		string unionStationKey;
+		string nodeName;
+		string category;
+		vector<string> data;
+		size_t size;
+		unsigned long long startTime;
+
+		BatchBuilder()
+			: size(0),
+			  startTime(0)
+			{ }
+	};
+
+	class Server;
+	typedef boost::shared_ptr<Server> ServerPtr;
+
+	struct Batch {
+		string unionStationKey;
+		string nodeName;
+		string category;
+		string data;
+		unsigned int itemCount;
+		bool compressed;
+		/** The servers that failed to process this batch. */
+		vector<ServerPtr> failedServers;
+
+		Batch()
+			: itemCount(0),
+			  compressed(false)
+			{ }
+
+		bool failedOn(const ServerPtr &server) const {
+			return std::find(failedServers.begin(), failedServers.end(), server)
+				!= failedServers.end();
+		}
+	};
+
+	typedef boost::shared_ptr<Batch> BatchPtr;
+
+	struct SpillFile {
+		string path;
+		size_t size;
+	};
+
+	/** An upload slot. Each one owns a CURL easy handle, which curl keeps
+	 * a keep-alive connection alive for between uploads.
+	 */
+	struct Transfer {
+		CURL *curl;
+		ServerPtr server;
+		BatchPtr batch;
+		string base64Data;
+		struct curl_httppost *post;
+		string responseBody;
+		char lastCurlErrorMessage[CURL_ERROR_SIZE];
+		unsigned long long startTime;
 
-		Item() {
-			exit = false;
-			compressed = false;
+		Transfer()
+			: curl(NULL),
+			  post(NULL),
+			  startTime(0)
+		{
+			lastCurlErrorMessage[0] = '\0';
 		}
 	};
 
@@ -108,6 +253,7 @@ private:
 		string certificate;
 		const CurlProxyInfo *proxyInfo;
 
+		/** Only used for pinging. */
 		CURL *curl;
 		struct curl_slist *headers;
 		char lastCurlErrorMessage[CURL_ERROR_SIZE];
@@ -125,6 +271,33 @@ private:
 		unsigned int packetsAccepted;
 		unsigned int packetsRejected;
 		unsigned int packetsDropped;
+		unsigned long long bytesSent;
+		unsigned long long totalLatency;
+		unsigned long long lastLatency;
+		unsigned long long maxLatency;
+		SpeedMeter<double> throughputMeter;
+
+		void setupCurl(CURL *handle, char *errorBuffer, string *body) {
+			curl_easy_setopt(handle, CURLOPT_NOSIGNAL, 1);
+			curl_easy_setopt(handle, CURLOPT_TIMEOUT, 180);
+			curl_easy_setopt(handle, CURLOPT_ERRORBUFFER, errorBuffer);
+			curl_easy_setopt(handle, CURLOPT_HTTPHEADER, headers);
+			curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, curlDataReceived);
+			curl_easy_setopt(handle, CURLOPT_WRITEDATA, body);
+			if (certificate.empty()) {
+				curl_easy_setopt(handle, CURLOPT_SSL_VERIFYPEER, 0);
+			} else {
+				curl_easy_setopt(handle, CURLOPT_SSL_VERIFYPEER, 1);
+				curl_easy_setopt(handle, CURLOPT_CAINFO, certificate.c_str());
+			}
+			/* No host name verification because Curl thinks the
+			 * host name is the IP address. But if we have the
+			 * certificate then it doesn't matter.
+			 */
+			curl_easy_setopt(handle, CURLOPT_SSL_VERIFYHOST, 0);
+			setCurlProxy(handle, *proxyInfo);
+			body->clear();
+		}
 
 		void resetConnection() {
 			if (curl != NULL) {
@@ -141,30 +314,7 @@ private:
 					throw IOException("Unable to create a CURL handle");
 				}
 			}
-			curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1);
-			curl_easy_setopt(curl, CURLOPT_TIMEOUT, 180);
-			curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, lastCurlErrorMessage);
-			curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-			curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curlDataReceived);
-			curl_easy_setopt(curl, CURLOPT_WRITEDATA, this);
-			if (certificate.empty()) {
-				curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0);
-			} else {
-				curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 1);
-				curl_easy_setopt(curl, CURLOPT_CAINFO, certificate.c_str());
-			}
-			/* No host name verification because Curl thinks the
-			 * host name is the IP address. But if we have the
-			 * certificate then it doesn't matter.
-			 */
-			curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0);
-			setCurlProxy(curl, *proxyInfo);
-			responseBody.clear();
-		}
-
-		void prepareRequest(const string &url) {
-			curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-			responseBody.clear();
+			setupCurl(curl, lastCurlErrorMessage, &responseBody);
 		}
 
 		static bool validateResponse(const Json::Value &response) {
@@ -182,37 +332,38 @@ private:
 			}
 		}
 
-		SendResult handleSendResponse(const Item &item) {
+		SendResult handleSendResponse(const Transfer &transfer) {
+			const Batch &batch = *transfer.batch;
 			Json::Reader reader;
 			Json::Value response;
 			long httpCode = -1;
 
-			curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpCode);
+			curl_easy_getinfo(transfer.curl, CURLINFO_RESPONSE_CODE, &httpCode);
 
-			if (!reader.parse(responseBody, response, false) || !validateResponse(response)) {
+			if (!reader.parse(transfer.responseBody, response, false) || !validateResponse(response)) {
 				setRequestError(
 					"The Union Station gateway server " + ip +
 					" encountered an error while processing sent analytics data. "
-					"It sent an invalid response. Key: " + item.unionStationKey
+					"It sent an invalid response. Key: " + batch.unionStationKey
 					+ ". Parse error: " + reader.getFormattedErrorMessages()
 					+ "; HTTP code: " + toString(httpCode)
-					+ "; data: \"" + cEscapeString(responseBody) + "\"");
+					+ "; data: \"" + cEscapeString(transfer.responseBody) + "\"");
 				return SR_MALFUNCTION;
 			} else if (response["status"].asString() == "ok") {
 				if (httpCode == 200) {
-					handleResponseSuccess();
+					handleResponseSuccess(transfer);
 					P_DEBUG("The Union Station gateway server " << ip
 						<< " accepted the packet. Key: "
-						<< item.unionStationKey);
+						<< batch.unionStationKey);
 					return SR_OK;
 				} else {
 					setRequestError(
 						"The Union Station gateway server " + ip
 						+ " encountered an error while processing sent "
 						"analytics data. It sent an invalid response. Key: "
-						+ item.unionStationKey + ". HTTP code: "
+						+ batch.unionStationKey + ". HTTP code: "
 						+ toString(httpCode) + ". Data: \""
-						+ cEscapeString(responseBody) + "\"");
+						+ cEscapeString(transfer.responseBody) + "\"");
 					return SR_MALFUNCTION;
 				}
 			} else {
@@ -220,17 +371,17 @@ private:
 				setPacketRejectedError(
 					"The Union Station gateway server "
 					+ ip + " did not accept the sent analytics data. "
-					"Key: " + item.unionStationKey + ". "
+					"Key: " + batch.unionStationKey + ". "
 					"Error: " + response["message"].asString());
 				return SR_REJECTED;
 			}
 		}
 
-		void handleSendError(const Item &item) {
+		void handleSendError(const Transfer &transfer) {
 			setRequestError(
 				"Could not send data to Union Station gateway server " +
-				ip + ". It might be down. Key: " + item.unionStationKey +
-				". Error: " + lastCurlErrorMessage);
+				ip + ". It might be down. Key: " + transfer.batch->unionStationKey +
+				". Error: " + transfer.lastCurlErrorMessage);
 		}
 
 		void setPingError(const string &message) {
@@ -268,21 +419,33 @@ private:
 			lastErrorTime = SystemTime::getUsec();
 		}
 
-		void handleResponseSuccess() {
+		void handleResponseSuccess(const Transfer &transfer) {
 			boost::lock_guard<boost::mutex> l(syncher);
-			lastSuccessTime = SystemTime::getUsec();
+			unsigned long long now = SystemTime::getUsec();
+			unsigned long long latency = now - transfer.startTime;
+
+			lastSuccessTime = now;
 			packetsAccepted++;
+			bytesSent += transfer.batch->data.size();
+			throughputMeter.addSample(bytesSent, now);
+			totalLatency += latency;
+			lastLatency = latency;
+			maxLatency = std::max(maxLatency, latency);
 		}
 
 		static size_t curlDataReceived(void *buffer, size_t size, size_t nmemb, void *userData) {
-			Server *self = (Server *) userData;
-			self->responseBody.append((const char *) buffer, size * nmemb);
+			string *body = (string *) userData;
+			body->append((const char *) buffer, size * nmemb);
 			return size * nmemb;
 		}
 
+		static Json::Value latencyToJson(unsigned long long usec) {
+			return Json::Value(usec / 1000.0);
+		}
+
 	public:
 		Server(const string &ip, const string &hostName, unsigned short port,
-			const string &cert, const CurlProxyInfo *proxyInfo)
+			const string &cert, const CurlProxyInfo *proxyInfo, bool useHttps)
 		{
 			this->ip = ip;
 			this->port = port;
@@ -295,13 +458,18 @@ private:
 			if (headers == NULL) {
 				throw IOException("Unable to create a CURL linked list");
 			}
+			// Don't wait for a "100 Continue" before sending the batch.
+			headers = curl_slist_append(headers, "Expect:");
+			if (headers == NULL) {
+				throw IOException("Unable to create a CURL linked list");
+			}
 
 			// Older libcurl versions didn't strdup() any option
 			// strings so we need to keep these in memory.
-			pingURL = string("https://") + ip + ":" + toString(port) +
-				"/ping";
-			sinkURL = string("https://") + ip + ":" + toString(port) +
-				"/sink";
+			string baseURL = string(useHttps ? "https://" : "http://")
+				+ ip + ":" + toString(port);
+			pingURL = baseURL + "/ping";
+			sinkURL = baseURL + "/sink";
 
 			curl = NULL;
 			lastErrorTime = 0;
@@ -310,6 +478,10 @@ private:
 			packetsAccepted = 0;
 			packetsRejected = 0;
 			packetsDropped = 0;
+			bytesSent = 0;
+			totalLatency = 0;
+			lastLatency = 0;
+			maxLatency = 0;
 			resetConnection();
 		}
 
@@ -327,7 +499,8 @@ private:
 		bool ping() {
 			P_INFO("Pinging Union Station gateway " << ip << ":" << port);
 			ScopeGuard guard(boost::bind(&Server::resetConnection, this));
-			prepareRequest(pingURL);
+			curl_easy_setopt(curl, CURLOPT_URL, pingURL.c_str());
+			responseBody.clear();
 
 			curl_easy_setopt(curl, CURLOPT_HTTPGET, 1);
 			if (curl_easy_perform(curl) != 0) {
@@ -348,67 +521,77 @@ private:
 			}
 		}
 
-		SendResult send(const Item &item) {
-			ScopeGuard guard(boost::bind(&Server::resetConnection, this));
-			prepareRequest(sinkURL);
-
-			struct curl_httppost *post = NULL;
+		/**
+		 * Prepares the given transfer for uploading its batch to this server.
+		 * The caller must add the transfer's handle to a curl multi handle.
+		 */
+		void prepareSend(Transfer &transfer) {
+			const Batch &batch = *transfer.batch;
 			struct curl_httppost *last = NULL;
-			string base64_data;
 
-			curl_formadd(&post, &last,
+			setupCurl(transfer.curl, transfer.lastCurlErrorMessage, &transfer.responseBody);
+			curl_easy_setopt(transfer.curl, CURLOPT_URL, sinkURL.c_str());
+
+			transfer.post = NULL;
+			curl_formadd(&transfer.post, &last,
 				CURLFORM_PTRNAME, "key",
-				CURLFORM_PTRCONTENTS, item.unionStationKey.c_str(),
-				CURLFORM_CONTENTSLENGTH, (long) item.unionStationKey.size(),
+				CURLFORM_PTRCONTENTS, batch.unionStationKey.c_str(),
+				CURLFORM_CONTENTSLENGTH, (long) batch.unionStationKey.size(),
 				CURLFORM_END);
-			curl_formadd(&post, &last,
+			curl_formadd(&transfer.post, &last,
 				CURLFORM_PTRNAME, "node_name",
-				CURLFORM_PTRCONTENTS, item.nodeName.c_str(),
-				CURLFORM_CONTENTSLENGTH, (long) item.nodeName.size(),
+				CURLFORM_PTRCONTENTS, batch.nodeName.c_str(),
+				CURLFORM_CONTENTSLENGTH, (long) batch.nodeName.size(),
 				CURLFORM_END);
-			curl_formadd(&post, &last,
+			curl_formadd(&transfer.post, &last,
 				CURLFORM_PTRNAME, "category",
-				CURLFORM_PTRCONTENTS, item.category.c_str(),
-				CURLFORM_CONTENTSLENGTH, (long) item.category.size(),
+				CURLFORM_PTRCONTENTS, batch.category.c_str(),
+				CURLFORM_CONTENTSLENGTH, (long) batch.category.size(),
 				CURLFORM_END);
-			if (item.compressed) {
-				base64_data = modp::b64_encode(item.data);
-				curl_formadd(&post, &last,
+			if (batch.compressed) {
+				transfer.base64Data = modp::b64_encode(batch.data);
+				curl_formadd(&transfer.post, &last,
 					CURLFORM_PTRNAME, "data",
-					CURLFORM_PTRCONTENTS, base64_data.data(),
-					CURLFORM_CONTENTSLENGTH, (long) base64_data.size(),
+					CURLFORM_PTRCONTENTS, transfer.base64Data.data(),
+					CURLFORM_CONTENTSLENGTH, (long) transfer.base64Data.size(),
 					CURLFORM_END);
-				curl_formadd(&post, &last,
+				curl_formadd(&transfer.post, &last,
 					CURLFORM_PTRNAME, "compressed",
 					CURLFORM_PTRCONTENTS, "1",
 					CURLFORM_END);
 			} else {
-				curl_formadd(&post, &last,
+				curl_formadd(&transfer.post, &last,
 					CURLFORM_PTRNAME, "data",
-					CURLFORM_PTRCONTENTS, item.data.c_str(),
-					CURLFORM_CONTENTSLENGTH, (long) item.data.size(),
+					CURLFORM_PTRCONTENTS, batch.data.c_str(),
+					CURLFORM_CONTENTSLENGTH, (long) batch.data.size(),
 					CURLFORM_END);
 			}
 
-			curl_easy_setopt(curl, CURLOPT_HTTPGET, 0);
-			curl_easy_setopt(curl, CURLOPT_HTTPPOST, post);
-			P_DEBUG("Sending Union Station packet: key=" << item.unionStationKey <<
-				", node=" << item.nodeName << ", category=" << item.category <<
-				", compressedDataSize=" << item.data.size());
-			CURLcode code = curl_easy_perform(curl);
-			curl_formfree(post);
+			curl_easy_setopt(transfer.curl, CURLOPT_HTTPGET, 0);
+			curl_easy_setopt(transfer.curl, CURLOPT_HTTPPOST, transfer.post);
+			P_DEBUG("Sending Union Station batch to " << ip << ": key=" << batch.unionStationKey <<
+				", node=" << batch.nodeName << ", category=" << batch.category <<
+				", packets=" << batch.itemCount <<
+				", compressedDataSize=" << batch.data.size());
+			transfer.startTime = SystemTime::getUsec();
+		}
+
+		/** Called when the transfer that was prepared with prepareSend() finished. */
+		SendResult finishSend(Transfer &transfer, CURLcode code) {
+			curl_formfree(transfer.post);
+			transfer.post = NULL;
+			string().swap(transfer.base64Data);
 
 			if (code == CURLE_OK) {
-				guard.clear();
-				return handleSendResponse(item);
+				return handleSendResponse(transfer);
 			} else {
-				handleSendError(item);
+				handleSendError(transfer);
 				return SR_DOWN;
 			}
 		}
 
 		Json::Value inspectStateAsJson() const {
-			Json::Value doc, errorDoc;
+			Json::Value doc, errorDoc, latencyDoc;
 			doc["sink_url"] = sinkURL;
 			doc["ping_url"] = pingURL;
 
@@ -434,63 +617,252 @@ private:
 
 			doc["errors"] = errorDoc;
 			doc["packets_accepted"] = packetsAccepted;
+			doc["bytes_sent"] = byteSizeToJson(bytesSent);
+
+			double throughput = throughputMeter.currentSpeed();
+			if (throughput == SpeedMeter<double>::unknownSpeed()) {
+				doc["bytes_sent_per_second"] = Json::Value(Json::nullValue);
+			} else {
+				doc["bytes_sent_per_second"] = throughput;
+			}
+
+			if (packetsAccepted > 0) {
+				latencyDoc["average"] = latencyToJson(totalLatency / packetsAccepted);
+				latencyDoc["last"] = latencyToJson(lastLatency);
+				latencyDoc["max"] = latencyToJson(maxLatency);
+				latencyDoc["unit"] = "msec";
+				doc["latency"] = latencyDoc;
+			} else {
+				doc["latency"] = Json::Value(Json::nullValue);
+			}
 
 			return doc;
 		}
 	};
 
-	typedef boost::shared_ptr<Server> ServerPtr;
-
-	string gatewayAddress;
-	unsigned short gatewayPort;
-	string certificate;
+	RemoteSenderOptions options;
 	CurlProxyInfo proxyInfo;
-	BlockingQueue<Item> queue;
 	oxt::thread *thr;
 
 	mutable boost::mutex syncher;
+	boost::condition_variable cond;
+	deque<Item> queue;
+	/** Number of uncompressed bytes in `queue` and in `builders`. */
+	size_t queuedBytes;
+	bool exiting;
+	bool checkupRequested;
+	/** Whether the sender thread is blocked in curl_multi_poll(). */
+	bool polling;
 	list<ServerPtr> upServers;
 	vector<ServerPtr> downServers;
 	time_t lastCheckupTime, nextCheckupTime;
 	string lastDnsErrorMessage;
-	unsigned int packetsAccepted, packetsRejected, packetsDropped;
+	unsigned int packetsAccepted, packetsRejected, packetsDropped, packetsSpilled;
+	unsigned int batchesSent, activeTransfers;
+	size_t spillSize;
+	unsigned int spillFileCount;
+
+	// The following fields are only accessed from the sender thread.
+	CURLM *multi;
+	vector<Transfer *> transfers;
+	vector<Transfer *> idleTransfers;
+	map<string, BatchBuilder> builders;
+	deque<BatchPtr> pendingBatches;
+	deque<SpillFile> spillFiles;
+	unsigned int spillSequence;
 
 	void threadMain() {
 		ScopeGuard guard(boost::bind(&RemoteSender::freeThreadData, this));
 
+		initThreadData();
+
 		while (true) {
-			Item item;
-			bool hasItem;
+			boost::unique_lock<boost::mutex> l(syncher);
+			waitForWork(l);
+			bool exiting = this->exiting;
+			bool checkup = timeForCheckup();
+			if (pendingBatches.size() < options.maxConnections) {
+				takeQueuedItems();
+			}
+			l.unlock();
 
-			if (firstStarted()) {
-				item = queue.get();
-				hasItem = true;
-			} else {
-				hasItem = queue.timedGet(item, msecUntilNextCheckup());
+			if (checkup) {
+				recheckServers();
+			}
+			buildBatches(exiting);
+			if (serversChecked()) {
+				if (hasUpServers()) {
+					if (!exiting) {
+						unspill();
+					}
+					startTransfers();
+				} else {
+					handleUndeliverableBatches();
+				}
 			}
+			processTransfers();
 
-			if (hasItem) {
-				if (item.exit) {
+			if (exiting && builders.empty() && pendingBatches.empty()
+			 && idleTransfers.size() == transfers.size())
+			{
+				l.lock();
+				if (queue.empty()) {
 					return;
-				} else {
-					if (timeForCheckup()) {
-						recheckServers();
-					}
-					sendOut(item);
 				}
-			} else if (timeForCheckup()) {
-				recheckServers();
 			}
 		}
 	}
 
-	bool firstStarted() const {
+	void initThreadData() {
+		multi = curl_multi_init();
+		if (multi == NULL) {
+			throw IOException("Unable to create a CURL multi handle");
+		}
+		curl_multi_setopt(multi, CURLMOPT_MAXCONNECTS, (long) options.maxConnections * 2);
+
+		for (unsigned int i = 0; i < options.maxConnections; i++) {
+			Transfer *transfer = new Transfer();
+			transfer->curl = curl_easy_init();
+			if (transfer->curl == NULL) {
+				delete transfer;
+				throw IOException("Unable to create a CURL handle");
+			}
+			curl_easy_setopt(transfer->curl, CURLOPT_PRIVATE, transfer);
+			transfers.push_back(transfer);
+			idleTransfers.push_back(transfer);
+		}
+
+		if (!options.spillDir.empty()) {
+			scanSpillDir();
+		}
+	}
+
+	void freeThreadData() {
+		foreach (Transfer *transfer, transfers) {
+			if (transfer->post != NULL) {
+				curl_multi_remove_handle(multi, transfer->curl);
+				curl_formfree(transfer->post);
+			}
+			curl_easy_cleanup(transfer->curl);
+			delete transfer;
+		}
+		transfers.clear();
+		idleTransfers.clear();
+		if (multi != NULL) {
+			curl_multi_cleanup(multi);
+			multi = NULL;
+		}
+
+		boost::lock_guard<boost::mutex> l(syncher);
+		// Invoke destructors inside this thread.
+		upServers.clear();
+		downServers.clear();
+	}
+
+	/**
+	 * Blocks until there is something for the sender thread to do: new items,
+	 * a batch that is due, progress on active transfers, a checkup, or exit.
+	 */
+	void waitForWork(boost::unique_lock<boost::mutex> &l) {
+		unsigned int timeout = msecUntilNextEvent();
+
+		if (idleTransfers.size() < transfers.size()) {
+			int numfds;
+			#ifdef PASSENGER_HAS_CURL_MULTI_WAKEUP
+				// wakeUpSenderThread() interrupts this when there are new items.
+				polling = true;
+				l.unlock();
+				curl_multi_poll(multi, NULL, 0, std::min<unsigned int>(timeout, INT_MAX),
+					&numfds);
+				l.lock();
+				polling = false;
+			#else
+				// New items don't interrupt curl_multi_wait(), so we wake up
+				// regularly to pick them up.
+				l.unlock();
+				curl_multi_wait(multi, NULL, 0, std::min(timeout, 50u), &numfds);
+				l.lock();
+			#endif
+		} else if (queue.empty() && !exiting && !checkupRequested && timeout > 0
+			&& (pendingBatches.empty() || nextCheckupTime == 0)
+			&& (spillFiles.empty() || upServers.empty()))
+		{
+			if (timeout == UINT_MAX) {
+				cond.wait(l);
+			} else {
+				cond.timed_wait(l, posix_time::milliseconds(timeout));
+			}
+		}
+	}
+
+	/**
+	 * Wakes up the sender thread, whether it's waiting on `cond` or on
+	 * active transfers. Must be called with `syncher` locked.
+	 */
+	void wakeUpSenderThread() {
+		cond.notify_one();
+		#ifdef PASSENGER_HAS_CURL_MULTI_WAKEUP
+			if (polling) {
+				curl_multi_wakeup(multi);
+			}
+		#endif
+	}
+
+	/** Returns UINT_MAX if there's nothing scheduled. */
+	unsigned int msecUntilNextEvent() const {
+		unsigned long long now = SystemTime::getUsec();
+		unsigned long long deadline = 0;
+		map<string, BatchBuilder>::const_iterator it;
+
+		for (it = builders.begin(); it != builders.end(); it++) {
+			unsigned long long due = it->second.startTime + options.maxBatchDelay * 1000ull;
+			if (deadline == 0 || due < deadline) {
+				deadline = due;
+			}
+		}
+		if (nextCheckupTime != 0) {
+			unsigned long long due = nextCheckupTime * 1000000ull;
+			if (deadline == 0 || due < deadline) {
+				deadline = due;
+			}
+		}
+
+		if (deadline == 0) {
+			return UINT_MAX;
+		} else if (deadline <= now) {
+			return 0;
+		} else {
+			return (unsigned int) std::min<unsigned long long>(
+				(deadline - now + 999) / 1000, UINT_MAX - 1);
+		}
+	}
+
+	/** Must be called with `syncher` locked. */
+	bool timeForCheckup() {
+		if (checkupRequested) {
+			checkupRequested = false;
+			return true;
+		} else if (nextCheckupTime == 0) {
+			// Servers are checked for the first time when there's
+			// something to send.
+			return !queue.empty() || !spillFiles.empty();
+		} else {
+			return SystemTime::get() >= nextCheckupTime;
+		}
+	}
+
+	bool serversChecked() const {
 		boost::lock_guard<boost::mutex> l(syncher);
-		return nextCheckupTime == 0;
+		return nextCheckupTime != 0;
+	}
+
+	bool hasUpServers() const {
+		boost::lock_guard<boost::mutex> l(syncher);
+		return !upServers.empty();
 	}
 
 	void recheckServers() {
-		P_INFO("Rechecking Union Station gateway servers (" << gatewayAddress << ")...");
+		P_INFO("Rechecking Union Station gateway servers (" << options.gatewayAddress << ")...");
 
 		vector<string> ips;
 		vector<string>::const_iterator it;
@@ -498,16 +870,16 @@ private:
 		vector<ServerPtr> downServers;
 
 		try {
-			ips = resolveHostname(gatewayAddress, gatewayPort);
+			ips = resolveHostname(options.gatewayAddress, options.gatewayPort);
 		} catch (const tracable_exception &e) {
 			P_ERROR(e.what());
+			boost::lock_guard<boost::mutex> l(syncher);
 			// DNS errors tend to be temporary, so retry
 			// after a short timeout.
 			scheduleNextCheckup(60);
 			// Take note of the error, but do not change the server
 			// list so that the RemoteSender can keep working with
 			// the last known server list.
-			boost::lock_guard<boost::mutex> l(syncher);
 			this->lastCheckupTime = SystemTime::get();
 			this->lastDnsErrorMessage = e.what();
 			return;
@@ -518,8 +890,8 @@ private:
 
 		for (it = ips.begin(); it != ips.end(); it++) {
 			ServerPtr server = boost::make_shared<Server>(
-				*it, gatewayAddress, gatewayPort, certificate,
-				&proxyInfo);
+				*it, options.gatewayAddress, options.gatewayPort,
+				options.certificate, &proxyInfo, options.useHttps);
 			if (server->ping()) {
 				upServers.push_back(server);
 			} else {
@@ -528,6 +900,7 @@ private:
 		}
 		P_INFO(upServers.size() << " Union Station gateway servers are up");
 
+		boost::lock_guard<boost::mutex> l(syncher);
 		if (upServers.empty()) {
 			scheduleNextCheckup(5 * 60);
 		} else if (!downServers.empty()) {
@@ -535,25 +908,18 @@ private:
 		} else {
 			scheduleNextCheckup(3 * 60 * 60);
 		}
-
-		boost::lock_guard<boost::mutex> l(syncher);
 		this->lastCheckupTime = SystemTime::get();
 		this->upServers = upServers;
 		this->downServers = downServers;
 		this->lastDnsErrorMessage.clear();
 	}
 
-	void freeThreadData() {
-		boost::lock_guard<boost::mutex> l(syncher);
-		// Invoke destructors inside this thread.
-		upServers.clear();
-		downServers.clear();
-	}
-
 	/**
 	 * Schedules the next checkup to be run after the given number
 	 * of seconds, unless there's already a checkup scheduled for
 	 * earlier.
+	 *
+	 * Must be called with `syncher` locked.
 	 */
 	void scheduleNextCheckup(unsigned int seconds) {
 		time_t now = SystemTime::get();
@@ -563,83 +929,407 @@ private:
 		}
 	}
 
-	unsigned int msecUntilNextCheckup() const {
-		boost::lock_guard<boost::mutex> l(syncher);
-		time_t now = SystemTime::get();
-		if (now >= nextCheckupTime) {
-			return 0;
-		} else {
-			return (nextCheckupTime - now) * 1000;
+	/**
+	 * Moves queued items into the batch builders, until a builder is full.
+	 * Must be called with `syncher` locked.
+	 */
+	void takeQueuedItems() {
+		unsigned long long now = SystemTime::getUsec();
+
+		while (!queue.empty()) {
+			Item &item = queue.front();
+			string builderKey = item.unionStationKey + '\0' + item.nodeName
+				+ '\0' + item.category;
+			BatchBuilder &builder = builders[builderKey];
+
+			if (builder.size >= options.maxBatchSize) {
+				// Leave the rest in the queue until buildBatches()
+				// has turned this builder into a batch.
+				return;
+			} else if (builder.data.empty()) {
+				builder.unionStationKey.swap(item.unionStationKey);
+				builder.nodeName.swap(item.nodeName);
+				builder.category.swap(item.category);
+				builder.startTime = now;
+			}
+			builder.size += item.data.size();
+			builder.data.push_back(string());
+			builder.data.back().swap(item.data);
+			queue.pop_front();
 		}
 	}
 
-	bool timeForCheckup() const {
-		boost::lock_guard<boost::mutex> l(syncher);
-		return SystemTime::get() >= nextCheckupTime;
+	/**
+	 * Compresses the batch builders that are full or that have waited
+	 * long enough into batches.
+	 */
+	void buildBatches(bool force) {
+		unsigned long long now = SystemTime::getUsec();
+		map<string, BatchBuilder>::iterator it = builders.begin();
+
+		while (it != builders.end()) {
+			BatchBuilder &builder = it->second;
+
+			if (force
+			 || builder.size >= options.maxBatchSize
+			 || now >= builder.startTime + options.maxBatchDelay * 1000ull)
+			{
+				pendingBatches.push_back(createBatch(builder));
+				{
+					boost::lock_guard<boost::mutex> l(syncher);
+					queuedBytes -= builder.size;
+				}
+				builders.erase(it++);
+			} else {
+				it++;
+			}
+		}
 	}
 
-	void sendOut(const Item &item) {
-		boost::unique_lock<boost::mutex> l(syncher);
-		bool done = false;
-		bool accepted = false;
-		bool rejected = false;
+	BatchPtr createBatch(BatchBuilder &builder) {
+		BatchPtr batch = boost::make_shared<Batch>();
+		vector<StaticString> data;
 
-		while (!done && !upServers.empty()) {
-			// Pick first available server and put it on the back of the list
-			// for round-robin load balancing.
-			ServerPtr server = upServers.front();
+		batch->unionStationKey.swap(builder.unionStationKey);
+		batch->nodeName.swap(builder.nodeName);
+		batch->category.swap(builder.category);
+		batch->itemCount = builder.data.size();
 
-			l.unlock();
-			Server::SendResult result = server->send(item);
-			l.lock();
+		data.reserve(builder.data.size());
+		foreach (const string &piece, builder.data) {
+			data.push_back(piece);
+		}
+		if (compress(&data[0], data.size(), batch->data)) {
+			batch->compressed = true;
+		} else {
+			batch->data.clear();
+			batch->data.reserve(builder.size);
+			foreach (const string &piece, builder.data) {
+				batch->data.append(piece);
+			}
+		}
 
-			if (result == Server::SR_OK) {
-				upServers.pop_front();
-				upServers.push_back(server);
-				accepted = true;
-				done = true;
-			} else if (result == Server::SR_REJECTED) {
-				upServers.pop_front();
+		P_DEBUG("Coalesced " << batch->itemCount << " Union Station packets into a batch: key=" <<
+			batch->unionStationKey << ", node=" << batch->nodeName <<
+			", category=" << batch->category <<
+			", dataSize=" << builder.size <<
+			", compressedDataSize=" << batch->data.size());
+		return batch;
+	}
+
+	void startTransfers() {
+		while (!pendingBatches.empty() && !idleTransfers.empty()) {
+			BatchPtr batch = pendingBatches.front();
+			ServerPtr server;
+			{
+				boost::lock_guard<boost::mutex> l(syncher);
+				if (upServers.empty()) {
+					return;
+				}
+				// Pick the first available server that hasn't failed this batch
+				// yet, and put it on the back of the list for round-robin load
+				// balancing.
+				list<ServerPtr>::iterator it = upServers.begin();
+				while (it != upServers.end() && batch->failedOn(*it)) {
+					it++;
+				}
+				if (it == upServers.end()) {
+					it = upServers.begin();
+				}
+				server = *it;
+				upServers.erase(it);
 				upServers.push_back(server);
-				rejected = true;
-				done = true;
-			} else {
-				upServers.pop_front();
-				downServers.push_back(server);
+				activeTransfers++;
+			}
+
+			Transfer *transfer = idleTransfers.back();
+			idleTransfers.pop_back();
+			transfer->server = server;
+			transfer->batch = batch;
+			pendingBatches.pop_front();
+			server->prepareSend(*transfer);
+			curl_multi_add_handle(multi, transfer->curl);
+		}
+	}
+
+	void processTransfers() {
+		CURLMsg *msg;
+		int running, remaining;
+
+		if (idleTransfers.size() == transfers.size()) {
+			return;
+		}
+
+		curl_multi_perform(multi, &running);
+		while ((msg = curl_multi_info_read(multi, &remaining)) != NULL) {
+			if (msg->msg == CURLMSG_DONE) {
+				Transfer *transfer;
+				CURLcode code = msg->data.result;
+
+				curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **) &transfer);
+				curl_multi_remove_handle(multi, transfer->curl);
+				finishTransfer(transfer, code);
 			}
 		}
+	}
 
-		if (!downServers.empty()) {
-			if (upServers.empty()) {
-				scheduleNextCheckup(5 * 60);
+	void finishTransfer(Transfer *transfer, CURLcode code) {
+		ServerPtr server = transfer->server;
+		BatchPtr batch = transfer->batch;
+		Server::SendResult result = server->finishSend(*transfer, code);
+
+		transfer->server.reset();
+		transfer->batch.reset();
+		idleTransfers.push_back(transfer);
+
+		boost::lock_guard<boost::mutex> l(syncher);
+		activeTransfers--;
+		if (result == Server::SR_OK) {
+			packetsAccepted += batch->itemCount;
+			batchesSent++;
+			// The batch was fine, so the servers that failed it malfunction.
+			foreach (const ServerPtr &failedServer, batch->failedServers) {
+				markServerDown(failedServer);
+			}
+		} else if (result == Server::SR_REJECTED) {
+			packetsRejected += batch->itemCount;
+		} else if (result == Server::SR_MALFUNCTION) {
+			batch->failedServers.push_back(server);
+			if (batch->failedServers.size() >= options.maxBatchAttempts
+			 || !hasUntriedServer(*batch))
+			{
+				P_WARN("Dropping Union Station packets because " <<
+					batch->failedServers.size() << " gateway servers failed to"
+					" process them. Details of dropped packets:"
+					" key=" << batch->unionStationKey <<
+					", node=" << batch->nodeName <<
+					", category=" << batch->category <<
+					", packets=" << batch->itemCount <<
+					", compressedDataSize=" << batch->data.size());
+				packetsDropped += batch->itemCount;
 			} else {
-				scheduleNextCheckup(60 * 60);
+				pendingBatches.push_front(batch);
 			}
+		} else {
+			markServerDown(server);
+			// Retry on another server. If there are none left,
+			// the batch will be spilled or dropped.
+			pendingBatches.push_front(batch);
 		}
+	}
 
-		if (accepted) {
-			packetsAccepted++;
-		} else if (rejected) {
-			packetsRejected++;
+	/** Must be called with `syncher` held. */
+	void markServerDown(const ServerPtr &server) {
+		list<ServerPtr>::iterator it = std::find(upServers.begin(),
+			upServers.end(), server);
+		if (it != upServers.end()) {
+			upServers.erase(it);
+			downServers.push_back(server);
+		}
+		if (upServers.empty()) {
+			scheduleNextCheckup(5 * 60);
 		} else {
-			packetsDropped++;
+			scheduleNextCheckup(60 * 60);
 		}
-		l.unlock();
+	}
 
-		if (!accepted && !rejected) {
-			assert(upServers.empty());
-			/* If all servers went down then all items in the queue will be
-			 * effectively dropped until after the next checkup has detected
-			 * servers that are up.
-			 */
-			P_WARN("Dropping Union Station packet because no servers are"
-				" available. Run `passenger-status --show=union_station` to"
-				" view server status. Details of dropped packet:"
-				" key=" << item.unionStationKey <<
-				", node=" << item.nodeName <<
-				", category=" << item.category <<
-				", compressedDataSize=" << item.data.size());
+	/** Must be called with `syncher` held. */
+	bool hasUntriedServer(const Batch &batch) const {
+		foreach (const ServerPtr &server, upServers) {
+			if (!batch.failedOn(server)) {
+				return true;
+			}
 		}
+		return false;
+	}
+
+	/** Called when no servers are up. */
+	void handleUndeliverableBatches() {
+		while (!pendingBatches.empty()) {
+			BatchPtr batch = pendingBatches.front();
+			pendingBatches.pop_front();
+			if (options.spillDir.empty() || !spill(*batch)) {
+				/* If all servers went down then all items in the queue will be
+				 * effectively dropped until after the next checkup has detected
+				 * servers that are up.
+				 */
+				P_WARN("Dropping Union Station packets because no servers are"
+					" available. Run `passenger-status --show=union_station` to"
+					" view server status. Details of dropped packets:"
+					" key=" << batch->unionStationKey <<
+					", node=" << batch->nodeName <<
+					", category=" << batch->category <<
+					", packets=" << batch->itemCount <<
+					", compressedDataSize=" << batch->data.size());
+				boost::lock_guard<boost::mutex> l(syncher);
+				packetsDropped += batch->itemCount;
+			}
+		}
+	}
+
+	static bool hasSuffix(const StaticString &str, const StaticString &suffix) {
+		return str.size() >= suffix.size()
+			&& str.substr(str.size() - suffix.size()) == suffix;
+	}
+
+	void scanSpillDir() {
+		DIR *dir;
+		struct dirent *ent;
+		vector<string> names;
+
+		try {
+			makeDirTree(options.spillDir);
+		} catch (const tracable_exception &e) {
+			P_ERROR("Cannot create Union Station spill directory: " << e.what());
+			return;
+		}
+
+		dir = opendir(options.spillDir.c_str());
+		if (dir == NULL) {
+			int e = errno;
+			P_ERROR("Cannot open Union Station spill directory " << options.spillDir
+				<< ": " << strerror(e) << " (errno=" << e << ")");
+			return;
+		}
+		while ((ent = readdir(dir)) != NULL) {
+			StaticString name(ent->d_name);
+			if (hasSuffix(name, ".batch")) {
+				names.push_back(name);
+			} else if (hasSuffix(name, ".tmp")) {
+				unlink((options.spillDir + "/" + name).c_str());
+			}
+		}
+		closedir(dir);
+
+		// File names start with a fixed-width timestamp.
+		std::sort(names.begin(), names.end());
+		foreach (const string &name, names) {
+			SpillFile file;
+			struct stat buf;
+
+			file.path = options.spillDir + "/" + name;
+			if (stat(file.path.c_str(), &buf) == 0) {
+				file.size = buf.st_size;
+				spillFiles.push_back(file);
+				boost::lock_guard<boost::mutex> l(syncher);
+				spillSize += file.size;
+				spillFileCount++;
+			}
+		}
+		if (!spillFiles.empty()) {
+			P_INFO("Found " << spillFiles.size() << " spilled Union Station batches in "
+				<< options.spillDir);
+		}
+	}
+
+	/**
+	 * Stores the given batch in the spill directory. Returns whether that
+	 * succeeded.
+	 *
+	 * The file consists of the key, node name, category, packet count and
+	 * compression flag, each on its own line, followed by the data.
+	 */
+	bool spill(const Batch &batch) {
+		string header = batch.unionStationKey + "\n"
+			+ batch.nodeName + "\n"
+			+ batch.category + "\n"
+			+ toString(batch.itemCount) + "\n"
+			+ (batch.compressed ? "1" : "0") + "\n";
+		size_t size = header.size() + batch.data.size();
+
+		{
+			boost::lock_guard<boost::mutex> l(syncher);
+			if (spillSize + size > options.maxSpillSize) {
+				P_WARN("The Union Station spill directory " << options.spillDir
+					<< " is full");
+				return false;
+			}
+		}
+
+		char name[64];
+		snprintf(name, sizeof(name), "%020llu-%010u.batch",
+			SystemTime::getUsec(), spillSequence++);
+		SpillFile file;
+		file.path = options.spillDir + "/" + name;
+		file.size = size;
+
+		try {
+			createFile(file.path + ".tmp", header + batch.data, S_IRUSR | S_IWUSR);
+		} catch (const tracable_exception &e) {
+			P_ERROR("Cannot spill Union Station batch to disk: " << e.what());
+			return false;
+		}
+		if (rename((file.path + ".tmp").c_str(), file.path.c_str()) == -1) {
+			int e = errno;
+			P_ERROR("Cannot rename " << file.path << ".tmp: " << strerror(e)
+				<< " (errno=" << e << ")");
+			unlink((file.path + ".tmp").c_str());
+			return false;
+		}
+
+		P_DEBUG("Spilled Union Station batch to " << file.path);
+		spillFiles.push_back(file);
+		boost::lock_guard<boost::mutex> l(syncher);
+		spillSize += size;
+		spillFileCount++;
+		packetsSpilled += batch.itemCount;
+		return true;
+	}
+
+	/** Loads spilled batches back into memory, oldest first. */
+	void unspill() {
+		while (pendingBatches.size() < options.maxConnections && !spillFiles.empty()) {
+			SpillFile file = spillFiles.front();
+			string contents;
+			bool read;
+
+			spillFiles.pop_front();
+			try {
+				contents = readAll(file.path);
+				read = true;
+			} catch (const SystemException &e) {
+				P_ERROR("Cannot read spilled Union Station batch: " << e.what());
+				read = false;
+			}
+			unlink(file.path.c_str());
+			{
+				boost::lock_guard<boost::mutex> l(syncher);
+				spillSize -= file.size;
+				spillFileCount--;
+			}
+
+			if (read) {
+				BatchPtr batch = parseSpillFile(contents);
+				if (batch) {
+					pendingBatches.push_back(batch);
+				} else {
+					P_ERROR("Spilled Union Station batch " << file.path << " is corrupt");
+				}
+			}
+		}
+	}
+
+	BatchPtr parseSpillFile(const string &contents) {
+		BatchPtr batch = boost::make_shared<Batch>();
+		string::size_type pos = 0;
+		string fields[5];
+
+		for (int i = 0; i < 5; i++) {
+			string::size_type end = contents.find('\n', pos);
+			if (end == string::npos) {
+				return BatchPtr();
+			}
+			fields[i] = contents.substr(pos, end - pos);
+			pos = end + 1;
+		}
+
+		batch->unionStationKey = fields[0];
+		batch->nodeName = fields[1];
+		batch->category = fields[2];
+		batch->itemCount = stringToUint(fields[3]);
+		batch->compressed = fields[4] == "1";
+		batch->data = contents.substr(pos);
+		return batch;
 	}
 
 	bool compress(const StaticString data[], unsigned int count, string &output) {
@@ -699,25 +1389,35 @@ private:
 	}
 
 public:
-	RemoteSender(const string &gatewayAddress, unsigned short gatewayPort,
-		const string &certificate, const string &proxyAddress)
-		: queue(1024)
+	RemoteSender(const RemoteSenderOptions &_options)
+		: options(_options)
 	{
 		TRACE_POINT();
-		this->gatewayAddress = gatewayAddress;
-		this->gatewayPort = gatewayPort;
-		this->certificate = certificate;
+		if (options.maxConnections == 0) {
+			options.maxConnections = 1;
+		}
 		try {
-			this->proxyInfo = prepareCurlProxy(proxyAddress);
+			this->proxyInfo = prepareCurlProxy(options.proxyAddress);
 		} catch (const ArgumentException &e) {
 			throw RuntimeException("Invalid Union Station proxy address \"" +
-				proxyAddress + "\": " + e.what());
+				options.proxyAddress + "\": " + e.what());
 		}
+		queuedBytes = 0;
+		exiting = false;
+		checkupRequested = false;
+		polling = false;
 		lastCheckupTime = 0;
 		nextCheckupTime = 0;
 		packetsAccepted = 0;
 		packetsRejected = 0;
 		packetsDropped = 0;
+		packetsSpilled = 0;
+		batchesSent = 0;
+		activeTransfers = 0;
+		spillSize = 0;
+		spillFileCount = 0;
+		multi = NULL;
+		spillSequence = 0;
 		thr = new oxt::thread(
 			boost::bind(&RemoteSender::threadMain, this),
 			"RemoteSender thread",
@@ -726,9 +1426,11 @@ public:
 	}
 
 	~RemoteSender() {
-		Item item;
-		item.exit = true;
-		queue.add(item);
+		{
+			boost::lock_guard<boost::mutex> l(syncher);
+			exiting = true;
+			wakeUpSenderThread();
+		}
 		/* Wait until the thread sends out all queued items.
 		 * If this cannot be done within a short amount of time,
 		 * e.g. because all servers are down, then we'll get killed
@@ -742,55 +1444,78 @@ public:
 		const StaticString &category, const StaticString data[],
 		unsigned int count)
 	{
-		Item item;
+		size_t size = 0;
+		unsigned int i;
 
-		item.unionStationKey = unionStationKey;
-		item.nodeName = nodeName;
-		item.category = category;
-
-		if (compress(data, count, item.data)) {
-			item.compressed = true;
-		} else {
-			size_t size = 0;
-			unsigned int i;
-
-			for (i = 0; i < count; i++) {
-				size += data[i].size();
-			}
-			item.data.reserve(size);
-			for (i = 0; i < count; i++) {
-				item.data.append(data[i].c_str(), data[i].size());
-			}
+		for (i = 0; i < count; i++) {
+			size += data[i].size();
 		}
 
 		P_DEBUG("Scheduling Union Station packet: key=" << unionStationKey <<
 			", node=" << nodeName << ", category=" << category <<
-			", compressedDataSize=" << item.data.size());
+			", dataSize=" << size);
 
-		if (!queue.tryAdd(item)) {
+		boost::lock_guard<boost::mutex> l(syncher);
+		if (queuedBytes + size > options.maxQueueMemory) {
 			P_WARN("The Union Station gateway isn't responding quickly enough; dropping packet.");
-			boost::lock_guard<boost::mutex> l(syncher);
 			packetsDropped++;
+			return;
+		}
+
+		queue.push_back(Item());
+		Item &item = queue.back();
+		item.unionStationKey = unionStationKey;
+		item.nodeName = nodeName;
+		item.category = category;
+		item.data.reserve(size);
+		for (i = 0; i < count; i++) {
+			item.data.append(data[i].data(), data[i].size());
 		}
+		queuedBytes += size;
+		wakeUpSenderThread();
+	}
+
+	/** Checks which gateway servers are up as soon as possible,
+	 * instead of waiting for the next scheduled checkup.
+	 */
+	void scheduleServerCheckup() {
+		boost::lock_guard<boost::mutex> l(syncher);
+		checkupRequested = true;
+		wakeUpSenderThread();
 	}
 
 	unsigned int queued() const {
+		boost::lock_guard<boost::mutex> l(syncher);
 		return queue.size();
 	}
 
 	Json::Value inspectStateAsJson() const {
-		Json::Value doc;
+		Json::Value doc, spillDoc;
 		boost::lock_guard<boost::mutex> l(syncher);
 		doc["up_servers"] = inspectUpServersStateAsJson();
 		doc["down_servers"] = inspectDownServersStateAsJson();
-		doc["queue_size"] = queue.size();
+		doc["queue_size"] = (Json::UInt) queue.size();
+		doc["queued_bytes"] = byteSizeToJson(queuedBytes);
+		doc["max_queued_bytes"] = byteSizeToJson(options.maxQueueMemory);
+		doc["active_transfers"] = activeTransfers;
+		doc["max_connections"] = options.maxConnections;
+		doc["batches_sent"] = batchesSent;
 		doc["packets_accepted"] = packetsAccepted;
 		doc["packets_rejected"] = packetsRejected;
 		doc["packets_dropped"] = packetsDropped;
-		if (certificate.empty()) {
+		if (options.spillDir.empty()) {
+			doc["spill"] = Json::nullValue;
+		} else {
+			spillDoc["dir"] = options.spillDir;
+			spillDoc["files"] = spillFileCount;
+			spillDoc["size"] = byteSizeToJson(spillSize);
+			spillDoc["packets_spilled"] = packetsSpilled;
+			doc["spill"] = spillDoc;
+		}
+		if (options.certificate.empty()) {
 			doc["certificate"] = Json::nullValue;
 		} else {
-			doc["certificate"] = certificate;
+			doc["certificate"] = options.certificate;
 		}
 		if (lastCheckupTime == 0) {
 			doc["last_server_checkup_time"] = Json::Value(Json::nullValue);
@@ -61,21 +61,13 @@ private:
 	}
 
 public:
-	/* RemoteSender compresses the data with zlib before sending it
-	 * to the server. Even including Base64 and URL encoding overhead,
-	 * this compresses the data to about 25% of its original size.
-	 * Therefore we set a buffer capacity of a little less than 4 times
-	 * the TCP maximum segment size so that we can send as much
-	 * data as possible to the server in a single TCP segment.
-	 * With the "little less" we take into account:
-	 * - HTTPS overhead. This can be as high as 2 KB.
-	 * - The fact that RemoteSink.append() might try to flush the
-	 *   current buffer. Observations have shown that the data
-	 *   for a request transaction is often less than 5 KB.
+	/* RemoteSender coalesces the packets of all sinks with the same key,
+	 * node and category into larger compressed batches, so this buffer
+	 * only needs to be large enough to avoid handing over every single
+	 * transaction to the RemoteSender. Observations have shown that the
+	 * data for a request transaction is often less than 5 KB.
 	 */
-	static const unsigned int BUFFER_CAPACITY =
-		4 * 64 * 1024 -
-		16 * 1024;
+	static const unsigned int BUFFER_CAPACITY = 64 * 1024;
 
 	string unionStationKey;
 	string nodeName;
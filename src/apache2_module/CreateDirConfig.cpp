@@ -54,6 +54,7 @@
 				config->highPerformance = DirConfig::UNSET;
 				config->enabled = DirConfig::UNSET;
 				config->maxRequestQueueSize = UNSET_INT_VALUE;
+				config->maxRequestQueueTime = UNSET_INT_VALUE;
 				config->maxPreloaderIdleTime = UNSET_INT_VALUE;
 				config->loadShellEnvvars = DirConfig::UNSET;
 				config->bufferUpload = DirConfig::UNSET;
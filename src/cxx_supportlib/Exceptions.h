@@ -416,6 +416,36 @@ public:
 	}
 };
 
+/**
+ * Indicates that a Pool::get() or Pool::asyncGet() request was denied because
+ * it waited in the getWaitlist queue for too long: either its queue deadline
+ * passed, or it was shed from a standing queue.
+ */
+class RequestQueueTimeoutException: public GetAbortedException {
+private:
+	string msg;
+
+public:
+	RequestQueueTimeoutException(unsigned long long waitTime, bool shed)
+		: GetAbortedException(oxt::tracable_exception::no_backtrace())
+		{
+			stringstream str;
+			if (shed) {
+				str << "Request shed from overloaded request queue after waiting ";
+			} else {
+				str << "Request queue deadline exceeded after waiting ";
+			}
+			str << (waitTime / 1000) << " msec";
+			msg = str.str();
+		}
+
+	virtual ~RequestQueueTimeoutException() throw() {}
+
+	virtual const char *what() const throw() {
+		return msg.c_str();
+	}
+};
+
 /**
  * Indicates that a specified argument is incorrect or violates a requirement.
  *
@@ -78,6 +78,11 @@ using namespace boost;
  * Inside the "PassengerAgent core", we activate AcceptLoadBalancer
  * only if `core_threads > 1`, which is often the case because
  * `core_threads` defaults to the number of CPU cores.
+ *
+ * If the Servers' threads are bound to NUMA nodes (see `serverNumaNodes`),
+ * then a client is preferably fed to a Server on the node of the CPU that
+ * processes the client socket's receive queue, so that its packets and its
+ * buffers stay on the same node. This requires SO_INCOMING_CPU (Linux 3.19+).
  */
 template<typename Server>
 class AcceptLoadBalancer {
@@ -96,6 +101,7 @@ private:
 
 	int exitPipe[2];
 	oxt::thread *thread;
+	vector<unsigned int> nextServerOnNode;
 
 	void pollAllEndpoints() {
 		pollers[0].fd = exitPipe[0];
@@ -159,17 +165,64 @@ private:
 		unsigned int i;
 
 		for (i = 0; i < newClientCount; i++) {
-			ServerKit::Context *ctx = servers[nextServer]->getContext();
-			P_TRACE(2, "Feeding client to server thread " << (int) nextServer <<
+			unsigned int server = selectServer(newClients[i]);
+			ServerKit::Context *ctx = servers[server]->getContext();
+			P_TRACE(2, "Feeding client to server thread " << server <<
 				": file descriptor " << newClients[i]);
-			ctx->libev->runLater(boost::bind(feedNewClient, servers[nextServer],
+			ctx->libev->runLater(boost::bind(feedNewClient, servers[server],
 				newClients[i]));
-			nextServer = (nextServer + 1) % servers.size();
 		}
 
 		newClientCount = 0;
 	}
 
+	unsigned int selectServer(int fd) {
+		int node = getIncomingNumaNode(fd);
+
+		if (node != -1) {
+			// Round-robin over the servers on that node.
+			unsigned int n = servers.size();
+			if (nextServerOnNode.size() <= (unsigned int) node) {
+				nextServerOnNode.resize(node + 1, 0);
+			}
+			for (unsigned int i = 0; i < n; i++) {
+				unsigned int server = (nextServerOnNode[node] + i) % n;
+				if (serverNumaNodes[server] == node) {
+					nextServerOnNode[node] = (server + 1) % n;
+					return server;
+				}
+			}
+		}
+
+		unsigned int server = nextServer;
+		nextServer = (nextServer + 1) % servers.size();
+		return server;
+	}
+
+	/**
+	 * Returns the NUMA node of the CPU that processes the given socket's
+	 * receive queue, or -1 if unknown or if servers aren't bound to nodes.
+	 */
+	int getIncomingNumaNode(int fd) const {
+		#ifdef SO_INCOMING_CPU
+			if (serverNumaNodes.empty()) {
+				return -1;
+			}
+
+			int cpu;
+			socklen_t len = sizeof(cpu);
+			if (getsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) == -1
+			 || cpu < 0 || (unsigned int) cpu >= cpuNumaNodes.size())
+			{
+				// Unix domain sockets, for example.
+				return -1;
+			}
+			return cpuNumaNodes[cpu];
+		#else
+			return -1;
+		#endif
+	}
+
 	static void feedNewClient(Server *server, int fd) {
 		server->feedNewClients(&fd, 1);
 	}
@@ -243,6 +296,14 @@ private:
 
 public:
 	vector<Server *> servers;
+	/**
+	 * The NUMA node that each Server's thread is bound to, or -1 if
+	 * it's not bound to a single node. Leave empty to distribute clients
+	 * in a plain round-robin manner.
+	 */
+	vector<int> serverNumaNodes;
+	/** The NUMA node of each CPU, indexed by CPU number. */
+	vector<int> cpuNumaNodes;
 
 	AcceptLoadBalancer()
 		: nEndpoints(0),
@@ -32,6 +32,7 @@
 #include <jsoncpp/json.h>
 #include <MemoryKit/mbuf.h>
 #include <SafeLibev.h>
+#include <ServerKit/TimerWheel.h>
 #include <Constants.h>
 #include <Utils/StrIntUtils.h>
 #include <Utils/JsonUtils.h>
@@ -75,16 +76,20 @@ public:
 	struct MemoryKit::mbuf_pool mbuf_pool;
 	string secureModePassword;
 	FileBufferedChannelConfig defaultFileBufferedChannelConfig;
+	/** Keeps track of the timeouts of all servers running on this event loop. */
+	TimerWheel timerWheel;
 
 	Context(const SafeLibevPtr &_libev, struct uv_loop_s *_libuv)
 		: libev(_libev),
-		  libuv(_libuv)
+		  libuv(_libuv),
+		  timerWheel(_libev->getLoop())
 	{
 		initialize();
 	}
 
 	Context(struct ev_loop *loop)
-		: libev(boost::make_shared<SafeLibev>(loop))
+		: libev(boost::make_shared<SafeLibev>(loop)),
+		  timerWheel(loop)
 	{
 		initialize();
 	}
@@ -127,6 +132,7 @@ public:
 		#endif
 
 		doc["mbuf_pool"] = mbufDoc;
+		doc["timer_wheel"] = timerWheel.inspectStateAsJson();
 
 		return doc;
 	}
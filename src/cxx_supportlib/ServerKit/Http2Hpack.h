@@ -0,0 +1,752 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2015 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_SERVER_KIT_HTTP2_HPACK_H_
+#define _PASSENGER_SERVER_KIT_HTTP2_HPACK_H_
+
+#include <boost/cstdint.hpp>
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <utility>
+#include <cstddef>
+#include <cstring>
+#include <StaticString.h>
+
+namespace Passenger {
+namespace ServerKit {
+
+using namespace std;
+
+
+/**
+ * A decoded HTTP/2 header field. Names are always lowercase.
+ */
+typedef pair<string, string> Http2Header;
+typedef vector<Http2Header> Http2HeaderList;
+
+
+/**
+ * Primitive HPACK (RFC 7541) encoding functions: prefixed integers and
+ * (optionally Huffman coded) string literals.
+ */
+class Http2Hpack {
+public:
+	struct StaticEntry {
+		const char *name;
+		const char *value;
+	};
+
+	static const unsigned int STATIC_TABLE_SIZE = 61;
+
+	/**
+	 * Per RFC 7541 section 4.1, the size of an entry is the sum of the
+	 * name and value lengths plus 32.
+	 */
+	static const unsigned int ENTRY_OVERHEAD = 32;
+
+	/** Returns the static table entry with the given 1-based index. */
+	static const StaticEntry &getStaticEntry(unsigned int index) {
+		static const StaticEntry table[STATIC_TABLE_SIZE] = {
+			{ ":authority", "" },
+			{ ":method", "GET" },
+			{ ":method", "POST" },
+			{ ":path", "/" },
+			{ ":path", "/index.html" },
+			{ ":scheme", "http" },
+			{ ":scheme", "https" },
+			{ ":status", "200" },
+			{ ":status", "204" },
+			{ ":status", "206" },
+			{ ":status", "304" },
+			{ ":status", "400" },
+			{ ":status", "404" },
+			{ ":status", "500" },
+			{ "accept-charset", "" },
+			{ "accept-encoding", "gzip, deflate" },
+			{ "accept-language", "" },
+			{ "accept-ranges", "" },
+			{ "accept", "" },
+			{ "access-control-allow-origin", "" },
+			{ "age", "" },
+			{ "allow", "" },
+			{ "authorization", "" },
+			{ "cache-control", "" },
+			{ "content-disposition", "" },
+			{ "content-encoding", "" },
+			{ "content-language", "" },
+			{ "content-length", "" },
+			{ "content-location", "" },
+			{ "content-range", "" },
+			{ "content-type", "" },
+			{ "cookie", "" },
+			{ "date", "" },
+			{ "etag", "" },
+			{ "expect", "" },
+			{ "expires", "" },
+			{ "from", "" },
+			{ "host", "" },
+			{ "if-match", "" },
+			{ "if-modified-since", "" },
+			{ "if-none-match", "" },
+			{ "if-range", "" },
+			{ "if-unmodified-since", "" },
+			{ "last-modified", "" },
+			{ "link", "" },
+			{ "location", "" },
+			{ "max-forwards", "" },
+			{ "proxy-authenticate", "" },
+			{ "proxy-authorization", "" },
+			{ "range", "" },
+			{ "referer", "" },
+			{ "refresh", "" },
+			{ "retry-after", "" },
+			{ "server", "" },
+			{ "set-cookie", "" },
+			{ "strict-transport-security", "" },
+			{ "transfer-encoding", "" },
+			{ "user-agent", "" },
+			{ "vary", "" },
+			{ "via", "" },
+			{ "www-authenticate", "" }
+		};
+		return table[index - 1];
+	}
+
+	/**
+	 * Appends `value` to `output` as an integer with an N-bit prefix. `flags`
+	 * are OR'ed into the first byte, above the prefix.
+	 */
+	static void encodeInteger(string &output, unsigned char flags,
+		unsigned int prefixBits, boost::uint64_t value)
+	{
+		unsigned int max = (1u << prefixBits) - 1;
+		if (value < max) {
+			output.append(1, (char) (flags | value));
+		} else {
+			output.append(1, (char) (flags | max));
+			value -= max;
+			while (value >= 128) {
+				output.append(1, (char) (0x80 | (value & 0x7f)));
+				value >>= 7;
+			}
+			output.append(1, (char) value);
+		}
+	}
+
+	/**
+	 * Decodes an integer with an N-bit prefix starting at `*pos`. Advances
+	 * `*pos` on success. Returns false if the input is truncated or the
+	 * integer does not fit in 32 bits.
+	 */
+	static bool decodeInteger(const unsigned char **pos, const unsigned char *end,
+		unsigned int prefixBits, boost::uint32_t *result)
+	{
+		const unsigned char *p = *pos;
+		unsigned int max = (1u << prefixBits) - 1;
+		boost::uint64_t value;
+		unsigned int shift = 0;
+
+		if (p == end) {
+			return false;
+		}
+		value = *p & max;
+		p++;
+		if (value == max) {
+			unsigned char byte;
+			do {
+				if (p == end || shift > 28) {
+					return false;
+				}
+				byte = *p;
+				p++;
+				value += (boost::uint64_t) (byte & 0x7f) << shift;
+				shift += 7;
+			} while (byte & 0x80);
+			if (value > 0xffffffffull) {
+				return false;
+			}
+		}
+
+		*result = (boost::uint32_t) value;
+		*pos = p;
+		return true;
+	}
+
+	static size_t getHuffmanEncodedSize(const StaticString &str) {
+		const unsigned char *data = (const unsigned char *) str.data();
+		boost::uint64_t bits = 0;
+		for (size_t i = 0; i < str.size(); i++) {
+			bits += huffmanCodeLengths()[data[i]];
+		}
+		return (bits + 7) / 8;
+	}
+
+	static void huffmanEncode(string &output, const StaticString &str) {
+		const unsigned char *data = (const unsigned char *) str.data();
+		boost::uint64_t buffer = 0;
+		unsigned int bits = 0;
+
+		for (size_t i = 0; i < str.size(); i++) {
+			unsigned int len = huffmanCodeLengths()[data[i]];
+			buffer = (buffer << len) | huffmanCodes()[data[i]];
+			bits += len;
+			while (bits >= 8) {
+				bits -= 8;
+				output.append(1, (char) (buffer >> bits));
+			}
+		}
+		if (bits > 0) {
+			// Pad with the most significant bits of the EOS symbol (all ones).
+			output.append(1, (char) ((buffer << (8 - bits)) | (0xff >> bits)));
+		}
+	}
+
+	/**
+	 * Decodes a Huffman coded string and appends the result to `output`.
+	 * Returns false if the input is not a valid Huffman code, as described
+	 * in RFC 7541 section 5.2.
+	 */
+	static bool huffmanDecode(string &output, const unsigned char *data, size_t size) {
+		boost::uint32_t code = 0;
+		unsigned int len = 0;
+		bool allOnes = true;
+
+		for (size_t i = 0; i < size; i++) {
+			for (int bit = 7; bit >= 0; bit--) {
+				unsigned int b = (data[i] >> bit) & 1;
+				code = (code << 1) | b;
+				len++;
+				allOnes = allOnes && b;
+				if (huffmanCountForLength()[len] > 0
+				 && code >= huffmanFirstCodeForLength()[len]
+				 && code - huffmanFirstCodeForLength()[len] < huffmanCountForLength()[len])
+				{
+					unsigned int symbol = huffmanSortedSymbols()[
+						huffmanOffsetForLength()[len]
+						+ code - huffmanFirstCodeForLength()[len]];
+					if (symbol == 256) {
+						// EOS in the string is a decoding error.
+						return false;
+					}
+					output.append(1, (char) symbol);
+					code = 0;
+					len = 0;
+					allOnes = true;
+				} else if (len >= 30) {
+					return false;
+				}
+			}
+		}
+
+		// Padding must be shorter than 8 bits and consist of EOS bits.
+		return len < 8 && allOnes;
+	}
+
+	/**
+	 * Appends a string literal, Huffman coded if that makes it shorter.
+	 */
+	static void encodeString(string &output, const StaticString &str) {
+		size_t huffmanSize = getHuffmanEncodedSize(str);
+		if (huffmanSize < str.size()) {
+			encodeInteger(output, 0x80, 7, huffmanSize);
+			huffmanEncode(output, str);
+		} else {
+			encodeInteger(output, 0, 7, str.size());
+			output.append(str.data(), str.size());
+		}
+	}
+
+	/**
+	 * Decodes a string literal starting at `*pos` and stores it in `result`.
+	 * Advances `*pos` on success. Strings longer than `maxSize` are rejected.
+	 */
+	static bool decodeString(const unsigned char **pos, const unsigned char *end,
+		size_t maxSize, string &result)
+	{
+		const unsigned char *p = *pos;
+		boost::uint32_t size;
+		bool huffman;
+
+		if (p == end) {
+			return false;
+		}
+		huffman = *p & 0x80;
+		if (!decodeInteger(&p, end, 7, &size) || size > (size_t) (end - p)
+		 || size > maxSize)
+		{
+			return false;
+		}
+
+		result.clear();
+		if (huffman) {
+			if (!huffmanDecode(result, p, size) || result.size() > maxSize) {
+				return false;
+			}
+		} else {
+			result.assign((const char *) p, size);
+		}
+		*pos = p + size;
+		return true;
+	}
+
+private:
+	static const boost::uint32_t *huffmanCodes() {
+		static const boost::uint32_t codes[257] = {
+			0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5,
+			0xfffffe6, 0xfffffe7, 0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9,
+			0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec, 0xfffffed, 0xfffffee,
+			0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+			0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9,
+			0xffffffa, 0xffffffb, 0x14, 0x3f8, 0x3f9, 0xffa,
+			0x1ff9, 0x15, 0xf8, 0x7fa, 0x3fa, 0x3fb,
+			0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+			0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b,
+			0x1c, 0x1d, 0x1e, 0x1f, 0x5c, 0xfb,
+			0x7ffc, 0x20, 0xffb, 0x3fc, 0x1ffa, 0x21,
+			0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+			0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+			0x69, 0x6a, 0x6b, 0x6c, 0x6d, 0x6e,
+			0x6f, 0x70, 0x71, 0x72, 0xfc, 0x73,
+			0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+			0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5,
+			0x25, 0x26, 0x27, 0x6, 0x74, 0x75,
+			0x28, 0x29, 0x2a, 0x7, 0x2b, 0x76,
+			0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+			0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd,
+			0x1ffd, 0xffffffc, 0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8,
+			0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9, 0x3fffd6, 0x7fffda,
+			0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+			0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1,
+			0x7fffe2, 0x7fffe3, 0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5,
+			0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef, 0x3fffda, 0x1fffdd,
+			0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+			0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf,
+			0x7fffeb, 0x7fffec, 0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2,
+			0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef, 0xfffea, 0x3fffe2,
+			0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+			0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2,
+			0x3fffe8, 0x1ffffec, 0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde,
+			0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed, 0x7fff2, 0x1fffe3,
+			0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+			0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3,
+			0x7ffffe4, 0x7ffffe5, 0xfffec, 0xfffff3, 0xfffed, 0x1fffe6,
+			0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3, 0x3fffea, 0x3fffeb,
+			0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+			0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8,
+			0x7ffffe9, 0x7ffffea, 0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed,
+			0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee, 0x3fffffff
+		};
+		return codes;
+	}
+
+	static const unsigned char *huffmanCodeLengths() {
+		static const unsigned char lengths[257] = {
+			13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+			28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+			6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+			5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+			13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+			7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+			15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+			6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+			20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+			24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+			22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+			21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+			26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+			19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+			20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+			26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+			30
+		};
+		return lengths;
+	}
+
+	// The HPACK Huffman code is canonical, so it can be decoded by
+	// comparing the code read so far against the first code of each length.
+
+	static const boost::uint16_t *huffmanSortedSymbols() {
+		static const boost::uint16_t symbols[257] = {
+			48, 49, 50, 97, 99, 101, 105, 111, 115, 116, 32, 37,
+			45, 46, 47, 51, 52, 53, 54, 55, 56, 57, 61, 65,
+			95, 98, 100, 102, 103, 104, 108, 109, 110, 112, 114, 117,
+			58, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76,
+			77, 78, 79, 80, 81, 82, 83, 84, 85, 86, 87, 89,
+			106, 107, 113, 118, 119, 120, 121, 122, 38, 42, 44, 59,
+			88, 90, 33, 34, 40, 41, 63, 39, 43, 124, 35, 62,
+			0, 36, 64, 91, 93, 126, 94, 125, 60, 96, 123, 92,
+			195, 208, 128, 130, 131, 162, 184, 194, 224, 226, 153, 161,
+			167, 172, 176, 177, 179, 209, 216, 217, 227, 229, 230, 129,
+			132, 133, 134, 136, 146, 154, 156, 160, 163, 164, 169, 170,
+			173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232,
+			233, 1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150,
+			151, 152, 155, 157, 158, 165, 166, 168, 174, 175, 180, 182,
+			183, 188, 191, 197, 231, 239, 9, 142, 144, 145, 148, 159,
+			171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193,
+			200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243,
+			255, 203, 204, 211, 212, 214, 221, 222, 223, 241, 244, 245,
+			246, 247, 248, 250, 251, 252, 253, 254, 2, 3, 4, 5,
+			6, 7, 8, 11, 12, 14, 15, 16, 17, 18, 19, 20,
+			21, 23, 24, 25, 26, 27, 28, 29, 30, 31, 127, 220,
+			249, 10, 13, 22, 256
+		};
+		return symbols;
+	}
+
+	static const boost::uint32_t *huffmanFirstCodeForLength() {
+		static const boost::uint32_t firstCodes[31] = {
+			0x0, 0x0, 0x0, 0x0, 0x0, 0x0,
+			0x14, 0x5c, 0xf8, 0x0, 0x3f8, 0x7fa,
+			0xffa, 0x1ff8, 0x3ffc, 0x7ffc, 0x0, 0x0,
+			0x0, 0x7fff0, 0xfffe6, 0x1fffdc, 0x3fffd2, 0x7fffd8,
+			0xffffea, 0x1ffffec, 0x3ffffe0, 0x7ffffde, 0xfffffe2, 0x0,
+			0x3ffffffc
+		};
+		return firstCodes;
+	}
+
+	static const boost::uint16_t *huffmanCountForLength() {
+		static const boost::uint16_t counts[31] = {
+			0, 0, 0, 0, 0, 10, 26, 32, 6, 0, 5, 3, 2, 6, 2, 3,
+			0, 0, 0, 3, 8, 13, 26, 29, 12, 4, 15, 19, 29, 0, 4
+		};
+		return counts;
+	}
+
+	static const boost::uint16_t *huffmanOffsetForLength() {
+		static const boost::uint16_t offsets[31] = {
+			0, 0, 0, 0, 0, 0, 10, 36, 68, 0, 74, 79, 82, 84, 90, 92,
+			0, 0, 0, 95, 98, 106, 119, 145, 174, 186, 190, 205, 224, 0, 253
+		};
+		return offsets;
+	}
+};
+
+
+/**
+ * An HPACK dynamic table (RFC 7541 section 2.3.2). Index 1 is the most
+ * recently inserted entry.
+ */
+class Http2HpackDynamicTable {
+private:
+	deque<Http2Header> entries;
+	size_t size;
+	size_t maxSize;
+
+	void evict(size_t targetSize) {
+		while (size > targetSize) {
+			const Http2Header &header = entries.back();
+			size -= header.first.size() + header.second.size()
+				+ Http2Hpack::ENTRY_OVERHEAD;
+			entries.pop_back();
+		}
+	}
+
+public:
+	Http2HpackDynamicTable(size_t _maxSize = 4096)
+		: size(0),
+		  maxSize(_maxSize)
+		{ }
+
+	void insert(const StaticString &name, const StaticString &value) {
+		size_t entrySize = name.size() + value.size() + Http2Hpack::ENTRY_OVERHEAD;
+		if (entrySize > maxSize) {
+			// Per RFC 7541 section 4.4, this empties the table.
+			evict(0);
+		} else {
+			evict(maxSize - entrySize);
+			entries.push_front(Http2Header(name, value));
+			size += entrySize;
+		}
+	}
+
+	void setMaxSize(size_t value) {
+		maxSize = value;
+		evict(value);
+	}
+
+	size_t getMaxSize() const {
+		return maxSize;
+	}
+
+	size_t getSize() const {
+		return size;
+	}
+
+	unsigned int getCount() const {
+		return entries.size();
+	}
+
+	/** `index` is 1-based. */
+	const Http2Header &get(unsigned int index) const {
+		return entries[index - 1];
+	}
+};
+
+
+/**
+ * Decodes HPACK header blocks. Each HTTP/2 connection has one decoder,
+ * whose dynamic table lives as long as the connection.
+ */
+class Http2HpackDecoder {
+private:
+	Http2HpackDynamicTable table;
+	size_t maxTableSizeLimit;
+	size_t maxHeaderListSize;
+
+	bool lookup(boost::uint32_t index, StaticString &name, StaticString &value) const {
+		if (index == 0) {
+			return false;
+		} else if (index <= Http2Hpack::STATIC_TABLE_SIZE) {
+			const Http2Hpack::StaticEntry &entry = Http2Hpack::getStaticEntry(index);
+			name = entry.name;
+			value = entry.value;
+			return true;
+		} else if (index - Http2Hpack::STATIC_TABLE_SIZE <= table.getCount()) {
+			const Http2Header &entry = table.get(index - Http2Hpack::STATIC_TABLE_SIZE);
+			name = entry.first;
+			value = entry.second;
+			return true;
+		} else {
+			return false;
+		}
+	}
+
+public:
+	Http2HpackDecoder(size_t _maxTableSizeLimit = 4096, size_t _maxHeaderListSize = 65536)
+		: table(_maxTableSizeLimit),
+		  maxTableSizeLimit(_maxTableSizeLimit),
+		  maxHeaderListSize(_maxHeaderListSize)
+		{ }
+
+	/**
+	 * Decodes a complete header block and appends the fields to `headers`.
+	 * Returns false on a compression error, after which the connection
+	 * must be terminated because the dynamic table is no longer in sync.
+	 */
+	bool decode(const char *data, size_t size, Http2HeaderList &headers) {
+		const unsigned char *pos = (const unsigned char *) data;
+		const unsigned char *end = pos + size;
+		size_t listSize = 0;
+		bool headerSeen = false;
+		string name, value;
+		StaticString indexedName, indexedValue;
+
+		while (pos < end) {
+			boost::uint32_t index;
+			unsigned char byte = *pos;
+
+			if (byte & 0x80) {
+				// Indexed header field.
+				if (!Http2Hpack::decodeInteger(&pos, end, 7, &index)
+				 || !lookup(index, indexedName, indexedValue))
+				{
+					return false;
+				}
+				headers.push_back(Http2Header(indexedName, indexedValue));
+			} else if ((byte & 0xe0) == 0x20) {
+				// Dynamic table size update. Only allowed at the start of
+				// a header block.
+				if (headerSeen
+				 || !Http2Hpack::decodeInteger(&pos, end, 5, &index)
+				 || index > maxTableSizeLimit)
+				{
+					return false;
+				}
+				table.setMaxSize(index);
+				continue;
+			} else {
+				// Literal header field: with incremental indexing (01),
+				// without indexing (0000) or never indexed (0001).
+				bool indexed = (byte & 0xc0) == 0x40;
+				if (!Http2Hpack::decodeInteger(&pos, end, indexed ? 6 : 4, &index)) {
+					return false;
+				}
+				if (index == 0) {
+					if (!Http2Hpack::decodeString(&pos, end, maxHeaderListSize, name)) {
+						return false;
+					}
+				} else if (lookup(index, indexedName, indexedValue)) {
+					name.assign(indexedName.data(), indexedName.size());
+				} else {
+					return false;
+				}
+				if (!Http2Hpack::decodeString(&pos, end, maxHeaderListSize, value)) {
+					return false;
+				}
+				if (indexed) {
+					table.insert(name, value);
+				}
+				headers.push_back(Http2Header(name, value));
+			}
+
+			headerSeen = true;
+			listSize += headers.back().first.size() + headers.back().second.size()
+				+ Http2Hpack::ENTRY_OVERHEAD;
+			if (listSize > maxHeaderListSize) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	const Http2HpackDynamicTable &getTable() const {
+		return table;
+	}
+};
+
+
+/**
+ * Encodes HPACK header blocks. Each HTTP/2 connection has one encoder,
+ * whose dynamic table mirrors the peer's decoder table.
+ */
+class Http2HpackEncoder {
+private:
+	Http2HpackDynamicTable table;
+	size_t maxTableSizeLimit;
+	size_t pendingMaxTableSize;
+	bool maxTableSizeChanged;
+
+	/**
+	 * Returns the index of an entry whose name and value match, or the
+	 * index of an entry whose name matches (setting `*valueMatched` to
+	 * false), or 0.
+	 */
+	unsigned int find(const StaticString &name, const StaticString &value,
+		bool *valueMatched) const
+	{
+		unsigned int nameIndex = 0;
+		unsigned int i;
+
+		for (i = 1; i <= Http2Hpack::STATIC_TABLE_SIZE; i++) {
+			const Http2Hpack::StaticEntry &entry = Http2Hpack::getStaticEntry(i);
+			if (name == entry.name) {
+				if (value == entry.value) {
+					*valueMatched = true;
+					return i;
+				} else if (nameIndex == 0) {
+					nameIndex = i;
+				}
+			}
+		}
+		for (i = 1; i <= table.getCount(); i++) {
+			const Http2Header &entry = table.get(i);
+			if (name == entry.first) {
+				if (value == entry.second) {
+					*valueMatched = true;
+					return i + Http2Hpack::STATIC_TABLE_SIZE;
+				} else if (nameIndex == 0) {
+					nameIndex = i + Http2Hpack::STATIC_TABLE_SIZE;
+				}
+			}
+		}
+
+		*valueMatched = false;
+		return nameIndex;
+	}
+
+	/**
+	 * Values of these headers change from response to response, so adding
+	 * them to the dynamic table would only evict more useful entries.
+	 */
+	static bool shouldIndex(const StaticString &name) {
+		return name != "content-length"
+			&& name != "date"
+			&& name != "etag"
+			&& name != "last-modified"
+			&& name != "expires"
+			&& name != "age"
+			&& name != "set-cookie";
+	}
+
+public:
+	Http2HpackEncoder(size_t _maxTableSizeLimit = 4096)
+		: table(_maxTableSizeLimit),
+		  maxTableSizeLimit(_maxTableSizeLimit),
+		  pendingMaxTableSize(_maxTableSizeLimit),
+		  maxTableSizeChanged(false)
+		{ }
+
+	/**
+	 * Called when the peer announces SETTINGS_HEADER_TABLE_SIZE. The new
+	 * size is signalled at the start of the next header block.
+	 */
+	void setPeerMaxTableSize(size_t size) {
+		size = std::min(size, maxTableSizeLimit);
+		if (size != table.getMaxSize() || maxTableSizeChanged) {
+			pendingMaxTableSize = size;
+			maxTableSizeChanged = true;
+		}
+	}
+
+	void beginHeaderBlock(string &output) {
+		if (maxTableSizeChanged) {
+			maxTableSizeChanged = false;
+			table.setMaxSize(pendingMaxTableSize);
+			Http2Hpack::encodeInteger(output, 0x20, 5, pendingMaxTableSize);
+		}
+	}
+
+	/**
+	 * Appends a header field to a header block. `name` must be lowercase.
+	 * Call `beginHeaderBlock()` first.
+	 */
+	void encode(string &output, const StaticString &name, const StaticString &value) {
+		bool valueMatched;
+		unsigned int index = find(name, value, &valueMatched);
+
+		if (valueMatched) {
+			Http2Hpack::encodeInteger(output, 0x80, 7, index);
+		} else if (shouldIndex(name)
+			&& name.size() + value.size() + Http2Hpack::ENTRY_OVERHEAD <= table.getMaxSize())
+		{
+			Http2Hpack::encodeInteger(output, 0x40, 6, index);
+			if (index == 0) {
+				Http2Hpack::encodeString(output, name);
+			}
+			Http2Hpack::encodeString(output, value);
+			table.insert(name, value);
+		} else {
+			Http2Hpack::encodeInteger(output, 0, 4, index);
+			if (index == 0) {
+				Http2Hpack::encodeString(output, name);
+			}
+			Http2Hpack::encodeString(output, value);
+		}
+	}
+
+	const Http2HpackDynamicTable &getTable() const {
+		return table;
+	}
+};
+
+
+} // namespace ServerKit
+} // namespace Passenger
+
+#endif /* _PASSENGER_SERVER_KIT_HTTP2_HPACK_H_ */
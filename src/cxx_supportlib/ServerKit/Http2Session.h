@@ -0,0 +1,1677 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2015 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_SERVER_KIT_HTTP2_SESSION_H_
+#define _PASSENGER_SERVER_KIT_HTTP2_SESSION_H_
+
+#include <boost/cstdint.hpp>
+#include <oxt/macros.hpp>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <map>
+#include <ev.h>
+#include <jsoncpp/json.h>
+#include <modp_b64.h>
+#include <Logging.h>
+#include <StaticString.h>
+#include <Exceptions.h>
+#include <ServerKit/Context.h>
+#include <ServerKit/Http2Hpack.h>
+#include <ServerKit/http_parser.h>
+#include <Utils/IOUtils.h>
+#include <Utils/StrIntUtils.h>
+
+namespace Passenger {
+namespace ServerKit {
+
+using namespace std;
+
+
+/**
+ * Server side of a cleartext HTTP/2 (RFC 7540) connection.
+ *
+ * HttpServer and the servers derived from it are built around one request
+ * at a time per client. Rather than teaching all of them about streams,
+ * Http2Session bridges every HTTP/2 stream to a regular HTTP/1.1 client
+ * of the same server: for each new stream it creates a Unix socket pair,
+ * hands one end to the server as if it were a freshly accepted client, and
+ * writes the stream's request to the other end as an HTTP/1.1 request with
+ * `Connection: close`. The HTTP/1.1 response that the server writes back is
+ * parsed and turned into HEADERS and DATA frames. This way every stream
+ * goes through the normal Request lifecycle, including routing,
+ * turbocaching and application forwarding.
+ *
+ * Flow control maps onto socket backpressure. A stream's receive window is
+ * only replenished after its request body data has been written to the
+ * socket pair, and response data is only read from the socket pair while
+ * the stream's and the connection's send windows have room.
+ *
+ * Every open stream costs two file descriptors, and the server usually
+ * opens a third one to forward the request. `maxConcurrentStreams` only
+ * limits a single connection, so owners that serve many connections
+ * should also share a stream counter between their sessions (see
+ * `sharedStreamCount`).
+ *
+ * Many frames make us do work or send a reply without the client getting
+ * anywhere, so a client can send them endlessly: PING, SETTINGS, PRIORITY,
+ * RST_STREAM and empty DATA frames, and streams that are reset right after
+ * being opened ("rapid reset"). Both are counted per second, and a client
+ * that exceeds `maxControlFramesPerSecond` or `maxStreamResetsPerSecond` is
+ * sent GOAWAY with ENHANCE_YOUR_CALM. Replies are only bounded if the
+ * owner stops feeding the session while its output is backlogged; call
+ * `setOutputBlocked()` to also stop reading the stream bridges meanwhile.
+ *
+ * The owner must set the callbacks, call `start()` to send the server
+ * connection preface, feed it the data received from the client, and call
+ * `destroy()` when the client is disconnected. Server push and stream
+ * priorities are not implemented.
+ */
+class Http2Session {
+public:
+	typedef void (*OutputCallback)(Http2Session *session, const char *data, unsigned int size);
+	typedef bool (*NewStreamCallback)(Http2Session *session, int fd);
+	typedef void (*FinishedCallback)(Http2Session *session, const StaticString &error);
+
+	enum State {
+		ACTIVE,
+		GOING_AWAY,
+		FINISHED
+	};
+
+	enum FrameType {
+		DATA          = 0x0,
+		HEADERS       = 0x1,
+		PRIORITY      = 0x2,
+		RST_STREAM    = 0x3,
+		SETTINGS      = 0x4,
+		PUSH_PROMISE  = 0x5,
+		PING          = 0x6,
+		GOAWAY        = 0x7,
+		WINDOW_UPDATE = 0x8,
+		CONTINUATION  = 0x9
+	};
+
+	enum FrameFlag {
+		FLAG_END_STREAM  = 0x1,
+		FLAG_ACK         = 0x1,
+		FLAG_END_HEADERS = 0x4,
+		FLAG_PADDED      = 0x8,
+		FLAG_PRIORITY    = 0x20
+	};
+
+	enum ErrorCode {
+		NO_ERROR           = 0x0,
+		PROTOCOL_ERROR     = 0x1,
+		INTERNAL_ERROR     = 0x2,
+		FLOW_CONTROL_ERROR = 0x3,
+		STREAM_CLOSED      = 0x5,
+		FRAME_SIZE_ERROR   = 0x6,
+		REFUSED_STREAM     = 0x7,
+		CANCEL             = 0x8,
+		COMPRESSION_ERROR  = 0x9,
+		ENHANCE_YOUR_CALM  = 0xb
+	};
+
+	enum Setting {
+		SETTINGS_HEADER_TABLE_SIZE      = 0x1,
+		SETTINGS_ENABLE_PUSH            = 0x2,
+		SETTINGS_MAX_CONCURRENT_STREAMS = 0x3,
+		SETTINGS_INITIAL_WINDOW_SIZE    = 0x4,
+		SETTINGS_MAX_FRAME_SIZE         = 0x5,
+		SETTINGS_MAX_HEADER_LIST_SIZE   = 0x6
+	};
+
+	static const unsigned int PREFACE_SIZE = 24;
+	static const unsigned int FRAME_HEADER_SIZE = 9;
+	static const unsigned int DEFAULT_WINDOW_SIZE = 65535;
+	static const unsigned int DEFAULT_MAX_FRAME_SIZE = 16384;
+	static const unsigned int MAX_FRAME_SIZE_LIMIT = 16777215;
+	static const long long MAX_WINDOW_SIZE = 0x7fffffff;
+	static const unsigned int MAX_HEADER_LIST_SIZE = 65536;
+	/** Stop reading a stream's response once this much data awaits window space. */
+	static const unsigned int MAX_PENDING_RESPONSE_DATA = 65536;
+
+	/** The client connection preface (RFC 7540 section 3.5). */
+	static StaticString getPreface() {
+		return P_STATIC_STRING("PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n");
+	}
+
+
+	/***** Configuration *****/
+
+	unsigned int maxConcurrentStreams;
+	/**
+	 * If not NULL, the number of open streams of all sessions that share
+	 * this counter. New streams are refused while it is at least
+	 * `maxSharedStreams`. The counter must outlive this session.
+	 */
+	unsigned int *sharedStreamCount;
+	unsigned int maxSharedStreams;
+	/** Receive window of each stream. Must be at least DEFAULT_WINDOW_SIZE. */
+	unsigned int initialWindowSize;
+	/**
+	 * How many PING, SETTINGS, PRIORITY, RST_STREAM and empty DATA frames
+	 * the client may send per second. 0 means unlimited.
+	 */
+	unsigned int maxControlFramesPerSecond;
+	/**
+	 * How many streams per second may be reset by the client, or refused
+	 * or reset by us because of the client. 0 means unlimited.
+	 */
+	unsigned int maxStreamResetsPerSecond;
+
+	OutputCallback outputCallback;
+	NewStreamCallback newStreamCallback;
+	FinishedCallback finishedCallback;
+	void *userData;
+
+
+	/***** Statistics (do not modify) *****/
+
+	unsigned long totalStreamsBegun;
+	/** Number of streams that were reset by the client or refused. */
+	unsigned long totalStreamsReset;
+
+private:
+	struct Stream {
+		Http2Session *session;
+		boost::uint32_t id;
+		int fd;
+		ev_io watcher;
+		int watcherEvents;
+
+		/** Data to be written to the socket pair. */
+		string requestData;
+		/** Request body bytes consumed since the last WINDOW_UPDATE. */
+		unsigned int unacknowledgedBytes;
+		long long recvWindow;
+		long long sendWindow;
+		/** -1 if the request has no Content-Length header. */
+		long long contentLength;
+		boost::uint64_t bodyBytesReceived;
+
+		http_parser parser;
+		Http2HeaderList responseHeaders;
+		string headerName, headerValue;
+		/** Response body data waiting for window space. */
+		string responseData;
+
+		bool head: 1;
+		/** Whether the request body is sent with chunked encoding. */
+		bool chunked: 1;
+		bool remoteEnded: 1;
+		bool bridgeWriteClosed: 1;
+		bool bridgeEof: 1;
+		bool lastHeaderCallbackWasValue: 1;
+		bool skippingInterimResponse: 1;
+		bool responseHeadersComplete: 1;
+		bool responseHeadersSent: 1;
+		bool responseComplete: 1;
+		bool resetSent: 1;
+
+		Stream(Http2Session *_session, boost::uint32_t _id, int _fd)
+			: session(_session),
+			  id(_id),
+			  fd(_fd),
+			  watcherEvents(0),
+			  unacknowledgedBytes(0),
+			  recvWindow(_session->initialWindowSize),
+			  sendWindow(_session->peerInitialWindowSize),
+			  contentLength(-1),
+			  bodyBytesReceived(0),
+			  head(false),
+			  chunked(false),
+			  remoteEnded(false),
+			  bridgeWriteClosed(false),
+			  bridgeEof(false),
+			  lastHeaderCallbackWasValue(false),
+			  skippingInterimResponse(false),
+			  responseHeadersComplete(false),
+			  responseHeadersSent(false),
+			  responseComplete(false),
+			  resetSent(false)
+		{
+			http_parser_init(&parser, HTTP_RESPONSE);
+			parser.data = this;
+			ev_io_init(&watcher, _onBridgeEvent, fd, 0);
+			watcher.data = this;
+		}
+	};
+
+	typedef map<boost::uint32_t, Stream *> StreamMap;
+
+	/**
+	 * Defers deleting the session until the outermost session method
+	 * returns, because callbacks may cause the owner to call `destroy()`.
+	 */
+	struct CallGuard {
+		Http2Session *session;
+
+		CallGuard(Http2Session *_session)
+			: session(_session)
+		{
+			session->callDepth++;
+		}
+
+		~CallGuard() {
+			session->callDepth--;
+			if (session->callDepth == 0 && session->destroyRequested) {
+				delete session;
+			}
+		}
+	};
+
+	friend struct CallGuard;
+
+	Context *ctx;
+	State state;
+	bool prefaceReceived: 1;
+	bool settingsReceived: 1;
+	bool destroyRequested: 1;
+	bool outputBlocked: 1;
+	unsigned int callDepth;
+
+	/** Start of the period in which the flood counters count. */
+	ev_tstamp floodPeriodStart;
+	unsigned int controlFrameCount;
+	unsigned int streamResetCount;
+
+	string inputBuffer;
+	string outputBuffer;
+	Http2HpackDecoder decoder;
+	Http2HpackEncoder encoder;
+	StreamMap streams;
+	boost::uint32_t lastStreamId;
+
+	/** Set while a header block is continued in CONTINUATION frames. */
+	boost::uint32_t headerBlockStreamId;
+	unsigned char headerBlockFlags;
+	string headerBlock;
+
+	boost::uint32_t peerInitialWindowSize;
+	boost::uint32_t peerMaxFrameSize;
+	long long connSendWindow;
+	long long connRecvWindow;
+
+
+	/***** Frame output *****/
+
+	static void appendUint32(string &output, boost::uint32_t value) {
+		char buf[4];
+		buf[0] = (char) (value >> 24);
+		buf[1] = (char) (value >> 16);
+		buf[2] = (char) (value >> 8);
+		buf[3] = (char) value;
+		output.append(buf, 4);
+	}
+
+	static boost::uint32_t readUint32(const unsigned char *data) {
+		return ((boost::uint32_t) data[0] << 24)
+			| ((boost::uint32_t) data[1] << 16)
+			| ((boost::uint32_t) data[2] << 8)
+			| (boost::uint32_t) data[3];
+	}
+
+	void writeFrame(FrameType type, unsigned char flags, boost::uint32_t streamId,
+		const char *payload, size_t size)
+	{
+		char header[FRAME_HEADER_SIZE];
+		header[0] = (char) (size >> 16);
+		header[1] = (char) (size >> 8);
+		header[2] = (char) size;
+		header[3] = (char) type;
+		header[4] = (char) flags;
+		outputBuffer.append(header, 5);
+		appendUint32(outputBuffer, streamId & 0x7fffffff);
+		if (size > 0) {
+			outputBuffer.append(payload, size);
+		}
+	}
+
+	void sendSettings() {
+		string payload;
+		payload.append(1, '\0');
+		payload.append(1, (char) SETTINGS_MAX_CONCURRENT_STREAMS);
+		appendUint32(payload, maxConcurrentStreams);
+		payload.append(1, '\0');
+		payload.append(1, (char) SETTINGS_MAX_HEADER_LIST_SIZE);
+		appendUint32(payload, MAX_HEADER_LIST_SIZE);
+		if (initialWindowSize != DEFAULT_WINDOW_SIZE) {
+			payload.append(1, '\0');
+			payload.append(1, (char) SETTINGS_INITIAL_WINDOW_SIZE);
+			appendUint32(payload, initialWindowSize);
+		}
+		writeFrame(SETTINGS, 0, 0, payload.data(), payload.size());
+	}
+
+	void sendWindowUpdate(boost::uint32_t streamId, boost::uint32_t increment) {
+		string payload;
+		appendUint32(payload, increment);
+		writeFrame(WINDOW_UPDATE, 0, streamId, payload.data(), payload.size());
+	}
+
+	void sendRstStream(boost::uint32_t streamId, ErrorCode code) {
+		string payload;
+		appendUint32(payload, code);
+		writeFrame(RST_STREAM, 0, streamId, payload.data(), payload.size());
+	}
+
+	void sendGoaway(ErrorCode code, const StaticString &debugData) {
+		string payload;
+		appendUint32(payload, lastStreamId);
+		appendUint32(payload, code);
+		payload.append(debugData.data(), debugData.size());
+		writeFrame(GOAWAY, 0, 0, payload.data(), payload.size());
+	}
+
+	void flushOutput() {
+		if (!outputBuffer.empty() && !destroyRequested) {
+			string data;
+			data.swap(outputBuffer);
+			outputCallback(this, data.data(), data.size());
+		}
+	}
+
+
+	/***** Session termination *****/
+
+	void connectionError(ErrorCode code, const StaticString &message) {
+		if (state == FINISHED) {
+			return;
+		}
+		P_DEBUG("HTTP/2 connection error " << (int) code << ": " << message);
+		sendGoaway(code, message);
+		finish(message);
+	}
+
+	void finish(const StaticString &error) {
+		state = FINISHED;
+		closeAllStreams();
+		flushOutput();
+		if (!destroyRequested) {
+			finishedCallback(this, error);
+		}
+	}
+
+	void closeAllStreams() {
+		while (!streams.empty()) {
+			Stream *stream = streams.begin()->second;
+			stream->resetSent = true;
+			closeStream(stream);
+		}
+	}
+
+
+	/***** Flood protection *****/
+
+	/**
+	 * Counts an event towards one of the per-second flood counters.
+	 * Returns false, after terminating the session, if the client has
+	 * exceeded the limit.
+	 */
+	bool countFloodEvent(unsigned int &counter, unsigned int limit, const char *description) {
+		if (limit == 0) {
+			return true;
+		}
+
+		ev_tstamp now = ev_now(ctx->libev->getLoop());
+		if (now - floodPeriodStart >= 1) {
+			floodPeriodStart = now;
+			controlFrameCount = 0;
+			streamResetCount = 0;
+		}
+		counter++;
+		if (counter > limit) {
+			P_WARN("HTTP/2 client sent too many " << description <<
+				" (more than " << limit << " per second); closing the connection");
+			connectionError(ENHANCE_YOUR_CALM, "flood detected");
+			return false;
+		} else {
+			return true;
+		}
+	}
+
+	bool countControlFrame() {
+		return countFloodEvent(controlFrameCount, maxControlFramesPerSecond,
+			"control frames");
+	}
+
+	bool countStreamReset() {
+		totalStreamsReset++;
+		return countFloodEvent(streamResetCount, maxStreamResetsPerSecond,
+			"stream resets");
+	}
+
+
+	/***** Streams *****/
+
+	Stream *findStream(boost::uint32_t id) const {
+		StreamMap::const_iterator it = streams.find(id);
+		if (it == streams.end()) {
+			return NULL;
+		} else {
+			return it->second;
+		}
+	}
+
+	void closeStream(Stream *stream) {
+		if (!stream->remoteEnded && !stream->resetSent && state != FINISHED) {
+			// The response is complete but the client is still sending the
+			// request body; tell it to stop (RFC 7540 section 8.1).
+			sendRstStream(stream->id, NO_ERROR);
+		}
+		ev_io_stop(ctx->libev->getLoop(), &stream->watcher);
+		if (stream->fd != -1) {
+			::close(stream->fd);
+			P_LOG_FILE_DESCRIPTOR_CLOSE(stream->fd);
+		}
+		streams.erase(stream->id);
+		if (sharedStreamCount != NULL) {
+			(*sharedStreamCount)--;
+		}
+		delete stream;
+
+		if (state == GOING_AWAY && streams.empty()) {
+			finish(StaticString());
+		}
+	}
+
+	void resetStream(Stream *stream, ErrorCode code) {
+		sendRstStream(stream->id, code);
+		stream->resetSent = true;
+		closeStream(stream);
+		if (code != INTERNAL_ERROR && code != REFUSED_STREAM) {
+			// Caused by the client.
+			countStreamReset();
+		}
+	}
+
+	static bool isConnectionSpecificHeader(const StaticString &name) {
+		return name == "connection"
+			|| name == "keep-alive"
+			|| name == "proxy-connection"
+			|| name == "transfer-encoding"
+			|| name == "upgrade";
+	}
+
+	static bool isValidHeaderName(const StaticString &name) {
+		if (name.empty()) {
+			return false;
+		}
+		for (string::size_type i = 0; i < name.size(); i++) {
+			char ch = name[i];
+			if (ch <= ' ' || ch >= 127 || ch == ':' || (ch >= 'A' && ch <= 'Z')) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	static bool isAllDigits(const StaticString &value) {
+		for (string::size_type i = 0; i < value.size(); i++) {
+			if (value[i] < '0' || value[i] > '9') {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	static bool isValidHeaderValue(const StaticString &value) {
+		return value.find('\r') == string::npos
+			&& value.find('\n') == string::npos
+			&& value.find('\0') == string::npos;
+	}
+
+	/**
+	 * Translates the request headers of a stream into an HTTP/1.1 request
+	 * head. Returns false if the request is malformed (RFC 7540 section
+	 * 8.1.2), in which case the stream must be reset with PROTOCOL_ERROR.
+	 */
+	static bool buildHttp1Request(const Http2HeaderList &headers, string &result,
+		long long *contentLength, bool *head)
+	{
+		Http2HeaderList::const_iterator it, end = headers.end();
+		StaticString method, scheme, authority, path;
+		string cookie, fields;
+		bool pseudoHeadersDone = false;
+
+		*contentLength = -1;
+		for (it = headers.begin(); it != end; it++) {
+			const StaticString name(it->first);
+			const StaticString value(it->second);
+
+			if (!isValidHeaderValue(value)) {
+				return false;
+			}
+			if (!name.empty() && name[0] == ':') {
+				if (pseudoHeadersDone) {
+					return false;
+				} else if (name == ":method" && method.empty()) {
+					method = value;
+				} else if (name == ":scheme" && scheme.empty()) {
+					scheme = value;
+				} else if (name == ":authority" && authority.empty()) {
+					authority = value;
+				} else if (name == ":path" && path.empty()) {
+					path = value;
+				} else {
+					return false;
+				}
+				continue;
+			}
+
+			pseudoHeadersDone = true;
+			if (!isValidHeaderName(name) || isConnectionSpecificHeader(name)) {
+				return false;
+			} else if (name == "te") {
+				if (value != "trailers") {
+					return false;
+				}
+				continue;
+			} else if (name == "expect") {
+				// We always send the request body right away.
+				continue;
+			} else if (name == "host" && !authority.empty()) {
+				continue;
+			} else if (name == "cookie") {
+				// Cookie crumbs must be rejoined (RFC 7540 section 8.1.2.5).
+				if (!cookie.empty()) {
+					cookie.append("; ");
+				}
+				cookie.append(value.data(), value.size());
+				continue;
+			} else if (name == "content-length") {
+				if (value.empty() || !isAllDigits(value)) {
+					return false;
+				}
+				*contentLength = stringToULL(value);
+			}
+			fields.append(name.data(), name.size());
+			fields.append(": ");
+			fields.append(value.data(), value.size());
+			fields.append("\r\n");
+		}
+
+		if (method.empty() || scheme.empty() || path.empty()
+		 || method == "CONNECT" || path.find(' ') != string::npos)
+		{
+			return false;
+		}
+
+		*head = method == "HEAD";
+		result.reserve(method.size() + path.size() + authority.size()
+			+ cookie.size() + fields.size() + 100);
+		result.append(method.data(), method.size());
+		result.append(" ");
+		result.append(path.data(), path.size());
+		result.append(" HTTP/1.1\r\n");
+		if (!authority.empty()) {
+			result.append("Host: ");
+			result.append(authority.data(), authority.size());
+			result.append("\r\n");
+		}
+		result.append(fields);
+		if (!cookie.empty()) {
+			result.append("cookie: ");
+			result.append(cookie);
+			result.append("\r\n");
+		}
+		return true;
+	}
+
+	void openStream(boost::uint32_t id, const Http2HeaderList &headers, bool endStream) {
+		string request;
+		long long contentLength;
+		bool head;
+
+		if (!buildHttp1Request(headers, request, &contentLength, &head)) {
+			P_DEBUG("HTTP/2 stream " << id << ": malformed request");
+			if (countStreamReset()) {
+				sendRstStream(id, PROTOCOL_ERROR);
+			}
+			return;
+		}
+		if (contentLength == -1 && !endStream) {
+			request.append("Transfer-Encoding: chunked\r\n");
+		}
+		request.append("Connection: close\r\n\r\n");
+
+		Stream *stream = createStream(id, request, head);
+		if (stream == NULL) {
+			return;
+		}
+		stream->contentLength = contentLength;
+		stream->chunked = contentLength == -1 && !endStream;
+		if (endStream) {
+			endRequestBody(stream);
+		} else {
+			writeToBridge(stream);
+		}
+	}
+
+	Stream *createStream(boost::uint32_t id, const string &request, bool head) {
+		int fds[2];
+
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+			int e = errno;
+			P_WARN("Cannot create a socket pair for HTTP/2 stream " << id <<
+				": " << strerror(e) << " (errno=" << e << ")");
+			sendRstStream(id, REFUSED_STREAM);
+			return NULL;
+		}
+		P_LOG_FILE_DESCRIPTOR_OPEN2(fds[0], "HTTP/2 stream " << id);
+		P_LOG_FILE_DESCRIPTOR_OPEN2(fds[1], "HTTP/2 stream " << id);
+		try {
+			setNonBlocking(fds[0]);
+			setNonBlocking(fds[1]);
+		} catch (const SystemException &e) {
+			P_WARN("Cannot set up HTTP/2 stream " << id << ": " << e.what());
+			::close(fds[0]);
+			::close(fds[1]);
+			P_LOG_FILE_DESCRIPTOR_CLOSE(fds[0]);
+			P_LOG_FILE_DESCRIPTOR_CLOSE(fds[1]);
+			sendRstStream(id, REFUSED_STREAM);
+			return NULL;
+		}
+
+		Stream *stream = new Stream(this, id, fds[0]);
+		stream->requestData = request;
+		stream->head = head;
+		streams.insert(make_pair(id, stream));
+		if (sharedStreamCount != NULL) {
+			(*sharedStreamCount)++;
+		}
+		totalStreamsBegun++;
+
+		if (!newStreamCallback(this, fds[1])) {
+			::close(fds[1]);
+			P_LOG_FILE_DESCRIPTOR_CLOSE(fds[1]);
+			resetStream(stream, REFUSED_STREAM);
+			return NULL;
+		}
+		return stream;
+	}
+
+	void endRequestBody(Stream *stream) {
+		stream->remoteEnded = true;
+		if (stream->chunked) {
+			if (!stream->bridgeWriteClosed) {
+				stream->requestData.append("0\r\n\r\n");
+			}
+		} else if (stream->contentLength != -1
+			&& stream->bodyBytesReceived != (boost::uint64_t) stream->contentLength)
+		{
+			resetStream(stream, PROTOCOL_ERROR);
+			return;
+		}
+		writeToBridge(stream);
+	}
+
+
+	/***** Bridge I/O *****/
+
+	static void _onBridgeEvent(EV_P_ ev_io *io, int revents) {
+		Stream *stream = static_cast<Stream *>(io->data);
+		stream->session->onBridgeEvent(stream, revents);
+	}
+
+	void onBridgeEvent(Stream *stream, int revents) {
+		CallGuard guard(this);
+		boost::uint32_t id = stream->id;
+
+		if (revents & EV_WRITE) {
+			writeToBridge(stream);
+		}
+		if ((revents & EV_READ) && findStream(id) == stream) {
+			readFromBridge(stream);
+		}
+		flushOutput();
+	}
+
+	void updateWatcher(Stream *stream) {
+		int events = 0;
+
+		if (!stream->responseComplete && !stream->bridgeEof && !outputBlocked
+		 && stream->responseData.size() < MAX_PENDING_RESPONSE_DATA)
+		{
+			events |= EV_READ;
+		}
+		if (!stream->requestData.empty() && !stream->bridgeWriteClosed) {
+			events |= EV_WRITE;
+		}
+
+		if (events != stream->watcherEvents) {
+			struct ev_loop *loop = ctx->libev->getLoop();
+			ev_io_stop(loop, &stream->watcher);
+			ev_io_set(&stream->watcher, stream->fd, events);
+			if (events != 0) {
+				ev_io_start(loop, &stream->watcher);
+			}
+			stream->watcherEvents = events;
+		}
+	}
+
+	void writeToBridge(Stream *stream) {
+		while (!stream->requestData.empty() && !stream->bridgeWriteClosed) {
+			ssize_t ret;
+			do {
+				#ifdef MSG_NOSIGNAL
+					ret = ::send(stream->fd, stream->requestData.data(),
+						stream->requestData.size(), MSG_NOSIGNAL);
+				#else
+					ret = ::write(stream->fd, stream->requestData.data(),
+						stream->requestData.size());
+				#endif
+			} while (ret == -1 && errno == EINTR);
+
+			if (ret >= 0) {
+				stream->requestData.erase(0, ret);
+			} else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			} else {
+				// The server stopped reading the request, e.g. because it
+				// responded early. Discard the rest of the body; the response
+				// can still be read.
+				stream->bridgeWriteClosed = true;
+				stream->requestData.clear();
+			}
+		}
+
+		if (stream->requestData.empty() && stream->unacknowledgedBytes > 0
+		 && !stream->remoteEnded)
+		{
+			sendWindowUpdate(stream->id, stream->unacknowledgedBytes);
+			stream->recvWindow += stream->unacknowledgedBytes;
+			stream->unacknowledgedBytes = 0;
+		}
+		updateWatcher(stream);
+	}
+
+	void readFromBridge(Stream *stream) {
+		boost::uint32_t id = stream->id;
+		char buf[1024 * 16];
+
+		while (!stream->responseComplete && !stream->bridgeEof && !outputBlocked
+			&& stream->responseData.size() < MAX_PENDING_RESPONSE_DATA)
+		{
+			ssize_t ret;
+			do {
+				ret = ::read(stream->fd, buf, sizeof(buf));
+			} while (ret == -1 && errno == EINTR);
+
+			if (ret > 0) {
+				size_t parsed = http_parser_execute(&stream->parser, getResponseParserSettings(),
+					buf, ret);
+				if (parsed != (size_t) ret && !stream->responseComplete) {
+					P_WARN("HTTP/2 stream " << id << ": cannot parse response: " <<
+						http_errno_description(HTTP_PARSER_ERRNO(&stream->parser)));
+					resetStream(stream, INTERNAL_ERROR);
+					return;
+				}
+			} else if (ret == 0) {
+				stream->bridgeEof = true;
+				// Signals EOF, which completes responses without Content-Length.
+				http_parser_execute(&stream->parser, getResponseParserSettings(), NULL, 0);
+			} else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			} else {
+				stream->bridgeEof = true;
+			}
+		}
+
+		flushStream(stream);
+		if (findStream(id) != stream) {
+			return;
+		}
+		if (stream->bridgeEof && !stream->responseComplete) {
+			P_DEBUG("HTTP/2 stream " << id << ": incomplete response");
+			resetStream(stream, INTERNAL_ERROR);
+		} else {
+			updateWatcher(stream);
+		}
+	}
+
+
+	/***** Response parsing *****/
+
+	static const http_parser_settings *getResponseParserSettings() {
+		static const http_parser_settings settings = {
+			NULL,
+			NULL,
+			NULL,
+			onResponseHeaderField,
+			onResponseHeaderValue,
+			onResponseHeadersComplete,
+			onResponseBody,
+			onResponseMessageComplete
+		};
+		return &settings;
+	}
+
+	static void addResponseHeader(Stream *stream) {
+		string &name = stream->headerName;
+		for (string::size_type i = 0; i < name.size(); i++) {
+			if (name[i] >= 'A' && name[i] <= 'Z') {
+				name[i] = name[i] - 'A' + 'a';
+			}
+		}
+		stream->responseHeaders.push_back(Http2Header(name, stream->headerValue));
+		name.clear();
+		stream->headerValue.clear();
+	}
+
+	static int onResponseHeaderField(http_parser *parser, const char *data, size_t size) {
+		Stream *stream = static_cast<Stream *>(parser->data);
+		if (stream->lastHeaderCallbackWasValue) {
+			addResponseHeader(stream);
+			stream->lastHeaderCallbackWasValue = false;
+		}
+		stream->headerName.append(data, size);
+		return 0;
+	}
+
+	static int onResponseHeaderValue(http_parser *parser, const char *data, size_t size) {
+		Stream *stream = static_cast<Stream *>(parser->data);
+		stream->headerValue.append(data, size);
+		stream->lastHeaderCallbackWasValue = true;
+		return 0;
+	}
+
+	static int onResponseHeadersComplete(http_parser *parser) {
+		Stream *stream = static_cast<Stream *>(parser->data);
+		if (stream->lastHeaderCallbackWasValue) {
+			addResponseHeader(stream);
+			stream->lastHeaderCallbackWasValue = false;
+		}
+		if (parser->status_code < 200) {
+			// We strip `Expect` so this should not happen, but HTTP/1
+			// allows interim responses anyway. Drop them.
+			stream->skippingInterimResponse = true;
+			stream->responseHeaders.clear();
+			return 0;
+		}
+		stream->responseHeadersComplete = true;
+		return stream->head ? 1 : 0;
+	}
+
+	static int onResponseBody(http_parser *parser, const char *data, size_t size) {
+		Stream *stream = static_cast<Stream *>(parser->data);
+		stream->responseData.append(data, size);
+		return 0;
+	}
+
+	static int onResponseMessageComplete(http_parser *parser) {
+		Stream *stream = static_cast<Stream *>(parser->data);
+		if (stream->skippingInterimResponse) {
+			stream->skippingInterimResponse = false;
+			return 0;
+		}
+		stream->responseComplete = true;
+		http_parser_pause(parser, 1);
+		return 0;
+	}
+
+	void sendResponseHeaders(Stream *stream, bool endStream) {
+		Http2HeaderList::const_iterator it, end = stream->responseHeaders.end();
+		string block;
+		char status[8];
+
+		encoder.beginHeaderBlock(block);
+		snprintf(status, sizeof(status), "%u", stream->parser.status_code);
+		encoder.encode(block, P_STATIC_STRING(":status"), status);
+		for (it = stream->responseHeaders.begin(); it != end; it++) {
+			const StaticString name(it->first);
+			// HttpServer adds a CGI-style Status header to every response.
+			if (!isConnectionSpecificHeader(name) && name != "status") {
+				encoder.encode(block, name, it->second);
+			}
+		}
+		stream->responseHeaders.clear();
+
+		size_t pos = 0;
+		bool first = true;
+		do {
+			size_t size = std::min<size_t>(block.size() - pos, peerMaxFrameSize);
+			unsigned char flags = 0;
+			if (pos + size == block.size()) {
+				flags |= FLAG_END_HEADERS;
+			}
+			if (first && endStream) {
+				flags |= FLAG_END_STREAM;
+			}
+			writeFrame(first ? HEADERS : CONTINUATION, flags, stream->id,
+				block.data() + pos, size);
+			pos += size;
+			first = false;
+		} while (pos < block.size());
+	}
+
+	/**
+	 * Sends as much of the response as the flow control windows allow.
+	 * Closes the stream once the response has been sent completely.
+	 */
+	void flushStream(Stream *stream) {
+		if (stream->responseHeadersComplete && !stream->responseHeadersSent) {
+			bool endStream = stream->responseComplete && stream->responseData.empty();
+			sendResponseHeaders(stream, endStream);
+			stream->responseHeadersSent = true;
+			if (endStream) {
+				closeStream(stream);
+				return;
+			}
+		}
+		if (!stream->responseHeadersSent) {
+			return;
+		}
+
+		while (!stream->responseData.empty()) {
+			long long window = std::min(stream->sendWindow, connSendWindow);
+			if (window <= 0) {
+				break;
+			}
+			size_t size = std::min<size_t>(stream->responseData.size(),
+				std::min<long long>(window, peerMaxFrameSize));
+			bool endStream = stream->responseComplete && size == stream->responseData.size();
+			writeFrame(DATA, endStream ? FLAG_END_STREAM : 0, stream->id,
+				stream->responseData.data(), size);
+			stream->responseData.erase(0, size);
+			stream->sendWindow -= size;
+			connSendWindow -= size;
+			if (endStream) {
+				closeStream(stream);
+				return;
+			}
+		}
+
+		if (stream->responseComplete && stream->responseData.empty()) {
+			writeFrame(DATA, FLAG_END_STREAM, stream->id, NULL, 0);
+			closeStream(stream);
+		} else {
+			updateWatcher(stream);
+		}
+	}
+
+	void flushAllStreams() {
+		vector<boost::uint32_t> ids;
+		StreamMap::const_iterator it, end = streams.end();
+
+		for (it = streams.begin(); it != end; it++) {
+			ids.push_back(it->first);
+		}
+		for (unsigned int i = 0; i < ids.size() && state != FINISHED; i++) {
+			Stream *stream = findStream(ids[i]);
+			if (stream != NULL) {
+				flushStream(stream);
+			}
+		}
+	}
+
+
+	/***** Frame processing *****/
+
+	size_t processInput(const char *begin, const char *end) {
+		const char *pos = begin;
+
+		if (!prefaceReceived) {
+			size_t size = std::min<size_t>(end - pos, PREFACE_SIZE);
+			if (memcmp(pos, getPreface().data(), size) != 0) {
+				connectionError(PROTOCOL_ERROR, "invalid connection preface");
+				return end - begin;
+			} else if (size < PREFACE_SIZE) {
+				return 0;
+			}
+			pos += PREFACE_SIZE;
+			prefaceReceived = true;
+		}
+
+		while (state != FINISHED && (size_t) (end - pos) >= FRAME_HEADER_SIZE) {
+			const unsigned char *header = (const unsigned char *) pos;
+			boost::uint32_t size = ((boost::uint32_t) header[0] << 16)
+				| ((boost::uint32_t) header[1] << 8)
+				| (boost::uint32_t) header[2];
+
+			if (size > DEFAULT_MAX_FRAME_SIZE) {
+				connectionError(FRAME_SIZE_ERROR, "frame too large");
+				return end - begin;
+			} else if ((size_t) (end - pos) < FRAME_HEADER_SIZE + size) {
+				break;
+			}
+			processFrame((FrameType) header[3], header[4],
+				readUint32(header + 5) & 0x7fffffff,
+				header + FRAME_HEADER_SIZE, size);
+			pos += FRAME_HEADER_SIZE + size;
+		}
+
+		return pos - begin;
+	}
+
+	void processFrame(FrameType type, unsigned char flags, boost::uint32_t streamId,
+		const unsigned char *payload, boost::uint32_t size)
+	{
+		if (!settingsReceived && type != SETTINGS) {
+			connectionError(PROTOCOL_ERROR, "expected a SETTINGS frame");
+			return;
+		}
+		if (headerBlockStreamId != 0
+		 && (type != CONTINUATION || streamId != headerBlockStreamId))
+		{
+			connectionError(PROTOCOL_ERROR, "expected a CONTINUATION frame");
+			return;
+		}
+
+		switch (type) {
+		case DATA:
+			processDataFrame(flags, streamId, payload, size);
+			break;
+		case HEADERS:
+			processHeadersFrame(flags, streamId, payload, size);
+			break;
+		case PRIORITY:
+			if (streamId == 0) {
+				connectionError(PROTOCOL_ERROR, "PRIORITY frame on stream 0");
+			} else if (size != 5) {
+				connectionError(FRAME_SIZE_ERROR, "invalid PRIORITY frame size");
+			} else {
+				countControlFrame();
+			}
+			break;
+		case RST_STREAM:
+			processRstStreamFrame(streamId, payload, size);
+			break;
+		case SETTINGS:
+			processSettingsFrame(flags, streamId, payload, size);
+			break;
+		case PUSH_PROMISE:
+			connectionError(PROTOCOL_ERROR, "clients may not push");
+			break;
+		case PING:
+			if (streamId != 0) {
+				connectionError(PROTOCOL_ERROR, "PING frame on a stream");
+			} else if (size != 8) {
+				connectionError(FRAME_SIZE_ERROR, "invalid PING frame size");
+			} else if (countControlFrame() && !(flags & FLAG_ACK)) {
+				writeFrame(PING, FLAG_ACK, 0, (const char *) payload, size);
+			}
+			break;
+		case GOAWAY:
+			if (streamId != 0) {
+				connectionError(PROTOCOL_ERROR, "GOAWAY frame on a stream");
+			} else if (state == ACTIVE) {
+				state = GOING_AWAY;
+				if (streams.empty()) {
+					finish(StaticString());
+				}
+			}
+			break;
+		case WINDOW_UPDATE:
+			processWindowUpdateFrame(streamId, payload, size);
+			break;
+		case CONTINUATION:
+			if (headerBlockStreamId == 0) {
+				connectionError(PROTOCOL_ERROR, "unexpected CONTINUATION frame");
+			} else if (headerBlock.size() + size > MAX_HEADER_LIST_SIZE * 2) {
+				connectionError(ENHANCE_YOUR_CALM, "header block too large");
+			} else {
+				headerBlock.append((const char *) payload, size);
+				if (flags & FLAG_END_HEADERS) {
+					headerBlockStreamId = 0;
+					processHeaderBlock(streamId);
+				}
+			}
+			break;
+		default:
+			// Unknown frame types must be ignored.
+			break;
+		}
+	}
+
+	/**
+	 * Strips the padding of a DATA or HEADERS frame. Returns false if the
+	 * padding is invalid.
+	 */
+	static bool stripPadding(unsigned char flags, const unsigned char **payload,
+		boost::uint32_t *size)
+	{
+		if (flags & FLAG_PADDED) {
+			if (*size < 1 || (*payload)[0] >= *size) {
+				return false;
+			}
+			*size -= 1 + (*payload)[0];
+			(*payload)++;
+		}
+		return true;
+	}
+
+	void processHeadersFrame(unsigned char flags, boost::uint32_t streamId,
+		const unsigned char *payload, boost::uint32_t size)
+	{
+		if (streamId == 0) {
+			connectionError(PROTOCOL_ERROR, "HEADERS frame on stream 0");
+			return;
+		}
+		if (!stripPadding(flags, &payload, &size)) {
+			connectionError(PROTOCOL_ERROR, "invalid padding");
+			return;
+		}
+		if (flags & FLAG_PRIORITY) {
+			if (size < 5) {
+				connectionError(FRAME_SIZE_ERROR, "invalid HEADERS frame size");
+				return;
+			}
+			payload += 5;
+			size -= 5;
+		}
+
+		headerBlock.assign((const char *) payload, size);
+		headerBlockFlags = flags;
+		if (flags & FLAG_END_HEADERS) {
+			processHeaderBlock(streamId);
+		} else {
+			headerBlockStreamId = streamId;
+		}
+	}
+
+	void processHeaderBlock(boost::uint32_t streamId) {
+		Http2HeaderList headers;
+		bool endStream = headerBlockFlags & FLAG_END_STREAM;
+
+		// The header block must always be decoded, even if we are going
+		// to ignore it, to keep the HPACK dynamic table in sync.
+		if (!decoder.decode(headerBlock.data(), headerBlock.size(), headers)) {
+			connectionError(COMPRESSION_ERROR, "cannot decode header block");
+			return;
+		}
+		headerBlock.clear();
+
+		Stream *stream = findStream(streamId);
+		if (stream != NULL) {
+			// Trailers. We don't forward them, but they end the request body.
+			if (stream->remoteEnded) {
+				resetStream(stream, STREAM_CLOSED);
+			} else if (!endStream) {
+				resetStream(stream, PROTOCOL_ERROR);
+			} else {
+				endRequestBody(stream);
+			}
+			return;
+		} else if (streamId <= lastStreamId) {
+			// A stream that we already closed.
+			return;
+		} else if (streamId % 2 == 0) {
+			connectionError(PROTOCOL_ERROR, "clients must use odd stream IDs");
+			return;
+		}
+
+		lastStreamId = streamId;
+		if (state != ACTIVE || streams.size() >= maxConcurrentStreams) {
+			if (countStreamReset()) {
+				sendRstStream(streamId, REFUSED_STREAM);
+			}
+		} else if (sharedStreamCount != NULL && *sharedStreamCount >= maxSharedStreams) {
+			P_DEBUG("HTTP/2 stream " << streamId << ": refused because " <<
+				*sharedStreamCount << " streams are already open");
+			if (countStreamReset()) {
+				sendRstStream(streamId, REFUSED_STREAM);
+			}
+		} else {
+			openStream(streamId, headers, endStream);
+		}
+	}
+
+	void processDataFrame(unsigned char flags, boost::uint32_t streamId,
+		const unsigned char *payload, boost::uint32_t size)
+	{
+		boost::uint32_t flowControlledSize = size;
+
+		if (streamId == 0) {
+			connectionError(PROTOCOL_ERROR, "DATA frame on stream 0");
+			return;
+		}
+		if (!stripPadding(flags, &payload, &size)) {
+			connectionError(PROTOCOL_ERROR, "invalid padding");
+			return;
+		}
+		if (size == 0 && !(flags & FLAG_END_STREAM) && !countControlFrame()) {
+			return;
+		}
+
+		connRecvWindow -= flowControlledSize;
+		if (connRecvWindow < 0) {
+			connectionError(FLOW_CONTROL_ERROR, "connection window exceeded");
+			return;
+		}
+		// Stream windows limit how much we buffer, so we can replenish
+		// the connection window right away.
+		if (flowControlledSize > 0) {
+			sendWindowUpdate(0, flowControlledSize);
+			connRecvWindow += flowControlledSize;
+		}
+
+		Stream *stream = findStream(streamId);
+		if (stream == NULL) {
+			if (streamId > lastStreamId) {
+				connectionError(PROTOCOL_ERROR, "DATA frame on an idle stream");
+			}
+			return;
+		}
+		if (stream->remoteEnded) {
+			resetStream(stream, STREAM_CLOSED);
+			return;
+		}
+
+		stream->recvWindow -= flowControlledSize;
+		if (stream->recvWindow < 0) {
+			resetStream(stream, FLOW_CONTROL_ERROR);
+			return;
+		}
+		stream->bodyBytesReceived += size;
+		if (stream->contentLength != -1
+		 && stream->bodyBytesReceived > (boost::uint64_t) stream->contentLength)
+		{
+			resetStream(stream, PROTOCOL_ERROR);
+			return;
+		}
+
+		stream->unacknowledgedBytes += flowControlledSize;
+		if (size > 0 && !stream->bridgeWriteClosed) {
+			if (stream->chunked) {
+				char chunkHeader[16];
+				int len = snprintf(chunkHeader, sizeof(chunkHeader), "%x\r\n", (unsigned int) size);
+				stream->requestData.append(chunkHeader, len);
+				stream->requestData.append((const char *) payload, size);
+				stream->requestData.append("\r\n");
+			} else {
+				stream->requestData.append((const char *) payload, size);
+			}
+		}
+
+		if (flags & FLAG_END_STREAM) {
+			endRequestBody(stream);
+		} else {
+			writeToBridge(stream);
+		}
+	}
+
+	void processRstStreamFrame(boost::uint32_t streamId, const unsigned char *payload,
+		boost::uint32_t size)
+	{
+		if (streamId == 0) {
+			connectionError(PROTOCOL_ERROR, "RST_STREAM frame on stream 0");
+		} else if (size != 4) {
+			connectionError(FRAME_SIZE_ERROR, "invalid RST_STREAM frame size");
+		} else if (!countControlFrame()) {
+			return;
+		} else {
+			Stream *stream = findStream(streamId);
+			if (stream != NULL) {
+				P_DEBUG("HTTP/2 stream " << streamId << " reset by client (error " <<
+					readUint32(payload) << ")");
+				stream->resetSent = true;
+				closeStream(stream);
+				countStreamReset();
+			} else if (streamId > lastStreamId) {
+				connectionError(PROTOCOL_ERROR, "RST_STREAM frame on an idle stream");
+			}
+		}
+	}
+
+	/** Returns NO_ERROR or the error to terminate the connection with. */
+	ErrorCode applySettings(const unsigned char *payload, boost::uint32_t size) {
+		for (boost::uint32_t i = 0; i + 6 <= size; i += 6) {
+			unsigned int id = ((unsigned int) payload[i] << 8) | payload[i + 1];
+			boost::uint32_t value = readUint32(payload + i + 2);
+
+			switch (id) {
+			case SETTINGS_HEADER_TABLE_SIZE:
+				encoder.setPeerMaxTableSize(value);
+				break;
+			case SETTINGS_ENABLE_PUSH:
+				if (value > 1) {
+					return PROTOCOL_ERROR;
+				}
+				break;
+			case SETTINGS_INITIAL_WINDOW_SIZE: {
+				if (value > MAX_WINDOW_SIZE) {
+					return FLOW_CONTROL_ERROR;
+				}
+				long long delta = (long long) value - peerInitialWindowSize;
+				StreamMap::iterator it, end = streams.end();
+				for (it = streams.begin(); it != end; it++) {
+					it->second->sendWindow += delta;
+					if (it->second->sendWindow > MAX_WINDOW_SIZE) {
+						return FLOW_CONTROL_ERROR;
+					}
+				}
+				peerInitialWindowSize = value;
+				break;
+			}
+			case SETTINGS_MAX_FRAME_SIZE:
+				if (value < DEFAULT_MAX_FRAME_SIZE || value > MAX_FRAME_SIZE_LIMIT) {
+					return PROTOCOL_ERROR;
+				}
+				peerMaxFrameSize = value;
+				break;
+			default:
+				// We don't push, so MAX_CONCURRENT_STREAMS doesn't apply to us.
+				// Unknown settings must be ignored.
+				break;
+			}
+		}
+		return NO_ERROR;
+	}
+
+	void processSettingsFrame(unsigned char flags, boost::uint32_t streamId,
+		const unsigned char *payload, boost::uint32_t size)
+	{
+		if (streamId != 0) {
+			connectionError(PROTOCOL_ERROR, "SETTINGS frame on a stream");
+		} else if (flags & FLAG_ACK) {
+			if (size != 0) {
+				connectionError(FRAME_SIZE_ERROR, "SETTINGS acknowledgement with payload");
+			}
+		} else if (size % 6 != 0) {
+			connectionError(FRAME_SIZE_ERROR, "invalid SETTINGS frame size");
+		} else if (!settingsReceived || countControlFrame()) {
+			ErrorCode code = applySettings(payload, size);
+			if (code != NO_ERROR) {
+				connectionError(code, "invalid setting");
+				return;
+			}
+			settingsReceived = true;
+			writeFrame(SETTINGS, FLAG_ACK, 0, NULL, 0);
+			// The initial window size may have grown.
+			flushAllStreams();
+		}
+	}
+
+	void processWindowUpdateFrame(boost::uint32_t streamId, const unsigned char *payload,
+		boost::uint32_t size)
+	{
+		if (size != 4) {
+			connectionError(FRAME_SIZE_ERROR, "invalid WINDOW_UPDATE frame size");
+			return;
+		}
+
+		boost::uint32_t increment = readUint32(payload) & 0x7fffffff;
+		if (streamId == 0) {
+			connSendWindow += increment;
+			if (increment == 0) {
+				connectionError(PROTOCOL_ERROR, "zero WINDOW_UPDATE increment");
+			} else if (connSendWindow > MAX_WINDOW_SIZE) {
+				connectionError(FLOW_CONTROL_ERROR, "connection window too large");
+			} else {
+				flushAllStreams();
+			}
+			return;
+		}
+
+		Stream *stream = findStream(streamId);
+		if (stream == NULL) {
+			if (streamId > lastStreamId) {
+				connectionError(PROTOCOL_ERROR, "WINDOW_UPDATE frame on an idle stream");
+			}
+		} else if (increment == 0) {
+			resetStream(stream, PROTOCOL_ERROR);
+		} else {
+			stream->sendWindow += increment;
+			if (stream->sendWindow > MAX_WINDOW_SIZE) {
+				resetStream(stream, FLOW_CONTROL_ERROR);
+			} else {
+				flushStream(stream);
+			}
+		}
+	}
+
+	~Http2Session() {
+		state = FINISHED;
+		destroyRequested = true;
+		closeAllStreams();
+	}
+
+public:
+	Http2Session(Context *context)
+		: maxConcurrentStreams(100),
+		  sharedStreamCount(NULL),
+		  maxSharedStreams(0),
+		  initialWindowSize(DEFAULT_WINDOW_SIZE),
+		  maxControlFramesPerSecond(1000),
+		  maxStreamResetsPerSecond(200),
+		  outputCallback(NULL),
+		  newStreamCallback(NULL),
+		  finishedCallback(NULL),
+		  userData(NULL),
+		  totalStreamsBegun(0),
+		  totalStreamsReset(0),
+		  ctx(context),
+		  state(ACTIVE),
+		  prefaceReceived(false),
+		  settingsReceived(false),
+		  destroyRequested(false),
+		  outputBlocked(false),
+		  callDepth(0),
+		  floodPeriodStart(0),
+		  controlFrameCount(0),
+		  streamResetCount(0),
+		  decoder(4096, MAX_HEADER_LIST_SIZE),
+		  lastStreamId(0),
+		  headerBlockStreamId(0),
+		  headerBlockFlags(0),
+		  peerInitialWindowSize(DEFAULT_WINDOW_SIZE),
+		  peerMaxFrameSize(DEFAULT_MAX_FRAME_SIZE),
+		  connSendWindow(DEFAULT_WINDOW_SIZE),
+		  connRecvWindow(DEFAULT_WINDOW_SIZE)
+		{ }
+
+	/**
+	 * Deletes the session, closing all stream bridges. Safe to call from
+	 * within a callback.
+	 */
+	void destroy() {
+		if (callDepth == 0) {
+			delete this;
+		} else {
+			state = FINISHED;
+			destroyRequested = true;
+			closeAllStreams();
+		}
+	}
+
+	/** Sends the server connection preface. */
+	void start() {
+		CallGuard guard(this);
+		if (initialWindowSize < DEFAULT_WINDOW_SIZE) {
+			initialWindowSize = DEFAULT_WINDOW_SIZE;
+		}
+		sendSettings();
+		flushOutput();
+	}
+
+	/**
+	 * Applies the value of the HTTP2-Settings header of an h2c upgrade
+	 * request (RFC 7540 section 3.2.1). Returns false if it is invalid.
+	 */
+	bool applyUpgradeSettings(const StaticString &value) {
+		string base64(value.data(), value.size());
+		string decoded;
+		size_t size;
+
+		// The header uses the URL-safe base64 alphabet without padding.
+		for (string::size_type i = 0; i < base64.size(); i++) {
+			if (base64[i] == '-') {
+				base64[i] = '+';
+			} else if (base64[i] == '_') {
+				base64[i] = '/';
+			}
+		}
+		while (base64.size() % 4 != 0) {
+			base64.append(1, '=');
+		}
+
+		decoded.resize(modp_b64_decode_len(base64.size()));
+		size = modp_b64_decode(&decoded[0], base64.data(), base64.size());
+		if (size == (size_t) -1 || size % 6 != 0) {
+			return false;
+		}
+		return applySettings((const unsigned char *) decoded.data(), size) == NO_ERROR;
+	}
+
+	/**
+	 * Creates stream 1 for the HTTP/1.1 request that was upgraded to h2c.
+	 * `request` must be a complete HTTP/1.1 request head without a body.
+	 */
+	void startUpgradeStream(const string &request, bool head) {
+		CallGuard guard(this);
+		lastStreamId = 1;
+		Stream *stream = createStream(1, request, head);
+		if (stream != NULL) {
+			stream->contentLength = 0;
+			endRequestBody(stream);
+		}
+		flushOutput();
+	}
+
+	/** Processes data received from the client. */
+	void feed(const char *data, size_t size) {
+		CallGuard guard(this);
+		size_t consumed;
+
+		if (state == FINISHED) {
+			return;
+		}
+		if (inputBuffer.empty()) {
+			consumed = processInput(data, data + size);
+			if (state != FINISHED) {
+				inputBuffer.assign(data + consumed, size - consumed);
+			}
+		} else {
+			inputBuffer.append(data, size);
+			consumed = processInput(inputBuffer.data(),
+				inputBuffer.data() + inputBuffer.size());
+			if (state != FINISHED) {
+				inputBuffer.erase(0, consumed);
+			}
+		}
+		flushOutput();
+	}
+
+	/**
+	 * Begins a graceful shutdown: no new streams are accepted and the
+	 * session finishes once the existing streams are done.
+	 */
+	void shutdown() {
+		CallGuard guard(this);
+		if (state == ACTIVE) {
+			sendGoaway(NO_ERROR, StaticString());
+			state = GOING_AWAY;
+			if (streams.empty()) {
+				finish(StaticString());
+			}
+		}
+		flushOutput();
+	}
+
+	/**
+	 * Tells the session whether the owner's output is backlogged. While it
+	 * is, no more response data is read from the stream bridges.
+	 */
+	void setOutputBlocked(bool blocked) {
+		if (outputBlocked == blocked) {
+			return;
+		}
+		outputBlocked = blocked;
+
+		StreamMap::iterator it, end = streams.end();
+		for (it = streams.begin(); it != end; it++) {
+			updateWatcher(it->second);
+		}
+	}
+
+	bool isOutputBlocked() const {
+		return outputBlocked;
+	}
+
+	State getState() const {
+		return state;
+	}
+
+	unsigned int getStreamCount() const {
+		return streams.size();
+	}
+
+	Json::Value inspectStateAsJson() const {
+		Json::Value doc;
+		Json::Value streamsDoc(Json::objectValue);
+		StreamMap::const_iterator it, end = streams.end();
+
+		switch (state) {
+		case ACTIVE:
+			doc["state"] = "ACTIVE";
+			break;
+		case GOING_AWAY:
+			doc["state"] = "GOING_AWAY";
+			break;
+		case FINISHED:
+			doc["state"] = "FINISHED";
+			break;
+		}
+		doc["last_stream_id"] = lastStreamId;
+		doc["total_streams_begun"] = (Json::UInt64) totalStreamsBegun;
+		doc["total_streams_reset"] = (Json::UInt64) totalStreamsReset;
+		doc["output_blocked"] = (bool) outputBlocked;
+		doc["send_window"] = (Json::Int64) connSendWindow;
+		doc["peer_max_frame_size"] = peerMaxFrameSize;
+		doc["hpack_decoder_table_size"] = (Json::UInt64) decoder.getTable().getSize();
+		doc["hpack_encoder_table_size"] = (Json::UInt64) encoder.getTable().getSize();
+
+		for (it = streams.begin(); it != end; it++) {
+			const Stream *stream = it->second;
+			Json::Value streamDoc;
+			streamDoc["remote_ended"] = stream->remoteEnded;
+			streamDoc["response_headers_sent"] = stream->responseHeadersSent;
+			streamDoc["response_complete"] = stream->responseComplete;
+			streamDoc["send_window"] = (Json::Int64) stream->sendWindow;
+			streamDoc["recv_window"] = (Json::Int64) stream->recvWindow;
+			streamDoc["buffered_request_data"] = (Json::UInt64) stream->requestData.size();
+			streamDoc["buffered_response_data"] = (Json::UInt64) stream->responseData.size();
+			streamsDoc[toString(stream->id)] = streamDoc;
+		}
+		doc["streams"] = streamsDoc;
+
+		return doc;
+	}
+};
+
+
+} // namespace ServerKit
+} // namespace Passenger
+
+#endif /* _PASSENGER_SERVER_KIT_HTTP2_SESSION_H_ */
@@ -29,11 +29,15 @@
 #include <psg_sysqueue.h>
 #include <ServerKit/Client.h>
 #include <ServerKit/HttpRequest.h>
+#include <ServerKit/TimerWheel.h>
 
 namespace Passenger {
 namespace ServerKit {
 
 
+class Http2Session;
+
+
 template<typename Request = HttpRequest>
 class BaseHttpClient: public BaseClient {
 public:
@@ -47,12 +51,32 @@ public:
 	 *         currentRequest->httpState != HttpRequest::IN_FREELIST
 	 */
 	Request *currentRequest;
+	/**
+	 * Set when the connection speaks HTTP/2. In that case, currentRequest
+	 * is NULL and the session owns all protocol handling.
+	 */
+	Http2Session *http2Session;
 	unsigned int requestsBegun;
+	/**
+	 * The number of bytes of the HTTP/2 connection preface received at the
+	 * start of the connection, or -1 if the connection is not HTTP/2 with
+	 * prior knowledge.
+	 */
+	int http2PrefaceMatched;
+	/**
+	 * The keep-alive, header, body or response timeout that is currently
+	 * armed for this client, if any. Managed by HttpServer.
+	 */
+	TimerWheelEntry timeoutTimer;
+	unsigned char timeoutType;
 
 	BaseHttpClient(void *server)
 		: BaseClient(server),
 		  currentRequest(NULL),
-		  requestsBegun(0)
+		  http2Session(NULL),
+		  requestsBegun(0),
+		  http2PrefaceMatched(0),
+		  timeoutType(0)
 		{ }
 };
 
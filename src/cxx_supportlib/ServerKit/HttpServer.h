@@ -41,6 +41,7 @@
 #include <ServerKit/HttpRequestRef.h>
 #include <ServerKit/HttpHeaderParser.h>
 #include <ServerKit/HttpChunkedBodyParser.h>
+#include <ServerKit/Http2Session.h>
 #include <Utils/SystemTime.h>
 #include <Utils/StrIntUtils.h>
 #include <Utils/HttpConstants.h>
@@ -67,6 +68,56 @@ public:
 	unsigned int freeRequestCount, requestFreelistLimit;
 	unsigned long totalRequestsBegun;
 
+	/**
+	 * Whether cleartext HTTP/2 is accepted, both with prior knowledge
+	 * (the client starts with the HTTP/2 connection preface) and through
+	 * an `Upgrade: h2c` request. See Http2Session for how streams are
+	 * mapped onto requests.
+	 */
+	bool http2Enabled;
+	unsigned int http2MaxConcurrentStreams;
+	/**
+	 * The maximum number of HTTP/2 streams that may be open over all
+	 * connections of this server, or 0 for no limit. Every stream is
+	 * bridged to a client of its own through a socket pair, so without
+	 * this limit a few HTTP/2 connections can use up the file descriptors.
+	 */
+	unsigned int http2MaxTotalStreams;
+	/** The number of currently open HTTP/2 streams (do not modify). */
+	unsigned int http2StreamCount;
+
+	enum TimeoutType {
+		NO_TIMEOUT,
+		KEEP_ALIVE_TIMEOUT,
+		HEADER_READ_TIMEOUT,
+		BODY_READ_TIMEOUT,
+		RESPONSE_TIMEOUT
+	};
+
+	/**
+	 * Timeouts in milliseconds, or 0 to disable them. They are tracked in
+	 * the context's TimerWheel, so arming and re-arming them is cheap.
+	 *
+	 * - keepAliveTimeout: how long an idle kept-alive connection may wait
+	 *   for the first byte of the next request.
+	 * - headerReadTimeout: how long the client may take to send the entire
+	 *   request header.
+	 * - bodyReadTimeout: the maximum time between two pieces of request
+	 *   body data. Time during which the request handler doesn't consume
+	 *   the body doesn't count.
+	 * - responseTimeout: how long the request handler may take to begin
+	 *   the response after the entire request has been received. See
+	 *   onResponseTimeout().
+	 */
+	unsigned int keepAliveTimeout;
+	unsigned int headerReadTimeout;
+	unsigned int bodyReadTimeout;
+	unsigned int responseTimeout;
+	unsigned long totalKeepAliveTimeouts;
+	unsigned long totalHeaderReadTimeouts;
+	unsigned long totalBodyReadTimeouts;
+	unsigned long totalResponseTimeouts;
+
 private:
 	/***** Types and nested classes *****/
 
@@ -242,6 +293,282 @@ private:
 		client->currentRequest = req = checkoutRequestObject(client);
 		req->client = client;
 		reinitializeRequest(client, req);
+
+		if (client->requestsBegun > 0) {
+			armTimeout(client, KEEP_ALIVE_TIMEOUT, keepAliveTimeout);
+		} else {
+			armTimeout(client, HEADER_READ_TIMEOUT, headerReadTimeout);
+		}
+	}
+
+
+	/***** Timeouts *****/
+
+	void armTimeout(Client *client, TimeoutType type, unsigned int timeout) {
+		if (timeout == 0) {
+			cancelTimeout(client);
+		} else {
+			client->timeoutType = type;
+			this->getContext()->timerWheel.arm(&client->timeoutTimer, timeout);
+		}
+	}
+
+	void cancelTimeout(Client *client) {
+		if (client->timeoutType != NO_TIMEOUT) {
+			client->timeoutType = NO_TIMEOUT;
+			this->getContext()->timerWheel.cancel(&client->timeoutTimer);
+		}
+	}
+
+	/**
+	 * Called once the entire request has been received. The response
+	 * timeout only applies if the response hasn't begun yet.
+	 */
+	void armResponseTimeout(Client *client, Request *req) {
+		if (req->responseBegun) {
+			cancelTimeout(client);
+		} else {
+			armTimeout(client, RESPONSE_TIMEOUT, responseTimeout);
+		}
+	}
+
+	static void onTimeoutTimerExpired(TimerWheelEntry *entry) {
+		Client *client = static_cast<Client *>(static_cast<BaseClient *>(entry->userData));
+		HttpServer *self = static_cast<HttpServer *>(HttpServer::getServerFromClient(client));
+		TimeoutType type = (TimeoutType) client->timeoutType;
+
+		client->timeoutType = NO_TIMEOUT;
+		self->processTimeout(client, type);
+	}
+
+	void processTimeout(Client *client, TimeoutType type) {
+		Request *req = client->currentRequest;
+
+		assert(client->connected());
+		assert(req != NULL);
+
+		switch (type) {
+		case KEEP_ALIVE_TIMEOUT:
+			SKC_DEBUG(client, "Keep-alive timeout; disconnecting client");
+			totalKeepAliveTimeouts++;
+			this->disconnect(&client);
+			break;
+		case HEADER_READ_TIMEOUT:
+			SKC_DEBUG(client, "Timeout while reading request header");
+			totalHeaderReadTimeouts++;
+			client->input.stop();
+			endWithErrorResponse(&client, &req, 408, "Request timeout\n");
+			break;
+		case BODY_READ_TIMEOUT:
+			if (req->bodyChannel.acceptingInput() && client->input.isStarted()) {
+				SKC_DEBUG(client, "Timeout while reading request body");
+				totalBodyReadTimeouts++;
+				client->input.stop();
+				req->wantKeepAlive = false;
+				req->bodyChannel.feedError(ETIMEDOUT);
+			} else if (req->bodyChannel.acceptingInput()
+				|| req->bodyChannel.mayAcceptInputLater())
+			{
+				// The request handler isn't consuming the body right now,
+				// which is not the client's fault.
+				armTimeout(client, BODY_READ_TIMEOUT, bodyReadTimeout);
+			} else {
+				totalBodyReadTimeouts++;
+				this->disconnect(&client);
+			}
+			break;
+		case RESPONSE_TIMEOUT:
+			SKC_DEBUG(client, "Timeout while waiting for the response to begin");
+			totalResponseTimeouts++;
+			onResponseTimeout(client, req);
+			break;
+		default:
+			P_BUG("Invalid timeout type " << (int) type);
+			break;
+		}
+	}
+
+
+	/***** HTTP/2 *****/
+
+	Http2Session *createHttp2Session(Client *client) {
+		Http2Session *session = new Http2Session(this->getContext());
+		session->maxConcurrentStreams = http2MaxConcurrentStreams;
+		if (http2MaxTotalStreams > 0) {
+			// Don't invite clients to open more streams than we can serve.
+			session->maxConcurrentStreams = std::min(http2MaxConcurrentStreams,
+				http2MaxTotalStreams);
+			session->sharedStreamCount = &http2StreamCount;
+			session->maxSharedStreams = http2MaxTotalStreams;
+		}
+		session->outputCallback = onHttp2SessionOutput;
+		session->newStreamCallback = onHttp2SessionNewStream;
+		session->finishedCallback = onHttp2SessionFinished;
+		session->userData = client;
+		return session;
+	}
+
+	void switchToHttp2(Client *client, Http2Session *session) {
+		Request *req = client->currentRequest;
+
+		// HTTP/2 connections don't use the HTTP/1 request object; every
+		// stream gets its own client and request instead.
+		cancelTimeout(client);
+		deinitializeRequestAndAddToFreelist(client, req);
+		client->currentRequest = NULL;
+		unrefRequest(req, __FILE__, __LINE__);
+
+		client->http2Session = session;
+		session->start();
+	}
+
+	bool isHttp2UpgradeRequest(Client *client, Request *req) {
+		const LString *upgrade = req->headers.lookup(P_STATIC_STRING("upgrade"));
+		// Upgrading requests that have a body is not supported; those are
+		// handled as normal HTTP/1 upgrade requests.
+		return client->requestsBegun == 0
+			&& upgrade != NULL
+			&& psg_lstr_cmp(upgrade, P_STATIC_STRING("h2c"))
+			&& req->headers.lookup(P_STATIC_STRING("http2-settings")) != NULL
+			&& req->headers.lookup(P_STATIC_STRING("content-length")) == NULL
+			&& req->headers.lookup(P_STATIC_STRING("transfer-encoding")) == NULL;
+	}
+
+	static void appendLString(string &output, const LString *str) {
+		const LString::Part *part = str->start;
+		while (part != NULL) {
+			output.append(part->data, part->size);
+			part = part->next;
+		}
+	}
+
+	/**
+	 * Serializes an `Upgrade: h2c` request, minus the headers that belong
+	 * to the upgrade, so that it can be sent as stream 1.
+	 */
+	void serializeUpgradedRequest(Request *req, string &output) {
+		output.append(http_method_str((http_method) req->method));
+		output.append(" ");
+		appendLString(output, &req->path);
+		output.append(" HTTP/1.1\r\n");
+
+		HeaderTable::Iterator it(req->headers);
+		while (*it != NULL) {
+			const LString *key = &it->header->key;
+			if (!psg_lstr_cmp(key, P_STATIC_STRING("connection"))
+			 && !psg_lstr_cmp(key, P_STATIC_STRING("upgrade"))
+			 && !psg_lstr_cmp(key, P_STATIC_STRING("http2-settings"))
+			 && !psg_lstr_cmp(key, P_STATIC_STRING("keep-alive")))
+			{
+				appendLString(output, &it->header->origKey);
+				output.append(": ");
+				appendLString(output, &it->header->val);
+				output.append("\r\n");
+			}
+			it.next();
+		}
+		output.append("Connection: close\r\n\r\n");
+	}
+
+	Channel::Result upgradeToHttp2(Client *client, Request *req, const MemoryKit::mbuf &buffer,
+		size_t consumed)
+	{
+		Http2Session *session = createHttp2Session(client);
+		string settings, request;
+		bool head = req->method == HTTP_HEAD;
+
+		appendLString(settings, req->headers.lookup(P_STATIC_STRING("http2-settings")));
+		if (!session->applyUpgradeSettings(settings)) {
+			session->destroy();
+			// Change state so that the response body will be written.
+			req->httpState = Request::COMPLETE;
+			endAsBadRequest(&client, &req, "Invalid HTTP2-Settings header\n");
+			return Channel::Result(0, true);
+		}
+
+		SKC_TRACE(client, 2, "Upgrading connection to HTTP/2");
+		serializeUpgradedRequest(req, request);
+		writeResponse(client, P_STATIC_STRING(
+			"HTTP/1.1 101 Switching Protocols\r\n"
+			"Connection: Upgrade\r\n"
+			"Upgrade: h2c\r\n"
+			"\r\n"));
+		switchToHttp2(client, session);
+		session->startUpgradeStream(request, head);
+
+		if (client->http2Session != NULL && consumed < buffer.size()) {
+			return processClientDataWhenHttp2(client,
+				MemoryKit::mbuf(buffer, consumed), 0);
+		} else {
+			return Channel::Result(buffer.size(), !client->connected());
+		}
+	}
+
+	static void onHttp2SessionOutput(Http2Session *session, const char *data,
+		unsigned int size)
+	{
+		Client *client = static_cast<Client *>(session->userData);
+		HttpServer *self = static_cast<HttpServer *>(HttpServer::getServerFromClient(client));
+		struct MemoryKit::mbuf_pool *pool = &self->getContext()->mbuf_pool;
+		unsigned int blockSize = MemoryKit::mbuf_pool_data_size(pool);
+
+		if (!client->connected() || client->output.ended()) {
+			return;
+		}
+		while (size > 0) {
+			unsigned int n = std::min(size, blockSize);
+			MemoryKit::mbuf buffer(MemoryKit::mbuf_get(pool));
+			memcpy(buffer.start, data, n);
+			client->output.feed(MemoryKit::mbuf(buffer, 0, n));
+			data += n;
+			size -= n;
+		}
+
+		// Frames such as PING make us reply without the client having to
+		// read anything, so stop reading from the client (and from the
+		// streams) until it has caught up. Resumed by _onClientOutputDataFlushed().
+		if (client->connected() && !session->isOutputBlocked()
+		 && client->output.getTotalBytesBuffered()
+			>= self->getContext()->defaultFileBufferedChannelConfig.threshold)
+		{
+			SKC_TRACE_FROM_STATIC(self, client, 2, "HTTP/2 client is not reading "
+				"its output quickly enough; pausing input");
+			client->input.stop();
+			session->setOutputBlocked(true);
+		}
+	}
+
+	static bool onHttp2SessionNewStream(Http2Session *session, int fd) {
+		Client *client = static_cast<Client *>(session->userData);
+		HttpServer *self = static_cast<HttpServer *>(HttpServer::getServerFromClient(client));
+
+		if (self->serverState != HttpServer::ACTIVE) {
+			return false;
+		}
+		SKC_TRACE_FROM_STATIC(self, client, 2,
+			"New HTTP/2 stream, handled by new client on FD " << fd);
+		self->feedNewClients(&fd, 1);
+		return true;
+	}
+
+	static void onHttp2SessionFinished(Http2Session *session, const StaticString &error) {
+		Client *client = static_cast<Client *>(session->userData);
+		HttpServer *self = static_cast<HttpServer *>(HttpServer::getServerFromClient(client));
+
+		if (error.empty()) {
+			SKC_TRACE_FROM_STATIC(self, client, 2, "HTTP/2 session finished");
+		} else {
+			SKC_DEBUG_FROM_STATIC(self, client, "HTTP/2 session terminated: " << error);
+		}
+
+		// Disconnect once the final frames have been written.
+		client->input.stop();
+		if (!client->output.ended()) {
+			client->output.feed(MemoryKit::mbuf());
+		}
+		if (client->output.endAcked()) {
+			self->disconnect(&client);
+		}
 	}
 
 
@@ -276,23 +603,31 @@ private:
 				return Channel::Result(buffer.size(), false);
 			}
 
+			// The timeouts are armed before onRequestBegin() because
+			// that may already end the request.
 			switch (req->httpState) {
 			case Request::COMPLETE:
 				client->input.stop();
+				armTimeout(client, RESPONSE_TIMEOUT, responseTimeout);
 				onRequestBegin(client, req);
 				return Channel::Result(ret, false);
 			case Request::PARSING_BODY:
 				SKC_TRACE(client, 2, "Expecting a request body");
+				armTimeout(client, BODY_READ_TIMEOUT, bodyReadTimeout);
 				onRequestBegin(client, req);
 				return Channel::Result(ret, false);
 			case Request::PARSING_CHUNKED_BODY:
 				SKC_TRACE(client, 2, "Expecting a chunked request body");
 				prepareChunkedBodyParsing(client, req);
+				armTimeout(client, BODY_READ_TIMEOUT, bodyReadTimeout);
 				onRequestBegin(client, req);
 				return Channel::Result(ret, false);
 			case Request::UPGRADED:
 				assert(!req->wantKeepAlive);
-				if (supportsUpgrade(client, req)) {
+				cancelTimeout(client);
+				if (http2Enabled && isHttp2UpgradeRequest(client, req)) {
+					return upgradeToHttp2(client, req, buffer, ret);
+				} else if (supportsUpgrade(client, req)) {
 					SKC_TRACE(client, 2, "Expecting connection upgrade");
 					onRequestBegin(client, req);
 					return Channel::Result(ret, false);
@@ -320,6 +655,74 @@ private:
 		}
 	}
 
+	/**
+	 * Called at the start of a connection when HTTP/2 is enabled. Holds back
+	 * data that looks like the start of the HTTP/2 connection preface until
+	 * we know whether it is one.
+	 */
+	Channel::Result processClientDataWhenDetectingHttp2(Client *client, Request *req,
+		const MemoryKit::mbuf &buffer, int errcode)
+	{
+		const StaticString preface = Http2Session::getPreface();
+		unsigned int matched = client->http2PrefaceMatched;
+		unsigned int size = std::min<unsigned int>(buffer.size(), preface.size() - matched);
+
+		if (buffer.empty()) {
+			client->http2PrefaceMatched = -1;
+			return processClientDataWhenParsingHeaders(client, req, buffer, errcode);
+		}
+
+		if (memcmp(buffer.start, preface.data() + matched, size) == 0) {
+			if (matched + size < preface.size()) {
+				client->http2PrefaceMatched = matched + size;
+				return Channel::Result(buffer.size(), false);
+			}
+
+			SKC_TRACE(client, 2, "HTTP/2 connection preface received");
+			client->http2PrefaceMatched = -1;
+			switchToHttp2(client, createHttp2Session(client));
+			// Starting the session writes our SETTINGS frame, which may
+			// already have disconnected the client.
+			if (client->http2Session == NULL) {
+				return Channel::Result(0, true);
+			}
+			// The session expects to see the entire preface.
+			client->http2Session->feed(preface.data(), matched);
+			if (!client->connected() || client->http2Session == NULL) {
+				return Channel::Result(0, true);
+			}
+			return processClientDataWhenHttp2(client, buffer, errcode);
+		}
+
+		client->http2PrefaceMatched = -1;
+		if (matched > 0) {
+			if (matched > 2) {
+				// Only the HTTP/2 preface starts with "PRI".
+				this->disconnectWithError(&client, "invalid HTTP/2 connection preface");
+				return Channel::Result(0, true);
+			}
+			// Not HTTP/2 after all (e.g. "PROPFIND"). Parse the bytes
+			// that we held back.
+			Channel::Result result = processClientDataWhenParsingHeaders(client, req,
+				MemoryKit::mbuf(preface.data(), matched), errcode);
+			if (result.end || !client->connected()) {
+				return Channel::Result(0, true);
+			}
+		}
+		return processClientDataWhenParsingHeaders(client, req, buffer, errcode);
+	}
+
+	Channel::Result processClientDataWhenHttp2(Client *client, const MemoryKit::mbuf &buffer,
+		int errcode)
+	{
+		if (buffer.empty()) {
+			this->disconnect(&client);
+			return Channel::Result(0, true);
+		}
+		client->http2Session->feed(buffer.start, buffer.size());
+		return Channel::Result(buffer.size(), !client->connected());
+	}
+
 	Channel::Result processClientDataWhenParsingBody(Client *client, Request *req,
 		const MemoryKit::mbuf &buffer, int errcode)
 	{
@@ -346,6 +749,11 @@ private:
 				req->aux.bodyInfo.contentLength << " bytes already read");
 
 			if (remaining > 0) {
+				if (req->bodyFullyRead()) {
+					armResponseTimeout(client, req);
+				} else {
+					armTimeout(client, BODY_READ_TIMEOUT, bodyReadTimeout);
+				}
 				req->bodyChannel.feed(MemoryKit::mbuf(buffer, 0, remaining));
 				if (req->ended()) {
 					return Channel::Result(remaining, false);
@@ -369,6 +777,7 @@ private:
 			} else {
 				SKC_TRACE(client, 2, "End of request body reached");
 				client->input.stop();
+				armResponseTimeout(client, req);
 				req->bodyChannel.feed(MemoryKit::mbuf());
 				return Channel::Result(0, false);
 			}
@@ -411,9 +820,11 @@ private:
 			switch (event.type) {
 			case HttpChunkedEvent::NONE:
 				assert(!event.end);
+				armTimeout(client, BODY_READ_TIMEOUT, bodyReadTimeout);
 				return Channel::Result(event.consumed, false);
 			case HttpChunkedEvent::DATA:
 				assert(!event.end);
+				armTimeout(client, BODY_READ_TIMEOUT, bodyReadTimeout);
 				req->bodyChannel.feed(event.data);
 				if (!req->ended()) {
 					if (req->bodyChannel.acceptingInput()) {
@@ -432,11 +843,13 @@ private:
 				assert(event.end);
 				client->input.stop();
 				req->aux.bodyInfo.endChunkReached = true;
+				armResponseTimeout(client, req);
 				req->bodyChannel.feed(MemoryKit::mbuf());
 				return Channel::Result(event.consumed, false);
 			case HttpChunkedEvent::ERROR:
 				assert(event.end);
 				client->input.stop();
+				cancelTimeout(client);
 				req->wantKeepAlive = false;
 				req->bodyChannel.feedError(event.errcode);
 				return Channel::Result(event.consumed, true);
@@ -598,6 +1011,16 @@ private:
 		{
 			client->currentRequest->httpState = Request::WAITING_FOR_REFERENCES;
 			self->doneWithCurrentRequest(&client);
+		} else if (client->http2Session != NULL
+			&& client->http2Session->getState() == Http2Session::FINISHED)
+		{
+			self->disconnect(&client);
+		} else if (client->http2Session != NULL
+			&& client->http2Session->isOutputBlocked())
+		{
+			SKC_TRACE_FROM_STATIC(self, client, 2, "HTTP/2 output flushed; resuming input");
+			client->http2Session->setOutputBlocked(false);
+			client->input.start();
 		}
 	}
 
@@ -622,8 +1045,10 @@ private:
 		channel->consumedCallback = NULL;
 		if (channel->acceptingInput()) {
 			if (req->bodyFullyRead()) {
+				self->armResponseTimeout(client, req);
 				req->bodyChannel.feed(MemoryKit::mbuf());
 			} else {
+				self->armTimeout(client, BODY_READ_TIMEOUT, self->bodyReadTimeout);
 				client->input.start();
 			}
 		}
@@ -663,6 +1088,8 @@ protected:
 	virtual void onClientObjectCreated(Client *client) {
 		ParentClass::onClientObjectCreated(client);
 		client->output.setDataFlushedCallback(_onClientOutputDataFlushed);
+		client->timeoutTimer.callback = onTimeoutTimerExpired;
+		client->timeoutTimer.userData = static_cast<BaseClient *>(client);
 	}
 
 	virtual void onClientAccepted(Client *client) {
@@ -675,6 +1102,10 @@ protected:
 		int errcode)
 	{
 		SKC_LOG_EVENT(HttpServer, client, "onClientDataReceived");
+		if (OXT_UNLIKELY(client->http2Session != NULL)) {
+			return processClientDataWhenHttp2(client, buffer, errcode);
+		}
+
 		assert(client->currentRequest != NULL);
 		Request *req = client->currentRequest;
 		RequestRef ref(req, __FILE__, __LINE__);
@@ -682,6 +1113,12 @@ protected:
 		// Moved outside switch() so that the CPU branch predictor can do its work
 		if (req->httpState == Request::PARSING_HEADERS) {
 			assert(!req->ended());
+			if (client->timeoutType == KEEP_ALIVE_TIMEOUT && !buffer.empty()) {
+				armTimeout(client, HEADER_READ_TIMEOUT, headerReadTimeout);
+			}
+			if (OXT_UNLIKELY(http2Enabled && client->http2PrefaceMatched >= 0)) {
+				return processClientDataWhenDetectingHttp2(client, req, buffer, errcode);
+			}
 			return processClientDataWhenParsingHeaders(client, req, buffer, errcode);
 		} else {
 			switch (req->bodyType) {
@@ -716,6 +1153,12 @@ protected:
 
 	virtual void onClientDisconnecting(Client *client) {
 		ParentClass::onClientDisconnecting(client);
+		cancelTimeout(client);
+
+		if (client->http2Session != NULL) {
+			client->http2Session->destroy();
+			client->http2Session = NULL;
+		}
 
 		// Handle client being disconnect()'ed without endRequest().
 
@@ -733,6 +1176,12 @@ protected:
 	}
 
 	virtual bool shouldDisconnectClientOnShutdown(Client *client) {
+		if (client->http2Session != NULL) {
+			// Send GOAWAY and let the open streams finish. The session
+			// disconnects the client when they're done.
+			client->http2Session->shutdown();
+			return false;
+		}
 		return client->currentRequest == NULL
 			|| client->currentRequest->upgraded();
 	}
@@ -766,6 +1215,15 @@ protected:
 		return false;
 	}
 
+	/**
+	 * Called when the response timeout expires before the response has
+	 * begun. The default implementation ends the request with a
+	 * 504 Gateway Timeout response.
+	 */
+	virtual void onResponseTimeout(Client *client, Request *req) {
+		endWithErrorResponse(&client, &req, 504, "Gateway timeout\n");
+	}
+
 	virtual PassengerLogLevel getClientOutputErrorDisconnectionLogLevel(
 		Client *client, int errcode) const
 	{
@@ -779,7 +1237,10 @@ protected:
 	virtual void reinitializeClient(Client *client, int fd) {
 		ParentClass::reinitializeClient(client, fd);
 		client->requestsBegun = 0;
+		client->http2PrefaceMatched = 0;
+		assert(client->timeoutType == NO_TIMEOUT);
 		assert(client->currentRequest == NULL);
+		assert(client->http2Session == NULL);
 	}
 
 	virtual void reinitializeRequest(Client *client, Request *req) {
@@ -860,6 +1321,18 @@ public:
 		  freeRequestCount(0),
 		  requestFreelistLimit(1024),
 		  totalRequestsBegun(0),
+		  http2Enabled(false),
+		  http2MaxConcurrentStreams(100),
+		  http2MaxTotalStreams(0),
+		  http2StreamCount(0),
+		  keepAliveTimeout(0),
+		  headerReadTimeout(0),
+		  bodyReadTimeout(0),
+		  responseTimeout(0),
+		  totalKeepAliveTimeouts(0),
+		  totalHeaderReadTimeouts(0),
+		  totalBodyReadTimeouts(0),
+		  totalResponseTimeouts(0),
 		  headerParserStatePool(16, 256)
 	{
 		STAILQ_INIT(&freeRequests);
@@ -927,6 +1400,9 @@ public:
 	}
 
 	void writeResponse(Client *client, const MemoryKit::mbuf &buffer) {
+		if (client->timeoutType == RESPONSE_TIMEOUT) {
+			cancelTimeout(client);
+		}
 		client->currentRequest->responseBegun = true;
 		client->output.feedWithoutRefGuard(buffer);
 	}
@@ -1060,6 +1536,7 @@ public:
 
 		SKC_TRACE(c, 2, "Ending request");
 		assert(c->currentRequest == req);
+		cancelTimeout(c);
 
 		if (OXT_UNLIKELY(!req->responseBegun)) {
 			writeDefault500Response(c, req);
@@ -1108,11 +1585,39 @@ public:
 		if (doc.isMember("request_freelist_limit")) {
 			requestFreelistLimit = doc["request_freelist_limit"].asUInt();
 		}
+		if (doc.isMember("http2")) {
+			http2Enabled = doc["http2"].asBool();
+		}
+		if (doc.isMember("http2_max_concurrent_streams")) {
+			http2MaxConcurrentStreams = doc["http2_max_concurrent_streams"].asUInt();
+		}
+		if (doc.isMember("http2_max_total_streams")) {
+			http2MaxTotalStreams = doc["http2_max_total_streams"].asUInt();
+		}
+		if (doc.isMember("keep_alive_timeout")) {
+			keepAliveTimeout = doc["keep_alive_timeout"].asUInt();
+		}
+		if (doc.isMember("header_read_timeout")) {
+			headerReadTimeout = doc["header_read_timeout"].asUInt();
+		}
+		if (doc.isMember("body_read_timeout")) {
+			bodyReadTimeout = doc["body_read_timeout"].asUInt();
+		}
+		if (doc.isMember("response_timeout")) {
+			responseTimeout = doc["response_timeout"].asUInt();
+		}
 	}
 
 	virtual Json::Value getConfigAsJson() const {
 		Json::Value doc = ParentClass::getConfigAsJson();
 		doc["request_freelist_limit"] = requestFreelistLimit;
+		doc["http2"] = http2Enabled;
+		doc["http2_max_concurrent_streams"] = http2MaxConcurrentStreams;
+		doc["http2_max_total_streams"] = http2MaxTotalStreams;
+		doc["keep_alive_timeout"] = keepAliveTimeout;
+		doc["header_read_timeout"] = headerReadTimeout;
+		doc["body_read_timeout"] = bodyReadTimeout;
+		doc["response_timeout"] = responseTimeout;
 		return doc;
 	}
 
@@ -1120,6 +1625,14 @@ public:
 		Json::Value doc = ParentClass::inspectStateAsJson();
 		doc["free_request_count"] = freeRequestCount;
 		doc["total_requests_begun"] = (Json::UInt64) totalRequestsBegun;
+		doc["http2_stream_count"] = http2StreamCount;
+
+		Json::Value timeouts;
+		timeouts["keep_alive"] = (Json::UInt64) totalKeepAliveTimeouts;
+		timeouts["header_read"] = (Json::UInt64) totalHeaderReadTimeouts;
+		timeouts["body_read"] = (Json::UInt64) totalBodyReadTimeouts;
+		timeouts["response"] = (Json::UInt64) totalResponseTimeouts;
+		doc["timeouts"] = timeouts;
 		return doc;
 	}
 
@@ -1128,6 +1641,9 @@ public:
 		if (client->currentRequest) {
 			doc["current_request"] = inspectRequestStateAsJson(client->currentRequest);
 		}
+		if (client->http2Session != NULL) {
+			doc["http2"] = client->http2Session->inspectStateAsJson();
+		}
 		doc["requests_begun"] = client->requestsBegun;
 		doc["lingering_request_count"] = client->lingeringRequestCount;
 		return doc;
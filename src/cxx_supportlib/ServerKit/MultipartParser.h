@@ -0,0 +1,479 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2015 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_SERVER_KIT_MULTIPART_PARSER_H_
+#define _PASSENGER_SERVER_KIT_MULTIPART_PARSER_H_
+
+#include <string>
+#include <cstddef>
+#include <cstring>
+#include <StaticString.h>
+
+namespace Passenger {
+namespace ServerKit {
+
+using namespace std;
+
+
+/**
+ * A streaming parser for multipart/form-data bodies (RFC 2046 and RFC 7578).
+ * Feed it the body in arbitrarily sized pieces and it calls `onPartBegin`
+ * with the raw header block of every part, `onPartData` with its content
+ * and `onPartEnd` when the part's closing delimiter has been seen. The
+ * preamble and the epilogue are skipped.
+ *
+ * Part content is passed without copying: the `data` argument of
+ * `onPartData` either points into the buffer given to `feed()`, or (for
+ * bytes that turned out not to be the start of a delimiter after all) into
+ * memory owned by the parser that stays valid for the parser's lifetime.
+ */
+class MultipartParser {
+public:
+	typedef void (*PartBeginCallback)(MultipartParser *parser, const StaticString &headers);
+	typedef void (*PartDataCallback)(MultipartParser *parser, const char *data, size_t size);
+	typedef void (*PartEndCallback)(MultipartParser *parser);
+
+	enum State {
+		PREAMBLE,
+		AFTER_DELIMITER,
+		AFTER_DELIMITER_DASH,
+		AFTER_DELIMITER_CR,
+		PARSING_HEADERS,
+		PARSING_BODY,
+		DONE,
+		ERROR
+	};
+
+	/** RFC 2046 limits boundaries to 70 characters. */
+	static const unsigned int MAX_BOUNDARY_SIZE = 70;
+	static const unsigned int MAX_HEADERS_SIZE = 16 * 1024;
+
+private:
+	/** "\r\n--" followed by the boundary. */
+	string delimiter;
+	string headers;
+	const char *errorMessage;
+	unsigned int matched;
+	State state;
+
+	static char toLower(char ch) {
+		if (ch >= 'A' && ch <= 'Z') {
+			return ch - 'A' + 'a';
+		} else {
+			return ch;
+		}
+	}
+
+	static bool isSpace(char ch) {
+		return ch == ' ' || ch == '\t';
+	}
+
+	static StaticString trim(const StaticString &str) {
+		const char *begin = str.data();
+		const char *end = str.data() + str.size();
+		while (begin < end && isSpace(*begin)) {
+			begin++;
+		}
+		while (end > begin && isSpace(end[-1])) {
+			end--;
+		}
+		return StaticString(begin, end - begin);
+	}
+
+	void setError(const char *message) {
+		state = ERROR;
+		errorMessage = message;
+	}
+
+	void emitData(const char *data, size_t size) {
+		if (size > 0 && onPartData != NULL) {
+			onPartData(this, data, size);
+		}
+	}
+
+	/**
+	 * Scans for the delimiter. In the preamble, data before the delimiter
+	 * is dropped; in a part body it is passed to `onPartData`.
+	 */
+	const char *scanForDelimiter(const char *pos, const char *end, bool emit) {
+		while (pos < end) {
+			if (matched == 0) {
+				// The delimiter starts with a CR, and the boundary may not
+				// contain one, so a CR is the only place where a match can
+				// start.
+				const char *cr = (const char *) memchr(pos, '\r', end - pos);
+				if (cr == NULL) {
+					if (emit) {
+						emitData(pos, end - pos);
+					}
+					return end;
+				}
+				if (emit) {
+					emitData(pos, cr - pos);
+				}
+				pos = cr + 1;
+				matched = 1;
+			} else if (*pos == delimiter[matched]) {
+				pos++;
+				matched++;
+				if (matched == delimiter.size()) {
+					matched = 0;
+					if (state == PARSING_BODY && onPartEnd != NULL) {
+						onPartEnd(this);
+					}
+					state = AFTER_DELIMITER;
+					return pos;
+				}
+			} else {
+				// What we held back wasn't a delimiter after all. Check
+				// the current byte again, it may start a new match.
+				if (emit) {
+					emitData(delimiter.data(), matched);
+				}
+				matched = 0;
+			}
+		}
+		return pos;
+	}
+
+	const char *parseHeaders(const char *pos, const char *end) {
+		while (pos < end) {
+			headers.append(1, *pos);
+			pos++;
+			if (headers.size() == 2 && headers[0] == '\r' && headers[1] == '\n') {
+				// A part without headers.
+				headers.clear();
+				beginPart();
+				return pos;
+			} else if (headers.size() >= 4
+				&& memcmp(headers.data() + headers.size() - 4, "\r\n\r\n", 4) == 0)
+			{
+				headers.resize(headers.size() - 4);
+				beginPart();
+				return pos;
+			} else if (headers.size() > MAX_HEADERS_SIZE) {
+				setError("part headers too large");
+				return pos;
+			}
+		}
+		return pos;
+	}
+
+	void beginPart() {
+		state = PARSING_BODY;
+		if (onPartBegin != NULL) {
+			onPartBegin(this, headers);
+		}
+		headers.clear();
+	}
+
+public:
+	PartBeginCallback onPartBegin;
+	PartDataCallback onPartData;
+	PartEndCallback onPartEnd;
+	void *userData;
+
+	MultipartParser(const StaticString &boundary)
+		: errorMessage(NULL),
+		  // The first delimiter may appear at the very start of the body,
+		  // without a preceding CRLF.
+		  matched(2),
+		  state(PREAMBLE),
+		  onPartBegin(NULL),
+		  onPartData(NULL),
+		  onPartEnd(NULL),
+		  userData(NULL)
+	{
+		delimiter.reserve(boundary.size() + 4);
+		delimiter.append("\r\n--");
+		delimiter.append(boundary.data(), boundary.size());
+	}
+
+	/**
+	 * Parses the given data. Returns the number of bytes consumed, which is
+	 * less than `size` only if an error occurred. Data after the closing
+	 * delimiter is consumed and ignored.
+	 */
+	size_t feed(const char *data, size_t size) {
+		const char *pos = data;
+		const char *end = data + size;
+
+		while (pos < end) {
+			switch (state) {
+			case PREAMBLE:
+				pos = scanForDelimiter(pos, end, false);
+				break;
+			case AFTER_DELIMITER:
+				if (*pos == '-') {
+					state = AFTER_DELIMITER_DASH;
+				} else if (*pos == '\r') {
+					state = AFTER_DELIMITER_CR;
+				} else if (!isSpace(*pos)) {
+					setError("invalid data after delimiter");
+					return pos - data;
+				}
+				pos++;
+				break;
+			case AFTER_DELIMITER_DASH:
+				if (*pos != '-') {
+					setError("invalid data after delimiter");
+					return pos - data;
+				}
+				state = DONE;
+				pos++;
+				break;
+			case AFTER_DELIMITER_CR:
+				if (*pos != '\n') {
+					setError("invalid data after delimiter");
+					return pos - data;
+				}
+				state = PARSING_HEADERS;
+				pos++;
+				break;
+			case PARSING_HEADERS:
+				pos = parseHeaders(pos, end);
+				if (state == ERROR) {
+					return pos - data;
+				}
+				break;
+			case PARSING_BODY:
+				pos = scanForDelimiter(pos, end, true);
+				break;
+			case DONE:
+				return size;
+			case ERROR:
+				return pos - data;
+			}
+		}
+
+		return size;
+	}
+
+	State getState() const {
+		return state;
+	}
+
+	/** Whether the closing delimiter has been parsed. */
+	bool isDone() const {
+		return state == DONE;
+	}
+
+	bool hasError() const {
+		return state == ERROR;
+	}
+
+	const char *getErrorMessage() const {
+		return errorMessage;
+	}
+
+
+	/***** Header utilities *****/
+
+	static bool equalsIgnoreCase(const StaticString &a, const StaticString &b) {
+		if (a.size() != b.size()) {
+			return false;
+		}
+		for (string::size_type i = 0; i < a.size(); i++) {
+			if (toLower(a[i]) != toLower(b[i])) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/**
+	 * Extracts the boundary from a Content-Type header value. Returns false
+	 * if the media type is not multipart/form-data or if the boundary is
+	 * missing or invalid.
+	 */
+	static bool parseBoundary(const StaticString &contentType, string &boundary) {
+		string::size_type pos = contentType.find(';');
+		StaticString mediaType = trim(contentType.substr(0, pos));
+
+		if (!equalsIgnoreCase(mediaType, P_STATIC_STRING("multipart/form-data"))) {
+			return false;
+		}
+		boundary.clear();
+		return getHeaderParameter(contentType, P_STATIC_STRING("boundary"), boundary)
+			&& !boundary.empty()
+			&& boundary.size() <= MAX_BOUNDARY_SIZE
+			&& boundary.find('\r') == string::npos
+			&& boundary.find('\n') == string::npos;
+	}
+
+	/**
+	 * Looks up a header in a raw header block, as passed to `onPartBegin`.
+	 * Returns the trimmed value, or an empty string if there is no such header.
+	 */
+	static StaticString getHeader(const StaticString &headers, const StaticString &name) {
+		StaticString result;
+		findHeaders(headers, name, &result);
+		return result;
+	}
+
+	/**
+	 * Returns how many times a header occurs in a raw header block.
+	 */
+	static unsigned int countHeaders(const StaticString &headers, const StaticString &name) {
+		return findHeaders(headers, name, NULL);
+	}
+
+	/**
+	 * Extracts a parameter such as `name` or `filename` from a header value
+	 * like `form-data; name="field"; filename="a.txt"`. Quoted values are
+	 * unescaped. Returns whether the parameter exists.
+	 */
+	static bool getHeaderParameter(const StaticString &value, const StaticString &name,
+		string &result)
+	{
+		return findHeaderParameters(value, name, &result) > 0;
+	}
+
+	/**
+	 * Returns how many times a parameter occurs in a header value.
+	 */
+	static unsigned int countHeaderParameters(const StaticString &value, const StaticString &name) {
+		return findHeaderParameters(value, name, NULL);
+	}
+
+private:
+	/**
+	 * Stores the value of the first occurrence of the given header in `result`,
+	 * unless `result` is NULL, in which case all occurrences are counted.
+	 */
+	static unsigned int findHeaders(const StaticString &headers, const StaticString &name,
+		StaticString *result)
+	{
+		string::size_type pos = 0;
+		unsigned int count = 0;
+
+		while (pos < headers.size()) {
+			string::size_type lineEnd = headers.find("\r\n", pos);
+			if (lineEnd == string::npos) {
+				lineEnd = headers.size();
+			}
+
+			StaticString line = headers.substr(pos, lineEnd - pos);
+			string::size_type colon = line.find(':');
+			if (colon != string::npos
+			 && equalsIgnoreCase(trim(line.substr(0, colon)), name))
+			{
+				count++;
+				if (result != NULL) {
+					*result = trim(line.substr(colon + 1));
+					return count;
+				}
+			}
+			pos = lineEnd + 2;
+		}
+
+		return count;
+	}
+
+	/**
+	 * Like `findHeaders()`, but for parameters inside a header value.
+	 */
+	static unsigned int findHeaderParameters(const StaticString &value, const StaticString &name,
+		string *result)
+	{
+		unsigned int count = 0;
+		const char *pos = value.data();
+		const char *end = value.data() + value.size();
+
+		// Skip the value itself; parameters follow the first semicolon.
+		while (pos < end && *pos != ';') {
+			if (*pos == '"') {
+				pos++;
+				while (pos < end && *pos != '"') {
+					pos++;
+				}
+			}
+			if (pos < end) {
+				pos++;
+			}
+		}
+
+		while (pos < end) {
+			// *pos is ';'
+			pos++;
+			while (pos < end && isSpace(*pos)) {
+				pos++;
+			}
+
+			const char *keyBegin = pos;
+			while (pos < end && *pos != '=' && *pos != ';') {
+				pos++;
+			}
+			StaticString key = trim(StaticString(keyBegin, pos - keyBegin));
+			string paramValue;
+
+			if (pos < end && *pos == '=') {
+				pos++;
+				while (pos < end && isSpace(*pos)) {
+					pos++;
+				}
+				if (pos < end && *pos == '"') {
+					pos++;
+					while (pos < end && *pos != '"') {
+						if (*pos == '\\' && pos + 1 < end) {
+							pos++;
+						}
+						paramValue.append(1, *pos);
+						pos++;
+					}
+					if (pos < end) {
+						pos++;
+					}
+					while (pos < end && *pos != ';') {
+						pos++;
+					}
+				} else {
+					const char *valueBegin = pos;
+					while (pos < end && *pos != ';') {
+						pos++;
+					}
+					StaticString token = trim(StaticString(valueBegin, pos - valueBegin));
+					paramValue.assign(token.data(), token.size());
+				}
+			}
+
+			if (equalsIgnoreCase(key, name)) {
+				count++;
+				if (result != NULL) {
+					*result = paramValue;
+					return count;
+				}
+			}
+		}
+
+		return count;
+	}
+};
+
+
+} // namespace ServerKit
+} // namespace Passenger
+
+#endif /* _PASSENGER_SERVER_KIT_MULTIPART_PARSER_H_ */
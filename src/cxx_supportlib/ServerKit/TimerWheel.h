@@ -0,0 +1,347 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2015 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_SERVER_KIT_TIMER_WHEEL_H_
+#define _PASSENGER_SERVER_KIT_TIMER_WHEEL_H_
+
+#include <ev++.h>
+#include <cstddef>
+#include <cassert>
+#include <jsoncpp/json.h>
+
+namespace Passenger {
+namespace ServerKit {
+
+
+struct TimerWheelEntry;
+
+typedef void (*TimerWheelCallback)(TimerWheelEntry *entry);
+
+/**
+ * A timer that can be armed in a TimerWheel. Entries are meant to be
+ * embedded in the object that they time out (e.g. a client), so arming
+ * a timer never allocates memory.
+ */
+struct TimerWheelEntry {
+	TimerWheelEntry *next;
+	TimerWheelEntry *prev;
+	/** The tick at which this entry expires. Only valid while armed. */
+	unsigned long long expiry;
+	TimerWheelCallback callback;
+	void *userData;
+
+	TimerWheelEntry()
+		: next(NULL),
+		  prev(NULL),
+		  expiry(0),
+		  callback(NULL),
+		  userData(NULL)
+		{ }
+
+	bool isArmed() const {
+		return next != NULL;
+	}
+};
+
+
+/**
+ * A hierarchical hashed timer wheel, for keeping track of large numbers
+ * of timeouts that are usually cancelled or re-armed long before they
+ * expire, such as client idle timeouts.
+ *
+ * Time is divided into ticks of `tickMsec` milliseconds. The wheel
+ * consists of LEVELS levels of SLOTS slots each; level `n` slots span
+ * SLOTS^n ticks. Arming, re-arming and cancelling a timer are O(1):
+ * they only link or unlink the entry from a slot list. Once per tick,
+ * the slot for the current tick on level 0 is expired, and every SLOTS^n
+ * ticks one slot on level `n` is cascaded into the lower levels. Timeouts
+ * are therefore rounded up to a multiple of the tick duration. Timeouts
+ * longer than the wheel's range (SLOTS^LEVELS ticks; about 19 days with
+ * the default tick duration) are clamped to that range.
+ *
+ * When constructed with an event loop, the wheel drives itself with a
+ * libev timer that only runs while at least one timer is armed, so an
+ * idle server doesn't wake up every tick. Without an event loop, the
+ * caller must call `expire()` periodically.
+ *
+ * This class is not thread-safe and must only be used from the event
+ * loop thread.
+ */
+class TimerWheel {
+public:
+	static const unsigned int SLOT_BITS = 6;
+	static const unsigned int SLOTS = 1 << SLOT_BITS;
+	static const unsigned int SLOT_MASK = SLOTS - 1;
+	static const unsigned int LEVELS = 4;
+	static const unsigned int DEFAULT_TICK_MSEC = 100;
+
+private:
+	struct ev_loop *loop;
+	ev_timer timer;
+	unsigned int tickMsec;
+	/** The last tick that has been processed. */
+	unsigned long long currentTick;
+	unsigned int armedCount;
+	unsigned long long totalExpirations;
+	/** Circular lists with sentinel heads. */
+	TimerWheelEntry slots[LEVELS][SLOTS];
+
+	static void initList(TimerWheelEntry *head) {
+		head->next = head;
+		head->prev = head;
+	}
+
+	static bool listEmpty(const TimerWheelEntry *head) {
+		return head->next == head;
+	}
+
+	static void unlink(TimerWheelEntry *entry) {
+		entry->prev->next = entry->next;
+		entry->next->prev = entry->prev;
+		entry->next = NULL;
+		entry->prev = NULL;
+	}
+
+	static void append(TimerWheelEntry *head, TimerWheelEntry *entry) {
+		entry->next = head;
+		entry->prev = head->prev;
+		head->prev->next = entry;
+		head->prev = entry;
+	}
+
+	/** Moves all entries from `from` into the empty list `to`. */
+	static void moveList(TimerWheelEntry *from, TimerWheelEntry *to) {
+		if (listEmpty(from)) {
+			initList(to);
+		} else {
+			to->next = from->next;
+			to->prev = from->prev;
+			to->next->prev = to;
+			to->prev->next = to;
+			initList(from);
+		}
+	}
+
+	static unsigned long long getRange() {
+		return 1ull << (SLOT_BITS * LEVELS);
+	}
+
+	void insert(TimerWheelEntry *entry) {
+		unsigned long long delta = entry->expiry - currentTick;
+		unsigned int level;
+
+		if (delta >= getRange()) {
+			entry->expiry = currentTick + getRange() - 1;
+			delta = getRange() - 1;
+		}
+		for (level = 0; level < LEVELS - 1; level++) {
+			if (delta < (1ull << (SLOT_BITS * (level + 1)))) {
+				break;
+			}
+		}
+		append(&slots[level][(entry->expiry >> (SLOT_BITS * level)) & SLOT_MASK],
+			entry);
+	}
+
+	/**
+	 * Re-inserts the entries of the given slot. Because they expire within
+	 * the span of that slot, they all end up in lower levels.
+	 */
+	void cascade(unsigned int level, unsigned int index) {
+		TimerWheelEntry list;
+		TimerWheelEntry *entry;
+
+		moveList(&slots[level][index], &list);
+		while (!listEmpty(&list)) {
+			entry = list.next;
+			unlink(entry);
+			insert(entry);
+		}
+	}
+
+	void processTick() {
+		TimerWheelEntry list;
+		TimerWheelEntry *entry;
+		unsigned int index = currentTick & SLOT_MASK;
+
+		for (unsigned int level = 1; level < LEVELS && index == 0; level++) {
+			index = (currentTick >> (SLOT_BITS * level)) & SLOT_MASK;
+			cascade(level, index);
+		}
+
+		// Detach the slot first: callbacks may arm or cancel any
+		// timer, including ones that expire in this very tick.
+		moveList(&slots[0][currentTick & SLOT_MASK], &list);
+		while (!listEmpty(&list)) {
+			entry = list.next;
+			unlink(entry);
+			armedCount--;
+			totalExpirations++;
+			entry->callback(entry);
+		}
+	}
+
+	unsigned long long msecToTick(unsigned long long msec) const {
+		return msec / tickMsec;
+	}
+
+	unsigned long long getNowMsec() const {
+		return (unsigned long long) (ev_now(loop) * 1000);
+	}
+
+	void startTimer() {
+		if (loop != NULL && !ev_is_active(&timer)) {
+			ev_timer_set(&timer, tickMsec / 1000.0, tickMsec / 1000.0);
+			ev_timer_start(loop, &timer);
+		}
+	}
+
+	void stopTimer() {
+		if (loop != NULL && ev_is_active(&timer)) {
+			ev_timer_stop(loop, &timer);
+		}
+	}
+
+	static void onTimeout(EV_P_ ev_timer *w, int revents) {
+		TimerWheel *self = static_cast<TimerWheel *>(w->data);
+		self->expire(self->getNowMsec());
+	}
+
+public:
+	TimerWheel(struct ev_loop *_loop = NULL, unsigned int _tickMsec = DEFAULT_TICK_MSEC)
+		: loop(_loop),
+		  tickMsec(_tickMsec),
+		  currentTick(0),
+		  armedCount(0),
+		  totalExpirations(0)
+	{
+		assert(tickMsec > 0);
+		for (unsigned int level = 0; level < LEVELS; level++) {
+			for (unsigned int i = 0; i < SLOTS; i++) {
+				initList(&slots[level][i]);
+			}
+		}
+		ev_timer_init(&timer, onTimeout, 0, 0);
+		timer.data = this;
+	}
+
+	~TimerWheel() {
+		stopTimer();
+	}
+
+	/**
+	 * Arms the given entry so that its callback is called once `timeoutMsec`
+	 * milliseconds have passed, counting from the event loop's current time.
+	 * If the entry is already armed, then it is re-armed with the new timeout.
+	 */
+	void arm(TimerWheelEntry *entry, unsigned int timeoutMsec) {
+		assert(loop != NULL);
+		arm(entry, timeoutMsec, getNowMsec());
+	}
+
+	/**
+	 * Like `arm(entry, timeoutMsec)`, but with an explicitly given current
+	 * time, in milliseconds. The callback will be called from an `expire()`
+	 * call with a time of at least `nowMsec + timeoutMsec`, rounded up to
+	 * the next tick.
+	 */
+	void arm(TimerWheelEntry *entry, unsigned int timeoutMsec, unsigned long long nowMsec) {
+		unsigned long long expiry;
+
+		assert(entry->callback != NULL);
+		if (entry->isArmed()) {
+			unlink(entry);
+		} else {
+			if (armedCount == 0) {
+				// No need to process the ticks that passed while idle.
+				currentTick = msecToTick(nowMsec);
+			}
+			armedCount++;
+		}
+
+		expiry = msecToTick(nowMsec + timeoutMsec + tickMsec - 1);
+		if (expiry <= currentTick) {
+			expiry = currentTick + 1;
+		}
+		entry->expiry = expiry;
+		insert(entry);
+		startTimer();
+	}
+
+	/** Disarms the given entry. Does nothing if it isn't armed. */
+	void cancel(TimerWheelEntry *entry) {
+		if (entry->isArmed()) {
+			unlink(entry);
+			armedCount--;
+		}
+	}
+
+	/**
+	 * Calls the callbacks of all entries that expire at or before the given
+	 * time, in milliseconds. This is called automatically if the wheel has
+	 * an event loop.
+	 */
+	void expire(unsigned long long nowMsec) {
+		unsigned long long targetTick = msecToTick(nowMsec);
+
+		while (currentTick < targetTick) {
+			if (armedCount == 0) {
+				currentTick = targetTick;
+				break;
+			}
+			currentTick++;
+			processTick();
+		}
+		if (armedCount == 0) {
+			stopTimer();
+		}
+	}
+
+	unsigned int getTickMsec() const {
+		return tickMsec;
+	}
+
+	unsigned int getArmedCount() const {
+		return armedCount;
+	}
+
+	unsigned long long getTotalExpirations() const {
+		return totalExpirations;
+	}
+
+	Json::Value inspectStateAsJson() const {
+		Json::Value doc;
+		doc["tick_msec"] = tickMsec;
+		doc["armed"] = armedCount;
+		doc["total_expirations"] = (Json::UInt64) totalExpirations;
+		return doc;
+	}
+};
+
+
+} // namespace ServerKit
+} // namespace Passenger
+
+#endif /* _PASSENGER_SERVER_KIT_TIMER_WHEEL_H_ */
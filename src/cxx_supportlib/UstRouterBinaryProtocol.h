@@ -0,0 +1,273 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2015 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_UST_ROUTER_BINARY_PROTOCOL_H_
+#define _PASSENGER_UST_ROUTER_BINARY_PROTOCOL_H_
+
+#include <boost/cstdint.hpp>
+#include <arpa/inet.h>
+#include <cstring>
+#include <string>
+#include <StaticString.h>
+#include <Utils/StringMap.h>
+
+/*
+ * Binary framing for logger connections between UnionStation::Core and the
+ * UstRouter.
+ *
+ * With the text protocol, every log entry is an array message containing a
+ * hexatri timestamp, followed by a separate scalar message, and every
+ * 'openTransaction' repeats the group name, category and Union Station key
+ * as strings. A client that sends
+ *
+ *     init <node name> binary
+ *
+ * and gets back 'status ok binary' may send the hot path commands as frames
+ * instead:
+ *
+ *     uint8    frame type (high bit always set)
+ *     uint32   payload size
+ *     ...      payload
+ *
+ * The size prefix of array messages is limited to 16 KB by the UstRouter, so
+ * their first byte never has the high bit set. That is how the UstRouter
+ * tells frames and array messages apart: the other commands ('flush', 'info',
+ * 'ping') stay array messages, and so do all replies. An UstRouter that does
+ * not support frames rejects the extra 'init' argument, after which the
+ * client reconnects with the text protocol.
+ *
+ * Payloads. All integers are big endian; timestamps are in microseconds:
+ *
+ *     DEFINE_STRING      uint16 id, string
+ *     OPEN_TRANSACTION   uint8 flags, uint64 timestamp, uint16 group id,
+ *                        uint16 category id, uint16 Union Station key id,
+ *                        uint16 filters id, uint16 txnId size, txnId
+ *     LOG                uint8 flags, uint64 timestamp, uint16 txnId size,
+ *                        txnId, data
+ *     CLOSE_TRANSACTION  uint8 flags, uint64 timestamp, uint16 txnId size,
+ *                        txnId
+ *
+ * String IDs are scoped to the connection. Defining an ID that is already
+ * defined replaces its string. The node name is always the one given
+ * during 'init'.
+ */
+
+namespace Passenger {
+namespace UstRouterBinaryProtocol {
+
+using namespace std;
+
+
+enum FrameType {
+	DEFINE_STRING     = 0x81,
+	OPEN_TRANSACTION  = 0x82,
+	LOG               = 0x83,
+	CLOSE_TRANSACTION = 0x84
+};
+
+enum Flags {
+	CRASH_PROTECT = 1 << 0,
+	ACK           = 1 << 1
+};
+
+/** Frame type byte + payload size. */
+static const unsigned int FRAME_HEADER_SIZE = 1 + sizeof(boost::uint32_t);
+/** A string ID that refers to the empty string. */
+static const boost::uint16_t NO_STRING = 0xFFFF;
+static const unsigned int MAX_STRINGS = 1024;
+
+
+inline bool
+isFrameType(char c) {
+	return ((unsigned char) c & 0x80) != 0;
+}
+
+
+/**
+ * Appends a single frame to a string. Call finish() after all fields have
+ * been appended to fill in the payload size.
+ */
+class FrameBuilder {
+private:
+	string &output;
+	string::size_type start;
+
+public:
+	FrameBuilder(string &_output, FrameType type)
+		: output(_output),
+		  start(_output.size())
+	{
+		output.append(FRAME_HEADER_SIZE, '\0');
+		output[start] = (char) type;
+	}
+
+	void appendUint8(boost::uint8_t value) {
+		output.append(1, (char) value);
+	}
+
+	void appendUint16(boost::uint16_t value) {
+		value = htons(value);
+		output.append((const char *) &value, sizeof(value));
+	}
+
+	void appendUint64(boost::uint64_t value) {
+		boost::uint32_t halves[2] = {
+			htonl((boost::uint32_t) (value >> 32)),
+			htonl((boost::uint32_t) value)
+		};
+		output.append((const char *) halves, sizeof(halves));
+	}
+
+	/** Appends a string prefixed by its uint16 size. */
+	void appendSizedString(const StaticString &str) {
+		appendUint16(str.size());
+		output.append(str.data(), str.size());
+	}
+
+	void appendData(const StaticString &data) {
+		output.append(data.data(), data.size());
+	}
+
+	/**
+	 * @param trailingSize Size of data that belongs to this frame's payload,
+	 *                     but that the caller writes separately instead of
+	 *                     appending it.
+	 */
+	void finish(size_t trailingSize = 0) {
+		boost::uint32_t size = htonl(output.size() - start - FRAME_HEADER_SIZE
+			+ trailingSize);
+		memcpy(&output[start + 1], &size, sizeof(size));
+	}
+};
+
+
+/**
+ * Reads fields from a frame payload. All read methods return false if the
+ * payload is too short.
+ */
+class FrameParser {
+private:
+	const char *pos;
+	const char *end;
+
+public:
+	FrameParser(const StaticString &payload)
+		: pos(payload.data()),
+		  end(payload.data() + payload.size())
+		{ }
+
+	bool readUint8(boost::uint8_t &value) {
+		if (end - pos < 1) {
+			return false;
+		}
+		value = (boost::uint8_t) *pos;
+		pos++;
+		return true;
+	}
+
+	bool readUint16(boost::uint16_t &value) {
+		if (end - pos < (ptrdiff_t) sizeof(value)) {
+			return false;
+		}
+		memcpy(&value, pos, sizeof(value));
+		value = ntohs(value);
+		pos += sizeof(value);
+		return true;
+	}
+
+	bool readUint64(boost::uint64_t &value) {
+		boost::uint32_t halves[2];
+		if (end - pos < (ptrdiff_t) sizeof(halves)) {
+			return false;
+		}
+		memcpy(halves, pos, sizeof(halves));
+		value = ((boost::uint64_t) ntohl(halves[0]) << 32) | ntohl(halves[1]);
+		pos += sizeof(halves);
+		return true;
+	}
+
+	bool readSizedString(StaticString &str) {
+		boost::uint16_t size;
+		if (!readUint16(size) || end - pos < (ptrdiff_t) size) {
+			return false;
+		}
+		str = StaticString(pos, size);
+		pos += size;
+		return true;
+	}
+
+	/** Returns all unread data. */
+	StaticString rest() {
+		StaticString result(pos, end - pos);
+		pos = end;
+		return result;
+	}
+};
+
+
+/**
+ * Client side of the string table. Assigns IDs to strings and emits the
+ * DEFINE_STRING frames for strings that the UstRouter has not seen yet.
+ * When the table is full it starts over, redefining IDs from 0.
+ */
+class StringTable {
+private:
+	StringMap<boost::uint16_t> ids;
+	boost::uint16_t nextId;
+
+public:
+	StringTable()
+		: nextId(0)
+		{ }
+
+	boost::uint16_t lookup(const StaticString &str, string &output) {
+		if (str.empty()) {
+			return NO_STRING;
+		}
+
+		boost::uint16_t id = ids.get(str, NO_STRING);
+		if (id == NO_STRING) {
+			if (nextId == MAX_STRINGS) {
+				ids = StringMap<boost::uint16_t>();
+				nextId = 0;
+			}
+			id = nextId;
+			nextId++;
+			ids.set(str, id);
+
+			FrameBuilder frame(output, DEFINE_STRING);
+			frame.appendUint16(id);
+			frame.appendData(str);
+			frame.finish();
+		}
+		return id;
+	}
+};
+
+
+} // namespace UstRouterBinaryProtocol
+} // namespace Passenger
+
+#endif /* _PASSENGER_UST_ROUTER_BINARY_PROTOCOL_H_ */
@@ -0,0 +1,396 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2015 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_CPU_AFFINITY_H_
+#define _PASSENGER_CPU_AFFINITY_H_
+
+#ifdef __linux__
+	#define SUPPORTS_PER_THREAD_CPU_AFFINITY
+	#include <sched.h>
+	#include <pthread.h>
+#endif
+
+#include <boost/thread.hpp>
+#include <sys/types.h>
+#include <dirent.h>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <StaticString.h>
+#include <Exceptions.h>
+#include <Utils/StrIntUtils.h>
+#include <Utils/IOUtils.h>
+
+namespace Passenger {
+
+using namespace std;
+
+
+typedef vector<unsigned int> CpuList;
+
+
+/**
+ * Parses a CPU list in the format used by the Linux kernel and taskset,
+ * for example "0-3,8,10-11". Returns false if the format is invalid.
+ * The result is sorted and contains no duplicates.
+ */
+inline bool
+parseCpuList(const StaticString &str, CpuList &cpus) {
+	vector<string> parts;
+	vector<string>::const_iterator it;
+
+	cpus.clear();
+	split(strip(str), ',', parts);
+	for (it = parts.begin(); it != parts.end(); it++) {
+		string::size_type dash = it->find('-');
+		string first = (dash == string::npos) ? *it : it->substr(0, dash);
+		string last = (dash == string::npos) ? *it : it->substr(dash + 1);
+		unsigned int begin, end;
+
+		if (first.empty() || last.empty()
+		 || first.find_first_not_of("0123456789") != string::npos
+		 || last.find_first_not_of("0123456789") != string::npos)
+		{
+			cpus.clear();
+			return false;
+		}
+		begin = stringToUint(first);
+		end = stringToUint(last);
+		if (begin > end) {
+			cpus.clear();
+			return false;
+		}
+		for (unsigned int cpu = begin; cpu <= end; cpu++) {
+			cpus.push_back(cpu);
+		}
+	}
+
+	sort(cpus.begin(), cpus.end());
+	cpus.erase(unique(cpus.begin(), cpus.end()), cpus.end());
+	return !cpus.empty();
+}
+
+/**
+ * The inverse of `parseCpuList()`: formats a sorted CPU list,
+ * collapsing consecutive CPUs into ranges.
+ */
+inline string
+formatCpuList(const CpuList &cpus) {
+	string result;
+	unsigned int i = 0;
+
+	while (i < cpus.size()) {
+		unsigned int j = i;
+		while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) {
+			j++;
+		}
+		if (!result.empty()) {
+			result.append(1, ',');
+		}
+		result.append(toString(cpus[i]));
+		if (j > i) {
+			result.append(1, '-');
+			result.append(toString(cpus[j]));
+		}
+		i = j + 1;
+	}
+	return result;
+}
+
+
+/**
+ * Describes which CPUs belong to which NUMA node. On systems without
+ * NUMA information, all CPUs belong to node 0.
+ */
+class CpuTopology {
+public:
+	/** The NUMA node of each CPU, indexed by CPU number. -1 if unknown. */
+	vector<int> cpuNodes;
+	unsigned int nodeCount;
+
+	CpuTopology()
+		: nodeCount(0)
+		{ }
+
+	/**
+	 * Reads the topology from sysfs, where every NUMA node is a directory
+	 * named "node<N>" containing a "cpulist" file.
+	 */
+	void load(const string &nodeDir = "/sys/devices/system/node") {
+		DIR *dir = opendir(nodeDir.c_str());
+		struct dirent *ent;
+
+		cpuNodes.clear();
+		nodeCount = 0;
+		if (dir != NULL) {
+			while ((ent = readdir(dir)) != NULL) {
+				if (strncmp(ent->d_name, "node", 4) != 0
+				 || ent->d_name[4] < '0' || ent->d_name[4] > '9')
+				{
+					continue;
+				}
+
+				unsigned int node = atoi(ent->d_name + 4);
+				CpuList cpus;
+				string cpulist;
+				try {
+					cpulist = readAll(nodeDir + "/" + ent->d_name + "/cpulist");
+				} catch (const SystemException &) {
+					continue;
+				}
+				if (!parseCpuList(cpulist, cpus)) {
+					// Nodes without CPUs, such as memory-only nodes.
+					continue;
+				}
+				for (CpuList::const_iterator it = cpus.begin(); it != cpus.end(); it++) {
+					if (*it >= cpuNodes.size()) {
+						cpuNodes.resize(*it + 1, -1);
+					}
+					cpuNodes[*it] = node;
+				}
+				nodeCount = std::max(nodeCount, node + 1);
+			}
+			closedir(dir);
+		}
+
+		if (cpuNodes.empty()) {
+			cpuNodes.resize(std::max(1u, boost::thread::hardware_concurrency()), 0);
+			nodeCount = 1;
+		}
+	}
+
+	int getNode(unsigned int cpu) const {
+		if (cpu < cpuNodes.size()) {
+			return cpuNodes[cpu];
+		} else {
+			return -1;
+		}
+	}
+
+	/**
+	 * Returns the node that all of the given CPUs belong to,
+	 * or -1 if they span multiple nodes.
+	 */
+	int getNode(const CpuList &cpus) const {
+		int result = -1;
+		for (CpuList::const_iterator it = cpus.begin(); it != cpus.end(); it++) {
+			int node = getNode(*it);
+			if (node == -1 || (result != -1 && node != result)) {
+				return -1;
+			}
+			result = node;
+		}
+		return result;
+	}
+
+	/**
+	 * Reorders the given CPUs so that consecutive entries alternate between
+	 * NUMA nodes. Assigning threads in this order spreads them evenly over
+	 * the nodes, even if there are fewer threads than CPUs.
+	 */
+	CpuList interleave(const CpuList &cpus) const {
+		vector<CpuList> perNode(nodeCount + 1);
+		CpuList result;
+		unsigned int i;
+
+		for (CpuList::const_iterator it = cpus.begin(); it != cpus.end(); it++) {
+			int node = getNode(*it);
+			// CPUs of unknown nodes go last.
+			perNode[(node == -1) ? nodeCount : node].push_back(*it);
+		}
+		for (i = 0; result.size() < cpus.size(); i++) {
+			for (unsigned int node = 0; node < perNode.size(); node++) {
+				if (i < perNode[node].size()) {
+					result.push_back(perNode[node][i]);
+				}
+			}
+		}
+		return result;
+	}
+};
+
+
+/**
+ * Decides which CPUs each of `nthreads` threads should be bound to.
+ *
+ * `allowed` is the sorted list of CPUs that the threads may run on. If `spec`
+ * is empty, every thread is bound to a single CPU out of `allowed`, spread
+ * evenly over the NUMA nodes. Otherwise `spec` is a colon-separated list of
+ * CPU lists (see `parseCpuList()`), which are assigned to the threads in turn,
+ * for example "0-7:8-15". CPUs that are not in `allowed` are removed from
+ * these lists, so that the planned NUMA nodes match where the threads
+ * actually run. If `allowed` is empty, `spec` is only checked for validity.
+ *
+ * @throws ArgumentException `spec` is invalid, or one of its CPU lists
+ *   contains none of the allowed CPUs.
+ */
+inline vector<CpuList>
+planThreadCpuAffinity(unsigned int nthreads, const CpuTopology &topology,
+	const CpuList &allowed, const StaticString &spec)
+{
+	vector<CpuList> sets;
+	vector<CpuList> result;
+
+	if (spec.empty()) {
+		CpuList cpus = topology.interleave(allowed);
+		for (CpuList::const_iterator it = cpus.begin(); it != cpus.end(); it++) {
+			sets.push_back(CpuList(1, *it));
+		}
+	} else {
+		vector<string> parts;
+		vector<string>::const_iterator it;
+
+		split(spec, ':', parts);
+		for (it = parts.begin(); it != parts.end(); it++) {
+			CpuList cpus;
+			if (!parseCpuList(*it, cpus)) {
+				throw ArgumentException("Invalid CPU list '" + *it + "'");
+			}
+			if (!allowed.empty()) {
+				CpuList usable;
+				set_intersection(cpus.begin(), cpus.end(),
+					allowed.begin(), allowed.end(),
+					back_inserter(usable));
+				if (usable.empty()) {
+					throw ArgumentException("CPU list '" + *it + "' contains none of "
+						"the CPUs that this process may run on (" +
+						formatCpuList(allowed) + ")");
+				}
+				cpus = usable;
+			}
+			sets.push_back(cpus);
+		}
+	}
+
+	if (!sets.empty()) {
+		for (unsigned int i = 0; i < nthreads; i++) {
+			result.push_back(sets[i % sets.size()]);
+		}
+	}
+	return result;
+}
+
+
+#ifdef SUPPORTS_PER_THREAD_CPU_AFFINITY
+	/**
+	 * Returns the CPUs that the calling thread may run on.
+	 */
+	inline bool
+	getCurrentThreadCpuAffinity(CpuList &cpus) {
+		cpu_set_t set;
+
+		cpus.clear();
+		CPU_ZERO(&set);
+		if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+			return false;
+		}
+		for (unsigned int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+			if (CPU_ISSET(cpu, &set)) {
+				cpus.push_back(cpu);
+			}
+		}
+		return true;
+	}
+
+	/**
+	 * Binds the calling thread to the given CPUs. Threads that it creates
+	 * afterwards inherit this binding. Returns 0 on success, or an errno code.
+	 */
+	inline int
+	setCurrentThreadCpuAffinity(const CpuList &cpus) {
+		cpu_set_t set;
+
+		CPU_ZERO(&set);
+		for (CpuList::const_iterator it = cpus.begin(); it != cpus.end(); it++) {
+			if (*it >= CPU_SETSIZE) {
+				return EINVAL;
+			}
+			CPU_SET(*it, &set);
+		}
+		return pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	}
+
+	/**
+	 * Binds the calling thread to the given CPUs for the lifetime of this
+	 * object. Because Linux allocates memory pages on the NUMA node of the
+	 * CPU that first touches them, data structures that are created in this
+	 * scope are local to the given CPUs, and so are threads that are
+	 * started in this scope.
+	 *
+	 * If the binding fails, the thread keeps running on its current CPUs
+	 * and `getErrorCode()` tells why.
+	 */
+	class ScopedCpuAffinity {
+	private:
+		CpuList saved;
+		int errorCode;
+		bool restore;
+
+	public:
+		ScopedCpuAffinity(const CpuList &cpus)
+			: errorCode(0),
+			  restore(false)
+		{
+			if (cpus.empty()) {
+				return;
+			}
+			if (!getCurrentThreadCpuAffinity(saved)) {
+				errorCode = errno;
+			} else {
+				errorCode = setCurrentThreadCpuAffinity(cpus);
+				restore = errorCode == 0;
+			}
+		}
+
+		~ScopedCpuAffinity() {
+			if (restore) {
+				setCurrentThreadCpuAffinity(saved);
+			}
+		}
+
+		/** 0 if the thread has been bound to the given CPUs, otherwise an errno code. */
+		int getErrorCode() const {
+			return errorCode;
+		}
+	};
+#else
+	class ScopedCpuAffinity {
+	public:
+		ScopedCpuAffinity(const CpuList &cpus) { }
+
+		int getErrorCode() const {
+			return 0;
+		}
+	};
+#endif
+
+
+} // namespace Passenger
+
+#endif /* _PASSENGER_CPU_AFFINITY_H_ */
@@ -0,0 +1,452 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2015 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_FILE_WATCHER_H_
+#define _PASSENGER_FILE_WATCHER_H_
+
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/foreach.hpp>
+#include <boost/noncopyable.hpp>
+#include <oxt/thread.hpp>
+#include <oxt/backtrace.hpp>
+#include <oxt/system_calls.hpp>
+#include <string>
+#include <vector>
+#include <map>
+#include <utility>
+#include <cerrno>
+#include <cstring>
+#include <cassert>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#ifdef __linux__
+	#include <sys/inotify.h>
+#endif
+
+#include <Logging.h>
+
+namespace Passenger {
+
+using namespace std;
+using namespace oxt;
+
+
+/**
+ * Watches a set of file names inside directories, and asynchronously notifies
+ * the registered callbacks whenever such a file is created, modified, touched
+ * or removed. Example:
+ *
+ * @code
+ * FileWatcher watcher;
+ * vector<string> names;
+ * names.push_back("restart.txt");
+ * FileWatcher::WatchId id = watcher.watch("/webapps/foo/tmp", names, callback);
+ * watcher.start();
+ * ...
+ * watcher.unwatch(id);
+ * @endcode
+ *
+ * On Linux, inotify is used so that no filesystem calls are necessary
+ * for detecting changes. If inotify is not available (e.g. on other operating
+ * systems, or when the inotify watch limit has been reached) or if the watched
+ * directory does not exist yet, then FileWatcher falls back to polling the files
+ * with stat() once per `pollInterval` seconds. Directories watched through
+ * polling are periodically re-registered with inotify.
+ *
+ * Callbacks are called from a background thread, without any FileWatcher lock
+ * held. A callback may still be invoked shortly after unwatch() has returned,
+ * so callbacks must not reference objects that may have been destroyed.
+ *
+ * This class is thread-safe.
+ */
+class FileWatcher: public boost::noncopyable {
+public:
+	/**
+	 * @param dir The watched directory.
+	 * @param name The name of the file inside `dir` that changed.
+	 * @param exists Whether the file exists after the change.
+	 */
+	typedef boost::function<void (const string &dir, const string &name, bool exists)> Callback;
+	typedef unsigned int WatchId;
+
+private:
+	struct FileState {
+		time_t mtime;
+		time_t ctime;
+		bool exists;
+
+		FileState()
+			: mtime(0),
+			  ctime(0),
+			  exists(false)
+			{ }
+	};
+
+	struct Entry {
+		string dir;
+		vector<string> names;
+		vector<FileState> states;
+		Callback callback;
+		/** The inotify watch descriptor, or -1 if this entry is being polled. */
+		int wd;
+	};
+
+	typedef map<WatchId, Entry> EntryMap;
+	typedef pair<Callback, pair<string, pair<string, bool> > > Notification;
+
+	mutable boost::mutex syncher;
+	EntryMap entries;
+	WatchId nextId;
+	unsigned int pollInterval;
+	int inotifyFd;
+	oxt::thread *thr;
+
+	static FileState statFile(const string &dir, const string &name) {
+		FileState state;
+		struct stat buf;
+		string path = dir + "/" + name;
+
+		if (syscalls::stat(path.c_str(), &buf) == 0) {
+			state.mtime  = buf.st_mtime;
+			state.ctime  = buf.st_ctime;
+			state.exists = true;
+		}
+		return state;
+	}
+
+	void tryAddInotifyWatch(Entry &entry) {
+		#ifdef __linux__
+			if (inotifyFd == -1) {
+				return;
+			}
+			entry.wd = inotify_add_watch(inotifyFd, entry.dir.c_str(),
+				IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MODIFY
+				| IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF);
+			if (entry.wd == -1) {
+				int e = errno;
+				if (e != ENOENT && e != ENOTDIR) {
+					P_DEBUG("Cannot watch " << entry.dir << " with inotify: " <<
+						strerror(e) << " (errno=" << e << "); falling back to polling");
+				}
+			}
+		#endif
+	}
+
+	bool wdInUse(int wd) const {
+		EntryMap::const_iterator it, end = entries.end();
+		for (it = entries.begin(); it != end; it++) {
+			if (it->second.wd == wd) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void rescanEntry(Entry &entry, vector<Notification> &notifications) {
+		for (unsigned int i = 0; i < entry.names.size(); i++) {
+			FileState newState = statFile(entry.dir, entry.names[i]);
+			FileState &oldState = entry.states[i];
+			if (newState.exists != oldState.exists
+			 || newState.mtime != oldState.mtime
+			 || newState.ctime != oldState.ctime)
+			{
+				oldState = newState;
+				notifications.push_back(makeNotification(entry, entry.names[i],
+					newState.exists));
+			}
+		}
+	}
+
+	void pollEntries(vector<Notification> &notifications) {
+		EntryMap::iterator it, end = entries.end();
+		for (it = entries.begin(); it != end; it++) {
+			Entry &entry = it->second;
+			if (entry.wd == -1) {
+				// Maybe the directory has been created in the mean time.
+				// We try to watch it before scanning so that no changes
+				// can get lost in between.
+				tryAddInotifyWatch(entry);
+				rescanEntry(entry, notifications);
+			}
+		}
+	}
+
+	static Notification makeNotification(const Entry &entry, const string &name, bool exists) {
+		return Notification(entry.callback, make_pair(entry.dir, make_pair(name, exists)));
+	}
+
+	#ifdef __linux__
+		void processInotifyEvents(vector<Notification> &notifications) {
+			char buf[sizeof(struct inotify_event) + NAME_MAX + 1]
+				__attribute__((aligned(__alignof__(struct inotify_event))));
+			ssize_t ret;
+
+			while (true) {
+				ret = ::read(inotifyFd, buf, sizeof(buf));
+				if (ret <= 0) {
+					break;
+				}
+
+				const char *pos = buf;
+				const char *end = buf + ret;
+				while (pos < end) {
+					const struct inotify_event *event = (const struct inotify_event *) pos;
+					processInotifyEvent(event, notifications);
+					pos += sizeof(struct inotify_event) + event->len;
+				}
+			}
+		}
+
+		void processInotifyEvent(const struct inotify_event *event,
+			vector<Notification> &notifications)
+		{
+			EntryMap::iterator it, end = entries.end();
+
+			if (event->mask & IN_Q_OVERFLOW) {
+				// Events have been lost, so we don't know what changed.
+				for (it = entries.begin(); it != end; it++) {
+					rescanEntry(it->second, notifications);
+				}
+				return;
+			}
+			if (event->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+				// The directory itself is gone. Switch to polling until it
+				// reappears.
+				for (it = entries.begin(); it != end; it++) {
+					if (it->second.wd == event->wd) {
+						it->second.wd = -1;
+					}
+				}
+				return;
+			}
+			if (event->len == 0) {
+				return;
+			}
+
+			const char *name = event->name;
+			bool exists = !(event->mask & (IN_DELETE | IN_MOVED_FROM));
+			for (it = entries.begin(); it != end; it++) {
+				Entry &entry = it->second;
+				if (entry.wd != event->wd) {
+					continue;
+				}
+				for (unsigned int i = 0; i < entry.names.size(); i++) {
+					if (entry.names[i] == name) {
+						// Refresh the recorded state so that we don't report
+						// this change again if we ever fall back to polling.
+						entry.states[i] = statFile(entry.dir, entry.names[i]);
+						entry.states[i].exists = exists;
+						notifications.push_back(makeNotification(entry,
+							entry.names[i], exists));
+					}
+				}
+			}
+		}
+	#endif
+
+	void mainLoop() {
+		TRACE_POINT();
+		vector<Notification> notifications;
+
+		while (!this_thread::interruption_requested()) {
+			struct pollfd fds[1];
+			int nfds = 0;
+			int ret;
+
+			if (inotifyFd != -1) {
+				fds[0].fd = inotifyFd;
+				fds[0].events = POLLIN;
+				fds[0].revents = 0;
+				nfds = 1;
+			}
+
+			UPDATE_TRACE_POINT();
+			try {
+				ret = syscalls::poll(fds, nfds, pollInterval * 1000);
+			} catch (const thread_interrupted &) {
+				break;
+			}
+			if (ret == -1) {
+				int e = errno;
+				if (e != EINTR) {
+					P_WARN("Cannot poll() in file watcher: " << strerror(e) <<
+						" (errno=" << e << ")");
+					try {
+						syscalls::sleep(pollInterval);
+					} catch (const thread_interrupted &) {
+						break;
+					}
+				}
+				continue;
+			}
+
+			UPDATE_TRACE_POINT();
+			{
+				boost::lock_guard<boost::mutex> l(syncher);
+				#ifdef __linux__
+					if (ret > 0) {
+						processInotifyEvents(notifications);
+					}
+				#endif
+				pollEntries(notifications);
+			}
+
+			UPDATE_TRACE_POINT();
+			foreach (const Notification &n, notifications) {
+				try {
+					n.first(n.second.first, n.second.second.first, n.second.second.second);
+				} catch (const tracable_exception &e) {
+					P_WARN("ERROR in file watcher callback: " << e.what() <<
+						"\n  Backtrace:\n" << e.backtrace());
+				}
+			}
+			notifications.clear();
+		}
+	}
+
+public:
+	/**
+	 * @param pollInterval The number of seconds between two stat() calls on
+	 *                     files that cannot be watched with inotify.
+	 * @param useInotify Whether inotify may be used at all.
+	 */
+	FileWatcher(unsigned int _pollInterval = 1, bool useInotify = true)
+		: nextId(1),
+		  pollInterval(_pollInterval == 0 ? 1 : _pollInterval),
+		  inotifyFd(-1),
+		  thr(NULL)
+	{
+		#ifdef __linux__
+			if (useInotify) {
+				inotifyFd = inotify_init();
+				if (inotifyFd == -1) {
+					int e = errno;
+					P_WARN("Cannot initialize inotify: " << strerror(e) <<
+						" (errno=" << e << "); falling back to polling");
+				} else {
+					fcntl(inotifyFd, F_SETFD, FD_CLOEXEC);
+					fcntl(inotifyFd, F_SETFL, fcntl(inotifyFd, F_GETFL) | O_NONBLOCK);
+				}
+			}
+		#endif
+	}
+
+	~FileWatcher() {
+		stop();
+		if (inotifyFd != -1) {
+			this_thread::disable_syscall_interruption dsi;
+			syscalls::close(inotifyFd);
+		}
+	}
+
+	void start() {
+		assert(thr == NULL);
+		thr = new oxt::thread(boost::bind(&FileWatcher::mainLoop, this),
+			"File watcher", 128 * 1024);
+	}
+
+	void stop() {
+		if (thr != NULL) {
+			this_thread::disable_interruption di;
+			this_thread::disable_syscall_interruption dsi;
+			thr->interrupt_and_join();
+			delete thr;
+			thr = NULL;
+		}
+	}
+
+	/**
+	 * Starts watching the files with the given names inside `dir`.
+	 * The current state of the files is recorded so that only subsequent
+	 * changes result in `callback` being called.
+	 */
+	WatchId watch(const string &dir, const vector<string> &names, const Callback &callback) {
+		boost::lock_guard<boost::mutex> l(syncher);
+		WatchId id = nextId++;
+		if (nextId == 0) {
+			nextId = 1;
+		}
+
+		Entry &entry = entries[id];
+		entry.dir = dir;
+		entry.names = names;
+		entry.callback = callback;
+		entry.wd = -1;
+		foreach (const string &name, names) {
+			entry.states.push_back(statFile(dir, name));
+		}
+		tryAddInotifyWatch(entry);
+		return id;
+	}
+
+	void unwatch(WatchId id) {
+		boost::lock_guard<boost::mutex> l(syncher);
+		EntryMap::iterator it = entries.find(id);
+		if (it == entries.end()) {
+			return;
+		}
+
+		int wd = it->second.wd;
+		entries.erase(it);
+		#ifdef __linux__
+			if (wd != -1 && !wdInUse(wd)) {
+				inotify_rm_watch(inotifyFd, wd);
+			}
+		#endif
+	}
+
+	/**
+	 * Returns whether the given file existed as of the last time
+	 * FileWatcher looked at it.
+	 */
+	bool exists(WatchId id, const string &name) const {
+		boost::lock_guard<boost::mutex> l(syncher);
+		EntryMap::const_iterator it = entries.find(id);
+		if (it == entries.end()) {
+			return false;
+		}
+		for (unsigned int i = 0; i < it->second.names.size(); i++) {
+			if (it->second.names[i] == name) {
+				return it->second.states[i].exists;
+			}
+		}
+		return false;
+	}
+
+	bool usingInotify() const {
+		return inotifyFd != -1;
+	}
+};
+
+
+} // namespace Passenger
+
+#endif /* _PASSENGER_FILE_WATCHER_H_ */
@@ -0,0 +1,196 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2015 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_LATENCY_HISTOGRAM_H_
+#define _PASSENGER_LATENCY_HISTOGRAM_H_
+
+#include <ostream>
+#include <cstring>
+
+namespace Passenger {
+
+class MetricHistogram;
+
+/**
+ * A fixed-size histogram of durations, in microseconds. Samples are counted
+ * in buckets whose upper bounds roughly follow a 1-2.5-5 progression from
+ * 1 ms to 10 s, plus an overflow bucket. Adding a sample is O(number of
+ * buckets) with no memory allocation, so this is cheap enough to update
+ * while holding a lock on a hot path.
+ *
+ * The bucket counts are non-cumulative: `getBucketCount(i)` is the number of
+ * samples that are larger than `getBucketUpperBound(i - 1)` and at most
+ * `getBucketUpperBound(i)`.
+ *
+ * This class is not thread-safe.
+ */
+class LatencyHistogram {
+public:
+	static const unsigned int BUCKETS = 14;
+
+private:
+	unsigned long long buckets[BUCKETS];
+	unsigned long long count;
+	unsigned long long sum;
+	unsigned long long max;
+
+	friend class MetricHistogram;
+
+public:
+	LatencyHistogram() {
+		reset();
+	}
+
+	void reset() {
+		memset(buckets, 0, sizeof(buckets));
+		count = 0;
+		sum = 0;
+		max = 0;
+	}
+
+	/**
+	 * Returns the inclusive upper bound of the given bucket, in microseconds.
+	 * The last bucket has no upper bound; 0 is returned for it.
+	 */
+	static unsigned long long getBucketUpperBound(unsigned int index) {
+		static const unsigned long long bounds[BUCKETS - 1] = {
+			1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000,
+			500000, 1000000, 2500000, 5000000, 10000000
+		};
+		if (index < BUCKETS - 1) {
+			return bounds[index];
+		} else {
+			return 0;
+		}
+	}
+
+	void add(unsigned long long usec) {
+		unsigned int i = 0;
+		while (i < BUCKETS - 1 && usec > getBucketUpperBound(i)) {
+			i++;
+		}
+		buckets[i]++;
+		count++;
+		sum += usec;
+		if (usec > max) {
+			max = usec;
+		}
+	}
+
+	/**
+	 * Adds all samples of the given histogram to this one, for example
+	 * to sum histograms that were collected by different threads.
+	 */
+	void merge(const LatencyHistogram &other) {
+		for (unsigned int i = 0; i < BUCKETS; i++) {
+			buckets[i] += other.buckets[i];
+		}
+		count += other.count;
+		sum += other.sum;
+		if (other.max > max) {
+			max = other.max;
+		}
+	}
+
+	unsigned long long getBucketCount(unsigned int index) const {
+		return buckets[index];
+	}
+
+	unsigned long long getCount() const {
+		return count;
+	}
+
+	/** The sum of all samples, in microseconds. */
+	unsigned long long getSum() const {
+		return sum;
+	}
+
+	/** The largest sample seen, in microseconds. */
+	unsigned long long getMax() const {
+		return max;
+	}
+
+	/** The mean of all samples, in microseconds. */
+	unsigned long long getMean() const {
+		if (count == 0) {
+			return 0;
+		} else {
+			return sum / count;
+		}
+	}
+
+	/**
+	 * Estimates the given percentile (0-100) by returning the upper bound of
+	 * the bucket it falls in, capped at the largest sample seen. Returns 0 if
+	 * there are no samples.
+	 */
+	unsigned long long getPercentile(double percentile) const {
+		if (count == 0) {
+			return 0;
+		}
+
+		unsigned long long rank = (unsigned long long) (count * percentile / 100.0 + 0.5);
+		unsigned long long seen = 0;
+		if (rank == 0) {
+			rank = 1;
+		}
+		for (unsigned int i = 0; i < BUCKETS - 1; i++) {
+			seen += buckets[i];
+			if (seen >= rank) {
+				return std::min(getBucketUpperBound(i), max);
+			}
+		}
+		return max;
+	}
+
+	/**
+	 * Writes the histogram as XML elements (without an enclosing element).
+	 * Only non-empty buckets are written. Times are in microseconds.
+	 */
+	void toXml(std::ostream &stream) const {
+		stream << "<count>" << count << "</count>";
+		stream << "<sum>" << sum << "</sum>";
+		stream << "<max>" << max << "</max>";
+		stream << "<buckets>";
+		for (unsigned int i = 0; i < BUCKETS; i++) {
+			if (buckets[i] == 0) {
+				continue;
+			}
+			stream << "<bucket>";
+			if (i < BUCKETS - 1) {
+				stream << "<le>" << getBucketUpperBound(i) << "</le>";
+			} else {
+				stream << "<le>inf</le>";
+			}
+			stream << "<count>" << buckets[i] << "</count>";
+			stream << "</bucket>";
+		}
+		stream << "</buckets>";
+	}
+};
+
+} // namespace Passenger
+
+#endif /* _PASSENGER_LATENCY_HISTOGRAM_H_ */
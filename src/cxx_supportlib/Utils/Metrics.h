@@ -0,0 +1,255 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2015 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_METRICS_H_
+#define _PASSENGER_METRICS_H_
+
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <StaticString.h>
+#include <Utils/LatencyHistogram.h>
+
+namespace Passenger {
+
+using namespace std;
+
+
+/**
+ * A monotonically increasing counter that can be read by any thread
+ * without locking, while it is being updated.
+ *
+ * A counter must only be updated by one thread at a time: either by the
+ * thread that owns it (for example a RequestHandler's event loop thread),
+ * or while holding the lock that protects the data it describes. Under that
+ * rule, incrementing is a relaxed load and store instead of an atomic
+ * read-modify-write, which costs no more than incrementing a plain integer.
+ */
+class MetricCounter {
+private:
+	boost::atomic<boost::uint64_t> value;
+
+public:
+	MetricCounter()
+		: value(0)
+		{ }
+
+	void inc(boost::uint64_t amount = 1) {
+		value.store(value.load(boost::memory_order_relaxed) + amount,
+			boost::memory_order_relaxed);
+	}
+
+	boost::uint64_t get() const {
+		return value.load(boost::memory_order_relaxed);
+	}
+};
+
+/**
+ * A LatencyHistogram with the same updating and reading rules as
+ * MetricCounter. Readers obtain the samples with `collect()`. Because
+ * buckets are read one by one, the result may be off by the samples that
+ * were added during collection, but the count always equals the sum of the
+ * bucket counts.
+ */
+class MetricHistogram {
+private:
+	boost::atomic<boost::uint64_t> buckets[LatencyHistogram::BUCKETS];
+	boost::atomic<boost::uint64_t> sum;
+	boost::atomic<boost::uint64_t> max;
+
+	static void inc(boost::atomic<boost::uint64_t> &value, boost::uint64_t amount) {
+		value.store(value.load(boost::memory_order_relaxed) + amount,
+			boost::memory_order_relaxed);
+	}
+
+public:
+	MetricHistogram()
+		: sum(0),
+		  max(0)
+	{
+		for (unsigned int i = 0; i < LatencyHistogram::BUCKETS; i++) {
+			buckets[i].store(0, boost::memory_order_relaxed);
+		}
+	}
+
+	void add(unsigned long long usec) {
+		unsigned int i = 0;
+		while (i < LatencyHistogram::BUCKETS - 1
+		 && usec > LatencyHistogram::getBucketUpperBound(i))
+		{
+			i++;
+		}
+		inc(buckets[i], 1);
+		inc(sum, usec);
+		if (usec > max.load(boost::memory_order_relaxed)) {
+			max.store(usec, boost::memory_order_relaxed);
+		}
+	}
+
+	/** Adds the samples in this histogram to `result`. */
+	void collect(LatencyHistogram &result) const {
+		for (unsigned int i = 0; i < LatencyHistogram::BUCKETS; i++) {
+			boost::uint64_t count = buckets[i].load(boost::memory_order_relaxed);
+			result.buckets[i] += count;
+			result.count += count;
+		}
+		result.sum += sum.load(boost::memory_order_relaxed);
+		result.max = std::max<unsigned long long>(result.max,
+			max.load(boost::memory_order_relaxed));
+	}
+};
+
+
+/**
+ * Formats metrics in the OpenMetrics text format
+ * (https://openmetrics.io), which Prometheus can scrape. Usage:
+ *
+ *   OpenMetricsWriter writer;
+ *   writer.declare("passenger_requests", "counter", "Requests received.");
+ *   writer.sample("passenger_requests_total", "", 123);
+ *   writer.declare("passenger_group_processes", "gauge", "Processes per group.");
+ *   writer.sample("passenger_group_processes",
+ *       OpenMetricsWriter::label("group", "/app"), 2);
+ *   string result = writer.finish();
+ *
+ * Labels are given as a preformatted string of comma-separated `label()`
+ * results. Durations are written in seconds, as the format prescribes.
+ */
+class OpenMetricsWriter {
+private:
+	stringstream stream;
+
+	void writeName(const StaticString &name, const StaticString &suffix,
+		const StaticString &labels, const StaticString &extraLabel = StaticString())
+	{
+		stream << name << suffix;
+		if (!labels.empty() || !extraLabel.empty()) {
+			stream << '{' << labels;
+			if (!labels.empty() && !extraLabel.empty()) {
+				stream << ',';
+			}
+			stream << extraLabel << '}';
+		}
+		stream << ' ';
+	}
+
+	static string formatSeconds(unsigned long long usec) {
+		stringstream result;
+		result << usec / 1000000;
+		if (usec % 1000000 != 0) {
+			string fraction;
+			result << '.' << std::setw(6) << std::setfill('0') << usec % 1000000;
+			fraction = result.str();
+			return fraction.substr(0, fraction.find_last_not_of('0') + 1);
+		}
+		return result.str();
+	}
+
+public:
+	static const char *CONTENT_TYPE() {
+		return "application/openmetrics-text; version=1.0.0; charset=utf-8";
+	}
+
+	/** Formats a label, escaping its value. */
+	static string label(const StaticString &name, const StaticString &value) {
+		string result(name.data(), name.size());
+		const char *pos = value.data();
+		const char *end = value.data() + value.size();
+
+		result.append("=\"");
+		while (pos < end) {
+			switch (*pos) {
+			case '\\':
+				result.append("\\\\");
+				break;
+			case '"':
+				result.append("\\\"");
+				break;
+			case '\n':
+				result.append("\\n");
+				break;
+			default:
+				result.append(1, *pos);
+				break;
+			}
+			pos++;
+		}
+		result.append("\"");
+		return result;
+	}
+
+	/**
+	 * Starts a metric family. All samples of a family must directly follow
+	 * its declaration. `type` is "counter", "gauge" or "histogram".
+	 */
+	void declare(const StaticString &name, const StaticString &type,
+		const StaticString &help)
+	{
+		stream << "# TYPE " << name << ' ' << type << '\n';
+		stream << "# HELP " << name << ' ' << help << '\n';
+	}
+
+	/** Writes a sample with an integer value. */
+	template<typename IntegerType>
+	void sample(const StaticString &name, const StaticString &labels,
+		IntegerType value)
+	{
+		writeName(name, StaticString(), labels);
+		stream << value << '\n';
+	}
+
+	/** Writes the buckets, count and sum of a histogram family. */
+	void histogram(const StaticString &name, const StaticString &labels,
+		const LatencyHistogram &histogram)
+	{
+		unsigned long long cumulativeCount = 0;
+
+		for (unsigned int i = 0; i < LatencyHistogram::BUCKETS - 1; i++) {
+			cumulativeCount += histogram.getBucketCount(i);
+			writeName(name, "_bucket", labels, label("le",
+				formatSeconds(LatencyHistogram::getBucketUpperBound(i))));
+			stream << cumulativeCount << '\n';
+		}
+		writeName(name, "_bucket", labels, "le=\"+Inf\"");
+		stream << histogram.getCount() << '\n';
+		writeName(name, "_count", labels);
+		stream << histogram.getCount() << '\n';
+		writeName(name, "_sum", labels);
+		stream << formatSeconds(histogram.getSum()) << '\n';
+	}
+
+	/** Terminates the output and returns it. */
+	string finish() {
+		stream << "# EOF\n";
+		return stream.str();
+	}
+};
+
+
+} // namespace Passenger
+
+#endif /* _PASSENGER_METRICS_H_ */
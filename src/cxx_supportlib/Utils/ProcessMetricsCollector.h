@@ -29,10 +29,12 @@
 #include <boost/cstdint.hpp>
 #include <boost/thread.hpp>
 #include <boost/bind.hpp>
+#include <boost/noncopyable.hpp>
 #include <oxt/system_calls.hpp>
 #include <string>
 #include <vector>
 #include <map>
+#include <algorithm>
 
 #ifdef __APPLE__
 	#include <mach/mach_traps.h>
@@ -48,6 +50,12 @@
 	#include <set>
 #endif
 
+#ifdef __linux__
+	#define PROCESS_METRICS_COLLECTOR_SUPPORTS_PROCFS
+	#include <fcntl.h>
+	#include <cstdio>
+#endif
+
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/time.h>
@@ -189,12 +197,403 @@ public:
 /**
  * Utility class for collection metrics on processes, such as CPU usage, memory usage,
  * command name, etc.
+ *
+ * On Linux, metrics are read directly from /proc instead of by running 'ps'.
+ * The /proc files of each PID are kept open between collect() calls and are
+ * reread with pread() into a reusable buffer, so keep the collector object
+ * around if you collect metrics periodically. File descriptors of PIDs that
+ * were not part of the last collect() call are closed.
+ *
+ * This class is not thread-safe.
  */
-class ProcessMetricsCollector {
+class ProcessMetricsCollector: public boost::noncopyable {
 private:
 	bool canMeasureRealMemory;
 	string psOutput;
 
+	#ifdef PROCESS_METRICS_COLLECTOR_SUPPORTS_PROCFS
+		struct ProcFiles {
+			int stat;
+			int statm;
+			int status;
+			int cmdline;
+			/** Either smaps_rollup or, on kernels older than 4.14, smaps. */
+			int memory;
+			unsigned int generation;
+
+			ProcFiles()
+				: stat(-1),
+				  statm(-1),
+				  status(-1),
+				  cmdline(-1),
+				  memory(-1),
+				  generation(0)
+				{ }
+		};
+
+		typedef map<pid_t, ProcFiles> ProcFilesMap;
+
+		bool useProcfs;
+		bool hasSmapsRollup;
+		ProcFilesMap procFiles;
+		int uptimeFd;
+		unsigned int generation;
+		long clockTicks;
+		long pageSizeKb;
+		char *buffer;
+		size_t bufferSize;
+
+		static int openProcFile(pid_t pid, const char *name) {
+			char path[64];
+			int fd;
+
+			snprintf(path, sizeof(path), "/proc/%d/%s", (int) pid, name);
+			do {
+				fd = open(path, O_RDONLY | O_CLOEXEC);
+			} while (fd == -1 && errno == EINTR);
+			return fd;
+		}
+
+		static void closeFd(int &fd) {
+			if (fd != -1) {
+				this_thread::disable_syscall_interruption dsi;
+				syscalls::close(fd);
+				fd = -1;
+			}
+		}
+
+		static void closeProcFiles(ProcFiles &files) {
+			closeFd(files.stat);
+			closeFd(files.statm);
+			closeFd(files.status);
+			closeFd(files.cmdline);
+			closeFd(files.memory);
+		}
+
+		/**
+		 * Reads the entire file (up to the buffer size) from offset 0 into
+		 * `buffer` and NUL-terminates it. Returns the number of bytes read,
+		 * or -1 on error.
+		 */
+		ssize_t preadSmallFile(int fd) {
+			size_t total = 0;
+			ssize_t ret;
+
+			while (total < bufferSize - 1) {
+				do {
+					ret = ::pread(fd, buffer + total, bufferSize - 1 - total, total);
+				} while (ret == -1 && errno == EINTR);
+				if (ret == -1) {
+					return -1;
+				} else if (ret == 0) {
+					break;
+				}
+				total += ret;
+			}
+			buffer[total] = '\0';
+			return total;
+		}
+
+		static const char *skipFields(const char *pos, const char *end, unsigned int n) {
+			while (n > 0 && pos < end) {
+				while (pos < end && *pos == ' ') {
+					pos++;
+				}
+				while (pos < end && *pos != ' ') {
+					pos++;
+				}
+				n--;
+			}
+			while (pos < end && *pos == ' ') {
+				pos++;
+			}
+			return pos;
+		}
+
+		static long long parseLongLong(const char **pos, const char *end) {
+			const char *p = *pos;
+			long long result = 0;
+			bool negative = false;
+
+			while (p < end && (*p == ' ' || *p == '\t')) {
+				p++;
+			}
+			if (p < end && *p == '-') {
+				negative = true;
+				p++;
+			}
+			while (p < end && *p >= '0' && *p <= '9') {
+				result = result * 10 + (*p - '0');
+				p++;
+			}
+			*pos = p;
+			return negative ? -result : result;
+		}
+
+		bool readUptime(double &uptime) {
+			if (uptimeFd == -1) {
+				do {
+					uptimeFd = open("/proc/uptime", O_RDONLY | O_CLOEXEC);
+				} while (uptimeFd == -1 && errno == EINTR);
+				if (uptimeFd == -1) {
+					return false;
+				}
+			}
+			if (preadSmallFile(uptimeFd) <= 0) {
+				return false;
+			}
+			uptime = strtod(buffer, NULL);
+			return true;
+		}
+
+		/**
+		 * Parses /proc/<pid>/stat. The command name field may contain
+		 * spaces and parentheses, so we look for the last ')'.
+		 */
+		bool readStat(ProcFiles &files, double uptime, ProcessMetrics &metrics, string &comm) {
+			ssize_t size = preadSmallFile(files.stat);
+			if (size <= 0) {
+				return false;
+			}
+
+			const char *end = buffer + size;
+			const char *commBegin = (const char *) memchr(buffer, '(', size);
+			const char *commEnd = (const char *) memrchr(buffer, ')', size);
+			if (commBegin == NULL || commEnd == NULL || commEnd < commBegin) {
+				return false;
+			}
+			comm.assign(commBegin + 1, commEnd - commBegin - 1);
+
+			// Field 3 (state) follows the command name.
+			const char *pos = skipFields(commEnd + 1, end, 1);
+			metrics.ppid = (pid_t) parseLongLong(&pos, end);
+			metrics.processGroupId = (pid_t) parseLongLong(&pos, end);
+			// Skip session, tty_nr, tpgid, flags, minflt, cminflt, majflt, cmajflt.
+			pos = skipFields(pos, end, 8);
+			long long utime = parseLongLong(&pos, end);
+			long long stime = parseLongLong(&pos, end);
+			// Skip cutime, cstime, priority, nice, num_threads, itrealvalue.
+			pos = skipFields(pos, end, 6);
+			long long startTime = parseLongLong(&pos, end);
+
+			// Same definition as ps's %cpu: CPU time used divided by
+			// the time the process has been running.
+			double elapsed = uptime - (double) startTime / clockTicks;
+			if (elapsed > 0) {
+				double cpu = (double) (utime + stime) / clockTicks / elapsed * 100;
+				metrics.cpu = (boost::uint8_t) std::min<double>(cpu, 255);
+			} else {
+				metrics.cpu = 0;
+			}
+			return true;
+		}
+
+		bool readStatm(ProcFiles &files, ProcessMetrics &metrics) {
+			ssize_t size = preadSmallFile(files.statm);
+			if (size <= 0) {
+				return false;
+			}
+
+			const char *pos = buffer;
+			const char *end = buffer + size;
+			metrics.vmsize = parseLongLong(&pos, end) * pageSizeKb;
+			metrics.rss = parseLongLong(&pos, end) * pageSizeKb;
+			return true;
+		}
+
+		bool readEffectiveUid(ProcFiles &files, ProcessMetrics &metrics) {
+			ssize_t size = preadSmallFile(files.status);
+			if (size <= 0) {
+				return false;
+			}
+
+			// Format: "Uid:\t<real>\t<effective>\t<saved>\t<fs>"
+			const char *end = buffer + size;
+			const char *pos = (const char *) memmem(buffer, size, "\nUid:", 5);
+			if (pos == NULL) {
+				return false;
+			}
+			pos += 5;
+			parseLongLong(&pos, end);
+			metrics.uid = (uid_t) parseLongLong(&pos, end);
+			return true;
+		}
+
+		void readCommand(ProcFiles &files, ProcessMetrics &metrics, const string &comm) {
+			ssize_t size = preadSmallFile(files.cmdline);
+
+			while (size > 0 && buffer[size - 1] == '\0') {
+				size--;
+			}
+			if (size <= 0) {
+				// Kernel threads and zombies have no command line.
+				metrics.command = "[" + comm + "]";
+				return;
+			}
+			for (ssize_t i = 0; i < size; i++) {
+				if (buffer[i] == '\0') {
+					buffer[i] = ' ';
+				}
+			}
+			metrics.command.assign(buffer, size);
+		}
+
+		/**
+		 * Sums the Pss, Private_Dirty and Swap lines in smaps_rollup or smaps.
+		 * smaps can be several megabytes, so we scan it in buffer-sized chunks.
+		 */
+		bool readMemory(ProcFiles &files, ProcessMetrics &metrics) {
+			bool hasPss = false;
+			bool hasPrivateDirty = false;
+			bool hasSwap = false;
+			ssize_t pss = 0, privateDirty = 0, swap = 0;
+			off_t offset = 0;
+			size_t carry = 0;
+			bool eof = false;
+
+			while (!eof) {
+				ssize_t ret;
+				do {
+					ret = ::pread(files.memory, buffer + carry, bufferSize - 1 - carry, offset);
+				} while (ret == -1 && errno == EINTR);
+				if (ret == -1) {
+					return false;
+				} else if (ret == 0) {
+					eof = true;
+					if (carry == 0) {
+						break;
+					}
+					buffer[carry++] = '\n';
+				} else {
+					offset += ret;
+					carry += ret;
+				}
+
+				const char *pos = buffer;
+				const char *end = buffer + carry;
+				const char *newline;
+				while ((newline = (const char *) memchr(pos, '\n', end - pos)) != NULL) {
+					ssize_t *target = NULL;
+					const char *value = NULL;
+
+					if (newline - pos > 4 && memcmp(pos, "Pss:", 4) == 0) {
+						target = &pss;
+						hasPss = true;
+						value = pos + 4;
+					} else if (newline - pos > 14 && memcmp(pos, "Private_Dirty:", 14) == 0) {
+						target = &privateDirty;
+						hasPrivateDirty = true;
+						value = pos + 14;
+					} else if (newline - pos > 5 && memcmp(pos, "Swap:", 5) == 0) {
+						target = &swap;
+						hasSwap = true;
+						value = pos + 5;
+					}
+					if (target != NULL) {
+						*target += (ssize_t) parseLongLong(&value, newline);
+						if (newline - value < 3 || memcmp(value, " kB", 3) != 0) {
+							return false;
+						}
+					}
+					pos = newline + 1;
+				}
+
+				// Move the incomplete last line to the beginning of the buffer.
+				carry = end - pos;
+				if (carry == bufferSize - 1) {
+					// Absurdly long line; not one we're interested in.
+					carry = 0;
+				} else if (carry > 0) {
+					memmove(buffer, pos, carry);
+				}
+			}
+
+			metrics.pss = hasPss ? pss : -1;
+			metrics.privateDirty = hasPrivateDirty ? privateDirty : -1;
+			metrics.swap = hasSwap ? swap : -1;
+			return true;
+		}
+
+		bool openProcFiles(pid_t pid, ProcFiles &files) {
+			files.stat = openProcFile(pid, "stat");
+			if (files.stat == -1) {
+				return false;
+			}
+			files.statm = openProcFile(pid, "statm");
+			files.status = openProcFile(pid, "status");
+			files.cmdline = openProcFile(pid, "cmdline");
+			if (canMeasureRealMemory) {
+				files.memory = openProcFile(pid, hasSmapsRollup ? "smaps_rollup" : "smaps");
+				if (files.memory == -1 && errno == ENOENT) {
+					// The process exited after we opened its other files.
+					return false;
+				}
+			}
+			return files.statm != -1 && files.status != -1 && files.cmdline != -1;
+		}
+
+		template<typename Collection, typename ConstIterator>
+		ProcessMetricMap collectFromProcfs(const Collection &pids) {
+			ProcessMetricMap result;
+			ConstIterator it, end = pids.end();
+			double uptime;
+			string comm;
+
+			if (!readUptime(uptime)) {
+				throw RuntimeException("Cannot read /proc/uptime");
+			}
+
+			generation++;
+			for (it = pids.begin(); it != end; it++) {
+				pid_t pid = *it;
+				ProcFilesMap::iterator f_it = procFiles.find(pid);
+				if (f_it == procFiles.end()) {
+					f_it = procFiles.insert(make_pair(pid, ProcFiles())).first;
+					if (!openProcFiles(pid, f_it->second)) {
+						closeProcFiles(f_it->second);
+						procFiles.erase(f_it);
+						continue;
+					}
+				}
+
+				ProcFiles &files = f_it->second;
+				ProcessMetrics metrics;
+				files.generation = generation;
+				metrics.pid = pid;
+				// If the process has exited, reading its cached /proc files
+				// fails with ESRCH, even if the PID has been reused since.
+				if (!readStat(files, uptime, metrics, comm)
+				 || !readStatm(files, metrics)
+				 || !readEffectiveUid(files, metrics))
+				{
+					closeProcFiles(files);
+					procFiles.erase(f_it);
+					continue;
+				}
+				readCommand(files, metrics, comm);
+				if (files.memory == -1 || !readMemory(files, metrics)) {
+					metrics.pss = -1;
+					metrics.privateDirty = -1;
+					metrics.swap = -1;
+				}
+				result[pid] = metrics;
+			}
+
+			// Close the files of PIDs that we're no longer interested in.
+			ProcFilesMap::iterator f_it = procFiles.begin();
+			while (f_it != procFiles.end()) {
+				if (f_it->second.generation != generation) {
+					closeProcFiles(f_it->second);
+					procFiles.erase(f_it++);
+				} else {
+					f_it++;
+				}
+			}
+
+			return result;
+		}
+	#endif
+
 	template<typename Collection, typename ConstIterator>
 	ProcessMetricMap parsePsOutput(const string &output, const Collection &allowedPids) const {
 		ProcessMetricMap result;
@@ -256,13 +655,49 @@ public:
 		#else
 			canMeasureRealMemory = fileExists("/proc/self/smaps");
 		#endif
+		#ifdef PROCESS_METRICS_COLLECTOR_SUPPORTS_PROCFS
+			useProcfs = fileExists("/proc/self/stat");
+			// smaps_rollup exists since Linux 4.14. Probing it once here means
+			// that a process exiting mid-collection can't turn it off.
+			hasSmapsRollup = fileExists("/proc/self/smaps_rollup");
+			uptimeFd = -1;
+			generation = 0;
+			clockTicks = sysconf(_SC_CLK_TCK);
+			pageSizeKb = sysconf(_SC_PAGESIZE) / 1024;
+			bufferSize = 1024 * 16;
+			buffer = (char *) malloc(bufferSize);
+			if (buffer == NULL) {
+				throw std::bad_alloc();
+			}
+		#endif
 	}
 
-	/** Mock 'ps' output, used by unit tests. */
+	~ProcessMetricsCollector() {
+		#ifdef PROCESS_METRICS_COLLECTOR_SUPPORTS_PROCFS
+			ProcFilesMap::iterator it, end = procFiles.end();
+			for (it = procFiles.begin(); it != end; it++) {
+				closeProcFiles(it->second);
+			}
+			closeFd(uptimeFd);
+			free(buffer);
+		#endif
+	}
+
+	/** Mock 'ps' output, used by unit tests. Implies that /proc is not used. */
 	void setPsOutput(const string &data) {
 		this->psOutput = data;
 	}
 
+	/**
+	 * Whether to read metrics from /proc (the default where supported),
+	 * or to run 'ps'. Used by unit tests and benchmarks.
+	 */
+	void setUseProcfs(bool value) {
+		#ifdef PROCESS_METRICS_COLLECTOR_SUPPORTS_PROCFS
+			useProcfs = value && fileExists("/proc/self/stat");
+		#endif
+	}
+
 	/**
 	 * Collect metrics for the given process IDs. Nonexistant PIDs are not
 	 * included in the result.
@@ -274,11 +709,17 @@ public:
 	 * @throws RuntimeException
 	 */
 	template<typename Collection, typename ConstIterator>
-	ProcessMetricMap collect(const Collection &pids) const {
+	ProcessMetricMap collect(const Collection &pids) {
 		if (pids.empty()) {
 			return ProcessMetricMap();
 		}
 
+		#ifdef PROCESS_METRICS_COLLECTOR_SUPPORTS_PROCFS
+			if (useProcfs && psOutput.empty()) {
+				return collectFromProcfs<Collection, ConstIterator>(pids);
+			}
+		#endif
+
 		ConstIterator it;
 		// The list of PIDs must follow -p without a space.
 		// https://groups.google.com/forum/#!topic/phusion-passenger/WKXy61nJBMA
@@ -329,7 +770,7 @@ public:
 		return result;
 	}
 
-	ProcessMetricMap collect(const vector<pid_t> &pids) const {
+	ProcessMetricMap collect(const vector<pid_t> &pids) {
 		return collect< vector<pid_t>, vector<pid_t>::const_iterator >(pids);
 	}
 
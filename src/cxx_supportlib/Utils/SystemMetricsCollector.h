@@ -29,6 +29,7 @@
 #include <boost/cstdint.hpp>
 #include <boost/thread.hpp>
 #include <boost/typeof/typeof.hpp>
+#include <boost/noncopyable.hpp>
 #include <ostream>
 #include <iomanip>
 #include <algorithm>
@@ -44,9 +45,10 @@
 #include <sys/utsname.h>
 #ifdef __linux__
 	#include <sys/sysinfo.h>
+	#include <fcntl.h>
+	#include <cerrno>
+	#include <cstring>
 	#include <Exceptions.h>
-	#include <Utils/StringScanning.h>
-	#include <Utils/IOUtils.h>
 #endif
 #ifdef __APPLE__
 	#include <mach/mach.h>
@@ -104,12 +106,14 @@ public:
 		bool general;
 		bool cpu;
 		bool memory;
+		bool pressure;
 		bool colors;
 
 		DescriptionOptions()
 			: general(true),
 			  cpu(true),
 			  memory(true),
+			  pressure(true),
 			  colors(false)
 			{ }
 	};
@@ -118,11 +122,13 @@ public:
 		bool general;
 		bool cpu;
 		bool memory;
+		bool pressure;
 
 		XmlOptions()
 			: general(true),
 			  cpu(true),
-			  memory(true)
+			  memory(true),
+			  pressure(true)
 			{ }
 	};
 
@@ -319,6 +325,40 @@ public:
 		}
 	};
 
+	/**
+	 * Pressure stall information (PSI) for a single resource. Only
+	 * supported on Linux >= 4.20.
+	 *
+	 * `some` is the percentage (0..100) of wall time in which at least one
+	 * task was stalled on the resource, `full` the percentage of wall time
+	 * in which all non-idle tasks were stalled simultaneously. Both are
+	 * averaged over the past 10 seconds, 60 seconds and 5 minutes. The
+	 * totals are the accumulated stall times in microseconds.
+	 *
+	 * The averages are -1 if an error occurred while querying them,
+	 * or -2 if the OS doesn't support them.
+	 */
+	struct PressureStall {
+		double some[3];
+		double full[3];
+		unsigned long long someTotal;
+		unsigned long long fullTotal;
+
+		explicit PressureStall(double value = -2)
+			: someTotal(0),
+			  fullTotal(0)
+		{
+			for (int i = 0; i < 3; i++) {
+				some[i] = value;
+				full[i] = value;
+			}
+		}
+
+		bool supported() const {
+			return some[0] != -2;
+		}
+	};
+
 	/** Per-core CPU usage. This collection is empty if the number of cores
 	 * cannot be queried.
 	 */
@@ -360,6 +400,9 @@ public:
 	 */
 	double swapInRate, swapOutRate;
 
+	/** Pressure stall information for the CPU, memory and I/O. */
+	PressureStall cpuPressure, memoryPressure, ioPressure;
+
 	/** Kernel version number, or the empty string if this information cannot be queried. */
 	string kernelVersion;
 
@@ -690,6 +733,16 @@ public:
 
 			stream << endl;
 		}
+
+		if (options.pressure && (cpuPressure.supported()
+			|| memoryPressure.supported() || ioPressure.supported()))
+		{
+			outputHeader(stream, options, "Pressure stall (10 sec, 60 sec, 5 min)");
+			describePressure(stream, options, "CPU", cpuPressure);
+			describePressure(stream, options, "Memory", memoryPressure);
+			describePressure(stream, options, "I/O", ioPressure);
+			stream << endl;
+		}
 	}
 
 	void toXml(ostream &stream, const XmlOptions &options = XmlOptions()) const {
@@ -767,8 +820,54 @@ public:
 			stream << "</memory_metrics>";
 		}
 
+		if (options.pressure) {
+			stream << "<pressure_stall>";
+			pressureToXml(stream, "cpu", cpuPressure);
+			pressureToXml(stream, "memory", memoryPressure);
+			pressureToXml(stream, "io", ioPressure);
+			stream << "</pressure_stall>";
+		}
+
 		stream << "</system_metrics>";
 	}
+
+private:
+	void describePressure(ostream &stream, const DescriptionOptions &options,
+		const char *label, const PressureStall &pressure) const
+	{
+		char buf[32];
+
+		snprintf(buf, sizeof(buf), "%-18s: ", label);
+		stream << buf << "some ";
+		for (int i = 0; i < 3; i++) {
+			stream << formatPercent2(options, pressure.some[i], 7, 10);
+		}
+		stream << "  -- full ";
+		for (int i = 0; i < 3; i++) {
+			stream << formatPercent2(options, pressure.full[i], 7, 5);
+		}
+		stream << endl;
+	}
+
+	void pressureAveragesToXml(ostream &stream, const double *averages,
+		unsigned long long total) const
+	{
+		stream << "<avg10>" << averages[0] << "</avg10>";
+		stream << "<avg60>" << averages[1] << "</avg60>";
+		stream << "<avg300>" << averages[2] << "</avg300>";
+		stream << "<total>" << total << "</total>";
+	}
+
+	void pressureToXml(ostream &stream, const char *name, const PressureStall &pressure) const {
+		stream << "<" << name << ">";
+		stream << "<some>";
+		pressureAveragesToXml(stream, pressure.some, pressure.someTotal);
+		stream << "</some>";
+		stream << "<full>";
+		pressureAveragesToXml(stream, pressure.full, pressure.fullTotal);
+		stream << "</full>";
+		stream << "</" << name << ">";
+	}
 };
 
 /**
@@ -789,7 +888,7 @@ public:
  * beginning and end of a time interval. The metrics object remembers the
  * number of CPU ticks that was queried last time.
  */
-class SystemMetricsCollector {
+class SystemMetricsCollector: public boost::noncopyable {
 private:
 	#if defined(__linux__) || defined(__APPLE__) || defined(__FreeBSD__)
 		int pageSize;
@@ -902,57 +1001,215 @@ private:
 	#endif
 
 	#ifdef __linux__
-		void readNextWordAndAssertEqual(const char **data, const StaticString &expected) const {
-			if (readNextWord(data) != expected) {
-				throw ParseException();
+		/**
+		 * A file in /proc that is kept open between collections. Its
+		 * contents are re-read with pread() so that taking a sample
+		 * does not involve any open()/close() calls.
+		 */
+		struct ProcFile {
+			const char *path;
+			int fd;
+			/** Set if the file does not exist, e.g. because the kernel
+			 * is too old to provide it. We won't try to open it again.
+			 */
+			bool unsupported;
+
+			ProcFile(const char *_path)
+				: path(_path),
+				  fd(-1),
+				  unsupported(false)
+				{ }
+		};
+
+		/**
+		 * Minimal scanner over the contents of a /proc file. Unlike the
+		 * functions in StringScanning.h it does not throw exceptions and does
+		 * not require the data to be NUL-terminated.
+		 */
+		struct ProcScanner {
+			const char *pos;
+			const char *end;
+
+			ProcScanner(const StaticString &data)
+				: pos(data.data()),
+				  end(data.data() + data.size())
+				{ }
+
+			bool atEnd() const {
+				return pos >= end;
+			}
+
+			void skipSpaces() {
+				while (pos < end && (*pos == ' ' || *pos == '\t')) {
+					pos++;
+				}
+			}
+
+			/** Skips to the beginning of the next line. Returns whether there is one. */
+			bool nextLine() {
+				const char *newline = (const char *) memchr(pos, '\n', end - pos);
+				if (newline == NULL) {
+					pos = end;
+				} else {
+					pos = newline + 1;
+				}
+				return pos < end;
+			}
+
+			bool readWord(StaticString &word) {
+				skipSpaces();
+				const char *start = pos;
+				while (pos < end && *pos != ' ' && *pos != '\t' && *pos != '\n') {
+					pos++;
+				}
+				word = StaticString(start, pos - start);
+				return pos > start;
+			}
+
+			/** Reads a word of the form "key=" and returns the key. */
+			bool readKey(StaticString &key) {
+				skipSpaces();
+				const char *start = pos;
+				while (pos < end && *pos != '=' && *pos != ' ' && *pos != '\n') {
+					pos++;
+				}
+				if (pos < end && *pos == '=' && pos > start) {
+					key = StaticString(start, pos - start);
+					pos++;
+					return true;
+				} else {
+					return false;
+				}
+			}
+
+			bool readNumber(unsigned long long &value) {
+				skipSpaces();
+				if (pos >= end || *pos < '0' || *pos > '9') {
+					return false;
+				}
+				value = 0;
+				while (pos < end && *pos >= '0' && *pos <= '9') {
+					value = value * 10 + (*pos - '0');
+					pos++;
+				}
+				return true;
+			}
+
+			bool readDecimal(double &value) {
+				unsigned long long integral;
+				if (!readNumber(integral)) {
+					return false;
+				}
+				value = (double) integral;
+				if (pos < end && *pos == '.') {
+					double scale = 0.1;
+					pos++;
+					while (pos < end && *pos >= '0' && *pos <= '9') {
+						value += (*pos - '0') * scale;
+						scale /= 10;
+						pos++;
+					}
+				}
+				return true;
+			}
+		};
+
+		ProcFile meminfoFile, statFile, vmstatFile;
+		ProcFile cpuPressureFile, memoryPressureFile, ioPressureFile;
+		/** Buffer that /proc files are read into. Grows when a file
+		 * doesn't fit, but is never shrunk, so that after the first few
+		 * samples no more allocations take place.
+		 */
+		vector<char> buffer;
+
+		void closeProcFile(ProcFile &file) {
+			if (file.fd != -1) {
+				close(file.fd);
+				file.fd = -1;
 			}
 		}
 
-		void queryMemInfo(SystemMetrics &metrics) const {
-			string contents;
-			bool hasContents = false;
-			try {
-				contents = readAll("/proc/meminfo");
-				hasContents = true;
-			} catch (const SystemException &) {
-			}
-			if (hasContents) {
-				try {
-					parseMemInfo(metrics, contents);
-				} catch (const ParseException &) {
-					throw RuntimeException("Cannot parse information in /proc/meminfo");
+		/**
+		 * Reads the entire contents of the given /proc file into `buffer`.
+		 * Returns false if the file cannot be read.
+		 */
+		bool readProcFile(ProcFile &file, StaticString &result) {
+			if (file.unsupported) {
+				return false;
+			}
+			if (file.fd == -1) {
+				file.fd = open(file.path, O_RDONLY | O_CLOEXEC);
+				if (file.fd == -1) {
+					if (errno == ENOENT) {
+						file.unsupported = true;
+					}
+					return false;
+				}
+			}
+
+			while (true) {
+				size_t size = 0;
+				ssize_t ret;
+
+				do {
+					ret = pread(file.fd, &buffer[size], buffer.size() - size, size);
+					if (ret > 0) {
+						size += ret;
+					}
+				} while ((ret > 0 && size < buffer.size()) || (ret == -1 && errno == EINTR));
+
+				if (ret == -1) {
+					closeProcFile(file);
+					return false;
+				} else if (size == buffer.size()) {
+					// The file might not have been read completely.
+					// /proc files must be read in one go in order to get
+					// a consistent snapshot, so grow the buffer and retry.
+					buffer.resize(buffer.size() * 2);
+				} else {
+					result = StaticString(&buffer[0], size);
+					return true;
 				}
+			}
+		}
+
+		void queryMemInfo(SystemMetrics &metrics) {
+			StaticString contents;
+			if (readProcFile(meminfoFile, contents)) {
+				parseMemInfo(metrics, contents);
 			} else {
 				metrics.ramTotal = metrics.ramUsed = -1;
 				metrics.swapTotal = metrics.swapUsed = -1;
 			}
 		}
 
-		void parseMemInfo(SystemMetrics &metrics, const string &data) const {
-			const char *start = data.c_str();
+		void parseMemInfo(SystemMetrics &metrics, const StaticString &data) const {
+			ProcScanner scanner(data);
 			long long memTotal = -1, memFree = -1, buffers = -1, cached = -1;
 			long long swapTotal = -1, swapFree = -1;
+			StaticString name;
+			unsigned long long value;
 
-			while (start != NULL) {
-				StaticString name = readNextWord(&start);
-				long long value = readNextWordAsLongLong(&start);
-				if (!skipToNextLine(&start) || *start == '\0') {
-					start = NULL;
+			while (!scanner.atEnd()) {
+				if (!scanner.readWord(name) || !scanner.readNumber(value)) {
+					throw RuntimeException("Cannot parse information in /proc/meminfo");
 				}
 
-				if (name == "MemTotal:") {
+				if (name == P_STATIC_STRING("MemTotal:")) {
 					memTotal = value;
-				} else if (name == "MemFree:") {
+				} else if (name == P_STATIC_STRING("MemFree:")) {
 					memFree = value;
-				} else if (name == "Buffers:") {
+				} else if (name == P_STATIC_STRING("Buffers:")) {
 					buffers = value;
-				} else if (name == "Cached:") {
+				} else if (name == P_STATIC_STRING("Cached:")) {
 					cached = value;
-				} else if (name == "SwapTotal:") {
+				} else if (name == P_STATIC_STRING("SwapTotal:")) {
 					swapTotal = value;
-				} else if (name == "SwapFree:") {
+				} else if (name == P_STATIC_STRING("SwapFree:")) {
 					swapFree = value;
 				}
+
+				scanner.nextLine();
 			}
 
 			if (memTotal != -1) {
@@ -983,55 +1240,59 @@ private:
 			}
 		}
 
-		void queryProcStat(SystemMetrics &metrics) const {
-			string contents;
-			bool hasContents = false;
-			try {
-				contents = readAll("/proc/stat");
-				hasContents = true;
-			} catch (const SystemException &) {
-			}
-			if (hasContents) {
-				try {
-					parseProcStat(metrics, contents);
-				} catch (const ParseException &) {
-					throw RuntimeException("Cannot parse information in /proc/stat");
-				}
+		void queryProcStat(SystemMetrics &metrics) {
+			StaticString contents;
+			if (readProcFile(statFile, contents)) {
+				parseProcStat(metrics, contents);
 			} else {
 				failReadingCpuUsages(metrics);
+				metrics.forkRate = -1;
 			}
 		}
 
-		void parseProcStat(SystemMetrics &metrics, const string &data) const {
-			const char *start = data.c_str();
+		void parseProcStat(SystemMetrics &metrics, const StaticString &data) const {
+			ProcScanner scanner(data);
 			unsigned long long forkCount = 0;
+			StaticString name;
 
-			while (start != NULL) {
-				if (*start == '\n') {
-					// Empty line. Skip to next line.
-					start++;
+			while (!scanner.atEnd()) {
+				if (!scanner.readWord(name)) {
+					// Empty line.
+					scanner.nextLine();
 					continue;
 				}
 
-				StaticString name = readNextWord(&start);
-
-				if (name.size() > 3 && startsWith(name, "cpu")) {
-					const char *numStart = name.data() + 3;
-					unsigned long num = strtoul(numStart, NULL, 10);
-
-					long long user = readNextWordAsLongLong(&start);
-					long long nice = readNextWordAsLongLong(&start);
-					long long sys  = readNextWordAsLongLong(&start);
-					long long idle = readNextWordAsLongLong(&start);
-					long long iowait = readNextWordAsLongLong(&start);
-					readNextWordAsLongLong(&start); // irq
-					readNextWordAsLongLong(&start); // softirq
-					long long steal;
-					try {
-						steal = readNextWordAsLongLong(&start);
-					} catch (const ParseException &) {
-						// Not supported on Linux < 2.6.11
-						steal = -2;
+				// "cpu" is the sum of all CPUs; we're only interested
+				// in the per-CPU lines "cpu0", "cpu1", etc.
+				if (name.size() > 3 && startsWith(name, P_STATIC_STRING("cpu"))) {
+					unsigned long long num = 0;
+					unsigned long long user, nice, sys, idle, iowait, irq, softirq, steal;
+					long long iowaitResult, stealResult;
+					ProcScanner numScanner(name.substr(3));
+
+					if (!numScanner.readNumber(num)
+					 || !scanner.readNumber(user)
+					 || !scanner.readNumber(nice)
+					 || !scanner.readNumber(sys)
+					 || !scanner.readNumber(idle))
+					{
+						throw RuntimeException("Cannot parse information in /proc/stat");
+					}
+					// iowait is not supported on Linux < 2.5.41,
+					// steal not on Linux < 2.6.11.
+					if (scanner.readNumber(iowait)) {
+						iowaitResult = iowait;
+					} else {
+						iowaitResult = -2;
+					}
+					if (iowaitResult >= 0
+					 && scanner.readNumber(irq)
+					 && scanner.readNumber(softirq)
+					 && scanner.readNumber(steal))
+					{
+						stealResult = steal;
+					} else {
+						stealResult = -2;
 					}
 
 					if (num + 1 > metrics.cpuUsages.size()) {
@@ -1042,16 +1303,16 @@ private:
 						user,
 						nice,
 						sys,
-						iowait,
+						iowaitResult,
 						idle,
-						steal);
-				} else if (name == "processes") {
-					forkCount = (long long) readNextWordAsLongLong(&start);
+						stealResult);
+				} else if (name == P_STATIC_STRING("processes")) {
+					scanner.readNumber(forkCount);
 				}
 
-				if (!skipToNextLine(&start) || *start == '\0') {
-					start = NULL;
-				}
+				// Note that this skips the very long "intr" line
+				// with a single memchr().
+				scanner.nextLine();
 			}
 
 			if (forkCount == 0) {
@@ -1062,42 +1323,34 @@ private:
 			}
 		}
 
-		void queryProcVmstat(SystemMetrics &metrics) const {
-			string contents;
-			bool hasContents = false;
-			try {
-				contents = readAll("/proc/vmstat");
-				hasContents = true;
-			} catch (const SystemException &) {
-			}
-			if (hasContents) {
-				try {
-					parseProcVmstat(metrics, contents);
-				} catch (const ParseException &) {
-					throw RuntimeException("Cannot parse information in /proc/vmstat");
-				}
+		void queryProcVmstat(SystemMetrics &metrics) {
+			StaticString contents;
+			if (readProcFile(vmstatFile, contents)) {
+				parseProcVmstat(metrics, contents);
 			} else {
-				failReadingCpuUsages(metrics);
+				metrics.swapInRate = -1;
+				metrics.swapOutRate = -1;
 			}
 		}
 
-		void parseProcVmstat(SystemMetrics &metrics, const string &data) const {
-			const char *start = data.c_str();
+		void parseProcVmstat(SystemMetrics &metrics, const StaticString &data) const {
+			ProcScanner scanner(data);
 			long long pswpin = -1, pswpout = -1;
+			StaticString name;
+			unsigned long long value;
 
-			while (start != NULL) {
-				StaticString name = readNextWord(&start);
-				long long value = readNextWordAsLongLong(&start);
-
-				if (!skipToNextLine(&start) || *start == '\0') {
-					start = NULL;
+			while (!scanner.atEnd()) {
+				if (!scanner.readWord(name) || !scanner.readNumber(value)) {
+					throw RuntimeException("Cannot parse information in /proc/vmstat");
 				}
 
-				if (name == "pswpin") {
+				if (name == P_STATIC_STRING("pswpin")) {
 					pswpin = value;
-				} else if (name == "pswpout") {
+				} else if (name == P_STATIC_STRING("pswpout")) {
 					pswpout = value;
 				}
+
+				scanner.nextLine();
 			}
 
 			if (pswpin == -1 || pswpout == -1) {
@@ -1111,6 +1364,74 @@ private:
 			}
 		}
 
+		void queryPressure(ProcFile &file, SystemMetrics::PressureStall &pressure) {
+			StaticString contents;
+			if (readProcFile(file, contents)) {
+				parsePressure(file, pressure, contents);
+			} else if (file.unsupported) {
+				pressure = SystemMetrics::PressureStall(-2);
+			} else {
+				pressure = SystemMetrics::PressureStall(-1);
+			}
+		}
+
+		/**
+		 * Parses the contents of a file in /proc/pressure:
+		 *
+		 *     some avg10=0.00 avg60=0.00 avg300=0.00 total=0
+		 *     full avg10=0.00 avg60=0.00 avg300=0.00 total=0
+		 *
+		 * The "full" line is absent for the CPU on Linux < 5.13.
+		 */
+		void parsePressure(const ProcFile &file, SystemMetrics::PressureStall &pressure,
+			const StaticString &data) const
+		{
+			ProcScanner scanner(data);
+			StaticString kind, key;
+
+			pressure = SystemMetrics::PressureStall(-2);
+			while (!scanner.atEnd()) {
+				double *averages;
+				unsigned long long *total;
+
+				if (!scanner.readWord(kind)) {
+					scanner.nextLine();
+					continue;
+				} else if (kind == P_STATIC_STRING("some")) {
+					averages = pressure.some;
+					total = &pressure.someTotal;
+				} else if (kind == P_STATIC_STRING("full")) {
+					averages = pressure.full;
+					total = &pressure.fullTotal;
+				} else {
+					scanner.nextLine();
+					continue;
+				}
+
+				while (scanner.readKey(key)) {
+					bool ok;
+					if (key == P_STATIC_STRING("avg10")) {
+						ok = scanner.readDecimal(averages[0]);
+					} else if (key == P_STATIC_STRING("avg60")) {
+						ok = scanner.readDecimal(averages[1]);
+					} else if (key == P_STATIC_STRING("avg300")) {
+						ok = scanner.readDecimal(averages[2]);
+					} else if (key == P_STATIC_STRING("total")) {
+						ok = scanner.readNumber(*total);
+					} else {
+						StaticString ignored;
+						ok = scanner.readWord(ignored);
+					}
+					if (!ok) {
+						throw RuntimeException(string("Cannot parse information in ")
+							+ file.path);
+					}
+				}
+
+				scanner.nextLine();
+			}
+		}
+
 		void queryBoottimeFromSysinfo(SystemMetrics &metrics) const {
 			if (metrics.boottime == -1) {
 				struct sysinfo info;
@@ -1399,7 +1720,17 @@ private:
 	}
 
 public:
-	SystemMetricsCollector() {
+	SystemMetricsCollector()
+		#ifdef __linux__
+			: meminfoFile("/proc/meminfo"),
+			  statFile("/proc/stat"),
+			  vmstatFile("/proc/vmstat"),
+			  cpuPressureFile("/proc/pressure/cpu"),
+			  memoryPressureFile("/proc/pressure/memory"),
+			  ioPressureFile("/proc/pressure/io"),
+			  buffer(16 * 1024)
+		#endif
+	{
 		#if defined(__linux__) || defined(__APPLE__) || defined(__FreeBSD__)
 			pageSize = getpagesize();
 		#endif
@@ -1431,6 +1762,17 @@ public:
 		#endif
 	}
 
+	~SystemMetricsCollector() {
+		#ifdef __linux__
+			closeProcFile(meminfoFile);
+			closeProcFile(statFile);
+			closeProcFile(vmstatFile);
+			closeProcFile(cpuPressureFile);
+			closeProcFile(memoryPressureFile);
+			closeProcFile(ioPressureFile);
+		#endif
+	}
+
 	/**
 	 * If some information cannot be queried, then this method does not
 	 * throw an exception. Instead, that particular metric in the metrics
@@ -1439,13 +1781,19 @@ public:
 	 * supposed to return, so that we're unable to parse the output) then
 	 * a RuntimeException is thrown.
 	 *
+	 * On Linux, the /proc files that are read are kept open between
+	 * calls, so this method is not thread-safe.
+	 *
 	 * @throws RuntimeException
 	 */
-	void collect(SystemMetrics &metrics) const {
+	void collect(SystemMetrics &metrics) {
 		#if defined(__linux__)
 			queryMemInfo(metrics);
 			queryProcStat(metrics);
 			queryProcVmstat(metrics);
+			queryPressure(cpuPressureFile, metrics.cpuPressure);
+			queryPressure(memoryPressureFile, metrics.memoryPressure);
+			queryPressure(ioPressureFile, metrics.ioPressure);
 			queryBoottimeFromSysinfo(metrics);
 			queryLoadAvg(metrics);
 		#elif defined(__APPLE__)
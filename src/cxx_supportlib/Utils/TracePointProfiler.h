@@ -0,0 +1,260 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2015 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_TRACE_POINT_PROFILER_H_
+#define _PASSENGER_TRACE_POINT_PROFILER_H_
+
+#include <boost/thread/mutex.hpp>
+#include <boost/bind.hpp>
+#include <oxt/thread.hpp>
+#include <oxt/system_calls.hpp>
+#include <map>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <Utils/SystemTime.h>
+
+namespace Passenger {
+
+using namespace std;
+
+
+/**
+ * A sampling profiler built on oxt's trace points. A background thread
+ * periodically samples the innermost trace point of every oxt thread (see
+ * `oxt::thread::sample_trace_points()`) and counts how often every function
+ * and every source line was seen. Since the Core's hot paths are covered by
+ * TRACE_POINT() and UPDATE_TRACE_POINT() calls, this shows where the threads
+ * spend their time, without needing perf or a debugger in production.
+ *
+ * Sampling doesn't block the sampled threads: it only reads their shadow
+ * stacks. A thread that is waiting, e.g. in an event loop, is attributed to
+ * the trace point that it's waiting in.
+ *
+ * This class is thread-safe.
+ */
+class TracePointProfiler {
+private:
+	struct Location {
+		const char *function;
+		const char *source;
+		unsigned short line;
+
+		bool operator<(const Location &other) const {
+			if (function != other.function) {
+				return function < other.function;
+			} else if (source != other.source) {
+				return source < other.source;
+			} else {
+				return line < other.line;
+			}
+		}
+	};
+
+	typedef map<Location, unsigned long long> LocationMap;
+	typedef map<string, unsigned long long> CountMap;
+
+	mutable boost::mutex syncher;
+	/** Keyed by the trace points' string pointers, which is cheap. Locations
+	 * are merged by their contents when generating a report, because the
+	 * same function may have been compiled into multiple object files. */
+	LocationMap locations;
+	unsigned long long samples;
+	unsigned long long rounds;
+	unsigned long long startTime;
+	unsigned int interval;
+	bool supported;
+	oxt::thread *thread;
+
+	void threadMain() {
+		try {
+			while (!boost::this_thread::interruption_requested()) {
+				oxt::syscalls::usleep(interval * 1000);
+				sample();
+			}
+		} catch (const boost::thread_interrupted &) {
+			// Return.
+		}
+	}
+
+	static string formatLocation(const char *source, unsigned short line) {
+		const char *basename;
+		if (source == NULL) {
+			return "(unknown)";
+		} else if ((basename = strrchr(source, '/')) != NULL) {
+			basename++;
+		} else {
+			basename = source;
+		}
+
+		char buf[16];
+		snprintf(buf, sizeof(buf), ":%u", (unsigned int) line);
+		return string(basename) + buf;
+	}
+
+	static bool compareCounts(const pair<string, unsigned long long> &a,
+		const pair<string, unsigned long long> &b)
+	{
+		if (a.second != b.second) {
+			return a.second > b.second;
+		} else {
+			return a.first < b.first;
+		}
+	}
+
+	void formatTable(stringstream &stream, const char *title, const CountMap &counts,
+		unsigned int maxEntries) const
+	{
+		vector< pair<string, unsigned long long> > sorted(counts.begin(), counts.end());
+		sort(sorted.begin(), sorted.end(), compareCounts);
+
+		stream << title << ":\n";
+		stream << "   Samples      %\n";
+		for (unsigned int i = 0; i < sorted.size() && i < maxEntries; i++) {
+			char buf[32];
+			snprintf(buf, sizeof(buf), "%10llu %5.1f%%  ",
+				sorted[i].second, sorted[i].second * 100.0 / samples);
+			stream << buf << sorted[i].first << "\n";
+		}
+		if (sorted.size() > maxEntries) {
+			stream << "   (" << (sorted.size() - maxEntries) << " more)\n";
+		}
+	}
+
+public:
+	/**
+	 * @param interval The sampling interval, in milliseconds.
+	 */
+	TracePointProfiler(unsigned int interval = 10)
+		: samples(0),
+		  rounds(0),
+		  startTime(SystemTime::getUsec()),
+		  interval(std::max(1u, interval)),
+		  supported(true),
+		  thread(NULL)
+		{ }
+
+	~TracePointProfiler() {
+		stop();
+	}
+
+	void start() {
+		if (thread == NULL) {
+			thread = new oxt::thread(
+				boost::bind(&TracePointProfiler::threadMain, this),
+				"Trace point profiler",
+				1024 * 64);
+		}
+	}
+
+	void stop() {
+		if (thread != NULL) {
+			thread->interrupt_and_join();
+			delete thread;
+			thread = NULL;
+		}
+	}
+
+	unsigned int getInterval() const {
+		return interval;
+	}
+
+	/**
+	 * Samples the current trace point of every thread once. Called
+	 * periodically by the background thread after start().
+	 */
+	void sample() {
+		vector<oxt::trace_point_sample> threadSamples;
+		threadSamples.reserve(64);
+		bool supported = oxt::thread::sample_trace_points(threadSamples);
+
+		boost::lock_guard<boost::mutex> l(syncher);
+		this->supported = supported;
+		vector<oxt::trace_point_sample>::const_iterator it, end = threadSamples.end();
+		for (it = threadSamples.begin(); it != end; it++) {
+			if (it->function == NULL) {
+				continue;
+			}
+			Location location;
+			location.function = it->function;
+			location.source = it->source;
+			location.line = it->line;
+			locations[location]++;
+			samples++;
+		}
+		rounds++;
+	}
+
+	void reset() {
+		boost::lock_guard<boost::mutex> l(syncher);
+		locations.clear();
+		samples = 0;
+		rounds = 0;
+		startTime = SystemTime::getUsec();
+	}
+
+	unsigned long long getSampleCount() const {
+		boost::lock_guard<boost::mutex> l(syncher);
+		return samples;
+	}
+
+	/**
+	 * Returns a plain text report of the functions and source lines at which
+	 * the most samples were taken, most frequent first.
+	 */
+	string report(unsigned int maxEntries = 40) const {
+		boost::lock_guard<boost::mutex> l(syncher);
+		CountMap functions, lines;
+		LocationMap::const_iterator it, end = locations.end();
+		stringstream stream;
+
+		for (it = locations.begin(); it != end; it++) {
+			functions[it->first.function] += it->second;
+			lines[formatLocation(it->first.source, it->first.line) +
+				" in '" + it->first.function + "'"] += it->second;
+		}
+
+		stream << "Trace point profile: " << samples << " samples in " << rounds <<
+			" rounds over " << ((SystemTime::getUsec() - startTime) / 1000000) <<
+			" sec, sampled every " << interval << " msec\n";
+		if (!supported) {
+			stream << "(backtrace support disabled during compile time)\n";
+		} else if (samples > 0) {
+			stream << "\n";
+			formatTable(stream, "Functions", functions, maxEntries);
+			stream << "\n";
+			formatTable(stream, "Lines", lines, maxEntries);
+		}
+		return stream.str();
+	}
+};
+
+
+} // namespace Passenger
+
+#endif /* _PASSENGER_TRACE_POINT_PROFILER_H_ */
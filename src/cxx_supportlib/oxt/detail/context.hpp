@@ -34,8 +34,19 @@
 #ifdef __linux__
 	#include <sys/types.h>
 #endif
+#ifdef OXT_BACKTRACE_IS_ENABLED
+	#include <boost/atomic.hpp>
+#endif
 #include "../spin_lock.hpp"
 
+/**
+ * The maximum number of trace points that are recorded per thread. Trace
+ * points beyond this depth are counted, but left out of backtraces.
+ */
+#ifndef OXT_MAX_BACKTRACE_DEPTH
+	#define OXT_MAX_BACKTRACE_DEPTH 128
+#endif
+
 namespace oxt {
 
 
@@ -72,8 +83,22 @@ struct thread_local_context {
 	spin_lock syscall_interruption_lock;
 
 	#ifdef OXT_BACKTRACE_IS_ENABLED
-		std::vector<trace_point *> backtrace_list;
-		spin_lock backtrace_lock;
+		/**
+		 * A shadow stack of the thread's active trace points, innermost last.
+		 * Only the thread itself pushes and pops, without taking any locks.
+		 * Other threads read it seqlock-style: `backtrace_sequence` is odd
+		 * while the stack is being modified, and a reader discards its copy
+		 * if the sequence has changed in the meantime.
+		 *
+		 * `backtrace_depth` may exceed OXT_MAX_BACKTRACE_DEPTH, in which case
+		 * only the outermost trace points are stored. A slot is stored before
+		 * the depth that covers it is published with a release store, so a
+		 * reader that loads the depth with acquire semantics never sees an
+		 * unwritten slot. Slots are NULL until they're first used.
+		 */
+		boost::atomic<trace_point *> backtrace_list[OXT_MAX_BACKTRACE_DEPTH];
+		boost::atomic<unsigned int> backtrace_depth;
+		boost::atomic<unsigned int> backtrace_sequence;
 	#endif
 
 	static thread_local_context_ptr make_shared_ptr();
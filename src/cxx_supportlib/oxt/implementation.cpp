@@ -41,6 +41,7 @@
 	#include <sstream>
 	#include <cstring>
 #endif
+#include <algorithm>
 #include <cstring>
 
 
@@ -133,6 +134,161 @@ static global_context_t *global_context = NULL;
 
 #ifdef OXT_BACKTRACE_IS_ENABLED
 
+/*
+ * The shadow stack in thread_local_context is only modified by the thread
+ * that owns it, so pushing and popping trace points doesn't need any locks.
+ * Other threads copy it optimistically and validate the copy against
+ * `backtrace_sequence`. This is a seqlock with a single writer: the sequence
+ * is odd while the writer is modifying the stack, and the writer never
+ * waits for readers.
+ */
+
+static void
+push_trace_point(thread_local_context *ctx, trace_point *p) {
+	unsigned int seq = ctx->backtrace_sequence.load(boost::memory_order_relaxed);
+	unsigned int depth = ctx->backtrace_depth.load(boost::memory_order_relaxed);
+
+	ctx->backtrace_sequence.store(seq + 1, boost::memory_order_relaxed);
+	boost::atomic_thread_fence(boost::memory_order_release);
+	if (OXT_LIKELY(depth < OXT_MAX_BACKTRACE_DEPTH)) {
+		ctx->backtrace_list[depth].store(p, boost::memory_order_relaxed);
+	}
+	ctx->backtrace_depth.store(depth + 1, boost::memory_order_release);
+	ctx->backtrace_sequence.store(seq + 2, boost::memory_order_release);
+}
+
+static void
+pop_trace_point(thread_local_context *ctx) {
+	unsigned int seq = ctx->backtrace_sequence.load(boost::memory_order_relaxed);
+	unsigned int depth = ctx->backtrace_depth.load(boost::memory_order_relaxed);
+
+	assert(depth > 0);
+	ctx->backtrace_sequence.store(seq + 1, boost::memory_order_relaxed);
+	boost::atomic_thread_fence(boost::memory_order_release);
+	ctx->backtrace_depth.store(depth - 1, boost::memory_order_relaxed);
+	ctx->backtrace_sequence.store(seq + 2, boost::memory_order_release);
+}
+
+/**
+ * Begins an optimistic read of another thread's shadow stack. Returns false
+ * if that thread is modifying it right now.
+ */
+static bool
+begin_reading_backtrace(const thread_local_context *ctx, unsigned int &seq) {
+	seq = ctx->backtrace_sequence.load(boost::memory_order_acquire);
+	return seq % 2 == 0;
+}
+
+/**
+ * Returns whether everything that was read since `begin_reading_backtrace()`
+ * is consistent, i.e. whether the other thread hasn't modified its shadow
+ * stack in the meantime.
+ */
+static bool
+backtrace_unchanged(const thread_local_context *ctx, unsigned int seq) {
+	boost::atomic_thread_fence(boost::memory_order_acquire);
+	return ctx->backtrace_sequence.load(boost::memory_order_relaxed) == seq;
+}
+
+static trace_point *
+copy_trace_point(const trace_point *p) {
+	if (p->m_hasDataFunc) {
+		return new trace_point(
+			p->function,
+			p->source,
+			p->line,
+			p->u.dataFunc.func,
+			p->u.dataFunc.userData,
+			true);
+	} else {
+		return new trace_point(
+			p->function,
+			p->source,
+			p->line,
+			p->u.data,
+			trace_point::detached());
+	}
+}
+
+static void
+free_trace_points(vector<trace_point *> &backtrace_list) {
+	vector<trace_point *>::iterator it, end = backtrace_list.end();
+	for (it = backtrace_list.begin(); it != end; it++) {
+		delete *it;
+	}
+	backtrace_list.clear();
+}
+
+/**
+ * Copies the current thread's own shadow stack. No validation is necessary
+ * because the stack doesn't change while we're reading it.
+ */
+static void
+copy_current_backtrace(const thread_local_context *ctx, vector<trace_point *> &result) {
+	unsigned int depth = std::min<unsigned int>(
+		ctx->backtrace_depth.load(boost::memory_order_relaxed),
+		OXT_MAX_BACKTRACE_DEPTH);
+	result.reserve(depth);
+	for (unsigned int i = 0; i < depth; i++) {
+		result.push_back(copy_trace_point(
+			ctx->backtrace_list[i].load(boost::memory_order_relaxed)));
+	}
+}
+
+/**
+ * Copies another thread's shadow stack into `result`, without blocking that
+ * thread. Returns false if the copy raced with a push or a pop, in which
+ * case `result` is left empty.
+ *
+ * Only the function, source and line are copied. The data and data function
+ * arguments may point to memory that is owned by the other thread, and that
+ * may be freed at any time, so they are never touched.
+ *
+ * The other thread's stack must stay mapped during the call, so its context
+ * must be registered and `thread_registration_mutex` must be held.
+ */
+static bool
+try_copy_other_backtrace(const thread_local_context *ctx, vector<trace_point *> &result,
+	unsigned int &seq)
+{
+	struct {
+		const char *function;
+		const char *source;
+		unsigned short line;
+	} fields[OXT_MAX_BACKTRACE_DEPTH];
+
+	if (!begin_reading_backtrace(ctx, seq)) {
+		return false;
+	}
+
+	// The trace points may have been popped already, in which case their
+	// memory may contain anything. So only copy their fields for now, and
+	// don't use them until the copy has been validated. The acquire load
+	// guarantees that all slots up to the depth have been written.
+	unsigned int depth = std::min<unsigned int>(
+		ctx->backtrace_depth.load(boost::memory_order_acquire),
+		OXT_MAX_BACKTRACE_DEPTH);
+	for (unsigned int i = 0; i < depth; i++) {
+		const trace_point *p = ctx->backtrace_list[i].load(boost::memory_order_relaxed);
+		if (OXT_UNLIKELY(p == NULL)) {
+			return false;
+		}
+		fields[i].function = p->function;
+		fields[i].source = p->source;
+		fields[i].line = p->line;
+	}
+	if (!backtrace_unchanged(ctx, seq)) {
+		return false;
+	}
+
+	result.reserve(depth);
+	for (unsigned int i = 0; i < depth; i++) {
+		result.push_back(new trace_point(fields[i].function, fields[i].source,
+			fields[i].line, (const char *) NULL, trace_point::detached()));
+	}
+	return true;
+}
+
 trace_point::trace_point(const char *_function, const char *_source, unsigned short _line,
 	const char *_data)
 	: function(_function),
@@ -141,14 +297,15 @@ trace_point::trace_point(const char *_function, const char *_source, unsigned sh
 	  m_detached(false),
 	  m_hasDataFunc(false)
 {
+	// All fields must be set before the trace point is
+	// pushed, because other threads may read it right away.
+	u.data = _data;
 	thread_local_context *ctx = get_thread_local_context();
 	if (OXT_LIKELY(ctx != NULL)) {
-		spin_lock::scoped_lock l(ctx->backtrace_lock);
-		ctx->backtrace_list.push_back(this);
+		push_trace_point(ctx, this);
 	} else {
 		m_detached = true;
 	}
-	u.data = _data;
 }
 
 trace_point::trace_point(const char *_function, const char *_source, unsigned short _line,
@@ -159,17 +316,16 @@ trace_point::trace_point(const char *_function, const char *_source, unsigned sh
 	  m_detached(detached),
 	  m_hasDataFunc(true)
 {
+	u.dataFunc.func = _dataFunc;
+	u.dataFunc.userData = _userData;
 	if (!detached) {
 		thread_local_context *ctx = get_thread_local_context();
 		if (OXT_LIKELY(ctx != NULL)) {
-			spin_lock::scoped_lock l(ctx->backtrace_lock);
-			ctx->backtrace_list.push_back(this);
+			push_trace_point(ctx, this);
 		} else {
 			m_detached = true;
 		}
 	}
-	u.dataFunc.func = _dataFunc;
-	u.dataFunc.userData = _userData;
 }
 
 trace_point::trace_point(const char *_function, const char *_source, unsigned short _line,
@@ -187,15 +343,15 @@ trace_point::~trace_point() {
 	if (OXT_LIKELY(!m_detached)) {
 		thread_local_context *ctx = get_thread_local_context();
 		if (OXT_LIKELY(ctx != NULL)) {
-			spin_lock::scoped_lock l(ctx->backtrace_lock);
-			assert(!ctx->backtrace_list.empty());
-			ctx->backtrace_list.pop_back();
+			pop_trace_point(ctx);
 		}
 	}
 }
 
 void
 trace_point::update(const char *source, unsigned short line) {
+	// Not covered by the sequence: a concurrent reader may see the new
+	// source with the old line, which is harmless.
 	this->source = source;
 	this->line = line;
 }
@@ -204,30 +360,7 @@ trace_point::update(const char *source, unsigned short line) {
 tracable_exception::tracable_exception() {
 	thread_local_context *ctx = get_thread_local_context();
 	if (OXT_LIKELY(ctx != NULL)) {
-		spin_lock::scoped_lock l(ctx->backtrace_lock);
-		vector<trace_point *>::const_iterator it, end = ctx->backtrace_list.end();
-
-		backtrace_copy.reserve(ctx->backtrace_list.size());
-		for (it = ctx->backtrace_list.begin(); it != end; it++) {
-			trace_point *p;
-			if ((*it)->m_hasDataFunc) {
-				p = new trace_point(
-					(*it)->function,
-					(*it)->source,
-					(*it)->line,
-					(*it)->u.dataFunc.func,
-					(*it)->u.dataFunc.userData,
-					true);
-			} else {
-				p = new trace_point(
-					(*it)->function,
-					(*it)->source,
-					(*it)->line,
-					(*it)->u.data,
-					trace_point::detached());
-			}
-			backtrace_copy.push_back(p);
-		}
+		copy_current_backtrace(ctx, backtrace_copy);
 	}
 }
 
@@ -237,24 +370,7 @@ tracable_exception::tracable_exception(const tracable_exception &other)
 	vector<trace_point *>::const_iterator it, end = other.backtrace_copy.end();
 	backtrace_copy.reserve(other.backtrace_copy.size());
 	for (it = other.backtrace_copy.begin(); it != end; it++) {
-		trace_point *p;
-		if ((*it)->m_hasDataFunc) {
-			p = new trace_point(
-				(*it)->function,
-				(*it)->source,
-				(*it)->line,
-				(*it)->u.dataFunc.func,
-				(*it)->u.dataFunc.userData,
-				true);
-		} else {
-			p = new trace_point(
-				(*it)->function,
-				(*it)->source,
-				(*it)->line,
-				(*it)->u.data,
-				trace_point::detached());
-		}
-		backtrace_copy.push_back(p);
+		backtrace_copy.push_back(copy_trace_point(*it));
 	}
 }
 
@@ -265,10 +381,7 @@ tracable_exception::tracable_exception(const no_backtrace &tag)
 }
 
 tracable_exception::~tracable_exception() throw() {
-	vector<trace_point *>::iterator it, end = backtrace_copy.end();
-	for (it = backtrace_copy.begin(); it != end; it++) {
-		delete *it;
-	}
+	free_trace_points(backtrace_copy);
 }
 
 template<typename Collection>
@@ -313,6 +426,90 @@ format_backtrace(const Collection &backtrace_list) {
 	}
 }
 
+static string
+format_omitted_trace_points(unsigned int depth) {
+	if (depth > OXT_MAX_BACKTRACE_DEPTH) {
+		stringstream result;
+		result << "     (" << (depth - OXT_MAX_BACKTRACE_DEPTH) <<
+			" innermost trace points omitted)" << endl;
+		return result.str();
+	} else {
+		return string();
+	}
+}
+
+static string
+format_current_backtrace(const thread_local_context *ctx) {
+	vector<trace_point *> copy;
+	copy_current_backtrace(ctx, copy);
+	string result = format_omitted_trace_points(
+		ctx->backtrace_depth.load(boost::memory_order_relaxed));
+	result.append(format_backtrace(copy));
+	free_trace_points(copy);
+	return result;
+}
+
+/**
+ * Formats the backtrace of another thread without blocking it. Only
+ * functions, sources and lines are shown: data functions may refer to
+ * objects that only live as long as their trace point, so they must not be
+ * called from another thread.
+ *
+ * Must be called with `thread_registration_mutex` held.
+ */
+static string
+format_other_backtrace(const thread_local_context *ctx) {
+	vector<trace_point *> copy;
+	unsigned int seq;
+
+	for (unsigned int i = 0; i < 100; i++) {
+		if (try_copy_other_backtrace(ctx, copy, seq)) {
+			string result = format_omitted_trace_points(
+				ctx->backtrace_depth.load(boost::memory_order_relaxed));
+			result.append(format_backtrace(copy));
+			free_trace_points(copy);
+			return result;
+		}
+	}
+	return "     (backtrace changed too quickly to be read)";
+}
+
+/**
+ * Copies the innermost trace point of another thread into `sample`, without
+ * blocking that thread. Returns false if the thread has no trace points, or
+ * if its backtrace kept changing while we tried to read it.
+ *
+ * Must be called with `thread_registration_mutex` held.
+ */
+static bool
+sample_other_trace_point(const thread_local_context *ctx, trace_point_sample &sample) {
+	for (unsigned int i = 0; i < 10; i++) {
+		unsigned int seq;
+		if (!begin_reading_backtrace(ctx, seq)) {
+			continue;
+		}
+
+		unsigned int depth = ctx->backtrace_depth.load(boost::memory_order_acquire);
+		if (depth == 0) {
+			return false;
+		}
+		const trace_point *p = ctx->backtrace_list[
+			std::min<unsigned int>(depth, OXT_MAX_BACKTRACE_DEPTH) - 1].load(
+				boost::memory_order_relaxed);
+		if (OXT_UNLIKELY(p == NULL)) {
+			continue;
+		}
+		sample.function = p->function;
+		sample.source = p->source;
+		sample.line = p->line;
+		if (backtrace_unchanged(ctx, seq)) {
+			sample.thread_number = ctx->thread_number;
+			return true;
+		}
+	}
+	return false;
+}
+
 string
 tracable_exception::backtrace() const throw() {
 	return format_backtrace< vector<trace_point *> >(backtrace_copy);
@@ -364,15 +561,21 @@ thread_local_context::make_shared_ptr() {
 
 thread_local_context::thread_local_context()
 	: thread_number(0)
+	#ifdef OXT_BACKTRACE_IS_ENABLED
+		, backtrace_depth(0)
+		, backtrace_sequence(0)
+	#endif
 {
 	thread = pthread_self();
 	#ifdef __linux__
 		tid = syscall(SYS_gettid);
 	#endif
-	syscall_interruption_lock.lock();
 	#ifdef OXT_BACKTRACE_IS_ENABLED
-		backtrace_list.reserve(50);
+		for (unsigned int i = 0; i < OXT_MAX_BACKTRACE_DEPTH; i++) {
+			backtrace_list[i].store(NULL, boost::memory_order_relaxed);
+		}
 	#endif
+	syscall_interruption_lock.lock();
 }
 
 
@@ -438,8 +641,12 @@ thread::name() const throw() {
 std::string
 thread::backtrace() const throw() {
 	#ifdef OXT_BACKTRACE_IS_ENABLED
-		spin_lock::scoped_lock l(context->backtrace_lock);
-		return format_backtrace(context->backtrace_list);
+		if (OXT_LIKELY(global_context != NULL)) {
+			boost::lock_guard<boost::mutex> l(global_context->thread_registration_mutex);
+			return format_other_backtrace(context.get());
+		} else {
+			return format_other_backtrace(context.get());
+		}
 	#else
 		return "    (backtrace support disabled during compile time)";
 	#endif
@@ -465,8 +672,7 @@ thread::all_backtraces() throw() {
 				#endif
 				result << "):" << endl;
 
-				spin_lock::scoped_lock l(ctx->backtrace_lock);
-				std::string bt = format_backtrace(ctx->backtrace_list);
+				std::string bt = format_other_backtrace(ctx.get());
 				result << bt;
 				if (bt.empty() || bt[bt.size() - 1] != '\n') {
 					result << endl;
@@ -487,8 +693,7 @@ thread::current_backtrace() throw() {
 	#ifdef OXT_BACKTRACE_IS_ENABLED
 		thread_local_context *ctx = get_thread_local_context();
 		if (OXT_LIKELY(ctx != NULL)) {
-			spin_lock::scoped_lock l(ctx->backtrace_lock);
-			return format_backtrace(ctx->backtrace_list);
+			return format_current_backtrace(ctx);
 		} else {
 			return "(OXT not initialized)";
 		}
@@ -497,6 +702,29 @@ thread::current_backtrace() throw() {
 	#endif
 }
 
+bool
+thread::sample_trace_points(std::vector<trace_point_sample> &samples) throw() {
+	#ifdef OXT_BACKTRACE_IS_ENABLED
+		if (OXT_LIKELY(global_context != NULL)) {
+			boost::lock_guard<boost::mutex> l(global_context->thread_registration_mutex);
+			list<thread_local_context_ptr>::const_iterator it;
+
+			for (it = global_context->registered_threads.begin();
+			     it != global_context->registered_threads.end();
+			     it++)
+			{
+				trace_point_sample sample;
+				if (sample_other_trace_point(it->get(), sample)) {
+					samples.push_back(sample);
+				}
+			}
+		}
+		return true;
+	#else
+		return false;
+	#endif
+}
+
 void
 thread::interrupt(bool interruptSyscalls) {
 	int ret;
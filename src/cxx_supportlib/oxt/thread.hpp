@@ -34,6 +34,7 @@
 #include "detail/context.hpp"
 #include <string>
 #include <list>
+#include <vector>
 #include <unistd.h>
 #include <limits.h>  // for PTHREAD_STACK_MIN
 
@@ -46,6 +47,17 @@ namespace oxt {
 	extern __thread void *thread_signature;
 #endif
 
+/**
+ * The trace point that a thread was at when it was sampled by
+ * `thread::sample_trace_points()`.
+ */
+struct trace_point_sample {
+	const char *function;
+	const char *source;
+	unsigned short line;
+	unsigned int thread_number;
+};
+
 /**
  * Enhanced thread class with support for:
  * - user-defined stack size.
@@ -153,6 +165,16 @@ public:
 	 */
 	static std::string current_backtrace() throw();
 
+	/**
+	 * Appends the innermost trace point of every oxt::thread thread, as well
+	 * as that of the main thread, to `samples`. The threads are not blocked
+	 * while doing so, which makes this cheap enough to be called periodically
+	 * by a sampling profiler. Threads without trace points are skipped.
+	 *
+	 * Returns false if backtrace support was disabled during compile time.
+	 */
+	static bool sample_trace_points(std::vector<trace_point_sample> &samples) throw();
+
 	/**
 	 * Interrupt the thread. This method behaves just like
 	 * boost::thread::interrupt(), but if <em>interruptSyscalls</em> is true
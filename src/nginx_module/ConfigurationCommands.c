@@ -420,6 +420,16 @@
 	NULL
 },
 
+{
+	
+	ngx_string("passenger_max_request_queue_time"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_HTTP_LIF_CONF | NGX_CONF_TAKE1,
+	ngx_conf_set_num_slot,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	offsetof(passenger_loc_conf_t, max_request_queue_time),
+	NULL
+},
+
 {
 	
 	ngx_string("passenger_request_queue_overflow_status_code"),
@@ -42,6 +42,8 @@ have_header('ruby/thread.h')
 have_var('ruby_version')
 have_func('rb_thread_io_blocking_region', 'ruby/io.h')
 have_func('rb_thread_call_without_gvl', 'ruby/thread.h')
+have_func('rb_hash_dup')
+have_func('rb_gc_register_mark_object')
 
 with_cflags($CFLAGS) do
 	create_makefile('passenger_native_support')
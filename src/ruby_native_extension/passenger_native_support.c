@@ -146,6 +146,221 @@ split_by_null_into_hash(VALUE self, VALUE data) {
 	return result;
 }
 
+/*
+ * Rack env keys are the same for almost every request, so we keep frozen
+ * copies of the keys that we've seen before. Hash#[]= doesn't need to
+ * duplicate and freeze frozen String keys, and the same key objects are
+ * shared by all requests. The number of cached keys is limited so that
+ * clients can't make the cache grow without bound by sending random headers.
+ */
+#define ENV_KEY_CACHE_SLOTS 1024 /* Must be a power of 2 */
+#define ENV_KEY_CACHE_MAX_ENTRIES 512
+#define ENV_KEY_CACHE_MAX_KEY_SIZE 128
+
+typedef struct {
+	unsigned int hash;
+	unsigned int len;
+	/* A private copy of the key data, so that we don't depend on where
+	 * the Ruby string stores its data. */
+	char *data;
+	VALUE str;
+} EnvKeyCacheEntry;
+
+static EnvKeyCacheEntry env_key_cache[ENV_KEY_CACHE_SLOTS];
+static unsigned int env_key_cache_count = 0;
+#ifndef HAVE_RB_GC_REGISTER_MARK_OBJECT
+/* Keeps the cached key strings alive on Rubies that can't pin them.
+ * Those Rubies don't have a compacting GC either. */
+static VALUE env_key_cache_strings;
+#endif
+static VALUE S_RackUrlScheme;
+static VALUE S_HTTP;
+static VALUE S_HTTPS;
+
+static unsigned int
+hash_env_key(const char *data, unsigned int len) {
+	/* FNV-1a */
+	unsigned int hash = 2166136261u;
+	unsigned int i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= (unsigned char) data[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/* Returns a frozen String with the given contents, from the cache if possible. */
+static VALUE
+lookup_env_key(VALUE data, const char *cdata, const char *begin, unsigned int len) {
+	unsigned int hash, index;
+	EnvKeyCacheEntry *entry;
+	VALUE str;
+
+	if (len > ENV_KEY_CACHE_MAX_KEY_SIZE) {
+		return rb_str_substr(data, begin - cdata, len);
+	}
+
+	hash = hash_env_key(begin, len);
+	index = hash & (ENV_KEY_CACHE_SLOTS - 1);
+	while (env_key_cache[index].data != NULL) {
+		entry = &env_key_cache[index];
+		if (entry->hash == hash && entry->len == len
+		 && memcmp(entry->data, begin, len) == 0)
+		{
+			return entry->str;
+		}
+		index = (index + 1) & (ENV_KEY_CACHE_SLOTS - 1);
+	}
+
+	str = rb_str_new(begin, len);
+	if (env_key_cache_count >= ENV_KEY_CACHE_MAX_ENTRIES) {
+		return str;
+	}
+	entry = &env_key_cache[index];
+	entry->data = (char *) malloc(len + 1);
+	if (entry->data == NULL) {
+		return str;
+	}
+	memcpy(entry->data, begin, len);
+	entry->data[len] = '\0';
+	entry->hash = hash;
+	entry->len = len;
+	entry->str = rb_obj_freeze(str);
+	#ifdef HAVE_RB_GC_REGISTER_MARK_OBJECT
+		/* Marks and pins the string, so that GC.compact can't move it
+		 * away from the raw VALUE in the cache. */
+		rb_gc_register_mark_object(entry->str);
+	#else
+		rb_ary_push(env_key_cache_strings, entry->str);
+	#endif
+	env_key_cache_count++;
+	return entry->str;
+}
+
+static int
+is_https_value(VALUE value) {
+	const char *cvalue = RSTRING_PTR(value);
+	long len = RSTRING_LEN(value);
+
+	return (len == 3 && memcmp(cvalue, "yes", 3) == 0)
+		|| (len == 2 && memcmp(cvalue, "on", 2) == 0)
+		|| (len == 1 && cvalue[0] == '1');
+}
+
+/*
+ * call-seq: split_by_null_into_rack_env(data, template)
+ *
+ * Like #split_by_null_into_hash, but builds a complete Rack env in one go.
+ * The result starts out as a copy of _template_, which should contain the
+ * request-independent Rack entries. Header names are replaced by shared,
+ * frozen strings, and "rack.url_scheme" is set according to the HTTPS
+ * header.
+ */
+static VALUE
+split_by_null_into_rack_env(VALUE self, VALUE data, VALUE template) {
+	const char *cdata, *begin, *current, *end;
+	VALUE result, key, value;
+	int https = 0;
+
+	Check_Type(data, T_STRING);
+	Check_Type(template, T_HASH);
+	cdata   = RSTRING_PTR(data);
+	begin   = cdata;
+	current = cdata;
+	end     = cdata + RSTRING_LEN(data);
+
+	#ifdef HAVE_RB_HASH_DUP
+		result = rb_hash_dup(template);
+	#else
+		result = rb_obj_dup(template);
+	#endif
+	while (current < end) {
+		current = (const char *) memchr(begin, '\0', end - begin);
+		if (current == NULL) {
+			break;
+		}
+		key   = lookup_env_key(data, cdata, begin, (unsigned int) (current - begin));
+		begin = current + 1;
+		current = (const char *) memchr(begin, '\0', end - begin);
+		if (current == NULL) {
+			break;
+		}
+		value = rb_str_substr(data, begin - cdata, current - begin);
+		begin = current = current + 1;
+		if (RSTRING_LEN(key) == sizeof("HTTPS") - 1
+		 && memcmp(RSTRING_PTR(key), "HTTPS", sizeof("HTTPS") - 1) == 0)
+		{
+			https = is_https_value(value);
+		}
+		rb_hash_aset(result, key, value);
+	}
+
+	rb_hash_aset(result, S_RackUrlScheme, https ? S_HTTPS : S_HTTP);
+	return result;
+}
+
+static void
+append_header_lines(VALUE result, VALUE key, VALUE value) {
+	const char *begin = RSTRING_PTR(value);
+	const char *end = begin + RSTRING_LEN(value);
+	const char *newline;
+
+	/* Like String#split("\n"): trailing empty lines are dropped. */
+	while (end > begin && end[-1] == '\n') {
+		end--;
+	}
+	while (begin < end) {
+		newline = (const char *) memchr(begin, '\n', end - begin);
+		if (newline == NULL) {
+			newline = end;
+		}
+		rb_str_buf_cat(result, RSTRING_PTR(key), RSTRING_LEN(key));
+		rb_str_buf_cat(result, ": ", 2);
+		rb_str_buf_cat(result, begin, newline - begin);
+		rb_str_buf_cat(result, "\r\n", 2);
+		begin = newline + 1;
+	}
+}
+
+static int
+generate_rack_header(VALUE key, VALUE value, VALUE result) {
+	if (TYPE(value) != T_STRING) {
+		if (TYPE(key) == T_STRING
+		 && RSTRING_LEN(key) == sizeof("rack.hijack") - 1
+		 && memcmp(RSTRING_PTR(key), "rack.hijack", sizeof("rack.hijack") - 1) == 0)
+		{
+			return ST_CONTINUE;
+		}
+		value = rb_obj_as_string(value);
+	}
+	append_header_lines(result, StringValue(key), value);
+	return ST_CONTINUE;
+}
+
+/*
+ * call-seq: generate_rack_headers(status, headers)
+ *
+ * Serializes a Rack response status and headers Hash into a String containing
+ * the HTTP status line and one header line per value. Header values that
+ * contain newlines are output as multiple headers. The "rack.hijack" entry
+ * is skipped. The result doesn't end with an empty line, so that more header
+ * lines can be appended.
+ */
+static VALUE
+generate_rack_headers(VALUE self, VALUE status, VALUE headers) {
+	VALUE result, status_str;
+
+	Check_Type(headers, T_HASH);
+	status_str = rb_obj_as_string(status);
+	result = rb_str_buf_new(1024);
+	rb_str_buf_cat(result, "HTTP/1.1 ", sizeof("HTTP/1.1 ") - 1);
+	rb_str_buf_cat(result, RSTRING_PTR(status_str), RSTRING_LEN(status_str));
+	rb_str_buf_cat(result, " Whatever\r\n", sizeof(" Whatever\r\n") - 1);
+	rb_hash_foreach(headers, generate_rack_header, result);
+	return result;
+}
+
 typedef struct {
 	/* The IO vectors in this group. */
 	struct iovec *io_vectors;
@@ -975,8 +1190,21 @@ Init_passenger_native_support() {
 
 	S_ProcessTimes = rb_struct_define("ProcessTimes", "utime", "stime", NULL);
 
+	#ifndef HAVE_RB_GC_REGISTER_MARK_OBJECT
+		env_key_cache_strings = rb_ary_new();
+		rb_global_variable(&env_key_cache_strings);
+	#endif
+	S_RackUrlScheme = rb_obj_freeze(rb_str_new2("rack.url_scheme"));
+	rb_global_variable(&S_RackUrlScheme);
+	S_HTTP = rb_obj_freeze(rb_str_new2("http"));
+	rb_global_variable(&S_HTTP);
+	S_HTTPS = rb_obj_freeze(rb_str_new2("https"));
+	rb_global_variable(&S_HTTPS);
+
 	rb_define_singleton_method(mNativeSupport, "disable_stdio_buffering", disable_stdio_buffering, 0);
 	rb_define_singleton_method(mNativeSupport, "split_by_null_into_hash", split_by_null_into_hash, 1);
+	rb_define_singleton_method(mNativeSupport, "split_by_null_into_rack_env", split_by_null_into_rack_env, 2);
+	rb_define_singleton_method(mNativeSupport, "generate_rack_headers", generate_rack_headers, 2);
 	rb_define_singleton_method(mNativeSupport, "writev", f_writev, 2);
 	rb_define_singleton_method(mNativeSupport, "writev2", f_writev2, 3);
 	rb_define_singleton_method(mNativeSupport, "writev3", f_writev3, 4);
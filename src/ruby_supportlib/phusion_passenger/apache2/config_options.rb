@@ -149,6 +149,13 @@ APACHE2_DIRECTORY_CONFIGURATION_OPTIONS = [
     :context   => ["OR_ALL"],
     :desc      => "The maximum number of queued requests."
   },
+  {
+    :name      => "PassengerMaxRequestQueueTime",
+    :type      => :integer,
+    :min_value => 0,
+    :context   => ["OR_ALL"],
+    :desc      => "The maximum number of seconds that a request may be queued."
+  },
   {
     :name      => "PassengerMaxPreloaderIdleTime",
     :type      => :integer,
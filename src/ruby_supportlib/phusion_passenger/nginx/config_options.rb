@@ -277,6 +277,10 @@ LOCATION_CONFIGURATION_OPTIONS = [
     :name  => 'passenger_max_request_queue_size',
     :type  => :integer
   },
+  {
+    :name  => 'passenger_max_request_queue_time',
+    :type  => :integer
+  },
   {
     :name  => 'passenger_request_queue_overflow_status_code',
     :type  => :integer
@@ -23,6 +23,7 @@
 #  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 #  THE SOFTWARE.
 
+PhusionPassenger.require_passenger_lib 'utils/native_support_utils'
 PhusionPassenger.require_passenger_lib 'utils/tee_input'
 
 module PhusionPassenger
@@ -67,18 +68,17 @@ module PhusionPassenger
       def process_request(env, connection, socket_wrapper, full_http_response)
         rewindable_input = PhusionPassenger::Utils::TeeInput.new(connection, env)
         begin
-          env[RACK_VERSION]      = RACK_VERSION_VALUE
-          env[RACK_INPUT]        = rewindable_input
-          env[RACK_ERRORS]       = STDERR
-          env[RACK_MULTITHREAD]  = @request_handler.concurrency > 1
-          env[RACK_MULTIPROCESS] = true
-          env[RACK_RUN_ONCE]     = false
-          if env[HTTPS] == YES || env[HTTPS] == ON || env[HTTPS] == ONE
-            env[RACK_URL_SCHEME] = HTTPS_DOWNCASE
-          else
-            env[RACK_URL_SCHEME] = HTTP
+          if !env.has_key?(RACK_VERSION)
+            # The env was not built by #parse_session_headers, for example
+            # because the request came in through the HTTP protocol.
+            env.merge!(rack_env_template)
+            if env[HTTPS] == YES || env[HTTPS] == ON || env[HTTPS] == ONE
+              env[RACK_URL_SCHEME] = HTTPS_DOWNCASE
+            else
+              env[RACK_URL_SCHEME] = HTTP
+            end
           end
-          env[RACK_HIJACK_P] = true
+          env[RACK_INPUT] = rewindable_input
           env[RACK_HIJACK] = lambda do
             env[RACK_HIJACK_IO] ||= begin
               connection.stop_simulating_eof!
@@ -158,6 +158,25 @@ module PhusionPassenger
       end
 
     private
+      # Builds the Rack env in a single native call: the request-independent
+      # entries come from #rack_env_template, and "rack.url_scheme" is set
+      # according to the HTTPS header.
+      def parse_session_headers(headers_data)
+        return Utils::NativeSupportUtils.split_by_null_into_rack_env(headers_data,
+          rack_env_template)
+      end
+
+      def rack_env_template
+        @rack_env_template ||= {
+          RACK_VERSION      => RACK_VERSION_VALUE,
+          RACK_ERRORS       => STDERR,
+          RACK_MULTITHREAD  => @request_handler.concurrency > 1,
+          RACK_MULTIPROCESS => true,
+          RACK_RUN_ONCE     => false,
+          RACK_HIJACK_P     => true
+        }.freeze
+      end
+
       def process_body(env, connection, socket_wrapper, status, is_head_request, headers, body)
         if @ush_reporter
           ush_log_id = @ush_reporter.log_writing_rack_body_begin
@@ -327,26 +346,7 @@ module PhusionPassenger
       end
 
       def generate_headers_array(status, headers)
-        status_str = status.to_s
-        result = ["HTTP/1.1 #{status_str} Whatever\r\n"]
-        headers.each do |key, values|
-          if values.is_a?(String)
-            values = values.split(NEWLINE)
-          elsif key == RACK_HIJACK
-            # We do not check for this key name in every loop
-            # iteration as an optimization.
-            next
-          else
-            values = values.to_s.split(NEWLINE)
-          end
-          values.each do |value|
-            result << key
-            result << NAME_VALUE_SEPARATOR
-            result << value
-            result << CRLF
-          end
-        end
-        return result
+        return [Utils::NativeSupportUtils.generate_rack_headers(status, headers)]
       end
 
       def should_output_body?(status, is_head_request)
@@ -40,6 +40,16 @@ module PhusionPassenger
       class Interrupted < StandardError
       end
 
+      # Turns the header block of a session protocol request into an env hash.
+      # This lives in a module so that extensions, such as the Rack extension,
+      # can override it.
+      module SessionHeadersParsing
+        def parse_session_headers(headers_data)
+          return Utils::NativeSupportUtils.split_by_null_into_hash(headers_data)
+        end
+      end
+      include SessionHeadersParsing
+
       REQUEST_METHOD = 'REQUEST_METHOD'.freeze
       GET            = 'GET'.freeze
       PING           = 'PING'.freeze
@@ -221,7 +231,7 @@ module PhusionPassenger
         if headers_data.nil?
           return
         end
-        headers = Utils::NativeSupportUtils.split_by_null_into_hash(headers_data)
+        headers = parse_session_headers(headers_data)
         if @connect_password && headers[PASSENGER_CONNECT_PASSWORD] != @connect_password
           warn "*** Passenger RequestHandler warning: " <<
             "someone tried to connect with an invalid connect password."
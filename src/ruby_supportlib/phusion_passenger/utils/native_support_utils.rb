@@ -38,6 +38,23 @@ module PhusionPassenger
           return PhusionPassenger::NativeSupport.split_by_null_into_hash(data)
         end
 
+        # Like #split_by_null_into_hash, but returns a copy of +template+ into which
+        # the keys and values have been merged, with "rack.url_scheme" set according
+        # to the HTTPS key. Keys are shared, frozen strings.
+        def split_by_null_into_rack_env(data, template)
+          return PhusionPassenger::NativeSupport.split_by_null_into_rack_env(data, template)
+        end
+
+        # Serializes a Rack response status and headers into a String containing the
+        # HTTP status line and the header lines, without the terminating empty line.
+        def generate_rack_headers(status, headers)
+          if headers.is_a?(Hash)
+            return PhusionPassenger::NativeSupport.generate_rack_headers(status, headers)
+          else
+            return generate_rack_headers_in_ruby(status, headers)
+          end
+        end
+
         # Wrapper for getrusage().
         def process_times
           return PhusionPassenger::NativeSupport.process_times
@@ -54,12 +71,56 @@ module PhusionPassenger
           return Hash[*args]
         end
 
+        def split_by_null_into_rack_env(data, template)
+          env = template.dup
+          env.merge!(split_by_null_into_hash(data))
+          https = env[HTTPS]
+          if https == YES || https == ON || https == ONE
+            env[RACK_URL_SCHEME] = HTTPS_DOWNCASE
+          else
+            env[RACK_URL_SCHEME] = HTTP
+          end
+          return env
+        end
+
+        def generate_rack_headers(status, headers)
+          return generate_rack_headers_in_ruby(status, headers)
+        end
+
         def process_times
           times = Process.times
           return ProcessTimes.new((times.utime * 1_000_000).to_i,
             (times.stime * 1_000_000).to_i)
         end
       end
+
+    private
+      RACK_HIJACK     = "rack.hijack".freeze     # :nodoc:
+      RACK_URL_SCHEME = "rack.url_scheme".freeze # :nodoc:
+      HTTPS           = "HTTPS".freeze           # :nodoc:
+      HTTPS_DOWNCASE  = "https".freeze           # :nodoc:
+      HTTP            = "http".freeze            # :nodoc:
+      YES             = "yes".freeze             # :nodoc:
+      ON              = "on".freeze              # :nodoc:
+      ONE             = "1".freeze               # :nodoc:
+      NEWLINE         = "\n".freeze              # :nodoc:
+
+      def generate_rack_headers_in_ruby(status, headers)
+        result = "HTTP/1.1 #{status} Whatever\r\n"
+        headers.each do |key, values|
+          if values.is_a?(String)
+            values = values.split(NEWLINE)
+          elsif key == RACK_HIJACK
+            next
+          else
+            values = values.to_s.split(NEWLINE)
+          end
+          values.each do |value|
+            result << "#{key}: #{value}\r\n"
+          end
+        end
+        return result
+      end
     end
 
   end # module Utils
@@ -0,0 +1,385 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2015 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_BENCHMARK_SUPPORT_H_
+#define _PASSENGER_BENCHMARK_SUPPORT_H_
+
+/*
+ * A small harness for micro-benchmarks. A benchmark is a function that
+ * performs the measured operation the given number of times:
+ *
+ *   static void benchmarkFoo(unsigned long long iterations) {
+ *       for (unsigned long long i = 0; i < iterations; i++) {
+ *           Benchmark::doNotOptimize(foo());
+ *       }
+ *   }
+ *
+ *   int main(int argc, char *argv[]) {
+ *       Benchmark::Runner runner(argc, argv);
+ *       runner.run("foo", benchmarkFoo);
+ *       return runner.finish();
+ *   }
+ *
+ * The runner increases the number of iterations until a run takes at least
+ * the minimum time, then reports the time per operation, the number of heap
+ * allocations per operation and the throughput. Results can be written to a
+ * JSON file and compared against a JSON file from an earlier run, e.g. one
+ * made on another commit.
+ *
+ * This file defines malloc() & co. in order to count allocations, so it must
+ * be included by exactly one translation unit of a benchmark executable.
+ */
+
+#include <time.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <jsoncpp/json.h>
+
+namespace Passenger {
+namespace Benchmark {
+
+using namespace std;
+
+
+/** The number of heap allocations performed so far by this process. */
+static unsigned long long allocations = 0;
+
+template<typename T>
+inline void
+doNotOptimize(const T &value) {
+	#if defined(__GNUC__)
+		__asm__ __volatile__("" : : "g"(&value) : "memory");
+	#else
+		volatile const T *p = &value;
+		(void) p;
+	#endif
+}
+
+inline unsigned long long
+getMonotonicNsec() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+class Runner {
+public:
+	typedef void (*Function)(unsigned long long iterations);
+
+	struct Result {
+		string name;
+		unsigned long long iterations;
+		double nsPerOp;
+		double allocationsPerOp;
+		/** Bytes processed per operation, or 0 if not applicable. */
+		double bytesPerOp;
+
+		double getOpsPerSec() const {
+			return 1000000000.0 / nsPerOp;
+		}
+
+		double getMbPerSec() const {
+			return bytesPerOp * getOpsPerSec() / 1024 / 1024;
+		}
+	};
+
+private:
+	string filter;
+	string jsonFile;
+	string compareFile;
+	unsigned long long minTimeNsec;
+	double maxRegression;
+	vector<Result> results;
+
+	static void usage(const char *program) {
+		printf("Usage: %s [OPTIONS...]\n", program);
+		printf("\n");
+		printf("Options:\n");
+		printf("  --filter TEXT          Only run benchmarks whose name contains TEXT\n");
+		printf("  --min-time MSEC        Minimum time per benchmark. Default: 200\n");
+		printf("  --json FILE            Write the results to FILE in JSON format\n");
+		printf("  --compare FILE         Compare the results with an earlier JSON file\n");
+		printf("  --max-regression PCT   With --compare: exit with status 1 if a benchmark\n");
+		printf("                         became more than PCT percent slower\n");
+	}
+
+	void printHeader() const {
+		printf("%-40s %12s %12s %10s %14s\n", "Benchmark", "Iterations",
+			"ns/op", "allocs/op", "Throughput");
+	}
+
+	void printResult(const Result &result) const {
+		char throughput[64];
+		if (result.bytesPerOp > 0) {
+			snprintf(throughput, sizeof(throughput), "%.1f MB/s", result.getMbPerSec());
+		} else if (result.getOpsPerSec() >= 1000000) {
+			snprintf(throughput, sizeof(throughput), "%.2f Mops/s", result.getOpsPerSec() / 1000000);
+		} else {
+			snprintf(throughput, sizeof(throughput), "%.0f ops/s", result.getOpsPerSec());
+		}
+		printf("%-40s %12llu %12.1f %10.2f %14s\n", result.name.c_str(),
+			result.iterations, result.nsPerOp, result.allocationsPerOp, throughput);
+		fflush(stdout);
+	}
+
+	Json::Value toJson() const {
+		Json::Value doc, benchmarks(Json::arrayValue);
+		for (unsigned int i = 0; i < results.size(); i++) {
+			const Result &result = results[i];
+			Json::Value entry;
+			entry["name"] = result.name;
+			entry["iterations"] = (Json::UInt64) result.iterations;
+			entry["ns_per_op"] = result.nsPerOp;
+			entry["allocations_per_op"] = result.allocationsPerOp;
+			entry["ops_per_sec"] = result.getOpsPerSec();
+			if (result.bytesPerOp > 0) {
+				entry["bytes_per_op"] = result.bytesPerOp;
+				entry["mb_per_sec"] = result.getMbPerSec();
+			}
+			benchmarks.append(entry);
+		}
+		doc["benchmarks"] = benchmarks;
+		return doc;
+	}
+
+	bool writeJson() const {
+		ofstream stream(jsonFile.c_str());
+		stream << toJson().toStyledString();
+		if (!stream) {
+			fprintf(stderr, "Cannot write %s\n", jsonFile.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	/** Returns false if a regression larger than maxRegression was found. */
+	bool compare() const {
+		ifstream stream(compareFile.c_str());
+		Json::Reader reader;
+		Json::Value doc;
+		bool ok = true;
+
+		if (!stream || !reader.parse(stream, doc, false)) {
+			fprintf(stderr, "Cannot read %s\n", compareFile.c_str());
+			return false;
+		}
+
+		printf("\nComparison with %s:\n", compareFile.c_str());
+		printf("%-40s %12s %12s %9s %12s\n", "Benchmark", "Old ns/op",
+			"New ns/op", "Change", "Old allocs");
+		for (unsigned int i = 0; i < results.size(); i++) {
+			const Result &result = results[i];
+			const Json::Value *old = NULL;
+			const Json::Value &benchmarks = doc["benchmarks"];
+			for (Json::Value::const_iterator it = benchmarks.begin();
+			     it != benchmarks.end(); it++)
+			{
+				if ((*it)["name"].asString() == result.name) {
+					old = &(*it);
+					break;
+				}
+			}
+			if (old == NULL) {
+				printf("%-40s %12s %12.1f %9s %12s\n", result.name.c_str(), "-",
+					result.nsPerOp, "new", "-");
+				continue;
+			}
+
+			double oldNsPerOp = (*old)["ns_per_op"].asDouble();
+			double change = (result.nsPerOp - oldNsPerOp) / oldNsPerOp * 100;
+			printf("%-40s %12.1f %12.1f %+8.1f%% %12.2f\n", result.name.c_str(),
+				oldNsPerOp, result.nsPerOp, change,
+				(*old)["allocations_per_op"].asDouble());
+			if (maxRegression >= 0 && change > maxRegression) {
+				ok = false;
+			}
+		}
+		if (!ok) {
+			printf("\nSome benchmarks became more than %.1f%% slower.\n", maxRegression);
+		}
+		return ok;
+	}
+
+public:
+	Runner(int argc, char *argv[])
+		: minTimeNsec(200000000ull),
+		  maxRegression(-1)
+	{
+		for (int i = 1; i < argc; i++) {
+			string arg = argv[i];
+			bool hasValue = i + 1 < argc;
+
+			if (arg == "--filter" && hasValue) {
+				filter = argv[++i];
+			} else if (arg == "--min-time" && hasValue) {
+				minTimeNsec = strtoull(argv[++i], NULL, 10) * 1000000ull;
+			} else if (arg == "--json" && hasValue) {
+				jsonFile = argv[++i];
+			} else if (arg == "--compare" && hasValue) {
+				compareFile = argv[++i];
+			} else if (arg == "--max-regression" && hasValue) {
+				maxRegression = atof(argv[++i]);
+			} else if (arg == "-h" || arg == "--help") {
+				usage(argv[0]);
+				exit(0);
+			} else {
+				fprintf(stderr, "Invalid argument: %s\n", arg.c_str());
+				usage(argv[0]);
+				exit(1);
+			}
+		}
+		printHeader();
+	}
+
+	/**
+	 * Runs the given benchmark. If `bytesPerOp` is given, the throughput
+	 * is reported in MB/s instead of operations per second.
+	 */
+	void run(const string &name, Function func, size_t bytesPerOp = 0) {
+		if (!filter.empty() && name.find(filter) == string::npos) {
+			return;
+		}
+
+		// Warm up caches and lazily initialized data structures.
+		func(1);
+
+		unsigned long long iterations = 1;
+		unsigned long long elapsed, allocationsBefore;
+		while (true) {
+			allocationsBefore = allocations;
+			unsigned long long start = getMonotonicNsec();
+			func(iterations);
+			elapsed = getMonotonicNsec() - start;
+			if (elapsed >= minTimeNsec || iterations >= 1000000000ull) {
+				break;
+			}
+
+			// Aim for 20% over the minimum time, but grow by at most
+			// 100x at a time in case the first runs were too short to
+			// measure accurately.
+			unsigned long long next;
+			if (elapsed == 0) {
+				next = iterations * 100;
+			} else {
+				next = (unsigned long long) (iterations * 1.2 * minTimeNsec / elapsed);
+				if (next > iterations * 100) {
+					next = iterations * 100;
+				}
+			}
+			iterations = (next > iterations) ? next : iterations + 1;
+		}
+
+		Result result;
+		result.name = name;
+		result.iterations = iterations;
+		result.nsPerOp = (double) elapsed / iterations;
+		result.allocationsPerOp = (double) (allocations - allocationsBefore) / iterations;
+		result.bytesPerOp = bytesPerOp;
+		results.push_back(result);
+		printResult(result);
+	}
+
+	/** Writes and compares the results as requested. Returns the exit code. */
+	int finish() {
+		int exitCode = 0;
+		if (!jsonFile.empty() && !writeJson()) {
+			exitCode = 1;
+		}
+		if (!compareFile.empty() && !compare()) {
+			exitCode = 1;
+		}
+		return exitCode;
+	}
+};
+
+
+} // namespace Benchmark
+} // namespace Passenger
+
+
+#ifdef __GLIBC__
+	/*
+	 * Count allocations by interposing glibc's allocation functions. This
+	 * also catches allocations made by C code such as palloc and the mbuf
+	 * pool, which overriding operator new wouldn't.
+	 */
+	extern "C" {
+		void *__libc_malloc(size_t size);
+		void *__libc_calloc(size_t nmemb, size_t size);
+		void *__libc_realloc(void *ptr, size_t size);
+		void *__libc_memalign(size_t alignment, size_t size);
+
+		void *malloc(size_t size) __THROW {
+			Passenger::Benchmark::allocations++;
+			return __libc_malloc(size);
+		}
+
+		void *calloc(size_t nmemb, size_t size) __THROW {
+			Passenger::Benchmark::allocations++;
+			return __libc_calloc(nmemb, size);
+		}
+
+		void *realloc(void *ptr, size_t size) __THROW {
+			Passenger::Benchmark::allocations++;
+			return __libc_realloc(ptr, size);
+		}
+
+		int posix_memalign(void **memptr, size_t alignment, size_t size) __THROW {
+			void *result;
+			Passenger::Benchmark::allocations++;
+			result = __libc_memalign(alignment, size);
+			if (result == NULL) {
+				return ENOMEM;
+			} else {
+				*memptr = result;
+				return 0;
+			}
+		}
+	}
+#else
+	#include <new>
+
+	/* Elsewhere we can only count C++ allocations. */
+	void *operator new(size_t size) throw(std::bad_alloc) {
+		Passenger::Benchmark::allocations++;
+		void *result = malloc(size);
+		if (result == NULL) {
+			throw std::bad_alloc();
+		}
+		return result;
+	}
+
+	void operator delete(void *ptr) throw() {
+		free(ptr);
+	}
+#endif
+
+#endif /* _PASSENGER_BENCHMARK_SUPPORT_H_ */
@@ -0,0 +1,863 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2015 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+
+/*
+ * End-to-end load test for the Core. It starts a Core that serves
+ * CoreLoadTestStubApp, drives it with many concurrent HTTP connections and
+ * reports the throughput and latency percentiles. This is repeated for every
+ * combination of benchmark mode (see RequestHandler::BenchmarkMode), app
+ * protocol and number of Core threads, so that the cost of each request
+ * handling stage can be compared across thread counts.
+ *
+ * Usage: CoreLoadTest [OPTIONS]. Run with --help for the available options.
+ *
+ * Run it from the 'test' directory after building the PassengerAgent, or
+ * use `rake test:cxx:load_test ARGS="..."`. Build with OPTIMIZE=yes to get
+ * numbers that are representative of production builds.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <pwd.h>
+#include <grp.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <deque>
+#include <fstream>
+#include <algorithm>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <ev.h>
+#include <jsoncpp/json.h>
+#include <ServerKit/http_parser.h>
+#include <StaticString.h>
+#include <Utils.h>
+#include <Utils/IOUtils.h>
+#include <Utils/StrIntUtils.h>
+
+using namespace std;
+using namespace Passenger;
+
+
+struct Config {
+	string passengerRoot;
+	string agent;
+	string stubApp;
+	vector<string> modes;
+	vector<string> protocols;
+	vector<unsigned int> coreThreads;
+	unsigned int clientThreads;
+	unsigned int connections;
+	unsigned int pipeline;
+	bool keepAlive;
+	unsigned int requestBodySize;
+	unsigned int responseSize;
+	unsigned int appProcesses;
+	double duration;
+	double warmup;
+	string jsonFile;
+
+	Config()
+		: clientThreads(2),
+		  connections(64),
+		  pipeline(1),
+		  keepAlive(true),
+		  requestBodySize(0),
+		  responseSize(64),
+		  appProcesses(4),
+		  duration(5),
+		  warmup(1)
+		{ }
+};
+
+struct RunResult {
+	string mode;
+	string protocol;
+	unsigned int coreThreads;
+	unsigned long long requests;
+	unsigned long long errors;
+	double duration;
+	unsigned int p50;
+	unsigned int p99;
+	unsigned int p999;
+	unsigned int max;
+
+	double getRequestsPerSec() const {
+		return requests / duration;
+	}
+};
+
+static unsigned long long
+getMonotonicUsec() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+/***** Client *****/
+
+struct Worker;
+
+/**
+ * A client connection. It sends `pipeline` requests at once, waits until
+ * all responses have been received and then sends the next batch, over the
+ * same connection if keep-alive is enabled.
+ */
+struct Connection {
+	Worker *worker;
+	int fd;
+	ev_io io;
+	bool connecting;
+	http_parser parser;
+	string output;
+	size_t outputOffset;
+	deque<unsigned long long> sendTimes;
+	bool closeAfterResponse;
+};
+
+struct Worker {
+	const Config *config;
+	struct sockaddr_in address;
+	string request;
+	struct ev_loop *loop;
+	ev_timer timer;
+	vector<Connection> connections;
+	bool recording;
+	bool stopping;
+
+	vector<unsigned int> latencies;
+	unsigned long long completed;
+	unsigned long long errors;
+	unsigned long long recordingStart;
+	unsigned long long recordingEnd;
+};
+
+static void onConnectionEvent(struct ev_loop *loop, ev_io *io, int revents);
+static void startConnection(Connection *conn);
+
+static int
+onMessageComplete(http_parser *parser) {
+	Connection *conn = (Connection *) parser->data;
+	Worker *worker = conn->worker;
+	unsigned long long now = getMonotonicUsec();
+
+	if (!conn->sendTimes.empty()) {
+		if (worker->recording) {
+			worker->latencies.push_back(now - conn->sendTimes.front());
+			worker->completed++;
+			if (parser->status_code != 200) {
+				worker->errors++;
+			}
+		}
+		conn->sendTimes.pop_front();
+	}
+	if (!http_should_keep_alive(parser)) {
+		conn->closeAfterResponse = true;
+	}
+	return 0;
+}
+
+static http_parser_settings parserSettings;
+
+static void
+closeConnection(Connection *conn) {
+	if (conn->fd != -1) {
+		ev_io_stop(conn->worker->loop, &conn->io);
+		close(conn->fd);
+		conn->fd = -1;
+	}
+}
+
+static void
+failConnection(Connection *conn) {
+	Worker *worker = conn->worker;
+	if (worker->recording) {
+		worker->errors += std::max<size_t>(conn->sendTimes.size(), 1);
+	}
+	closeConnection(conn);
+	if (!worker->stopping) {
+		startConnection(conn);
+	}
+}
+
+static void
+watch(Connection *conn, int events) {
+	ev_io_stop(conn->worker->loop, &conn->io);
+	ev_io_set(&conn->io, conn->fd, events);
+	ev_io_start(conn->worker->loop, &conn->io);
+}
+
+static void
+sendBatch(Connection *conn) {
+	const Worker *worker = conn->worker;
+	unsigned long long now = getMonotonicUsec();
+
+	conn->output.clear();
+	conn->outputOffset = 0;
+	for (unsigned int i = 0; i < worker->config->pipeline; i++) {
+		conn->output.append(worker->request);
+		conn->sendTimes.push_back(now);
+	}
+	watch(conn, EV_WRITE);
+}
+
+static void
+startConnection(Connection *conn) {
+	Worker *worker = conn->worker;
+	int one = 1;
+
+	conn->fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (conn->fd == -1) {
+		perror("socket()");
+		exit(1);
+	}
+	setNonBlocking(conn->fd);
+	setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	conn->connecting = true;
+	conn->closeAfterResponse = false;
+	conn->sendTimes.clear();
+	http_parser_init(&conn->parser, HTTP_RESPONSE);
+	conn->parser.data = conn;
+
+	if (connect(conn->fd, (const struct sockaddr *) &worker->address,
+		sizeof(worker->address)) == -1 && errno != EINPROGRESS)
+	{
+		failConnection(conn);
+		return;
+	}
+	ev_io_init(&conn->io, onConnectionEvent, conn->fd, EV_WRITE);
+	conn->io.data = conn;
+	ev_io_start(worker->loop, &conn->io);
+}
+
+static void
+onWritable(Connection *conn) {
+	if (conn->connecting) {
+		int error = 0;
+		socklen_t len = sizeof(error);
+		getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &error, &len);
+		if (error != 0) {
+			failConnection(conn);
+			return;
+		}
+		conn->connecting = false;
+		sendBatch(conn);
+		return;
+	}
+
+	ssize_t ret = write(conn->fd, conn->output.data() + conn->outputOffset,
+		conn->output.size() - conn->outputOffset);
+	if (ret == -1) {
+		if (errno != EAGAIN && errno != EINTR) {
+			failConnection(conn);
+		}
+		return;
+	}
+	conn->outputOffset += ret;
+	if (conn->outputOffset == conn->output.size()) {
+		watch(conn, EV_READ);
+	}
+}
+
+static void
+onReadable(Connection *conn) {
+	Worker *worker = conn->worker;
+	char buf[1024 * 64];
+	ssize_t ret = read(conn->fd, buf, sizeof(buf));
+
+	if (ret == -1) {
+		if (errno != EAGAIN && errno != EINTR) {
+			failConnection(conn);
+		}
+		return;
+	} else if (ret == 0) {
+		if (conn->sendTimes.empty()) {
+			closeConnection(conn);
+			startConnection(conn);
+		} else {
+			failConnection(conn);
+		}
+		return;
+	}
+
+	size_t parsed = http_parser_execute(&conn->parser, &parserSettings, buf, ret);
+	if (parsed != (size_t) ret || HTTP_PARSER_ERRNO(&conn->parser) != HPE_OK) {
+		failConnection(conn);
+		return;
+	}
+
+	if (conn->sendTimes.empty()) {
+		if (worker->stopping) {
+			closeConnection(conn);
+		} else if (conn->closeAfterResponse || !worker->config->keepAlive) {
+			closeConnection(conn);
+			startConnection(conn);
+		} else {
+			sendBatch(conn);
+		}
+	}
+}
+
+static void
+onConnectionEvent(struct ev_loop *loop, ev_io *io, int revents) {
+	Connection *conn = (Connection *) io->data;
+	if (revents & EV_WRITE) {
+		onWritable(conn);
+	} else if (revents & EV_READ) {
+		onReadable(conn);
+	}
+}
+
+static void
+onTimer(struct ev_loop *loop, ev_timer *timer, int revents) {
+	Worker *worker = (Worker *) timer->data;
+	if (!worker->recording) {
+		// The warm-up has ended.
+		worker->recording = true;
+		worker->recordingStart = getMonotonicUsec();
+		ev_timer_set(timer, worker->config->duration, 0);
+		ev_timer_start(loop, timer);
+	} else {
+		worker->recording = false;
+		worker->stopping = true;
+		worker->recordingEnd = getMonotonicUsec();
+		ev_break(loop, EVBREAK_ALL);
+	}
+}
+
+static void
+runWorker(Worker *worker, unsigned int nconnections) {
+	worker->loop = ev_loop_new(EVFLAG_AUTO);
+	worker->recording = false;
+	worker->stopping = false;
+	worker->completed = 0;
+	worker->errors = 0;
+	worker->connections.resize(nconnections);
+
+	ev_timer_init(&worker->timer, onTimer, worker->config->warmup, 0);
+	worker->timer.data = worker;
+	ev_timer_start(worker->loop, &worker->timer);
+	for (unsigned int i = 0; i < nconnections; i++) {
+		worker->connections[i].worker = worker;
+		worker->connections[i].fd = -1;
+		startConnection(&worker->connections[i]);
+	}
+
+	ev_run(worker->loop, 0);
+
+	for (unsigned int i = 0; i < nconnections; i++) {
+		closeConnection(&worker->connections[i]);
+	}
+	ev_loop_destroy(worker->loop);
+}
+
+static string
+createRequest(const Config &config) {
+	string request;
+	if (config.requestBodySize > 0) {
+		request.append("POST /load_test HTTP/1.1\r\n");
+	} else {
+		request.append("GET /load_test HTTP/1.1\r\n");
+	}
+	request.append("Host: localhost\r\n"
+		"User-Agent: CoreLoadTest\r\n");
+	if (!config.keepAlive) {
+		request.append("Connection: close\r\n");
+	}
+	if (config.requestBodySize > 0) {
+		request.append("Content-Type: application/octet-stream\r\n"
+			"Content-Length: " + toString(config.requestBodySize) + "\r\n");
+	}
+	request.append("\r\n");
+	request.append(config.requestBodySize, 'x');
+	return request;
+}
+
+static unsigned int
+getPercentile(const vector<unsigned int> &sorted, double percentile) {
+	if (sorted.empty()) {
+		return 0;
+	}
+	size_t index = (size_t) (sorted.size() * percentile / 100.0 + 0.5);
+	if (index > 0) {
+		index--;
+	}
+	return sorted[std::min(index, sorted.size() - 1)];
+}
+
+static void
+runLoad(const Config &config, unsigned short port, RunResult &result) {
+	vector<Worker> workers(config.clientThreads);
+	boost::thread_group threads;
+	string request = createRequest(config);
+	unsigned long long start = 0, end = 0;
+
+	for (unsigned int i = 0; i < workers.size(); i++) {
+		Worker &worker = workers[i];
+		worker.config = &config;
+		worker.request = request;
+		memset(&worker.address, 0, sizeof(worker.address));
+		worker.address.sin_family = AF_INET;
+		worker.address.sin_port = htons(port);
+		worker.address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+		// Distribute the connections as evenly as possible.
+		unsigned int nconnections = config.connections / workers.size();
+		if (i < config.connections % workers.size()) {
+			nconnections++;
+		}
+		threads.create_thread(boost::bind(runWorker, &worker, nconnections));
+	}
+	threads.join_all();
+
+	vector<unsigned int> latencies;
+	result.requests = 0;
+	result.errors = 0;
+	for (unsigned int i = 0; i < workers.size(); i++) {
+		const Worker &worker = workers[i];
+		latencies.insert(latencies.end(), worker.latencies.begin(),
+			worker.latencies.end());
+		result.requests += worker.completed;
+		result.errors += worker.errors;
+		if (start == 0 || worker.recordingStart < start) {
+			start = worker.recordingStart;
+		}
+		if (worker.recordingEnd > end) {
+			end = worker.recordingEnd;
+		}
+	}
+
+	std::sort(latencies.begin(), latencies.end());
+	result.duration = (end - start) / 1000000.0;
+	result.p50  = getPercentile(latencies, 50);
+	result.p99  = getPercentile(latencies, 99);
+	result.p999 = getPercentile(latencies, 99.9);
+	result.max  = latencies.empty() ? 0 : latencies.back();
+}
+
+
+/***** Core management *****/
+
+static unsigned short
+findFreePort() {
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (fd == -1 || ::bind(fd, (const struct sockaddr *) &addr, sizeof(addr)) == -1
+	 || getsockname(fd, (struct sockaddr *) &addr, &len) == -1)
+	{
+		perror("Cannot find a free port");
+		exit(1);
+	}
+	close(fd);
+	return ntohs(addr.sin_port);
+}
+
+static pid_t
+startCore(const Config &config, const string &appRoot, const string &logFile,
+	const string &mode, const string &protocol, unsigned int coreThreads,
+	unsigned short port)
+{
+	struct passwd *pwUser = getpwuid(getuid());
+	struct group *grGroup = getgrgid(getgid());
+	vector<string> args;
+
+	args.push_back(config.agent);
+	args.push_back("core");
+	args.push_back("--passenger-root");
+	args.push_back(config.passengerRoot);
+	args.push_back("--listen");
+	args.push_back("tcp://127.0.0.1:" + toString(port));
+	args.push_back("--threads");
+	args.push_back(toString(coreThreads));
+	if (mode != "none") {
+		args.push_back("--benchmark");
+		args.push_back(mode);
+	}
+	args.push_back("--app-type");
+	args.push_back("wsgi");
+	args.push_back("--startup-file");
+	args.push_back("passenger_wsgi.py");
+	args.push_back("--python");
+	args.push_back(config.stubApp);
+	args.push_back("--spawn-method");
+	args.push_back("direct");
+	args.push_back("--min-instances");
+	args.push_back(toString(config.appProcesses));
+	args.push_back("--max-pool-size");
+	args.push_back(toString(config.appProcesses));
+	args.push_back("--disable-turbocaching");
+	args.push_back("--disable-selfchecks");
+	args.push_back("--no-graceful-exit");
+	if (pwUser != NULL) {
+		args.push_back("--default-user");
+		args.push_back(pwUser->pw_name);
+	}
+	if (grGroup != NULL) {
+		args.push_back("--default-group");
+		args.push_back(grGroup->gr_name);
+	}
+	args.push_back(appRoot);
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		vector<const char *> argv;
+		for (unsigned int i = 0; i < args.size(); i++) {
+			argv.push_back(args[i].c_str());
+		}
+		argv.push_back(NULL);
+
+		int fd = open(logFile.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+		if (fd != -1) {
+			dup2(fd, 1);
+			dup2(fd, 2);
+			close(fd);
+		}
+		setenv("PASSENGER_LOAD_TEST_PROTOCOL", protocol.c_str(), 1);
+		setenv("PASSENGER_LOAD_TEST_RESPONSE_SIZE",
+			toString(config.responseSize).c_str(), 1);
+		setenv("PASSENGER_LOAD_TEST_SOCKET_DIR", appRoot.c_str(), 1);
+		execv(argv[0], (char * const *) &argv[0]);
+		int e = errno;
+		fprintf(stderr, "Cannot execute %s: %s\n", argv[0], strerror(e));
+		_exit(1);
+	} else if (pid == -1) {
+		perror("fork()");
+		exit(1);
+	}
+	return pid;
+}
+
+static bool
+waitForCore(pid_t pid, unsigned short port) {
+	struct sockaddr_in addr;
+	unsigned long long deadline = getMonotonicUsec() + 30 * 1000000ull;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	while (getMonotonicUsec() < deadline) {
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+		int ret = connect(fd, (const struct sockaddr *) &addr, sizeof(addr));
+		close(fd);
+		if (ret == 0) {
+			return true;
+		} else if (waitpid(pid, NULL, WNOHANG) == pid) {
+			return false;
+		}
+		usleep(20000);
+	}
+	return false;
+}
+
+static void
+stopCore(pid_t pid) {
+	unsigned long long deadline = getMonotonicUsec() + 10 * 1000000ull;
+
+	kill(pid, SIGTERM);
+	while (getMonotonicUsec() < deadline) {
+		if (waitpid(pid, NULL, WNOHANG) == pid) {
+			return;
+		}
+		usleep(20000);
+	}
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+}
+
+
+/***** Reporting *****/
+
+static void
+printHeader() {
+	printf("%-16s %-13s %7s %12s %9s %9s %9s %9s %8s\n",
+		"Mode", "Protocol", "Threads", "Requests/s", "p50 (us)", "p99 (us)",
+		"p999 (us)", "max (us)", "Errors");
+}
+
+static void
+printResult(const RunResult &result) {
+	printf("%-16s %-13s %7u %12.0f %9u %9u %9u %9u %8llu\n",
+		result.mode.c_str(), result.protocol.c_str(), result.coreThreads,
+		result.getRequestsPerSec(), result.p50, result.p99, result.p999,
+		result.max, result.errors);
+	fflush(stdout);
+}
+
+static bool
+writeJson(const Config &config, const vector<RunResult> &results) {
+	Json::Value doc;
+	Json::Value runs(Json::arrayValue);
+
+	doc["connections"] = config.connections;
+	doc["client_threads"] = config.clientThreads;
+	doc["pipeline"] = config.pipeline;
+	doc["keep_alive"] = config.keepAlive;
+	doc["request_body_size"] = config.requestBodySize;
+	doc["response_size"] = config.responseSize;
+	doc["app_processes"] = config.appProcesses;
+	doc["duration"] = config.duration;
+	for (unsigned int i = 0; i < results.size(); i++) {
+		const RunResult &result = results[i];
+		Json::Value run;
+		run["mode"] = result.mode;
+		run["protocol"] = result.protocol;
+		run["core_threads"] = result.coreThreads;
+		run["requests"] = (Json::UInt64) result.requests;
+		run["errors"] = (Json::UInt64) result.errors;
+		run["requests_per_sec"] = result.getRequestsPerSec();
+		run["latency_p50_usec"] = result.p50;
+		run["latency_p99_usec"] = result.p99;
+		run["latency_p999_usec"] = result.p999;
+		run["latency_max_usec"] = result.max;
+		runs.append(run);
+	}
+	doc["runs"] = runs;
+
+	ofstream stream(config.jsonFile.c_str());
+	stream << doc.toStyledString();
+	return stream.good();
+}
+
+
+/***** Main *****/
+
+static void
+usage(const char *program) {
+	printf("Usage: %s [OPTIONS]\n", program);
+	printf("Starts a Core for every combination of benchmark mode, protocol and\n");
+	printf("number of Core threads, and load tests it.\n\n");
+	printf("  --passenger-root DIR     Default: ..\n");
+	printf("  --agent PATH             Default: <passenger root>/buildout/support-binaries/PassengerAgent\n");
+	printf("  --stub-app PATH          Default: CoreLoadTestStubApp next to this program\n");
+	printf("  --modes LIST             Comma-separated benchmark modes. 'none' runs\n");
+	printf("                           requests through the app. Default:\n");
+	printf("                           none,after_accept,before_checkout,after_checkout,response_begin\n");
+	printf("  --protocols LIST         App protocols: session, http_session.\n");
+	printf("                           Default: session,http_session\n");
+	printf("  --threads LIST           Core thread counts to sweep. Default: 1,2,4\n");
+	printf("  --client-threads N       Client event loop threads. Default: 2\n");
+	printf("  --connections N          Concurrent client connections. Default: 64\n");
+	printf("  --pipeline N             Requests to pipeline per connection. Default: 1\n");
+	printf("  --no-keep-alive          Open a new connection for every request\n");
+	printf("  --body-size BYTES        Send POST requests with a body of this size.\n");
+	printf("                           Default: 0 (GET requests)\n");
+	printf("  --response-size BYTES    App response body size. Default: 64\n");
+	printf("  --app-processes N        Number of app processes. Default: 4\n");
+	printf("  --duration SEC           Measurement time per run. Default: 5\n");
+	printf("  --warmup SEC             Warm-up time per run. Default: 1\n");
+	printf("  --json FILE              Write the results to FILE as JSON\n");
+	printf("  -h, --help               Show this help\n");
+}
+
+static vector<string>
+parseList(const string &value) {
+	vector<string> result;
+	split(value, ',', result);
+	result.erase(std::remove(result.begin(), result.end(), string()), result.end());
+	return result;
+}
+
+static void
+parseOptions(int argc, char *argv[], Config &config) {
+	string dir = extractDirName(argv[0]);
+
+	config.passengerRoot = "..";
+	config.modes = parseList("none,after_accept,before_checkout,after_checkout,response_begin");
+	config.protocols = parseList("session,http_session");
+	config.coreThreads.push_back(1);
+	config.coreThreads.push_back(2);
+	config.coreThreads.push_back(4);
+
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+
+		if (arg == "--passenger-root" && hasValue) {
+			config.passengerRoot = argv[++i];
+		} else if (arg == "--agent" && hasValue) {
+			config.agent = argv[++i];
+		} else if (arg == "--stub-app" && hasValue) {
+			config.stubApp = argv[++i];
+		} else if (arg == "--modes" && hasValue) {
+			config.modes = parseList(argv[++i]);
+		} else if (arg == "--protocols" && hasValue) {
+			config.protocols = parseList(argv[++i]);
+		} else if (arg == "--threads" && hasValue) {
+			vector<string> values = parseList(argv[++i]);
+			config.coreThreads.clear();
+			for (unsigned int j = 0; j < values.size(); j++) {
+				config.coreThreads.push_back(std::max(1, atoi(values[j].c_str())));
+			}
+		} else if (arg == "--client-threads" && hasValue) {
+			config.clientThreads = std::max(1, atoi(argv[++i]));
+		} else if (arg == "--connections" && hasValue) {
+			config.connections = std::max(1, atoi(argv[++i]));
+		} else if (arg == "--pipeline" && hasValue) {
+			config.pipeline = std::max(1, atoi(argv[++i]));
+		} else if (arg == "--no-keep-alive") {
+			config.keepAlive = false;
+		} else if (arg == "--body-size" && hasValue) {
+			config.requestBodySize = std::max(0, atoi(argv[++i]));
+		} else if (arg == "--response-size" && hasValue) {
+			config.responseSize = std::max(0, atoi(argv[++i]));
+		} else if (arg == "--app-processes" && hasValue) {
+			config.appProcesses = std::max(1, atoi(argv[++i]));
+		} else if (arg == "--duration" && hasValue) {
+			config.duration = atof(argv[++i]);
+		} else if (arg == "--warmup" && hasValue) {
+			config.warmup = atof(argv[++i]);
+		} else if (arg == "--json" && hasValue) {
+			config.jsonFile = argv[++i];
+		} else if (arg == "-h" || arg == "--help") {
+			usage(argv[0]);
+			exit(0);
+		} else {
+			fprintf(stderr, "Invalid argument: %s\n", argv[i]);
+			usage(argv[0]);
+			exit(1);
+		}
+	}
+
+	config.passengerRoot = absolutizePath(config.passengerRoot);
+	if (config.agent.empty()) {
+		config.agent = config.passengerRoot + "/buildout/support-binaries/PassengerAgent";
+	}
+	if (config.stubApp.empty()) {
+		config.stubApp = dir + "/CoreLoadTestStubApp";
+	}
+	config.agent = absolutizePath(config.agent);
+	config.stubApp = absolutizePath(config.stubApp);
+	if (!config.keepAlive && config.pipeline > 1) {
+		fprintf(stderr, "--pipeline requires keep-alive connections\n");
+		exit(1);
+	}
+	if (config.duration <= 0 || config.warmup <= 0) {
+		fprintf(stderr, "--duration and --warmup must be positive\n");
+		exit(1);
+	}
+	if (config.modes.empty() || config.protocols.empty() || config.coreThreads.empty()) {
+		fprintf(stderr, "--modes, --protocols and --threads may not be empty\n");
+		exit(1);
+	}
+}
+
+/**
+ * The protocol only makes a difference in the modes in which requests are
+ * forwarded to the app.
+ */
+static bool
+modeUsesAppProtocol(const string &mode) {
+	return mode == "none" || mode == "response_begin";
+}
+
+int
+main(int argc, char *argv[]) {
+	Config config;
+	vector<RunResult> results;
+	char tmpDir[] = "/tmp/passenger-load-test.XXXXXX";
+	bool ok = true;
+
+	parseOptions(argc, argv, config);
+	signal(SIGPIPE, SIG_IGN);
+	parserSettings.on_message_complete = onMessageComplete;
+
+	if (mkdtemp(tmpDir) == NULL) {
+		perror("mkdtemp()");
+		return 1;
+	}
+	string appRoot = tmpDir;
+	string startupFile = appRoot + "/passenger_wsgi.py";
+	string logFile = appRoot + "/core.log";
+	createFile(startupFile, "# Placeholder; the app is CoreLoadTestStubApp.\n");
+
+	printf("Connections: %u (%u client threads), pipeline: %u, keep-alive: %s, "
+		"request body: %u bytes, response body: %u bytes, app processes: %u\n\n",
+		config.connections, config.clientThreads, config.pipeline,
+		config.keepAlive ? "yes" : "no", config.requestBodySize,
+		config.responseSize, config.appProcesses);
+	printHeader();
+
+	for (unsigned int m = 0; m < config.modes.size() && ok; m++) {
+		const string &mode = config.modes[m];
+		unsigned int nprotocols = modeUsesAppProtocol(mode) ? config.protocols.size() : 1;
+
+		for (unsigned int p = 0; p < nprotocols && ok; p++) {
+			const string &protocol = config.protocols[p];
+
+			for (unsigned int t = 0; t < config.coreThreads.size() && ok; t++) {
+				unsigned short port = findFreePort();
+				pid_t pid = startCore(config, appRoot, logFile, mode, protocol,
+					config.coreThreads[t], port);
+				if (!waitForCore(pid, port)) {
+					fprintf(stderr, "The Core did not start. See %s\n", logFile.c_str());
+					stopCore(pid);
+					ok = false;
+					break;
+				}
+
+				RunResult result;
+				result.mode = mode;
+				result.protocol = modeUsesAppProtocol(mode) ? protocol : "-";
+				result.coreThreads = config.coreThreads[t];
+				runLoad(config, port, result);
+				stopCore(pid);
+				printResult(result);
+				results.push_back(result);
+			}
+		}
+	}
+
+	if (ok && !config.jsonFile.empty() && !writeJson(config, results)) {
+		fprintf(stderr, "Cannot write %s\n", config.jsonFile.c_str());
+		ok = false;
+	}
+	if (ok) {
+		// Also removes sockets left behind by app processes.
+		removeDirTree(appRoot);
+	}
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,312 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2015 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+
+/*
+ * A minimal native application for CoreLoadTest. It performs the SpawningKit
+ * startup handshake and then serves every request with a fixed response, so
+ * that load tests measure the Core rather than a language runtime.
+ *
+ * CoreLoadTest runs the Core with `--app-type wsgi --python <this binary>`,
+ * so the first argument (the path to wsgi-loader.py) is ignored. The
+ * following environment variables are inherited from the Core:
+ *
+ *   PASSENGER_LOAD_TEST_PROTOCOL       'session' (default) or 'http_session'
+ *   PASSENGER_LOAD_TEST_RESPONSE_SIZE  Response body size in bytes (default 64)
+ *   PASSENGER_LOAD_TEST_SOCKET_DIR     Where to create the socket, if the
+ *                                      Core doesn't pass a socket_dir
+ *
+ * Like the bundled loaders, it handles one connection at a time and exits
+ * when its stdin (the owner pipe) is closed.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+using namespace std;
+
+static string protocol;
+static string response;
+static string socketFilename;
+
+
+static bool
+readExact(int fd, char *buf, size_t size) {
+	while (size > 0) {
+		ssize_t ret = read(fd, buf, size);
+		if (ret == -1 && errno == EINTR) {
+			continue;
+		} else if (ret <= 0) {
+			return false;
+		}
+		buf += ret;
+		size -= ret;
+	}
+	return true;
+}
+
+static bool
+writeExact(int fd, const char *buf, size_t size) {
+	while (size > 0) {
+		ssize_t ret = write(fd, buf, size);
+		if (ret == -1 && errno == EINTR) {
+			continue;
+		} else if (ret == -1) {
+			return false;
+		}
+		buf += ret;
+		size -= ret;
+	}
+	return true;
+}
+
+static bool
+discardBody(int fd, size_t size) {
+	char buf[1024 * 16];
+	while (size > 0) {
+		ssize_t ret = read(fd, buf, std::min(size, sizeof(buf)));
+		if (ret == -1 && errno == EINTR) {
+			continue;
+		} else if (ret <= 0) {
+			return false;
+		}
+		size -= ret;
+	}
+	return true;
+}
+
+/**
+ * Reads a request in the 'session' protocol: a 32-bit big endian header size,
+ * followed by NUL-separated key-value pairs, followed by the body.
+ */
+static bool
+readSessionRequest(int fd) {
+	unsigned char sizeBuf[4];
+	if (!readExact(fd, (char *) sizeBuf, 4)) {
+		return false;
+	}
+
+	size_t size = ((size_t) sizeBuf[0] << 24) | ((size_t) sizeBuf[1] << 16)
+		| ((size_t) sizeBuf[2] << 8) | (size_t) sizeBuf[3];
+	string header(size, '\0');
+	if (!readExact(fd, &header[0], size)) {
+		return false;
+	}
+
+	size_t pos = 0;
+	size_t contentLength = 0;
+	while (pos < header.size()) {
+		const char *key = header.c_str() + pos;
+		const char *value = key + strlen(key) + 1;
+		if (value >= header.c_str() + header.size()) {
+			break;
+		}
+		if (strcmp(key, "CONTENT_LENGTH") == 0) {
+			contentLength = strtoul(value, NULL, 10);
+		}
+		pos = (value + strlen(value) + 1) - header.c_str();
+	}
+	return discardBody(fd, contentLength);
+}
+
+/**
+ * Reads a request in the 'http_session' protocol. The Core sends request
+ * bodies either with a Content-Length or not at all, because it dechunks
+ * bodies before forwarding them.
+ */
+static bool
+readHttpRequest(int fd) {
+	string buf;
+	string::size_type end;
+	char tmp[1024 * 8];
+
+	while ((end = buf.find("\r\n\r\n")) == string::npos) {
+		ssize_t ret = read(fd, tmp, sizeof(tmp));
+		if (ret == -1 && errno == EINTR) {
+			continue;
+		} else if (ret <= 0) {
+			return false;
+		}
+		buf.append(tmp, ret);
+	}
+	end += 4;
+
+	size_t contentLength = 0;
+	string::size_type pos = buf.find("\r\n");
+	while (pos != string::npos && pos + 2 < end) {
+		pos += 2;
+		if (strncasecmp(buf.c_str() + pos, "content-length:", 15) == 0) {
+			contentLength = strtoul(buf.c_str() + pos + 15, NULL, 10);
+		}
+		pos = buf.find("\r\n", pos);
+	}
+
+	size_t alreadyRead = buf.size() - end;
+	if (alreadyRead >= contentLength) {
+		return true;
+	} else {
+		return discardBody(fd, contentLength - alreadyRead);
+	}
+}
+
+static void
+handleConnection(int fd) {
+	bool ok;
+	if (protocol == "http_session") {
+		ok = readHttpRequest(fd);
+	} else {
+		ok = readSessionRequest(fd);
+	}
+	if (ok) {
+		writeExact(fd, response.data(), response.size());
+	}
+	shutdown(fd, SHUT_WR);
+	close(fd);
+}
+
+static void
+handshake() {
+	char line[1024 * 4];
+	const char *defaultSocketDir = getenv("PASSENGER_LOAD_TEST_SOCKET_DIR");
+	string socketDir = (defaultSocketDir != NULL && *defaultSocketDir != '\0')
+		? defaultSocketDir
+		: "/tmp";
+
+	printf("!> I have control 1.0\n");
+	fflush(stdout);
+	if (fgets(line, sizeof(line), stdin) == NULL
+	 || strcmp(line, "You have control 1.0\n") != 0)
+	{
+		fprintf(stderr, "Invalid initialization header\n");
+		exit(1);
+	}
+	while (fgets(line, sizeof(line), stdin) != NULL && strcmp(line, "\n") != 0) {
+		if (strncmp(line, "socket_dir: ", sizeof("socket_dir: ") - 1) == 0) {
+			socketDir.assign(line + sizeof("socket_dir: ") - 1);
+			socketDir.erase(socketDir.size() - 1);
+		}
+	}
+
+	char name[128];
+	snprintf(name, sizeof(name), "/loadtest.%d", (int) getpid());
+	socketFilename = socketDir + name;
+}
+
+static int
+createServerSocket() {
+	struct sockaddr_un addr;
+	int fd;
+
+	if (socketFilename.size() >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Socket filename too long: %s\n", socketFilename.c_str());
+		exit(1);
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socketFilename.c_str());
+
+	unlink(socketFilename.c_str());
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1 || bind(fd, (const struct sockaddr *) &addr, sizeof(addr)) == -1
+	 || listen(fd, 1024) == -1)
+	{
+		perror("Cannot create server socket");
+		exit(1);
+	}
+	return fd;
+}
+
+int
+main(int argc, char *argv[]) {
+	const char *value;
+	unsigned int responseSize = 64;
+	char header[256];
+
+	signal(SIGPIPE, SIG_IGN);
+	value = getenv("PASSENGER_LOAD_TEST_PROTOCOL");
+	protocol = (value != NULL && *value != '\0') ? value : "session";
+	value = getenv("PASSENGER_LOAD_TEST_RESPONSE_SIZE");
+	if (value != NULL && *value != '\0') {
+		responseSize = atoi(value);
+	}
+
+	snprintf(header, sizeof(header),
+		"HTTP/1.1 200 OK\r\n"
+		"Status: 200 OK\r\n"
+		"Content-Type: text/plain\r\n"
+		"Content-Length: %u\r\n"
+		"Connection: close\r\n\r\n",
+		responseSize);
+	response.assign(header);
+	response.append(responseSize, 'x');
+
+	handshake();
+	int serverFd = createServerSocket();
+	printf("!> Ready\n");
+	printf("!> socket: main;unix:%s;%s;1\n", socketFilename.c_str(),
+		protocol.c_str());
+	printf("!> \n");
+	fflush(stdout);
+
+	while (true) {
+		struct pollfd fds[2];
+		fds[0].fd = serverFd;
+		fds[0].events = POLLIN;
+		fds[1].fd = STDIN_FILENO;
+		fds[1].events = POLLIN;
+		if (poll(fds, 2, -1) == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+
+		if (fds[1].revents != 0) {
+			char buf[64];
+			if (read(STDIN_FILENO, buf, sizeof(buf)) <= 0) {
+				// The Core has closed the owner pipe.
+				break;
+			}
+		}
+		if (fds[0].revents & POLLIN) {
+			int fd = accept(serverFd, NULL, NULL);
+			if (fd != -1) {
+				handleConnection(fd);
+			}
+		}
+	}
+
+	unlink(socketFilename.c_str());
+	return 0;
+}
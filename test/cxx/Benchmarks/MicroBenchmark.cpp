@@ -0,0 +1,438 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2015 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+
+/*
+ * Micro-benchmarks for the data structures and utilities that are used on
+ * every request: HTTP header parsing, HeaderTable, StringKeyTable, palloc,
+ * mbufs, the response cache, integer formatting and date handling.
+ *
+ * Usage: MicroBenchmark [--filter TEXT] [--min-time MSEC] [--json FILE]
+ *                       [--compare FILE] [--max-regression PCT]
+ *
+ * To check a change for regressions, run with `--json before.json` on the
+ * old commit and with `--compare before.json` on the new one. The
+ * `test:cxx:microbenchmark` Rake task does the same through the FILTER, JSON,
+ * COMPARE and MAX_REGRESSION environment variables. Build with OPTIMIZE=yes
+ * to get numbers that are representative of production builds.
+ */
+
+#include <time.h>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <ev++.h>
+#include <ServerKit/Context.h>
+#include <ServerKit/HttpRequest.h>
+#include <ServerKit/HttpHeaderParser.h>
+#include <ServerKit/HeaderTable.h>
+#include <MemoryKit/mbuf.h>
+#include <MemoryKit/palloc.h>
+#include <DataStructures/StringKeyTable.h>
+#include <Core/RequestHandler/Request.h>
+#include <Core/ResponseCache.h>
+#include <Utils/StrIntUtils.h>
+#include <Utils/DateParsing.h>
+#include "BenchmarkSupport.h"
+
+using namespace std;
+using namespace Passenger;
+using namespace Passenger::ServerKit;
+
+static ServerKit::Context *context;
+
+
+/***** HTTP header parsing *****/
+
+static const char REQUEST_HEADER[] =
+	"GET /api/v1/users/123.json?fields=name,email HTTP/1.1\r\n"
+	"Host: www.example.com\r\n"
+	"User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:42.0) Gecko/20100101 Firefox/42.0\r\n"
+	"Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+	"Accept-Language: en-US,en;q=0.5\r\n"
+	"Accept-Encoding: gzip, deflate\r\n"
+	"Referer: https://www.example.com/users\r\n"
+	"Cookie: _session_id=0123456789abcdef0123456789abcdef; locale=en\r\n"
+	"Connection: keep-alive\r\n"
+	"Cache-Control: max-age=0\r\n"
+	"\r\n";
+
+static void
+deinitializeHeaders(HeaderTable &headers) {
+	HeaderTable::Iterator it(headers);
+	while (*it != NULL) {
+		psg_lstr_deinit(&it->header->key);
+		psg_lstr_deinit(&it->header->origKey);
+		psg_lstr_deinit(&it->header->val);
+		it.next();
+	}
+	headers.clear();
+}
+
+static void
+benchmarkHttpHeaderParser(unsigned long long iterations) {
+	BaseHttpRequest req;
+	HttpHeaderParserState state;
+	MemoryKit::mbuf buffer(MemoryKit::mbuf_get(&context->mbuf_pool));
+
+	memcpy(buffer.start, REQUEST_HEADER, sizeof(REQUEST_HEADER) - 1);
+	buffer = MemoryKit::mbuf(buffer, 0, sizeof(REQUEST_HEADER) - 1);
+	req.pool = psg_create_pool(PSG_DEFAULT_POOL_SIZE);
+	req.parserState.headerParser = &state;
+
+	for (unsigned long long i = 0; i < iterations; i++) {
+		req.httpState = BaseHttpRequest::PARSING_HEADERS;
+		req.bodyType  = BaseHttpRequest::RBT_NO_BODY;
+		ServerKit::HttpHeaderParser<BaseHttpRequest> parser(context, &state, &req, req.pool);
+		parser.initialize();
+		Benchmark::doNotOptimize(parser.feed(buffer));
+		if (req.httpState != BaseHttpRequest::COMPLETE) {
+			fprintf(stderr, "Cannot parse the request header\n");
+			abort();
+		}
+
+		psg_lstr_deinit(&req.path);
+		deinitializeHeaders(req.headers);
+		deinitializeHeaders(req.secureHeaders);
+		psg_reset_pool(req.pool, PSG_DEFAULT_POOL_SIZE);
+	}
+
+	psg_destroy_pool(req.pool);
+}
+
+
+/***** HeaderTable *****/
+
+static const char *HEADER_NAMES[] = {
+	"host", "user-agent", "accept", "accept-language", "accept-encoding",
+	"referer", "cookie", "connection", "cache-control", "x-forwarded-for",
+	"x-forwarded-proto", "x-request-id", "content-type", "content-length",
+	"if-none-match", "if-modified-since"
+};
+static const unsigned int NHEADER_NAMES = sizeof(HEADER_NAMES) / sizeof(const char *);
+
+static void
+benchmarkHeaderTableInsert(unsigned long long iterations) {
+	psg_pool_t *pool = psg_create_pool(PSG_DEFAULT_POOL_SIZE);
+	HeaderTable table;
+
+	for (unsigned long long i = 0; i < iterations; i++) {
+		for (unsigned int j = 0; j < NHEADER_NAMES; j++) {
+			table.insert(pool, HEADER_NAMES[j], "value");
+		}
+		table.clear();
+		psg_reset_pool(pool, PSG_DEFAULT_POOL_SIZE);
+	}
+
+	psg_destroy_pool(pool);
+}
+
+static void
+benchmarkHeaderTableLookup(unsigned long long iterations) {
+	psg_pool_t *pool = psg_create_pool(PSG_DEFAULT_POOL_SIZE);
+	HeaderTable table;
+	vector<HashedStaticString> keys;
+
+	for (unsigned int j = 0; j < NHEADER_NAMES; j++) {
+		table.insert(pool, HEADER_NAMES[j], "value");
+		keys.push_back(HEADER_NAMES[j]);
+	}
+	for (unsigned long long i = 0; i < iterations; i++) {
+		Benchmark::doNotOptimize(table.lookup(keys[i % NHEADER_NAMES]));
+	}
+
+	psg_destroy_pool(pool);
+}
+
+static void
+benchmarkHeaderTableLookupMiss(unsigned long long iterations) {
+	psg_pool_t *pool = psg_create_pool(PSG_DEFAULT_POOL_SIZE);
+	HeaderTable table;
+	HashedStaticString key("x-sendfile");
+
+	for (unsigned int j = 0; j < NHEADER_NAMES; j++) {
+		table.insert(pool, HEADER_NAMES[j], "value");
+	}
+	for (unsigned long long i = 0; i < iterations; i++) {
+		Benchmark::doNotOptimize(table.lookup(key));
+	}
+
+	psg_destroy_pool(pool);
+}
+
+
+/***** StringKeyTable *****/
+
+static void
+benchmarkStringKeyTableInsert(unsigned long long iterations) {
+	StringKeyTable<int> table;
+
+	for (unsigned long long i = 0; i < iterations; i++) {
+		for (unsigned int j = 0; j < NHEADER_NAMES; j++) {
+			table.insert(HEADER_NAMES[j], j);
+		}
+		table.clear();
+	}
+}
+
+static void
+benchmarkStringKeyTableLookup(unsigned long long iterations) {
+	StringKeyTable<int> table;
+	vector<HashedStaticString> keys;
+	const int *value;
+
+	for (unsigned int j = 0; j < NHEADER_NAMES; j++) {
+		table.insert(HEADER_NAMES[j], j);
+		keys.push_back(HEADER_NAMES[j]);
+	}
+	for (unsigned long long i = 0; i < iterations; i++) {
+		Benchmark::doNotOptimize(table.lookup(keys[i % NHEADER_NAMES], &value));
+	}
+}
+
+
+/***** palloc *****/
+
+static void
+benchmarkPalloc(unsigned long long iterations) {
+	psg_pool_t *pool = psg_create_pool(PSG_DEFAULT_POOL_SIZE);
+
+	for (unsigned long long i = 0; i < iterations; i++) {
+		Benchmark::doNotOptimize(psg_palloc(pool, 64));
+		// Mimic a request's lifetime: a couple of hundred allocations
+		// followed by a reset.
+		if (i % 256 == 255) {
+			psg_reset_pool(pool, PSG_DEFAULT_POOL_SIZE);
+		}
+	}
+
+	psg_destroy_pool(pool);
+}
+
+static void
+benchmarkPoolCreateDestroy(unsigned long long iterations) {
+	for (unsigned long long i = 0; i < iterations; i++) {
+		psg_pool_t *pool = psg_create_pool(PSG_DEFAULT_POOL_SIZE);
+		Benchmark::doNotOptimize(psg_palloc(pool, 64));
+		psg_destroy_pool(pool);
+	}
+}
+
+
+/***** mbuf *****/
+
+static void
+benchmarkMbufBlockGetUnref(unsigned long long iterations) {
+	for (unsigned long long i = 0; i < iterations; i++) {
+		MemoryKit::mbuf_block *block = MemoryKit::mbuf_block_get(&context->mbuf_pool);
+		Benchmark::doNotOptimize(block);
+		MemoryKit::mbuf_block_unref(block);
+	}
+}
+
+static void
+benchmarkMbufGetSlice(unsigned long long iterations) {
+	for (unsigned long long i = 0; i < iterations; i++) {
+		MemoryKit::mbuf buffer(MemoryKit::mbuf_get(&context->mbuf_pool));
+		MemoryKit::mbuf slice(buffer, 0, 100);
+		Benchmark::doNotOptimize(slice.start);
+	}
+}
+
+
+/***** ResponseCache *****/
+
+typedef ResponseCache<Request> ResponseCacheType;
+
+struct ResponseCacheBenchmarkHandler {
+	StaticString defaultVaryTurbocacheByCookie;
+};
+
+static LString *
+createLString(psg_pool_t *pool, const StaticString &value) {
+	LString *str = (LString *) psg_palloc(pool, sizeof(LString));
+	psg_lstr_init(str);
+	psg_lstr_append(str, pool, value.data(), value.size());
+	return str;
+}
+
+static void
+initializeCacheableRequest(Request &req, char *date, size_t dateSize) {
+	time_t now = time(NULL);
+	struct tm tm;
+
+	req.pool = psg_create_pool(PSG_DEFAULT_POOL_SIZE);
+	req.httpMajor = 1;
+	req.httpMinor = 1;
+	req.httpState = Request::COMPLETE;
+	req.bodyType  = Request::RBT_NO_BODY;
+	req.method    = HTTP_GET;
+	req.https     = false;
+	req.host      = createLString(req.pool, "www.example.com");
+	req.cacheControl = NULL;
+	req.varyCookie   = NULL;
+	req.hasPragmaHeader = false;
+	psg_lstr_append(&req.path, req.pool, "/api/v1/users/123.json");
+
+	gmtime_r(&now, &tm);
+	dateSize = strftime(date, dateSize, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+	req.appResponse.statusCode = 200;
+	req.appResponse.date = createLString(req.pool, StaticString(date, dateSize));
+	req.appResponse.setCookie = NULL;
+	req.appResponse.cacheControl = NULL;
+	req.appResponse.expiresHeader = NULL;
+	req.appResponse.lastModifiedHeader = NULL;
+	req.appResponse.headers.insert(req.pool, "date", StaticString(date, dateSize));
+	req.appResponse.headers.insert(req.pool, "cache-control", "public,max-age=99999");
+}
+
+static void
+benchmarkResponseCacheStore(unsigned long long iterations) {
+	ResponseCacheBenchmarkHandler handler;
+	ResponseCacheType cache;
+	Request req;
+	char date[64];
+	ev_tstamp now = time(NULL);
+
+	initializeCacheableRequest(req, date, sizeof(date));
+	cache.prepareRequest(&handler, &req);
+	for (unsigned long long i = 0; i < iterations; i++) {
+		if (cache.requestAllowsStoring(&req) && cache.prepareRequestForStoring(&req)) {
+			Benchmark::doNotOptimize(cache.store(&req, now, 100, 1000).index);
+		}
+	}
+
+	psg_destroy_pool(req.pool);
+	req.pool = NULL;
+}
+
+static void
+benchmarkResponseCacheFetch(unsigned long long iterations) {
+	ResponseCacheBenchmarkHandler handler;
+	ResponseCacheType cache;
+	Request req;
+	char date[64];
+	ev_tstamp now = time(NULL);
+
+	initializeCacheableRequest(req, date, sizeof(date));
+	cache.prepareRequest(&handler, &req);
+	cache.prepareRequestForStoring(&req);
+	if (!cache.store(&req, now, 100, 1000).valid()) {
+		fprintf(stderr, "Cannot store response in the response cache\n");
+		abort();
+	}
+	for (unsigned long long i = 0; i < iterations; i++) {
+		if (cache.requestAllowsFetching(&req)) {
+			Benchmark::doNotOptimize(cache.fetch(&req, now).index);
+		}
+	}
+
+	psg_destroy_pool(req.pool);
+	req.pool = NULL;
+}
+
+
+/***** Integer formatting *****/
+
+static void
+benchmarkIntegerToDecimal(unsigned long long iterations) {
+	char buf[sizeof("18446744073709551615")];
+	for (unsigned long long i = 0; i < iterations; i++) {
+		Benchmark::doNotOptimize(integerToOtherBase<boost::uint64_t, 10>(
+			i * 7919, buf, sizeof(buf)));
+	}
+}
+
+static void
+benchmarkIntegerToHex(unsigned long long iterations) {
+	char buf[2 * sizeof(boost::uint64_t) + 1];
+	for (unsigned long long i = 0; i < iterations; i++) {
+		Benchmark::doNotOptimize(integerToOtherBase<boost::uint64_t, 16>(
+			i * 7919, buf, sizeof(buf)));
+	}
+}
+
+
+/***** Dates *****/
+
+static void
+benchmarkDateFormat(unsigned long long iterations) {
+	char buf[64];
+	time_t base = time(NULL);
+	struct tm tm;
+
+	// The same as RequestHandler::constructDateHeaderBuffersForResponse().
+	for (unsigned long long i = 0; i < iterations; i++) {
+		time_t the_time = base + (time_t) (i & 1023);
+		gmtime_r(&the_time, &tm);
+		Benchmark::doNotOptimize(strftime(buf, sizeof(buf),
+			"%a, %d %b %Y %H:%M:%S GMT", &tm));
+	}
+}
+
+static void
+benchmarkDateParse(unsigned long long iterations) {
+	static const char date[] = "Sun, 06 Nov 1994 08:49:37 GMT";
+	struct tm tm;
+	int zone;
+
+	for (unsigned long long i = 0; i < iterations; i++) {
+		memset(&tm, 0, sizeof(tm));
+		zone = 0;
+		if (parseImfFixdate(date, date + sizeof(date) - 1, tm, zone)) {
+			Benchmark::doNotOptimize(parsedDateToTimestamp(tm, zone));
+		}
+	}
+}
+
+
+int
+main(int argc, char *argv[]) {
+	Benchmark::Runner runner(argc, argv);
+	// The context's SafeLibev takes ownership of the loop.
+	context = new ServerKit::Context(ev_loop_new(EVFLAG_AUTO));
+
+	runner.run("http_header_parser/request", benchmarkHttpHeaderParser,
+		sizeof(REQUEST_HEADER) - 1);
+	runner.run("header_table/insert_16_and_clear", benchmarkHeaderTableInsert);
+	runner.run("header_table/lookup_hit", benchmarkHeaderTableLookup);
+	runner.run("header_table/lookup_miss", benchmarkHeaderTableLookupMiss);
+	runner.run("string_key_table/insert_16_and_clear", benchmarkStringKeyTableInsert);
+	runner.run("string_key_table/lookup", benchmarkStringKeyTableLookup);
+	runner.run("palloc/64_bytes", benchmarkPalloc);
+	runner.run("palloc/create_and_destroy_pool", benchmarkPoolCreateDestroy);
+	runner.run("mbuf/block_get_and_unref", benchmarkMbufBlockGetUnref);
+	runner.run("mbuf/get_and_slice", benchmarkMbufGetSlice);
+	runner.run("response_cache/store", benchmarkResponseCacheStore);
+	runner.run("response_cache/fetch", benchmarkResponseCacheFetch);
+	runner.run("integer_to_other_base/decimal", benchmarkIntegerToDecimal);
+	runner.run("integer_to_other_base/hex", benchmarkIntegerToHex);
+	runner.run("date/format_http_date", benchmarkDateFormat);
+	runner.run("date/parse_imf_fixdate", benchmarkDateParse);
+
+	int exitCode = runner.finish();
+	delete context;
+	return exitCode;
+}
@@ -0,0 +1,99 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2015 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+
+/*
+ * Compares the time it takes to collect the metrics of many processes
+ * through /proc versus through 'ps'.
+ *
+ * Usage: ProcessMetricsCollectorBenchmark [NUM_PROCESSES] [ITERATIONS]
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <Utils/ProcessMetricsCollector.h>
+#include <Utils/SystemTime.h>
+
+using namespace std;
+using namespace Passenger;
+
+static double
+measure(ProcessMetricsCollector &collector, const vector<pid_t> &pids,
+	unsigned int iterations)
+{
+	unsigned long long start = SystemTime::getUsec();
+	for (unsigned int i = 0; i < iterations; i++) {
+		ProcessMetricMap result = collector.collect(pids);
+		if (result.size() != pids.size()) {
+			fprintf(stderr, "Collected %u metrics instead of %u\n",
+				(unsigned int) result.size(), (unsigned int) pids.size());
+			exit(1);
+		}
+	}
+	return (SystemTime::getUsec() - start) / 1000.0 / iterations;
+}
+
+int
+main(int argc, char *argv[]) {
+	unsigned int nprocs = (argc > 1) ? atoi(argv[1]) : 200;
+	unsigned int iterations = (argc > 2) ? atoi(argv[2]) : 20;
+	vector<pid_t> pids;
+
+	for (unsigned int i = 0; i < nprocs; i++) {
+		pid_t pid = fork();
+		if (pid == 0) {
+			pause();
+			_exit(0);
+		} else if (pid == -1) {
+			perror("fork()");
+			break;
+		}
+		pids.push_back(pid);
+	}
+
+	ProcessMetricsCollector collector;
+	// Warm up: opens the /proc files.
+	collector.collect(pids);
+	double procTime = measure(collector, pids, iterations);
+	collector.setUseProcfs(false);
+	double psTime = measure(collector, pids, iterations);
+
+	printf("Processes : %u\n", (unsigned int) pids.size());
+	printf("Iterations: %u\n", iterations);
+	printf("/proc     : %.3f ms per collection\n", procTime);
+	printf("ps        : %.3f ms per collection\n", psTime);
+	printf("Speedup   : %.1fx\n", psTime / procTime);
+
+	for (unsigned int i = 0; i < pids.size(); i++) {
+		kill(pids[i], SIGKILL);
+		waitpid(pids[i], NULL, 0);
+	}
+	return 0;
+}
@@ -0,0 +1,73 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2015 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+
+
+/*
+ * Measures how long it takes to collect system metrics with a long-lived
+ * collector (which keeps the /proc files open) versus a collector that
+ * is created for every sample.
+ *
+ * Usage: SystemMetricsCollectorBenchmark [ITERATIONS]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <Utils/SystemMetricsCollector.h>
+#include <Utils/SystemTime.h>
+
+using namespace std;
+using namespace Passenger;
+
+int
+main(int argc, char *argv[]) {
+	unsigned int iterations = (argc > 1) ? atoi(argv[1]) : 10000;
+	SystemMetricsCollector collector;
+	SystemMetrics metrics;
+	unsigned long long start;
+	double persistentTime, freshTime;
+
+	// Warm up: opens the /proc files and sizes the buffer.
+	collector.collect(metrics);
+
+	start = SystemTime::getUsec();
+	for (unsigned int i = 0; i < iterations; i++) {
+		collector.collect(metrics);
+	}
+	persistentTime = (SystemTime::getUsec() - start) / (double) iterations;
+
+	start = SystemTime::getUsec();
+	for (unsigned int i = 0; i < iterations; i++) {
+		SystemMetricsCollector freshCollector;
+		freshCollector.collect(metrics);
+	}
+	freshTime = (SystemTime::getUsec() - start) / (double) iterations;
+
+	printf("CPUs                : %u\n", metrics.ncpus());
+	printf("Iterations          : %u\n", iterations);
+	printf("Persistent collector: %.2f us per collection\n", persistentTime);
+	printf("Fresh collector     : %.2f us per collection\n", freshTime);
+	return 0;
+}
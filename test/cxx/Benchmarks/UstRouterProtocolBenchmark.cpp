@@ -0,0 +1,156 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2015 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+
+
+/*
+ * Measures how many log messages per second a single UstRouter event loop,
+ * and thus a single core, accepts from UnionStation::Core clients, with
+ * binary framing and with the text protocol.
+ *
+ * Usage: UstRouterProtocolBenchmark [THREADS] [MESSAGES_PER_THREAD]
+ */
+
+#include <sys/types.h>
+#include <signal.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/thread.hpp>
+#include <oxt/initialize.hpp>
+#include <oxt/system_calls.hpp>
+#include <BackgroundEventLoop.cpp>
+#include <ServerKit/Context.h>
+#include <UstRouter/Controller.h>
+#include <Core/UnionStation/Core.h>
+#include <Core/UnionStation/Transaction.h>
+#include <Utils.h>
+#include <Utils/IOUtils.h>
+#include <Utils/SystemTime.h>
+
+using namespace std;
+using namespace Passenger;
+
+static const unsigned int MESSAGES_PER_TRANSACTION = 20;
+
+static void
+logMessages(UnionStation::CorePtr core, unsigned int count) {
+	UnionStation::TransactionPtr transaction;
+	for (unsigned int i = 0; i < count; i++) {
+		if (i % MESSAGES_PER_TRANSACTION == 0) {
+			transaction = core->newTransaction("benchmark");
+		}
+		transaction->message("BEGIN: request processing (1445438402123456, 1234, 5678)");
+	}
+	// Wait until the UstRouter has processed everything that was sent
+	// over this thread's connection.
+	transaction->flushToDiskAfterClose(true);
+	transaction.reset();
+}
+
+static void
+getServerState(UstRouter::Controller *controller, UstRouter::Controller::State *state) {
+	*state = controller->serverState;
+}
+
+static double
+measure(const string &address, bool binary, unsigned int nthreads,
+	unsigned int count)
+{
+	UnionStation::CorePtr core = boost::make_shared<UnionStation::Core>(
+		address, "benchmark", "1234", "localhost");
+	core->setBinaryProtocol(binary);
+
+	// Warm up: establishes the connections.
+	logMessages(core, MESSAGES_PER_TRANSACTION);
+
+	vector< boost::shared_ptr<boost::thread> > threads;
+	unsigned long long start = SystemTime::getUsec();
+	for (unsigned int i = 0; i < nthreads; i++) {
+		threads.push_back(boost::make_shared<boost::thread>(
+			boost::bind(logMessages, core, count)));
+	}
+	for (unsigned int i = 0; i < nthreads; i++) {
+		threads[i]->join();
+	}
+	unsigned long long elapsed = SystemTime::getUsec() - start;
+	return nthreads * (double) count / (elapsed / 1000000.0);
+}
+
+int
+main(int argc, char *argv[]) {
+	unsigned int nthreads = (argc > 1) ? atoi(argv[1]) : 4;
+	unsigned int count = (argc > 2) ? atoi(argv[2]) : 50000;
+	char dir[] = "/tmp/passenger-benchmark.XXXXXX";
+
+	signal(SIGPIPE, SIG_IGN);
+	oxt::initialize();
+	oxt::setup_syscall_interruption_support();
+	setLogLevel(LVL_ERROR);
+
+	if (mkdtemp(dir) == NULL) {
+		perror("mkdtemp()");
+		return 1;
+	}
+	string socketFilename = string(dir) + "/socket";
+
+	VariantMap options;
+	options.set("ust_router_username", "benchmark");
+	options.set("ust_router_password", "1234");
+	options.setBool("ust_router_dev_mode", true);
+	options.set("ust_router_dump_dir", dir);
+
+	BackgroundEventLoop bg(false, true);
+	ServerKit::Context context(bg.safe, bg.libuv_loop);
+	FileDescriptor serverFd(createUnixServer(socketFilename.c_str(), 0, true,
+		__FILE__, __LINE__), NULL, 0);
+	UstRouter::Controller controller(&context, options);
+	controller.listen(serverFd);
+	bg.start();
+
+	double binaryRate = measure("unix:" + socketFilename, true, nthreads, count);
+	double textRate = measure("unix:" + socketFilename, false, nthreads, count);
+
+	printf("Client threads: %u\n", nthreads);
+	printf("Messages      : %u per thread, %u per transaction\n",
+		count, MESSAGES_PER_TRANSACTION);
+	printf("Text protocol : %.0f messages/sec\n", textRate);
+	printf("Binary framing: %.0f messages/sec\n", binaryRate);
+	printf("Speedup       : %.2fx\n", binaryRate / textRate);
+
+	UstRouter::Controller::State state;
+	bg.safe->runSync(boost::bind(&UstRouter::Controller::shutdown, &controller, true));
+	do {
+		syscalls::usleep(10000);
+		bg.safe->runSync(boost::bind(getServerState, &controller, &state));
+	} while (state != UstRouter::Controller::FINISHED_SHUTDOWN);
+	bg.stop();
+	removeDirTree(dir);
+	return 0;
+}
@@ -0,0 +1,126 @@
+#include <TestSupport.h>
+#include <Core/ApplicationPool/CapacityShares.h>
+
+using namespace Passenger;
+using namespace Passenger::ApplicationPool2;
+using namespace std;
+
+namespace tut {
+	struct Core_ApplicationPool_CapacitySharesTest {
+		CapacityShares shares;
+
+		void add(const char *name, unsigned int weight, unsigned int guaranteed,
+			unsigned int demand, unsigned int current)
+		{
+			CapacityShares::Entry &entry = shares.add(NULL, name, weight, guaranteed);
+			entry.demand = demand;
+			entry.current = current;
+		}
+
+		double share(const char *name) {
+			return shares.find(name)->share;
+		}
+
+		void setShare(const char *name, double share, unsigned int current) {
+			shares.find(name)->share = share;
+			shares.find(name)->current = current;
+		}
+
+		bool shouldMove(const char *donor, const char *recipient) {
+			return CapacityShares::shouldMove(*shares.find(donor), *shares.find(recipient));
+		}
+	};
+
+	DEFINE_TEST_GROUP(Core_ApplicationPool_CapacitySharesTest);
+
+	TEST_METHOD(1) {
+		set_test_name("Capacity is divided in proportion to the weights");
+		add("a", 3, 0, 10, 0);
+		add("b", 1, 0, 10, 0);
+		shares.compute(8);
+		ensure_distance("(1)", share("a"), 6.0, 0.001);
+		ensure_distance("(2)", share("b"), 2.0, 0.001);
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("Capacity that a group doesn't need goes to the others");
+		add("a", 1, 0, 1, 0);
+		add("b", 1, 0, 10, 0);
+		add("c", 2, 0, 10, 0);
+		shares.compute(10);
+		ensure_distance("(1)", share("a"), 1.0, 0.001);
+		ensure_distance("(2)", share("b"), 3.0, 0.001);
+		ensure_distance("(3)", share("c"), 6.0, 0.001);
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("minProcesses is guaranteed before weights are applied, "
+			"but only as far as there is demand");
+		add("a", 2, 0, 10, 0);
+		add("b", 1, 2, 10, 0);
+		add("c", 1, 2, 0, 0);
+		shares.compute(5);
+		ensure_distance("(1)", share("b"), 3.0, 0.001);
+		ensure_distance("(2)", share("a"), 2.0, 0.001);
+		ensure_distance("(3)", share("c"), 0.0, 0.001);
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("A group without processes may take one from any group "
+			"over its share");
+		add("a", 1, 1, 0, 2);
+		add("b", 1, 1, 1, 0);
+		setShare("a", 0, 2);
+		setShare("b", 1, 0);
+		ensure("(1)", shouldMove("a", "b"));
+		ensure("(2)", !shouldMove("b", "a"));
+
+		setShare("a", 2, 2);
+		ensure("(3)", !shouldMove("a", "b"));
+	}
+
+	TEST_METHOD(5) {
+		set_test_name("Other groups only take a process if the difference "
+			"in deficits exceeds the hysteresis");
+		add("a", 1, 0, 10, 0);
+		add("b", 1, 0, 10, 0);
+		setShare("a", 2, 3);
+		setShare("b", 2.5, 2);
+		ensure("(1)", !shouldMove("a", "b"));
+
+		setShare("a", 2, 4);
+		setShare("b", 3, 1);
+		ensure("(2)", shouldMove("a", "b"));
+		setShare("a", 2, 3);
+		setShare("b", 3, 2);
+		ensure("(3)", shouldMove("a", "b"));
+
+		// Once the shares are met, processes don't move in either direction.
+		setShare("a", 2, 2);
+		setShare("b", 3, 3);
+		ensure("(4)", !shouldMove("a", "b"));
+		ensure("(5)", !shouldMove("b", "a"));
+
+		// The donor keeps at least one process.
+		setShare("a", 0, 1);
+		setShare("b", 3, 1);
+		ensure("(6)", !shouldMove("a", "b"));
+	}
+
+	TEST_METHOD(6) {
+		set_test_name("A group with no demand gives up its last process to "
+			"a group that already has processes and queued requests");
+		add("a", 1, 1, 0, 1);
+		add("b", 1, 1, 3, 1);
+		shares.compute(2);
+		ensure_equals("(1)", share("a"), 0.0);
+		ensure_equals("(2)", share("b"), 2.0);
+		ensure("(3)", shouldMove("a", "b"));
+		ensure("(4)", !shouldMove("b", "a"));
+
+		// A group that still has demand keeps its last process.
+		add("c", 1, 1, 1, 1);
+		setShare("c", 0, 1);
+		ensure("(5)", !shouldMove("c", "b"));
+	}
+}
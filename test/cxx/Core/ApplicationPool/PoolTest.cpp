@@ -182,6 +182,13 @@ namespace tut {
 			return options;
 		}
 
+		void setProcessMemoryUsage(const ProcessPtr &process, unsigned int megabytes) {
+			process->metrics.pid = process->getPid();
+			process->metrics.rss = megabytes * 1024;
+			process->metrics.privateDirty = megabytes * 1024;
+			process->metrics.swap = 0;
+		}
+
 		void disableProcess(ProcessPtr process, AtomicInt *result) {
 			*result = (int) pool->disableProcess(process->getGupid());
 		}
@@ -1998,6 +2005,795 @@ namespace tut {
 		currentSession.reset();
 	}
 
+	TEST_METHOD(80) {
+		// If restart file watching is enabled, then touching restart.txt
+		// restarts the app on the next request, regardless of stat throttling.
+		TempDirCopy dir("stub/rack", "tmp.rack");
+		pool->initRestartFileWatching(1);
+		Options options = createOptions();
+		options.appRoot = "tmp.rack";
+		options.statThrottleRate = 3600;
+
+		SessionPtr session = pool->get(options, &ticket);
+		pid_t pid = session->getPid();
+		session.reset();
+		GroupPtr group = pool->findOrCreateGroup(options);
+		ensure("The group is registered with the file watcher",
+			group->restartFileWatchId != 0);
+
+		touchFile("tmp.rack/tmp/restart.txt");
+		EVENTUALLY(5,
+			result = group->restartFileChanged.load();
+		);
+		session = pool->get(options, &ticket);
+		ensure("The app has been restarted", session->getPid() != pid);
+		ensure("The change has been consumed", !group->restartFileChanged.load());
+		pid = session->getPid();
+		session.reset();
+
+		// Events that don't change the mtime, like the remaining events
+		// of the same touch, don't cause another restart.
+		chmod("tmp.rack/tmp/restart.txt", 0600);
+		SHOULD_NEVER_HAPPEN(200,
+			result = group->restartFileChanged.load();
+		);
+		session = pool->get(options, &ticket);
+		ensure_equals("The app has not been restarted again", session->getPid(), pid);
+	}
+
+	TEST_METHOD(81) {
+		// A request that has been in the getWaitlist for longer than
+		// maxRequestQueueTime is removed from it, even if no process becomes
+		// available, and fails with a RequestQueueTimeoutException.
+		Options options = createOptions();
+		options.appGroupName = "test";
+		options.maxRequestQueueTime = 100;
+		pool->setMax(1);
+		pool->asyncGet(options, callback);
+		EVENTUALLY(5,
+			result = number == 1;
+		);
+		SessionPtr session1 = currentSession;
+		currentSession.reset();
+
+		pool->asyncGet(options, callback);
+		GroupPtr group = pool->groups.lookupCopy("test");
+		{
+			LockGuard l(pool->syncher);
+			ensure_equals(group->getWaitlist.size(), 1u);
+		}
+		EVENTUALLY(5,
+			result = number == 2;
+		);
+		ensure("A RequestQueueTimeoutException is returned",
+			dynamic_pointer_cast<RequestQueueTimeoutException>(currentException) != NULL);
+		LockGuard l(pool->syncher);
+		ensure_equals(group->getWaitlist.size(), 0u);
+		ensure_equals(group->getWaitersTimedOut, 1u);
+		ensure_equals(group->getWaitersShed, 0u);
+	}
+
+	TEST_METHOD(82) {
+		// Once the getWaitlist has been non-empty for longer than
+		// requestQueueInterval, requests that have waited longer than
+		// requestQueueTarget are shed.
+		Options options = createOptions();
+		options.appGroupName = "test";
+		options.requestQueueTarget = 50;
+		options.requestQueueInterval = 100;
+		pool->setMax(1);
+		pool->asyncGet(options, callback);
+		EVENTUALLY(5,
+			result = number == 1;
+		);
+		SessionPtr session1 = currentSession;
+		currentSession.reset();
+		GroupPtr group = pool->groups.lookupCopy("test");
+		{
+			// Forget about the request that waited for the spawn.
+			LockGuard l(pool->syncher);
+			group->getWaitlistWaitTimes.reset();
+		}
+
+		SystemTime::forceAll(1000000000);
+		pool->asyncGet(options, callback);
+		SystemTime::forceAll(1000000000 + 120000);
+		pool->asyncGet(options, callback);
+		SystemTime::forceAll(1000000000 + 150000);
+		pool->wakeupGarbageCollector();
+		EVENTUALLY(5,
+			result = number == 2;
+		);
+		ensure("A RequestQueueTimeoutException is returned",
+			dynamic_pointer_cast<RequestQueueTimeoutException>(currentException) != NULL);
+		{
+			LockGuard l(pool->syncher);
+			ensure_equals("The oldest request has been shed",
+				group->getWaitlist.size(), 1u);
+			ensure_equals(group->getWaitlist.front().enqueuedAt,
+				1000000000ull + 120000);
+			ensure_equals("One request has been shed", group->getWaitersShed, 1u);
+		}
+
+		session1.reset();
+		EVENTUALLY(5,
+			result = number == 3;
+		);
+		ensure("The newest request has been served", currentSession != NULL);
+		LockGuard l(pool->syncher);
+		ensure_equals("One request has been served from the queue",
+			group->getWaitlistWaitTimes.getCount(), 1u);
+		ensure_equals(group->getWaitlistWaitTimes.getMax(), 30000u);
+	}
+
+	TEST_METHOD(83) {
+		// If requestQueueAdaptiveLifo is set, then a standing getWaitlist
+		// is served newest first.
+		Options options = createOptions();
+		options.appGroupName = "test";
+		options.requestQueueTarget = 10000;
+		options.requestQueueInterval = 100;
+		options.requestQueueAdaptiveLifo = true;
+		pool->setMax(1);
+		pool->asyncGet(options, callback);
+		EVENTUALLY(5,
+			result = number == 1;
+		);
+		SessionPtr session1 = currentSession;
+		currentSession.reset();
+		GroupPtr group = pool->groups.lookupCopy("test");
+		{
+			// Forget about the request that waited for the spawn.
+			LockGuard l(pool->syncher);
+			group->getWaitlistWaitTimes.reset();
+		}
+
+		for (int i = 0; i < 3; i++) {
+			SystemTime::forceAll(1000000000 + i * 1000);
+			pool->asyncGet(options, callback);
+		}
+		SystemTime::forceAll(1000000000 + 200000);
+		session1.reset();
+		EVENTUALLY(5,
+			result = number == 2;
+		);
+		{
+			LockGuard l(pool->syncher);
+			ensure_equals(group->getWaitlist.size(), 2u);
+			ensure_equals(group->getWaitlist[0].enqueuedAt, 1000000000ull);
+			ensure_equals(group->getWaitlist[1].enqueuedAt, 1000000000ull + 1000);
+			ensure_equals(group->getWaitlistWaitTimes.getMax(), 198000u);
+		}
+		ensure("The wait time is reported",
+			pool->inspect().find("Queue wait time: ") != string::npos);
+	}
+
+	TEST_METHOD(84) {
+		// A process is marked as suspicious when a session times out, the mark
+		// is cleared by a session that doesn't time out, and the process is
+		// detached once it reaches the consecutive timeout threshold.
+		Options options = createOptions();
+		options.minProcesses = 0;
+		pool->setMax(1);
+
+		SessionPtr session = pool->get(options, &ticket);
+		ProcessPtr process = session->getProcess()->shared_from_this();
+		session->reportResponseTimeout(2);
+		session.reset();
+		{
+			LockGuard l(pool->syncher);
+			ensure_equals(process->responseTimeouts, 1u);
+			ensure("(1)", process->isSuspicious());
+		}
+
+		pool->get(options, &ticket).reset();
+		{
+			LockGuard l(pool->syncher);
+			ensure_equals(process->responseTimeouts, 1u);
+			ensure("(2)", !process->isSuspicious());
+			ensure_equals(process->enabled, Process::ENABLED);
+		}
+
+		for (int i = 0; i < 2; i++) {
+			session = pool->get(options, &ticket);
+			ensure_equals(session->getPid(), process->getPid());
+			session->reportResponseTimeout(2);
+			session.reset();
+		}
+		{
+			LockGuard l(pool->syncher);
+			ensure_equals(process->responseTimeouts, 3u);
+		}
+		EVENTUALLY(2,
+			result = pool->getProcessCount() == 0;
+		);
+	}
+
+	TEST_METHOD(86) {
+		// While a process is warming up, it only receives a share of the
+		// traffic proportional to its age, unless the other processes are
+		// totally busy.
+		Options options = createOptions();
+		options.minProcesses = 1;
+		options.warmupTime = 10;
+		pool->setMax(2);
+		GroupPtr group = pool->findOrCreateGroup(options);
+		spawningKitConfig->concurrency = 2;
+		SystemTime::forceAll(1000000000);
+		{
+			LockGuard l(pool->syncher);
+			group->spawn();
+		}
+		EVENTUALLY(5,
+			result = pool->getProcessCount() == 1;
+		);
+
+		// Spawn a second process a minute later.
+		SystemTime::forceAll(1000000000 + 60 * 1000000ull);
+		{
+			LockGuard l(pool->syncher);
+			group->options.minProcesses = 2;
+			group->spawn();
+		}
+		EVENTUALLY(5,
+			result = pool->getProcessCount() == 2;
+		);
+
+		ProcessPtr warm, fresh;
+		{
+			LockGuard l(pool->syncher);
+			warm = group->enabledProcesses[0];
+			fresh = group->enabledProcesses[1];
+			ensure_equals(group->warmupEndTime, 1000000000 + 70 * 1000000ull);
+		}
+
+		// Without warm-up, the second request would go to the idle process.
+		SessionPtr session1 = pool->get(options, &ticket);
+		ensure("(1)", session1->getProcess() == warm.get());
+		SessionPtr session2 = pool->get(options, &ticket);
+		ensure("(2)", session2->getProcess() == warm.get());
+		SessionPtr session3 = pool->get(options, &ticket);
+		ensure("(3)", session3->getProcess() == fresh.get());
+		session1.reset();
+		session2.reset();
+		session3.reset();
+
+		// The garbage collector switches back to normal routing once
+		// the processes have warmed up.
+		SystemTime::forceAll(1000000000 + 80 * 1000000ull);
+		pool->wakeupGarbageCollector();
+		EVENTUALLY(5,
+			LockGuard l(pool->syncher);
+			result = group->warmupEndTime == 0;
+		);
+	}
+
+	TEST_METHOD(87) {
+		// A rolling restart keeps the old processes serving requests while
+		// their replacements are being spawned, and replaces them one by one.
+		initPoolDebugging();
+		debug->restarting = false;
+		debug->messages->send("Proceed with spawn loop iteration 1");
+		debug->messages->send("Proceed with spawn loop iteration 2");
+		Options options = ensureMinProcesses(2);
+		GroupPtr group = pool->findOrCreateGroup(options);
+		ProcessPtr old1, old2;
+		{
+			LockGuard l(pool->syncher);
+			old1 = group->enabledProcesses[0];
+			old2 = group->enabledProcesses[1];
+		}
+
+		Pool::RestartOptions restartOptions = Pool::RestartOptions::makeAuthorized();
+		restartOptions.method = RM_ROLLING;
+		ensure(pool->restartGroupByName("stub/rack", restartOptions));
+		debug->debugger->recv("Begin spawn loop iteration 3");
+		{
+			LockGuard l(pool->syncher);
+			ensure("(1)", group->rollingRestarting());
+			ensure_equals("(2)", group->enabledCount, 2);
+			ensure("(3)", old1->oldGeneration);
+			ensure("(4)", old2->oldGeneration);
+		}
+		SessionPtr session = pool->get(options, &ticket);
+		ensure("(5)", session->getProcess() == old1.get() || session->getProcess() == old2.get());
+		session.reset();
+		ensure("(6)", pool->inspect().find("rolling restart: 0 of 2 processes replaced")
+			!= string::npos);
+
+		debug->messages->send("Proceed with spawn loop iteration 3");
+		debug->debugger->recv("Begin spawn loop iteration 4");
+		{
+			LockGuard l(pool->syncher);
+			ensure("(7)", group->rollingRestarting());
+			ensure_equals("(8)", group->enabledCount, 2);
+			ensure_equals("(9)", group->countOldGenerationProcesses(), 1u);
+		}
+
+		debug->messages->send("Proceed with spawn loop iteration 4");
+		EVENTUALLY(5,
+			LockGuard l(pool->syncher);
+			result = !group->rollingRestarting();
+		);
+		LockGuard l(pool->syncher);
+		ensure_equals("(10)", group->enabledCount, 2);
+		ensure_equals("(11)", group->countOldGenerationProcesses(), 0u);
+		ensure("(12)", group->enabledProcesses[0] != old1 && group->enabledProcesses[0] != old2);
+		ensure("(13)", group->enabledProcesses[1] != old1 && group->enabledProcesses[1] != old2);
+	}
+
+	TEST_METHOD(88) {
+		// If a new process fails to spawn during a rolling restart, then the
+		// restart is rolled back: the new processes are detached, and the old
+		// spawner replaces the old processes that had already been detached.
+		initPoolDebugging();
+		debug->restarting = false;
+		debug->messages->send("Proceed with spawn loop iteration 1");
+		debug->messages->send("Proceed with spawn loop iteration 2");
+		debug->messages->send("Proceed with spawn loop iteration 3");
+		Options options = ensureMinProcesses(2);
+		GroupPtr group = pool->findOrCreateGroup(options);
+		SpawningKit::SpawnerPtr oldSpawner;
+		ProcessPtr old1, old2;
+		{
+			LockGuard l(pool->syncher);
+			oldSpawner = group->spawner;
+			old1 = group->enabledProcesses[0];
+			old2 = group->enabledProcesses[1];
+		}
+
+		Pool::RestartOptions restartOptions = Pool::RestartOptions::makeAuthorized();
+		restartOptions.method = RM_ROLLING;
+		ensure(pool->restartGroupByName("stub/rack", restartOptions));
+		debug->debugger->recv("Begin spawn loop iteration 4");
+		ProcessPtr newProcess;
+		{
+			LockGuard l(pool->syncher);
+			ensure_equals("(1)", group->countOldGenerationProcesses(), 1u);
+			newProcess = group->enabledProcesses[0]->oldGeneration
+				? group->enabledProcesses[1]
+				: group->enabledProcesses[0];
+		}
+
+		setLogLevel(LVL_CRIT);
+		debug->messages->send("Fail spawn loop iteration 4");
+		debug->debugger->recv("Begin spawn loop iteration 5");
+		{
+			LockGuard l(pool->syncher);
+			ensure("(2)", !group->rollingRestarting());
+			ensure("(3)", group->spawner == oldSpawner);
+			ensure_equals("(4)", group->enabledCount, 1);
+			ensure_equals("(5)", group->countOldGenerationProcesses(), 0u);
+			ensure("(6)", newProcess->enabled == Process::DETACHED);
+			ensure("(7)", (old1->enabled == Process::ENABLED) != (old2->enabled == Process::ENABLED));
+		}
+
+		debug->messages->send("Proceed with spawn loop iteration 5");
+		EVENTUALLY(5,
+			LockGuard l(pool->syncher);
+			result = group->enabledCount == 2;
+		);
+	}
+
+	TEST_METHOD(89) {
+		// A group keeps `standbyProcesses` spawned processes that aren't routed to,
+		// and promotes one of them as soon as all other processes are totally busy.
+		Options options = createOptions();
+		options.minProcesses = 1;
+		options.standbyProcesses = 1;
+		GroupPtr group = pool->findOrCreateGroup(options);
+		{
+			LockGuard l(pool->syncher);
+			group->spawn();
+		}
+		EVENTUALLY(5,
+			LockGuard l(pool->syncher);
+			result = group->standbyCount == 1 && !group->spawning();
+		);
+		ensure_equals(pool->getProcessCount(), 1u);
+
+		ProcessPtr standby;
+		{
+			LockGuard l(pool->syncher);
+			standby = group->standbyProcesses[0];
+			ensure_equals(group->capacityUsed(), 2u);
+		}
+		SessionPtr session1 = pool->get(options, &ticket);
+		ensure("(1)", session1->getProcess() != standby.get());
+		SessionPtr session2 = pool->get(options, &ticket);
+		ensure("(2)", session2->getProcess() == standby.get());
+		ensure("(3)", pool->inspect().find("Standby") == string::npos);
+		session1.reset();
+		session2.reset();
+
+		// The standby process is replaced in the background.
+		EVENTUALLY(5,
+			LockGuard l(pool->syncher);
+			result = group->standbyCount == 1 && group->enabledCount >= 2;
+		);
+		ensure("(4)", pool->inspect().find("Standby") != string::npos);
+	}
+
+	TEST_METHOD(90) {
+		// Standby processes are the first to go when another group needs
+		// capacity in a full pool.
+		Options options = createOptions();
+		options.minProcesses = 1;
+		options.standbyProcesses = 1;
+		pool->setMax(2);
+		GroupPtr group = pool->findOrCreateGroup(options);
+		{
+			LockGuard l(pool->syncher);
+			group->spawn();
+		}
+		EVENTUALLY(5,
+			LockGuard l(pool->syncher);
+			result = group->standbyCount == 1 && !group->spawning();
+		);
+
+		Options options2 = createOptions();
+		options2.appGroupName = "test2";
+		pool->get(options2, &ticket).reset();
+		LockGuard l(pool->syncher);
+		ensure_equals(group->standbyCount, 0);
+		ensure_equals(group->enabledCount, 1);
+	}
+
+	TEST_METHOD(91) {
+		// A process that exceeds the memory limit keeps serving requests
+		// until its replacement has been spawned.
+		Options options = ensureMinProcesses(1);
+		GroupPtr group = pool->findOrCreateGroup(options);
+		ProcessPtr process;
+		{
+			LockGuard l(pool->syncher);
+			boost::container::vector<Callback> actions;
+			group->options.memoryLimit = 100;
+			process = group->enabledProcesses[0];
+			setProcessMemoryUsage(process, 200);
+			group->checkMemoryLimits(actions);
+			ensure("(1)", process->memoryLimitExceeded);
+			ensure("(2)", process->enabled == Process::ENABLED);
+			ensure("(3)", group->spawning());
+		}
+		ensure("(4)", pool->inspect().find("Memory limit exceeded") != string::npos);
+
+		EVENTUALLY(5,
+			LockGuard l(pool->syncher);
+			result = process->enabled == Process::DETACHED && !group->spawning();
+		);
+		LockGuard l(pool->syncher);
+		ensure_equals("(5)", group->enabledCount, 1);
+		ensure("(6)", group->enabledProcesses[0] != process);
+		ensure_equals("(7)", group->processesRecycledForMemoryLimit, 1ull);
+		ensure_equals("(8)", group->countProcessesExceedingMemoryLimit(), 0u);
+	}
+
+	TEST_METHOD(92) {
+		// If no replacement can be spawned, a process that exceeds the memory
+		// limit is only detached if that leaves at least `minProcesses` processes.
+		pool->setMax(2);
+		Options options = ensureMinProcesses(2);
+		GroupPtr group = pool->findOrCreateGroup(options);
+		LockGuard l(pool->syncher);
+		boost::container::vector<Callback> actions;
+		group->options.minProcesses = 1;
+		group->options.memoryLimit = 100;
+		ProcessPtr process1 = group->enabledProcesses[0];
+		ProcessPtr process2 = group->enabledProcesses[1];
+
+		setProcessMemoryUsage(process1, 200);
+		group->checkMemoryLimits(actions);
+		ensure("(1)", process1->enabled == Process::DETACHED);
+		ensure_equals("(2)", group->enabledCount, 1);
+		ensure_equals("(3)", group->processesRecycledForMemoryLimit, 1ull);
+
+		group->options.maxProcesses = 1;
+		setProcessMemoryUsage(process2, 200);
+		group->checkMemoryLimits(actions);
+		ensure("(4)", process2->memoryLimitExceeded);
+		ensure("(5)", process2->enabled == Process::ENABLED);
+		ensure_equals("(6)", group->processesRecycledForMemoryLimit, 1ull);
+	}
+
+	TEST_METHOD(93) {
+		// Metrics are written without locking the pool. Group and process
+		// metrics come from the latest published snapshot.
+		Options options = ensureMinProcesses(1);
+		pid_t pid;
+		{
+			OpenMetricsWriter writer;
+			pool->writeMetrics(writer);
+			string result = writer.finish();
+			ensure("(1)", result.find("passenger_processes_spawned_total 1\n") != string::npos);
+			ensure("(2)", result.find("passenger_spawn_duration_seconds_count 1\n") != string::npos);
+		}
+		{
+			LockGuard l(pool->syncher);
+			pid = pool->getProcesses(false)[0]->getPid();
+			pool->publishMetricsSnapshot();
+		}
+
+		LockGuard l(pool->syncher);
+		OpenMetricsWriter writer;
+		pool->writeMetrics(writer);
+		string result = writer.finish();
+		string groupLabel = OpenMetricsWriter::label("group", options.getAppGroupName());
+		ensure("(3)", result.find("passenger_group_queued_requests{"
+			+ groupLabel + "} 0\n") != string::npos);
+		ensure("(4)", result.find("passenger_process_pid{"
+			+ groupLabel + ",slot=\"0\"} " + toString(pid) + "\n") != string::npos);
+		ensure("(5)", result.find("passenger_process_sessions{"
+			+ groupLabel + ",slot=\"0\"} 0\n") != string::npos);
+		ensure("(6)", result.find("passenger_process_enabled{"
+			+ groupLabel + ",slot=\"0\"} 1\n") != string::npos);
+	}
+
+	TEST_METHOD(94) {
+		// When the pool is full, a group whose processes are all busy takes
+		// an idle process from a group that is over its fair share.
+		pool->setMax(3);
+		Options options = ensureMinProcesses(2);
+		GroupPtr group1 = pool->findOrCreateGroup(options);
+		retainSessions = true;
+
+		Options options2 = createOptions();
+		options2.appGroupName = "test2";
+		pool->asyncGet(options2, callback);
+		EVENTUALLY(5,
+			result = number == 2;
+		);
+		pool->asyncGet(options2, callback);
+		EVENTUALLY(5,
+			result = number == 3;
+		);
+
+		{
+			LockGuard l(pool->syncher);
+			ensure_equals("(1)", group1->getProcessCount(), 1u);
+			ensure_equals("(2)", pool->getGroup("test2")->getProcessCount(), 2u);
+			ensure_equals("(3)", pool->capacityDecisions.size(), 1u);
+			ensure_equals("(4)", pool->capacityDecisions[0].donor, group1->getName().toString());
+			ensure_equals("(5)", pool->capacityDecisions[0].recipient, "test2");
+		}
+
+		Pool::InspectOptions inspectOptions = Pool::InspectOptions::makeAuthorized();
+		inspectOptions.verbose = true;
+		string inspection = pool->inspect(inspectOptions);
+		ensure("(6)", inspection.find("given up for test2") != string::npos);
+		ensure("(7)", inspection.find("Capacity share: 2.0 (weight 1, demand 2)") != string::npos);
+	}
+
+	TEST_METHOD(95) {
+		// When the pool is full and a group has queued requests, a group that
+		// is further over its fair share gives up a process as soon as one of
+		// its sessions is closed.
+		pool->setMax(4);
+		Options options = ensureMinProcesses(3);
+		GroupPtr group1 = pool->findOrCreateGroup(options);
+		options.minProcesses = 1;
+		retainSessions = true;
+		for (unsigned int i = 0; i < 3; i++) {
+			pool->asyncGet(options, callback);
+		}
+		EVENTUALLY(5,
+			result = number == 4;
+		);
+
+		Options options2 = createOptions();
+		options2.appGroupName = "test2";
+		pool->asyncGet(options2, callback);
+		EVENTUALLY(5,
+			result = number == 5;
+		);
+		pool->asyncGet(options2, callback);
+		SHOULD_NEVER_HAPPEN(100,
+			result = number > 5;
+		);
+
+		SessionPtr session;
+		{
+			LockGuard l(syncher);
+			list<SessionPtr>::iterator it = sessions.begin();
+			while ((*it)->getGroup() != group1.get()) {
+				it++;
+			}
+			session = *it;
+			sessions.erase(it);
+		}
+		session.reset();
+		EVENTUALLY(5,
+			result = number == 6;
+		);
+
+		LockGuard l(pool->syncher);
+		ensure_equals("(1)", group1->getProcessCount(), 2u);
+		ensure_equals("(2)", pool->getGroup("test2")->getProcessCount(), 2u);
+		ensure_equals("(3)", pool->capacityDecisions.size(), 1u);
+	}
+
+	TEST_METHOD(96) {
+		// With sticky session fallback, a request for a session whose
+		// process is totally busy goes to another process instead of
+		// being queued, and sessions whose process is gone are
+		// consistently routed to the same process.
+		ensureMinProcesses(2);
+		Options options = createOptions();
+		SessionPtr session1 = pool->get(options, &ticket);
+		SessionPtr session2 = pool->get(options, &ticket);
+		unsigned int id1 = session1->getStickySessionId();
+		unsigned int id2 = session2->getStickySessionId();
+		pid_t pid1 = session1->getPid();
+		pid_t pid2 = session2->getPid();
+		session1.reset();
+		session2.reset();
+
+		options.stickySessionId = id1;
+		options.stickySessionsFallback = true;
+		session1 = pool->get(options, &ticket);
+		ensure_equals("(1)", session1->getPid(), pid1);
+		session2 = pool->get(options, &ticket);
+		ensure_equals("(2)", session2->getPid(), pid2);
+		session1.reset();
+		session2.reset();
+
+		options.stickySessionId = 1;
+		while (options.stickySessionId == id1 || options.stickySessionId == id2) {
+			options.stickySessionId++;
+		}
+		session1 = pool->get(options, &ticket);
+		pid_t pid = session1->getPid();
+		session1.reset();
+		for (unsigned int i = 0; i < 5; i++) {
+			session1 = pool->get(options, &ticket);
+			ensure_equals("(3)", session1->getPid(), pid);
+			session1.reset();
+		}
+	}
+
+	TEST_METHOD(97) {
+		// During a rolling restart, new requests go to the new generation
+		// processes as soon as they're ready. Old generation processes only
+		// get requests while the new ones are totally busy.
+		initPoolDebugging();
+		debug->restarting = false;
+		debug->messages->send("Proceed with spawn loop iteration 1");
+		debug->messages->send("Proceed with spawn loop iteration 2");
+		Options options = ensureMinProcesses(2);
+		GroupPtr group = pool->findOrCreateGroup(options);
+
+		Pool::RestartOptions restartOptions = Pool::RestartOptions::makeAuthorized();
+		restartOptions.method = RM_ROLLING;
+		ensure(pool->restartGroupByName("stub/rack", restartOptions));
+		debug->debugger->recv("Begin spawn loop iteration 3");
+		debug->messages->send("Proceed with spawn loop iteration 3");
+		debug->debugger->recv("Begin spawn loop iteration 4");
+		{
+			LockGuard l(pool->syncher);
+			ensure("(1)", group->rollingRestarting());
+			ensure_equals("(2)", group->countOldGenerationProcesses(), 1u);
+		}
+
+		for (unsigned int i = 0; i < 3; i++) {
+			SessionPtr session = pool->get(options, &ticket);
+			ensure("(3)", !session->getProcess()->oldGeneration);
+		}
+
+		SessionPtr session1 = pool->get(options, &ticket);
+		SessionPtr session2 = pool->get(options, &ticket);
+		ensure("(4)", !session1->getProcess()->oldGeneration);
+		ensure("(5)", session2->getProcess()->oldGeneration);
+		session1.reset();
+		session2.reset();
+
+		debug->messages->send("Proceed with spawn loop iteration 4");
+		EVENTUALLY(5,
+			LockGuard l(pool->syncher);
+			result = !group->rollingRestarting();
+		);
+	}
+
+	TEST_METHOD(98) {
+		// Each attached process of a group has its own slot, and the slot of
+		// a detached process is given to its replacement.
+		Options options = ensureMinProcesses(2);
+		GroupPtr group = pool->findOrCreateGroup(options);
+		ProcessPtr process1, process2;
+		{
+			LockGuard l(pool->syncher);
+			process1 = group->enabledProcesses[0];
+			process2 = group->enabledProcesses[1];
+			ensure_equals("(1)", process1->slot, 0u);
+			ensure_equals("(2)", process2->slot, 1u);
+		}
+
+		pool->detachProcess(process1);
+		EVENTUALLY(5,
+			LockGuard l(pool->syncher);
+			result = group->enabledProcesses.size() == 2;
+		);
+		LockGuard l(pool->syncher);
+		ProcessPtr process3 = group->enabledProcesses[0] == process2
+			? group->enabledProcesses[1]
+			: group->enabledProcesses[0];
+		ensure_equals("(3)", process2->slot, 1u);
+		ensure_equals("(4)", process3->slot, 0u);
+	}
+
+	TEST_METHOD(99) {
+		// If freshly spawned processes exceed the memory limit twice in a
+		// row, then processes aren't recycled for exceeding it for a while.
+		Options options = ensureMinProcesses(1);
+		GroupPtr group = pool->findOrCreateGroup(options);
+		ProcessPtr process;
+
+		for (unsigned int i = 0; i < 2; i++) {
+			{
+				LockGuard l(pool->syncher);
+				boost::container::vector<Callback> actions;
+				group->options.memoryLimit = 100;
+				process = group->enabledProcesses[0];
+				setProcessMemoryUsage(process, 200);
+				group->checkMemoryLimits(actions);
+				ensure("(1)", process->memoryLimitExceeded);
+			}
+			EVENTUALLY(5,
+				LockGuard l(pool->syncher);
+				result = process->enabled == Process::DETACHED && !group->spawning();
+			);
+		}
+
+		LockGuard l(pool->syncher);
+		boost::container::vector<Callback> actions;
+		ensure_equals("(2)", group->memoryLimitBackoffLevel, 2u);
+		ensure("(3)", group->memoryLimitBackoffEndTime > SystemTime::getUsec());
+		process = group->enabledProcesses[0];
+		setProcessMemoryUsage(process, 200);
+		group->checkMemoryLimits(actions);
+		ensure("(4)", !process->memoryLimitExceeded);
+		ensure("(5)", !group->spawning());
+		ensure_equals("(6)", group->processesRecycledForMemoryLimit, 2ull);
+
+		// A freshly spawned process that is within the limit ends the backoff.
+		setProcessMemoryUsage(process, 50);
+		group->checkMemoryLimits(actions);
+		ensure_equals("(7)", group->memoryLimitBackoffLevel, 0u);
+		ensure_equals("(8)", group->memoryLimitBackoffEndTime, 0ull);
+	}
+
+	TEST_METHOD(100) {
+		// If a group whose processes are all busy can't take a process from
+		// another group, then get() doesn't try again for a while.
+		pool->setMax(2);
+		Options options = ensureMinProcesses(1);
+		GroupPtr group1 = pool->findOrCreateGroup(options);
+		Options options2 = createOptions();
+		options2.appGroupName = "test2";
+		retainSessions = true;
+		pool->asyncGet(options, callback);
+		pool->asyncGet(options2, callback);
+		EVENTUALLY(5,
+			result = number == 3;
+		);
+
+		unsigned long long before = SystemTime::getUsec();
+		pool->asyncGet(options, callback);
+		{
+			LockGuard l(pool->syncher);
+			ensure_equals("(1)", group1->getWaitlist.size(), 1u);
+			ensure("(2)", pool->capacityDecisions.empty());
+			ensure("(3)", pool->nextBusyGroupRebalanceTime
+				>= before + CAPACITY_REBALANCE_RETRY_INTERVAL);
+		}
+
+		// Let the queued request finish, so that the pool can be destroyed.
+		clearAllSessions();
+		EVENTUALLY(5,
+			result = number == 4;
+		);
+		clearAllSessions();
+	}
+
 	// TODO: Persistent connections.
 	// TODO: If one closes the session before it has reached EOF, and process's maximum concurrency
 	//       has already been reached, then the pool should ping the process so that it can detect
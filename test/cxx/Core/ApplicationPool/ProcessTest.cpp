@@ -204,4 +204,26 @@ namespace tut {
 				&& gatheredOutput.find("errorPipe 2\n") != string::npos;
 		);
 	}
+
+	TEST_METHOD(6) {
+		set_test_name("The warmup weight ramps up linearly after spawning");
+		ProcessPtr process = createProcess();
+		unsigned long long warmupTime = 10000000;
+		unsigned long long t = process->getSpawnEndTime();
+
+		ensure_equals(process->getWarmupWeight(t, 0), 1.0);
+		ensure_equals(process->getWarmupWeight(t, warmupTime), 0.1);
+		ensure_equals(process->getWarmupWeight(t + 5000000, warmupTime), 0.5);
+		ensure_equals(process->getWarmupWeight(t + 10000000, warmupTime), 1.0);
+
+		// A warmed up process's busyness is unchanged.
+		SessionPtr session = process->newSession();
+		ensure_equals(process->getWarmupBusyness(t + 10000000, warmupTime),
+			(double) process->busyness());
+		// At half weight, 1 session plus the one about to be routed count
+		// as 4, so it looks as busy as a warmed up process with 3 sessions.
+		ensure("(1)", fabs(process->getWarmupBusyness(t + 5000000, warmupTime)
+			- 3 * (INT_MAX / 9.0)) < 2);
+		process->sessionClosed(session.get());
+	}
 }
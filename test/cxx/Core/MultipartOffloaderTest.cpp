@@ -0,0 +1,195 @@
+#include <TestSupport.h>
+#include <BackgroundEventLoop.h>
+#include <ServerKit/Context.h>
+#include <Core/RequestHandler/MultipartOffloader.h>
+
+using namespace Passenger;
+using namespace Passenger::MemoryKit;
+using namespace std;
+
+namespace tut {
+	struct Core_MultipartOffloaderTest {
+		BackgroundEventLoop bg;
+		ServerKit::Context context;
+		RandomGenerator randomGenerator;
+		MultipartOffloader *offloader;
+		string output;
+
+		Core_MultipartOffloaderTest()
+			: bg(false, true),
+			  context(bg.safe, bg.libuv_loop)
+		{
+			offloader = new MultipartOffloader(&context, "XyZ", "/tmp", &randomGenerator);
+			offloader->outputCallback = onOutput;
+			offloader->userData = this;
+		}
+
+		~Core_MultipartOffloaderTest() {
+			offloader->destroy();
+		}
+
+		static void onOutput(MultipartOffloader *offloader, const mbuf &buffer) {
+			Core_MultipartOffloaderTest *self =
+				static_cast<Core_MultipartOffloaderTest *>(offloader->userData);
+			self->output.append(buffer.start, buffer.size());
+		}
+
+		int feed(const string &data) {
+			assert(data.size() < context.mbuf_pool.mbuf_block_chunk_size);
+			mbuf buf = mbuf_get(&context.mbuf_pool);
+			memcpy(buf.start, data.data(), data.size());
+			buf = mbuf(buf, 0, (unsigned int) data.size());
+			return offloader->feed(buf);
+		}
+	};
+
+	DEFINE_TEST_GROUP(Core_MultipartOffloaderTest);
+
+	TEST_METHOD(1) {
+		set_test_name("Non-file parts are passed through unchanged");
+		string body =
+			"--XyZ\r\n"
+			"Content-Disposition: form-data; name=\"title\"\r\n"
+			"\r\n"
+			"hello\r\n"
+			"--XyZ\r\n"
+			"Content-Disposition: form-data; name=\"avatar[caption]\"\r\n"
+			"\r\n"
+			"me\r\n"
+			"--XyZ--\r\n";
+
+		ensure_equals(feed(body), (int) body.size());
+		ensure_equals(offloader->finish(), 0);
+		ensure("No error", !offloader->hasError());
+		ensure_equals(output, body);
+		ensure_equals(offloader->getFiles().size(), 0u);
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("Client-supplied fields that look like offloaded file descriptions are dropped");
+		string body =
+			"--XyZ\r\n"
+			"Content-Disposition: form-data; name=\"avatar[path]\"\r\n"
+			"\r\n"
+			"/etc/passwd\r\n"
+			"--XyZ\r\n"
+			"Content-Disposition: form-data; name=\"title\"\r\n"
+			"\r\n"
+			"hello\r\n"
+			"--XyZ\r\n"
+			"Content-Disposition: form-data; name=\"avatar[size]\"\r\n"
+			"\r\n"
+			"1234\r\n"
+			"--XyZ\r\n"
+			"Content-Disposition: form-data; name=\"avatar[filename]\"\r\n"
+			"\r\n"
+			"passwd\r\n"
+			"--XyZ\r\n"
+			"Content-Disposition: form-data; name=\"avatar[content_type]\"\r\n"
+			"\r\n"
+			"text/plain\r\n"
+			"--XyZ--\r\n";
+
+		ensure_equals(feed(body), (int) body.size());
+		ensure_equals(offloader->finish(), 0);
+		ensure("No error", !offloader->hasError());
+		ensure_equals(output,
+			"--XyZ\r\n"
+			"Content-Disposition: form-data; name=\"title\"\r\n"
+			"\r\n"
+			"hello\r\n"
+			"--XyZ--\r\n");
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("Forged fields are dropped even if their brackets are malformed the way Rack accepts");
+		string body =
+			"--XyZ\r\n"
+			"Content-Disposition: form-data; name=\"avatar[path\"\r\n"
+			"\r\n"
+			"/etc/passwd\r\n"
+			"--XyZ\r\n"
+			"Content-Disposition: form-data; name=\"avatar[path]]\"\r\n"
+			"\r\n"
+			"/etc/passwd\r\n"
+			"--XyZ\r\n"
+			"Content-Disposition: form-data; name=\"avatar]path\"\r\n"
+			"\r\n"
+			"/etc/passwd\r\n"
+			"--XyZ\r\n"
+			"Content-Disposition: form-data; name=\"[avatar][path]\"\r\n"
+			"\r\n"
+			"/etc/passwd\r\n"
+			"--XyZ\r\n"
+			"Content-Disposition: form-data; name=\"avatars[][path]\"\r\n"
+			"\r\n"
+			"/etc/passwd\r\n"
+			"--XyZ\r\n"
+			"Content-Disposition: form-data; name=\"user[avatar][size]]]\"\r\n"
+			"\r\n"
+			"1234\r\n"
+			"--XyZ--\r\n";
+
+		ensure_equals(feed(body), (int) body.size());
+		ensure_equals(offloader->finish(), 0);
+		ensure("No error", !offloader->hasError());
+		ensure_equals(output, "--XyZ--\r\n");
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("Fields that Rack doesn't parse as a file description are passed through");
+		string body =
+			"--XyZ\r\n"
+			"Content-Disposition: form-data; name=\"path\"\r\n"
+			"\r\n"
+			"a\r\n"
+			"--XyZ\r\n"
+			"Content-Disposition: form-data; name=\"avatar[path][]\"\r\n"
+			"\r\n"
+			"b\r\n"
+			"--XyZ\r\n"
+			"Content-Disposition: form-data; name=\"avatar[paths]\"\r\n"
+			"\r\n"
+			"c\r\n"
+			"--XyZ--\r\n";
+
+		ensure_equals(feed(body), (int) body.size());
+		ensure_equals(offloader->finish(), 0);
+		ensure("No error", !offloader->hasError());
+		ensure_equals(output, body);
+	}
+
+	TEST_METHOD(5) {
+		set_test_name("Parts with duplicate names or Content-Disposition headers are dropped");
+		string body =
+			"--XyZ\r\n"
+			"Content-Disposition: form-data; name=\"x\"; name=\"avatar[path]\"\r\n"
+			"\r\n"
+			"/etc/passwd\r\n"
+			"--XyZ\r\n"
+			"Content-Disposition: form-data; name=\"x\"\r\n"
+			"Content-Disposition: form-data; name=\"avatar[path]\"\r\n"
+			"\r\n"
+			"/etc/passwd\r\n"
+			"--XyZ\r\n"
+			"Content-Disposition: form-data; name=\"x\"; filename=\"a.txt\"; name=\"avatar[path]\"\r\n"
+			"\r\n"
+			"/etc/passwd\r\n"
+			"--XyZ\r\n"
+			"Content-Disposition: form-data; name=\"title\"\r\n"
+			"\r\n"
+			"hello\r\n"
+			"--XyZ--\r\n";
+
+		ensure_equals(feed(body), (int) body.size());
+		ensure_equals(offloader->finish(), 0);
+		ensure("No error", !offloader->hasError());
+		ensure_equals(output,
+			"--XyZ\r\n"
+			"Content-Disposition: form-data; name=\"title\"\r\n"
+			"\r\n"
+			"hello\r\n"
+			"--XyZ--\r\n");
+		ensure_equals(offloader->getFiles().size(), 0u);
+	}
+}
@@ -1465,3 +1465,482 @@ namespace tut {
 	/***************************/
 }
 #endif
+
+#include <TestSupport.h>
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+#include <oxt/system_calls.hpp>
+#include <BackgroundEventLoop.h>
+#include <Core/RequestHandler.h>
+#include <Core/ApplicationPool/Pool.h>
+#include <Utils/IOUtils.h>
+#include <Utils/StrIntUtils.h>
+#include <Utils/BufferedIO.h>
+
+using namespace Passenger;
+using namespace Passenger::ApplicationPool2;
+using namespace std;
+using namespace oxt;
+
+namespace tut {
+	struct Core_RequestHandlerTest {
+		BackgroundEventLoop bg;
+		ServerKit::Context context;
+		VariantMap agentsOptions;
+		SpawningKit::ConfigPtr spawningKitConfig;
+		SpawningKit::FactoryPtr spawningKitFactory;
+		PoolPtr appPool;
+		RequestHandler *handler;
+		TempDir appRoot;
+		int serverSocket;
+		int appSocket;
+		FileDescriptor fd;
+		BufferedIO io;
+
+		Core_RequestHandlerTest()
+			: bg(false, true),
+			  context(bg.safe, bg.libuv_loop),
+			  handler(NULL),
+			  appRoot("tmp.handler"),
+			  appSocket(-1)
+		{
+			setLogLevel(LVL_WARN);
+			context.defaultFileBufferedChannelConfig.bufferDir = "/tmp";
+			makeDirTree("tmp.handler/public");
+
+			spawningKitConfig = boost::make_shared<SpawningKit::Config>();
+			spawningKitConfig->resourceLocator = resourceLocator;
+			spawningKitConfig->finalize();
+			spawningKitFactory = boost::make_shared<SpawningKit::Factory>(spawningKitConfig);
+			appPool = boost::make_shared<Pool>(spawningKitFactory);
+			appPool->initialize();
+
+			agentsOptions.set("multi_app", "false");
+			agentsOptions.set("app_root", absolutizePath("tmp.handler"));
+			agentsOptions.set("app_type", "rack");
+			agentsOptions.set("startup_file", "config.ru");
+			agentsOptions.set("environment", "production");
+			agentsOptions.set("spawn_method", "dummy");
+			agentsOptions.setBool("serve_static_files", true);
+			agentsOptions.setInt("stat_throttle_rate", 0);
+			agentsOptions.setInt("response_buffer_high_watermark", 128 * 1024);
+			agentsOptions.setBool("show_version_in_header", false);
+			agentsOptions.setBool("sticky_sessions", false);
+			agentsOptions.setBool("core_graceful_exit", true);
+			agentsOptions.set("default_ruby", "ruby");
+			agentsOptions.set("default_server_name", "localhost");
+			agentsOptions.set("default_server_port", "80");
+			agentsOptions.set("server_software", "Passenger");
+			agentsOptions.set("sticky_sessions_cookie_name", "_passenger_route");
+			agentsOptions.setBool("user_switching", false);
+			agentsOptions.setInt("min_instances", 1);
+			agentsOptions.setInt("max_preloader_idle_time", 0);
+			agentsOptions.setBool("load_shell_envvars", false);
+			agentsOptions.setInt("max_request_queue_time", 0);
+			agentsOptions.setInt("request_queue_target", 0);
+			agentsOptions.setInt("request_queue_interval", 0);
+			agentsOptions.setBool("request_queue_adaptive_lifo", false);
+			agentsOptions.setInt("warmup_time", 0);
+			agentsOptions.setInt("standby_processes", 0);
+			agentsOptions.setInt("memory_limit", 0);
+			agentsOptions.setBool("sticky_sessions_fallback", false);
+			agentsOptions.setBool("rolling_restarts", false);
+			agentsOptions.setInt("rolling_restart_batch_size", 1);
+			agentsOptions.set("friendly_error_pages", "false");
+			agentsOptions.setBool("turbocaching", false);
+
+			serverSocket = createUnixServer("tmp.server");
+		}
+
+		~Core_RequestHandlerTest() {
+			if (handler != NULL) {
+				startLoop();
+				fd.close();
+				// Silence error disconnection messages during shutdown.
+				setLogLevel(LVL_CRIT);
+				bg.safe->runSync(boost::bind(&RequestHandler::shutdown, handler, true));
+				while (getServerState() != RequestHandler::FINISHED_SHUTDOWN) {
+					syscalls::usleep(10000);
+				}
+			}
+			safelyClose(serverSocket);
+			unlink("tmp.server");
+			if (appSocket != -1) {
+				safelyClose(appSocket);
+				unlink("tmp.app");
+			}
+			bg.stop();
+			delete handler;
+			appPool->destroy();
+			appPool.reset();
+			setLogLevel(DEFAULT_LOG_LEVEL);
+		}
+
+		void init() {
+			handler = new RequestHandler(&context, &agentsOptions);
+			handler->resourceLocator = resourceLocator;
+			handler->appPool = appPool;
+			handler->initialize();
+			handler->listen(serverSocket);
+		}
+
+		void startLoop() {
+			if (!bg.isStarted()) {
+				bg.start();
+			}
+		}
+
+		FileDescriptor &connectToServer() {
+			startLoop();
+			fd = FileDescriptor(connectToUnixServer("tmp.server", __FILE__, __LINE__), NULL, 0);
+			io = BufferedIO(fd);
+			return fd;
+		}
+
+		void sendRequest(const StaticString &data) {
+			writeExact(fd, data);
+		}
+
+		string readResponseHeader() {
+			string result;
+			string line;
+			do {
+				line = io.readLine();
+				if (line.empty()) {
+					break;
+				} else {
+					result.append(line);
+					if (line == "\r\n") {
+						break;
+					}
+				}
+			} while (true);
+			return result;
+		}
+
+		string readResponseBody(unsigned int size) {
+			string result;
+			char buf[1024 * 16];
+			unsigned long long timeout = 5000000;
+
+			while (result.size() < size) {
+				unsigned int ret = io.read(buf,
+					std::min<unsigned int>(sizeof(buf), size - result.size()),
+					&timeout);
+				if (ret == 0) {
+					break;
+				}
+				result.append(buf, ret);
+			}
+			return result;
+		}
+
+		string getHeader(const string &header, const string &name) {
+			string::size_type start = header.find("\r\n" + name + ": ");
+			if (start == string::npos) {
+				return string();
+			}
+			start += name.size() + 4;
+			return header.substr(start, header.find("\r\n", start) - start);
+		}
+
+		string createStaticFile(const string &name, unsigned int size) {
+			string contents;
+			contents.reserve(size);
+			for (unsigned int i = 0; i < size; i++) {
+				contents.append(1, (char) ('a' + i % 26));
+			}
+			createFile("tmp.handler/public/" + name, contents);
+			return contents;
+		}
+
+		/**
+		 * Makes the spawned (dummy) processes listen on a socket that
+		 * the test accepts connections on, so that the test plays the
+		 * application. Must be called before `init()`.
+		 */
+		void listenAsApp() {
+			appSocket = createUnixServer("tmp.app");
+			spawningKitConfig->dummySocketAddress = "unix:" + absolutizePath("tmp.app");
+		}
+
+		FileDescriptor acceptAppConnection() {
+			unsigned long long timeout = 5000000;
+			ensure("The application receives a connection",
+				waitUntilReadable(appSocket, &timeout));
+			return FileDescriptor(syscalls::accept(appSocket, NULL, NULL), NULL, 0);
+		}
+
+		Json::Value inspectState() {
+			Json::Value result;
+			bg.safe->runSync(boost::bind(&Core_RequestHandlerTest::_inspectState,
+				this, &result));
+			return result;
+		}
+
+		void _inspectState(Json::Value *result) {
+			*result = handler->inspectStateAsJson();
+		}
+
+		RequestHandler::State getServerState() {
+			RequestHandler::State result;
+			bg.safe->runSync(boost::bind(&Core_RequestHandlerTest::_getServerState,
+				this, &result));
+			return result;
+		}
+
+		void _getServerState(RequestHandler::State *state) {
+			*state = handler->serverState;
+		}
+
+		unsigned int getActiveClientCount() {
+			unsigned int result;
+			bg.safe->runSync(boost::bind(&Core_RequestHandlerTest::_getActiveClientCount,
+				this, &result));
+			return result;
+		}
+
+		void _getActiveClientCount(unsigned int *result) {
+			*result = handler->activeClientCount;
+		}
+	};
+
+	DEFINE_TEST_GROUP(Core_RequestHandlerTest);
+
+	/***** Static files *****/
+
+	TEST_METHOD(1) {
+		set_test_name("It serves static files larger than a single sendfile() burst "
+			"to clients that read slowly");
+		// Larger than STATIC_FILE_SEND_BURST, and larger than the socket
+		// buffers, so that the handler has to wait for the socket to
+		// become writable.
+		string contents = createStaticFile("large.txt", 3 * 1024 * 1024 + 123);
+		init();
+		connectToServer();
+		sendRequest(
+			"GET /large.txt HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"\r\n");
+		syscalls::usleep(100000);
+
+		string header = readResponseHeader();
+		ensure(header, containsSubstring(header, "HTTP/1.1 200 OK\r\n"));
+		ensure_equals(getHeader(header, "Content-Length"), toString(contents.size()));
+		ensure_equals(getHeader(header, "Content-Type"), "text/plain; charset=utf-8");
+		ensure("ETag", !getHeader(header, "ETag").empty());
+		ensure("Last-Modified", !getHeader(header, "Last-Modified").empty());
+
+		string body;
+		char buf[1024 * 16];
+		unsigned long long timeout = 5000000;
+		while (body.size() < contents.size()) {
+			unsigned int ret = io.read(buf, sizeof(buf), &timeout);
+			if (ret == 0) {
+				break;
+			}
+			body.append(buf, ret);
+			if (body.size() < 1024 * 1024) {
+				// Keep the socket buffers full for a while.
+				syscalls::usleep(1000);
+			}
+		}
+		ensure_equals("The whole body is received", body.size(), contents.size());
+		ensure("The body is intact", body == contents);
+		ensure_equals("The connection is closed afterwards", io.readAll(), "");
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("It responds to HEAD requests for static files without a body");
+		string contents = createStaticFile("hello.txt", 1000);
+		init();
+		connectToServer();
+		sendRequest(
+			"HEAD /hello.txt HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"\r\n");
+		string header = readResponseHeader();
+		ensure(header, containsSubstring(header, "HTTP/1.1 200 OK\r\n"));
+		ensure_equals(getHeader(header, "Content-Length"), "1000");
+		ensure_equals(io.readAll(), "");
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("It responds with 304 if the static file's ETag matches If-None-Match");
+		createStaticFile("hello.txt", 1000);
+		init();
+		connectToServer();
+		sendRequest(
+			"GET /hello.txt HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"\r\n");
+		string header = readResponseHeader();
+		string etag = getHeader(header, "ETag");
+		ensure("ETag", !etag.empty());
+		ensure_equals(readResponseBody(1000).size(), 1000u);
+
+		sendRequest(
+			"GET /hello.txt HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"If-None-Match: " + etag + "\r\n"
+			"Connection: close\r\n"
+			"\r\n");
+		header = readResponseHeader();
+		ensure(header, containsSubstring(header, "HTTP/1.1 304 Not Modified\r\n"));
+		ensure_equals(getHeader(header, "ETag"), etag);
+		ensure_equals(io.readAll(), "");
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("It responds with 304 if the static file hasn't been modified "
+			"since If-Modified-Since");
+		createStaticFile("hello.txt", 1000);
+		init();
+		connectToServer();
+		sendRequest(
+			"HEAD /hello.txt HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"\r\n");
+		string lastModified = getHeader(readResponseHeader(), "Last-Modified");
+		ensure("Last-Modified", !lastModified.empty());
+
+		sendRequest(
+			"GET /hello.txt HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"If-Modified-Since: " + lastModified + "\r\n"
+			"Connection: close\r\n"
+			"\r\n");
+		string header = readResponseHeader();
+		ensure(header, containsSubstring(header, "HTTP/1.1 304 Not Modified\r\n"));
+		ensure_equals(io.readAll(), "");
+	}
+
+	TEST_METHOD(5) {
+		set_test_name("It responds with 200 if If-Modified-Since is older than the static file");
+		string contents = createStaticFile("hello.txt", 1000);
+		init();
+		connectToServer();
+		sendRequest(
+			"GET /hello.txt HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"If-Modified-Since: Thu, 01 Jan 1970 00:00:01 GMT\r\n"
+			"Connection: close\r\n"
+			"\r\n");
+		string header = readResponseHeader();
+		ensure(header, containsSubstring(header, "HTTP/1.1 200 OK\r\n"));
+		ensure("The body is intact", io.readAll() == contents);
+	}
+
+	TEST_METHOD(6) {
+		set_test_name("It keeps the connection alive after a static file response");
+		string contents = createStaticFile("large.txt", 1024 * 1024 + 1);
+		string contents2 = createStaticFile("hello.txt", 1000);
+		init();
+		connectToServer();
+		sendRequest(
+			"GET /large.txt HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"\r\n");
+		string header = readResponseHeader();
+		ensure(header, containsSubstring(header, "HTTP/1.1 200 OK\r\n"));
+		ensure_equals(getHeader(header, "Connection"), "keep-alive");
+		ensure("The first body is intact",
+			readResponseBody(contents.size()) == contents);
+
+		sendRequest(
+			"GET /hello.txt HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"\r\n");
+		header = readResponseHeader();
+		ensure(header, containsSubstring(header, "HTTP/1.1 200 OK\r\n"));
+		ensure("The second body is intact", io.readAll() == contents2);
+	}
+
+	TEST_METHOD(7) {
+		set_test_name("It cleans up if the client disconnects in the middle of "
+			"a static file body");
+		string contents = createStaticFile("large.txt", 4 * 1024 * 1024);
+		string contents2 = createStaticFile("hello.txt", 1000);
+		init();
+		connectToServer();
+		sendRequest(
+			"GET /large.txt HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"\r\n");
+		string header = readResponseHeader();
+		ensure(header, containsSubstring(header, "HTTP/1.1 200 OK\r\n"));
+		ensure_equals(readResponseBody(1024).size(), 1024u);
+		fd.close();
+
+		EVENTUALLY(5,
+			result = getActiveClientCount() == 0;
+		);
+
+		connectToServer();
+		sendRequest(
+			"GET /hello.txt HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"\r\n");
+		header = readResponseHeader();
+		ensure(header, containsSubstring(header, "HTTP/1.1 200 OK\r\n"));
+		ensure("The body is intact", io.readAll() == contents2);
+	}
+
+	/***** Application response timeouts *****/
+
+	TEST_METHOD(8) {
+		set_test_name("If the application doesn't send a response header within "
+			"app_response_header_timeout, the client gets a 504 response");
+		agentsOptions.setInt("app_response_header_timeout", 200);
+		// Silence the timeout warnings.
+		setLogLevel(LVL_ERROR);
+		listenAsApp();
+		init();
+		connectToServer();
+		sendRequest(
+			"GET /stall HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"\r\n");
+
+		// Accept the session, but never respond.
+		FileDescriptor app = acceptAppConnection();
+		string response = io.readAll();
+		ensure(response, containsSubstring(response, "HTTP/1.1 504 Gateway Timeout\r\n"));
+		ensure(response, containsSubstring(response, "The application did not respond in time"));
+		ensure_equals(inspectState()["app_response_timeouts"]["header"].asUInt(), 1u);
+		ensure_equals(inspectState()["app_response_timeouts"]["body"].asUInt(), 0u);
+	}
+
+	TEST_METHOD(9) {
+		set_test_name("If the application stops sending the response body for longer than "
+			"app_response_body_timeout, the client is disconnected");
+		agentsOptions.setInt("app_response_body_timeout", 200);
+		// Silence the timeout warnings.
+		setLogLevel(LVL_ERROR);
+		listenAsApp();
+		init();
+		connectToServer();
+		sendRequest(
+			"GET /stall HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"\r\n");
+
+		FileDescriptor app = acceptAppConnection();
+		writeExact(app,
+			"HTTP/1.1 200 OK\r\n"
+			"Content-Length: 100\r\n"
+			"\r\n"
+			"hello");
+		string header = readResponseHeader();
+		ensure(header, containsSubstring(header, "HTTP/1.1 200 OK\r\n"));
+		ensure_equals("The response is cut off, because a 504 can't be sent anymore",
+			io.readAll(), "hello");
+		ensure_equals(inspectState()["app_response_timeouts"]["body"].asUInt(), 1u);
+		ensure_equals(inspectState()["app_response_timeouts"]["header"].asUInt(), 0u);
+	}
+}
@@ -0,0 +1,129 @@
+#include <TestSupport.h>
+#include <Core/SpawningKit/ShellEnvvarsCache.h>
+#include <Utils/SystemTime.h>
+#include <ctime>
+
+using namespace Passenger;
+using namespace Passenger::SpawningKit;
+
+namespace tut {
+	struct Core_SpawningKit_ShellEnvvarsCacheTest {
+		TempDir tmpDir;
+		UserSwitchingInfo user;
+		string environment;
+
+		Core_SpawningKit_ShellEnvvarsCacheTest()
+			: tmpDir("tmp.shell_envvars_cache")
+		{
+			user.username = "alice";
+			user.shell = "/bin/bash";
+			user.home = absolutizePath("tmp.shell_envvars_cache");
+			createFile("tmp.shell_envvars_cache/.bashrc", "export FOO=bar\n");
+			runShellCommand("touch -d '2000-01-01' tmp.shell_envvars_cache/.bashrc");
+
+			environment = pair("FOO", "bar") + pair("PWD", "/somewhere") + pair("SHLVL", "2");
+		}
+
+		~Core_SpawningKit_ShellEnvvarsCacheTest() {
+			SystemTime::releaseAll();
+		}
+
+		static string pair(const StaticString &key, const StaticString &value) {
+			string result;
+			result.append(key.data(), key.size());
+			result.append(1, '\0');
+			result.append(value.data(), value.size());
+			result.append(1, '\0');
+			return result;
+		}
+
+		static unsigned long long now() {
+			return (unsigned long long) time(NULL) * 1000000 + 1000000;
+		}
+	};
+
+	DEFINE_TEST_GROUP(Core_SpawningKit_ShellEnvvarsCacheTest);
+
+	TEST_METHOD(1) {
+		set_test_name("A stored environment can be looked up, "
+			"without invocation-specific variables");
+		ShellEnvvarsCache cache;
+		string envvars;
+
+		ensure("(1)", !cache.lookup(user, "/", "/app", envvars));
+		ensure("(2)", cache.store(user, "/", "/app", environment, now()));
+		ensure("(3)", cache.lookup(user, "/", "/app", envvars));
+		ensure_equals("(4)", envvars, pair("FOO", "bar"));
+		ensure("(5)", !cache.lookup(user, "/", "/other-app", envvars));
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("Entries are invalidated when a shell initialization file changes");
+		ShellEnvvarsCache cache;
+		string envvars;
+
+		ensure("(1)", cache.store(user, "/", "/app", environment, now()));
+		createFile("tmp.shell_envvars_cache/.bashrc", "export FOO=baz\nexport BAR=1\n");
+		runShellCommand("touch -d '2000-01-01' tmp.shell_envvars_cache/.bashrc");
+		ensure("(2)", !cache.lookup(user, "/", "/app", envvars));
+
+		ensure("(3)", cache.store(user, "/", "/app", environment, now()));
+		createFile("tmp.shell_envvars_cache/.profile", "");
+		ensure("(4)", !cache.lookup(user, "/", "/app", envvars));
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("Entries expire after the TTL");
+		ShellEnvvarsCache cache(10);
+		string envvars;
+
+		SystemTime::forceUsec(1000000000);
+		ensure("(1)", cache.store(user, "/", "/app", environment, now()));
+		SystemTime::forceUsec(1000000000 + 9000000);
+		ensure("(2)", cache.lookup(user, "/", "/app", envvars));
+		SystemTime::forceUsec(1000000000 + 10000000);
+		ensure("(3)", !cache.lookup(user, "/", "/app", envvars));
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("An environment is not stored if a shell initialization file "
+			"was modified after the spawn began");
+		ShellEnvvarsCache cache;
+		string envvars;
+
+		createFile("tmp.shell_envvars_cache/.bashrc", "export FOO=baz\n");
+		ensure("(1)", !cache.store(user, "/", "/app", environment,
+			(unsigned long long) time(NULL) * 1000000 - 5000000));
+		ensure("(2)", !cache.lookup(user, "/", "/app", envvars));
+	}
+
+	TEST_METHOD(5) {
+		set_test_name("A TTL of 0 disables the cache");
+		ShellEnvvarsCache cache(0);
+		string envvars;
+
+		ensure("(1)", !cache.isEnabled());
+		ensure("(2)", !cache.store(user, "/", "/app", environment, now()));
+		ensure("(3)", !cache.lookup(user, "/", "/app", envvars));
+	}
+
+	TEST_METHOD(6) {
+		set_test_name("Entries are invalidated when a file in /etc/profile.d "
+			"is modified in place");
+		TempDir chrootDir("tmp.shell_envvars_chroot");
+		ShellEnvvarsCache cache;
+		string envvars;
+
+		user.home = "/home/alice";
+		makeDirTree("tmp.shell_envvars_chroot/etc/profile.d");
+		createFile("tmp.shell_envvars_chroot/etc/profile.d/foo.sh", "export FOO=bar\n");
+		runShellCommand("touch -d '2000-01-01' tmp.shell_envvars_chroot/etc/profile.d/foo.sh");
+		string chroot = absolutizePath("tmp.shell_envvars_chroot");
+
+		ensure("(1)", cache.store(user, chroot, "/app", environment, now()));
+		ensure("(2)", cache.lookup(user, chroot, "/app", envvars));
+		createFile("tmp.shell_envvars_chroot/etc/profile.d/foo.sh", "export FOO=baz\n");
+		runShellCommand("touch -d '2001-01-01' tmp.shell_envvars_chroot/etc/profile.d/foo.sh");
+		ensure("(3)", !cache.lookup(user, chroot, "/app", envvars));
+	}
+}
@@ -0,0 +1,186 @@
+#include <TestSupport.h>
+#include <Core/RequestHandler/StaticFileCache.h>
+#include <Utils/FileWatcher.h>
+#include <Utils.h>
+
+using namespace Passenger;
+using namespace std;
+
+namespace tut {
+	struct Core_StaticFileCacheTest {
+		TempDir tmpDir;
+		string publicDir;
+
+		Core_StaticFileCacheTest()
+			: tmpDir("tmp.static")
+		{
+			publicDir = "tmp.static/public";
+			makeDirTree(publicDir + "/assets");
+		}
+
+		StaticFileCache::EntryPtr lookup(StaticFileCache &cache, const char *uriPath,
+			ev_tstamp now = 1)
+		{
+			return cache.lookup(publicDir, uriPath, now);
+		}
+	};
+
+	DEFINE_TEST_GROUP(Core_StaticFileCacheTest);
+
+	TEST_METHOD(1) {
+		set_test_name("URI paths are mapped to files like Passenger's Nginx module does");
+		StaticFileCache cache;
+		createFile(publicDir + "/assets/app.css", "body {}");
+		createFile(publicDir + "/index.html", "index");
+		createFile(publicDir + "/about.html", "about");
+
+		StaticFileCache::EntryPtr entry = lookup(cache, "/assets/app.css");
+		ensure("(1)", entry != NULL);
+		ensure_equals("(2)", entry->filename, publicDir + "/assets/app.css");
+		ensure_equals("(3)", entry->variants[StaticFileCache::IDENTITY].size, (off_t) 7);
+		ensure_equals("(4)", entry->contentType, "text/css; charset=utf-8");
+		ensure_equals("(5)", lookup(cache, "/")->filename, publicDir + "/index.html");
+		ensure_equals("(6)", lookup(cache, "/about")->filename, publicDir + "/about.html");
+		ensure_equals("(7)", lookup(cache, "/assets/app%2Ecss")->filename,
+			publicDir + "/assets/app.css");
+		ensure("(8)", lookup(cache, "/assets") == NULL);
+		ensure("(9)", lookup(cache, "/missing.css") == NULL);
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("Paths that could escape the public directory are rejected");
+		string result;
+		ensure("(1)", !StaticFileCache::decodeUriPath("/../secret", result));
+		ensure("(2)", !StaticFileCache::decodeUriPath("/assets/%2e%2e/secret", result));
+		ensure("(3)", !StaticFileCache::decodeUriPath("/assets/./app.css", result));
+		ensure("(4)", !StaticFileCache::decodeUriPath("/foo%00.css", result));
+		ensure("(5)", !StaticFileCache::decodeUriPath("/foo%2", result));
+		ensure("(6)", !StaticFileCache::decodeUriPath("foo", result));
+		ensure("(7)", StaticFileCache::decodeUriPath("/a..b/%41", result));
+		ensure_equals("(8)", result, "/a..b/A");
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("Precompressed siblings are selected according to Accept-Encoding, "
+			"unless they are older than the file");
+		StaticFileCache cache;
+		createFile(publicDir + "/app.js", "alert(1)");
+		createFile(publicDir + "/app.js.gz", "gz");
+		createFile(publicDir + "/app.js.br", "br");
+		createFile(publicDir + "/old.js", "alert(2)");
+		createFile(publicDir + "/old.js.gz", "gz");
+		touchFile((publicDir + "/old.js.gz").c_str(), time(NULL) - 60);
+
+		StaticFileCache::EntryPtr entry = lookup(cache, "/app.js");
+		ensure("(1)", entry->hasPrecompressedVariants());
+		ensure_equals("(2)", entry->selectEncoding("gzip, deflate, br"), StaticFileCache::BROTLI);
+		ensure_equals("(3)", entry->selectEncoding("gzip"), StaticFileCache::GZIP);
+		ensure_equals("(4)", entry->selectEncoding("br;q=0, gzip;q=0.5"), StaticFileCache::GZIP);
+		ensure_equals("(5)", entry->selectEncoding("identity"), StaticFileCache::IDENTITY);
+		ensure_equals("(6)", entry->selectEncoding("*"), StaticFileCache::BROTLI);
+		ensure_equals("(7)", entry->selectEncoding("*, br;q=0.000"), StaticFileCache::GZIP);
+		ensure("(8)", entry->variants[StaticFileCache::GZIP].etag
+			!= entry->variants[StaticFileCache::IDENTITY].etag);
+		ensure("(9)", !lookup(cache, "/old.js")->hasPrecompressedVariants());
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("If-None-Match values are compared with the weak comparison function");
+		ensure("(1)", StaticFileCache::etagMatches("\"abc\"", "\"abc\""));
+		ensure("(2)", StaticFileCache::etagMatches("W/\"abc\"", "\"abc\""));
+		ensure("(3)", StaticFileCache::etagMatches("\"x\", \"abc\"", "\"abc\""));
+		ensure("(4)", StaticFileCache::etagMatches("*", "\"abc\""));
+		ensure("(5)", !StaticFileCache::etagMatches("\"abcd\"", "\"abc\""));
+		ensure("(6)", !StaticFileCache::etagMatches("", "\"abc\""));
+	}
+
+	TEST_METHOD(5) {
+		set_test_name("Entries are reused until the FileWatcher notices a change");
+		FileWatcher watcher;
+		StaticFileCache cache(1024, 1000);
+		watcher.start();
+		cache.setWatcher(&watcher);
+		createFile(publicDir + "/app.css", "a");
+
+		StaticFileCache::EntryPtr entry = lookup(cache, "/app.css");
+		ensure("(1)", lookup(cache, "/app.css") == entry);
+		createFile(publicDir + "/app.css", "abc");
+		EVENTUALLY(5,
+			result = lookup(cache, "/app.css")->variants[StaticFileCache::IDENTITY].size == 3;
+		);
+	}
+
+	TEST_METHOD(6) {
+		set_test_name("Without a FileWatcher, entries are checked with stat() "
+			"after the revalidation interval");
+		StaticFileCache cache(1024, 10);
+		ensure("(1)", lookup(cache, "/app.css", 1) == NULL);
+		createFile(publicDir + "/app.css", "a");
+		ensure("Missing files are cached too", lookup(cache, "/app.css", 5) == NULL);
+		StaticFileCache::EntryPtr entry = lookup(cache, "/app.css", 12);
+		ensure("(3)", entry != NULL);
+		ensure("Unchanged files keep their entry", lookup(cache, "/app.css", 30) == entry);
+	}
+
+	TEST_METHOD(7) {
+		set_test_name("The least recently used entries are evicted");
+		StaticFileCache cache(2);
+		createFile(publicDir + "/a.css", "a");
+		createFile(publicDir + "/b.css", "b");
+		createFile(publicDir + "/c.css", "c");
+
+		StaticFileCache::EntryPtr a = lookup(cache, "/a.css");
+		lookup(cache, "/b.css");
+		ensure("(1)", lookup(cache, "/a.css") == a);
+		StaticFileCache::EntryPtr c = lookup(cache, "/c.css");
+		ensure_equals("(2)", cache.size(), 2u);
+		ensure("(3)", lookup(cache, "/c.css") == c);
+		lookup(cache, "/b.css");
+		ensure("a has been evicted", lookup(cache, "/a.css") != a);
+		ensure("An evicted entry's file stays open while it is referenced",
+			a->variants[StaticFileCache::IDENTITY].fd != -1);
+	}
+
+	TEST_METHOD(8) {
+		set_test_name("Entries for missing files are evicted separately, "
+			"so that they don't evict existing files");
+		StaticFileCache cache(2, 10, 2);
+		createFile(publicDir + "/a.css", "a");
+		createFile(publicDir + "/b.css", "b");
+
+		StaticFileCache::EntryPtr a = lookup(cache, "/a.css");
+		StaticFileCache::EntryPtr b = lookup(cache, "/b.css");
+		ensure("(1)", lookup(cache, "/users/1") == NULL);
+		ensure("(2)", lookup(cache, "/users/2") == NULL);
+		ensure("(3)", lookup(cache, "/users/3") == NULL);
+		ensure_equals("2 files and 2 missing files are cached", cache.size(), 4u);
+		ensure("a is still cached", lookup(cache, "/a.css") == a);
+		ensure("b is still cached", lookup(cache, "/b.css") == b);
+		ensure_equals("(6)", cache.inspectStateAsJson()["negative_entries"].asUInt(), 2u);
+	}
+
+	TEST_METHOD(9) {
+		set_test_name("Symlinks are only followed if they have the same owner as their target");
+		StaticFileCache cache;
+		createFile("tmp.static/secret.txt", "secret");
+		makeDirTree("tmp.static/shared");
+		createFile("tmp.static/shared/upload.txt", "upload");
+		ensure("(1)", symlink("../secret.txt", (publicDir + "/secret.txt").c_str()) == 0);
+		ensure("(2)", symlink("../shared", (publicDir + "/shared").c_str()) == 0);
+
+		ensure("Symlinks to files with the same owner are followed",
+			lookup(cache, "/secret.txt") != NULL);
+		ensure("Symlinks to directories with the same owner are followed",
+			lookup(cache, "/shared/upload.txt") != NULL);
+
+		if (geteuid() == 0) {
+			StaticFileCache cache2;
+			ensure("(5)", chown("tmp.static/secret.txt", 65534, 65534) == 0);
+			ensure("(6)", chown("tmp.static/shared", 65534, 65534) == 0);
+			ensure("Symlinks to files with another owner are not followed",
+				lookup(cache2, "/secret.txt") == NULL);
+			ensure("Symlinks to directories with another owner are not followed",
+				lookup(cache2, "/shared/upload.txt") == NULL);
+		}
+	}
+}
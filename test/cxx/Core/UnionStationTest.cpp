@@ -651,5 +651,127 @@ namespace tut {
 		ensure("(2)", data.find("transaction 2\n") == string::npos);
 	}
 
+	TEST_METHOD(31) {
+		// Core negotiates binary framing by default and produces the
+		// same log entries as with the text protocol.
+		init();
+		core2->setBinaryProtocol(false);
+		SystemTime::forceAll(YESTERDAY);
+
+		TransactionPtr log = core->newTransaction("foobar");
+		log->message("binary 1");
+		SystemTime::forceAll(TODAY);
+		log->message("binary 2");
+		log->flushToDiskAfterClose(true);
+
+		TransactionPtr log2 = core2->continueTransaction(log->getTxnId(),
+			log->getGroupName(), log->getCategory());
+		log2->message("text 1");
+		log2->flushToDiskAfterClose(true);
+
+		ConnectionPtr connection = core->checkoutConnection();
+		ensure("(1)", connection->binaryProtocol);
+		core->checkinConnection(connection);
+		connection = core2->checkoutConnection();
+		ensure("(2)", !connection->binaryProtocol);
+		core2->checkinConnection(connection);
+
+		log2.reset();
+		log.reset();
+
+		string data = readDumpFile();
+		ensure("(3)", data.find(timestampString(YESTERDAY) + " 0 ATTACH\n") != string::npos);
+		ensure("(4)", data.find(timestampString(YESTERDAY) + " 1 binary 1\n") != string::npos);
+		ensure("(5)", data.find(timestampString(TODAY) + " 2 binary 2\n") != string::npos);
+		ensure("(6)", data.find(timestampString(TODAY) + " 3 ATTACH\n") != string::npos);
+		ensure("(7)", data.find(timestampString(TODAY) + " 4 text 1\n") != string::npos);
+		ensure("(8)", data.find(timestampString(TODAY) + " 5 DETACH\n") != string::npos);
+		ensure("(9)", data.find(timestampString(TODAY) + " 6 DETACH\n") != string::npos);
+	}
+
+	TEST_METHOD(32) {
+		// The UstRouter accepts frames and array messages interleaved on
+		// a connection that negotiated binary framing.
+		using namespace UstRouterBinaryProtocol;
+		init();
+		MessageClient client;
+		vector<string> args;
+		string frames;
+
+		client.connect(socketAddress, "test", "1234");
+		client.write("init", "localhost", "binary", NULL);
+		ensure("(1)", client.read(args));
+		ensure_equals("(2)", args.size(), 3u);
+		ensure_equals("(3)", args[2], "binary");
+
+		FrameBuilder define(frames, DEFINE_STRING);
+		define.appendUint16(0);
+		define.appendData("foobar");
+		define.finish();
+		FrameBuilder defineCategory(frames, DEFINE_STRING);
+		defineCategory.appendUint16(1);
+		defineCategory.appendData("requests");
+		defineCategory.finish();
+
+		FrameBuilder open(frames, OPEN_TRANSACTION);
+		open.appendUint8(CRASH_PROTECT);
+		open.appendUint64(TODAY);
+		open.appendUint16(0);
+		open.appendUint16(1);
+		open.appendUint16(NO_STRING);
+		open.appendUint16(NO_STRING);
+		open.appendSizedString(TODAY_TXN_ID);
+		open.finish();
+
+		FrameBuilder logEntry(frames, LOG);
+		logEntry.appendUint8(0);
+		logEntry.appendUint64(TODAY);
+		logEntry.appendSizedString(TODAY_TXN_ID);
+		logEntry.appendData("hello world");
+		logEntry.finish();
+
+		FrameBuilder close(frames, CLOSE_TRANSACTION);
+		close.appendUint8(0);
+		close.appendUint64(TOMORROW);
+		close.appendSizedString(TODAY_TXN_ID);
+		close.finish();
+
+		writeExact(client.getConnection(), frames);
+		client.write("flush", NULL);
+		ensure("(4)", client.read(args));
+		ensure_equals("(5)", args[1], "ok");
+
+		string data = readDumpFile();
+		ensure("(6)", data.find(TODAY_TXN_ID " " TODAY_TIMESTAMP_STR " 0 ATTACH\n") != string::npos);
+		ensure("(7)", data.find(TODAY_TXN_ID " " TODAY_TIMESTAMP_STR " 1 hello world\n") != string::npos);
+		ensure("(8)", data.find(TODAY_TXN_ID " " + timestampString(TOMORROW) + " 2 DETACH\n") != string::npos);
+	}
+
+	TEST_METHOD(33) {
+		// The UstRouter disconnects clients that refer to undefined strings.
+		using namespace UstRouterBinaryProtocol;
+		init();
+		MessageClient client;
+		vector<string> args;
+		string frames;
+
+		client.connect(socketAddress, "test", "1234");
+		client.write("init", "localhost", "binary", NULL);
+		client.read(args);
+
+		FrameBuilder open(frames, OPEN_TRANSACTION);
+		open.appendUint8(CRASH_PROTECT | ACK);
+		open.appendUint64(TODAY);
+		open.appendUint16(5);
+		open.appendUint16(6);
+		open.appendUint16(NO_STRING);
+		open.appendUint16(NO_STRING);
+		open.appendSizedString(TODAY_TXN_ID);
+		open.finish();
+		writeExact(client.getConnection(), frames);
+
+		ensure(!client.read(args));
+	}
+
 	/************************************/
 }
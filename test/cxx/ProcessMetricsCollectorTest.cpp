@@ -120,4 +120,69 @@ namespace tut {
 			ensure(swap < 10000 || swap == -1);
 		#endif
 	}
+
+	#ifdef PROCESS_METRICS_COLLECTOR_SUPPORTS_PROCFS
+		TEST_METHOD(4) {
+			// On Linux, it collects the metrics from /proc.
+			child = spawnChild(20);
+			usleep(500000);
+			vector<pid_t> pids;
+			pids.push_back(getpid());
+			pids.push_back(child);
+			ProcessMetricMap result = collector.collect(pids);
+
+			ensure_equals(result.size(), 2u);
+			ensure_equals(result[getpid()].ppid, getppid());
+			ensure_equals(result[getpid()].processGroupId, getpgrp());
+			ensure_equals(result[getpid()].uid, geteuid());
+			ensure_equals(result[child].ppid, getpid());
+			ensure("RSS is correct", result[child].rss > 20000 && result[child].rss < 30000);
+			ensure("VM size is at least the RSS", result[child].vmsize >= result[child].rss);
+			ensure("Private dirty is correct", result[child].privateDirty > 20000
+				&& result[child].privateDirty < 30000);
+			ensure("The command line is collected",
+				result[child].command.find("allocate_memory 20") != string::npos);
+		}
+
+		TEST_METHOD(5) {
+			// It does not collect the metrics for PIDs that have exited since
+			// the previous collection.
+			child = spawnChild(1);
+			usleep(100000);
+			vector<pid_t> pids;
+			pids.push_back(getpid());
+			pids.push_back(child);
+			ensure_equals(collector.collect(pids).size(), 2u);
+
+			kill(child, SIGKILL);
+			waitpid(child, NULL, 0);
+			pid_t oldChild = child;
+			child = -1;
+			ProcessMetricMap result = collector.collect(pids);
+			ensure_equals(result.size(), 1u);
+			ensure(result.find(oldChild) == result.end());
+		}
+
+		TEST_METHOD(6) {
+			// The /proc and the 'ps' code paths produce the same metrics.
+			child = spawnChild(20);
+			usleep(500000);
+			vector<pid_t> pids;
+			pids.push_back(child);
+			ProcessMetricMap procResult = collector.collect(pids);
+			collector.setUseProcfs(false);
+			ProcessMetricMap psResult = collector.collect(pids);
+
+			ensure_equals(procResult.size(), 1u);
+			ensure_equals(psResult.size(), 1u);
+			ensure_equals(procResult[child].ppid, psResult[child].ppid);
+			ensure_equals(procResult[child].processGroupId, psResult[child].processGroupId);
+			ensure_equals(procResult[child].uid, psResult[child].uid);
+			ensure_equals(procResult[child].command, psResult[child].command);
+			ensure("RSS is similar",
+				labs((long) (procResult[child].rss - psResult[child].rss)) < 1024);
+			ensure("Private dirty is similar",
+				labs((long) (procResult[child].privateDirty - psResult[child].privateDirty)) < 1024);
+		}
+	#endif
 }
@@ -0,0 +1,261 @@
+#include <TestSupport.h>
+#include <ServerKit/Http2Hpack.h>
+
+using namespace Passenger;
+using namespace Passenger::ServerKit;
+using namespace std;
+
+namespace tut {
+	struct ServerKit_Http2HpackTest {
+		Http2HpackDecoder decoder;
+		Http2HeaderList headers;
+
+		string unhex(const StaticString &str) {
+			string result;
+			string digits;
+			for (string::size_type i = 0; i < str.size(); i++) {
+				if (str[i] != ' ') {
+					digits.append(1, str[i]);
+				}
+			}
+			for (string::size_type i = 0; i + 1 < digits.size(); i += 2) {
+				result.append(1, (char) hexToUint(StaticString(digits.data() + i, 2)));
+			}
+			return result;
+		}
+
+		bool decode(const StaticString &hex) {
+			string data = unhex(hex);
+			headers.clear();
+			return decoder.decode(data.data(), data.size(), headers);
+		}
+
+		void ensureHeader(unsigned int index, const StaticString &name,
+			const StaticString &value)
+		{
+			ensure("Header exists", index < headers.size());
+			ensure_equals("Header name", headers[index].first, name);
+			ensure_equals("Header value", headers[index].second, value);
+		}
+	};
+
+	DEFINE_TEST_GROUP(ServerKit_Http2HpackTest);
+
+	/***** Primitives *****/
+
+	TEST_METHOD(1) {
+		set_test_name("Integers are encoded as in RFC 7541 appendix C.1");
+		string output;
+
+		Http2Hpack::encodeInteger(output, 0, 5, 10);
+		ensure_equals("(1)", output, unhex("0a"));
+
+		output.clear();
+		Http2Hpack::encodeInteger(output, 0, 5, 1337);
+		ensure_equals("(2)", output, unhex("1f 9a 0a"));
+
+		output.clear();
+		Http2Hpack::encodeInteger(output, 0, 8, 42);
+		ensure_equals("(3)", output, unhex("2a"));
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("Integers are decoded as in RFC 7541 appendix C.1");
+		string input = unhex("1f 9a 0a");
+		const unsigned char *pos = (const unsigned char *) input.data();
+		const unsigned char *end = pos + input.size();
+		boost::uint32_t value;
+
+		ensure("(1)", Http2Hpack::decodeInteger(&pos, end, 5, &value));
+		ensure_equals("(2)", value, 1337u);
+		ensure("(3)", pos == end);
+
+		input = unhex("1f 9a");
+		pos = (const unsigned char *) input.data();
+		end = pos + input.size();
+		ensure("Truncated integers are rejected",
+			!Http2Hpack::decodeInteger(&pos, end, 5, &value));
+
+		input = unhex("1f ff ff ff ff ff 01");
+		pos = (const unsigned char *) input.data();
+		end = pos + input.size();
+		ensure("Integers larger than 32 bits are rejected",
+			!Http2Hpack::decodeInteger(&pos, end, 5, &value));
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("Huffman encoding and decoding");
+		string output;
+
+		Http2Hpack::huffmanEncode(output, "www.example.com");
+		ensure_equals("(1)", output, unhex("f1e3 c2e5 f23a 6ba0 ab90 f4ff"));
+		ensure_equals("(2)", Http2Hpack::getHuffmanEncodedSize("www.example.com"),
+			output.size());
+
+		string decoded;
+		ensure("(3)", Http2Hpack::huffmanDecode(decoded,
+			(const unsigned char *) output.data(), output.size()));
+		ensure_equals("(4)", decoded, "www.example.com");
+
+		string all;
+		for (unsigned int i = 0; i < 256; i++) {
+			all.append(1, (char) i);
+		}
+		output.clear();
+		decoded.clear();
+		Http2Hpack::huffmanEncode(output, all);
+		ensure("(5)", Http2Hpack::huffmanDecode(decoded,
+			(const unsigned char *) output.data(), output.size()));
+		ensure("All byte values survive a round trip", decoded == all);
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("Huffman decoding rejects invalid padding");
+		string decoded;
+		// 'a' is 00011 (5 bits); the remaining 3 bits must be ones.
+		string input = unhex("18");
+		ensure("Padding that is not all ones",
+			!Http2Hpack::huffmanDecode(decoded,
+				(const unsigned char *) input.data(), input.size()));
+
+		input = unhex("1f ff");
+		decoded.clear();
+		ensure("Padding longer than 7 bits",
+			!Http2Hpack::huffmanDecode(decoded,
+				(const unsigned char *) input.data(), input.size()));
+	}
+
+
+	/***** Decoder *****/
+
+	TEST_METHOD(10) {
+		set_test_name("It decodes the request examples with Huffman coding "
+			"from RFC 7541 appendix C.4");
+
+		ensure("(1)", decode("8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff"));
+		ensure_equals(headers.size(), 4u);
+		ensureHeader(0, ":method", "GET");
+		ensureHeader(1, ":scheme", "http");
+		ensureHeader(2, ":path", "/");
+		ensureHeader(3, ":authority", "www.example.com");
+		ensure_equals(decoder.getTable().getSize(), 57u);
+
+		ensure("(2)", decode("8286 84be 5886 a8eb 1064 9cbf"));
+		ensure_equals(headers.size(), 5u);
+		ensureHeader(3, ":authority", "www.example.com");
+		ensureHeader(4, "cache-control", "no-cache");
+		ensure_equals(decoder.getTable().getSize(), 110u);
+
+		ensure("(3)", decode("8287 85bf 4088 25a8 49e9 5ba9 7d7f 8925 a849 e95b b8e8 b4bf"));
+		ensure_equals(headers.size(), 5u);
+		ensureHeader(1, ":scheme", "https");
+		ensureHeader(2, ":path", "/index.html");
+		ensureHeader(3, ":authority", "www.example.com");
+		ensureHeader(4, "custom-key", "custom-value");
+		ensure_equals(decoder.getTable().getSize(), 164u);
+		ensure_equals(decoder.getTable().getCount(), 3u);
+	}
+
+	TEST_METHOD(11) {
+		set_test_name("It evicts entries from the dynamic table when a "
+			"size update shrinks it");
+
+		ensure("(1)", decode("8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff"));
+		ensure("(2)", decode("8286 84be 5886 a8eb 1064 9cbf"));
+		ensure_equals(decoder.getTable().getCount(), 2u);
+
+		// Size update to 60: only the newest entry (53 bytes) fits.
+		ensure("(3)", decode("3f1d 82"));
+		ensure_equals(decoder.getTable().getCount(), 1u);
+		ensure_equals(decoder.getTable().get(1).first, "cache-control");
+	}
+
+	TEST_METHOD(12) {
+		set_test_name("It rejects invalid indices");
+		ensure("Index 0", !decode("80"));
+		ensure("Index beyond the dynamic table", !decode("be"));
+	}
+
+	TEST_METHOD(13) {
+		set_test_name("It rejects dynamic table size updates that exceed "
+			"the limit or that don't appear at the start of a header block");
+		string data;
+
+		Http2Hpack::encodeInteger(data, 0x20, 5, 8192);
+		headers.clear();
+		ensure("(1)", !decoder.decode(data.data(), data.size(), headers));
+
+		ensure("(2)", !decode("82 20"));
+	}
+
+	TEST_METHOD(14) {
+		set_test_name("It rejects header lists larger than the limit");
+		Http2HpackDecoder smallDecoder(4096, 64);
+		Http2HpackEncoder encoder;
+		string data;
+
+		encoder.beginHeaderBlock(data);
+		encoder.encode(data, "x-foo", string(40, 'a'));
+		ensure("(1)", !smallDecoder.decode(data.data(), data.size(), headers));
+	}
+
+
+	/***** Encoder *****/
+
+	TEST_METHOD(20) {
+		set_test_name("Encoded header blocks can be decoded, and repeated "
+			"fields are encoded as indices");
+		Http2HpackEncoder encoder;
+		string first, second;
+
+		encoder.beginHeaderBlock(first);
+		encoder.encode(first, ":status", "200");
+		encoder.encode(first, "content-type", "text/html");
+		encoder.encode(first, "x-powered-by", "Passenger");
+		encoder.encode(first, "date", "Thu, 11 Sep 2014 12:54:09 GMT");
+
+		ensure("(1)", decoder.decode(first.data(), first.size(), headers));
+		ensure_equals(headers.size(), 4u);
+		ensureHeader(0, ":status", "200");
+		ensureHeader(1, "content-type", "text/html");
+		ensureHeader(2, "x-powered-by", "Passenger");
+		ensureHeader(3, "date", "Thu, 11 Sep 2014 12:54:09 GMT");
+		ensure_equals("Volatile fields are not indexed",
+			encoder.getTable().getCount(), 2u);
+		ensure_equals("Tables are in sync",
+			decoder.getTable().getSize(), encoder.getTable().getSize());
+
+		encoder.beginHeaderBlock(second);
+		encoder.encode(second, ":status", "200");
+		encoder.encode(second, "content-type", "text/html");
+		encoder.encode(second, "x-powered-by", "Passenger");
+		ensure_equals("Indexed fields take one byte each", second.size(), 3u);
+
+		headers.clear();
+		ensure("(2)", decoder.decode(second.data(), second.size(), headers));
+		ensure_equals(headers.size(), 3u);
+		ensureHeader(2, "x-powered-by", "Passenger");
+	}
+
+	TEST_METHOD(21) {
+		set_test_name("It signals a smaller peer table size at the start of "
+			"the next header block");
+		Http2HpackEncoder encoder;
+		string data;
+
+		encoder.beginHeaderBlock(data);
+		encoder.encode(data, "x-foo", "bar");
+		ensure("(1)", decoder.decode(data.data(), data.size(), headers));
+
+		encoder.setPeerMaxTableSize(0);
+		data.clear();
+		headers.clear();
+		encoder.beginHeaderBlock(data);
+		encoder.encode(data, "x-foo", "bar");
+		ensure("(2)", decoder.decode(data.data(), data.size(), headers));
+		ensure_equals(encoder.getTable().getCount(), 0u);
+		ensure_equals(decoder.getTable().getCount(), 0u);
+		ensure_equals(decoder.getTable().getMaxSize(), 0u);
+		ensureHeader(0, "x-foo", "bar");
+	}
+}
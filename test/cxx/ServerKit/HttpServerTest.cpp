@@ -149,6 +149,8 @@ namespace tut {
 				testLargeResponse(client, req);
 			} else if (psg_lstr_cmp(&req->path, "/path_test")) {
 				testPath(client, req);
+			} else if (psg_lstr_cmp(&req->path, "/no_response_test")) {
+				// Never respond.
 			} else {
 				testRequest(client, req);
 			}
@@ -240,7 +242,9 @@ namespace tut {
 
 		ServerKit_HttpServerTest()
 			: bg(false, true),
-			  context(bg.safe, bg.libuv_loop)
+			  context(bg.safe, bg.libuv_loop),
+			  h2GoawayCode(0),
+			  h2GoawayReceived(false)
 		{
 			setLogLevel(LVL_WARN);
 			serverSocket = createUnixServer("tmp.server");
@@ -327,6 +331,17 @@ namespace tut {
 			*result = server->totalRequestsBegun;
 		}
 
+		Json::Value inspectServerState() {
+			Json::Value result;
+			bg.safe->runSync(boost::bind(&ServerKit_HttpServerTest::_inspectServerState,
+				this, &result));
+			return result;
+		}
+
+		void _inspectServerState(Json::Value *result) {
+			*result = server->inspectStateAsJson();
+		}
+
 		unsigned int getBodyBytesRead() {
 			unsigned int result;
 			bg.safe->runSync(boost::bind(&ServerKit_HttpServerTest::_getBodyBytesRead,
@@ -406,9 +421,185 @@ namespace tut {
 			} while (true);
 			return result;
 		}
+
+		/***** HTTP/2 client *****/
+
+		struct Http2Frame {
+			unsigned char type;
+			unsigned char flags;
+			unsigned int streamId;
+			string payload;
+		};
+
+		struct Http2Response {
+			Http2HeaderList headers;
+			string body;
+			unsigned int resetCode;
+			bool ended;
+
+			Http2Response()
+				: resetCode(0),
+				  ended(false)
+				{ }
+
+			string getHeader(const StaticString &name) const {
+				for (unsigned int i = 0; i < headers.size(); i++) {
+					if (headers[i].first == name) {
+						return headers[i].second;
+					}
+				}
+				return string();
+			}
+		};
+
+		Http2HpackEncoder h2Encoder;
+		Http2HpackDecoder h2Decoder;
+		map<unsigned int, Http2Response> h2Responses;
+		unsigned int h2GoawayCode;
+		bool h2GoawayReceived;
+
+		static void appendUint32(string &output, unsigned int value) {
+			output.append(1, (char) ((value >> 24) & 0xff));
+			output.append(1, (char) ((value >> 16) & 0xff));
+			output.append(1, (char) ((value >> 8) & 0xff));
+			output.append(1, (char) (value & 0xff));
+		}
+
+		static unsigned int readUint32(const string &data, unsigned int offset) {
+			const unsigned char *p = (const unsigned char *) data.data() + offset;
+			return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+		}
+
+		static string http2Frame(unsigned char type, unsigned char flags,
+			unsigned int streamId, const StaticString &payload)
+		{
+			string result;
+			result.append(1, (char) ((payload.size() >> 16) & 0xff));
+			result.append(1, (char) ((payload.size() >> 8) & 0xff));
+			result.append(1, (char) (payload.size() & 0xff));
+			result.append(1, (char) type);
+			result.append(1, (char) flags);
+			appendUint32(result, streamId);
+			result.append(payload.data(), payload.size());
+			return result;
+		}
+
+		void sendHttp2Preface() {
+			sendRequest(Http2Session::getPreface()
+				+ http2Frame(Http2Session::SETTINGS, 0, 0, ""));
+		}
+
+		string http2RequestHeaders(unsigned int streamId, const StaticString &method,
+			const StaticString &path, bool endStream,
+			const Http2HeaderList &extraHeaders = Http2HeaderList())
+		{
+			string block;
+			h2Encoder.beginHeaderBlock(block);
+			h2Encoder.encode(block, ":method", method);
+			h2Encoder.encode(block, ":scheme", "http");
+			h2Encoder.encode(block, ":authority", "localhost");
+			h2Encoder.encode(block, ":path", path);
+			for (unsigned int i = 0; i < extraHeaders.size(); i++) {
+				h2Encoder.encode(block, extraHeaders[i].first, extraHeaders[i].second);
+			}
+			return http2Frame(Http2Session::HEADERS,
+				Http2Session::FLAG_END_HEADERS
+					| (endStream ? Http2Session::FLAG_END_STREAM : 0),
+				streamId, block);
+		}
+
+		Http2Frame readHttp2Frame() {
+			char header[Http2Session::FRAME_HEADER_SIZE];
+			unsigned long long timeout = 5000000;
+			Http2Frame frame;
+
+			if (io.read(header, sizeof(header), &timeout) != sizeof(header)) {
+				throw EOFException("Connection closed");
+			}
+			const unsigned char *p = (const unsigned char *) header;
+			unsigned int size = (p[0] << 16) | (p[1] << 8) | p[2];
+			frame.type = p[3];
+			frame.flags = p[4];
+			frame.streamId = ((p[5] & 0x7f) << 24) | (p[6] << 16) | (p[7] << 8) | p[8];
+			frame.payload.resize(size);
+			if (size > 0 && io.read(&frame.payload[0], size, &timeout) != size) {
+				throw EOFException("Connection closed");
+			}
+			return frame;
+		}
+
+		/** Returns the state of the first HTTP/2 connection, or null. */
+		Json::Value inspectHttp2SessionState() {
+			Json::Value clients = inspectServerState()["active_clients"];
+			Json::Value::iterator it, end = clients.end();
+			for (it = clients.begin(); it != end; it++) {
+				if ((*it).isMember("http2")) {
+					return (*it)["http2"];
+				}
+			}
+			return Json::Value();
+		}
+
+		/**
+		 * Reads frames and collects responses into `h2Responses` until
+		 * `count` streams have ended, or until a GOAWAY frame is received.
+		 * Replenishes flow control windows for all received data.
+		 */
+		void readHttp2Responses(unsigned int count) {
+			unsigned int ended = 0;
+			string headerBlock;
+
+			while (ended < count && !h2GoawayReceived) {
+				Http2Frame frame = readHttp2Frame();
+				Http2Response &response = h2Responses[frame.streamId];
+
+				switch (frame.type) {
+				case Http2Session::HEADERS:
+				case Http2Session::CONTINUATION:
+					headerBlock.append(frame.payload);
+					if (frame.flags & Http2Session::FLAG_END_HEADERS) {
+						ensure("Header block is valid", h2Decoder.decode(
+							headerBlock.data(), headerBlock.size(), response.headers));
+						headerBlock.clear();
+					}
+					break;
+				case Http2Session::DATA:
+					response.body.append(frame.payload);
+					// After the last frame the server may have already
+					// closed the connection.
+					if (!frame.payload.empty()
+					 && !(frame.flags & Http2Session::FLAG_END_STREAM))
+					{
+						string increment;
+						appendUint32(increment, frame.payload.size());
+						sendRequest(
+							http2Frame(Http2Session::WINDOW_UPDATE, 0, 0, increment)
+							+ http2Frame(Http2Session::WINDOW_UPDATE, 0,
+								frame.streamId, increment));
+					}
+					break;
+				case Http2Session::RST_STREAM:
+					response.resetCode = readUint32(frame.payload, 0);
+					response.ended = true;
+					ended++;
+					continue;
+				case Http2Session::GOAWAY:
+					h2GoawayReceived = true;
+					h2GoawayCode = readUint32(frame.payload, 4);
+					continue;
+				default:
+					continue;
+				}
+
+				if (frame.flags & Http2Session::FLAG_END_STREAM) {
+					response.ended = true;
+					ended++;
+				}
+			}
+		}
 	};
 
-	DEFINE_TEST_GROUP_WITH_LIMIT(ServerKit_HttpServerTest, 100);
+	DEFINE_TEST_GROUP_WITH_LIMIT(ServerKit_HttpServerTest, 110);
 
 
 	/***** Valid HTTP header parsing *****/
@@ -1575,4 +1766,392 @@ namespace tut {
 		string response = readAll(fd);
 		ensure_equals(response, "");
 	}
+
+
+	/***** HTTP/2 *****/
+
+	TEST_METHOD(83) {
+		set_test_name("It accepts HTTP/2 connections with prior knowledge");
+
+		server->http2Enabled = true;
+		connectToServer();
+		sendHttp2Preface();
+		Http2HeaderList extraHeaders;
+		extraHeaders.push_back(Http2Header("foo", "bar"));
+		sendRequest(http2RequestHeaders(1, "GET", "/hello", true, extraHeaders));
+
+		Http2Frame frame = readHttp2Frame();
+		ensure_equals("The server sends its SETTINGS first",
+			(int) frame.type, (int) Http2Session::SETTINGS);
+
+		readHttp2Responses(1);
+		Http2Response &response = h2Responses[1];
+		ensure_equals(response.getHeader(":status"), "200");
+		ensure_equals(response.getHeader("content-type"), "text/plain");
+		ensure_equals(response.getHeader("connection"), "");
+		ensure_equals(response.body, "hello /hello\nFoo: bar");
+	}
+
+	TEST_METHOD(84) {
+		set_test_name("It processes multiple HTTP/2 streams concurrently");
+
+		server->http2Enabled = true;
+		connectToServer();
+		sendHttp2Preface();
+		// Header blocks must be encoded in order, so they're appended one by one.
+		string data = http2RequestHeaders(1, "GET", "/one", true);
+		data.append(http2RequestHeaders(3, "GET", "/two", true));
+		data.append(http2RequestHeaders(5, "GET", "/three", true));
+		sendRequest(data);
+
+		readHttp2Responses(3);
+		ensure_equals(h2Responses[1].body, "hello /one");
+		ensure_equals(h2Responses[3].body, "hello /two");
+		ensure_equals(h2Responses[5].body, "hello /three");
+		ensure_equals(getTotalRequestsBegun(), 3u);
+	}
+
+	TEST_METHOD(85) {
+		set_test_name("HTTP/2 request bodies are passed in DATA frames");
+
+		server->http2Enabled = true;
+		connectToServer();
+		sendHttp2Preface();
+		Http2HeaderList extraHeaders;
+		extraHeaders.push_back(Http2Header("content-length", "11"));
+		string data = http2RequestHeaders(1, "POST", "/body_test", false, extraHeaders);
+		data.append(http2Frame(Http2Session::DATA, 0, 1, "hello "));
+		data.append(http2RequestHeaders(3, "POST", "/body_test", false));
+		data.append(http2Frame(Http2Session::DATA, 0, 3, "abc"));
+		data.append(http2Frame(Http2Session::DATA, Http2Session::FLAG_END_STREAM, 1, "world"));
+		data.append(http2Frame(Http2Session::DATA, Http2Session::FLAG_END_STREAM, 3, "de"));
+		sendRequest(data);
+
+		readHttp2Responses(2);
+		ensure_equals("With content-length", h2Responses[1].body, "11 bytes: hello world");
+		ensure_equals("Without content-length", h2Responses[3].body, "5 bytes: abcde");
+	}
+
+	TEST_METHOD(86) {
+		set_test_name("HTTP/2 responses larger than the flow control window "
+			"are sent as the client replenishes the window");
+
+		server->http2Enabled = true;
+		connectToServer();
+		sendHttp2Preface();
+		Http2HeaderList extraHeaders;
+		extraHeaders.push_back(Http2Header("size", "200000"));
+		sendRequest(http2RequestHeaders(1, "GET", "/large_response", true, extraHeaders));
+
+		readHttp2Responses(1);
+		ensure_equals(h2Responses[1].getHeader(":status"), "200");
+		ensure_equals(h2Responses[1].body, string(200000, 'x'));
+	}
+
+	TEST_METHOD(87) {
+		set_test_name("It supports upgrading HTTP/1.1 connections to HTTP/2");
+
+		server->http2Enabled = true;
+		connectToServer();
+		sendRequest(
+			"GET /upgraded HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: Upgrade, HTTP2-Settings\r\n"
+			"Upgrade: h2c\r\n"
+			"HTTP2-Settings: AAMAAABkAAQAAP__\r\n\r\n");
+		string header = readResponseHeader();
+		ensure(header, startsWith(header, "HTTP/1.1 101"));
+		ensure(header, containsSubstring(header, "Upgrade: h2c"));
+
+		sendHttp2Preface();
+		readHttp2Responses(1);
+		ensure_equals(h2Responses[1].getHeader(":status"), "200");
+		ensure_equals(h2Responses[1].body, "hello /upgraded");
+
+		sendRequest(http2RequestHeaders(3, "GET", "/next", true));
+		readHttp2Responses(1);
+		ensure_equals(h2Responses[3].body, "hello /next");
+	}
+
+	TEST_METHOD(88) {
+		set_test_name("HTTP/2 PING frames are acknowledged");
+
+		server->http2Enabled = true;
+		connectToServer();
+		sendHttp2Preface();
+		sendRequest(http2Frame(Http2Session::PING, 0, 0, "12345678"));
+
+		Http2Frame frame;
+		do {
+			frame = readHttp2Frame();
+		} while (frame.type != Http2Session::PING);
+		ensure_equals(frame.flags, (unsigned char) Http2Session::FLAG_ACK);
+		ensure_equals(frame.payload, "12345678");
+	}
+
+	TEST_METHOD(89) {
+		set_test_name("HTTP/1 requests are still accepted when HTTP/2 is enabled, "
+			"including ones that start like the HTTP/2 preface");
+
+		server->http2Enabled = true;
+		connectToServer();
+		sendRequest(
+			"PUT / HTTP/1.1\r\n"
+			"Connection: close\r\n\r\n");
+		string response = readAll(fd);
+		ensure(response, containsSubstring(response, "HTTP/1.1 200 OK"));
+		ensure(response, containsSubstring(response, "hello /"));
+	}
+
+	TEST_METHOD(90) {
+		set_test_name("HTTP/2 streams beyond the concurrency limit are refused");
+
+		server->http2Enabled = true;
+		server->http2MaxConcurrentStreams = 1;
+		connectToServer();
+		sendHttp2Preface();
+		string data = http2RequestHeaders(1, "POST", "/body_test", false);
+		data.append(http2RequestHeaders(3, "GET", "/", true));
+		sendRequest(data);
+
+		readHttp2Responses(1);
+		ensure_equals(h2Responses[3].resetCode, (unsigned int) Http2Session::REFUSED_STREAM);
+
+		sendRequest(http2Frame(Http2Session::DATA, Http2Session::FLAG_END_STREAM, 1, "ok"));
+		readHttp2Responses(1);
+		ensure_equals(h2Responses[1].body, "2 bytes: ok");
+	}
+
+	TEST_METHOD(91) {
+		set_test_name("Upon shutting down the server, HTTP/2 connections are sent "
+			"a GOAWAY frame and are closed after their streams have finished");
+
+		server->http2Enabled = true;
+		connectToServer();
+		sendHttp2Preface();
+		sendRequest(http2RequestHeaders(1, "POST", "/body_test", false));
+		EVENTUALLY(5,
+			result = getTotalRequestsBegun() == 1;
+		);
+		shutdownServer();
+		readHttp2Responses(1);
+		ensure("(1)", h2GoawayReceived);
+		ensure_equals("(2)", h2GoawayCode, (unsigned int) Http2Session::NO_ERROR);
+
+		sendRequest(http2Frame(Http2Session::DATA, Http2Session::FLAG_END_STREAM, 1, "ok"));
+		h2GoawayReceived = false;
+		readHttp2Responses(1);
+		ensure_equals("(3)", h2Responses[1].body, "2 bytes: ok");
+		// Throws if the server doesn't close the connection.
+		unsigned long long timeout = 5000000;
+		io.readAll(&timeout);
+	}
+
+	/***** Timeouts *****/
+
+	TEST_METHOD(92) {
+		set_test_name("Timeouts are configurable");
+
+		Json::Value config;
+		config["keep_alive_timeout"] = 1000;
+		config["header_read_timeout"] = 2000;
+		config["body_read_timeout"] = 3000;
+		config["response_timeout"] = 4000;
+		server->configure(config);
+		ensure_equals(server->keepAliveTimeout, 1000u);
+		ensure_equals(server->headerReadTimeout, 2000u);
+		ensure_equals(server->bodyReadTimeout, 3000u);
+		ensure_equals(server->responseTimeout, 4000u);
+		ensure_equals(server->getConfigAsJson()["response_timeout"].asUInt(), 4000u);
+	}
+
+	TEST_METHOD(93) {
+		set_test_name("Idle kept-alive connections are closed after the keep-alive timeout");
+
+		server->keepAliveTimeout = 200;
+		connectToServer();
+		sendRequest(
+			"GET / HTTP/1.1\r\n"
+			"Connection: keep-alive\r\n\r\n");
+		string header = readResponseHeader();
+		ensure(header, containsSubstring(header, "HTTP/1.1 200 OK"));
+
+		// Throws if the server doesn't close the connection.
+		unsigned long long timeout = 5000000;
+		io.readAll(&timeout);
+		ensure_equals(inspectServerState()["timeouts"]["keep_alive"].asUInt(), 1u);
+		ensure_equals(context.timerWheel.getTotalExpirations(), 1ull);
+	}
+
+	TEST_METHOD(94) {
+		set_test_name("Clients that don't send the request header in time "
+			"get a 408 response");
+
+		server->headerReadTimeout = 200;
+		connectToServer();
+		sendRequest("GET / HTTP/1.1\r\n");
+		string response = readAll(fd);
+		ensure(response, containsSubstring(response, "HTTP/1.0 408 Request Timeout"));
+		ensure_equals(inspectServerState()["timeouts"]["header_read"].asUInt(), 1u);
+	}
+
+	TEST_METHOD(95) {
+		set_test_name("The request body channel receives an error when the client "
+			"doesn't send body data in time");
+
+		server->bodyReadTimeout = 200;
+		connectToServer();
+		sendRequest(
+			"POST /body_test HTTP/1.1\r\n"
+			"Content-Length: 10\r\n\r\n"
+			"ab");
+		string response = readAll(fd);
+		ensure(response, containsSubstring(response, "HTTP/1.1 422 Unprocessable Entity"));
+		ensure(response, containsSubstring(response,
+			"Request body error: " + string(strerror(ETIMEDOUT))));
+		ensure_equals(inspectServerState()["timeouts"]["body_read"].asUInt(), 1u);
+	}
+
+	TEST_METHOD(96) {
+		set_test_name("The body read timeout doesn't count time during which "
+			"the request handler doesn't consume the body");
+
+		server->bodyReadTimeout = 100;
+		connectToServer();
+		sendRequest(
+			"POST /body_stop_test HTTP/1.1\r\n"
+			"Connection: close\r\n"
+			"Content-Length: 2\r\n\r\n"
+			"ok");
+		EVENTUALLY(5,
+			result = getNumRequestsWaitingToStartAcceptingBody() == 1;
+		);
+		syscalls::usleep(400000);
+		startAcceptingBody();
+		string response = readAll(fd);
+		ensure(response, containsSubstring(response, "2 bytes: ok"));
+		ensure_equals(inspectServerState()["timeouts"]["body_read"].asUInt(), 0u);
+	}
+
+	TEST_METHOD(97) {
+		set_test_name("Requests that don't get a response in time "
+			"get a 504 response");
+
+		server->responseTimeout = 200;
+		connectToServer();
+		sendRequest(
+			"GET /no_response_test HTTP/1.1\r\n"
+			"Connection: keep-alive\r\n\r\n");
+		string response = readAll(fd);
+		ensure(response, containsSubstring(response, "HTTP/1.1 504 Gateway Timeout"));
+		ensure_equals(inspectServerState()["timeouts"]["response"].asUInt(), 1u);
+	}
+
+	TEST_METHOD(98) {
+		set_test_name("HTTP/2 streams beyond the server-wide stream limit are refused, "
+			"over all connections");
+
+		server->http2Enabled = true;
+		server->http2MaxTotalStreams = 1;
+		connectToServer();
+		sendHttp2Preface();
+		Http2Frame frame = readHttp2Frame();
+		ensure_equals("The server sends its SETTINGS first",
+			(int) frame.type, (int) Http2Session::SETTINGS);
+		ensure_equals("SETTINGS_MAX_CONCURRENT_STREAMS is limited as well",
+			readUint32(frame.payload, 2), 1u);
+		sendRequest(http2RequestHeaders(1, "POST", "/body_test", false));
+		EVENTUALLY(5,
+			result = inspectServerState()["http2_stream_count"].asUInt() == 1;
+		);
+		FileDescriptor fd1 = fd;
+		BufferedIO io1 = io;
+
+		connectToServer();
+		h2Encoder = Http2HpackEncoder();
+		sendHttp2Preface();
+		sendRequest(http2RequestHeaders(1, "GET", "/", true));
+		readHttp2Responses(1);
+		ensure_equals(h2Responses[1].resetCode, (unsigned int) Http2Session::REFUSED_STREAM);
+
+		fd = fd1;
+		io = io1;
+		h2Responses.clear();
+		sendRequest(http2Frame(Http2Session::DATA, Http2Session::FLAG_END_STREAM, 1, "ok"));
+		readHttp2Responses(1);
+		ensure_equals(h2Responses[1].body, "2 bytes: ok");
+		EVENTUALLY(5,
+			result = inspectServerState()["http2_stream_count"].asUInt() == 0;
+		);
+	}
+
+	TEST_METHOD(99) {
+		set_test_name("HTTP/2 clients that reset too many streams are sent "
+			"GOAWAY with ENHANCE_YOUR_CALM");
+
+		server->http2Enabled = true;
+		connectToServer();
+		sendHttp2Preface();
+		string data;
+		string errorCode;
+		appendUint32(errorCode, Http2Session::CANCEL);
+		for (unsigned int i = 0; i < 250; i++) {
+			unsigned int streamId = i * 2 + 1;
+			data.append(http2RequestHeaders(streamId, "POST", "/body_test", false));
+			data.append(http2Frame(Http2Session::RST_STREAM, 0, streamId, errorCode));
+		}
+		sendRequest(data);
+
+		readHttp2Responses(250);
+		ensure("(1)", h2GoawayReceived);
+		ensure_equals("(2)", h2GoawayCode, (unsigned int) Http2Session::ENHANCE_YOUR_CALM);
+	}
+
+	TEST_METHOD(100) {
+		set_test_name("HTTP/2 clients that send too many PING frames are sent "
+			"GOAWAY with ENHANCE_YOUR_CALM");
+
+		server->http2Enabled = true;
+		connectToServer();
+		sendHttp2Preface();
+		string data;
+		for (unsigned int i = 0; i < 1100; i++) {
+			data.append(http2Frame(Http2Session::PING, 0, 0, "12345678"));
+		}
+		sendRequest(data);
+
+		readHttp2Responses(1);
+		ensure("(1)", h2GoawayReceived);
+		ensure_equals("(2)", h2GoawayCode, (unsigned int) Http2Session::ENHANCE_YOUR_CALM);
+	}
+
+	TEST_METHOD(101) {
+		set_test_name("HTTP/2 connections stop reading input and responses while "
+			"the client doesn't read its output");
+
+		server->http2Enabled = true;
+		connectToServer();
+		string settings, increment;
+		settings.append(1, '\0');
+		settings.append(1, (char) Http2Session::SETTINGS_INITIAL_WINDOW_SIZE);
+		appendUint32(settings, Http2Session::MAX_WINDOW_SIZE);
+		appendUint32(increment, Http2Session::MAX_WINDOW_SIZE
+			- Http2Session::DEFAULT_WINDOW_SIZE);
+		Http2HeaderList extraHeaders;
+		extraHeaders.push_back(Http2Header("size", "8000000"));
+		sendRequest(Http2Session::getPreface()
+			+ http2Frame(Http2Session::SETTINGS, 0, 0, settings)
+			+ http2Frame(Http2Session::WINDOW_UPDATE, 0, 0, increment)
+			+ http2RequestHeaders(1, "GET", "/large_response", true, extraHeaders));
+
+		EVENTUALLY(5,
+			result = inspectHttp2SessionState()["output_blocked"].asBool();
+		);
+
+		readHttp2Responses(1);
+		ensure_equals("(1)", h2Responses[1].body.size(), 8000000u);
+		EVENTUALLY(5,
+			result = !inspectHttp2SessionState()["output_blocked"].asBool();
+		);
+	}
 }
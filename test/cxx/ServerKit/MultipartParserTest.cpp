@@ -0,0 +1,188 @@
+#include <TestSupport.h>
+#include <ServerKit/MultipartParser.h>
+
+using namespace Passenger;
+using namespace Passenger::ServerKit;
+using namespace std;
+
+namespace tut {
+	struct ServerKit_MultipartParserTest {
+		MultipartParser parser;
+		vector<string> partHeaders;
+		vector<string> partData;
+		unsigned int partsEnded;
+
+		ServerKit_MultipartParserTest()
+			: parser("XyZ"),
+			  partsEnded(0)
+		{
+			parser.onPartBegin = onPartBegin;
+			parser.onPartData = onPartData;
+			parser.onPartEnd = onPartEnd;
+			parser.userData = this;
+		}
+
+		static void onPartBegin(MultipartParser *parser, const StaticString &headers) {
+			ServerKit_MultipartParserTest *self =
+				static_cast<ServerKit_MultipartParserTest *>(parser->userData);
+			self->partHeaders.push_back(headers);
+			self->partData.push_back(string());
+		}
+
+		static void onPartData(MultipartParser *parser, const char *data, size_t size) {
+			ServerKit_MultipartParserTest *self =
+				static_cast<ServerKit_MultipartParserTest *>(parser->userData);
+			self->partData.back().append(data, size);
+		}
+
+		static void onPartEnd(MultipartParser *parser) {
+			ServerKit_MultipartParserTest *self =
+				static_cast<ServerKit_MultipartParserTest *>(parser->userData);
+			self->partsEnded++;
+		}
+
+		void feedBytewise(const StaticString &data) {
+			for (string::size_type i = 0; i < data.size(); i++) {
+				parser.feed(data.data() + i, 1);
+			}
+		}
+	};
+
+	DEFINE_TEST_GROUP(ServerKit_MultipartParserTest);
+
+	static const char BODY[] =
+		"preamble\r\n"
+		"--XyZ\r\n"
+		"Content-Disposition: form-data; name=\"title\"\r\n"
+		"\r\n"
+		"hello\r\n"
+		"--XyZ\r\n"
+		"Content-Disposition: form-data; name=\"file\"; filename=\"a.txt\"\r\n"
+		"Content-Type: text/plain\r\n"
+		"\r\n"
+		"line 1\r\nline 2\r\n--X\r\n--Xy\r\r\n"
+		"--XyZ--\r\n"
+		"epilogue";
+
+	static void
+	ensureBodyParsed(ServerKit_MultipartParserTest *test) {
+		ensure("Done", test->parser.isDone());
+		ensure_equals("Number of parts", test->partHeaders.size(), 2u);
+		ensure_equals("Parts ended", test->partsEnded, 2u);
+		ensure_equals("Headers 1", test->partHeaders[0],
+			"Content-Disposition: form-data; name=\"title\"");
+		ensure_equals("Data 1", test->partData[0], "hello");
+		ensure_equals("Data 2", test->partData[1],
+			"line 1\r\nline 2\r\n--X\r\n--Xy\r");
+	}
+
+	TEST_METHOD(1) {
+		set_test_name("It parses a body that is fed in one piece");
+		ensure_equals(parser.feed(BODY, sizeof(BODY) - 1), sizeof(BODY) - 1);
+		ensureBodyParsed(this);
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("It parses a body that is fed byte by byte");
+		feedBytewise(StaticString(BODY, sizeof(BODY) - 1));
+		ensureBodyParsed(this);
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("It parses a body in every possible two-piece split");
+		StaticString body(BODY, sizeof(BODY) - 1);
+
+		for (string::size_type i = 1; i < body.size(); i++) {
+			ServerKit_MultipartParserTest test;
+			test.parser.feed(body.data(), i);
+			test.parser.feed(body.data() + i, body.size() - i);
+			ensureBodyParsed(&test);
+		}
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("It supports a body without preamble and parts without headers");
+		StaticString body = P_STATIC_STRING(
+			"--XyZ\r\n"
+			"\r\n"
+			"data\r\n"
+			"--XyZ--");
+		parser.feed(body.data(), body.size());
+		ensure("Done", parser.isDone());
+		ensure_equals(partHeaders.size(), 1u);
+		ensure_equals(partHeaders[0], "");
+		ensure_equals(partData[0], "data");
+	}
+
+	TEST_METHOD(5) {
+		set_test_name("It reports garbage after a delimiter");
+		StaticString body = P_STATIC_STRING("--XyZ\r\n\r\ndata\r\n--XyZ-x");
+		parser.feed(body.data(), body.size());
+		ensure("Has error", parser.hasError());
+		ensure_equals(parser.getErrorMessage(), string("invalid data after delimiter"));
+	}
+
+	TEST_METHOD(6) {
+		set_test_name("It reports header blocks that are too large");
+		string body = "--XyZ\r\nX-Foo: ";
+		body.append(MultipartParser::MAX_HEADERS_SIZE, 'a');
+		body.append("\r\n\r\n");
+		parser.feed(body.data(), body.size());
+		ensure("Has error", parser.hasError());
+	}
+
+	TEST_METHOD(7) {
+		set_test_name("It is incomplete if the closing delimiter is missing");
+		StaticString body = P_STATIC_STRING("--XyZ\r\n\r\ndata\r\n--XyZ");
+		parser.feed(body.data(), body.size());
+		ensure("Not done", !parser.isDone());
+		ensure("No error", !parser.hasError());
+		ensure_equals("Parts ended", partsEnded, 1u);
+	}
+
+
+	/***** Header utilities *****/
+
+	TEST_METHOD(10) {
+		set_test_name("parseBoundary()");
+		string boundary;
+
+		ensure("(1)", MultipartParser::parseBoundary(
+			"multipart/form-data; boundary=----abc123", boundary));
+		ensure_equals("(2)", boundary, "----abc123");
+		ensure("(3)", MultipartParser::parseBoundary(
+			"Multipart/Form-Data; charset=utf-8; boundary=\"a b;c\"", boundary));
+		ensure_equals("(4)", boundary, "a b;c");
+		ensure("Other media types", !MultipartParser::parseBoundary(
+			"multipart/mixed; boundary=abc", boundary));
+		ensure("Missing boundary", !MultipartParser::parseBoundary(
+			"multipart/form-data", boundary));
+		ensure("Empty boundary", !MultipartParser::parseBoundary(
+			"multipart/form-data; boundary=\"\"", boundary));
+		ensure("Boundary too long", !MultipartParser::parseBoundary(
+			"multipart/form-data; boundary=" + string(71, 'a'), boundary));
+	}
+
+	TEST_METHOD(11) {
+		set_test_name("getHeader() and getHeaderParameter()");
+		StaticString headers = P_STATIC_STRING(
+			"Content-Disposition: form-data; name=\"upload\"; "
+				"filename=\"my \\\"file\\\".txt\"\r\n"
+			"content-type:  image/png \r\n"
+			"\r\n");
+		string value;
+
+		ensure_equals("(1)", MultipartParser::getHeader(headers, "Content-Type"),
+			StaticString("image/png"));
+		ensure_equals("(2)", MultipartParser::getHeader(headers, "X-Foo"),
+			StaticString());
+
+		StaticString disposition = MultipartParser::getHeader(headers,
+			"content-disposition");
+		ensure("(3)", MultipartParser::getHeaderParameter(disposition, "name", value));
+		ensure_equals("(4)", value, "upload");
+		ensure("(5)", MultipartParser::getHeaderParameter(disposition, "filename", value));
+		ensure_equals("(6)", value, "my \"file\".txt");
+		ensure("(7)", !MultipartParser::getHeaderParameter(disposition, "form-data", value));
+	}
+}
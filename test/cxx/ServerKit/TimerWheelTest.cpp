@@ -0,0 +1,109 @@
+#include <TestSupport.h>
+#include <ServerKit/TimerWheel.h>
+#include <vector>
+
+using namespace Passenger;
+using namespace Passenger::ServerKit;
+using namespace std;
+
+namespace tut {
+	struct ServerKit_TimerWheelTest {
+		TimerWheel wheel;
+		TimerWheelEntry entries[4];
+		vector<TimerWheelEntry *> expired;
+
+		ServerKit_TimerWheelTest() {
+			for (unsigned int i = 0; i < 4; i++) {
+				entries[i].callback = onExpired;
+				entries[i].userData = this;
+			}
+		}
+
+		static void onExpired(TimerWheelEntry *entry) {
+			ServerKit_TimerWheelTest *self =
+				static_cast<ServerKit_TimerWheelTest *>(entry->userData);
+			self->expired.push_back(entry);
+		}
+	};
+
+	DEFINE_TEST_GROUP(ServerKit_TimerWheelTest);
+
+	TEST_METHOD(1) {
+		set_test_name("Timers expire once their timeout has passed, "
+			"rounded up to the next tick");
+		wheel.arm(&entries[0], 250, 1000);
+		wheel.arm(&entries[1], 100, 1000);
+		ensure_equals(wheel.getArmedCount(), 2u);
+
+		wheel.expire(1099);
+		ensure_equals(expired.size(), 0u);
+		wheel.expire(1100);
+		ensure_equals(expired.size(), 1u);
+		ensure(expired[0] == &entries[1]);
+		wheel.expire(1299);
+		ensure_equals(expired.size(), 1u);
+		wheel.expire(1300);
+		ensure_equals(expired.size(), 2u);
+		ensure(expired[1] == &entries[0]);
+		ensure_equals(wheel.getArmedCount(), 0u);
+		ensure_equals(wheel.getTotalExpirations(), 2ull);
+		ensure("Expired entries are disarmed", !entries[0].isArmed());
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("Cancelled timers don't expire");
+		wheel.arm(&entries[0], 100, 1000);
+		wheel.arm(&entries[1], 100, 1000);
+		wheel.cancel(&entries[0]);
+		wheel.cancel(&entries[0]);
+		ensure_equals(wheel.getArmedCount(), 1u);
+		wheel.expire(5000);
+		ensure_equals(expired.size(), 1u);
+		ensure(expired[0] == &entries[1]);
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("Re-arming a timer replaces its timeout");
+		wheel.arm(&entries[0], 100, 1000);
+		wheel.expire(1050);
+		wheel.arm(&entries[0], 500, 1050);
+		ensure_equals(wheel.getArmedCount(), 1u);
+		wheel.expire(1500);
+		ensure_equals(expired.size(), 0u);
+		wheel.expire(1600);
+		ensure_equals(expired.size(), 1u);
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("Timers in higher levels are cascaded down and expire "
+			"at the right tick");
+		// 64 ticks and 4096+ ticks: levels 1 and 2.
+		wheel.arm(&entries[0], 6500, 0);
+		wheel.arm(&entries[1], 500000, 0);
+		wheel.arm(&entries[2], 100, 0);
+
+		wheel.expire(6400);
+		ensure_equals(expired.size(), 1u);
+		wheel.expire(6500);
+		ensure_equals(expired.size(), 2u);
+		ensure(expired[1] == &entries[0]);
+		wheel.expire(499900);
+		ensure_equals(expired.size(), 2u);
+		wheel.expire(500000);
+		ensure_equals(expired.size(), 3u);
+		ensure(expired[2] == &entries[1]);
+	}
+
+	TEST_METHOD(5) {
+		set_test_name("Time that passes while no timers are armed is skipped");
+		wheel.arm(&entries[0], 100, 0);
+		wheel.expire(100);
+		ensure_equals(expired.size(), 1u);
+
+		wheel.arm(&entries[0], 200, 1000000000ull);
+		wheel.expire(1000000100ull);
+		ensure_equals(expired.size(), 1u);
+		wheel.expire(1000000200ull);
+		ensure_equals(expired.size(), 2u);
+	}
+}
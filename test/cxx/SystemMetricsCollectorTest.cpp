@@ -0,0 +1,103 @@
+#include <TestSupport.h>
+#include <Utils/SystemMetricsCollector.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <map>
+#include <utility>
+#include <sstream>
+
+using namespace Passenger;
+
+namespace tut {
+	struct SystemMetricsCollectorTest {
+		SystemMetricsCollector collector;
+		SystemMetrics metrics;
+
+		typedef map< int, pair<dev_t, ino_t> > OpenFiles;
+
+		/** Returns the device and inode number of every open file descriptor. */
+		OpenFiles getOpenFiles() {
+			DIR *dir = opendir("/proc/self/fd");
+			OpenFiles result;
+			struct dirent *ent;
+			struct stat buf;
+
+			while ((ent = readdir(dir)) != NULL) {
+				if (ent->d_name[0] == '.') {
+					continue;
+				}
+				int fd = atoi(ent->d_name);
+				if (fd != dirfd(dir) && fstat(fd, &buf) == 0) {
+					result[fd] = make_pair(buf.st_dev, buf.st_ino);
+				}
+			}
+			closedir(dir);
+			return result;
+		}
+	};
+
+	DEFINE_TEST_GROUP(SystemMetricsCollectorTest);
+
+	TEST_METHOD(1) {
+		// It collects memory, CPU and general metrics.
+		collector.collect(metrics);
+		usleep(20000);
+		collector.collect(metrics);
+
+		ensure("RAM total is known", metrics.ramTotal > 0);
+		ensure("RAM used is known", metrics.ramUsed >= 0);
+		ensure("RAM used <= RAM total", metrics.ramUsed <= metrics.ramTotal);
+		ensure("CPUs are detected", metrics.ncpus() >= 1);
+		ensure("CPU usage >= 0", metrics.avgCpuUsage() >= 0);
+		ensure("CPU usage <= 100", metrics.avgCpuUsage() <= 100);
+		ensure("Load average is known", metrics.loadAverage1 >= 0);
+		ensure("Boot time is known", metrics.boottime > 0);
+		ensure("Kernel version is known", !metrics.kernelVersion.empty());
+	}
+
+	#ifdef __linux__
+		TEST_METHOD(2) {
+			// It detects as many CPUs as the kernel reports. /proc/stat
+			// only lists the CPUs that are online.
+			collector.collect(metrics);
+			ensure_equals(metrics.ncpus(), (unsigned int) sysconf(_SC_NPROCESSORS_ONLN));
+		}
+
+		TEST_METHOD(3) {
+			// It keeps the /proc files open between collections, and
+			// reuses the same file descriptors instead of reopening them.
+			collector.collect(metrics);
+			OpenFiles openFiles = getOpenFiles();
+			for (int i = 0; i < 10; i++) {
+				collector.collect(metrics);
+			}
+			OpenFiles openFilesAfterwards = getOpenFiles();
+			ensure_equals(openFilesAfterwards.size(), openFiles.size());
+			ensure("The same files are open on the same file descriptors",
+				openFilesAfterwards == openFiles);
+		}
+
+		TEST_METHOD(4) {
+			// It collects pressure stall information if the kernel supports it.
+			collector.collect(metrics);
+			if (access("/proc/pressure/cpu", R_OK) == 0) {
+				ensure("CPU pressure is supported", metrics.cpuPressure.supported());
+				for (int i = 0; i < 3; i++) {
+					ensure(metrics.cpuPressure.some[i] >= 0);
+					ensure(metrics.cpuPressure.some[i] <= 100);
+					ensure(metrics.memoryPressure.some[i] >= 0);
+					ensure(metrics.ioPressure.some[i] >= 0);
+				}
+			} else {
+				ensure_equals(metrics.cpuPressure.some[0], -2.0);
+			}
+
+			stringstream xml;
+			metrics.toXml(xml);
+			ensure(containsSubstring(xml.str(), "<pressure_stall><cpu><some><avg10>"));
+		}
+	#endif
+}
@@ -0,0 +1,419 @@
+#include <TestSupport.h>
+#include <UstRouter/RemoteSender.h>
+#include <FileDescriptor.h>
+#include <Utils/IOUtils.h>
+#include <Utils/ScopeGuard.h>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <oxt/thread.hpp>
+#include <oxt/system_calls.hpp>
+#include <sys/socket.h>
+#include <dirent.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <zlib.h>
+#include <modp_b64.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstring>
+
+using namespace Passenger;
+using namespace std;
+using namespace oxt;
+
+namespace tut {
+	/**
+	 * A stand-in for the Union Station gateway, speaking plain HTTP with
+	 * keep-alive. Records all packets that it receives.
+	 */
+	class FakeGateway {
+	public:
+		struct Packet {
+			string key;
+			string nodeName;
+			string category;
+			string data;
+		};
+
+	private:
+		FileDescriptor serverFd;
+		oxt::thread *acceptThread;
+		vector<oxt::thread *> connectionThreads;
+		boost::mutex syncher;
+		vector<Packet> packets;
+		unsigned int connections;
+		string malfunctionKey;
+		unsigned int malfunctions;
+
+		void acceptMain() {
+			while (!this_thread::interruption_requested()) {
+				int fd = syscalls::accept(serverFd, NULL, NULL);
+				if (fd == -1) {
+					return;
+				}
+				boost::lock_guard<boost::mutex> l(syncher);
+				connections++;
+				connectionThreads.push_back(new oxt::thread(
+					boost::bind(&FakeGateway::connectionMain, this, fd),
+					"FakeGateway connection", 1024 * 128));
+			}
+		}
+
+		void connectionMain(int _fd) {
+			FileDescriptor fd(_fd, NULL, 0);
+			string buffer;
+			char tmp[1024 * 16];
+
+			while (true) {
+				string::size_type headerEnd;
+				while ((headerEnd = buffer.find("\r\n\r\n")) == string::npos) {
+					ssize_t ret = syscalls::read(fd, tmp, sizeof(tmp));
+					if (ret <= 0) {
+						return;
+					}
+					buffer.append(tmp, ret);
+				}
+
+				string header = buffer.substr(0, headerEnd + 2);
+				string::size_type bodyStart = headerEnd + 4;
+				size_t contentLength = stringToUint(headerValue(header, "Content-Length"));
+				while (buffer.size() < bodyStart + contentLength) {
+					ssize_t ret = syscalls::read(fd, tmp, sizeof(tmp));
+					if (ret <= 0) {
+						return;
+					}
+					buffer.append(tmp, ret);
+				}
+				string body = buffer.substr(bodyStart, contentLength);
+				buffer.erase(0, bodyStart + contentLength);
+
+				string response;
+				if (startsWith(header, "GET /ping ")) {
+					response = "pong";
+				} else if (handleSink(header, body)) {
+					response = "{\"status\":\"ok\"}";
+				} else {
+					response = "gibberish";
+				}
+				writeExact(fd, "HTTP/1.1 200 OK\r\n"
+					"Content-Length: " + toString(response.size()) + "\r\n"
+					"\r\n" + response);
+			}
+		}
+
+		static string headerValue(const string &header, const string &name) {
+			string::size_type pos = header.find("\r\n" + name + ": ");
+			if (pos == string::npos) {
+				return string();
+			}
+			pos += name.size() + 4;
+			return header.substr(pos, header.find("\r\n", pos) - pos);
+		}
+
+		/** Returns false if the gateway should fail to process the packet. */
+		bool handleSink(const string &header, const string &body) {
+			string contentType = headerValue(header, "Content-Type");
+			string boundary = "--" + contentType.substr(contentType.find("boundary=") + 9);
+			map<string, string> fields;
+			string::size_type pos = 0;
+
+			while ((pos = body.find(boundary, pos)) != string::npos) {
+				pos += boundary.size();
+				string::size_type nameStart = body.find("name=\"", pos);
+				string::size_type contentStart = body.find("\r\n\r\n", pos);
+				if (nameStart == string::npos || contentStart == string::npos) {
+					break;
+				}
+				nameStart += 6;
+				string name = body.substr(nameStart, body.find('"', nameStart) - nameStart);
+				contentStart += 4;
+				string::size_type contentEnd = body.find("\r\n" + boundary, contentStart);
+				fields[name] = body.substr(contentStart, contentEnd - contentStart);
+				pos = contentEnd;
+			}
+
+			Packet packet;
+			packet.key = fields["key"];
+			packet.nodeName = fields["node_name"];
+			packet.category = fields["category"];
+			if (fields["compressed"] == "1") {
+				packet.data = decompress(modp::b64_decode(fields["data"]));
+			} else {
+				packet.data = fields["data"];
+			}
+
+			boost::lock_guard<boost::mutex> l(syncher);
+			if (packet.key == malfunctionKey) {
+				malfunctions++;
+				return false;
+			}
+			packets.push_back(packet);
+			return true;
+		}
+
+		static string decompress(const string &data) {
+			z_stream strm;
+			unsigned char out[1024 * 16];
+			string result;
+			int ret;
+
+			memset(&strm, 0, sizeof(strm));
+			inflateInit(&strm);
+			strm.avail_in = data.size();
+			strm.next_in = (unsigned char *) data.data();
+			do {
+				strm.avail_out = sizeof(out);
+				strm.next_out = out;
+				ret = inflate(&strm, Z_NO_FLUSH);
+				result.append((const char *) out, sizeof(out) - strm.avail_out);
+			} while (ret == Z_OK);
+			inflateEnd(&strm);
+			return result;
+		}
+
+	public:
+		unsigned short port;
+
+		FakeGateway()
+			: acceptThread(NULL),
+			  connections(0),
+			  malfunctions(0)
+		{
+			struct sockaddr_in addr;
+			socklen_t len = sizeof(addr);
+			int yes = 1;
+
+			serverFd.assign(socket(AF_INET, SOCK_STREAM, 0), NULL, 0);
+			setsockopt(serverFd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+			memset(&addr, 0, sizeof(addr));
+			addr.sin_family = AF_INET;
+			addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+			addr.sin_port = 0;
+			if (::bind(serverFd, (const struct sockaddr *) &addr, sizeof(addr)) == -1) {
+				throw SystemException("Cannot bind", errno);
+			}
+			getsockname(serverFd, (struct sockaddr *) &addr, &len);
+			port = ntohs(addr.sin_port);
+		}
+
+		~FakeGateway() {
+			if (acceptThread != NULL) {
+				acceptThread->interrupt_and_join();
+				delete acceptThread;
+			}
+			boost::lock_guard<boost::mutex> l(syncher);
+			foreach (oxt::thread *thr, connectionThreads) {
+				thr->interrupt_and_join();
+				delete thr;
+			}
+		}
+
+		/** Until this is called, connections are refused. */
+		void start() {
+			::listen(serverFd, 16);
+			acceptThread = new oxt::thread(boost::bind(&FakeGateway::acceptMain, this),
+				"FakeGateway", 1024 * 128);
+		}
+
+		vector<Packet> getPackets() {
+			boost::lock_guard<boost::mutex> l(syncher);
+			return packets;
+		}
+
+		unsigned int getConnections() {
+			boost::lock_guard<boost::mutex> l(syncher);
+			return connections;
+		}
+
+		/** Makes the gateway respond with gibberish to packets with the given key. */
+		void malfunctionOnKey(const string &key) {
+			boost::lock_guard<boost::mutex> l(syncher);
+			malfunctionKey = key;
+		}
+
+		unsigned int getMalfunctions() {
+			boost::lock_guard<boost::mutex> l(syncher);
+			return malfunctions;
+		}
+	};
+
+	struct UstRouter_RemoteSenderTest {
+		FakeGateway gateway;
+		RemoteSenderOptions options;
+		boost::shared_ptr<RemoteSender> sender;
+
+		UstRouter_RemoteSenderTest() {
+			options.gatewayAddress = "127.0.0.1";
+			options.gatewayPort = gateway.port;
+			options.useHttps = false;
+			options.maxBatchDelay = 100;
+			setLogLevel(LVL_CRIT);
+		}
+
+		~UstRouter_RemoteSenderTest() {
+			sender.reset();
+			setLogLevel(DEFAULT_LOG_LEVEL);
+		}
+
+		void init() {
+			sender = boost::make_shared<RemoteSender>(options);
+		}
+
+		void schedule(const string &key, const string &category, const string &data) {
+			StaticString str(data);
+			sender->schedule(key, "localhost", category, &str, 1);
+		}
+
+		unsigned int countPackets() {
+			return gateway.getPackets().size();
+		}
+
+		unsigned int countSpillFiles(const string &dir) {
+			DIR *d = opendir(dir.c_str());
+			struct dirent *ent;
+			unsigned int result = 0;
+
+			while ((ent = readdir(d)) != NULL) {
+				if (strstr(ent->d_name, ".batch") != NULL) {
+					result++;
+				}
+			}
+			closedir(d);
+			return result;
+		}
+	};
+
+	DEFINE_TEST_GROUP(UstRouter_RemoteSenderTest);
+
+	TEST_METHOD(1) {
+		set_test_name("It coalesces packets with the same key, node and category into one upload");
+		gateway.start();
+		init();
+		for (int i = 0; i < 10; i++) {
+			schedule("key1", "requests", "data" + toString(i) + "\n");
+		}
+		schedule("key2", "requests", "other\n");
+
+		EVENTUALLY(5,
+			result = countPackets() == 2;
+		);
+		SHOULD_NEVER_HAPPEN(200,
+			result = countPackets() > 2;
+		);
+
+		vector<FakeGateway::Packet> packets = gateway.getPackets();
+		if (packets[0].key != "key1") {
+			std::swap(packets[0], packets[1]);
+		}
+		ensure_equals(packets[0].key, "key1");
+		ensure_equals(packets[0].nodeName, "localhost");
+		ensure_equals(packets[0].category, "requests");
+		ensure_equals(packets[0].data,
+			"data0\ndata1\ndata2\ndata3\ndata4\n"
+			"data5\ndata6\ndata7\ndata8\ndata9\n");
+		ensure_equals(packets[1].key, "key2");
+		ensure_equals(packets[1].data, "other\n");
+
+		Json::Value doc = sender->inspectStateAsJson();
+		ensure_equals(doc["packets_accepted"].asUInt(), 11u);
+		ensure_equals(doc["batches_sent"].asUInt(), 2u);
+		ensure_equals(doc["up_servers"].size(), 1u);
+		ensure_equals(doc["up_servers"][0u]["packets_accepted"].asUInt(), 2u);
+		ensure(doc["up_servers"][0u]["bytes_sent"]["bytes"].asUInt() > 0);
+		ensure(doc["up_servers"][0u]["latency"].isObject());
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("It reuses connections between uploads");
+		options.maxConnections = 2;
+		options.maxBatchSize = 1;
+		gateway.start();
+		init();
+		for (int i = 0; i < 50; i++) {
+			schedule("key", "requests", "data" + toString(i));
+		}
+
+		EVENTUALLY(5,
+			result = countPackets() == 50;
+		);
+		// One extra connection for pinging.
+		ensure("(connections = " + toString(gateway.getConnections()) + ")",
+			gateway.getConnections() <= options.maxConnections + 1);
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("It spills batches to disk while the gateway is down, and sends them later");
+		TempDir tmpdir("tmp.spill");
+		options.spillDir = tmpdir.getPath();
+		init();
+		schedule("key", "requests", "hello");
+
+		EVENTUALLY(5,
+			result = sender->inspectStateAsJson()["spill"]["packets_spilled"].asUInt() == 1;
+		);
+		ensure_equals(countSpillFiles(tmpdir.getPath()), 1u);
+		ensure_equals(sender->inspectStateAsJson()["packets_dropped"].asUInt(), 0u);
+
+		gateway.start();
+		sender->scheduleServerCheckup();
+		EVENTUALLY(5,
+			result = countPackets() == 1;
+		);
+		ensure_equals(gateway.getPackets()[0].data, "hello");
+		EVENTUALLY(5,
+			result = countSpillFiles(tmpdir.getPath()) == 0;
+		);
+		sender.reset();
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("It drops packets while the gateway is down if there is no spill directory");
+		init();
+		schedule("key", "requests", "hello");
+
+		EVENTUALLY(5,
+			result = sender->inspectStateAsJson()["packets_dropped"].asUInt() == 1;
+		);
+	}
+
+	TEST_METHOD(5) {
+		set_test_name("It drops packets when the queue memory limit is reached");
+		options.maxQueueMemory = 10;
+		init();
+		schedule("key", "requests", "12345678901");
+		ensure_equals(sender->inspectStateAsJson()["packets_dropped"].asUInt(), 1u);
+		ensure_equals(sender->queued(), 0u);
+	}
+
+	TEST_METHOD(6) {
+		set_test_name("A batch that the gateway fails to process is dropped"
+			" without marking the gateway down");
+		TempDir tmpdir("tmp.spill");
+		options.spillDir = tmpdir.getPath();
+		gateway.malfunctionOnKey("bad");
+		gateway.start();
+		init();
+		schedule("bad", "requests", "hello");
+
+		EVENTUALLY(5,
+			result = sender->inspectStateAsJson()["packets_dropped"].asUInt() == 1;
+		);
+		ensure_equals(gateway.getMalfunctions(), 1u);
+		ensure_equals(countSpillFiles(tmpdir.getPath()), 0u);
+
+		Json::Value doc = sender->inspectStateAsJson();
+		ensure_equals(doc["up_servers"].size(), 1u);
+		ensure_equals(doc["down_servers"].size(), 0u);
+
+		schedule("good", "requests", "world");
+		EVENTUALLY(5,
+			result = countPackets() == 1;
+		);
+		ensure_equals(gateway.getPackets()[0].key, "good");
+		SHOULD_NEVER_HAPPEN(200,
+			result = gateway.getMalfunctions() > 1;
+		);
+	}
+}
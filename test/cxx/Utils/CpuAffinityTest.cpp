@@ -0,0 +1,126 @@
+#include <TestSupport.h>
+#include <Utils/CpuAffinity.h>
+
+using namespace Passenger;
+using namespace std;
+
+namespace tut {
+	struct CpuAffinityTest {
+		CpuTopology topology;
+
+		CpuAffinityTest() {
+			// Two nodes with 4 CPUs each, numbered like on a typical
+			// 2-socket machine with hyperthreading.
+			topology.cpuNodes.push_back(0);
+			topology.cpuNodes.push_back(0);
+			topology.cpuNodes.push_back(1);
+			topology.cpuNodes.push_back(1);
+			topology.cpuNodes.push_back(0);
+			topology.cpuNodes.push_back(0);
+			topology.cpuNodes.push_back(1);
+			topology.cpuNodes.push_back(1);
+			topology.nodeCount = 2;
+		}
+
+		static CpuList cpus(const char *str) {
+			CpuList result;
+			parseCpuList(str, result);
+			return result;
+		}
+	};
+
+	DEFINE_TEST_GROUP(CpuAffinityTest);
+
+	TEST_METHOD(1) {
+		set_test_name("Parsing and formatting CPU lists");
+		CpuList result;
+		ensure("(1)", parseCpuList("0-3,8,10-11", result));
+		ensure_equals("(2)", result.size(), 7u);
+		ensure_equals("(3)", formatCpuList(result), "0-3,8,10-11");
+		ensure("(4)", parseCpuList("5,1,2,1\n", result));
+		ensure_equals("(5)", formatCpuList(result), "1-2,5");
+		ensure("(6)", !parseCpuList("", result));
+		ensure("(7)", !parseCpuList("3-1", result));
+		ensure("(8)", !parseCpuList("1,a", result));
+		ensure("(9)", !parseCpuList("1-", result));
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("Loading the topology from sysfs");
+		TempDir dir("tmp.nodes");
+		makeDirTree("tmp.nodes/node0");
+		makeDirTree("tmp.nodes/node1");
+		makeDirTree("tmp.nodes/node2");
+		createFile("tmp.nodes/node0/cpulist", "0-1,4-5\n");
+		createFile("tmp.nodes/node1/cpulist", "2-3,6-7\n");
+		// A node without CPUs.
+		createFile("tmp.nodes/node2/cpulist", "\n");
+		createFile("tmp.nodes/possible", "0-2\n");
+
+		CpuTopology loaded;
+		loaded.load("tmp.nodes");
+		ensure_equals("(1)", loaded.nodeCount, 2u);
+		ensure("(2)", loaded.cpuNodes == topology.cpuNodes);
+		ensure_equals("(3)", loaded.getNode(5), 0);
+		ensure_equals("(4)", loaded.getNode(8), -1);
+		ensure_equals("(5)", loaded.getNode(cpus("2-3")), 1);
+		ensure_equals("(6)", loaded.getNode(cpus("1-2")), -1);
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("Without NUMA information, all CPUs are on node 0");
+		CpuTopology loaded;
+		loaded.load("tmp.nonexistant");
+		ensure_equals("(1)", loaded.nodeCount, 1u);
+		ensure_equals("(2)", loaded.getNode(0), 0);
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("By default, threads are bound to one CPU each, "
+			"spread evenly over the NUMA nodes");
+		vector<CpuList> plan = planThreadCpuAffinity(3, topology, cpus("0-7"), "");
+		ensure_equals("(1)", plan.size(), 3u);
+		ensure_equals("(2)", formatCpuList(plan[0]), "0");
+		ensure_equals("(3)", formatCpuList(plan[1]), "2");
+		ensure_equals("(4)", formatCpuList(plan[2]), "1");
+
+		plan = planThreadCpuAffinity(3, topology, cpus("4,6"), "");
+		ensure_equals("(5)", formatCpuList(plan[0]), "4");
+		ensure_equals("(6)", formatCpuList(plan[1]), "6");
+		ensure_equals("Threads wrap around", formatCpuList(plan[2]), "4");
+	}
+
+	TEST_METHOD(5) {
+		set_test_name("Explicitly given CPU lists are assigned to threads in turn");
+		vector<CpuList> plan = planThreadCpuAffinity(3, topology, cpus("0-7"),
+			"0-1,4-5:2-3,6-7");
+		ensure_equals("(1)", plan.size(), 3u);
+		ensure_equals("(2)", formatCpuList(plan[0]), "0-1,4-5");
+		ensure_equals("(3)", formatCpuList(plan[1]), "2-3,6-7");
+		ensure_equals("(4)", formatCpuList(plan[2]), "0-1,4-5");
+
+		try {
+			planThreadCpuAffinity(3, topology, cpus("0-7"), "0-1:x");
+			fail("ArgumentException expected");
+		} catch (const ArgumentException &) {
+			// Success.
+		}
+	}
+
+	TEST_METHOD(6) {
+		set_test_name("Explicitly given CPU lists are limited to the allowed CPUs");
+		vector<CpuList> plan = planThreadCpuAffinity(2, topology, cpus("0-3"),
+			"0-1,4-5:2-3,6-7");
+		ensure_equals("(1)", formatCpuList(plan[0]), "0-1");
+		ensure_equals("(2)", formatCpuList(plan[1]), "2-3");
+		ensure_equals("The planned node is where the thread may run",
+			topology.getNode(plan[1]), 1);
+
+		try {
+			planThreadCpuAffinity(2, topology, cpus("0-3"), "0-1:6-7");
+			fail("ArgumentException expected");
+		} catch (const ArgumentException &) {
+			// Success.
+		}
+	}
+}
@@ -0,0 +1,56 @@
+#include <TestSupport.h>
+#include <Utils/LatencyHistogram.h>
+
+using namespace Passenger;
+using namespace std;
+
+namespace tut {
+	struct LatencyHistogramTest {
+		LatencyHistogram histogram;
+	};
+
+	DEFINE_TEST_GROUP(LatencyHistogramTest);
+
+	TEST_METHOD(1) {
+		set_test_name("An empty histogram");
+		ensure_equals(histogram.getCount(), 0u);
+		ensure_equals(histogram.getMean(), 0u);
+		ensure_equals(histogram.getPercentile(99), 0u);
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("Samples are counted in the bucket with the smallest upper bound that fits them");
+		histogram.add(0);
+		histogram.add(1000);
+		histogram.add(1001);
+		histogram.add(20000000);
+		ensure_equals(histogram.getBucketCount(0), 2u);
+		ensure_equals(histogram.getBucketCount(1), 1u);
+		ensure_equals(histogram.getBucketCount(LatencyHistogram::BUCKETS - 1), 1u);
+		ensure_equals(histogram.getCount(), 4u);
+		ensure_equals(histogram.getSum(), 20002001u);
+		ensure_equals(histogram.getMax(), 20000000u);
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("Percentiles are estimated by bucket upper bounds, capped at the maximum");
+		for (int i = 0; i < 98; i++) {
+			histogram.add(3000);
+		}
+		histogram.add(40000);
+		histogram.add(45000);
+		ensure_equals(histogram.getPercentile(50), 5000u);
+		ensure_equals(histogram.getPercentile(99), 45000u);
+		ensure_equals(histogram.getPercentile(100), 45000u);
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("XML output only contains non-empty buckets");
+		histogram.add(7000);
+		stringstream stream;
+		histogram.toXml(stream);
+		ensure_equals(stream.str(),
+			"<count>1</count><sum>7000</sum><max>7000</max>"
+			"<buckets><bucket><le>10000</le><count>1</count></bucket></buckets>");
+	}
+}
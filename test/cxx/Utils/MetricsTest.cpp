@@ -0,0 +1,70 @@
+#include <TestSupport.h>
+#include <Utils/Metrics.h>
+
+using namespace Passenger;
+using namespace std;
+
+namespace tut {
+	struct MetricsTest {
+		OpenMetricsWriter writer;
+	};
+
+	DEFINE_TEST_GROUP(MetricsTest);
+
+	TEST_METHOD(1) {
+		set_test_name("Counters");
+		MetricCounter counter;
+		ensure_equals(counter.get(), 0u);
+		counter.inc();
+		counter.inc(10);
+		ensure_equals(counter.get(), 11u);
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("Histograms can be collected into a LatencyHistogram, summing them");
+		MetricHistogram histogram1, histogram2;
+		LatencyHistogram result;
+		histogram1.add(500);
+		histogram1.add(3000);
+		histogram2.add(20000000);
+		histogram1.collect(result);
+		histogram2.collect(result);
+		ensure_equals(result.getCount(), 3u);
+		ensure_equals(result.getBucketCount(0), 1u);
+		ensure_equals(result.getBucketCount(2), 1u);
+		ensure_equals(result.getBucketCount(LatencyHistogram::BUCKETS - 1), 1u);
+		ensure_equals(result.getSum(), 20003500u);
+		ensure_equals(result.getMax(), 20000000u);
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("Samples are written in the OpenMetrics text format");
+		writer.declare("passenger_requests", "counter", "Requests.");
+		writer.sample("passenger_requests_total", "", 12);
+		writer.sample("passenger_requests_total",
+			OpenMetricsWriter::label("group", "a\"b\\c\nd"), 3);
+		ensure_equals(writer.finish(),
+			"# TYPE passenger_requests counter\n"
+			"# HELP passenger_requests Requests.\n"
+			"passenger_requests_total 12\n"
+			"passenger_requests_total{group=\"a\\\"b\\\\c\\nd\"} 3\n"
+			"# EOF\n");
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("Histograms are written with cumulative buckets, in seconds");
+		LatencyHistogram histogram;
+		histogram.add(2000);
+		histogram.add(3000);
+		histogram.add(20000000);
+		writer.histogram("wait_seconds", "group=\"x\"", histogram);
+		string result = writer.finish();
+		ensure(result.find("wait_seconds_bucket{group=\"x\",le=\"0.001\"} 0\n") != string::npos);
+		ensure(result.find("wait_seconds_bucket{group=\"x\",le=\"0.0025\"} 1\n") != string::npos);
+		ensure(result.find("wait_seconds_bucket{group=\"x\",le=\"0.005\"} 2\n") != string::npos);
+		ensure(result.find("wait_seconds_bucket{group=\"x\",le=\"10\"} 2\n") != string::npos);
+		ensure(result.find("wait_seconds_bucket{group=\"x\",le=\"+Inf\"} 3\n") != string::npos);
+		ensure(result.find("wait_seconds_count{group=\"x\"} 3\n") != string::npos);
+		ensure(result.find("wait_seconds_sum{group=\"x\"} 20.005\n") != string::npos);
+	}
+}
@@ -0,0 +1,100 @@
+#include <TestSupport.h>
+#include <Utils/TracePointProfiler.h>
+#include <oxt/thread.hpp>
+#include <oxt/backtrace.hpp>
+#include <oxt/system_calls.hpp>
+
+using namespace Passenger;
+using namespace std;
+using namespace oxt;
+
+namespace tut {
+	static void sleepInTracePoint() {
+		TRACE_POINT();
+		while (true) {
+			syscalls::usleep(1000000);
+		}
+	}
+
+	static string recurseInTracePoints(unsigned int depth) {
+		TRACE_POINT();
+		if (depth == 0) {
+			return oxt::thread::current_backtrace();
+		} else {
+			return recurseInTracePoints(depth - 1);
+		}
+	}
+
+	static void pushAndPopTracePoints(unsigned int depth) {
+		TRACE_POINT();
+		if (depth > 0) {
+			pushAndPopTracePoints(depth - 1);
+		}
+	}
+
+	static void churnTracePoints() {
+		while (true) {
+			for (unsigned int i = 0; i < 1000; i++) {
+				pushAndPopTracePoints(i % 32);
+			}
+			boost::this_thread::interruption_point();
+		}
+	}
+
+	struct TracePointProfilerTest {
+		TracePointProfiler profiler;
+		oxt::thread *thread;
+
+		TracePointProfilerTest() {
+			thread = new oxt::thread(sleepInTracePoint, "Sleeper");
+		}
+
+		~TracePointProfilerTest() {
+			thread->interrupt_and_join();
+			delete thread;
+		}
+	};
+
+	DEFINE_TEST_GROUP(TracePointProfilerTest);
+
+	TEST_METHOD(1) {
+		set_test_name("The backtrace of another thread is read from its shadow stack");
+		EVENTUALLY(5,
+			result = thread->backtrace().find("sleepInTracePoint") != string::npos;
+		);
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("Samples are attributed to the innermost trace point of each thread");
+		EVENTUALLY(5,
+			profiler.sample();
+			result = profiler.report().find("sleepInTracePoint") != string::npos;
+		);
+		ensure(profiler.getSampleCount() > 0);
+		ensure(profiler.report().find("TracePointProfilerTest.cpp:") != string::npos);
+
+		profiler.reset();
+		ensure_equals(profiler.getSampleCount(), 0ull);
+		ensure(profiler.report().find("sleepInTracePoint") == string::npos);
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("Trace points beyond the maximum depth are counted but not stored");
+		string backtrace = recurseInTracePoints(OXT_MAX_BACKTRACE_DEPTH + 10);
+		ensure(backtrace.find("innermost trace points omitted") != string::npos);
+		ensure(oxt::thread::current_backtrace().find("omitted") == string::npos);
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("Reading the backtrace of a thread that keeps pushing and "
+			"popping trace points never sees unwritten slots");
+		oxt::thread churner(churnTracePoints, "Churner");
+		string backtrace;
+		for (unsigned int i = 0; i < 2000; i++) {
+			profiler.sample();
+			backtrace = churner.backtrace();
+		}
+		churner.interrupt_and_join();
+		ensure(!backtrace.empty());
+	}
+}
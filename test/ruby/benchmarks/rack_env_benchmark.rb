@@ -0,0 +1,134 @@
+#!/usr/bin/env ruby
+# Compares the time it takes to build a Rack env from a session protocol
+# header block, and to serialize Rack response headers, using the per-key
+# Ruby code that Passenger used before versus the native_support functions.
+#
+# Usage: ruby test/ruby/benchmarks/rack_env_benchmark.rb [ITERATIONS]
+
+source_root = File.expand_path(File.dirname(__FILE__) + "/../../..")
+$LOAD_PATH.unshift("#{source_root}/src/ruby_supportlib")
+require 'phusion_passenger'
+PhusionPassenger.locate_directories
+PhusionPassenger.require_passenger_lib 'utils/native_support_utils'
+require 'benchmark'
+
+if !defined?(PhusionPassenger::NativeSupport)
+  abort "passenger_native_support is not available. Please run 'rake native_support' first."
+end
+
+include PhusionPassenger
+NativeSupportUtils = Utils::NativeSupportUtils
+
+ITERATIONS = (ARGV[0] || 200_000).to_i
+
+HEADERS_DATA = [
+  "REQUEST_URI", "/api/v1/users/123.json?fields=name,email",
+  "PATH_INFO", "/api/v1/users/123.json",
+  "SCRIPT_NAME", "",
+  "QUERY_STRING", "fields=name,email",
+  "REQUEST_METHOD", "GET",
+  "SERVER_NAME", "www.example.com",
+  "SERVER_PORT", "443",
+  "SERVER_SOFTWARE", "nginx/1.8.0 Phusion_Passenger/5.0.22",
+  "SERVER_PROTOCOL", "HTTP/1.1",
+  "REMOTE_ADDR", "203.0.113.17",
+  "REMOTE_PORT", "53624",
+  "HTTPS", "on",
+  "PASSENGER_CONNECT_PASSWORD", "abcdefghijklmnop",
+  "HTTP_HOST", "www.example.com",
+  "HTTP_USER_AGENT", "Mozilla/5.0 (X11; Linux x86_64; rv:42.0) Gecko/20100101 Firefox/42.0",
+  "HTTP_ACCEPT", "application/json",
+  "HTTP_ACCEPT_LANGUAGE", "en-US,en;q=0.5",
+  "HTTP_ACCEPT_ENCODING", "gzip, deflate",
+  "HTTP_COOKIE", "_session_id=0123456789abcdef0123456789abcdef",
+  "HTTP_CONNECTION", "keep-alive"
+].join("\0") + "\0"
+
+RACK_ENV_TEMPLATE = {
+  "rack.version"      => [1, 2],
+  "rack.errors"       => STDERR,
+  "rack.multithread"  => false,
+  "rack.multiprocess" => true,
+  "rack.run_once"     => false,
+  "rack.hijack?"      => true
+}.freeze
+
+RESPONSE_STATUS = 200
+RESPONSE_HEADERS = {
+  "Content-Type" => "application/json; charset=utf-8",
+  "Cache-Control" => "max-age=0, private, must-revalidate",
+  "ETag" => "W/\"0123456789abcdef0123456789abcdef\"",
+  "X-Request-Id" => "01234567-89ab-cdef-0123-456789abcdef",
+  "X-Runtime" => "0.004512",
+  "Set-Cookie" => "_session_id=0123456789abcdef; path=/; HttpOnly\nlocale=en; path=/"
+}
+
+# The way the Rack env used to be built.
+def build_env_in_ruby(data)
+  env = NativeSupportUtils.split_by_null_into_hash(data)
+  env["rack.version"]      = [1, 2]
+  env["rack.errors"]       = STDERR
+  env["rack.multithread"]  = false
+  env["rack.multiprocess"] = true
+  env["rack.run_once"]     = false
+  if env["HTTPS"] == "yes" || env["HTTPS"] == "on" || env["HTTPS"] == "1"
+    env["rack.url_scheme"] = "https"
+  else
+    env["rack.url_scheme"] = "http"
+  end
+  env["rack.hijack?"] = true
+  env
+end
+
+# The way the response headers used to be serialized.
+def generate_headers_in_ruby(status, headers)
+  result = ["HTTP/1.1 #{status} Whatever\r\n"]
+  headers.each do |key, values|
+    if values.is_a?(String)
+      values = values.split("\n")
+    elsif key == "rack.hijack"
+      next
+    else
+      values = values.to_s.split("\n")
+    end
+    values.each do |value|
+      result << key
+      result << ": "
+      result << value
+      result << "\r\n"
+    end
+  end
+  result
+end
+
+if build_env_in_ruby(HEADERS_DATA) != NativeSupportUtils.split_by_null_into_rack_env(HEADERS_DATA, RACK_ENV_TEMPLATE)
+  abort "The Ruby and native Rack envs differ!"
+end
+if generate_headers_in_ruby(RESPONSE_STATUS, RESPONSE_HEADERS).join !=
+   NativeSupportUtils.generate_rack_headers(RESPONSE_STATUS, RESPONSE_HEADERS)
+  abort "The Ruby and native response headers differ!"
+end
+
+def measure(label)
+  GC.start
+  gc_count = GC.count
+  time = Benchmark.realtime do
+    ITERATIONS.times { yield }
+  end
+  printf("%-30s %7.3f us per iteration, %5d GC runs\n", label,
+    time * 1_000_000 / ITERATIONS, GC.count - gc_count)
+  time
+end
+
+puts "Iterations: #{ITERATIONS}"
+ruby_time   = measure("Env (Ruby)")   { build_env_in_ruby(HEADERS_DATA) }
+native_time = measure("Env (native)") do
+  NativeSupportUtils.split_by_null_into_rack_env(HEADERS_DATA, RACK_ENV_TEMPLATE)
+end
+printf("%-30s %7.1fx\n", "Env speedup", ruby_time / native_time)
+
+ruby_time   = measure("Headers (Ruby)") { generate_headers_in_ruby(RESPONSE_STATUS, RESPONSE_HEADERS) }
+native_time = measure("Headers (native)") do
+  NativeSupportUtils.generate_rack_headers(RESPONSE_STATUS, RESPONSE_HEADERS)
+end
+printf("%-30s %7.1fx\n", "Headers speedup", ruby_time / native_time)
@@ -35,6 +35,47 @@ describe Utils do
     split_by_null_into_hash("\0\0").should == { "" => "" }
   end
 
+  specify "#split_by_null_into_rack_env works" do
+    template = { "rack.version" => [1, 2], "rack.run_once" => false }.freeze
+    env = split_by_null_into_rack_env("REQUEST_METHOD\0GET\0HTTPS\0on\0", template)
+    env.should == {
+      "rack.version" => [1, 2],
+      "rack.run_once" => false,
+      "REQUEST_METHOD" => "GET",
+      "HTTPS" => "on",
+      "rack.url_scheme" => "https"
+    }
+    env.should_not be_frozen
+    env.keys.each { |key| key.should be_frozen }
+    env["REQUEST_METHOD"].should_not be_frozen
+    template.size.should == 2
+
+    split_by_null_into_rack_env("", template).should == {
+      "rack.version" => [1, 2],
+      "rack.run_once" => false,
+      "rack.url_scheme" => "http"
+    }
+    split_by_null_into_rack_env("HTTPS\0off\0", template)["rack.url_scheme"].should == "http"
+  end
+
+  specify "#generate_rack_headers works" do
+    headers = {
+      "Content-Type" => "text/html",
+      "Set-Cookie" => "a=1\nb=2\n",
+      "X-Number" => 3,
+      "X-Empty" => "",
+      "rack.hijack" => lambda { }
+    }
+    generate_rack_headers(200, headers).should ==
+      "HTTP/1.1 200 Whatever\r\n" +
+      "Content-Type: text/html\r\n" +
+      "Set-Cookie: a=1\r\n" +
+      "Set-Cookie: b=2\r\n" +
+      "X-Number: 3\r\n"
+    generate_rack_headers("404 Not Found", [["X-Foo", "bar"]]).should ==
+      "HTTP/1.1 404 Not Found Whatever\r\nX-Foo: bar\r\n"
+  end
+
   ######################
 end
 